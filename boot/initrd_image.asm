@@ -0,0 +1,38 @@
+; =============================================================================
+; Chanux OS - Initramfs Disk Image
+; =============================================================================
+; What Stage 2 loads from the sector after the kernel image: one header
+; sector, then the cpio archive (scripts/mkinitramfs.c) from the next
+; sector on. A disk without this header boots without an initramfs.
+;
+; Built by the Makefile with:
+;   INITRD_PAYLOAD  Path of the archive (build/initramfs.cpio)
+; =============================================================================
+
+[BITS 16]
+
+%include "boot.inc"
+
+%ifndef INITRD_PAYLOAD
+    %error "INITRD_PAYLOAD not defined"
+%endif
+
+; =============================================================================
+; Header
+; =============================================================================
+header:
+    dd IRD_MAGIC                                ; IRD_OFF_MAGIC
+    dd (payload_end - payload + 511) / 512      ; IRD_OFF_SECTORS
+    dd payload_end - payload                    ; IRD_OFF_BYTES
+
+    times 512 - ($ - $$) db 0
+
+; =============================================================================
+; Payload
+; =============================================================================
+payload:
+    incbin INITRD_PAYLOAD
+payload_end:
+
+    ; Whole sectors, so the last read stays inside the image
+    times (512 - ($ - $$) % 512) % 512 db 0
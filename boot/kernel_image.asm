@@ -0,0 +1,46 @@
+; =============================================================================
+; Chanux OS - Kernel Disk Image
+; =============================================================================
+; What Stage 2 loads from sector KERNEL_START_SECTOR: one header sector,
+; then the kernel binary (raw or LZ4-compressed) from the next sector on.
+;
+; Built by the Makefile with:
+;   KERNEL_PAYLOAD  Path of the payload (build/kernel.bin or build/kernel.lz4)
+;   KERNEL_FLAGS    0, or KIMG_FLAG_LZ4 for a compressed payload
+;   KERNEL_SIZE     Size of build/kernel.bin in bytes
+; =============================================================================
+
+[BITS 16]
+
+%include "boot.inc"
+
+%ifndef KERNEL_PAYLOAD
+    %error "KERNEL_PAYLOAD not defined"
+%endif
+
+; The compressed payload is staged above the kernel's final location
+%if (KERNEL_FLAGS & KIMG_FLAG_LZ4) && (KERNEL_LOAD_ADDR + KERNEL_SIZE > KERNEL_STAGE_ADDR)
+    %error "kernel overlaps KERNEL_STAGE_ADDR; raise it in boot.inc"
+%endif
+
+; =============================================================================
+; Header
+; =============================================================================
+header:
+    dd KIMG_MAGIC                               ; KIMG_OFF_MAGIC
+    dd KERNEL_FLAGS                             ; KIMG_OFF_FLAGS
+    dd (payload_end - payload + 511) / 512      ; KIMG_OFF_SECTORS
+    dd payload_end - payload                    ; KIMG_OFF_BYTES
+    dd KERNEL_SIZE                              ; KIMG_OFF_SIZE
+
+    times 512 - ($ - $$) db 0
+
+; =============================================================================
+; Payload
+; =============================================================================
+payload:
+    incbin KERNEL_PAYLOAD
+payload_end:
+
+    ; Whole sectors, so the last read stays inside the image
+    times (512 - ($ - $$) % 512) % 512 db 0
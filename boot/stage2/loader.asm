@@ -6,10 +6,12 @@
 ; Responsibilities:
 ;   1. Enable A20 line (access memory above 1MB)
 ;   2. Get memory map from BIOS (E820)
-;   3. Load kernel from disk to temporary address
+;   3. Load the kernel image above 1MB (to 1MB itself, or to
+;      KERNEL_STAGE_ADDR if it is LZ4-compressed), then the initramfs
+;      archive, if the disk has one, to INITRD_LOAD_ADDR
 ;   4. Set up GDT for protected mode
 ;   5. Enter 32-bit protected mode
-;   6. Copy kernel to 1MB
+;   6. Decompress the kernel to 1MB (compressed images only)
 ;   7. Set up page tables for long mode
 ;   8. Enable PAE and long mode
 ;   9. Jump to kernel
@@ -23,9 +25,6 @@
 
 %include "boot.inc"
 
-; Temporary kernel load address (in low memory, accessible in real mode)
-KERNEL_TEMP_ADDR    equ 0x10000     ; 64KB mark
-
 ; =============================================================================
 ; Stage 2 Entry Point
 ; =============================================================================
@@ -75,7 +74,7 @@ stage2_start:
     int 0x10
 
     ; ==========================================================================
-    ; Step 3: Load Kernel from Disk to Temporary Address
+    ; Step 3: Load Kernel Image from Disk
     ; ==========================================================================
     ; Print message inline
     mov ah, 0x0E
@@ -130,6 +129,8 @@ stage2_start:
     mov al, 0x0A
     int 0x10
 
+    call load_initrd
+
     ; ==========================================================================
     ; Step 4: Enter Protected Mode
     ; ==========================================================================
@@ -172,23 +173,37 @@ protected_mode_entry:
     call print_string_32
 
     ; ==========================================================================
-    ; Step 5: Copy Kernel from Temporary Address to 1MB
+    ; Step 5: Decompress Kernel to 1MB
     ; ==========================================================================
-    ; Now that we're in protected mode, we can access all 4GB of memory
+    ; A raw kernel is already in place; a compressed one was staged at
+    ; KERNEL_STAGE_ADDR and expands straight into its final location.
 
-    add edi, 160                ; Next line
-    mov esi, msg_copying
+    test dword [kernel_flags], KIMG_FLAG_LZ4
+    jz .kernel_in_place
+
+    mov edi, VGA_MEMORY + 160   ; Line 1
+    mov esi, msg_decompress
     call print_string_32
 
-    ; Copy kernel from KERNEL_TEMP_ADDR to KERNEL_LOAD_ADDR
-    mov esi, KERNEL_TEMP_ADDR   ; Source: 0x10000
-    mov edi, KERNEL_LOAD_ADDR   ; Destination: 0x100000 (1MB)
-    mov ecx, (KERNEL_SECTORS * 512) / 4  ; Number of dwords to copy
-    rep movsd
+    mov esi, KERNEL_STAGE_ADDR
+    mov ecx, [kernel_payload_bytes]
+    mov edi, KERNEL_LOAD_ADDR
+    call lz4_decompress
+
+    ; The output must come out at exactly the size the image recorded
+    sub edi, KERNEL_LOAD_ADDR
+    cmp edi, [kernel_size]
+    je .kernel_in_place
 
-    add edi, 160                ; Next line (edi was modified, recalculate)
-    mov edi, VGA_MEMORY + 320
-    mov esi, msg_copy_ok
+    mov edi, VGA_MEMORY + 320   ; Line 2
+    mov esi, msg_lz4_error
+    call print_string_32
+    cli
+    hlt
+
+.kernel_in_place:
+    mov edi, VGA_MEMORY + 320   ; Line 2
+    mov esi, msg_kernel_ok
     call print_string_32
 
     ; ==========================================================================
@@ -347,6 +362,9 @@ get_memory_map:
     xor bp, bp                  ; Entry counter
 
 .loop:
+    cmp bp, MEMORY_MAP_MAX      ; No room for more in boot_info_t
+    jae .done
+
     mov eax, 0xE820             ; E820 function
     mov ecx, 24                 ; Size of entry (24 bytes)
     mov edx, 0x534D4150         ; "SMAP" signature
@@ -374,34 +392,174 @@ get_memory_map:
     ret
 
 ; -----------------------------------------------------------------------------
-; load_kernel - Load kernel from disk to temporary address
+; load_kernel - Load the kernel image to its place above 1MB
 ; -----------------------------------------------------------------------------
-; Uses BIOS INT 13h with chunked reads for compatibility
+; Reads the header sector (see boot/kernel_image.asm), then the payload in
+; BOOT_READ_SECTORS chunks with INT 13h AH=42h. Each chunk lands in the
+; KERNEL_BOUNCE_ADDR buffer and is moved above 1MB with INT 15h AH=87h:
+; straight to KERNEL_LOAD_ADDR for a raw kernel, to KERNEL_STAGE_ADDR for
+; a compressed one.
 ; -----------------------------------------------------------------------------
 load_kernel:
-    pusha
+    pushad
+    push fs
 
-    ; Initialize variables
-    mov word [sectors_remaining], KERNEL_SECTORS
+    ; Header
     mov dword [current_lba], KERNEL_START_SECTOR
-    mov word [current_segment], KERNEL_TEMP_ADDR >> 4  ; 0x1000
+    mov ax, 1
+    call read_chunk
+
+    mov ax, KERNEL_BOUNCE_ADDR >> 4
+    mov fs, ax
+    cmp dword [fs:KIMG_OFF_MAGIC], KIMG_MAGIC
+    jne .bad_image
+
+    mov eax, [fs:KIMG_OFF_FLAGS]
+    mov [kernel_flags], eax
+    mov eax, [fs:KIMG_OFF_SECTORS]
+    mov [sectors_remaining], eax
+    mov eax, [fs:KIMG_OFF_BYTES]
+    mov [kernel_payload_bytes], eax
+    mov eax, [fs:KIMG_OFF_SIZE]
+    mov [kernel_size], eax
+
+    mov dword [current_dest], KERNEL_LOAD_ADDR
+    test dword [kernel_flags], KIMG_FLAG_LZ4
+    jz .read
+    mov dword [current_dest], KERNEL_STAGE_ADDR
+
+.read:
+    call load_chunks
+
+    pop fs
+    popad
+    ret
+
+.bad_image:
+    mov si, msg_bad_image
+    call print_string_16
+    cli
+    hlt
+
+.error:
+    mov si, msg_disk_error
+    call print_string_16
+    cli
+    hlt
+
+; -----------------------------------------------------------------------------
+; load_initrd - Load the initramfs archive, if the disk has one
+; -----------------------------------------------------------------------------
+; The sector after the kernel image holds an initramfs header when the
+; disk carries an archive (see boot/initrd_image.asm); the archive is
+; moved to INITRD_LOAD_ADDR the same way as the kernel. Its address and
+; size go into boot_info_t for the kernel, which unpacks it into ramfs;
+; both stay 0 without one.
+; -----------------------------------------------------------------------------
+load_initrd:
+    pushad
+    push fs
+
+    mov dword [BOOT_INFO_INITRD_ADDR], 0
+    mov dword [BOOT_INFO_INITRD_ADDR + 4], 0
+    mov dword [BOOT_INFO_INITRD_SIZE], 0
+    mov dword [BOOT_INFO_INITRD_SIZE + 4], 0
+
+    ; Header (current_lba is just past the kernel image)
+    mov ax, 1
+    call read_chunk
+
+    mov ax, KERNEL_BOUNCE_ADDR >> 4
+    mov fs, ax
+    cmp dword [fs:IRD_OFF_MAGIC], IRD_MAGIC
+    jne .done                   ; No initramfs
+
+    mov si, msg_initrd
+    call print_string_16
+
+    mov ebx, [fs:IRD_OFF_BYTES]
+    cmp ebx, INITRD_MAX_SIZE
+    ja .too_large
+
+    mov eax, [fs:IRD_OFF_SECTORS]
+    mov [sectors_remaining], eax
+    mov dword [current_dest], INITRD_LOAD_ADDR
+    call load_chunks
+
+    mov dword [BOOT_INFO_INITRD_ADDR], INITRD_LOAD_ADDR
+    mov [BOOT_INFO_INITRD_SIZE], ebx
+
+    mov si, msg_done
+    call print_string_16
+
+.done:
+    pop fs
+    popad
+    ret
+
+.too_large:
+    ; Boot on without it
+    mov si, msg_initrd_large
+    call print_string_16
+    jmp .done
+
+; -----------------------------------------------------------------------------
+; load_chunks - Read sectors_remaining sectors from current_lba to
+; current_dest (above 1MB), BOOT_READ_SECTORS at a time
+; -----------------------------------------------------------------------------
+load_chunks:
+    pushad
 
 .read_loop:
-    ; Determine how many sectors to read (max 64 per call for safety)
-    mov ax, [sectors_remaining]
-    test ax, ax
+    ; Largest read the BIOS is guaranteed to take
+    mov eax, [sectors_remaining]
+    test eax, eax
     jz .done                    ; Done if no sectors remaining
 
-    cmp ax, 64
+    cmp eax, BOOT_READ_SECTORS
     jbe .use_remaining
-    mov ax, 64
+    mov eax, BOOT_READ_SECTORS
 .use_remaining:
+    call read_chunk
+
+    ; Move the chunk above 1MB (CX = words)
+    mov eax, [current_dest]
+    mov [move_dst_base_low], ax
+    shr eax, 16
+    mov [move_dst_base_mid], al
+    mov [move_dst_base_high], ah
+
+    mov cx, [dap_count]
+    shl cx, 8                   ; * 256 words per sector
+    mov ah, 0x87
+    mov si, move_gdt            ; ES:SI = descriptor table (ES = 0)
+    int 0x15
+    jc load_kernel.error
+
+    ; Update counters
+    movzx eax, word [dap_count]
+    sub [sectors_remaining], eax
+    shl eax, 9                  ; * 512
+    add [current_dest], eax
+
+    jmp .read_loop
+
+.done:
+    popad
+    ret
+
+; -----------------------------------------------------------------------------
+; read_chunk - Read sectors at current_lba into the bounce buffer
+; Input: AX = sector count (1 to BOOT_READ_SECTORS)
+; Advances current_lba
+; -----------------------------------------------------------------------------
+read_chunk:
+    pushad
 
     ; Fill in DAP
     mov word [dap_count], ax
     mov word [dap_offset], 0
-    mov cx, [current_segment]
-    mov word [dap_segment], cx
+    mov word [dap_segment], KERNEL_BOUNCE_ADDR >> 4
     mov ecx, [current_lba]
     mov dword [dap_lba], ecx
     mov dword [dap_lba + 4], 0
@@ -411,38 +569,24 @@ load_kernel:
     mov dl, [boot_drive]
     mov si, dap
     int 0x13
-
-    jc .error
-
-    ; Update counters
-    mov ax, [dap_count]
-    sub [sectors_remaining], ax
+    jc load_kernel.error
 
     ; Add to LBA (32-bit add)
     movzx eax, word [dap_count]
     add [current_lba], eax
 
-    ; Update segment (add sectors * 512 / 16 = sectors * 32)
-    mov ax, [dap_count]
-    shl ax, 5                   ; * 32
-    add [current_segment], ax
-
-    jmp .read_loop
-
-.done:
-    popa
+    popad
     ret
 
-.error:
-    mov si, msg_disk_error
-    call print_string_16
-    cli
-    hlt
+; Variables for load_kernel, load_initrd and load_chunks
+sectors_remaining:    dd 0
+current_lba:          dd 0
+current_dest:         dd 0
 
-; Variables for load_kernel
-sectors_remaining: dw 0
-current_lba:       dd 0
-current_segment:   dw 0
+; From the image header, for the decompression step
+kernel_flags:         dd 0
+kernel_payload_bytes: dd 0
+kernel_size:          dd 0
 
 ; Disk Address Packet for extended read
 align 4
@@ -458,6 +602,32 @@ dap_segment:
 dap_lba:
     dq 0                        ; LBA (64-bit)
 
+; Descriptor table for INT 15h AH=87h (move extended memory block)
+align 8
+move_gdt:
+    times 16 db 0               ; Null and table descriptors (BIOS use)
+
+    ; Source: the bounce buffer
+    dw 0xFFFF                   ; Limit
+    dw KERNEL_BOUNCE_ADDR & 0xFFFF  ; Base (low)
+    db KERNEL_BOUNCE_ADDR >> 16 ; Base (middle)
+    db 0x93                     ; Access: Present, Data, Writable
+    db 0x00                     ; Limit (high)
+    db 0x00                     ; Base (high)
+
+    ; Destination: set for each chunk
+    dw 0xFFFF                   ; Limit
+move_dst_base_low:
+    dw 0                        ; Base (low)
+move_dst_base_mid:
+    db 0                        ; Base (middle)
+    db 0x93                     ; Access: Present, Data, Writable
+    db 0x00                     ; Limit (high)
+move_dst_base_high:
+    db 0                        ; Base (high)
+
+    times 16 db 0               ; BIOS code and stack descriptors
+
 ; -----------------------------------------------------------------------------
 ; print_string_16 - Print string in real mode
 ; Input: SI = pointer to string
@@ -546,6 +716,94 @@ setup_page_tables:
     popa
     ret
 
+; -----------------------------------------------------------------------------
+; lz4_decompress - Expand an LZ4 legacy frame
+; Input: ESI = frame, ECX = frame size, EDI = destination
+; Output: EDI = end of the decompressed data
+; -----------------------------------------------------------------------------
+; A legacy frame is a magic number, then blocks of up to 8MB, each a
+; 32-bit compressed size followed by LZ4 sequences.
+; -----------------------------------------------------------------------------
+lz4_decompress:
+    push eax
+    push ebx
+    push ecx
+    push edx
+    push esi
+    push ebp
+
+    cld
+    lea ebp, [esi + ecx]        ; End of the frame
+    add esi, 4                  ; Skip LZ4_LEGACY_MAGIC
+
+.block:
+    cmp esi, ebp
+    jae .done
+    mov edx, [esi]              ; Compressed block size
+    add esi, 4
+    add edx, esi                ; End of the block
+
+.sequence:
+    ; Token: literal length (high nibble), match length - 4 (low nibble)
+    movzx ebx, byte [esi]
+    inc esi
+
+    mov eax, ebx
+    shr eax, 4
+    call lz4_length
+    mov ecx, eax
+    rep movsb                   ; Literals
+
+    ; The last sequence of a block is literals only
+    cmp esi, edx
+    jae .block
+
+    movzx ecx, word [esi]       ; Match offset, back from the output
+    add esi, 2
+
+    mov eax, ebx
+    and eax, 0x0F
+    call lz4_length
+    add eax, 4                  ; Minimum match length
+
+    push esi
+    mov esi, edi
+    sub esi, ecx
+    mov ecx, eax
+    rep movsb                   ; Byte by byte: a match may overlap its output
+    pop esi
+    jmp .sequence
+
+.done:
+    pop ebp
+    pop esi
+    pop edx
+    pop ecx
+    pop ebx
+    pop eax
+    ret
+
+; -----------------------------------------------------------------------------
+; lz4_length - Add the extension bytes of a length field
+; Input: EAX = 4-bit length from the token, ESI = next input byte
+; Output: EAX = full length, ESI advanced past the extension
+; -----------------------------------------------------------------------------
+lz4_length:
+    cmp eax, 15
+    jne .done
+    push ebx
+
+.more:
+    movzx ebx, byte [esi]       ; 255 means another byte follows
+    inc esi
+    add eax, ebx
+    cmp ebx, 255
+    je .more
+
+    pop ebx
+.done:
+    ret
+
 ; -----------------------------------------------------------------------------
 ; print_string_32 - Print string to VGA memory (32-bit mode)
 ; Input: EDI = VGA memory address, ESI = string pointer
@@ -663,10 +921,14 @@ msg_kernel:     db "  Loading kernel... ", 0
 msg_pmode:      db "  Entering protected mode...", 0x0D, 0x0A, 0
 msg_done:       db "OK", 0x0D, 0x0A, 0
 msg_disk_error: db "Disk error!", 0x0D, 0x0A, 0
+msg_bad_image:  db "Bad kernel image!", 0x0D, 0x0A, 0
+msg_initrd:     db "  Loading initramfs... ", 0
+msg_initrd_large: db "too large, skipped", 0x0D, 0x0A, 0
 
 msg_pmode_ok:   db "Protected Mode (32-bit) - OK", 0
-msg_copying:    db "Copying kernel to 1MB...", 0
-msg_copy_ok:    db "Kernel copy complete", 0
+msg_decompress: db "Decompressing kernel (LZ4)...", 0
+msg_kernel_ok:  db "Kernel ready at 1MB", 0
+msg_lz4_error:  db "Kernel decompression failed!", 0
 msg_pages_ok:   db "Page Tables configured", 0
 msg_lmode_ok:   db "Long Mode (64-bit) - Jumping to kernel...", 0
 
@@ -0,0 +1,336 @@
+/**
+ * =============================================================================
+ * Chanux OS - ACPI Table Discovery Implementation
+ * =============================================================================
+ * RSDP search order (ACPI spec 5.2.5.1):
+ *   1. First 1KB of the Extended BIOS Data Area
+ *   2. BIOS read-only area 0xE0000 - 0xFFFFF
+ * Both lie in the first megabyte, which is always direct-mapped. The RSDT
+ * or XSDT and the tables it points to are mapped on demand.
+ * =============================================================================
+ */
+
+#include "../../include/acpi.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/mm/vmm.h"
+#include "../../drivers/vga/vga.h"
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static acpi_madt_info_t madt_info;
+static acpi_numa_info_t numa_info;
+
+/* Root table (RSDT holds 32-bit pointers, XSDT 64-bit ones) */
+static const acpi_sdt_header_t* root_table = NULL;
+static bool root_is_xsdt = false;
+
+/* =============================================================================
+ * Helpers
+ * =============================================================================
+ */
+
+/* ACPI checksums: all bytes of the structure sum to zero */
+static bool acpi_checksum_ok(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+/* Look for a valid RSDP on 16-byte boundaries in [start, end) */
+static const acpi_rsdp_t* acpi_scan_rsdp(phys_addr_t start, phys_addr_t end) {
+    for (phys_addr_t p = ALIGN_UP(start, 16); p + 20 <= end; p += 16) {
+        const acpi_rsdp_t* rsdp = (const acpi_rsdp_t*)PHYS_TO_VIRT(p);
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum_ok(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+static const acpi_rsdp_t* acpi_find_rsdp(void) {
+    phys_addr_t ebda = (phys_addr_t)(*(volatile uint16_t*)PHYS_TO_VIRT(ACPI_EBDA_PTR)) << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        const acpi_rsdp_t* rsdp = acpi_scan_rsdp(ebda, ebda + 1024);
+        if (rsdp) return rsdp;
+    }
+    return acpi_scan_rsdp(ACPI_BIOS_START, ACPI_BIOS_END);
+}
+
+/* Map a whole table: the header first, then as much as it says it spans */
+static const acpi_sdt_header_t* acpi_map_table(phys_addr_t phys) {
+    const acpi_sdt_header_t* header = vmm_map_mmio(phys, sizeof(acpi_sdt_header_t));
+    if (!header || header->length < sizeof(acpi_sdt_header_t)) {
+        return NULL;
+    }
+
+    const acpi_sdt_header_t* table = vmm_map_mmio(phys, header->length);
+    if (!table || !acpi_checksum_ok(table, table->length)) {
+        return NULL;
+    }
+    return table;
+}
+
+/* =============================================================================
+ * Table Lookup
+ * =============================================================================
+ */
+
+const acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    if (!root_table) {
+        return NULL;
+    }
+
+    size_t entry_size = root_is_xsdt ? 8 : 4;
+    size_t entries = (root_table->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    const uint8_t* base = (const uint8_t*)root_table + sizeof(acpi_sdt_header_t);
+
+    for (size_t i = 0; i < entries; i++) {
+        phys_addr_t phys = root_is_xsdt ? ((const uint64_t*)base)[i]
+                                        : ((const uint32_t*)base)[i];
+        const acpi_sdt_header_t* table = acpi_map_table(phys);
+        if (table && memcmp(table->signature, signature, 4) == 0) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+/* =============================================================================
+ * MADT Parsing
+ * =============================================================================
+ */
+
+static void acpi_parse_madt(const acpi_madt_t* madt) {
+    madt_info.lapic_phys = madt->lapic_address;
+    madt_info.has_8259 = (madt->flags & 1) != 0;
+
+    const uint8_t* p = (const uint8_t*)madt + sizeof(acpi_madt_t);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+
+    while (p + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t* entry = (const acpi_madt_entry_t*)p;
+        if (entry->length < sizeof(acpi_madt_entry_t) || p + entry->length > end) {
+            break;
+        }
+
+        switch (entry->type) {
+        case ACPI_MADT_LAPIC: {
+            uint8_t apic_id = p[3];
+            uint32_t flags = *(const uint32_t*)(p + 4);
+            if ((flags & ACPI_MADT_LAPIC_ENABLED) && madt_info.cpu_count < ACPI_MAX_CPUS) {
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = apic_id;
+            }
+            break;
+        }
+        case ACPI_MADT_IOAPIC:
+            if (madt_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t* io = &madt_info.ioapics[madt_info.ioapic_count++];
+                io->id = p[2];
+                io->phys = *(const uint32_t*)(p + 4);
+                io->gsi_base = *(const uint32_t*)(p + 8);
+            }
+            break;
+        case ACPI_MADT_OVERRIDE:
+            if (madt_info.override_count < ACPI_MAX_OVERRIDES) {
+                acpi_override_t* ovr = &madt_info.overrides[madt_info.override_count++];
+                ovr->source = p[3];
+                ovr->gsi = *(const uint32_t*)(p + 4);
+                ovr->flags = *(const uint16_t*)(p + 8);
+            }
+            break;
+        case ACPI_MADT_LAPIC_OVERRIDE:
+            madt_info.lapic_phys = *(const uint64_t*)(p + 4);
+            break;
+        default:
+            break;
+        }
+
+        p += entry->length;
+    }
+
+    madt_info.found = true;
+}
+
+/* =============================================================================
+ * SRAT and SLIT Parsing
+ * =============================================================================
+ */
+
+/* Node for a proximity domain, numbering new domains as they turn up */
+static uint32_t acpi_domain_node(uint32_t domain) {
+    for (uint32_t i = 0; i < numa_info.node_count; i++) {
+        if (numa_info.domains[i] == domain) {
+            return i;
+        }
+    }
+    if (numa_info.node_count >= ACPI_MAX_NODES) {
+        return 0;
+    }
+    numa_info.domains[numa_info.node_count] = domain;
+    return numa_info.node_count++;
+}
+
+static void acpi_add_cpu_node(uint32_t apic_id, uint32_t domain) {
+    if (apic_id > 0xFF || numa_info.cpu_count >= ACPI_MAX_CPUS) {
+        return;
+    }
+    numa_info.cpu_apic_ids[numa_info.cpu_count] = (uint8_t)apic_id;
+    numa_info.cpu_nodes[numa_info.cpu_count++] = (uint8_t)acpi_domain_node(domain);
+}
+
+static void acpi_parse_srat(const acpi_srat_t* srat) {
+    const uint8_t* p = (const uint8_t*)srat + sizeof(acpi_srat_t);
+    const uint8_t* end = (const uint8_t*)srat + srat->header.length;
+
+    /* Renumbering starts over: node 0 is the first domain listed */
+    numa_info.node_count = 0;
+
+    while (p + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t* entry = (const acpi_madt_entry_t*)p;
+        if (entry->length < sizeof(acpi_madt_entry_t) || p + entry->length > end) {
+            break;
+        }
+
+        switch (entry->type) {
+        case ACPI_SRAT_LAPIC:
+            if (entry->length >= 16 && (*(const uint32_t*)(p + 4) & ACPI_SRAT_ENABLED)) {
+                uint32_t domain = p[2] | ((uint32_t)p[9] << 8) |
+                                  ((uint32_t)p[10] << 16) | ((uint32_t)p[11] << 24);
+                acpi_add_cpu_node(p[3], domain);
+            }
+            break;
+        case ACPI_SRAT_MEMORY:
+            if (entry->length >= 40 && (*(const uint32_t*)(p + 28) & ACPI_SRAT_ENABLED) &&
+                numa_info.mem_count < ACPI_MAX_MEM_RANGES) {
+                acpi_mem_range_t* range = &numa_info.mem[numa_info.mem_count++];
+                range->node = acpi_domain_node(*(const uint32_t*)(p + 2));
+                range->base = *(const uint64_t*)(p + 8);
+                range->length = *(const uint64_t*)(p + 16);
+            }
+            break;
+        case ACPI_SRAT_X2APIC:
+            if (entry->length >= 24 && (*(const uint32_t*)(p + 12) & ACPI_SRAT_ENABLED)) {
+                acpi_add_cpu_node(*(const uint32_t*)(p + 8), *(const uint32_t*)(p + 4));
+            }
+            break;
+        default:
+            break;
+        }
+
+        p += entry->length;
+    }
+
+    if (numa_info.node_count == 0) {
+        numa_info.node_count = 1;
+    }
+    numa_info.found = true;
+}
+
+static void acpi_parse_slit(const acpi_slit_t* slit) {
+    uint64_t count = slit->locality_count;
+    const uint8_t* matrix = (const uint8_t*)slit + sizeof(acpi_slit_t);
+    if (sizeof(acpi_slit_t) + count * count > slit->header.length) {
+        return;
+    }
+
+    for (uint32_t from = 0; from < numa_info.node_count; from++) {
+        for (uint32_t to = 0; to < numa_info.node_count; to++) {
+            uint64_t a = numa_info.domains[from];
+            uint64_t b = numa_info.domains[to];
+            if (a < count && b < count) {
+                numa_info.distance[from][to] = matrix[a * count + b];
+            }
+        }
+    }
+}
+
+/* One node holding everything, at the usual distances */
+static void acpi_numa_defaults(void) {
+    memset(&numa_info, 0, sizeof(numa_info));
+    numa_info.node_count = 1;
+    for (uint32_t from = 0; from < ACPI_MAX_NODES; from++) {
+        for (uint32_t to = 0; to < ACPI_MAX_NODES; to++) {
+            numa_info.distance[from][to] = (from == to) ? ACPI_SLIT_LOCAL : ACPI_SLIT_REMOTE;
+        }
+    }
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+int acpi_init(void) {
+    memset(&madt_info, 0, sizeof(madt_info));
+    acpi_numa_defaults();
+
+    const acpi_rsdp_t* rsdp = acpi_find_rsdp();
+    if (!rsdp) {
+        kprintf("[ACPI] No RSDP found\n");
+        return -1;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address != 0 &&
+        acpi_checksum_ok(rsdp, rsdp->length)) {
+        root_table = acpi_map_table(rsdp->xsdt_address);
+        root_is_xsdt = root_table != NULL;
+    }
+    if (!root_table) {
+        root_table = acpi_map_table(rsdp->rsdt_address);
+    }
+    if (!root_table) {
+        kprintf("[ACPI] Root table is missing or corrupt\n");
+        return -1;
+    }
+
+    const acpi_madt_t* madt = (const acpi_madt_t*)acpi_find_table("APIC");
+    if (!madt) {
+        kprintf("[ACPI] No MADT\n");
+        return -1;
+    }
+    acpi_parse_madt(madt);
+
+    /* NUMA layout is optional: without a SRAT everything is node 0 */
+    const acpi_srat_t* srat = (const acpi_srat_t*)acpi_find_table("SRAT");
+    if (srat) {
+        acpi_parse_srat(srat);
+        const acpi_slit_t* slit = (const acpi_slit_t*)acpi_find_table("SLIT");
+        if (slit) {
+            acpi_parse_slit(slit);
+        }
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[ACPI] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("%s, %d CPUs, %d I/O APICs, LAPIC at 0x%x, %d NUMA node%s\n",
+            root_is_xsdt ? "XSDT" : "RSDT", madt_info.cpu_count,
+            madt_info.ioapic_count, (uint32_t)madt_info.lapic_phys,
+            numa_info.node_count, numa_info.node_count == 1 ? "" : "s");
+
+    return 0;
+}
+
+const acpi_madt_info_t* acpi_madt(void) {
+    return &madt_info;
+}
+
+const acpi_numa_info_t* acpi_numa(void) {
+    return &numa_info;
+}
+
+uint32_t acpi_cpu_node(uint32_t apic_id) {
+    for (uint32_t i = 0; i < numa_info.cpu_count; i++) {
+        if (numa_info.cpu_apic_ids[i] == apic_id) {
+            return numa_info.cpu_nodes[i];
+        }
+    }
+    return 0;
+}
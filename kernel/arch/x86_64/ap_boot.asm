@@ -0,0 +1,142 @@
+; =============================================================================
+; Chanux OS - Application Processor Trampoline
+; =============================================================================
+; Real-mode entry point for application processors.
+;
+; smp_init() copies everything between ap_trampoline_start and
+; ap_trampoline_end to AP_TRAMPOLINE_ADDR and sends a STARTUP IPI with
+; vector AP_TRAMPOLINE_ADDR >> 12. The AP starts here in 16-bit real mode
+; with CS:IP = 0x0800:0000 and walks the same path as the loader:
+;
+;   16-bit real mode -> 32-bit protected mode -> 64-bit long mode
+;
+; then calls params.entry(params.cpu) on params.stack. Only one AP goes
+; through the trampoline at a time, so a single parameter block is enough.
+;
+; Code here runs at its copied address, not its link address, so every
+; absolute reference goes through TRAMP().
+; =============================================================================
+
+AP_TRAMPOLINE_ADDR  equ 0x8000          ; Must match smp.h
+
+CR0_PE              equ (1 << 0)
+CR0_PG              equ (1 << 31)
+CR4_PAE             equ (1 << 5)
+EFER_MSR            equ 0xC0000080
+EFER_LME            equ (1 << 8)
+EFER_NXE            equ (1 << 11)
+
+%define TRAMP(x)    ((x) - ap_trampoline_start + AP_TRAMPOLINE_ADDR)
+
+section .rodata
+
+global ap_trampoline_start
+global ap_trampoline_params
+global ap_trampoline_end
+
+; =============================================================================
+; 16-bit Real Mode
+; =============================================================================
+
+align 16
+ap_trampoline_start:
+    bits 16
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    lgdt [TRAMP(ap_gdt_ptr)]
+
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+
+    jmp dword 0x08:TRAMP(ap_pm32)
+
+; =============================================================================
+; 32-bit Protected Mode
+; =============================================================================
+
+    bits 32
+ap_pm32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; PAE paging on the kernel's page tables (identity map included)
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+
+    mov eax, [TRAMP(ap_trampoline_params.cr3)]
+    mov cr3, eax
+
+    ; Long mode and NX, as on the boot CPU
+    mov ecx, EFER_MSR
+    rdmsr
+    or eax, EFER_LME | EFER_NXE
+    wrmsr
+
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+
+    jmp 0x18:TRAMP(ap_lm64)
+
+; =============================================================================
+; 64-bit Long Mode
+; =============================================================================
+
+    bits 64
+ap_lm64:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov rsp, [TRAMP(ap_trampoline_params.stack)]
+    xor rbp, rbp
+    mov rdi, [TRAMP(ap_trampoline_params.cpu)]
+    mov rax, [TRAMP(ap_trampoline_params.entry)]
+    call rax
+
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+; =============================================================================
+; Temporary GDT
+; =============================================================================
+; Replaced by the CPU's own GDT in ap_main().
+
+align 16
+ap_gdt:
+    dq 0                                ; 0x00: Null
+    dq 0x00CF9A000000FFFF               ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF               ; 0x10: Data
+    dq 0x00AF9A000000FFFF               ; 0x18: 64-bit code
+ap_gdt_end:
+
+ap_gdt_ptr:
+    dw ap_gdt_end - ap_gdt - 1
+    dd TRAMP(ap_gdt)
+
+; =============================================================================
+; Parameters (filled in by smp_init() in the copy)
+; =============================================================================
+
+align 8
+ap_trampoline_params:
+.cr3:       dq 0                        ; Kernel PML4 (below 4GB)
+.stack:     dq 0                        ; Initial RSP (idle process stack)
+.entry:     dq 0                        ; void ap_main(cpu_t* cpu)
+.cpu:       dq 0                        ; Argument for entry
+
+ap_trampoline_end:
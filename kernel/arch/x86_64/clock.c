@@ -0,0 +1,208 @@
+/**
+ * =============================================================================
+ * Chanux OS - TSC Clock Source and APIC Clock Events
+ * =============================================================================
+ * The TSC is measured against CLOCK_CALIBRATE_TICKS PIT ticks. Conversions
+ * use 32.32 fixed point factors so the hot paths are one multiply:
+ *
+ *   ns     = base_ns + (tsc - base_tsc) * ns_per_cycle >> 32
+ *   cycles = (ns - base_ns) * cycles_per_ns >> 32
+ *
+ * The (64 x 64 -> 128 bit) products keep this exact for the lifetime of
+ * the machine; only a multiply is needed, no 128-bit division.
+ * =============================================================================
+ */
+
+#include "../../include/clock.h"
+#include "../../include/kernel.h"
+#include "../../include/drivers/lapic.h"
+#include "../../include/drivers/pit.h"
+#include "../../drivers/vga/vga.h"
+
+/* PIT ticks to measure the TSC over (100ms) */
+#define CLOCK_CALIBRATE_TICKS   10
+
+/* Longest single APIC count interval; later deadlines are re-armed */
+#define CLOCK_MAX_ONESHOT_NS    NSEC_PER_SEC
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static uint64_t tsc_khz = 0;
+static uint64_t ns_per_cycle = 0;       /* 32.32 */
+static uint64_t cycles_per_ns = 0;      /* 32.32 */
+
+/* Calibration point: clock_ns() == base_ns when rdtsc() == base_tsc */
+static uint64_t base_tsc = 0;
+static uint64_t base_ns = 0;
+
+/* Can go tickless (TSC and APIC timer both usable) */
+static bool oneshot_capable = false;
+static bool tsc_deadline = false;
+
+/* Tickless mode active */
+static volatile bool oneshot_active = false;
+
+/* =============================================================================
+ * Clock Source
+ * =============================================================================
+ */
+
+static void clock_calibrate(void) {
+    /* Start on a tick edge */
+    uint64_t start = pit_get_ticks();
+    while (pit_get_ticks() == start) {
+        halt();
+    }
+
+    uint64_t tick0 = pit_get_ticks();
+    uint64_t tsc0 = rdtsc();
+    pit_sleep_ticks(CLOCK_CALIBRATE_TICKS);
+    uint64_t tsc1 = rdtsc();
+    uint64_t tick1 = pit_get_ticks();
+
+    uint64_t elapsed_ms = (tick1 - tick0) * PIT_MS_PER_TICK;
+    tsc_khz = (tsc1 - tsc0) / elapsed_ms;
+    if (tsc_khz == 0) {
+        return;
+    }
+
+    ns_per_cycle = (NSEC_PER_MSEC << 32) / tsc_khz;
+    cycles_per_ns = (tsc_khz << 32) / NSEC_PER_MSEC;
+
+    /* Continue from the PIT's notion of uptime */
+    base_tsc = tsc1;
+    base_ns = tick1 * PIT_MS_PER_TICK * NSEC_PER_MSEC;
+}
+
+uint64_t clock_ns(void) {
+    if (tsc_khz == 0) {
+        return pit_get_ticks() * PIT_MS_PER_TICK * NSEC_PER_MSEC;
+    }
+
+    uint64_t delta = rdtsc() - base_tsc;
+    return base_ns + (uint64_t)(((unsigned __int128)delta * ns_per_cycle) >> 32);
+}
+
+/* TSC value at which clock_ns() reaches 'ns' */
+static uint64_t clock_ns_to_tsc(uint64_t ns) {
+    if (ns <= base_ns) {
+        return base_tsc;
+    }
+    return base_tsc + (uint64_t)(((unsigned __int128)(ns - base_ns) * cycles_per_ns) >> 32);
+}
+
+uint64_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * ns_per_cycle) >> 32);
+}
+
+bool clock_get_scale(uint64_t* tsc_base, uint64_t* ns_base, uint64_t* ns_per_cycle_out) {
+    if (tsc_khz == 0) {
+        return false;
+    }
+    *tsc_base = base_tsc;
+    *ns_base = base_ns;
+    *ns_per_cycle_out = ns_per_cycle;
+    return true;
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+int clock_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    if (!(edx & (1U << 4))) {
+        kprintf("[CLOCK] No TSC, staying on the 100Hz PIT\n");
+        return -1;
+    }
+    tsc_deadline = (ecx & (1U << 24)) != 0;
+
+    bool invariant = false;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        invariant = (edx & (1U << 8)) != 0;
+    }
+
+    clock_calibrate();
+    if (tsc_khz == 0) {
+        kprintf("[CLOCK] TSC calibration failed, staying on the 100Hz PIT\n");
+        return -1;
+    }
+
+    oneshot_capable = lapic_is_ready() && (tsc_deadline || lapic_timer_tick_count() != 0);
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[CLOCK] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    /* kprintf has no field widths: print the three kHz digits one by one */
+    uint32_t khz = (uint32_t)(tsc_khz % 1000);
+    kprintf("TSC %d.%d%d%d MHz%s, clock events: %s\n",
+            (int)(tsc_khz / 1000), khz / 100, (khz / 10) % 10, khz % 10,
+            invariant ? " (invariant)" : "",
+            !oneshot_capable ? "periodic" :
+            tsc_deadline ? "TSC-deadline" : "APIC one-shot");
+
+    return oneshot_capable ? 0 : -1;
+}
+
+bool clock_oneshot(void) {
+    return oneshot_active;
+}
+
+void clock_start(void) {
+    if (!oneshot_capable) {
+        return;
+    }
+
+    /* From here on pit_get_ticks() is derived from clock_ns() */
+    pit_stop();
+    oneshot_active = true;
+}
+
+/* =============================================================================
+ * Clock Events
+ * =============================================================================
+ */
+
+void clock_event_program(uint64_t deadline_ns) {
+    if (tsc_deadline) {
+        lapic_timer_deadline(clock_ns_to_tsc(deadline_ns));
+        return;
+    }
+
+    uint64_t now = clock_ns();
+    uint64_t delta = deadline_ns > now ? deadline_ns - now : 0;
+    if (delta > CLOCK_MAX_ONESHOT_NS) {
+        delta = CLOCK_MAX_ONESHOT_NS;
+    }
+
+    /* lapic_timer_tick_count() units per 10ms tick */
+    uint64_t per_tick = lapic_timer_tick_count();
+    uint64_t count = delta * per_tick / (PIT_MS_PER_TICK * NSEC_PER_MSEC);
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > 0xFFFFFFFFULL) {
+        count = 0xFFFFFFFFULL;
+    }
+    lapic_timer_oneshot((uint32_t)count);
+}
+
+void clock_event_stop(void) {
+    if (tsc_deadline) {
+        lapic_timer_deadline(0);
+    } else {
+        lapic_timer_oneshot(0);
+    }
+}
@@ -69,6 +69,7 @@ extern syscall_set_kernel_stack
 ;   RSI = new_rsp      - RSP value to load for new process
 ;   RDX = new_rsp0     - RSP0 value for TSS (kernel stack top of new process)
 ;   RCX = new_cr3      - CR3 value for new process (0 = don't switch)
+;                        May carry a PCID and the no-flush bit (63)
 ;
 ; This function:
 ;   1. Saves callee-saved registers (rbx, rbp, r12-r15) on current stack
@@ -137,9 +138,11 @@ context_switch:
     ; Debug: Print '2' before CR3 switch
     DEBUG_SERIAL_CHAR '2'
 
-    ; Check if CR3 is actually different
+    ; Check if CR3 is actually different (bit 63 never reads back)
     mov rax, cr3
-    cmp rax, rcx
+    mov rdx, rcx
+    btr rdx, 63
+    cmp rax, rdx
     je .skip_cr3_switch
 
     ; Switch to new address space
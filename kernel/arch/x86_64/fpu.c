@@ -0,0 +1,351 @@
+/**
+ * =============================================================================
+ * Chanux OS - FPU/SSE Support
+ * =============================================================================
+ * Enables x87/SSE (and AVX where XSAVE is available) on each CPU, lends
+ * the registers to kernel code through kernel_fpu_begin()/end() and
+ * switches them between user processes lazily.
+ *
+ * Kernel sections save the borrowed state with FXSAVE into a per-CPU
+ * slot; interrupts stay off for the whole section, so nothing else on
+ * this CPU can switch processes or start another section meanwhile.
+ * CR0.TS is cleared for the duration and restored afterwards. The SSE2
+ * kernels only use legacy SSE encodings, which leave the upper YMM
+ * halves alone, so FXSAVE is enough even with AVX enabled.
+ *
+ * Process state, per CPU:
+ *   - fpu_owner: the process whose state the registers hold (it is also
+ *     in that process's save area unless fpu_live)
+ *   - fpu_live: the current process has used the FPU since it was
+ *     switched in (CR0.TS is clear exactly while this is set)
+ *
+ * A process records the CPU it last loaded its state on (fpu_cpu). If it
+ * comes back to that CPU and is still the owner there, #NM only clears
+ * TS; otherwise the state is reloaded from its save area.
+ * =============================================================================
+ */
+
+#include "../../include/fpu.h"
+#include "../../include/kernel.h"
+#include "../../include/smp.h"
+#include "../../include/string.h"
+#include "../../include/mm/slab.h"
+#include "../../include/proc/process.h"
+#include "../../drivers/vga/vga.h"
+
+/* =============================================================================
+ * Definitions
+ * =============================================================================
+ */
+
+/* XCR0 components */
+#define XCR0_X87            0x1
+#define XCR0_SSE            0x2
+#define XCR0_AVX            0x4
+
+/* MXCSR after reset: every SIMD exception masked, round to nearest */
+#define MXCSR_DEFAULT       0x1F80
+
+/* XSAVE requires 64-byte alignment (FXSAVE 16) */
+#define FPU_AREA_ALIGN      64
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+/* FXSR and SSE2 present (every x86_64 CPU should have both) */
+static bool fpu_present = false;
+
+/* XSAVE in use, with these XCR0 components */
+static bool fpu_xsave = false;
+static bool fpu_xsaveopt = false;
+static uint64_t fpu_xcr0 = 0;
+
+/* Process state areas: fpu_area_size bytes, starting from fpu_init_state */
+static size_t fpu_area_size = FPU_STATE_SIZE;
+static kmem_cache_t* fpu_cache = NULL;
+static void* fpu_init_state = NULL;
+
+/* kernel_fpu_begin() state, per CPU */
+static fpu_state_t fpu_saved[SMP_MAX_CPUS];
+static uint64_t fpu_saved_irq[SMP_MAX_CPUS];
+static uint64_t fpu_saved_cr0[SMP_MAX_CPUS];
+
+/* Lazy switching, per CPU (see above) */
+static process_t* fpu_owner[SMP_MAX_CPUS];
+static bool fpu_live[SMP_MAX_CPUS];
+
+/* =============================================================================
+ * Save and Restore
+ * =============================================================================
+ */
+
+static inline void xsetbv(uint32_t reg, uint64_t value) {
+    __asm__ volatile ("xsetbv"
+                      : : "c"(reg), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/**
+ * Save the registers into a process state area.
+ */
+static void fpu_save(void* area) {
+    if (fpu_xsaveopt) {
+        __asm__ volatile ("xsaveopt64 (%0)"
+                          : : "r"(area), "a"((uint32_t)fpu_xcr0),
+                              "d"((uint32_t)(fpu_xcr0 >> 32))
+                          : "memory");
+    } else if (fpu_xsave) {
+        __asm__ volatile ("xsave64 (%0)"
+                          : : "r"(area), "a"((uint32_t)fpu_xcr0),
+                              "d"((uint32_t)(fpu_xcr0 >> 32))
+                          : "memory");
+    } else {
+        __asm__ volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/**
+ * Load the registers from a process state area.
+ */
+static void fpu_restore(const void* area) {
+    if (fpu_xsave) {
+        __asm__ volatile ("xrstor64 (%0)"
+                          : : "r"(area), "a"((uint32_t)fpu_xcr0),
+                              "d"((uint32_t)(fpu_xcr0 >> 32))
+                          : "memory");
+    } else {
+        __asm__ volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+/**
+ * Enable the FPU and SSE on the calling CPU.
+ * Leaves CR0.TS set: the first process to use the FPU takes #NM.
+ */
+void fpu_init_cpu(void) {
+    if (!fpu_present) {
+        return;
+    }
+
+    uint64_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (fpu_xsave) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+    if (fpu_xsave) {
+        xsetbv(0, fpu_xcr0);
+    }
+
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    __asm__ volatile ("fninit");
+    __asm__ volatile ("ldmxcsr %0" : : "m"(mxcsr));
+
+    fpu_owner[cpu_this()->id] = NULL;
+    fpu_live[cpu_this()->id] = false;
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+/**
+ * Detect FXSR/SSE2 and XSAVE/AVX and enable them on the boot CPU.
+ */
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    /* EDX bit 24: FXSAVE/FXRSTOR, bit 26: SSE2 */
+    fpu_present = (edx & (1U << 24)) && (edx & (1U << 26));
+
+    /* ECX bit 26: XSAVE, bit 28: AVX */
+    if (fpu_present && (ecx & (1U << 26))) {
+        bool avx = (ecx & (1U << 28)) != 0;
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+        if (avx && (eax & XCR0_AVX)) {
+            fpu_xcr0 |= XCR0_AVX;
+        }
+        fpu_xsave = true;
+    }
+
+    fpu_init_cpu();
+
+    if (fpu_xsave) {
+        /* EBX: save area size for the components now enabled in XCR0 */
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_area_size = ebx;
+        cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        fpu_xsaveopt = (eax & 0x1) != 0;
+    }
+
+    /* Template for processes that have not used the FPU yet */
+    if (fpu_present) {
+        fpu_cache = kmem_cache_create("fpu_state", fpu_area_size, FPU_AREA_ALIGN);
+        fpu_init_state = fpu_cache ? kmem_cache_alloc(fpu_cache) : NULL;
+        if (!fpu_init_state) {
+            PANIC("fpu_init: no memory for the FPU state template");
+        }
+        memset(fpu_init_state, 0, fpu_area_size);
+
+        __asm__ volatile ("clts");
+        fpu_save(fpu_init_state);
+        write_cr0(read_cr0() | CR0_TS);
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[FPU] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (!fpu_present) {
+        kprintf("No FXSR/SSE2, kernel stays on integer code\n");
+    } else if (fpu_xsave) {
+        kprintf("SSE2%s enabled, lazy %s of %u-byte states\n",
+                (fpu_xcr0 & XCR0_AVX) ? "/AVX" : "",
+                fpu_xsaveopt ? "XSAVEOPT" : "XSAVE", (uint32_t)fpu_area_size);
+    } else {
+        kprintf("SSE2 enabled, lazy FXSAVE of %u-byte states\n",
+                (uint32_t)fpu_area_size);
+    }
+}
+
+/**
+ * Check whether SSE2 may be used inside kernel_fpu_begin()/end().
+ */
+bool fpu_available(void) {
+    return fpu_present;
+}
+
+/* =============================================================================
+ * Kernel FPU Sections
+ * =============================================================================
+ */
+
+/**
+ * Start using FPU/SSE registers in the kernel.
+ */
+void kernel_fpu_begin(void) {
+    uint64_t irq = irq_save();
+    uint32_t id = cpu_this()->id;
+
+    fpu_saved_irq[id] = irq;
+    fpu_saved_cr0[id] = read_cr0();
+    if (fpu_saved_cr0[id] & CR0_TS) {
+        __asm__ volatile ("clts");
+    }
+
+    __asm__ volatile ("fxsave64 %0" : "=m"(fpu_saved[id]));
+}
+
+/**
+ * Stop using FPU/SSE registers.
+ */
+void kernel_fpu_end(void) {
+    uint32_t id = cpu_this()->id;
+
+    __asm__ volatile ("fxrstor64 %0" : : "m"(fpu_saved[id]));
+
+    if (fpu_saved_cr0[id] & CR0_TS) {
+        write_cr0(read_cr0() | CR0_TS);
+    }
+    irq_restore(fpu_saved_irq[id]);
+}
+
+/* =============================================================================
+ * Process FPU State
+ * =============================================================================
+ */
+
+/**
+ * Give the current process the FPU (#NM).
+ */
+void fpu_handle_nm(registers_t* regs) {
+    (void)regs;
+    process_t* proc = process_current();
+    uint32_t id = cpu_this()->id;
+
+    if (!fpu_present) {
+        PANIC("#NM without an FPU");
+    }
+
+    /* First use: start from the state fninit left */
+    if (!proc->fpu_state) {
+        void* state = kmem_cache_alloc(fpu_cache);
+        if (!state) {
+            kprintf("fpu: Out of memory for PID %d's FPU state, terminating it\n",
+                    (int)proc->pid);
+            process_exit(-1);
+        }
+        memcpy(state, fpu_init_state, fpu_area_size);
+        proc->fpu_state = state;
+        proc->fpu_cpu = PROCESS_FPU_CPU_NONE;
+    }
+
+    __asm__ volatile ("clts");
+
+    /* The registers still hold our state unless someone loaded theirs */
+    if (fpu_owner[id] != proc || proc->fpu_cpu != id) {
+        fpu_restore(proc->fpu_state);
+        fpu_owner[id] = proc;
+        proc->fpu_cpu = id;
+    }
+    fpu_live[id] = true;
+}
+
+/**
+ * Save the outgoing process's state if it used the FPU.
+ */
+void fpu_switch_out(process_t* prev) {
+    uint32_t id = cpu_this()->id;
+
+    if (!fpu_live[id]) {
+        return;
+    }
+
+    fpu_save(prev->fpu_state);
+    fpu_live[id] = false;
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+/**
+ * Copy a process's FPU state for a fork() child.
+ */
+bool fpu_state_clone(process_t* proc, void** copy) {
+    *copy = NULL;
+    if (!proc->fpu_state) {
+        return true;
+    }
+
+    void* state = kmem_cache_alloc(fpu_cache);
+    if (!state) {
+        return false;
+    }
+
+    /* Our live registers are newer than the save area */
+    uint64_t irq = irq_save();
+    uint32_t id = cpu_this()->id;
+    if (fpu_live[id] && fpu_owner[id] == proc) {
+        fpu_save(proc->fpu_state);
+    }
+    memcpy(state, proc->fpu_state, fpu_area_size);
+    irq_restore(irq);
+
+    *copy = state;
+    return true;
+}
+
+/**
+ * Free a process state area.
+ */
+void fpu_state_free(void* state) {
+    if (state) {
+        kmem_cache_free(fpu_cache, state);
+    }
+}
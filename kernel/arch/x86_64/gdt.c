@@ -20,11 +20,15 @@
  * The TSS provides:
  *   - RSP0 for ring transitions (syscalls, interrupts from Ring 3)
  *   - IST1 stack for double fault handling
+ *
+ * Every CPU has its own copy of the table, its own TSS and its own IST1
+ * stack: a TSS descriptor is marked busy by LTR, so CPUs cannot share one.
  * =============================================================================
  */
 
 #include "../../include/gdt.h"
 #include "../../include/kernel.h"
+#include "../../include/smp.h"
 #include "../../drivers/vga/vga.h"
 
 /* =============================================================================
@@ -32,17 +36,17 @@
  * =============================================================================
  */
 
-/* GDT entries - 5 entries (TSS takes 2 slots) */
-static gdt_entry_t gdt[GDT_ENTRIES];
+/* GDT entries for each CPU (TSS takes 2 slots) */
+static gdt_entry_t gdt[SMP_MAX_CPUS][GDT_ENTRIES];
 
 /* GDT pointer for LGDT */
-static gdt_ptr_t gdtr;
+static gdt_ptr_t gdtr[SMP_MAX_CPUS];
 
-/* Task State Segment */
-static tss_t tss;
+/* Task State Segment for each CPU */
+static tss_t tss[SMP_MAX_CPUS];
 
-/* Interrupt Stack for double fault (IST1) */
-static uint8_t ist1_stack[IST_STACK_SIZE] ALIGNED(16);
+/* Interrupt Stack for double fault (IST1), one per CPU */
+static uint8_t ist1_stack[SMP_MAX_CPUS][IST_STACK_SIZE] ALIGNED(16);
 
 /* =============================================================================
  * Assembly Helpers
@@ -63,11 +67,11 @@ static inline void gdt_load(gdt_ptr_t* gdtr) {
         "lretq\n"               /* Far return to reload CS */
         "1:\n"
         /* Reload data segment registers */
+        /* GS is left alone: loading it would clear the per-CPU GS base */
         "movw $0x10, %%ax\n"    /* Data segment selector */
         "movw %%ax, %%ds\n"
         "movw %%ax, %%es\n"
         "movw %%ax, %%fs\n"
-        "movw %%ax, %%gs\n"
         "movw %%ax, %%ss\n"
         :
         : "r"(gdtr)
@@ -90,22 +94,22 @@ static inline void tss_load(uint16_t selector) {
 /**
  * Set a regular GDT entry (null, code, or data segment).
  */
-static void gdt_set_entry(int index, uint32_t base, uint32_t limit,
+static void gdt_set_entry(gdt_entry_t* table, int index, uint32_t base, uint32_t limit,
                           uint8_t access, uint8_t granularity) {
-    gdt[index].limit_low    = (uint16_t)(limit & 0xFFFF);
-    gdt[index].base_low     = (uint16_t)(base & 0xFFFF);
-    gdt[index].base_mid     = (uint8_t)((base >> 16) & 0xFF);
-    gdt[index].access       = access;
-    gdt[index].granularity  = ((limit >> 16) & 0x0F) | (granularity & 0xF0);
-    gdt[index].base_high    = (uint8_t)((base >> 24) & 0xFF);
+    table[index].limit_low    = (uint16_t)(limit & 0xFFFF);
+    table[index].base_low     = (uint16_t)(base & 0xFFFF);
+    table[index].base_mid     = (uint8_t)((base >> 16) & 0xFF);
+    table[index].access       = access;
+    table[index].granularity  = ((limit >> 16) & 0x0F) | (granularity & 0xF0);
+    table[index].base_high    = (uint8_t)((base >> 24) & 0xFF);
 }
 
 /**
  * Set up the TSS descriptor (spans 2 GDT entries in 64-bit mode).
  */
-static void gdt_set_tss(int index, uint64_t base, uint32_t limit) {
+static void gdt_set_tss(gdt_entry_t* table, int index, uint64_t base, uint32_t limit) {
     /* First 8 bytes (low part of TSS descriptor) */
-    tss_descriptor_t* tss_desc = (tss_descriptor_t*)&gdt[index];
+    tss_descriptor_t* tss_desc = (tss_descriptor_t*)&table[index];
 
     tss_desc->limit_low     = (uint16_t)(limit & 0xFFFF);
     tss_desc->base_low      = (uint16_t)(base & 0xFFFF);
@@ -125,23 +129,24 @@ static void gdt_set_tss(int index, uint64_t base, uint32_t limit) {
 /**
  * Initialize the Task State Segment.
  */
-static void tss_init(void) {
+static void tss_init(uint32_t cpu) {
+    tss_t* t = &tss[cpu];
+
     /* Clear the TSS */
-    uint8_t* tss_ptr = (uint8_t*)&tss;
+    uint8_t* tss_ptr = (uint8_t*)t;
     for (size_t i = 0; i < sizeof(tss_t); i++) {
         tss_ptr[i] = 0;
     }
 
     /* Set up IST1 for double fault handling */
     /* Stack grows downward, so point to the top of the stack */
-    tss.ist1 = (uint64_t)&ist1_stack[IST_STACK_SIZE];
+    t->ist1 = (uint64_t)&ist1_stack[cpu][IST_STACK_SIZE];
 
-    /* RSP0 will be set when we have proper kernel stack management */
-    /* For now, it's 0 (we're always in ring 0) */
-    tss.rsp0 = 0;
+    /* RSP0 is set on every context switch */
+    t->rsp0 = 0;
 
     /* I/O Map Base - point past the TSS to disable I/O permission bitmap */
-    tss.iomap_base = sizeof(tss_t);
+    t->iomap_base = sizeof(tss_t);
 }
 
 /* =============================================================================
@@ -150,55 +155,66 @@ static void tss_init(void) {
  */
 
 /**
- * Initialize the Global Descriptor Table with TSS.
+ * Build and load the GDT and TSS of one CPU.
  */
-void gdt_init(void) {
+void gdt_init_cpu(uint32_t cpu) {
+    gdt_entry_t* table = gdt[cpu];
+
     /* Initialize TSS first */
-    tss_init();
+    tss_init(cpu);
 
     /* Entry 0: Null descriptor (required by x86) */
-    gdt_set_entry(0, 0, 0, 0, 0);
+    gdt_set_entry(table, 0, 0, 0, 0, 0);
 
     /* Entry 1: Kernel code segment (selector 0x08) */
     /* 64-bit code segment: executable, readable, present, ring 0 */
-    gdt_set_entry(1, 0, 0xFFFFF,
+    gdt_set_entry(table, 1, 0, 0xFFFFF,
                   GDT_ACCESS_PRESENT | GDT_ACCESS_DPL0 | GDT_ACCESS_SEGMENT |
                   GDT_ACCESS_EXECUTABLE | GDT_ACCESS_RW,
                   GDT_GRAN_LONG_MODE | GDT_GRAN_4K);
 
     /* Entry 2: Kernel data segment (selector 0x10) */
     /* Data segment: writable, present, ring 0 */
-    gdt_set_entry(2, 0, 0xFFFFF,
+    gdt_set_entry(table, 2, 0, 0xFFFFF,
                   GDT_ACCESS_PRESENT | GDT_ACCESS_DPL0 | GDT_ACCESS_SEGMENT |
                   GDT_ACCESS_RW,
                   GDT_GRAN_4K);
 
     /* Entry 3-4: TSS descriptor (selector 0x18, spans 2 entries) */
-    gdt_set_tss(3, (uint64_t)&tss, sizeof(tss_t) - 1);
+    gdt_set_tss(table, 3, (uint64_t)&tss[cpu], sizeof(tss_t) - 1);
 
     /* Entry 5: User data segment (selector 0x28, with RPL 0x2B) */
     /* Data segment: writable, present, ring 3 */
-    gdt_set_entry(5, 0, 0xFFFFF,
+    gdt_set_entry(table, 5, 0, 0xFFFFF,
                   GDT_ACCESS_PRESENT | GDT_ACCESS_DPL3 | GDT_ACCESS_SEGMENT |
                   GDT_ACCESS_RW,
                   GDT_GRAN_4K);
 
     /* Entry 6: User code segment (selector 0x30, with RPL 0x33) */
     /* 64-bit code segment: executable, readable, present, ring 3 */
-    gdt_set_entry(6, 0, 0xFFFFF,
+    gdt_set_entry(table, 6, 0, 0xFFFFF,
                   GDT_ACCESS_PRESENT | GDT_ACCESS_DPL3 | GDT_ACCESS_SEGMENT |
                   GDT_ACCESS_EXECUTABLE | GDT_ACCESS_RW,
                   GDT_GRAN_LONG_MODE | GDT_GRAN_4K);
 
     /* Set up GDT pointer */
-    gdtr.limit = sizeof(gdt) - 1;
-    gdtr.base = (uint64_t)&gdt;
+    gdtr[cpu].limit = sizeof(gdt[cpu]) - 1;
+    gdtr[cpu].base = (uint64_t)table;
 
     /* Load GDT and reload segment registers */
-    gdt_load(&gdtr);
+    gdt_load(&gdtr[cpu]);
 
     /* Load TSS */
     tss_load(GDT_TSS_SEL);
+
+    cpu_this()->tss = &tss[cpu];
+}
+
+/**
+ * Initialize the Global Descriptor Table with TSS (boot CPU).
+ */
+void gdt_init(void) {
+    gdt_init_cpu(0);
 }
 
 /* =============================================================================
@@ -207,15 +223,15 @@ void gdt_init(void) {
  */
 
 /**
- * Get the current RSP0 value from TSS.
+ * Get the current RSP0 value from this CPU's TSS.
  */
 uint64_t gdt_get_rsp0(void) {
-    return tss.rsp0;
+    return cpu_this()->tss->rsp0;
 }
 
 /**
- * Set the RSP0 value in TSS.
+ * Set the RSP0 value in this CPU's TSS.
  */
 void gdt_set_rsp0(uint64_t rsp0) {
-    tss.rsp0 = rsp0;
+    cpu_this()->tss->rsp0 = rsp0;
 }
@@ -4,11 +4,16 @@
 ; Contains:
 ;   - ISR stubs for exceptions (vectors 0-31)
 ;   - IRQ stubs for hardware interrupts (vectors 32-47)
+;   - Local APIC stubs (timer and IPIs, vectors 0x40-0x42; spurious 0xFF)
+;   - Device stubs for the vectors irq_alloc_vector() hands out (0x50-0xEF)
 ;   - Common handler that saves registers and calls C handlers
 ;   - IDT loading routine
 ;
 ; The ISR stubs push the interrupt number and (if needed) a dummy error code,
 ; then jump to a common routine that saves all registers and calls the C handler.
+;
+; Interrupts taken from ring 3 arrive with the user GS base loaded, so the
+; common stubs SWAPGS on entry and exit when the saved CS has RPL 3.
 ; =============================================================================
 
 [BITS 64]
@@ -116,6 +121,50 @@ IRQ 13, 45                  ; IRQ13 - FPU
 IRQ 14, 46                  ; IRQ14 - Primary ATA
 IRQ 15, 47                  ; IRQ15 - Secondary ATA
 
+; =============================================================================
+; Local APIC Vectors
+; =============================================================================
+; Handled through irq_handler, which sends them on to the LAPIC driver.
+
+IRQ 64, 0x40                ; LAPIC timer
+IRQ 65, 0x41                ; Reschedule IPI
+IRQ 66, 0x42                ; TLB shootdown IPI
+
+; =============================================================================
+; Device Vectors (IRQ_VECTOR_FIRST-IRQ_VECTOR_LAST in irq.h)
+; =============================================================================
+; One stub per vector for MSI/MSI-X, named irq_vector_<n>; the vector
+; pushed tells irq_handler which handler to call.
+
+IRQ_VECTOR_FIRST    equ 0x50
+IRQ_VECTOR_LAST     equ 0xEF
+
+%assign vec IRQ_VECTOR_FIRST
+%rep IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1
+irq_vector_ %+ vec:
+    push qword 0            ; Push dummy error code
+    push qword vec          ; Push interrupt vector number
+    jmp irq_common_stub
+%assign vec vec + 1
+%endrep
+
+; Spurious interrupts need no EOI and no handler
+global isr_spurious
+isr_spurious:
+    iretq
+
+; =============================================================================
+; Swap GS if the interrupted code was in ring 3
+; =============================================================================
+; %1 = offset of the saved CS from RSP
+
+%macro SWAPGS_IF_USER 1
+    test qword [rsp+%1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 ; =============================================================================
 ; Common ISR Stub
 ; =============================================================================
@@ -133,6 +182,8 @@ IRQ 15, 47                  ; IRQ15 - Secondary ATA
 ; After saving GPRs, stack matches registers_t structure.
 
 isr_common_stub:
+    SWAPGS_IF_USER 24           ; CS is above the vector and error code
+
     ; Save all general-purpose registers
     ; Push in reverse order so registers_t struct is correct
     push rax
@@ -178,6 +229,8 @@ isr_common_stub:
     ; Remove interrupt number and error code from stack
     add rsp, 16
 
+    SWAPGS_IF_USER 8
+
     ; Return from interrupt
     ; This pops RIP, CS, RFLAGS, RSP, SS
     iretq
@@ -188,6 +241,8 @@ isr_common_stub:
 ; Same as ISR stub but calls irq_handler instead.
 
 irq_common_stub:
+    SWAPGS_IF_USER 24
+
     ; Save all general-purpose registers
     push rax
     push rbx
@@ -231,6 +286,8 @@ irq_common_stub:
     ; Remove interrupt number and error code from stack
     add rsp, 16
 
+    SWAPGS_IF_USER 8
+
     ; Return from interrupt
     iretq
 
@@ -262,3 +319,17 @@ isr_stub_table:
     ; IRQ stubs (32-47)
     dq irq0,  irq1,  irq2,  irq3,  irq4,  irq5,  irq6,  irq7
     dq irq8,  irq9,  irq10, irq11, irq12, irq13, irq14, irq15
+
+; Local APIC stubs (LAPIC_TIMER_VECTOR onwards)
+global apic_stub_table
+apic_stub_table:
+    dq irq64, irq65, irq66
+
+; Device vector stubs (IRQ_VECTOR_FIRST onwards)
+global irq_vector_stub_table
+irq_vector_stub_table:
+%assign vec IRQ_VECTOR_FIRST
+%rep IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1
+    dq irq_vector_ %+ vec
+%assign vec vec + 1
+%endrep
@@ -0,0 +1,65 @@
+; =============================================================================
+; Chanux OS - SSE2 Memory Kernels
+; =============================================================================
+; Bulk loops behind memcpy() and memset() (lib/string.c) for CPUs without
+; fast string instructions. They move 64 bytes per iteration through
+; XMM0-XMM3 and expect the caller to have:
+;   - called kernel_fpu_begin() (the XMM registers are not preserved)
+;   - aligned the destination to 16 bytes
+;   - rounded the length down to a multiple of 64 (non-zero)
+; =============================================================================
+
+[BITS 64]
+
+section .text
+
+; =============================================================================
+; memcpy_sse2 - Copy 64-Byte Blocks
+; =============================================================================
+; void memcpy_sse2(void* dst, const void* src, size_t len)
+;
+; Input:  RDI = destination (16-byte aligned), RSI = source (any alignment),
+;         RDX = length (multiple of 64)
+; =============================================================================
+
+global memcpy_sse2
+memcpy_sse2:
+    shr rdx, 6
+.loop:
+    movdqu xmm0, [rsi]
+    movdqu xmm1, [rsi + 16]
+    movdqu xmm2, [rsi + 32]
+    movdqu xmm3, [rsi + 48]
+    movdqa [rdi], xmm0
+    movdqa [rdi + 16], xmm1
+    movdqa [rdi + 32], xmm2
+    movdqa [rdi + 48], xmm3
+    add rsi, 64
+    add rdi, 64
+    dec rdx
+    jnz .loop
+    ret
+
+; =============================================================================
+; memset_sse2 - Fill 64-Byte Blocks
+; =============================================================================
+; void memset_sse2(void* dst, uint64_t pattern, size_t len)
+;
+; Input:  RDI = destination (16-byte aligned), RSI = fill byte repeated 8
+;         times, RDX = length (multiple of 64)
+; =============================================================================
+
+global memset_sse2
+memset_sse2:
+    movq xmm0, rsi
+    punpcklqdq xmm0, xmm0
+    shr rdx, 6
+.loop:
+    movdqa [rdi], xmm0
+    movdqa [rdi + 16], xmm0
+    movdqa [rdi + 32], xmm0
+    movdqa [rdi + 48], xmm0
+    add rdi, 64
+    dec rdx
+    jnz .loop
+    ret
@@ -0,0 +1,266 @@
+/**
+ * =============================================================================
+ * Chanux OS - SMP Bring-up and Per-CPU Data
+ * =============================================================================
+ * APs are started one at a time with the INIT-SIPI-SIPI sequence (Intel SDM
+ * Vol. 3A, 8.4.4). Each gets an idle process first; the trampoline runs
+ * on that process's kernel stack, so ap_main() simply becomes the idle loop
+ * once the CPU is set up.
+ *
+ * TLB shootdowns (the kernel half, and user ranges of address spaces
+ * whose threads may be running on several CPUs) use one request slot
+ * guarded by tlb_lock. The sender marks each target pending, sends LAPIC_TLB_VECTOR,
+ * and waits for every target to acknowledge.
+ * =============================================================================
+ */
+
+#include "../../include/smp.h"
+#include "../../include/acpi.h"
+#include "../../include/clock.h"
+#include "../../include/fpu.h"
+#include "../../include/gdt.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/drivers/lapic.h"
+#include "../../include/drivers/pit.h"
+#include "../../include/interrupts/idt.h"
+#include "../../include/mm/vmm.h"
+#include "../../include/proc/process.h"
+#include "../../include/proc/sched.h"
+#include "../../include/syscall/syscall.h"
+#include "../../drivers/vga/vga.h"
+
+/* How long to wait for an AP to report in */
+#define SMP_AP_TIMEOUT_TICKS    20      /* 200ms */
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static cpu_t cpus[SMP_MAX_CPUS];
+
+/* CPUs online (cpus[0 .. cpu_count - 1]) */
+static volatile uint32_t cpu_count = 1;
+
+/* Trampoline image (ap_boot.asm) */
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_params[];
+extern uint8_t ap_trampoline_end[];
+
+/* Layout of ap_trampoline_params */
+typedef struct {
+    uint64_t cr3;
+    uint64_t stack;
+    uint64_t entry;
+    uint64_t cpu;
+} ap_params_t;
+
+/* TLB shootdown request */
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static volatile virt_addr_t tlb_virt;
+static volatile size_t tlb_size;
+static volatile uint32_t tlb_acks;
+
+/* =============================================================================
+ * Per-CPU Data
+ * =============================================================================
+ */
+
+static void cpu_setup(cpu_t* cpu, uint32_t id, uint32_t apic_id) {
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->apic_id = apic_id;
+    cpu->node = acpi_cpu_node(apic_id);
+    spin_init(&cpu->rq.lock);
+}
+
+/* Point GS at a CPU's data; the user GS base starts out zero */
+static void cpu_load_gs(cpu_t* cpu) {
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+void smp_init_bsp(void) {
+    cpu_setup(&cpus[0], 0, 0);
+    cpus[0].online = true;
+    cpu_load_gs(&cpus[0]);
+}
+
+cpu_t* cpu_get(uint32_t id) {
+    if (id >= SMP_MAX_CPUS || !cpus[id].online) {
+        return NULL;
+    }
+    return &cpus[id];
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
+
+/* =============================================================================
+ * AP Entry
+ * =============================================================================
+ */
+
+/* Called by the trampoline in long mode, on the idle process's stack */
+static NORETURN void ap_main(cpu_t* cpu) {
+    cpu_load_gs(cpu);
+    fpu_init_cpu();
+
+    gdt_init_cpu(cpu->id);
+    idt_load_cpu();
+    vmm_init_cpu();
+    syscall_init_cpu();
+    lapic_init_ap();
+
+    process_t* idle = cpu->idle;
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->on_cpu = true;
+    cpu->current = idle;
+    gdt_set_rsp0(idle->kernel_stack_top);
+    syscall_set_kernel_stack(idle->kernel_stack_top);
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+
+    /* In one-shot mode the scheduler arms the timer itself */
+    if (!clock_oneshot()) {
+        lapic_timer_start();
+    }
+    sched_start_ap();
+}
+
+/* INIT-SIPI-SIPI; true once the AP has reported in */
+static bool smp_start_ap(cpu_t* cpu) {
+    lapic_send_init(cpu->apic_id);
+    pit_sleep_ms(10);
+
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE_ADDR >> 12);
+        for (int us = 0; us < 200; us++) {
+            io_wait();      /* ~1us each */
+        }
+    }
+
+    uint64_t deadline = pit_get_ticks() + SMP_AP_TIMEOUT_TICKS;
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE) && pit_get_ticks() < deadline) {
+        cpu_pause();
+    }
+    return cpu->online;
+}
+
+void smp_init(void) {
+    const acpi_madt_info_t* madt = acpi_madt();
+
+    /* The boot CPU's APIC ID, and so its node, was not known at smp_init_bsp() */
+    if (lapic_is_ready()) {
+        cpus[0].apic_id = lapic_id();
+        cpus[0].node = acpi_cpu_node(cpus[0].apic_id);
+    }
+
+    if (!lapic_is_ready() || !madt->found || madt->cpu_count <= 1) {
+        kprintf("[SMP] Running on 1 CPU\n");
+        return;
+    }
+
+    uint32_t bsp_apic_id = cpus[0].apic_id;
+
+    /* Install the trampoline in low memory */
+    size_t tramp_size = (size_t)(ap_trampoline_end - ap_trampoline_start);
+    memcpy(PHYS_TO_VIRT(AP_TRAMPOLINE_ADDR), ap_trampoline_start, tramp_size);
+
+    ap_params_t* params = (ap_params_t*)PHYS_TO_VIRT(AP_TRAMPOLINE_ADDR +
+                                                    (ap_trampoline_params - ap_trampoline_start));
+    params->cr3 = vmm_get_pml4();
+    params->entry = (uint64_t)ap_main;
+
+    for (uint32_t i = 0; i < madt->cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+        uint32_t apic_id = madt->cpu_apic_ids[i];
+        if (apic_id == bsp_apic_id) {
+            continue;
+        }
+
+        cpu_t* cpu = &cpus[cpu_count];
+        process_t* idle = cpu->idle;    /* Left over from a CPU that failed */
+        cpu_setup(cpu, cpu_count, apic_id);
+
+        if (!idle) {
+            idle = process_create_idle(cpu->id);
+            if (!idle) {
+                kprintf("[SMP] Cannot create idle process for CPU %d\n", cpu->id);
+                break;
+            }
+        }
+        cpu->idle = idle;
+        idle->cpu = cpu->id;
+
+        params->stack = idle->kernel_stack_top;
+        params->cpu = (uint64_t)cpu;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (smp_start_ap(cpu)) {
+            cpu_count++;
+        } else {
+            kprintf("[SMP] CPU with APIC ID %d did not start\n", apic_id);
+        }
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[SMP] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("%d of %d CPUs online\n", cpu_count, madt->cpu_count);
+}
+
+/* =============================================================================
+ * Inter-Processor Requests
+ * =============================================================================
+ */
+
+void smp_send_reschedule(cpu_t* cpu) {
+    if (cpu && cpu != cpu_this() && cpu->online) {
+        lapic_send_ipi(cpu->apic_id, LAPIC_RESCHED_VECTOR);
+    }
+}
+
+void smp_poll_ipi(void) {
+    if (cpu_count <= 1) {
+        return;
+    }
+
+    cpu_t* cpu = cpu_this();
+    if (cpu->tlb_pending && __atomic_exchange_n(&cpu->tlb_pending, 0, __ATOMIC_ACQUIRE)) {
+        vmm_flush_tlb_range(tlb_virt, tlb_size);
+        __atomic_fetch_add(&tlb_acks, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void smp_tlb_shootdown(virt_addr_t virt, size_t size) {
+    if (cpu_count <= 1 || size == 0) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&tlb_lock);
+    cpu_t* self = cpu_this();
+
+    tlb_virt = virt;
+    tlb_size = size;
+    __atomic_store_n(&tlb_acks, 0, __ATOMIC_RELAXED);
+
+    uint32_t targets = 0;
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (cpu == self || !cpu->online) {
+            continue;
+        }
+        __atomic_store_n(&cpu->tlb_pending, 1, __ATOMIC_RELEASE);
+        lapic_send_ipi(cpu->apic_id, LAPIC_TLB_VECTOR);
+        targets++;
+    }
+
+    while (__atomic_load_n(&tlb_acks, __ATOMIC_ACQUIRE) < targets) {
+        cpu_pause();
+    }
+
+    spin_unlock_irqrestore(&tlb_lock, flags);
+}
@@ -24,15 +24,19 @@
 ;   - Return value in RAX
 ; =============================================================================
 
-section .data
-    ; Per-CPU data (for single CPU, just global variables)
-    ; These will be accessed by the syscall entry/exit code
-    align 16
-    global syscall_kstack_top
-    syscall_kstack_top:   dq 0      ; Kernel RSP to load on syscall entry
+; Per-CPU fields reached through GS (must match cpu_t in smp.h)
+CPU_KSTACK_TOP  equ 8               ; Kernel RSP to load on syscall entry
+CPU_USER_RSP    equ 16              ; User RSP saved on syscall entry
 
-    global user_stack_save
-    user_stack_save:    dq 0        ; User RSP saved on syscall entry
+; Size of syscall_table: passed in by the Makefile (-DSYS_MAX) from
+; SYS_MAX in syscall/syscall.h
+%ifndef SYS_MAX
+%error "SYS_MAX is not defined; assemble with -DSYS_MAX=<SYS_MAX from syscall/syscall.h>"
+%endif
+
+extern syscall_table
+extern syscall_invalid
+extern syscall_account
 
 section .text
     bits 64
@@ -46,11 +50,14 @@ section .text
 ;   RAX = syscall number
 ;   RDI, RSI, RDX, R10, R8, R9 = syscall arguments
 ;
+;   GS base = user GS base (SWAPGS brings in this CPU's cpu_t)
+;
 ; We need to:
 ;   1. Save user RSP and load kernel RSP
 ;   2. Save registers for return
-;   3. Call C dispatcher
-;   4. Restore and SYSRET back to user mode
+;   3. Call the handler from syscall_table, timing it with the TSC
+;   4. Count the call (syscall_account)
+;   5. Restore and SYSRET back to user mode
 ; =============================================================================
 
 global syscall_entry
@@ -58,19 +65,20 @@ syscall_entry:
     ; -------------------------------------------------------------------------
     ; Switch to kernel stack
     ; -------------------------------------------------------------------------
+    ; Switch GS to this CPU's data
+    swapgs
+
     ; Save user RSP (currently in RSP since we haven't switched yet)
-    mov [rel user_stack_save], rsp
+    mov [gs:CPU_USER_RSP], rsp
 
-    ; Load kernel RSP from per-process storage
-    ; For now, we use TSS.RSP0 which is set during context switch
-    ; The kernel stack was set up when the process was created
-    mov rsp, [rel syscall_kstack_top]
+    ; Load the running process's kernel stack top (set on context switch)
+    mov rsp, [gs:CPU_KSTACK_TOP]
 
     ; -------------------------------------------------------------------------
     ; Build syscall frame on kernel stack
     ; -------------------------------------------------------------------------
     ; Push user RSP first (at bottom of frame)
-    push qword [rel user_stack_save]
+    push qword [gs:CPU_USER_RSP]
 
     ; Push RCX and R11 (user RIP and RFLAGS, saved by SYSCALL)
     push r11                    ; User RFLAGS
@@ -90,47 +98,40 @@ syscall_entry:
     sti
 
     ; -------------------------------------------------------------------------
-    ; Prepare arguments for syscall_dispatch
+    ; Start the clock
     ; -------------------------------------------------------------------------
-    ; C calling convention: RDI, RSI, RDX, RCX, R8, R9
-    ; Syscall convention:   RAX=num, RDI, RSI, RDX, R10, R8, R9
-    ;
-    ; We need to shuffle:
-    ;   arg1 (RDI) -> RSI (second C arg)
-    ;   arg2 (RSI) -> RDX (third C arg)
-    ;   arg3 (RDX) -> RCX (fourth C arg)
-    ;   arg4 (R10) -> R8 (fifth C arg)
-    ;   arg5 (R8)  -> R9 (sixth C arg)
-    ;   syscall num (RAX) -> RDI (first C arg)
-
-    ; Save original values before shuffling
-    mov r15, rdi                ; Save arg1
-    mov r14, rsi                ; Save arg2
-    mov r13, rdx                ; Save arg3
-    mov r12, r10                ; Save arg4
-    ; R8, R9 will be handled last
-
-    ; Now set up C call arguments
-    mov rdi, rax                ; First arg: syscall number
-    mov rsi, r15                ; Second arg: original RDI (arg1)
-    mov rdx, r14                ; Third arg: original RSI (arg2)
-    mov rcx, r13                ; Fourth arg: original RDX (arg3)
-    ; R8 stays as R8 (fifth C arg = arg4... wait, we need R10 here)
-    ; Actually let me reconsider...
-
-    ; Correction: syscall args are RDI, RSI, RDX, R10, R8, R9
-    ; C dispatch: syscall_dispatch(num, arg1, arg2, arg3, arg4, arg5)
-    ; So: RDI=num, RSI=arg1, RDX=arg2, RCX=arg3, R8=arg4, R9=arg5
-
-    mov r8, r12                 ; Fifth arg: original R10 (arg4)
-    ; R9 stays as R9 for arg5
-
-    ; -------------------------------------------------------------------------
-    ; Call C dispatcher
-    ; -------------------------------------------------------------------------
-    extern syscall_dispatch
-    call syscall_dispatch
+    ; R12-R14 are saved in the frame and survive the C call: R12 keeps the
+    ; syscall number, R13 the entry TSC. RDTSC clobbers RDX (arg3).
+    mov r12, rax
+    mov r13, rdx
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov rdx, r13
+    mov r13, rax
+    mov rax, r12
 
+    ; -------------------------------------------------------------------------
+    ; Call the handler straight from syscall_table
+    ; -------------------------------------------------------------------------
+    ; Syscall convention: RAX=num, RDI, RSI, RDX, R10, R8, R9
+    ; C convention:       RDI, RSI, RDX, RCX, R8, R9
+    ;
+    ; Only arg4 is in the wrong place (SYSCALL clobbered RCX).
+    cmp rax, SYS_MAX
+    jae .invalid
+    mov r11, [syscall_table + rax * 8]
+    test r11, r11
+    jz .invalid
+    mov rcx, r10
+    call r11
+    jmp .done
+
+.invalid:
+    mov rdi, rax
+    call syscall_invalid
+
+.done:
     ; Return value is in RAX - keep it there for return to user
 
     ; -------------------------------------------------------------------------
@@ -138,6 +139,16 @@ syscall_entry:
     ; -------------------------------------------------------------------------
     cli
 
+    ; -------------------------------------------------------------------------
+    ; Count the call on this CPU (interrupts off: no lock needed)
+    ; -------------------------------------------------------------------------
+    mov r14, rax                ; Keep the return value
+    mov rdi, r12                ; Syscall number
+    mov rsi, r13                ; Entry TSC
+    mov rdx, rax                ; Return value
+    call syscall_account
+    mov rax, r14
+
     ; -------------------------------------------------------------------------
     ; Restore callee-saved registers
     ; -------------------------------------------------------------------------
@@ -157,6 +168,9 @@ syscall_entry:
     ; Pop user RSP (but don't load it yet)
     pop rsp                     ; Restore user stack pointer
 
+    ; Give user mode its GS back
+    swapgs
+
     ; -------------------------------------------------------------------------
     ; Return to user mode
     ; -------------------------------------------------------------------------
@@ -167,18 +181,55 @@ syscall_entry:
     ;   - Set SS to (STAR[63:48] + 8) = 0x2B (user data)
     o64 sysret
 
+; =============================================================================
+; syscall_fork_return - Enter user mode as a freshly forked child
+; =============================================================================
+; void syscall_fork_return(const syscall_frame_t* frame)
+;
+; Unwinds a copy of the parent's syscall frame exactly like the tail of
+; syscall_entry, but with RAX = 0 so fork() returns 0 in the child.
+; Caller-saved registers are cleared rather than leaking kernel values.
+; =============================================================================
+
+global syscall_fork_return
+syscall_fork_return:
+    cli
+    mov rsp, rdi                ; Walk the frame with pops
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+
+    pop rcx                     ; User RIP
+    pop r11                     ; User RFLAGS
+    pop rsp                     ; User stack pointer
+
+    xor eax, eax                ; fork() returns 0 in the child
+    xor edi, edi
+    xor esi, esi
+    xor edx, edx
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+
+    swapgs                      ; User GS
+    o64 sysret
+
 ; =============================================================================
 ; syscall_set_kernel_stack - Set kernel stack for current process
 ; =============================================================================
 ; void syscall_set_kernel_stack(uint64_t stack_top)
 ;
 ; Called during context switch to update the kernel stack pointer
-; that will be used on the next syscall entry.
+; that will be used on the next syscall entry on this CPU.
 ; =============================================================================
 
 global syscall_set_kernel_stack
 syscall_set_kernel_stack:
-    mov [rel syscall_kstack_top], rdi
+    mov [gs:CPU_KSTACK_TOP], rdi
     ret
 
 ; =============================================================================
@@ -189,5 +240,5 @@ syscall_set_kernel_stack:
 
 global syscall_get_kernel_stack
 syscall_get_kernel_stack:
-    mov rax, [rel syscall_kstack_top]
+    mov rax, [gs:CPU_KSTACK_TOP]
     ret
@@ -0,0 +1,111 @@
+; =============================================================================
+; Chanux OS - User Memory Access Primitives
+; =============================================================================
+; The only instructions in the kernel that touch user memory. Each one that
+; can fault has an entry in .ex_table: if a page fault at that instruction
+; cannot be resolved (copy-on-write, demand-zero), the fault handler resumes
+; at the paired fixup label instead of halting, and the caller sees how
+; much was left undone.
+;
+; Callers (user/uaccess.c) check that the whole range is below
+; USER_SPACE_END first; these routines do no range checks themselves.
+; =============================================================================
+
+[BITS 64]
+
+; Add an exception table entry: fault at %1 resumes at %2
+%macro EX_TABLE 2
+    section .ex_table
+    dq %1, %2
+    section .text
+%endmacro
+
+section .ex_table progbits alloc noexec nowrite align=8
+
+section .text
+
+; =============================================================================
+; uaccess_copy - Copy to or from User Memory
+; =============================================================================
+; uint64_t uaccess_copy(void* dst, const void* src, size_t len)
+;
+; Input:  RDI = destination, RSI = source, RDX = length
+; Output: RAX = bytes not copied (0 on success)
+; =============================================================================
+
+global uaccess_copy
+uaccess_copy:
+    cld                             ; User space may have left DF set
+    mov rcx, rdx
+.copy:
+    rep movsb                       ; Fast strings (ERMS) on current CPUs
+    xor eax, eax
+    ret
+.fault:
+    mov rax, rcx                    ; RCX counts the bytes still to go
+    ret
+
+    EX_TABLE uaccess_copy.copy, uaccess_copy.fault
+
+; =============================================================================
+; uaccess_strncpy - Copy a String from User Memory
+; =============================================================================
+; int64_t uaccess_strncpy(char* dst, const char* src, size_t size)
+;
+; Copies up to 'size' bytes, stopping after the terminating NUL.
+;
+; Input:  RDI = destination, RSI = user source, RDX = buffer size
+; Output: RAX = string length (without the NUL),
+;              'size' if no NUL was found within 'size' bytes,
+;              -1 on an unresolved fault
+; =============================================================================
+
+global uaccess_strncpy
+uaccess_strncpy:
+    xor eax, eax
+.loop:
+    cmp rax, rdx
+    jae .done
+.load:
+    movzx ecx, byte [rsi + rax]
+    mov [rdi + rax], cl
+    test cl, cl
+    jz .done
+    inc rax
+    jmp .loop
+.done:
+    ret
+.fault:
+    mov rax, -1
+    ret
+
+    EX_TABLE uaccess_strncpy.load, uaccess_strncpy.fault
+
+; =============================================================================
+; uaccess_cmpxchg32 - Compare and Exchange a User Word
+; =============================================================================
+; int uaccess_cmpxchg32(uint32_t* uaddr, uint32_t expected, uint32_t desired,
+;                       uint32_t* old)
+;
+; LOCK CMPXCHG always writes the destination (back with its own value on a
+; mismatch), so the page is made present and private even when the
+; comparison fails.
+;
+; Input:  RDI = user address (4-byte aligned), ESI = expected,
+;         EDX = desired, RCX = where to store the value found
+; Output: RAX = 0, or -1 on an unresolved fault
+; =============================================================================
+
+global uaccess_cmpxchg32
+uaccess_cmpxchg32:
+    mov eax, esi
+.cmpxchg:
+    lock cmpxchg [rdi], edx
+    mov [rcx], eax                  ; EAX holds the old value either way
+    xor eax, eax
+    ret
+.fault:
+    mov rax, -1
+    ret
+
+    EX_TABLE uaccess_cmpxchg32.cmpxchg, uaccess_cmpxchg32.fault
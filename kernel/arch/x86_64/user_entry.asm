@@ -61,8 +61,7 @@ user_mode_enter:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
-    ; Note: SS will be set by IRETQ
+    ; Note: SS will be set by IRETQ; GS is swapped below
 
     ; -------------------------------------------------------------------------
     ; Build IRETQ stack frame
@@ -111,6 +110,9 @@ user_mode_enter:
     ; -------------------------------------------------------------------------
     ; Enter user mode!
     ; -------------------------------------------------------------------------
+    ; Park the per-CPU GS base in KERNEL_GS_BASE for the next kernel entry
+    swapgs
+
     ; IRETQ will pop: RIP, CS, RFLAGS, RSP, SS
     iretq
 
@@ -140,12 +142,11 @@ user_mode_enter_with_args:
     ; Disable interrupts
     cli
 
-    ; Set data segment registers
+    ; Set data segment registers (GS is swapped below)
     mov ax, USER_DATA_SEGMENT
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
 
     ; Build IRETQ stack frame
     push USER_DATA_SEGMENT      ; SS
@@ -178,5 +179,6 @@ user_mode_enter_with_args:
     xor r15, r15
     xor rbp, rbp
 
-    ; Enter user mode
+    ; Enter user mode with the user GS base
+    swapgs
     iretq
@@ -0,0 +1,155 @@
+/**
+ * =============================================================================
+ * Chanux OS - I/O APIC Driver Implementation
+ * =============================================================================
+ * Every entry is used in physical destination mode with fixed delivery:
+ * the interrupt goes to exactly the one local APIC named in its entry.
+ *
+ * IOREGSEL/IOWIN is a two-step access, so one lock covers all of them;
+ * entries are only changed when a line is set up, masked or moved, never
+ * on the interrupt path.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/ioapic.h"
+#include "../../include/acpi.h"
+#include "../../include/kernel.h"
+#include "../../include/spinlock.h"
+#include "../../include/mm/vmm.h"
+#include "../vga/vga.h"
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+typedef struct {
+    volatile uint32_t*  base;
+    uint32_t            gsi_base;
+    uint32_t            entries;        /* Redirection entries (pins) */
+} ioapic_t;
+
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+
+/* =============================================================================
+ * Register Access
+ * =============================================================================
+ */
+
+static uint32_t ioapic_read(ioapic_t* io, uint32_t reg) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    return io->base[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(ioapic_t* io, uint32_t reg, uint32_t value) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    io->base[IOAPIC_WIN / 4] = value;
+}
+
+/* Find the I/O APIC serving a GSI, and the pin it is on */
+static ioapic_t* ioapic_for_gsi(uint32_t gsi, uint32_t* pin) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t* io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->entries) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+/* Set or clear bits in the low dword of a GSI's entry */
+static void ioapic_update(uint32_t gsi, uint32_t set, uint32_t clear) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for_gsi(gsi, &pin);
+    if (!io) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&ioapic_lock);
+    uint32_t reg = IOAPIC_REG_REDTBL + pin * 2;
+    ioapic_write(io, reg, (ioapic_read(io, reg) & ~clear) | set);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+uint32_t ioapic_init(void) {
+    const acpi_madt_info_t* madt = acpi_madt();
+
+    for (uint32_t i = 0; i < madt->ioapic_count; i++) {
+        ioapic_t* io = &ioapics[ioapic_count];
+        io->base = (volatile uint32_t*)vmm_map_mmio(madt->ioapics[i].phys, PAGE_SIZE);
+        if (!io->base) {
+            kprintf("[IOAPIC] Cannot map I/O APIC %d\n", madt->ioapics[i].id);
+            continue;
+        }
+        io->gsi_base = madt->ioapics[i].gsi_base;
+        io->entries = ((ioapic_read(io, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+        /* Nothing gets through until a driver asks for its line */
+        for (uint32_t pin = 0; pin < io->entries; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_REDIR_MASKED);
+            ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, 0);
+        }
+        ioapic_count++;
+
+        vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+        kprintf("[IOAPIC] ");
+        vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+        kprintf("I/O APIC %d at 0x%x: GSI %d-%d\n", madt->ioapics[i].id,
+                madt->ioapics[i].phys, io->gsi_base, io->gsi_base + io->entries - 1);
+    }
+
+    return ioapic_count;
+}
+
+/* =============================================================================
+ * Redirection Entries
+ * =============================================================================
+ */
+
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags, uint32_t apic_id) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for_gsi(gsi, &pin);
+    if (!io) {
+        return -1;
+    }
+
+    uint32_t low = IOAPIC_REDIR_MASKED | vector |
+                   (flags & (IOAPIC_REDIR_LEVEL | IOAPIC_REDIR_ACTIVE_LOW));
+
+    uint64_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, IOAPIC_REDIR_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, apic_id << 24);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2, low);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+    return 0;
+}
+
+void ioapic_set_dest(uint32_t gsi, uint32_t apic_id) {
+    uint32_t pin;
+    ioapic_t* io = ioapic_for_gsi(gsi, &pin);
+    if (!io) {
+        return;
+    }
+
+    /* The high dword only holds the destination */
+    uint64_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDTBL + pin * 2 + 1, apic_id << 24);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_mask(uint32_t gsi) {
+    ioapic_update(gsi, IOAPIC_REDIR_MASKED, 0);
+}
+
+void ioapic_unmask(uint32_t gsi) {
+    ioapic_update(gsi, 0, IOAPIC_REDIR_MASKED);
+}
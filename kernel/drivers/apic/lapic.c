@@ -0,0 +1,228 @@
+/**
+ * =============================================================================
+ * Chanux OS - Local APIC Driver Implementation
+ * =============================================================================
+ * The MMIO page is mapped uncached once by the boot CPU; APs share the
+ * mapping because the kernel half is the same in every address space.
+ *
+ * Timer calibration counts how far the APIC timer (divide by 16) runs down
+ * during LAPIC_CALIBRATE_TICKS PIT ticks. All CPUs run from the same bus
+ * clock, so the resulting count is reused on every AP.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/lapic.h"
+#include "../../include/drivers/pit.h"
+#include "../../include/proc/sched.h"
+#include "../../include/mm/vmm.h"
+#include "../../include/kernel.h"
+#include "../../include/smp.h"
+#include "../vga/vga.h"
+
+/* PIT ticks to measure the APIC timer over */
+#define LAPIC_CALIBRATE_TICKS   10
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static volatile uint32_t* lapic_base = NULL;
+
+/* APIC timer count for one scheduler tick */
+static uint32_t lapic_timer_count = 0;
+
+/* =============================================================================
+ * Register Access
+ * =============================================================================
+ */
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+    (void)lapic_base[LAPIC_REG_ID / 4];     /* Serialise the posted write */
+}
+
+/* Software-enable the calling CPU's APIC and quiet its local interrupt lines */
+static void lapic_enable(void) {
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | MSR_APIC_BASE_ENABLE);
+
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    /* Clear any error latched before the APIC was enabled */
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_eoi();
+}
+
+/* Measure the APIC timer against the PIT */
+static void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    /* Start on a tick edge */
+    uint64_t start = pit_get_ticks();
+    while (pit_get_ticks() == start) {
+        halt();
+    }
+
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    pit_sleep_ticks(LAPIC_CALIBRATE_TICKS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CUR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+    lapic_timer_count = elapsed / LAPIC_CALIBRATE_TICKS * PIT_TICK_RATE / SCHED_TICK_RATE;
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+int lapic_init(phys_addr_t phys) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1U << 9))) {
+        kprintf("[APIC] No local APIC\n");
+        return -1;
+    }
+
+    if (phys == 0) {
+        phys = LAPIC_DEFAULT_PHYS;
+    }
+    lapic_base = (volatile uint32_t*)vmm_map_mmio(phys, PAGE_SIZE);
+    if (!lapic_base) {
+        kprintf("[APIC] Cannot map local APIC registers\n");
+        return -1;
+    }
+
+    lapic_enable();
+    cpu_this()->apic_id = lapic_id();       /* For interrupt routing */
+    lapic_timer_calibrate();
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[APIC] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("Local APIC %d enabled, timer %d counts per tick\n",
+            lapic_id(), lapic_timer_count);
+
+    return 0;
+}
+
+void lapic_init_ap(void) {
+    lapic_enable();
+}
+
+bool lapic_is_ready(void) {
+    return lapic_base != NULL;
+}
+
+/* =============================================================================
+ * Basic Operations
+ * =============================================================================
+ */
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_base[LAPIC_REG_EOI / 4] = 0;
+}
+
+void lapic_disable_extint(void) {
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+}
+
+/* Write the ICR and wait for the APIC to accept the message */
+static void lapic_send(uint32_t apic_id, uint32_t command) {
+    uint64_t flags = irq_save();
+
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, command);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_pause();
+    }
+
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_send(apic_id, vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+    lapic_send(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);     /* De-assert */
+}
+
+void lapic_send_startup(uint32_t apic_id, uint8_t page) {
+    lapic_send(apic_id, LAPIC_ICR_STARTUP | page);
+}
+
+/* =============================================================================
+ * Timer
+ * =============================================================================
+ */
+
+void lapic_timer_start(void) {
+    if (lapic_timer_count == 0) {
+        return;
+    }
+
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INIT, lapic_timer_count);
+}
+
+uint32_t lapic_timer_tick_count(void) {
+    return lapic_timer_count;
+}
+
+void lapic_timer_oneshot(uint32_t count) {
+    /* Writing the initial count (re)starts the countdown; 0 stops it */
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INIT, count);
+}
+
+void lapic_timer_deadline(uint64_t tsc) {
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_TSC_DEADLINE | LAPIC_TIMER_VECTOR);
+
+    /* The LVT write must land before the MSR write (SDM 10.5.4.1) */
+    __asm__ volatile ("mfence" : : : "memory");
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+/* =============================================================================
+ * Interrupt Handling
+ * =============================================================================
+ */
+
+void lapic_handle_interrupt(registers_t* regs) {
+    /*
+     * Acknowledge first: the handlers below may switch to another process
+     * and not come back here for a while.
+     */
+    lapic_eoi();
+
+    switch (regs->int_no) {
+    case LAPIC_TIMER_VECTOR:
+        sched_tick(regs);
+        break;
+    case LAPIC_RESCHED_VECTOR:
+        sched_handle_ipi();
+        break;
+    case LAPIC_TLB_VECTOR:
+        smp_poll_ipi();
+        break;
+    default:
+        break;
+    }
+}
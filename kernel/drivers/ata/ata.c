@@ -0,0 +1,294 @@
+/**
+ * =============================================================================
+ * Chanux OS - ATA (IDE) Disk Driver Implementation
+ * =============================================================================
+ * Polled PIO: a command is written to the task file, then each sector is
+ * moved through the data register once the drive raises DRQ. A spinlock
+ * per channel keeps the two drives on a channel from interleaving their
+ * task file writes.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/ata.h"
+#include "../../include/drivers/blkdev.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/spinlock.h"
+#include "../vga/vga.h"
+
+/* Status polls before a command is given up on */
+#define ATA_TIMEOUT         10000000
+
+/* =============================================================================
+ * Driver State
+ * =============================================================================
+ */
+
+typedef struct {
+    uint16_t    io;
+    uint16_t    ctrl;
+    spinlock_t  lock;
+} ata_channel_t;
+
+typedef struct {
+    ata_channel_t*  channel;
+    uint8_t         slave;          /* 0: master, 1: slave */
+    bool            lba48;
+    blkdev_t        blk;
+} ata_drive_t;
+
+static ata_channel_t ata_channels[2] = {
+    { ATA_PRIMARY_IO,   ATA_PRIMARY_CTRL,   SPINLOCK_INIT },
+    { ATA_SECONDARY_IO, ATA_SECONDARY_CTRL, SPINLOCK_INIT },
+};
+
+static ata_drive_t ata_drives[4];
+
+/* =============================================================================
+ * Port Helpers
+ * =============================================================================
+ */
+
+static inline void ata_insw(uint16_t port, void* buf, uint32_t words) {
+    __asm__ volatile("rep insw" : "+D"(buf), "+c"(words) : "d"(port) : "memory");
+}
+
+static inline void ata_outsw(uint16_t port, const void* buf, uint32_t words) {
+    __asm__ volatile("rep outsw" : "+S"(buf), "+c"(words) : "d"(port) : "memory");
+}
+
+/* ~400ns: reading the alternate status register takes ~100ns */
+static void ata_delay(ata_channel_t* ch) {
+    for (int i = 0; i < 4; i++) {
+        inb(ch->ctrl);
+    }
+}
+
+/* Wait for BSY to clear; returns the final status, or -1 on timeout */
+static int ata_wait_idle(ata_channel_t* ch) {
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++) {
+        uint8_t status = inb(ch->io + ATA_REG_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            return status;
+        }
+        cpu_pause();
+    }
+    return -1;
+}
+
+/* Wait until the drive wants data moved: 0 on DRQ, -1 on error/timeout */
+static int ata_wait_drq(ata_channel_t* ch) {
+    int status = ata_wait_idle(ch);
+    if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF)) || !(status & ATA_SR_DRQ)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Load the task file for a transfer and issue the command */
+static void ata_issue(ata_drive_t* drive, uint64_t lba, uint32_t count, uint8_t cmd28,
+                      uint8_t cmd48) {
+    ata_channel_t* ch = drive->channel;
+
+    if (drive->lba48) {
+        outb(ch->io + ATA_REG_DRIVE, 0x40 | (drive->slave << 4));
+        ata_delay(ch);
+        /* High-order bytes first, then low (count 0 means 65536) */
+        outb(ch->io + ATA_REG_SECCOUNT, (uint8_t)(count >> 8));
+        outb(ch->io + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(ch->io + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(ch->io + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+        outb(ch->io + ATA_REG_SECCOUNT, (uint8_t)count);
+        outb(ch->io + ATA_REG_LBA0, (uint8_t)lba);
+        outb(ch->io + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+        outb(ch->io + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+        outb(ch->io + ATA_REG_COMMAND, cmd48);
+    } else {
+        outb(ch->io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+        ata_delay(ch);
+        outb(ch->io + ATA_REG_SECCOUNT, (uint8_t)count);    /* 0 means 256 */
+        outb(ch->io + ATA_REG_LBA0, (uint8_t)lba);
+        outb(ch->io + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+        outb(ch->io + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+        outb(ch->io + ATA_REG_COMMAND, cmd28);
+    }
+}
+
+/* =============================================================================
+ * Block Device Operations
+ * =============================================================================
+ */
+
+static int ata_read(blkdev_t* dev, uint64_t lba, uint32_t count, void* buf) {
+    ata_drive_t* drive = (ata_drive_t*)dev->priv;
+    ata_channel_t* ch = drive->channel;
+    uint8_t* dst = (uint8_t*)buf;
+    int result = 0;
+
+    uint64_t flags = spin_lock_irqsave(&ch->lock);
+    if (ata_wait_idle(ch) < 0) {
+        result = -1;
+    } else {
+        ata_issue(drive, lba, count, ATA_CMD_READ_PIO, ATA_CMD_READ_PIO_EXT);
+        for (uint32_t i = 0; i < count; i++) {
+            ata_delay(ch);
+            if (ata_wait_drq(ch) < 0) {
+                result = -1;
+                break;
+            }
+            ata_insw(ch->io + ATA_REG_DATA, dst, BLKDEV_SECTOR_SIZE / 2);
+            dst += BLKDEV_SECTOR_SIZE;
+        }
+    }
+    spin_unlock_irqrestore(&ch->lock, flags);
+
+    return result;
+}
+
+static int ata_write(blkdev_t* dev, uint64_t lba, uint32_t count, const void* buf) {
+    ata_drive_t* drive = (ata_drive_t*)dev->priv;
+    ata_channel_t* ch = drive->channel;
+    const uint8_t* src = (const uint8_t*)buf;
+    int result = 0;
+
+    uint64_t flags = spin_lock_irqsave(&ch->lock);
+    if (ata_wait_idle(ch) < 0) {
+        result = -1;
+    } else {
+        ata_issue(drive, lba, count, ATA_CMD_WRITE_PIO, ATA_CMD_WRITE_PIO_EXT);
+        for (uint32_t i = 0; i < count; i++) {
+            ata_delay(ch);
+            if (ata_wait_drq(ch) < 0) {
+                result = -1;
+                break;
+            }
+            ata_outsw(ch->io + ATA_REG_DATA, src, BLKDEV_SECTOR_SIZE / 2);
+            src += BLKDEV_SECTOR_SIZE;
+        }
+        /* The last sector is written once BSY drops again */
+        ata_delay(ch);
+        int status = ata_wait_idle(ch);
+        if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+            result = -1;
+        }
+    }
+    spin_unlock_irqrestore(&ch->lock, flags);
+
+    return result;
+}
+
+static int ata_flush(blkdev_t* dev) {
+    ata_drive_t* drive = (ata_drive_t*)dev->priv;
+    ata_channel_t* ch = drive->channel;
+
+    uint64_t flags = spin_lock_irqsave(&ch->lock);
+    outb(ch->io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4));
+    ata_delay(ch);
+    outb(ch->io + ATA_REG_COMMAND,
+         drive->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    ata_delay(ch);
+    int status = ata_wait_idle(ch);
+    spin_unlock_irqrestore(&ch->lock, flags);
+
+    return (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) ? -1 : 0;
+}
+
+static const blkdev_ops_t ata_blkdev_ops = {
+    .read  = ata_read,
+    .write = ata_write,
+    .flush = ata_flush,
+};
+
+/* =============================================================================
+ * Probing
+ * =============================================================================
+ */
+
+/* Run IDENTIFY on one drive; returns true for an ATA disk */
+static bool ata_identify(ata_channel_t* ch, uint8_t slave, uint16_t* id) {
+    outb(ch->io + ATA_REG_DRIVE, 0xA0 | (slave << 4));
+    ata_delay(ch);
+    outb(ch->io + ATA_REG_SECCOUNT, 0);
+    outb(ch->io + ATA_REG_LBA0, 0);
+    outb(ch->io + ATA_REG_LBA1, 0);
+    outb(ch->io + ATA_REG_LBA2, 0);
+    outb(ch->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(ch);
+
+    if (inb(ch->io + ATA_REG_STATUS) == 0) {
+        return false;   /* No drive */
+    }
+    if (ata_wait_idle(ch) < 0) {
+        return false;
+    }
+
+    /* ATAPI and SATA packet devices put a signature here instead */
+    if (inb(ch->io + ATA_REG_LBA1) != 0 || inb(ch->io + ATA_REG_LBA2) != 0) {
+        return false;
+    }
+    if (ata_wait_drq(ch) < 0) {
+        return false;
+    }
+
+    ata_insw(ch->io + ATA_REG_DATA, id, 256);
+    return true;
+}
+
+int ata_init(void) {
+    static const char* const names[4] = { "hda", "hdb", "hdc", "hdd" };
+    uint16_t id[256];
+    int found = 0;
+
+    for (int c = 0; c < 2; c++) {
+        ata_channel_t* ch = &ata_channels[c];
+
+        /* Polled driver: keep IRQ 14/15 quiet */
+        outb(ch->ctrl, ATA_CTRL_NIEN);
+
+        /* A floating bus reads 0xFF: no controller on this channel */
+        if (inb(ch->io + ATA_REG_STATUS) == 0xFF) {
+            continue;
+        }
+
+        for (uint8_t slave = 0; slave < 2; slave++) {
+            if (!ata_identify(ch, slave, id)) {
+                continue;
+            }
+
+            ata_drive_t* drive = &ata_drives[c * 2 + slave];
+            drive->channel = ch;
+            drive->slave = slave;
+            drive->lba48 = (id[83] & (1 << 10)) != 0;
+
+            uint64_t sectors;
+            if (drive->lba48) {
+                sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) |
+                          ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+            } else {
+                sectors = (uint64_t)id[60] | ((uint64_t)id[61] << 16);
+            }
+            if (sectors == 0) {
+                continue;
+            }
+
+            blkdev_t* blk = &drive->blk;
+            strncpy(blk->name, names[c * 2 + slave], BLKDEV_NAME_MAX - 1);
+            blk->sector_count = sectors;
+            blk->max_sectors = ATA_MAX_SECTORS;
+            blk->ops = &ata_blkdev_ops;
+            blk->priv = drive;
+            if (blkdev_register(blk) < 0) {
+                continue;
+            }
+            found++;
+
+            vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+            kprintf("[ATA] ");
+            vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+            kprintf("%s: %u MB, LBA%d, PIO\n", blk->name,
+                    sectors / 2048, drive->lba48 ? 48 : 28);
+        }
+    }
+
+    return found;
+}
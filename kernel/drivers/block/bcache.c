@@ -0,0 +1,593 @@
+/**
+ * =============================================================================
+ * Chanux OS - Block Buffer Cache Implementation
+ * =============================================================================
+ * One lock covers the hash, the LRU list and every buffer's flags and
+ * reference count. I/O is always submitted with the lock dropped: a
+ * synchronous driver completes the request inside blkdev_submit(), and
+ * the completion callback takes the lock to update the flags.
+ *
+ * A buffer with BUF_BUSY set has its request in flight; anyone who needs
+ * the data waits for the flag to clear. Buffers that are referenced,
+ * busy or dirty are never reused for another block.
+ *
+ * A run of adjacent blocks goes out as one request of a cluster: the
+ * blocks are copied into (or, on a read, out of) the cluster's physically
+ * contiguous bounce buffer. The copy costs far less than a device command
+ * per block. A cluster is free again once its completion has run and the
+ * request's status is set. When none is free, or a run is one block long,
+ * each buffer is sent with its own request as before.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/bcache.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/spinlock.h"
+#include "../../include/clock.h"
+#include "../../include/mm/pmm.h"
+#include "../../include/proc/process.h"
+#include "../../include/proc/wait.h"
+
+/* A multi-block request and its bounce buffer */
+typedef struct {
+    blkdev_request_t    req;
+    uint8_t*            data;           /* BCACHE_CLUSTER_BLOCKS blocks (lazily) */
+    buf_t*              bufs[BCACHE_CLUSTER_BLOCKS];
+    uint32_t            count;
+    bool                busy;
+} bcache_cluster_t;
+
+/* =============================================================================
+ * Cache State
+ * =============================================================================
+ */
+
+static buf_t bcache_bufs[BCACHE_BUFFERS];
+static buf_t* bcache_hash[BCACHE_BUCKETS];
+static buf_t* lru_head = NULL;      /* Most recently released */
+static buf_t* lru_tail = NULL;      /* Next to be reused */
+static bcache_cluster_t clusters[BCACHE_CLUSTERS];
+static spinlock_t bcache_lock = SPINLOCK_INIT;
+
+/* The write-back thread sleeps here until a buffer is dirtied */
+static wait_queue_t writeback_wq = WAIT_QUEUE_INIT(writeback_wq);
+static volatile bool writeback_pending = false;
+
+/* =============================================================================
+ * Hash and LRU Helpers (lock held)
+ * =============================================================================
+ */
+
+static uint32_t bcache_bucket(blkdev_t* dev, uint64_t block) {
+    uint64_t key = block ^ ((uint64_t)dev >> 6);
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (BCACHE_BUCKETS - 1);
+}
+
+static buf_t* bcache_lookup(blkdev_t* dev, uint64_t block) {
+    for (buf_t* b = bcache_hash[bcache_bucket(dev, block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static void bcache_unhash(buf_t* b) {
+    if (!b->dev) {
+        return;
+    }
+    buf_t** link = &bcache_hash[bcache_bucket(b->dev, b->block)];
+    while (*link && *link != b) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = b->hash_next;
+    }
+    b->hash_next = NULL;
+    b->dev = NULL;
+}
+
+static void lru_remove(buf_t* b) {
+    if (b->lru_prev) {
+        b->lru_prev->lru_next = b->lru_next;
+    } else {
+        lru_head = b->lru_next;
+    }
+    if (b->lru_next) {
+        b->lru_next->lru_prev = b->lru_prev;
+    } else {
+        lru_tail = b->lru_prev;
+    }
+    b->lru_prev = NULL;
+    b->lru_next = NULL;
+}
+
+static void lru_push_front(buf_t* b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = b;
+    } else {
+        lru_tail = b;
+    }
+    lru_head = b;
+}
+
+/*
+ * Find a buffer to reuse: the least recently released idle, clean one.
+ * If only dirty ones are idle, '*dirty' is set to the oldest of them.
+ */
+static buf_t* bcache_victim(buf_t** dirty) {
+    *dirty = NULL;
+    for (buf_t* b = lru_tail; b; b = b->lru_prev) {
+        if (b->refs != 0 || (b->flags & BUF_BUSY)) {
+            continue;
+        }
+        if (!(b->flags & BUF_DIRTY)) {
+            return b;
+        }
+        if (!*dirty) {
+            *dirty = b;
+        }
+    }
+    return NULL;
+}
+
+/* =============================================================================
+ * I/O
+ * =============================================================================
+ */
+
+static void bcache_io_done(blkdev_request_t* req, int status) {
+    buf_t* b = (buf_t*)req->priv;
+
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    if (req->op == BLKDEV_OP_READ) {
+        if (status == 0) {
+            b->flags |= BUF_VALID;
+        }
+    } else if (status < 0) {
+        b->flags |= BUF_DIRTY;      /* Try again on the next sync */
+    }
+    b->flags &= ~BUF_BUSY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/* Submit the buffer's request; BUF_BUSY is already set */
+static void bcache_submit(buf_t* b, uint32_t op) {
+    blkdev_request_t* req = &b->req;
+    memset(req, 0, sizeof(*req));
+    req->dev = b->dev;
+    req->op = op;
+    req->lba = b->block * BCACHE_SECTORS;
+    req->count = BCACHE_SECTORS;
+    req->buf = b->data;
+    req->done = bcache_io_done;
+    req->priv = b;
+    b->io = req;
+
+    if (blkdev_submit(req) < 0) {
+        bcache_io_done(req, -1);
+    }
+}
+
+static void bcache_cluster_done(blkdev_request_t* req, int status) {
+    bcache_cluster_t* c = (bcache_cluster_t*)req->priv;
+
+    /* The buffers are busy, so nobody else touches their data */
+    if (req->op == BLKDEV_OP_READ && status == 0) {
+        for (uint32_t i = 0; i < c->count; i++) {
+            memcpy(c->bufs[i]->data, c->data + (size_t)i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+        }
+    }
+
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < c->count; i++) {
+        buf_t* b = c->bufs[i];
+        if (req->op == BLKDEV_OP_READ) {
+            if (status == 0) {
+                b->flags |= BUF_VALID;
+            }
+        } else if (status < 0) {
+            b->flags |= BUF_DIRTY;
+        }
+        b->flags &= ~BUF_BUSY;
+    }
+    c->busy = false;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/* A cluster whose last request has completed, or NULL */
+static bcache_cluster_t* bcache_cluster_get(void) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_CLUSTERS; i++) {
+        bcache_cluster_t* c = &clusters[i];
+        if (c->busy || c->req.status == BLKDEV_REQ_PENDING) {
+            continue;
+        }
+        if (!c->data) {
+            phys_addr_t frames = pmm_alloc_pages(BCACHE_CLUSTER_BLOCKS);
+            if (frames == 0) {
+                break;
+            }
+            c->data = (uint8_t*)PHYS_TO_VIRT(frames);
+        }
+        c->busy = true;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return c;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return NULL;
+}
+
+/*
+ * Submit I/O for 'count' buffers of adjacent blocks of one device, all
+ * already BUF_BUSY: one request when a cluster is free, else one each.
+ */
+static void bcache_submit_run(buf_t** run, uint32_t count, uint32_t op) {
+    bcache_cluster_t* c = (count > 1) ? bcache_cluster_get() : NULL;
+    if (!c) {
+        for (uint32_t i = 0; i < count; i++) {
+            bcache_submit(run[i], op);
+        }
+        return;
+    }
+
+    blkdev_request_t* req = &c->req;
+    c->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        c->bufs[i] = run[i];
+        run[i]->io = req;
+        if (op == BLKDEV_OP_WRITE) {
+            memcpy(c->data + (size_t)i * BCACHE_BLOCK_SIZE, run[i]->data, BCACHE_BLOCK_SIZE);
+        }
+    }
+
+    memset(req, 0, sizeof(*req));
+    req->dev = run[0]->dev;
+    req->op = op;
+    req->lba = run[0]->block * BCACHE_SECTORS;
+    req->count = count * BCACHE_SECTORS;
+    req->buf = c->data;
+    req->done = bcache_cluster_done;
+    req->priv = c;
+
+    if (blkdev_submit(req) < 0) {
+        bcache_cluster_done(req, -1);
+    }
+}
+
+/* Longest run one request of the device can carry */
+static uint32_t bcache_run_max(blkdev_t* dev) {
+    uint32_t blocks = dev->max_sectors / BCACHE_SECTORS;
+    return MAX(1U, MIN(blocks, (uint32_t)BCACHE_CLUSTER_BLOCKS));
+}
+
+static void bcache_wait(buf_t* b) {
+    while (b->flags & BUF_BUSY) {
+        blkdev_wait(b->io);
+    }
+}
+
+/* Start reading a referenced buffer unless it is valid or already busy */
+static void bcache_start_read(buf_t* b) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    bool start = !(b->flags & (BUF_VALID | BUF_BUSY));
+    if (start) {
+        b->flags |= BUF_BUSY;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (start) {
+        bcache_submit(b, BLKDEV_OP_READ);
+    }
+}
+
+/* =============================================================================
+ * Getting Buffers
+ * =============================================================================
+ */
+
+static int bcache_write_dirty(blkdev_t* dev, bool idle_only);
+
+/* Referenced buffer for (dev, block); not necessarily valid */
+static buf_t* bcache_get(blkdev_t* dev, uint64_t block) {
+    if (!dev || block >= dev->sector_count / BCACHE_SECTORS) {
+        return NULL;
+    }
+
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&bcache_lock);
+
+        buf_t* b = bcache_lookup(dev, block);
+        if (b) {
+            b->refs++;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            return b;
+        }
+
+        buf_t* dirty;
+        b = bcache_victim(&dirty);
+        if (b && !b->data) {
+            phys_addr_t frame = pmm_alloc_page();
+            if (frame == 0) {
+                spin_unlock_irqrestore(&bcache_lock, flags);
+                return NULL;
+            }
+            b->data = (uint8_t*)PHYS_TO_VIRT(frame);
+        }
+        if (b) {
+            bcache_unhash(b);
+            b->dev = dev;
+            b->block = block;
+            b->flags = 0;
+            b->refs = 1;
+            uint32_t bucket = bcache_bucket(dev, block);
+            b->hash_next = bcache_hash[bucket];
+            bcache_hash[bucket] = b;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            return b;
+        }
+
+        if (!dirty) {
+            /* Every buffer is referenced or has I/O in flight */
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            return NULL;
+        }
+
+        /*
+         * Only dirty buffers are left to reuse: write back all idle ones
+         * of that device in runs rather than one per miss, then look again
+         */
+        blkdev_t* dirty_dev = dirty->dev;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (bcache_write_dirty(dirty_dev, true) < 0) {
+            return NULL;
+        }
+    }
+}
+
+/* =============================================================================
+ * Public Interface
+ * =============================================================================
+ */
+
+void bcache_init(void) {
+    memset(bcache_bufs, 0, sizeof(bcache_bufs));
+    memset(bcache_hash, 0, sizeof(bcache_hash));
+    lru_head = NULL;
+    lru_tail = NULL;
+
+    /* Every buffer starts idle; the order does not matter */
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_bufs[i].io = &bcache_bufs[i].req;
+        lru_push_front(&bcache_bufs[i]);
+    }
+}
+
+buf_t* bcache_read(blkdev_t* dev, uint64_t block) {
+    buf_t* b = bcache_get(dev, block);
+    if (!b) {
+        return NULL;
+    }
+
+    bcache_start_read(b);
+    bcache_wait(b);
+    if (!(b->flags & BUF_VALID)) {
+        bcache_release(b);
+        return NULL;
+    }
+    return b;
+}
+
+buf_t* bcache_getblk(blkdev_t* dev, uint64_t block) {
+    buf_t* b = bcache_get(dev, block);
+    if (b) {
+        bcache_wait(b);     /* Nothing in flight may land on the new data */
+    }
+    return b;
+}
+
+void bcache_readahead(blkdev_t* dev, uint64_t block, uint32_t count) {
+    if (!dev) {
+        return;
+    }
+
+    /* Runs of blocks that are neither cached nor being read */
+    uint32_t run_max = bcache_run_max(dev);
+    buf_t* run[BCACHE_CLUSTER_BLOCKS];
+    uint32_t run_len = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        buf_t* b = bcache_get(dev, block + i);
+        if (!b) {
+            break;
+        }
+
+        uint64_t flags = spin_lock_irqsave(&bcache_lock);
+        bool start = !(b->flags & (BUF_VALID | BUF_BUSY));
+        if (start) {
+            b->flags |= BUF_BUSY;
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        if (start) {
+            run[run_len++] = b;
+        }
+        if (run_len > 0 && (!start || run_len == run_max)) {
+            bcache_submit_run(run, run_len, BLKDEV_OP_READ);
+            run_len = 0;
+        }
+        /* In flight buffers are busy, so they are not reused meanwhile */
+        bcache_release(b);
+    }
+
+    if (run_len > 0) {
+        bcache_submit_run(run, run_len, BLKDEV_OP_READ);
+    }
+}
+
+void bcache_mark_dirty(buf_t* b) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    b->flags |= BUF_VALID | BUF_DIRTY;
+    bool wake = !writeback_pending;
+    writeback_pending = true;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (wake) {
+        wake_up(&writeback_wq);
+    }
+}
+
+int bcache_write(buf_t* b) {
+    for (;;) {
+        bcache_wait(b);
+
+        uint64_t flags = spin_lock_irqsave(&bcache_lock);
+        if (b->flags & BUF_BUSY) {
+            /* Someone started I/O meanwhile */
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            continue;
+        }
+        b->flags = (b->flags | BUF_BUSY) & ~BUF_DIRTY;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        break;
+    }
+
+    bcache_submit(b, BLKDEV_OP_WRITE);
+    bcache_wait(b);
+    return (b->flags & BUF_DIRTY) ? -1 : 0;
+}
+
+void bcache_release(buf_t* b) {
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    if (b->refs > 0 && --b->refs == 0) {
+        lru_remove(b);
+        lru_push_front(b);
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+/* Does a sort before b on the disk? */
+static inline bool buf_before(const buf_t* a, const buf_t* b) {
+    return a->dev != b->dev ? (uintptr_t)a->dev < (uintptr_t)b->dev : a->block < b->block;
+}
+
+/*
+ * Write back the dirty buffers of 'dev' (NULL: of every device), runs of
+ * adjacent blocks as one request each. 'idle_only' passes over buffers
+ * someone holds, which may be halfway through a change.
+ * Returns 0 on success, -1 if any write failed.
+ */
+static int bcache_write_dirty(blkdev_t* dev, bool idle_only) {
+    buf_t* batch = NULL;
+
+    /* Claim the buffers */
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        buf_t* b = &bcache_bufs[i];
+        if (!b->dev || (dev && b->dev != dev) ||
+            (b->flags & (BUF_DIRTY | BUF_BUSY)) != BUF_DIRTY || (idle_only && b->refs != 0)) {
+            continue;
+        }
+        b->refs++;
+        b->flags = (b->flags | BUF_BUSY) & ~BUF_DIRTY;
+        b->sync_next = batch;
+        batch = b;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    /* Sort them by block; they are ours while busy */
+    buf_t* sorted = NULL;
+    while (batch) {
+        buf_t* b = batch;
+        batch = b->sync_next;
+        buf_t** link = &sorted;
+        while (*link && buf_before(*link, b)) {
+            link = &(*link)->sync_next;
+        }
+        b->sync_next = *link;
+        *link = b;
+    }
+
+    /* All of them in flight, adjacent blocks together, then wait for each */
+    buf_t* run[BCACHE_CLUSTER_BLOCKS];
+    uint32_t run_len = 0;
+    for (buf_t* b = sorted; b; b = b->sync_next) {
+        run[run_len++] = b;
+        buf_t* next = b->sync_next;
+        if (!next || next->dev != b->dev || next->block != b->block + 1 ||
+            run_len == bcache_run_max(b->dev)) {
+            bcache_submit_run(run, run_len, BLKDEV_OP_WRITE);
+            run_len = 0;
+        }
+    }
+
+    int result = 0;
+    while (sorted) {
+        buf_t* b = sorted;
+        sorted = b->sync_next;
+        bcache_wait(b);
+        if (b->flags & BUF_DIRTY) {
+            result = -1;
+        }
+        bcache_release(b);
+    }
+    return result;
+}
+
+int bcache_sync(blkdev_t* dev) {
+    int result = bcache_write_dirty(dev, false);
+    if (blkdev_flush(dev) < 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/* =============================================================================
+ * Write-Back Thread
+ * =============================================================================
+ */
+
+/* Is any buffer still dirty (held, or its write failed)? */
+static bool bcache_any_dirty(void) {
+    bool dirty = false;
+    uint64_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS && !dirty; i++) {
+        dirty = bcache_bufs[i].dev && (bcache_bufs[i].flags & BUF_DIRTY);
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return dirty;
+}
+
+/*
+ * Sleeps until bcache_mark_dirty() has something for it, so an idle
+ * system with a clean cache takes no timer events for it. The period
+ * timer is only armed while dirty buffers exist.
+ */
+static void bcache_writeback_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        wait_event(&writeback_wq, writeback_pending);
+        process_sleep(clock_ns() + (uint64_t)BCACHE_WRITEBACK_MS * 1000000ULL);
+
+        /* Cleared first: a buffer dirtied from here on sets it again */
+        uint64_t flags = spin_lock_irqsave(&bcache_lock);
+        writeback_pending = false;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        bcache_write_dirty(NULL, true);
+        if (bcache_any_dirty()) {
+            flags = spin_lock_irqsave(&bcache_lock);
+            writeback_pending = true;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+        }
+    }
+}
+
+void bcache_writeback_start(void) {
+    if (process_create("bcache-wb", bcache_writeback_thread, NULL) == (pid_t)-1) {
+        PANIC("Failed to create the bcache write-back thread");
+    }
+}
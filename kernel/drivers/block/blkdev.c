@@ -0,0 +1,207 @@
+/**
+ * =============================================================================
+ * Chanux OS - Block Device Layer Implementation
+ * =============================================================================
+ * Keeps the registered devices on a list and turns arbitrary sector
+ * ranges into driver-sized requests. Completions wake one shared wait
+ * queue; each waiter goes back to sleep until its own request is done.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/blkdev.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/spinlock.h"
+#include "../../include/proc/process.h"
+#include "../../include/proc/sched.h"
+#include "../../include/proc/wait.h"
+
+/* =============================================================================
+ * Registry
+ * =============================================================================
+ */
+
+static blkdev_t* blkdev_list = NULL;
+static spinlock_t blkdev_lock = SPINLOCK_INIT;
+
+int blkdev_register(blkdev_t* dev) {
+    if (!dev || !dev->ops || !(dev->ops->read || dev->ops->submit) || dev->max_sectors == 0) {
+        return -1;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&blkdev_lock);
+    for (blkdev_t* d = blkdev_list; d; d = d->next) {
+        if (strcmp(d->name, dev->name) == 0) {
+            spin_unlock_irqrestore(&blkdev_lock, flags);
+            return -1;
+        }
+    }
+
+    /* Keep registration order, so the first disk probed is listed first */
+    blkdev_t** link = &blkdev_list;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    dev->next = NULL;
+    *link = dev;
+    spin_unlock_irqrestore(&blkdev_lock, flags);
+
+    return 0;
+}
+
+blkdev_t* blkdev_find(const char* name) {
+    uint64_t flags = spin_lock_irqsave(&blkdev_lock);
+    blkdev_t* dev = blkdev_list;
+    while (dev && strcmp(dev->name, name) != 0) {
+        dev = dev->next;
+    }
+    spin_unlock_irqrestore(&blkdev_lock, flags);
+    return dev;
+}
+
+/* =============================================================================
+ * Requests
+ * =============================================================================
+ */
+
+/* Woken on every completion; waiters re-check their own request */
+static wait_queue_t blkdev_waiters = WAIT_QUEUE_INIT(blkdev_waiters);
+
+static bool blkdev_range_ok(blkdev_t* dev, uint64_t lba, uint64_t count) {
+    return dev && lba <= dev->sector_count && count <= dev->sector_count - lba;
+}
+
+int blkdev_submit(blkdev_request_t* req) {
+    blkdev_t* dev = req->dev;
+    if (!dev || req->count > dev->max_sectors) {
+        return -1;
+    }
+    if (req->op == BLKDEV_OP_FLUSH) {
+        if (req->count != 0) {
+            return -1;
+        }
+    } else if (req->count == 0 || !blkdev_range_ok(dev, req->lba, req->count)) {
+        return -1;
+    }
+    if (req->op == BLKDEV_OP_WRITE && !dev->ops->write && !dev->ops->submit) {
+        return -1;
+    }
+
+    req->status = BLKDEV_REQ_PENDING;
+    if (dev->ops->submit) {
+        return dev->ops->submit(dev, req);
+    }
+
+    /* Synchronous driver: the request is done when the call returns */
+    int result;
+    if (req->op == BLKDEV_OP_READ) {
+        result = dev->ops->read(dev, req->lba, req->count, req->buf);
+    } else if (req->op == BLKDEV_OP_WRITE) {
+        result = dev->ops->write(dev, req->lba, req->count, req->buf);
+    } else {
+        result = dev->ops->flush ? dev->ops->flush(dev) : 0;
+    }
+    blkdev_complete(req, (result < 0) ? -1 : 0);
+    return 0;
+}
+
+void blkdev_complete(blkdev_request_t* req, int status) {
+    if (req->done) {
+        req->done(req, status);
+    }
+
+    /* Once status is set the owner may reuse the request */
+    __asm__ volatile("" : : : "memory");
+    req->status = status;
+    wake_up(&blkdev_waiters);
+}
+
+int blkdev_wait(blkdev_request_t* req) {
+    blkdev_t* dev = req->dev;
+
+    if (sched_is_running() && interrupts_enabled() &&
+        !(process_current()->flags & PROCESS_FLAG_IDLE)) {
+        wait_event(&blkdev_waiters, req->status != BLKDEV_REQ_PENDING);
+        return req->status;
+    }
+
+    /* Boot time, or interrupts off: reap the completion ourselves */
+    while (req->status == BLKDEV_REQ_PENDING) {
+        if (dev->ops->poll) {
+            dev->ops->poll(dev);
+        } else {
+            cpu_pause();
+        }
+    }
+    return req->status;
+}
+
+/* =============================================================================
+ * Synchronous I/O
+ * =============================================================================
+ */
+
+/* Split into max_sectors requests, BLKDEV_BATCH of them in flight at a time */
+static int blkdev_transfer(blkdev_t* dev, uint32_t op, uint64_t lba, uint64_t count,
+                           uint8_t* buf) {
+    blkdev_request_t reqs[BLKDEV_BATCH];
+    int result = 0;
+
+    while (count > 0 && result == 0) {
+        uint32_t issued = 0;
+        while (count > 0 && issued < BLKDEV_BATCH) {
+            uint32_t n = (count > dev->max_sectors) ? dev->max_sectors : (uint32_t)count;
+            blkdev_request_t* req = &reqs[issued];
+            memset(req, 0, sizeof(*req));
+            req->dev = dev;
+            req->op = op;
+            req->lba = lba;
+            req->count = n;
+            req->buf = buf;
+            if (blkdev_submit(req) < 0) {
+                result = -1;
+                break;
+            }
+            issued++;
+            lba += n;
+            count -= n;
+            buf += (size_t)n * BLKDEV_SECTOR_SIZE;
+        }
+
+        for (uint32_t i = 0; i < issued; i++) {
+            if (blkdev_wait(&reqs[i]) < 0) {
+                result = -1;
+            }
+        }
+    }
+    return result;
+}
+
+int blkdev_read(blkdev_t* dev, uint64_t lba, uint64_t count, void* buf) {
+    if (!blkdev_range_ok(dev, lba, count)) {
+        return -1;
+    }
+    return blkdev_transfer(dev, BLKDEV_OP_READ, lba, count, (uint8_t*)buf);
+}
+
+int blkdev_write(blkdev_t* dev, uint64_t lba, uint64_t count, const void* buf) {
+    if (!blkdev_range_ok(dev, lba, count)) {
+        return -1;
+    }
+    /* Only read by the driver */
+    return blkdev_transfer(dev, BLKDEV_OP_WRITE, lba, count, (uint8_t*)buf);
+}
+
+int blkdev_flush(blkdev_t* dev) {
+    if (!dev) {
+        return -1;
+    }
+
+    blkdev_request_t req = { 0 };
+    req.dev = dev;
+    req.op = BLKDEV_OP_FLUSH;
+    if (blkdev_submit(&req) < 0) {
+        return -1;
+    }
+    return blkdev_wait(&req);
+}
@@ -12,9 +12,10 @@
  */
 
 #include "../../include/drivers/keyboard.h"
-#include "../../include/drivers/pic.h"
 #include "../../include/interrupts/irq.h"
 #include "../../include/kernel.h"
+#include "../../include/proc/sched.h"
+#include "../../include/proc/wait.h"
 
 /* =============================================================================
  * Scancode to ASCII Tables
@@ -66,10 +67,17 @@ static const char scancode_ascii_shift[128] = {
  * =============================================================================
  */
 
-/* Circular input buffer */
-static volatile char key_buffer[KB_BUFFER_SIZE];
-static volatile size_t buffer_head = 0;  /* Write position */
-static volatile size_t buffer_tail = 0;  /* Read position */
+/*
+ * Input ring: the IRQ handler is the only producer and the TTY line
+ * discipline (under its lock) the only consumer. head and tail are
+ * free-running; each side publishes its index with a release store.
+ */
+static char key_buffer[KB_BUFFER_SIZE];
+static volatile size_t buffer_head = 0;  /* Write position (IRQ1) */
+static volatile size_t buffer_tail = 0;  /* Read position (reader) */
+
+/* Processes waiting for input */
+static wait_queue_t key_waiters = WAIT_QUEUE_INIT(key_waiters);
 
 /* Modifier key states */
 static volatile bool shift_pressed = false;
@@ -86,23 +94,23 @@ static volatile bool caps_lock = false;
  * Check if the buffer is empty.
  */
 static inline bool buffer_empty(void) {
-    return buffer_head == buffer_tail;
+    return __atomic_load_n(&buffer_head, __ATOMIC_ACQUIRE) == buffer_tail;
 }
 
 /**
- * Check if the buffer is full.
+ * Check if the buffer is full (producer side).
  */
 static inline bool buffer_full(void) {
-    return ((buffer_head + 1) % KB_BUFFER_SIZE) == buffer_tail;
+    return buffer_head - __atomic_load_n(&buffer_tail, __ATOMIC_ACQUIRE) == KB_BUFFER_SIZE;
 }
 
 /**
- * Add a character to the buffer.
+ * Add a character to the buffer; dropped if it is full.
  */
 static void buffer_put(char c) {
     if (!buffer_full()) {
-        key_buffer[buffer_head] = c;
-        buffer_head = (buffer_head + 1) % KB_BUFFER_SIZE;
+        key_buffer[buffer_head & (KB_BUFFER_SIZE - 1)] = c;
+        __atomic_store_n(&buffer_head, buffer_head + 1, __ATOMIC_RELEASE);
     }
 }
 
@@ -113,8 +121,8 @@ static char buffer_get(void) {
     if (buffer_empty()) {
         return 0;
     }
-    char c = key_buffer[buffer_tail];
-    buffer_tail = (buffer_tail + 1) % KB_BUFFER_SIZE;
+    char c = key_buffer[buffer_tail & (KB_BUFFER_SIZE - 1)];
+    __atomic_store_n(&buffer_tail, buffer_tail + 1, __ATOMIC_RELEASE);
     return c;
 }
 
@@ -185,6 +193,7 @@ static void keyboard_irq_handler(registers_t* regs) {
     /* Add to buffer if it's a printable character or control character */
     if (ascii != 0) {
         buffer_put(ascii);
+        wake_up(&key_waiters);
     }
 }
 
@@ -216,7 +225,7 @@ void keyboard_init(void) {
     irq_register_handler(1, keyboard_irq_handler);
 
     /* Enable IRQ1 */
-    pic_unmask_irq(1);
+    irq_unmask(1);
 }
 
 /* =============================================================================
@@ -231,14 +240,26 @@ bool keyboard_has_key(void) {
     return !buffer_empty();
 }
 
+/**
+ * Wait until a key is available.
+ */
+void keyboard_wait(void) {
+    if (!sched_is_running()) {
+        /* Boot time: nothing else to run */
+        while (buffer_empty()) {
+            halt();  /* Wait for interrupt */
+        }
+        return;
+    }
+
+    wait_event(&key_waiters, !buffer_empty());
+}
+
 /**
  * Get the next character (blocking).
  */
 char keyboard_getchar(void) {
-    /* Wait for a key */
-    while (buffer_empty()) {
-        halt();  /* Wait for interrupt */
-    }
+    keyboard_wait();
     return buffer_get();
 }
 
@@ -0,0 +1,294 @@
+/**
+ * =============================================================================
+ * Chanux OS - PCI Bus Implementation
+ * =============================================================================
+ * Brute-force enumeration: function 0 of every slot on every bus, and
+ * functions 1-7 of multi-function devices. Empty slots read back a vendor
+ * of 0xFFFF.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/pci.h"
+#include "../../include/interrupts/irq.h"
+#include "../../include/kernel.h"
+#include "../../include/spinlock.h"
+#include "../../include/mm/vmm.h"
+#include "../vga/vga.h"
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static uint32_t pci_device_count = 0;
+
+/* The address/data port pair is one shared register window */
+static spinlock_t pci_lock = SPINLOCK_INIT;
+
+/* =============================================================================
+ * Configuration Space Access
+ * =============================================================================
+ */
+
+static uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return (1U << 31) | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    uint64_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return value;
+}
+
+static void pci_config_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset,
+                             uint32_t value) {
+    uint64_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset) {
+    return pci_config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(const pci_device_t* dev, uint8_t offset) {
+    return (uint8_t)(pci_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value) {
+    pci_config_write(dev->bus, dev->slot, dev->func, offset, value);
+}
+
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value) {
+    /* Read-modify-write of the containing dword */
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t old = pci_read32(dev, offset);
+    pci_write32(dev, offset, (old & ~(0xFFFFU << shift)) | ((uint32_t)value << shift));
+}
+
+/* =============================================================================
+ * BARs and Enabling
+ * =============================================================================
+ */
+
+uint16_t pci_bar_io(const pci_device_t* dev, uint32_t bar) {
+    if (bar >= 6) {
+        return 0;
+    }
+    uint32_t value = pci_read32(dev, (uint8_t)(PCI_BAR0 + bar * 4));
+    if (!(value & PCI_BAR_IO)) {
+        return 0;
+    }
+    return (uint16_t)(value & PCI_BAR_IO_MASK);
+}
+
+phys_addr_t pci_bar_mem(const pci_device_t* dev, uint32_t bar) {
+    if (bar >= 6) {
+        return 0;
+    }
+    uint32_t value = pci_read32(dev, (uint8_t)(PCI_BAR0 + bar * 4));
+    if (value & PCI_BAR_IO) {
+        return 0;
+    }
+
+    phys_addr_t base = value & PCI_BAR_MEM_MASK;
+    if ((value & PCI_BAR_MEM_64) && bar < 5) {
+        base |= (phys_addr_t)pci_read32(dev, (uint8_t)(PCI_BAR0 + (bar + 1) * 4)) << 32;
+    }
+    return base;
+}
+
+void pci_enable_device(const pci_device_t* dev) {
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    command &= (uint16_t)~PCI_COMMAND_INTX_OFF;
+    pci_write16(dev, PCI_COMMAND, command);
+}
+
+/* =============================================================================
+ * Capabilities and MSI
+ * =============================================================================
+ */
+
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t id) {
+    if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+
+    /* At most 48 capabilities fit; stop there should the list loop */
+    uint8_t offset = pci_read8(dev, PCI_CAP_POINTER) & 0xFC;
+    for (int i = 0; i < 48 && offset != 0; i++) {
+        uint16_t header = pci_read16(dev, offset);
+        if ((header & 0xFF) == id) {
+            return offset;
+        }
+        offset = (uint8_t)(header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+int pci_enable_msi(pci_device_t* dev, uint8_t vector, uint32_t cpu) {
+    uint32_t apic_id;
+    if (dev->msi_cap == 0 || irq_cpu_apic_id(cpu, &apic_id) < 0) {
+        return -1;
+    }
+
+    uint8_t cap = dev->msi_cap;
+    uint16_t ctrl = pci_read16(dev, cap + PCI_MSI_CTRL);
+
+    /* Off while the message changes, then one vector */
+    pci_write16(dev, cap + PCI_MSI_CTRL, ctrl & (uint16_t)~PCI_MSI_CTRL_ENABLE);
+    pci_write32(dev, cap + PCI_MSI_ADDR, PCI_MSI_ADDRESS_BASE | (apic_id << 12));
+    if (ctrl & PCI_MSI_CTRL_64BIT) {
+        pci_write32(dev, cap + PCI_MSI_ADDR_HIGH, 0);
+        pci_write16(dev, cap + PCI_MSI_DATA_64, vector);
+    } else {
+        pci_write16(dev, cap + PCI_MSI_DATA_32, vector);
+    }
+    ctrl &= (uint16_t)~PCI_MSI_CTRL_MME_MASK;
+    pci_write16(dev, cap + PCI_MSI_CTRL, ctrl | PCI_MSI_CTRL_ENABLE);
+
+    pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) | PCI_COMMAND_INTX_OFF);
+    return 0;
+}
+
+int pci_enable_msix(pci_device_t* dev, uint16_t entry, uint8_t vector, uint32_t cpu) {
+    uint32_t apic_id;
+    if (dev->msix_cap == 0 || entry >= dev->msix_size ||
+        irq_cpu_apic_id(cpu, &apic_id) < 0) {
+        return -1;
+    }
+
+    uint8_t cap = dev->msix_cap;
+    uint16_t ctrl = pci_read16(dev, cap + PCI_MSIX_CTRL);
+
+    if (!dev->msix_table) {
+        uint32_t table = pci_read32(dev, cap + PCI_MSIX_TABLE);
+        phys_addr_t bar = pci_bar_mem(dev, table & PCI_MSIX_TABLE_BIR);
+        if (bar == 0) {
+            return -1;
+        }
+        dev->msix_table = (volatile uint32_t*)vmm_map_mmio(
+            bar + (table & ~(uint32_t)PCI_MSIX_TABLE_BIR),
+            (size_t)dev->msix_size * PCI_MSIX_ENTRY_SIZE);
+        if (!dev->msix_table) {
+            return -1;
+        }
+
+        /* Nothing fires until its entry is set up */
+        for (uint32_t i = 0; i < dev->msix_size; i++) {
+            dev->msix_table[(i * PCI_MSIX_ENTRY_SIZE + PCI_MSIX_ENTRY_CTRL) / 4] =
+                PCI_MSIX_ENTRY_MASKED;
+        }
+    }
+
+    /* Enabled but held back while the entry is written */
+    pci_write16(dev, cap + PCI_MSIX_CTRL, ctrl | PCI_MSIX_CTRL_ENABLE | PCI_MSIX_CTRL_MASKALL);
+
+    volatile uint32_t* e = dev->msix_table + (uint32_t)entry * PCI_MSIX_ENTRY_SIZE / 4;
+    e[PCI_MSIX_ENTRY_CTRL / 4] = PCI_MSIX_ENTRY_MASKED;
+    e[PCI_MSIX_ENTRY_ADDR / 4] = PCI_MSI_ADDRESS_BASE | (apic_id << 12);
+    e[PCI_MSIX_ENTRY_ADDR_HIGH / 4] = 0;
+    e[PCI_MSIX_ENTRY_DATA / 4] = vector;
+    e[PCI_MSIX_ENTRY_CTRL / 4] = 0;
+
+    pci_write16(dev, cap + PCI_MSIX_CTRL,
+                (ctrl | PCI_MSIX_CTRL_ENABLE) & (uint16_t)~PCI_MSIX_CTRL_MASKALL);
+    pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) | PCI_COMMAND_INTX_OFF);
+    return 0;
+}
+
+void pci_disable_msix(pci_device_t* dev) {
+    if (dev->msix_cap == 0) {
+        return;
+    }
+    uint16_t ctrl = pci_read16(dev, dev->msix_cap + PCI_MSIX_CTRL);
+    pci_write16(dev, dev->msix_cap + PCI_MSIX_CTRL, ctrl & (uint16_t)~PCI_MSIX_CTRL_ENABLE);
+    pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) & (uint16_t)~PCI_COMMAND_INTX_OFF);
+}
+
+/* =============================================================================
+ * Enumeration
+ * =============================================================================
+ */
+
+static void pci_add_function(uint8_t bus, uint8_t slot, uint8_t func) {
+    if (pci_device_count >= PCI_MAX_DEVICES) {
+        return;
+    }
+
+    pci_device_t* dev = &pci_devices[pci_device_count++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+
+    uint32_t id = pci_read32(dev, PCI_VENDOR_ID);
+    dev->vendor = (uint16_t)id;
+    dev->device = (uint16_t)(id >> 16);
+
+    uint32_t class_reg = pci_read32(dev, PCI_REVISION_ID);
+    dev->prog_if = (uint8_t)(class_reg >> 8);
+    dev->subclass = (uint8_t)(class_reg >> 16);
+    dev->class_code = (uint8_t)(class_reg >> 24);
+
+    uint32_t irq_reg = pci_read32(dev, PCI_INTERRUPT_LINE);
+    dev->irq_line = (uint8_t)irq_reg;
+    dev->irq_pin = (uint8_t)(irq_reg >> 8);
+
+    dev->msi_cap = pci_find_capability(dev, PCI_CAP_ID_MSI);
+    dev->msix_cap = pci_find_capability(dev, PCI_CAP_ID_MSIX);
+    dev->msix_size = 0;
+    dev->msix_table = NULL;
+    if (dev->msix_cap != 0) {
+        dev->msix_size = (pci_read16(dev, dev->msix_cap + PCI_MSIX_CTRL) & PCI_MSIX_CTRL_SIZE) + 1;
+    }
+}
+
+void pci_init(void) {
+    pci_device_count = 0;
+
+    for (uint32_t bus = 0; bus < PCI_MAX_BUSES; bus++) {
+        for (uint8_t slot = 0; slot < PCI_MAX_SLOTS; slot++) {
+            uint32_t id = pci_config_read((uint8_t)bus, slot, 0, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == PCI_VENDOR_NONE) {
+                continue;
+            }
+            pci_add_function((uint8_t)bus, slot, 0);
+
+            uint32_t header = pci_config_read((uint8_t)bus, slot, 0, PCI_HEADER_TYPE) >> 16;
+            if (!(header & PCI_HEADER_MULTIFUNC)) {
+                continue;
+            }
+            for (uint8_t func = 1; func < PCI_MAX_FUNCS; func++) {
+                id = pci_config_read((uint8_t)bus, slot, func, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) != PCI_VENDOR_NONE) {
+                    pci_add_function((uint8_t)bus, slot, func);
+                }
+            }
+        }
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[PCI] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("%u functions found\n", pci_device_count);
+}
+
+pci_device_t* pci_find_device(uint16_t vendor, uint16_t device, pci_device_t* from) {
+    uint32_t start = from ? (uint32_t)(from - pci_devices) + 1 : 0;
+    for (uint32_t i = start; i < pci_device_count; i++) {
+        if (pci_devices[i].vendor == vendor && pci_devices[i].device == device) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
@@ -4,6 +4,10 @@
  * =============================================================================
  * Configures the PIT for system timing at 100Hz.
  *
+ * Once clock_start() switches the kernel to one-shot clock events the PIT
+ * is stopped; the tick count is then derived from clock_ns() so existing
+ * users of pit_get_ticks() keep working.
+ *
  * The timer interrupt handler:
  *   1. Increments the tick counter
  *   2. (Future) Triggers scheduler tick
@@ -12,11 +16,12 @@
  */
 
 #include "../../include/drivers/pit.h"
-#include "../../include/drivers/pic.h"
 #include "../../include/interrupts/irq.h"
 #include "../../include/interrupts/idt.h"
 #include "../../include/proc/sched.h"
 #include "../../include/kernel.h"
+#include "../../include/clock.h"
+#include "../../include/user/vdso.h"
 #include "../vga/vga.h"
 
 /* =============================================================================
@@ -27,6 +32,9 @@
 /* Tick counter - incremented every timer interrupt */
 static volatile uint64_t tick_count = 0;
 
+/* IRQ0 masked; time comes from clock_ns() */
+static volatile bool pit_stopped = false;
+
 /* =============================================================================
  * Timer Interrupt Handler
  * =============================================================================
@@ -39,6 +47,7 @@ static volatile uint64_t tick_count = 0;
 static void pit_irq_handler(registers_t* regs) {
     /* Increment tick counter */
     tick_count++;
+    vdso_update_ticks(tick_count);
 
     /* Call scheduler tick handler for preemption */
     if (sched_is_running()) {
@@ -75,7 +84,7 @@ void pit_init(void) {
     irq_register_handler(0, pit_irq_handler);
 
     /* Enable IRQ0 */
-    pic_unmask_irq(0);
+    irq_unmask(0);
 }
 
 /* =============================================================================
@@ -87,6 +96,11 @@ void pit_init(void) {
  * Get current tick count.
  */
 uint64_t pit_get_ticks(void) {
+    if (pit_stopped) {
+        /* Never step back behind the last real tick */
+        uint64_t ticks = clock_ns() / (PIT_MS_PER_TICK * NSEC_PER_MSEC);
+        return ticks > tick_count ? ticks : tick_count;
+    }
     return tick_count;
 }
 
@@ -94,26 +108,38 @@ uint64_t pit_get_ticks(void) {
  * Get uptime in milliseconds.
  */
 uint64_t pit_get_uptime_ms(void) {
-    return tick_count * PIT_MS_PER_TICK;
+    return clock_ns() / NSEC_PER_MSEC;
 }
 
 /**
  * Get uptime in seconds.
  */
 uint64_t pit_get_uptime_sec(void) {
-    return tick_count / PIT_TICK_RATE;
+    return clock_ns() / NSEC_PER_SEC;
 }
 
 /**
  * Sleep for specified number of ticks.
  */
 void pit_sleep_ticks(uint64_t ticks) {
-    uint64_t target = tick_count + ticks;
-    while (tick_count < target) {
-        halt();  /* Wait for interrupt */
+    uint64_t target = pit_get_ticks() + ticks;
+    while (pit_get_ticks() < target) {
+        if (pit_stopped) {
+            cpu_pause();    /* No periodic interrupt to wait for */
+        } else {
+            halt();         /* Wait for interrupt */
+        }
     }
 }
 
+/**
+ * Stop the periodic interrupt.
+ */
+void pit_stop(void) {
+    irq_mask(0);
+    pit_stopped = true;
+}
+
 /**
  * Sleep for specified number of milliseconds.
  */
@@ -0,0 +1,188 @@
+/**
+ * =============================================================================
+ * Chanux OS - Serial Port (16550 UART) Driver Implementation
+ * =============================================================================
+ * Buffered COM1 output (see drivers/serial.h).
+ *
+ * serial_lock covers the ring and the interrupt enable register. It nests
+ * inside the console lock, and the IRQ4 handler takes nothing else.
+ *
+ * tx_active says the transmitter interrupt is armed: the UART still has
+ * bytes to send, or the ring does, and the next THRE interrupt will move
+ * them on. When it fires with the ring empty the interrupt is disarmed
+ * again, so an idle port raises no interrupts.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/serial.h"
+#include "../../include/interrupts/irq.h"
+#include "../../include/kernel.h"
+#include "../../include/spinlock.h"
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static bool serial_initialized = false;
+
+/* Buffered (interrupt-driven) output; false: poll for every byte */
+static volatile bool serial_buffered = false;
+
+/* Transmit ring: head is written by serial_putchar(), tail by the UART */
+static char tx_buffer[SERIAL_TX_BUFFER_SIZE];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static bool tx_active = false;
+
+static spinlock_t serial_lock = SPINLOCK_INIT;
+
+/* =============================================================================
+ * Helper Functions
+ * =============================================================================
+ */
+
+static inline bool tx_empty(void) {
+    return tx_head == tx_tail;
+}
+
+static inline bool tx_full(void) {
+    return tx_head - tx_tail == SERIAL_TX_BUFFER_SIZE;
+}
+
+/**
+ * Write one byte once the transmitter has room.
+ */
+static void serial_poll_putchar(char c) {
+    while ((inb(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE) == 0) {
+        cpu_pause();
+    }
+    outb(SERIAL_COM1 + SERIAL_THR, (uint8_t)c);
+}
+
+/**
+ * Refill the transmit FIFO from the ring if it has drained.
+ * Caller holds serial_lock.
+ */
+static void tx_fill_fifo(void) {
+    if ((inb(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE) == 0) {
+        return;
+    }
+    for (int i = 0; i < SERIAL_FIFO_SIZE && !tx_empty(); i++) {
+        outb(SERIAL_COM1 + SERIAL_THR,
+             (uint8_t)tx_buffer[tx_tail++ & (SERIAL_TX_BUFFER_SIZE - 1)]);
+    }
+}
+
+/* =============================================================================
+ * Interrupt Handler
+ * =============================================================================
+ */
+
+/**
+ * IRQ4: the transmit FIFO is empty.
+ */
+static void serial_irq_handler(registers_t* regs) {
+    (void)regs;
+
+    /* Reading IIR acknowledges a THRE interrupt */
+    inb(SERIAL_COM1 + SERIAL_IIR);
+
+    spin_lock(&serial_lock);
+    tx_fill_fifo();
+    if (tx_empty()) {
+        outb(SERIAL_COM1 + SERIAL_IER, 0x00);
+        tx_active = false;
+    }
+    spin_unlock(&serial_lock);
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+void serial_init(void) {
+    outb(SERIAL_COM1 + SERIAL_IER, 0x00);   /* Disable all interrupts */
+    outb(SERIAL_COM1 + SERIAL_LCR, 0x80);   /* Enable DLAB (set baud rate divisor) */
+    outb(SERIAL_COM1 + 0, 0x03);            /* Set divisor to 3 (lo byte) 38400 baud */
+    outb(SERIAL_COM1 + 1, 0x00);            /*                  (hi byte) */
+    outb(SERIAL_COM1 + SERIAL_LCR, 0x03);   /* 8 bits, no parity, one stop bit */
+    outb(SERIAL_COM1 + SERIAL_FCR, 0xC7);   /* Enable FIFO, clear them, with 14-byte threshold */
+    outb(SERIAL_COM1 + SERIAL_MCR, 0x0B);   /* IRQs enabled (OUT2), RTS/DSR set */
+    serial_initialized = true;
+}
+
+void serial_enable_irq(void) {
+    if (!serial_initialized) {
+        serial_init();
+    }
+
+    irq_register_handler(SERIAL_IRQ, serial_irq_handler);
+    irq_unmask(SERIAL_IRQ);
+    serial_buffered = true;
+}
+
+/* =============================================================================
+ * Output
+ * =============================================================================
+ */
+
+void serial_putchar(char c) {
+    if (!serial_initialized) {
+        serial_init();
+    }
+
+    if (!serial_buffered) {
+        serial_poll_putchar(c);
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&serial_lock);
+
+    /* Out of room: the line is the bottleneck, wait for it */
+    while (tx_full()) {
+        serial_poll_putchar(tx_buffer[tx_tail++ & (SERIAL_TX_BUFFER_SIZE - 1)]);
+    }
+    tx_buffer[tx_head++ & (SERIAL_TX_BUFFER_SIZE - 1)] = c;
+
+    /* Idle transmitter: start it, and let the interrupt do the rest */
+    if (!tx_active) {
+        tx_fill_fifo();
+        outb(SERIAL_COM1 + SERIAL_IER, SERIAL_IER_THRE);
+        tx_active = true;
+    }
+
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+void serial_flush(void) {
+    if (!serial_buffered) {
+        return;
+    }
+
+    /* Poll the rest out; the interrupt finds an empty ring and stops */
+    uint64_t flags = spin_lock_irqsave(&serial_lock);
+    while (!tx_empty()) {
+        serial_poll_putchar(tx_buffer[tx_tail++ & (SERIAL_TX_BUFFER_SIZE - 1)]);
+    }
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+void serial_panic(void) {
+    if (!serial_initialized) {
+        serial_init();
+    }
+
+    /*
+     * The lock may be held by a CPU that will never let go (or by this
+     * one, if the fault hit inside serial_putchar()); the system is
+     * halting, so take the ring without it.
+     */
+    serial_buffered = false;
+    outb(SERIAL_COM1 + SERIAL_IER, 0x00);
+    while (!tx_empty()) {
+        serial_poll_putchar(tx_buffer[tx_tail++ & (SERIAL_TX_BUFFER_SIZE - 1)]);
+    }
+    tx_active = false;
+}
@@ -0,0 +1,143 @@
+/**
+ * =============================================================================
+ * Chanux OS - Console TTY Implementation
+ * =============================================================================
+ * Canonical-mode line discipline (see drivers/tty.h).
+ *
+ * tty_lock makes the reader the keyboard ring's single consumer and
+ * covers the line being edited. Keys are taken from the ring only while
+ * no completed line is waiting, so type-ahead after Enter stays raw until
+ * the line before it has been read.
+ *
+ * Echo is collected and written with one vga_write() per batch, so a
+ * burst of input costs a screen update per batch rather than per key.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/tty.h"
+#include "../../include/drivers/keyboard.h"
+#include "../../include/kernel.h"
+#include "../../include/klog.h"
+#include "../../include/spinlock.h"
+#include "../vga/vga.h"
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static spinlock_t tty_lock = SPINLOCK_INIT;
+
+/* Line being edited, or completed and being read (tty_lock) */
+static char tty_line[TTY_LINE_MAX];
+static size_t tty_line_len = 0;
+static size_t tty_line_pos = 0;             /* Next byte to hand out */
+static volatile bool tty_line_done = false; /* Ended by Enter */
+
+/* Pending echo (tty_lock) */
+#define TTY_ECHO_MAX        64
+
+static char tty_echo[TTY_ECHO_MAX];
+static size_t tty_echo_len = 0;
+
+/* =============================================================================
+ * Echo
+ * =============================================================================
+ */
+
+static void echo_flush(void) {
+    if (tty_echo_len > 0) {
+        vga_write(tty_echo, tty_echo_len);
+        tty_echo_len = 0;
+    }
+}
+
+static void echo(const char* str, size_t len) {
+    if (tty_echo_len + len > TTY_ECHO_MAX) {
+        echo_flush();
+    }
+    for (size_t i = 0; i < len; i++) {
+        tty_echo[tty_echo_len++] = str[i];
+    }
+}
+
+/* =============================================================================
+ * Line Discipline
+ * =============================================================================
+ */
+
+/**
+ * Apply one key to the line.
+ */
+static void tty_input(char c) {
+    if (c == '\n' || c == '\r') {
+        /* Enter: the line is ready */
+        tty_line[tty_line_len++] = '\n';
+        tty_line_done = true;
+        echo("\n", 1);
+    } else if (c == '\b' || c == 127) {
+        /* Backspace */
+        if (tty_line_len > 0) {
+            tty_line_len--;
+            echo("\b \b", 3);
+        }
+    } else if (c >= 32 && c < 127 && tty_line_len < TTY_LINE_MAX - 1) {
+        /* Printable character, room left for the newline */
+        tty_line[tty_line_len++] = c;
+        echo(&c, 1);
+    }
+    /* Ignore other control characters */
+}
+
+/**
+ * Take keys from the keyboard ring until a line is complete or the ring
+ * is empty. Caller holds tty_lock.
+ */
+static void tty_process(void) {
+    if (tty_line_done || !keyboard_has_key()) {
+        return;
+    }
+
+    /* Echo goes after kernel messages already logged */
+    klog_flush();
+
+    while (!tty_line_done && keyboard_has_key()) {
+        tty_input(keyboard_getchar_nonblock());
+    }
+    echo_flush();
+}
+
+/* =============================================================================
+ * TTY API
+ * =============================================================================
+ */
+
+size_t tty_read(char* buf, size_t len) {
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&tty_lock);
+        tty_process();
+
+        if (tty_line_done) {
+            size_t n = MIN(len, tty_line_len - tty_line_pos);
+            for (size_t i = 0; i < n; i++) {
+                buf[i] = tty_line[tty_line_pos++];
+            }
+
+            /* Line handed out: start the next one */
+            if (tty_line_pos == tty_line_len) {
+                tty_line_len = 0;
+                tty_line_pos = 0;
+                tty_line_done = false;
+            }
+            spin_unlock_irqrestore(&tty_lock, flags);
+            return n;
+        }
+
+        spin_unlock_irqrestore(&tty_lock, flags);
+        keyboard_wait();
+    }
+}
+
+bool tty_input_ready(void) {
+    return tty_line_done;
+}
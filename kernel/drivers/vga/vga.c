@@ -10,12 +10,22 @@
  *   - Byte 1: Attribute byte (foreground | background << 4)
  *
  * Screen is 80 columns x 25 rows = 4000 bytes
+ *
+ * Output goes to a shadow copy of the screen in RAM first. Its rows form
+ * a ring: scrolling only advances vga_top and blanks one row. Rows that
+ * changed are marked dirty and copied to VGA memory, one row at a time,
+ * when the write finishes (vga_flush()), and the hardware cursor is
+ * moved once per write instead of once per character. All output runs
+ * under console_lock.
  * =============================================================================
  */
 
 #include "vga.h"
 #include "../../include/kernel.h"
-#include "../../include/stdarg.h"
+#include "../../include/smp.h"
+#include "../../include/spinlock.h"
+#include "../../include/string.h"
+#include "../../include/drivers/serial.h"
 
 /* =============================================================================
  * Static Variables
@@ -25,13 +35,36 @@
 /* VGA buffer pointer */
 static volatile uint16_t* vga_buffer = (uint16_t*)VGA_MEMORY;
 
+/* Shadow screen: a ring of rows, screen row 0 is shadow row vga_top */
+static uint16_t vga_shadow[VGA_HEIGHT * VGA_WIDTH];
+static int vga_top = 0;
+
+/* Screen rows changed since the last flush (bit y = row y) */
+#define VGA_ALL_ROWS        ((1U << VGA_HEIGHT) - 1)
+
+static uint32_t vga_dirty = 0;
+
+_Static_assert(VGA_HEIGHT <= 32, "vga_dirty holds one bit per row");
+
 /* Current cursor position */
 static int cursor_x = 0;
 static int cursor_y = 0;
 
+/* Position last sent to the hardware cursor (-1: unknown) */
+static int hw_cursor_pos = -1;
+
 /* Current color attribute */
 static uint8_t current_color = 0;
 
+/*
+ * Keeps console writes from different CPUs apart. The owner is recorded
+ * so that a fault raised while printing can still print on the same CPU.
+ */
+#define CONSOLE_NO_OWNER    0xFFFFFFFF
+
+static spinlock_t console_lock = SPINLOCK_INIT;
+static volatile uint32_t console_owner = CONSOLE_NO_OWNER;
+
 /* =============================================================================
  * Helper Functions
  * =============================================================================
@@ -52,119 +85,84 @@ static inline uint16_t vga_make_entry(char c, uint8_t color) {
 }
 
 /**
- * Calculate buffer index from x, y coordinates.
+ * Find screen row y in the shadow buffer.
  */
-static inline size_t vga_index(int x, int y) {
-    return y * VGA_WIDTH + x;
+static inline uint16_t* vga_row(int y) {
+    return &vga_shadow[((vga_top + y) % VGA_HEIGHT) * VGA_WIDTH];
 }
 
-/* =============================================================================
- * VGA I/O Ports for Cursor Control
- * =============================================================================
+/**
+ * Write one cell of the shadow screen.
  */
+static inline void vga_set_cell(int x, int y, uint16_t entry) {
+    vga_row(y)[x] = entry;
+    vga_dirty |= 1U << y;
+}
 
-#define VGA_CTRL_REGISTER   0x3D4
-#define VGA_DATA_REGISTER   0x3D5
-
-/* =============================================================================
- * Serial Port for Debug Output
- * =============================================================================
+/**
+ * Take the console lock, unless this CPU already holds it.
+ *
+ * @param flags Set to the interrupt state to restore
+ * @return true if the lock was already held here (nested output)
  */
-
-#define SERIAL_PORT         0x3F8
-
-static int serial_initialized = 0;
-
-static void serial_init(void) {
-    outb(SERIAL_PORT + 1, 0x00);    /* Disable all interrupts */
-    outb(SERIAL_PORT + 3, 0x80);    /* Enable DLAB (set baud rate divisor) */
-    outb(SERIAL_PORT + 0, 0x03);    /* Set divisor to 3 (lo byte) 38400 baud */
-    outb(SERIAL_PORT + 1, 0x00);    /*                  (hi byte) */
-    outb(SERIAL_PORT + 3, 0x03);    /* 8 bits, no parity, one stop bit */
-    outb(SERIAL_PORT + 2, 0xC7);    /* Enable FIFO, clear them, with 14-byte threshold */
-    outb(SERIAL_PORT + 4, 0x0B);    /* IRQs enabled, RTS/DSR set */
-    serial_initialized = 1;
+static bool console_acquire(uint64_t* flags) {
+    *flags = irq_save();
+    uint32_t cpu = cpu_this()->id;
+    if (console_owner == cpu) {
+        return true;
+    }
+    spin_lock(&console_lock);
+    console_owner = cpu;
+    return false;
 }
 
-static void serial_putchar(char c) {
-    if (!serial_initialized) {
-        serial_init();
+/**
+ * Release what console_acquire() took.
+ */
+static void console_release(uint64_t flags, bool nested) {
+    if (!nested) {
+        console_owner = CONSOLE_NO_OWNER;
+        spin_unlock(&console_lock);
     }
-    /* Wait for transmit buffer to be empty */
-    while ((inb(SERIAL_PORT + 5) & 0x20) == 0);
-    outb(SERIAL_PORT, c);
+    irq_restore(flags);
 }
 
 /* =============================================================================
- * Implementation
+ * VGA I/O Ports for Cursor Control
  * =============================================================================
  */
 
-void vga_init(void) {
-    /* Set default colors: light grey on black */
-    current_color = vga_make_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-
-    /* Clear screen */
-    vga_clear();
-
-    /* Enable cursor */
-    vga_enable_cursor(true);
-}
-
-void vga_clear(void) {
-    uint16_t blank = vga_make_entry(' ', current_color);
-
-    for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-        vga_buffer[i] = blank;
-    }
-
-    cursor_x = 0;
-    cursor_y = 0;
-    vga_update_cursor();
-}
-
-void vga_set_color(vga_color_t fg, vga_color_t bg) {
-    current_color = vga_make_color(fg, bg);
-}
-
-void vga_set_cursor(int x, int y) {
-    if (x >= 0 && x < VGA_WIDTH) {
-        cursor_x = x;
-    }
-    if (y >= 0 && y < VGA_HEIGHT) {
-        cursor_y = y;
-    }
-    vga_update_cursor();
-}
-
-int vga_get_cursor_x(void) {
-    return cursor_x;
-}
+#define VGA_CTRL_REGISTER   0x3D4
+#define VGA_DATA_REGISTER   0x3D5
 
-int vga_get_cursor_y(void) {
-    return cursor_y;
-}
+/* =============================================================================
+ * Shadow Screen (console_lock held)
+ * =============================================================================
+ */
 
-void vga_scroll(void) {
-    /* Move all lines up by one */
-    for (int y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[vga_index(x, y)] = vga_buffer[vga_index(x, y + 1)];
-        }
-    }
+/**
+ * Scroll the shadow screen up by one line.
+ */
+static void vga_scroll_locked(void) {
+    /* The old top row becomes the new bottom one */
+    vga_top = (vga_top + 1) % VGA_HEIGHT;
 
-    /* Clear the last line */
     uint16_t blank = vga_make_entry(' ', current_color);
+    uint16_t* row = vga_row(VGA_HEIGHT - 1);
     for (int x = 0; x < VGA_WIDTH; x++) {
-        vga_buffer[vga_index(x, VGA_HEIGHT - 1)] = blank;
+        row[x] = blank;
     }
 
-    /* Move cursor up */
+    /* Every screen row now shows a different shadow row */
+    vga_dirty = VGA_ALL_ROWS;
     cursor_y = VGA_HEIGHT - 1;
 }
 
-void vga_putchar(char c) {
-    /* Mirror output to serial for debugging */
+/**
+ * Put one character on the shadow screen.
+ */
+static void vga_emit(char c) {
+    /* Mirror output to serial for debugging (queued, see drivers/serial.h) */
     serial_putchar(c);
 
     /* Handle special characters */
@@ -189,16 +187,14 @@ void vga_putchar(char c) {
             /* Backspace: move cursor back and clear character */
             if (cursor_x > 0) {
                 cursor_x--;
-                vga_buffer[vga_index(cursor_x, cursor_y)] =
-                    vga_make_entry(' ', current_color);
+                vga_set_cell(cursor_x, cursor_y, vga_make_entry(' ', current_color));
             }
             break;
 
         default:
             /* Regular character: print it */
             if (c >= ' ') {  /* Only printable characters */
-                vga_buffer[vga_index(cursor_x, cursor_y)] =
-                    vga_make_entry(c, current_color);
+                vga_set_cell(cursor_x, cursor_y, vga_make_entry(c, current_color));
                 cursor_x++;
             }
             break;
@@ -212,59 +208,22 @@ void vga_putchar(char c) {
 
     /* Handle scroll */
     if (cursor_y >= VGA_HEIGHT) {
-        vga_scroll();
+        vga_scroll_locked();
     }
-
-    vga_update_cursor();
 }
 
-void vga_puts(const char* str) {
+static void vga_emit_str(const char* str) {
     while (*str) {
-        vga_putchar(*str++);
-    }
-}
-
-void vga_println(const char* str) {
-    vga_puts(str);
-    vga_putchar('\n');
-}
-
-void vga_update_cursor(void) {
-    uint16_t pos = cursor_y * VGA_WIDTH + cursor_x;
-
-    /* Send cursor position to VGA controller */
-    outb(VGA_CTRL_REGISTER, 0x0F);          /* Low byte index */
-    outb(VGA_DATA_REGISTER, pos & 0xFF);    /* Low byte value */
-    outb(VGA_CTRL_REGISTER, 0x0E);          /* High byte index */
-    outb(VGA_DATA_REGISTER, (pos >> 8) & 0xFF);  /* High byte value */
-}
-
-void vga_enable_cursor(bool enabled) {
-    if (enabled) {
-        /* Enable cursor, set start and end scanlines */
-        outb(VGA_CTRL_REGISTER, 0x0A);
-        outb(VGA_DATA_REGISTER, (inb(VGA_DATA_REGISTER) & 0xC0) | 14);
-
-        outb(VGA_CTRL_REGISTER, 0x0B);
-        outb(VGA_DATA_REGISTER, (inb(VGA_DATA_REGISTER) & 0xE0) | 15);
-    } else {
-        /* Disable cursor */
-        outb(VGA_CTRL_REGISTER, 0x0A);
-        outb(VGA_DATA_REGISTER, 0x20);
+        vga_emit(*str++);
     }
 }
 
-/* =============================================================================
- * Printing Functions
- * =============================================================================
- */
-
-void vga_print_dec(uint64_t value) {
+static void vga_emit_dec(uint64_t value) {
     char buffer[21];  /* Max 20 digits for 64-bit + null */
     int i = 0;
 
     if (value == 0) {
-        vga_putchar('0');
+        vga_emit('0');
         return;
     }
 
@@ -276,17 +235,17 @@ void vga_print_dec(uint64_t value) {
 
     /* Print in correct order */
     while (i > 0) {
-        vga_putchar(buffer[--i]);
+        vga_emit(buffer[--i]);
     }
 }
 
-void vga_print_hex(uint64_t value) {
+static void vga_emit_hex(uint64_t value) {
     static const char hex_chars[] = "0123456789ABCDEF";
     char buffer[17];  /* Max 16 hex digits + null */
     int i = 0;
 
     if (value == 0) {
-        vga_puts("0x0");
+        vga_emit_str("0x0");
         return;
     }
 
@@ -297,95 +256,190 @@ void vga_print_hex(uint64_t value) {
     }
 
     /* Print prefix and value */
-    vga_puts("0x");
+    vga_emit_str("0x");
     while (i > 0) {
-        vga_putchar(buffer[--i]);
+        vga_emit(buffer[--i]);
+    }
+}
+
+/**
+ * Copy the dirty rows to VGA memory and move the hardware cursor.
+ */
+static void vga_flush(void) {
+    uint32_t dirty = vga_dirty;
+    vga_dirty = 0;
+
+    for (int y = 0; dirty; y++, dirty >>= 1) {
+        if (dirty & 1) {
+            memcpy((uint16_t*)vga_buffer + y * VGA_WIDTH, vga_row(y),
+                   VGA_WIDTH * sizeof(uint16_t));
+        }
+    }
+
+    if (cursor_y * VGA_WIDTH + cursor_x != hw_cursor_pos) {
+        vga_update_cursor();
     }
 }
 
 /* =============================================================================
- * kprintf Implementation
+ * Implementation
  * =============================================================================
  */
 
-void kprintf(const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-
-    while (*format) {
-        if (*format == '%') {
-            format++;
-
-            switch (*format) {
-                case 's': {
-                    /* String */
-                    const char* str = va_arg(args, const char*);
-                    if (str) {
-                        vga_puts(str);
-                    } else {
-                        vga_puts("(null)");
-                    }
-                    break;
-                }
-
-                case 'c': {
-                    /* Character */
-                    char c = (char)va_arg(args, int);
-                    vga_putchar(c);
-                    break;
-                }
-
-                case 'd':
-                case 'i': {
-                    /* Signed decimal */
-                    int64_t value = va_arg(args, int64_t);
-                    if (value < 0) {
-                        vga_putchar('-');
-                        value = -value;
-                    }
-                    vga_print_dec((uint64_t)value);
-                    break;
-                }
-
-                case 'u': {
-                    /* Unsigned decimal */
-                    uint64_t value = va_arg(args, uint64_t);
-                    vga_print_dec(value);
-                    break;
-                }
-
-                case 'x':
-                case 'X': {
-                    /* Hexadecimal */
-                    uint64_t value = va_arg(args, uint64_t);
-                    vga_print_hex(value);
-                    break;
-                }
-
-                case 'p': {
-                    /* Pointer */
-                    void* ptr = va_arg(args, void*);
-                    vga_print_hex((uint64_t)ptr);
-                    break;
-                }
-
-                case '%':
-                    /* Percent sign */
-                    vga_putchar('%');
-                    break;
-
-                default:
-                    /* Unknown format, print as-is */
-                    vga_putchar('%');
-                    vga_putchar(*format);
-                    break;
-            }
-        } else {
-            vga_putchar(*format);
-        }
+void vga_init(void) {
+    /* Set default colors: light grey on black */
+    current_color = vga_make_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+    /* Clear screen */
+    vga_clear();
+
+    /* Enable cursor */
+    vga_enable_cursor(true);
+}
+
+void vga_clear(void) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+
+    uint16_t blank = vga_make_entry(' ', current_color);
+    for (size_t i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
+        vga_shadow[i] = blank;
+    }
+    vga_top = 0;
+    vga_dirty = VGA_ALL_ROWS;
+
+    cursor_x = 0;
+    cursor_y = 0;
+    vga_flush();
+
+    console_release(flags, nested);
+}
+
+void vga_set_color(vga_color_t fg, vga_color_t bg) {
+    current_color = vga_make_color(fg, bg);
+}
+
+uint8_t vga_get_color(void) {
+    return current_color;
+}
+
+void vga_set_cursor(int x, int y) {
+    if (x >= 0 && x < VGA_WIDTH) {
+        cursor_x = x;
+    }
+    if (y >= 0 && y < VGA_HEIGHT) {
+        cursor_y = y;
+    }
+    vga_update_cursor();
+}
+
+int vga_get_cursor_x(void) {
+    return cursor_x;
+}
+
+int vga_get_cursor_y(void) {
+    return cursor_y;
+}
 
-        format++;
+void vga_scroll(void) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    vga_scroll_locked();
+    vga_flush();
+    console_release(flags, nested);
+}
+
+void vga_putchar(char c) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    vga_emit(c);
+    vga_flush();
+    console_release(flags, nested);
+}
+
+void vga_write(const char* buf, size_t len) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    for (size_t i = 0; i < len; i++) {
+        vga_emit(buf[i]);
     }
+    vga_flush();
+    console_release(flags, nested);
+}
 
-    va_end(args);
+void vga_write_attr(uint8_t color, const char* buf, size_t len) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    uint8_t saved = current_color;
+    current_color = color;
+    for (size_t i = 0; i < len; i++) {
+        vga_emit(buf[i]);
+    }
+    current_color = saved;
+    vga_flush();
+    console_release(flags, nested);
+}
+
+void vga_puts(const char* str) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    vga_emit_str(str);
+    vga_flush();
+    console_release(flags, nested);
+}
+
+void vga_println(const char* str) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    vga_emit_str(str);
+    vga_emit('\n');
+    vga_flush();
+    console_release(flags, nested);
+}
+
+void vga_update_cursor(void) {
+    uint16_t pos = cursor_y * VGA_WIDTH + cursor_x;
+
+    /* Send cursor position to VGA controller */
+    outb(VGA_CTRL_REGISTER, 0x0F);          /* Low byte index */
+    outb(VGA_DATA_REGISTER, pos & 0xFF);    /* Low byte value */
+    outb(VGA_CTRL_REGISTER, 0x0E);          /* High byte index */
+    outb(VGA_DATA_REGISTER, (pos >> 8) & 0xFF);  /* High byte value */
+    hw_cursor_pos = pos;
+}
+
+void vga_enable_cursor(bool enabled) {
+    if (enabled) {
+        /* Enable cursor, set start and end scanlines */
+        outb(VGA_CTRL_REGISTER, 0x0A);
+        outb(VGA_DATA_REGISTER, (inb(VGA_DATA_REGISTER) & 0xC0) | 14);
+
+        outb(VGA_CTRL_REGISTER, 0x0B);
+        outb(VGA_DATA_REGISTER, (inb(VGA_DATA_REGISTER) & 0xE0) | 15);
+    } else {
+        /* Disable cursor */
+        outb(VGA_CTRL_REGISTER, 0x0A);
+        outb(VGA_DATA_REGISTER, 0x20);
+    }
+}
+
+/* =============================================================================
+ * Printing Functions
+ * =============================================================================
+ */
+
+void vga_print_dec(uint64_t value) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    vga_emit_dec(value);
+    vga_flush();
+    console_release(flags, nested);
+}
+
+void vga_print_hex(uint64_t value) {
+    uint64_t flags;
+    bool nested = console_acquire(&flags);
+    vga_emit_hex(value);
+    vga_flush();
+    console_release(flags, nested);
 }
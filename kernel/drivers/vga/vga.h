@@ -11,6 +11,7 @@
 #define CHANUX_VGA_H
 
 #include "../../include/types.h"
+#include "../../include/klog.h"
 
 /* =============================================================================
  * VGA Constants
@@ -74,6 +75,13 @@ void vga_clear(void);
  */
 void vga_set_color(vga_color_t fg, vga_color_t bg);
 
+/**
+ * Get the current color attribute (as built by vga_set_color()).
+ *
+ * @return Attribute byte: foreground | background << 4
+ */
+uint8_t vga_get_color(void);
+
 /**
  * Set the cursor position.
  *
@@ -104,6 +112,25 @@ int vga_get_cursor_y(void);
  */
 void vga_putchar(char c);
 
+/**
+ * Print a buffer of characters (same handling as vga_putchar()).
+ * The screen and hardware cursor are updated once, at the end.
+ *
+ * @param buf Characters to print
+ * @param len Number of characters
+ */
+void vga_write(const char* buf, size_t len);
+
+/**
+ * Print a buffer of characters in the given color, leaving the current
+ * color as it was.
+ *
+ * @param color Attribute byte (see vga_get_color())
+ * @param buf   Characters to print
+ * @param len   Number of characters
+ */
+void vga_write_attr(uint8_t color, const char* buf, size_t len);
+
 /**
  * Print a null-terminated string.
  *
@@ -154,13 +181,4 @@ void vga_print_dec(uint64_t value);
  */
 void vga_print_hex(uint64_t value);
 
-/**
- * Simple printf-like function.
- * Supports: %s (string), %c (char), %d (decimal), %x (hex), %p (pointer), %% (percent)
- *
- * @param format Format string
- * @param ... Arguments
- */
-void kprintf(const char* format, ...);
-
 #endif /* CHANUX_VGA_H */
@@ -0,0 +1,226 @@
+/**
+ * =============================================================================
+ * Chanux OS - Virtio Legacy PCI Transport and Virtqueue Implementation
+ * =============================================================================
+ * Ring memory comes straight from the PMM (frames below the direct-map
+ * limit), so the device sees the same bytes the kernel reads through
+ * PHYS_TO_VIRT(). x86 keeps stores in order and port writes are
+ * serializing, so only compiler barriers are needed between filling a
+ * ring entry and publishing its index.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/virtio.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/mm/pmm.h"
+#include "../../include/mm/heap.h"
+
+#define virtio_barrier()    __asm__ volatile("" : : : "memory")
+
+/* =============================================================================
+ * Device Registers
+ * =============================================================================
+ */
+
+int virtio_pci_setup(virtio_dev_t* vdev, pci_device_t* pci) {
+    uint16_t iobase = pci_bar_io(pci, 0);
+    if (iobase == 0) {
+        return -1;
+    }
+
+    vdev->pci = pci;
+    vdev->iobase = iobase;
+    vdev->config = VIRTIO_PCI_CONFIG;
+    pci_enable_device(pci);
+
+    /* Reset, then announce ourselves */
+    outb(iobase + VIRTIO_PCI_STATUS, 0);
+    outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    return 0;
+}
+
+uint32_t virtio_get_features(virtio_dev_t* vdev) {
+    return inl(vdev->iobase + VIRTIO_PCI_HOST_FEATURES);
+}
+
+void virtio_set_features(virtio_dev_t* vdev, uint32_t features) {
+    outl(vdev->iobase + VIRTIO_PCI_GUEST_FEATURES, features);
+}
+
+void virtio_driver_ok(virtio_dev_t* vdev) {
+    uint8_t status = inb(vdev->iobase + VIRTIO_PCI_STATUS);
+    outb(vdev->iobase + VIRTIO_PCI_STATUS, status | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_dev_t* vdev) {
+    uint8_t status = inb(vdev->iobase + VIRTIO_PCI_STATUS);
+    outb(vdev->iobase + VIRTIO_PCI_STATUS, status | VIRTIO_STATUS_FAILED);
+}
+
+uint8_t virtio_read_isr(virtio_dev_t* vdev) {
+    return inb(vdev->iobase + VIRTIO_PCI_ISR);
+}
+
+uint32_t virtio_config_read32(virtio_dev_t* vdev, uint32_t offset) {
+    return inl((uint16_t)(vdev->iobase + vdev->config + offset));
+}
+
+uint64_t virtio_config_read64(virtio_dev_t* vdev, uint32_t offset) {
+    /* Two halves; re-read if the high half moved meanwhile */
+    uint32_t high, low;
+    do {
+        high = virtio_config_read32(vdev, offset + 4);
+        low = virtio_config_read32(vdev, offset);
+    } while (high != virtio_config_read32(vdev, offset + 4));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* =============================================================================
+ * Virtqueue Setup
+ * =============================================================================
+ */
+
+int virtqueue_init(virtqueue_t* vq, virtio_dev_t* vdev, uint16_t index) {
+    uint16_t iobase = vdev->iobase;
+
+    outw(iobase + VIRTIO_PCI_QUEUE_SELECT, index);
+    uint16_t size = inw(iobase + VIRTIO_PCI_QUEUE_SIZE);
+    if (size == 0 || size > VIRTQ_MAX_SIZE) {
+        return -1;
+    }
+
+    /* desc + avail, then the used ring on the next VIRTQ_ALIGN boundary */
+    size_t avail_end = (size_t)size * sizeof(virtq_desc_t) +
+                       sizeof(virtq_avail_t) + (size_t)size * sizeof(uint16_t) + 2;
+    size_t used_offset = ALIGN_UP(avail_end, VIRTQ_ALIGN);
+    size_t used_size = sizeof(virtq_used_t) + (size_t)size * sizeof(virtq_used_elem_t) + 2;
+    size_t pages = (used_offset + ALIGN_UP(used_size, VIRTQ_ALIGN)) / PAGE_SIZE;
+
+    /* The device reads and writes the rings itself */
+    phys_addr_t phys = pmm_alloc_pages_dma32(pages);
+    if (phys == 0) {
+        return -1;
+    }
+    vq->cookies = (void**)kzalloc((size_t)size * sizeof(void*));
+    if (!vq->cookies) {
+        pmm_free_pages(phys, pages);
+        return -1;
+    }
+
+    uint8_t* base = (uint8_t*)PHYS_TO_VIRT(phys);
+    memset(base, 0, pages * PAGE_SIZE);
+
+    vq->vdev = vdev;
+    vq->index = index;
+    vq->size = size;
+    vq->desc = (virtq_desc_t*)base;
+    vq->avail = (virtq_avail_t*)(base + (size_t)size * sizeof(virtq_desc_t));
+    vq->used = (virtq_used_t*)(base + used_offset);
+    vq->ring_phys = phys;
+    vq->ring_pages = pages;
+    vq->last_used = 0;
+
+    /* Every descriptor starts on the free chain */
+    for (uint16_t i = 0; i + 1 < size; i++) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+    vq->free_head = 0;
+    vq->num_free = size;
+
+    outl(iobase + VIRTIO_PCI_QUEUE_PFN, (uint32_t)(phys >> 12));
+    return 0;
+}
+
+int virtqueue_enable_msix(virtqueue_t* vq, uint16_t entry, uint8_t vector, uint32_t cpu) {
+    virtio_dev_t* vdev = vq->vdev;
+    if (pci_enable_msix(vdev->pci, entry, vector, cpu) < 0) {
+        return -1;
+    }
+
+    /* The vector registers appear with MSI-X, in front of the config */
+    vdev->config = VIRTIO_PCI_CONFIG_MSIX;
+    outw(vdev->iobase + VIRTIO_MSI_CONFIG_VECTOR, VIRTIO_MSI_NO_VECTOR);
+    outw(vdev->iobase + VIRTIO_PCI_QUEUE_SELECT, vq->index);
+    outw(vdev->iobase + VIRTIO_MSI_QUEUE_VECTOR, entry);
+
+    /* The device reads back NO_VECTOR if it could not take the entry */
+    if (inw(vdev->iobase + VIRTIO_MSI_QUEUE_VECTOR) != entry) {
+        pci_disable_msix(vdev->pci);
+        vdev->config = VIRTIO_PCI_CONFIG;
+        return -1;
+    }
+    return 0;
+}
+
+/* =============================================================================
+ * Virtqueue Operations
+ * =============================================================================
+ */
+
+int virtqueue_add(virtqueue_t* vq, const virtq_seg_t* segs, uint32_t count, void* cookie) {
+    if (count == 0 || count > vq->num_free) {
+        return -1;
+    }
+
+    uint16_t head = vq->free_head;
+    uint16_t idx = head;
+    uint16_t last = head;
+    for (uint32_t i = 0; i < count; i++) {
+        virtq_desc_t* d = &vq->desc[idx];
+        d->addr = segs[i].addr;
+        d->len = segs[i].len;
+        d->flags = segs[i].device_writes ? VIRTQ_DESC_F_WRITE : 0;
+        if (i + 1 < count) {
+            d->flags |= VIRTQ_DESC_F_NEXT;
+        }
+        last = idx;
+        idx = d->next;
+    }
+
+    /* The last descriptor's 'next' still links the rest of the free chain */
+    vq->free_head = vq->desc[last].next;
+    vq->num_free -= (uint16_t)count;
+    vq->cookies[head] = cookie;
+
+    vq->avail->ring[vq->avail->idx % vq->size] = head;
+    virtio_barrier();
+    vq->avail->idx++;
+
+    return head;
+}
+
+void virtqueue_kick(virtqueue_t* vq) {
+    virtio_barrier();
+    if (!(*(volatile uint16_t*)&vq->used->flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        outw(vq->vdev->iobase + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+    }
+}
+
+void* virtqueue_get(virtqueue_t* vq, uint16_t* head_out) {
+    if (vq->last_used == *(volatile uint16_t*)&vq->used->idx) {
+        return NULL;
+    }
+    virtio_barrier();
+
+    virtq_used_elem_t* elem = &vq->used->ring[vq->last_used % vq->size];
+    uint16_t head = (uint16_t)elem->id;
+    vq->last_used++;
+
+    /* Return the chain to the free list */
+    uint16_t idx = head;
+    uint16_t count = 1;
+    while (vq->desc[idx].flags & VIRTQ_DESC_F_NEXT) {
+        idx = vq->desc[idx].next;
+        count++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+
+    void* cookie = vq->cookies[head];
+    vq->cookies[head] = NULL;
+    *head_out = head;
+    return cookie;
+}
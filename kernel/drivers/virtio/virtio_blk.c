@@ -0,0 +1,361 @@
+/**
+ * =============================================================================
+ * Chanux OS - Virtio Block Driver Implementation
+ * =============================================================================
+ * A request is one descriptor chain:
+ *
+ *   header (type, sector) -> data segments -> status byte
+ *
+ * Header and status live in a per-device slot array indexed by the
+ * chain's head descriptor, so nothing is allocated per request. Data
+ * segments are the physical pages of the caller's buffer, merged where
+ * they are adjacent; the buffer is never copied.
+ *
+ * Completion: the interrupt handler takes finished chains off the used
+ * ring and starts requests that were waiting for descriptors. With
+ * MSI-X each device has its own vector delivered straight to a local
+ * APIC; otherwise they share the INTx line and the handler reads every
+ * device's ISR register (which acknowledges the interrupt) to find them. The lock is
+ * dropped around blkdev_complete(), so a completion callback may submit
+ * the next request.
+ * =============================================================================
+ */
+
+#include "../../include/drivers/virtio_blk.h"
+#include "../../include/drivers/virtio.h"
+#include "../../include/drivers/blkdev.h"
+#include "../../include/interrupts/irq.h"
+#include "../../include/kernel.h"
+#include "../../include/string.h"
+#include "../../include/spinlock.h"
+#include "../../include/mm/pmm.h"
+#include "../../include/mm/vmm.h"
+#include "../vga/vga.h"
+
+/* =============================================================================
+ * Driver State
+ * =============================================================================
+ */
+
+/* Per-chain header and status, DMA'd by the device */
+typedef struct {
+    virtio_blk_req_hdr_t    hdr;
+    uint8_t                 status;
+    uint8_t                 reserved[15];
+} PACKED vblk_slot_t;
+
+typedef struct {
+    virtio_dev_t        vdev;
+    virtqueue_t         vq;
+    spinlock_t          lock;
+    vblk_slot_t*        slots;              /* One per descriptor */
+    phys_addr_t         slots_phys;
+    blkdev_request_t*   wait_head;          /* Waiting for descriptors */
+    blkdev_request_t*   wait_tail;
+    bool                has_flush;
+    bool                read_only;
+    int                 vector;             /* MSI-X vector, -1: INTx */
+    blkdev_t            blk;
+} vblk_t;
+
+static vblk_t vblk_devices[VBLK_MAX_DEVICES];
+static uint32_t vblk_count = 0;
+
+/* =============================================================================
+ * Issuing Requests
+ * =============================================================================
+ */
+
+/*
+ * Put a request on the ring (lock held).
+ * Returns 1 if started, 0 if the ring has no room for it yet, -1 if
+ * its buffer is not mapped.
+ */
+static int vblk_start(vblk_t* v, blkdev_request_t* req) {
+    virtq_seg_t segs[VBLK_MAX_SEGS];
+    uint32_t nsegs = 1;
+    uint16_t head = virtqueue_next_head(&v->vq);
+    vblk_slot_t* slot = &v->slots[head];
+    phys_addr_t slot_phys = v->slots_phys + (phys_addr_t)head * sizeof(vblk_slot_t);
+
+    segs[0].addr = slot_phys;
+    segs[0].len = sizeof(virtio_blk_req_hdr_t);
+    segs[0].device_writes = false;
+
+    /* Data: one segment per physically contiguous piece of the buffer */
+    bool device_writes = (req->op == BLKDEV_OP_READ);
+    uint64_t addr = (uint64_t)req->buf;
+    size_t remaining = (size_t)req->count * BLKDEV_SECTOR_SIZE;
+    while (remaining > 0) {
+        phys_addr_t phys = vmm_get_physical(addr);
+        if (phys == 0) {
+            return -1;
+        }
+        size_t chunk = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+
+        virtq_seg_t* prev = &segs[nsegs - 1];
+        if (nsegs > 1 && prev->addr + prev->len == phys) {
+            prev->len += (uint32_t)chunk;
+        } else {
+            segs[nsegs].addr = phys;
+            segs[nsegs].len = (uint32_t)chunk;
+            segs[nsegs].device_writes = device_writes;
+            nsegs++;
+        }
+        addr += chunk;
+        remaining -= chunk;
+    }
+
+    segs[nsegs].addr = slot_phys + __builtin_offsetof(vblk_slot_t, status);
+    segs[nsegs].len = 1;
+    segs[nsegs].device_writes = true;
+    nsegs++;
+
+    if (nsegs > v->vq.num_free) {
+        return 0;
+    }
+
+    slot->hdr.type = (req->op == BLKDEV_OP_READ)  ? VIRTIO_BLK_T_IN :
+                     (req->op == BLKDEV_OP_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_FLUSH;
+    slot->hdr.reserved = 0;
+    slot->hdr.sector = (req->op == BLKDEV_OP_FLUSH) ? 0 : req->lba;
+    slot->status = 0xFF;
+
+    virtqueue_add(&v->vq, segs, nsegs, req);
+    return 1;
+}
+
+/*
+ * Start waiting requests while there is room (lock held).
+ * Returns the requests that could not be started, for the caller to fail.
+ */
+static blkdev_request_t* vblk_start_waiting(vblk_t* v) {
+    blkdev_request_t* failed = NULL;
+    bool kicked = false;
+
+    while (v->wait_head) {
+        blkdev_request_t* req = v->wait_head;
+        int started = vblk_start(v, req);
+        if (started == 0) {
+            break;
+        }
+
+        v->wait_head = req->next;
+        if (!v->wait_head) {
+            v->wait_tail = NULL;
+        }
+        if (started < 0) {
+            req->next = failed;
+            failed = req;
+        } else {
+            kicked = true;
+        }
+    }
+
+    if (kicked) {
+        virtqueue_kick(&v->vq);
+    }
+    return failed;
+}
+
+static void vblk_fail_all(blkdev_request_t* list) {
+    while (list) {
+        blkdev_request_t* next = list->next;
+        blkdev_complete(list, -1);
+        list = next;
+    }
+}
+
+/* =============================================================================
+ * Completion
+ * =============================================================================
+ */
+
+/* Finish everything on the used ring and refill it from the wait queue */
+static void vblk_reap(vblk_t* v) {
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&v->lock);
+        uint16_t head = 0;
+        blkdev_request_t* req = (blkdev_request_t*)virtqueue_get(&v->vq, &head);
+        int status = (req && v->slots[head].status == VIRTIO_BLK_S_OK) ? 0 : -1;
+        blkdev_request_t* failed = vblk_start_waiting(v);
+        spin_unlock_irqrestore(&v->lock, flags);
+
+        vblk_fail_all(failed);
+        if (!req) {
+            return;
+        }
+        blkdev_complete(req, status);
+    }
+}
+
+static void vblk_irq_handler(registers_t* regs) {
+    (void)regs;
+
+    /* Devices may share the line: check each one's ISR */
+    for (uint32_t i = 0; i < vblk_count; i++) {
+        if (virtio_read_isr(&vblk_devices[i].vdev) & VIRTIO_ISR_QUEUE) {
+            vblk_reap(&vblk_devices[i]);
+        }
+    }
+}
+
+static void vblk_msix_handler(registers_t* regs) {
+    /* The vector says which device, nothing to acknowledge */
+    for (uint32_t i = 0; i < vblk_count; i++) {
+        if (vblk_devices[i].vector == (int)regs->int_no) {
+            vblk_reap(&vblk_devices[i]);
+        }
+    }
+}
+
+/* =============================================================================
+ * Block Device Operations
+ * =============================================================================
+ */
+
+static int vblk_submit(blkdev_t* dev, blkdev_request_t* req) {
+    vblk_t* v = (vblk_t*)dev->priv;
+
+    if (req->op == BLKDEV_OP_WRITE && v->read_only) {
+        return -1;
+    }
+    if (req->op == BLKDEV_OP_FLUSH && !v->has_flush) {
+        /* No write cache: every completed write is already stable */
+        blkdev_complete(req, 0);
+        return 0;
+    }
+
+    req->next = NULL;
+    uint64_t flags = spin_lock_irqsave(&v->lock);
+    int started = 0;
+    if (!v->wait_head) {
+        started = vblk_start(v, req);
+    }
+    if (started == 0) {
+        /* Behind earlier requests, or the ring is full */
+        if (v->wait_tail) {
+            v->wait_tail->next = req;
+        } else {
+            v->wait_head = req;
+        }
+        v->wait_tail = req;
+    } else if (started > 0) {
+        virtqueue_kick(&v->vq);
+    }
+    spin_unlock_irqrestore(&v->lock, flags);
+
+    if (started < 0) {
+        blkdev_complete(req, -1);
+    }
+    return 0;
+}
+
+static void vblk_poll(blkdev_t* dev) {
+    vblk_reap((vblk_t*)dev->priv);
+}
+
+static const blkdev_ops_t vblk_ops = {
+    .submit = vblk_submit,
+    .poll   = vblk_poll,
+};
+
+/* =============================================================================
+ * Probing
+ * =============================================================================
+ */
+
+/* Give the queue its own MSI-X vector on the boot CPU */
+static int vblk_setup_msix(vblk_t* v) {
+    int vector = irq_alloc_vector(vblk_msix_handler);
+    if (vector < 0) {
+        return -1;
+    }
+    if (virtqueue_enable_msix(&v->vq, 0, (uint8_t)vector, 0) < 0) {
+        irq_free_vector((uint8_t)vector);
+        return -1;
+    }
+    v->vector = vector;
+    return 0;
+}
+
+static int vblk_probe(vblk_t* v, pci_device_t* pci, uint32_t index) {
+    memset(v, 0, sizeof(*v));
+    spin_init(&v->lock);
+    v->vector = -1;
+
+    if (virtio_pci_setup(&v->vdev, pci) < 0) {
+        kprintf("[VIRTIO] PCI %u:%u.%u: no legacy I/O BAR, skipped\n",
+                pci->bus, pci->slot, pci->func);
+        return -1;
+    }
+
+    uint32_t features = virtio_get_features(&v->vdev);
+    features &= VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH;
+    virtio_set_features(&v->vdev, features);
+    v->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+    v->has_flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+
+    if (virtqueue_init(&v->vq, &v->vdev, 0) < 0 || v->vq.size < VBLK_MAX_SEGS) {
+        virtio_fail(&v->vdev);
+        return -1;
+    }
+
+    size_t slot_pages = ALIGN_UP((size_t)v->vq.size * sizeof(vblk_slot_t), PAGE_SIZE) / PAGE_SIZE;
+    v->slots_phys = pmm_alloc_pages_dma32(slot_pages);
+    if (v->slots_phys == 0) {
+        virtio_fail(&v->vdev);
+        return -1;
+    }
+    v->slots = (vblk_slot_t*)PHYS_TO_VIRT(v->slots_phys);
+    memset(v->slots, 0, slot_pages * PAGE_SIZE);
+
+    /* Before reading the config: MSI-X moves it */
+    if (vblk_setup_msix(v) < 0 && pci->irq_line < IRQ_COUNT) {
+        /* The firmware routed INTx to an ISA line */
+        irq_register_handler(pci->irq_line, vblk_irq_handler);
+        irq_unmask(pci->irq_line);
+    }
+
+    v->blk.name[0] = 'v';
+    v->blk.name[1] = 'd';
+    v->blk.name[2] = (char)('a' + index);
+    v->blk.sector_count = virtio_config_read64(&v->vdev, VIRTIO_BLK_CFG_CAPACITY);
+    v->blk.max_sectors = VBLK_MAX_SECTORS;
+    v->blk.ops = &vblk_ops;
+    v->blk.priv = v;
+
+    virtio_driver_ok(&v->vdev);
+
+    if (blkdev_register(&v->blk) < 0) {
+        return -1;
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[VIRTIO] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (v->vector >= 0) {
+        kprintf("%s: %u MB, %u descriptors, MSI-X vector 0x%x%s\n", v->blk.name,
+                v->blk.sector_count / 2048, v->vq.size, v->vector,
+                v->read_only ? ", read-only" : "");
+    } else {
+        kprintf("%s: %u MB, %u descriptors, IRQ %u%s\n", v->blk.name,
+                v->blk.sector_count / 2048, v->vq.size, pci->irq_line,
+                v->read_only ? ", read-only" : "");
+    }
+    return 0;
+}
+
+int virtio_blk_init(void) {
+    pci_device_t* pci = NULL;
+    while (vblk_count < VBLK_MAX_DEVICES &&
+           (pci = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, pci)) != NULL) {
+        if (vblk_probe(&vblk_devices[vblk_count], pci, vblk_count) == 0) {
+            vblk_count++;
+        }
+    }
+    return (int)vblk_count;
+}
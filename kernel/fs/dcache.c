@@ -0,0 +1,156 @@
+/**
+ * =============================================================================
+ * Chanux OS - Directory Entry Cache
+ * =============================================================================
+ * A fixed pool of DCACHE_ENTRIES dentries on DCACHE_BUCKETS hash chains.
+ * Lookups that find an entry mark it referenced; when the pool is full a
+ * CLOCK hand recycles the first entry not referenced since its last pass,
+ * so hot path components stay cached while one-off names cycle out.
+ *
+ * Callers hold the VFS lock, which serializes every operation here.
+ * =============================================================================
+ */
+
+#include "fs/dcache.h"
+#include "string.h"
+
+/* =============================================================================
+ * Cache State
+ * =============================================================================
+ */
+
+static dentry_t dcache_pool[DCACHE_ENTRIES];
+static dentry_t* dcache_hash[DCACHE_BUCKETS];
+static uint32_t dcache_clock_hand = 0;
+
+/* =============================================================================
+ * Helpers
+ * =============================================================================
+ */
+
+/* FNV-1a over the name, mixed with the directory */
+static uint32_t dcache_hash_name(uint32_t parent, const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (parent * 0x9E3779B1u);
+}
+
+static dentry_t* dcache_find(uint32_t parent, const char* name, size_t len, uint32_t hash) {
+    for (dentry_t* d = dcache_hash[hash & (DCACHE_BUCKETS - 1)]; d; d = d->hash_next) {
+        if (d->hash == hash && d->parent == parent && d->name_len == len &&
+            memcmp(d->name, name, len) == 0) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static void dcache_unhash(dentry_t* entry) {
+    dentry_t** link = &dcache_hash[entry->hash & (DCACHE_BUCKETS - 1)];
+    while (*link && *link != entry) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = entry->hash_next;
+    }
+    entry->hash_next = NULL;
+    entry->in_use = false;
+}
+
+/* Take a free entry, or recycle one the CLOCK hand finds unreferenced */
+static dentry_t* dcache_alloc(void) {
+    for (uint32_t scanned = 0; scanned < 2 * DCACHE_ENTRIES; scanned++) {
+        dentry_t* d = &dcache_pool[dcache_clock_hand];
+        dcache_clock_hand = (dcache_clock_hand + 1) % DCACHE_ENTRIES;
+
+        if (!d->in_use) {
+            return d;
+        }
+        if (d->referenced) {
+            d->referenced = false;
+            continue;
+        }
+        dcache_unhash(d);
+        return d;
+    }
+    return NULL;    /* Unreachable: the second pass finds a cleared entry */
+}
+
+/* Insert or update the entry for (parent, name) */
+static void dcache_store(uint32_t parent, const char* name, size_t len,
+                         uint32_t inode, bool negative) {
+    if (len == 0 || len >= DCACHE_NAME_MAX) {
+        return;
+    }
+
+    uint32_t hash = dcache_hash_name(parent, name, len);
+    dentry_t* d = dcache_find(parent, name, len, hash);
+    if (!d) {
+        d = dcache_alloc();
+        if (!d) {
+            return;
+        }
+        d->parent = parent;
+        d->hash = hash;
+        d->name_len = (uint8_t)len;
+        memcpy(d->name, name, len);
+        d->name[len] = '\0';
+        d->in_use = true;
+
+        dentry_t** bucket = &dcache_hash[hash & (DCACHE_BUCKETS - 1)];
+        d->hash_next = *bucket;
+        *bucket = d;
+    }
+
+    d->inode = inode;
+    d->negative = negative;
+    d->referenced = true;
+}
+
+/* =============================================================================
+ * Public Interface
+ * =============================================================================
+ */
+
+void dcache_init(void) {
+    memset(dcache_pool, 0, sizeof(dcache_pool));
+    memset(dcache_hash, 0, sizeof(dcache_hash));
+    dcache_clock_hand = 0;
+}
+
+int dcache_lookup(uint32_t parent, const char* name, size_t len, uint32_t* inode_out) {
+    if (len == 0 || len >= DCACHE_NAME_MAX) {
+        return DCACHE_MISS;
+    }
+
+    dentry_t* d = dcache_find(parent, name, len, dcache_hash_name(parent, name, len));
+    if (!d) {
+        return DCACHE_MISS;
+    }
+
+    d->referenced = true;
+    if (d->negative) {
+        return DCACHE_NEGATIVE;
+    }
+    *inode_out = d->inode;
+    return DCACHE_HIT;
+}
+
+void dcache_add(uint32_t parent, const char* name, size_t len, uint32_t inode) {
+    dcache_store(parent, name, len, inode, false);
+}
+
+void dcache_add_negative(uint32_t parent, const char* name, size_t len) {
+    dcache_store(parent, name, len, 0, true);
+}
+
+void dcache_purge_dir(uint32_t parent) {
+    for (uint32_t i = 0; i < DCACHE_ENTRIES; i++) {
+        if (dcache_pool[i].in_use && dcache_pool[i].parent == parent) {
+            dcache_unhash(&dcache_pool[i]);
+        }
+    }
+}
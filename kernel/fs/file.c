@@ -5,26 +5,32 @@
  * Implements per-process file descriptor tables and open file management.
  *
  * Design:
- *   - Each process has its own fd_table mapping fd numbers to file_t pointers
+ *   - Each process has its own fd_table mapping fd numbers to file_t pointers;
+ *     its threads share it through fd_table_ref()/fd_table_unref()
  *   - file_t represents an open file instance (system-wide)
  *   - Multiple fds can point to the same file_t (via dup/fork)
+ *   - The slots live in a growable fd_files_t with an open-fd bitmap,
+ *     shared copy-on-write between a forked child and its parent
  *   - Reference counting on file_t for proper cleanup
  * =============================================================================
  */
 
 #include "../include/fs/file.h"
 #include "../include/fs/vfs.h"
+#include "../include/fs/pipe.h"
 #include "../include/mm/heap.h"
+#include "../include/mm/slab.h"
 #include "../include/kernel.h"
+#include "../include/string.h"
 #include "../drivers/vga/vga.h"
 
-/* Maximum number of open files system-wide */
-#define MAX_OPEN_FILES  256
-
-/* System-wide open file table */
-static file_t open_file_table[MAX_OPEN_FILES];
+/* Object cache for open files (system-wide) */
+static kmem_cache_t* file_cache = NULL;
 static bool file_table_initialized = false;
 
+/* Object cache for per-process descriptor tables */
+static kmem_cache_t* fd_table_cache = NULL;
+
 /* Console file entries for stdin/stdout/stderr */
 static file_t console_stdin;
 static file_t console_stdout;
@@ -43,16 +49,6 @@ static void init_file_table(void) {
         return;
     }
 
-    /* Clear open file table */
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        open_file_table[i].ref_count = 0;
-        open_file_table[i].flags = 0;
-        open_file_table[i].offset = 0;
-        open_file_table[i].inode = 0;
-        open_file_table[i].type = 0;
-        open_file_table[i].vnode = NULL;
-    }
-
     /* Initialize console file entries */
     console_stdin.ref_count = 1;  /* Always referenced */
     console_stdin.flags = O_RDONLY;
@@ -75,9 +71,98 @@ static void init_file_table(void) {
     console_stderr.type = FILE_TYPE_CONSOLE;
     console_stderr.vnode = NULL;
 
+    file_cache = kmem_cache_create("file", sizeof(file_t), 0);
+    fd_table_cache = kmem_cache_create("fd_table", sizeof(fd_table_t), 0);
+
     file_table_initialized = true;
 }
 
+/* =============================================================================
+ * Descriptor Arrays
+ * =============================================================================
+ */
+
+/* Bitmap words for a capacity */
+#define FD_MAP_WORDS(capacity)  ((capacity) / 64)
+
+/**
+ * Allocate an empty descriptor array (bitmap and slots in one block).
+ */
+static fd_files_t* fd_files_alloc(uint32_t capacity) {
+    size_t map_size = FD_MAP_WORDS(capacity) * sizeof(uint64_t);
+    fd_files_t* files = kzalloc(sizeof(fd_files_t) + map_size + capacity * sizeof(file_t*));
+    if (!files) {
+        return NULL;
+    }
+
+    files->shares = 1;
+    files->capacity = capacity;
+    files->open_map = (uint64_t*)(files + 1);
+    files->entries = (file_t**)((uint8_t*)files->open_map + map_size);
+    return files;
+}
+
+/**
+ * Copy an array into a new one of at least 'capacity' slots.
+ * The copy takes its own reference on every open file.
+ */
+static fd_files_t* fd_files_copy(fd_files_t* src, uint32_t capacity) {
+    fd_files_t* dst = fd_files_alloc(MAX(capacity, src->capacity));
+    if (!dst) {
+        return NULL;
+    }
+
+    memcpy(dst->open_map, src->open_map, FD_MAP_WORDS(src->capacity) * sizeof(uint64_t));
+    memcpy(dst->entries, src->entries, src->capacity * sizeof(file_t*));
+    for (uint32_t i = 0; i < src->capacity; i++) {
+        file_ref(dst->entries[i]);
+    }
+    dst->num_open = src->num_open;
+    return dst;
+}
+
+/**
+ * Drop a table's share of an array; the last one closes every file.
+ */
+static void fd_files_put(fd_files_t* files) {
+    if (--files->shares > 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < files->capacity; i++) {
+        file_unref(files->entries[i]);
+    }
+    kfree(files);
+}
+
+/**
+ * Make a table's array private and at least 'capacity' slots, before it
+ * is changed: copies it if another table shares it or it is too small.
+ * Returns 0 on success, -1 if out of memory or beyond MAX_FD_PER_PROCESS.
+ */
+static int fd_files_prepare(fd_table_t* table, uint32_t capacity) {
+    fd_files_t* files = table->files;
+    if (files->shares == 1 && capacity <= files->capacity) {
+        return 0;
+    }
+    if (capacity > MAX_FD_PER_PROCESS) {
+        return -1;
+    }
+
+    uint32_t grown = files->capacity;
+    while (grown < capacity) {
+        grown *= 2;
+    }
+
+    fd_files_t* copy = fd_files_copy(files, MIN(grown, (uint32_t)MAX_FD_PER_PROCESS));
+    if (!copy) {
+        return -1;
+    }
+    fd_files_put(files);
+    table->files = copy;
+    return 0;
+}
+
 /* =============================================================================
  * File Descriptor Table Management
  * =============================================================================
@@ -92,16 +177,17 @@ fd_table_t* fd_table_create(void) {
     /* Ensure file table is initialized */
     init_file_table();
 
-    fd_table_t* table = (fd_table_t*)kmalloc(sizeof(fd_table_t));
+    fd_table_t* table = (fd_table_t*)kmem_cache_alloc(fd_table_cache);
     if (!table) {
         return NULL;
     }
 
-    /* Clear all entries */
-    for (int i = 0; i < MAX_FD_PER_PROCESS; i++) {
-        table->entries[i] = NULL;
+    table->files = fd_files_alloc(FD_TABLE_INITIAL);
+    if (!table->files) {
+        kmem_cache_free(fd_table_cache, table);
+        return NULL;
     }
-    table->num_open = 0;
+    table->ref_count = 1;
 
     return table;
 }
@@ -109,47 +195,57 @@ fd_table_t* fd_table_create(void) {
 /**
  * Destroy a file descriptor table.
  *
- * Closes all open file descriptors and frees the table.
+ * Closes all open file descriptors (unless a forked table still shares
+ * them) and frees the table.
  */
 void fd_table_destroy(fd_table_t* table) {
     if (!table) {
         return;
     }
 
-    /* Close all open files */
-    for (int i = 0; i < MAX_FD_PER_PROCESS; i++) {
-        if (table->entries[i]) {
-            file_unref(table->entries[i]);
-            table->entries[i] = NULL;
-        }
+    fd_files_put(table->files);
+    kmem_cache_free(fd_table_cache, table);
+}
+
+/**
+ * Take another reference on a file descriptor table (for a new thread).
+ */
+void fd_table_ref(fd_table_t* table) {
+    if (table) {
+        table->ref_count++;
     }
+}
 
-    kfree(table);
+/**
+ * Drop a reference on a file descriptor table.
+ *
+ * The last reference destroys it, closing every descriptor.
+ */
+void fd_table_unref(fd_table_t* table) {
+    if (table && --table->ref_count == 0) {
+        fd_table_destroy(table);
+    }
 }
 
 /**
  * Clone a file descriptor table (for fork).
  *
- * Creates a new table with the same entries, incrementing reference counts.
+ * The new table shares the descriptor array; whichever table changes its
+ * descriptors first copies it then, so forking costs no copy.
  */
 fd_table_t* fd_table_clone(fd_table_t* src) {
     if (!src) {
         return NULL;
     }
 
-    fd_table_t* dst = fd_table_create();
+    fd_table_t* dst = (fd_table_t*)kmem_cache_alloc(fd_table_cache);
     if (!dst) {
         return NULL;
     }
 
-    /* Copy entries and increment reference counts */
-    for (int i = 0; i < MAX_FD_PER_PROCESS; i++) {
-        if (src->entries[i]) {
-            dst->entries[i] = src->entries[i];
-            file_ref(dst->entries[i]);
-        }
-    }
-    dst->num_open = src->num_open;
+    dst->files = src->files;
+    dst->files->shares++;
+    dst->ref_count = 1;
 
     return dst;
 }
@@ -162,6 +258,8 @@ fd_table_t* fd_table_clone(fd_table_t* src) {
 /**
  * Allocate the lowest available file descriptor.
  *
+ * The table is made private, and grown if it is full, so fd_set_file()
+ * on the result cannot fail.
  * Returns the fd number, or -1 if no fds available.
  */
 int fd_alloc(fd_table_t* table) {
@@ -169,32 +267,35 @@ int fd_alloc(fd_table_t* table) {
         return -1;
     }
 
-    /* Find lowest available fd */
-    for (int i = 0; i < MAX_FD_PER_PROCESS; i++) {
-        if (table->entries[i] == NULL) {
-            return i;
+    /* Find lowest available fd: the first word with a zero bit */
+    fd_files_t* files = table->files;
+    uint32_t fd = files->capacity;
+    for (uint32_t w = 0; w < FD_MAP_WORDS(files->capacity); w++) {
+        if (files->open_map[w] != ~0ULL) {
+            fd = w * 64 + (uint32_t)__builtin_ctzll(~files->open_map[w]);
+            break;
         }
     }
 
-    return -1;  /* No available fds */
+    if (fd_files_prepare(table, fd + 1) < 0) {
+        return -1;  /* No available fds */
+    }
+    return (int)fd;
 }
 
 /**
  * Free a file descriptor.
  *
- * Decrements reference count on the underlying file.
+ * Decrements reference count on the underlying file. If the table is
+ * shared and cannot be copied (out of memory), the fd stays open.
  */
 void fd_free(fd_table_t* table, int fd) {
-    if (!table || fd < 0 || fd >= MAX_FD_PER_PROCESS) {
+    if (!table || fd < 0 || (uint32_t)fd >= table->files->capacity) {
         return;
     }
 
-    if (table->entries[fd]) {
-        file_unref(table->entries[fd]);
-        table->entries[fd] = NULL;
-        if (table->num_open > 0) {
-            table->num_open--;
-        }
+    if (table->files->entries[fd] && fd_files_prepare(table, 0) == 0) {
+        fd_set_file(table, fd, NULL);
     }
 }
 
@@ -204,32 +305,53 @@ void fd_free(fd_table_t* table, int fd) {
  * Returns NULL if fd is invalid or not open.
  */
 file_t* fd_get_file(fd_table_t* table, int fd) {
-    if (!table || fd < 0 || fd >= MAX_FD_PER_PROCESS) {
+    if (!table || fd < 0 || (uint32_t)fd >= table->files->capacity) {
         return NULL;
     }
 
-    return table->entries[fd];
+    return table->files->entries[fd];
+}
+
+/**
+ * Get the file behind a descriptor with a reference of its own.
+ *
+ * Takes the VFS lock itself. The threads of a process share its table, so
+ * a sibling may close() or dup2() over fd while the caller still uses the
+ * file; the reference keeps the file_t alive until file_put().
+ */
+file_t* fd_get_file_ref(fd_table_t* table, int fd) {
+    uint64_t irq = vfs_lock();
+    file_t* file = fd_get_file(table, fd);
+    file_ref(file);
+    vfs_unlock(irq);
+    return file;
 }
 
 /**
- * Set the file_t for a file descriptor.
+ * Set the file_t for a file descriptor (NULL closes it).
  *
+ * Takes over the caller's reference on 'file'.
  * Returns 0 on success, -1 on error.
  */
 int fd_set_file(fd_table_t* table, int fd, file_t* file) {
-    if (!table || fd < 0 || fd >= MAX_FD_PER_PROCESS) {
+    if (!table || fd < 0 || fd_files_prepare(table, (uint32_t)fd + 1) < 0) {
         return -1;
     }
 
+    fd_files_t* files = table->files;
+    uint64_t bit = 1ULL << (fd % 64);
+
     /* If there was an old file, unreference it */
-    if (table->entries[fd]) {
-        file_unref(table->entries[fd]);
-        table->num_open--;
+    if (files->entries[fd]) {
+        file_unref(files->entries[fd]);
+        files->open_map[fd / 64] &= ~bit;
+        files->num_open--;
     }
 
-    table->entries[fd] = file;
+    files->entries[fd] = file;
     if (file) {
-        table->num_open++;
+        files->open_map[fd / 64] |= bit;
+        files->num_open++;
     }
 
     return 0;
@@ -243,25 +365,24 @@ int fd_set_file(fd_table_t* table, int fd, file_t* file) {
 /**
  * Allocate a new file_t from the system-wide table.
  *
- * Returns NULL if no slots available.
+ * Returns NULL if out of memory.
  */
 file_t* file_alloc(void) {
     init_file_table();
 
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (open_file_table[i].ref_count == 0) {
-            file_t* file = &open_file_table[i];
-            file->ref_count = 1;
-            file->flags = 0;
-            file->offset = 0;
-            file->inode = 0;
-            file->type = FILE_TYPE_REGULAR;
-            file->vnode = NULL;
-            return file;
-        }
+    file_t* file = (file_t*)kmem_cache_alloc(file_cache);
+    if (!file) {
+        return NULL;
     }
 
-    return NULL;  /* No available slots */
+    file->ref_count = 1;
+    file->flags = 0;
+    file->offset = 0;
+    file->inode = 0;
+    file->type = FILE_TYPE_REGULAR;
+    file->vnode = NULL;
+    file->pipe = NULL;
+    return file;
 }
 
 /**
@@ -280,24 +401,26 @@ void file_free(file_t* file) {
         return;
     }
 
+    /* Wake or free the other end */
+    if (file->type == FILE_TYPE_PIPE) {
+        pipe_release(file);
+    }
+
     /* Clean up vnode reference */
     if (file->vnode) {
         vnode_unref(file->vnode);
         file->vnode = NULL;
     }
 
-    file->ref_count = 0;
-    file->flags = 0;
-    file->offset = 0;
-    file->inode = 0;
-    file->type = 0;
+    kmem_cache_free(file_cache, file);
 }
 
 /**
  * Increment reference count on a file.
  */
 void file_ref(file_t* file) {
-    if (file) {
+    /* Console files are never freed, so they are not counted either */
+    if (file && file != &console_stdin && file != &console_stdout && file != &console_stderr) {
         file->ref_count++;
     }
 }
@@ -325,6 +448,18 @@ void file_unref(file_t* file) {
     }
 }
 
+/**
+ * Drop a reference taken by fd_get_file_ref(), under the VFS lock.
+ */
+void file_put(file_t* file) {
+    if (!file) {
+        return;
+    }
+    uint64_t irq = vfs_lock();
+    file_unref(file);
+    vfs_unlock(irq);
+}
+
 /* =============================================================================
  * Standard I/O Initialization
  * =============================================================================
@@ -344,16 +479,12 @@ int fd_init_stdio(fd_table_t* table) {
     /* Initialize file table if needed */
     init_file_table();
 
-    /* Set up stdin (fd 0) */
-    table->entries[FD_STDIN] = &console_stdin;
-
-    /* Set up stdout (fd 1) */
-    table->entries[FD_STDOUT] = &console_stdout;
-
-    /* Set up stderr (fd 2) */
-    table->entries[FD_STDERR] = &console_stderr;
-
-    table->num_open = 3;
+    /* Set up stdin (fd 0), stdout (fd 1) and stderr (fd 2) */
+    if (fd_set_file(table, FD_STDIN, &console_stdin) < 0 ||
+        fd_set_file(table, FD_STDOUT, &console_stdout) < 0 ||
+        fd_set_file(table, FD_STDERR, &console_stderr) < 0) {
+        return -1;
+    }
 
     return 0;
 }
@@ -0,0 +1,270 @@
+/**
+ * =============================================================================
+ * Chanux OS - Initramfs Unpacker
+ * =============================================================================
+ * Walks the cpio "newc" archive the bootloader left in memory and builds
+ * its tree in the root filesystem (see fs/initramfs.h).
+ *
+ * Entries are taken in archive order, which puts every directory before
+ * what it contains. The archive is read once, front to back, so the pages
+ * behind the entry being unpacked are never needed again: they are given
+ * back to the PMM whenever a file's pages are adopted, and the rest at
+ * the end.
+ *
+ * Runs at boot before anything else uses the VFS, like the rest of
+ * fs_init(), so no VFS lock is taken.
+ * =============================================================================
+ */
+
+#include "fs/initramfs.h"
+#include "fs/vfs.h"
+#include "fs/file.h"
+#include "fs/ramfs.h"
+#include "mm/mm.h"
+#include "mm/pmm.h"
+#include "kernel.h"
+#include "string.h"
+#include "drivers/vga/vga.h"
+
+/* Header fields after the magic, in order */
+#define NEWC_FIELD_MODE         1
+#define NEWC_FIELD_FILESIZE     6
+#define NEWC_FIELD_NAMESIZE     11
+#define NEWC_FIELDS             13
+
+#define NEWC_MODE_TYPE          0xF000      /* S_IFREG, S_IFDIR, ... */
+
+/* =============================================================================
+ * Unpacking State
+ * =============================================================================
+ */
+
+typedef struct {
+    phys_addr_t     start;          /* Archive (physical, page-aligned) */
+    size_t          size;
+    phys_addr_t     released;       /* Pages below this went back to the PMM */
+
+    uint32_t        files;
+    uint32_t        dirs;
+    uint32_t        skipped;
+    uint64_t        adopted_bytes;  /* Taken over as ramfs blocks */
+    uint64_t        copied_bytes;   /* Written with ramfs_write() */
+} initramfs_t;
+
+/* =============================================================================
+ * Helper Functions
+ * =============================================================================
+ */
+
+/* Parse one 8-digit hex field; false if it has anything else in it */
+static bool parse_field(const char* text, uint32_t* value) {
+    uint32_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        char c = text[i];
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        v = (v << 4) | digit;
+    }
+    *value = v;
+    return true;
+}
+
+/**
+ * Turn an archive name ("bin/ls", "./bin/ls") into an absolute path.
+ * Returns false for the root itself and for names that are too long or
+ * climb out of it.
+ */
+static bool make_path(const char* name, size_t name_len, char* path) {
+    while (name_len > 0 && (name[0] == '/' || (name[0] == '.' && (name_len == 1 || name[1] == '/')))) {
+        name++;
+        name_len--;
+    }
+    if (name_len == 0 || name_len + 2 > VFS_MAX_PATH) {
+        return false;
+    }
+
+    for (size_t i = 0; i + 1 < name_len; i++) {
+        if (name[i] == '.' && name[i + 1] == '.' &&
+            (i == 0 || name[i - 1] == '/') && (i + 2 == name_len || name[i + 2] == '/')) {
+            return false;
+        }
+    }
+
+    path[0] = '/';
+    memcpy(path + 1, name, name_len);
+    path[name_len + 1] = '\0';
+    return true;
+}
+
+/* Give the archive's pages in [released, end) back to the PMM */
+static void release_pages(initramfs_t* ird, phys_addr_t end) {
+    for (; ird->released < end; ird->released += PAGE_SIZE) {
+        pmm_unreserve_page(ird->released);
+    }
+}
+
+/* =============================================================================
+ * Entries
+ * =============================================================================
+ */
+
+static void unpack_dir(initramfs_t* ird, const char* path) {
+    vnode_t* existing = NULL;
+    if (vfs_lookup(path, &existing) == 0) {
+        vnode_unref(existing);      /* Already there (snapshot, or listed twice) */
+        ird->dirs++;
+        return;
+    }
+
+    if (vfs_mkdir(path) < 0) {
+        kprintf("[INITRAMFS] Cannot create directory %s\n", path);
+        ird->skipped++;
+        return;
+    }
+    ird->dirs++;
+}
+
+/**
+ * Unpack a file whose data starts 'offset' bytes into the archive.
+ */
+static void unpack_file(initramfs_t* ird, const char* path, size_t offset, size_t size) {
+    file_t* file = NULL;
+    if (vfs_open(path, O_CREAT | O_WRONLY | O_TRUNC, &file) < 0) {
+        kprintf("[INITRAMFS] Cannot create file %s\n", path);
+        ird->skipped++;
+        return;
+    }
+    ramfs_inode_t* inode = file->vnode->inode;
+
+    phys_addr_t data = ird->start + offset;
+    size_t done = 0;
+
+    /* Whole pages on a page boundary: take them over as they are */
+    uint32_t pages = (uint32_t)(size / PAGE_SIZE);
+    if (IS_ALIGNED(data, PAGE_SIZE) && pages > 0) {
+        /* Fewer if the disk fills up; the rest is written below */
+        uint32_t adopted = ramfs_adopt_pages(inode, data, pages);
+        for (uint32_t i = 0; i < adopted; i++) {
+            pmm_claim_reserved_page(data + (phys_addr_t)i * PAGE_SIZE);
+        }
+
+        /* Everything before the adopted pages has been read */
+        release_pages(ird, data);
+        ird->released = data + (phys_addr_t)adopted * PAGE_SIZE;
+
+        done = (size_t)adopted * PAGE_SIZE;
+        ird->adopted_bytes += done;
+    }
+
+    /* The rest in one bulk write */
+    if (done < size) {
+        int64_t written = ramfs_write(inode, PHYS_TO_VIRT(data + done), size - done, done);
+        if (written < (int64_t)(size - done)) {
+            kprintf("[INITRAMFS] Out of space writing %s\n", path);
+        }
+        if (written > 0) {
+            ird->copied_bytes += (uint64_t)written;
+        }
+    }
+
+    vfs_close(file);
+    ird->files++;
+}
+
+/* =============================================================================
+ * Initramfs API
+ * =============================================================================
+ */
+
+int initramfs_unpack(phys_addr_t start, size_t size) {
+    if (!IS_ALIGNED(start, PAGE_SIZE) || start + size > MM_DIRECT_MAP_SIZE) {
+        kprintf("[INITRAMFS] Archive at 0x%x is outside the direct map, ignored\n",
+                (uint32_t)start);
+        return -1;
+    }
+
+    initramfs_t ird = {0};
+    ird.start = start;
+    ird.size = size;
+    ird.released = start;
+
+    const char* archive = (const char*)PHYS_TO_VIRT(start);
+    size_t pos = 0;
+    int result = -1;
+
+    while (pos + INITRAMFS_HEADER_SIZE <= size) {
+        const char* header = archive + pos;
+        uint32_t fields[NEWC_FIELDS];
+        bool valid = memcmp(header, INITRAMFS_MAGIC, 6) == 0;
+        for (int i = 0; valid && i < NEWC_FIELDS; i++) {
+            valid = parse_field(header + 6 + i * 8, &fields[i]);
+        }
+        if (!valid) {
+            break;
+        }
+
+        /* Name after the header (maybe NUL-padded), data 4-byte aligned after it */
+        size_t name_pos = pos + INITRAMFS_HEADER_SIZE;
+        size_t name_size = fields[NEWC_FIELD_NAMESIZE];
+        size_t data_pos = ALIGN_UP(name_pos + name_size, 4);
+        size_t file_size = fields[NEWC_FIELD_FILESIZE];
+        if (name_size == 0 || data_pos > size || file_size > size - data_pos) {
+            break;
+        }
+
+        const char* name = archive + name_pos;
+        size_t name_len = 0;
+        while (name_len < name_size && name[name_len] != '\0') {
+            name_len++;
+        }
+
+        if (name_len == sizeof(INITRAMFS_TRAILER) - 1 &&
+            memcmp(name, INITRAMFS_TRAILER, name_len) == 0) {
+            result = 0;
+            break;
+        }
+
+        char path[VFS_MAX_PATH];
+        uint32_t type = fields[NEWC_FIELD_MODE] & NEWC_MODE_TYPE;
+        if (!make_path(name, name_len, path)) {
+            if (name_len > 1) {
+                ird.skipped++;      /* Not just "." */
+            }
+        } else if (type == S_IFDIR) {
+            unpack_dir(&ird, path);
+        } else if (type == S_IFREG) {
+            unpack_file(&ird, path, data_pos, file_size);
+        } else {
+            ird.skipped++;          /* Links, devices, ... */
+        }
+
+        pos = ALIGN_UP(data_pos + file_size, 4);
+    }
+
+    /* Whatever was not adopted */
+    release_pages(&ird, ALIGN_UP(start + size, PAGE_SIZE));
+
+    vga_set_color(result == 0 ? VGA_COLOR_LIGHT_GREEN : VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    kprintf("[INITRAMFS] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    if (result < 0) {
+        kprintf("Archive is corrupt at offset %d; unpacked what came before\n", (uint32_t)pos);
+    }
+    kprintf("%d files, %d directories (%d KB adopted, %d KB copied",
+            ird.files, ird.dirs,
+            (uint32_t)(ird.adopted_bytes / 1024), (uint32_t)(ird.copied_bytes / 1024));
+    if (ird.skipped > 0) {
+        kprintf(", %d entries skipped", ird.skipped);
+    }
+    kprintf(")\n");
+
+    return result;
+}
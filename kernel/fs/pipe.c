@@ -0,0 +1,234 @@
+/**
+ * =============================================================================
+ * Chanux OS - Pipes
+ * =============================================================================
+ * Each pipe is a PIPE_SIZE ring with free-running head and tail counters.
+ * The writer fills the bytes after 'head' and then publishes them by
+ * advancing it; the reader copies the bytes after 'tail' and then hands
+ * the space back by advancing it. x86 keeps stores (and loads) in order,
+ * so compiler barriers between the copy and the counter update are all
+ * the ordering that is needed.
+ *
+ * Copies go straight between the ring and the caller's buffer, including
+ * user buffers: no lock is held while copying, so a fault on a
+ * demand-zero or copy-on-write page is fine.
+ *
+ * Sleeping uses wait queues: a reader waits on read_wq until head moves
+ * or the last writer goes away, a writer on write_wq until tail moves or
+ * the last reader goes away. Each side wakes the other after moving its
+ * counter. The reader and writer counts change under vfs_lock() as files
+ * are created and freed.
+ * =============================================================================
+ */
+
+#include "../include/fs/pipe.h"
+#include "../include/fs/file.h"
+#include "../include/mm/heap.h"
+#include "../include/mm/pmm.h"
+#include "../include/user/uaccess.h"
+#include "../include/syscall/syscall.h"
+#include "../include/string.h"
+#include "../include/kernel.h"
+
+#define pipe_barrier()  __asm__ volatile("" : : : "memory")
+
+/* =============================================================================
+ * Helpers
+ * =============================================================================
+ */
+
+/* Sleep until '*busy' can be taken (one reader or writer at a time) */
+static void pipe_claim(volatile uint32_t* busy, wait_queue_t* wq) {
+    wait_event(wq, __sync_bool_compare_and_swap(busy, 0, 1));
+}
+
+static void pipe_unclaim(volatile uint32_t* busy, wait_queue_t* wq) {
+    __sync_lock_release(busy);
+    wake_up(wq);
+}
+
+static int pipe_copy_out(void* dst, const void* src, size_t len, bool user) {
+    if (user) {
+        return copy_to_user(dst, src, len);
+    }
+    memcpy(dst, src, len);
+    return 0;
+}
+
+static int pipe_copy_in(void* dst, const void* src, size_t len, bool user) {
+    if (user) {
+        return copy_from_user(dst, src, len);
+    }
+    memcpy(dst, src, len);
+    return 0;
+}
+
+/* =============================================================================
+ * Creation and Release
+ * =============================================================================
+ */
+
+int pipe_create(file_t** read_end, file_t** write_end) {
+    pipe_t* p = (pipe_t*)kzalloc(sizeof(pipe_t));
+    if (!p) {
+        return -1;
+    }
+
+    phys_addr_t frame = pmm_alloc_page();
+    if (frame == 0) {
+        kfree(p);
+        return -1;
+    }
+    p->buf = (uint8_t*)PHYS_TO_VIRT(frame);
+    wait_queue_init(&p->read_wq);
+    wait_queue_init(&p->write_wq);
+
+    file_t* r = file_alloc();
+    file_t* w = file_alloc();
+    if (!r || !w) {
+        /* Plain files still: freeing them does not touch the pipe */
+        file_unref(r);
+        file_unref(w);
+        pmm_free_page(frame);
+        kfree(p);
+        return -1;
+    }
+
+    r->type = FILE_TYPE_PIPE;
+    r->flags = O_RDONLY;
+    r->pipe = p;
+    w->type = FILE_TYPE_PIPE;
+    w->flags = O_WRONLY;
+    w->pipe = p;
+    p->readers = 1;
+    p->writers = 1;
+
+    *read_end = r;
+    *write_end = w;
+    return 0;
+}
+
+void pipe_release(file_t* file) {
+    pipe_t* p = file->pipe;
+    if (!p) {
+        return;
+    }
+    file->pipe = NULL;
+
+    if ((file->flags & O_ACCMODE) == O_RDONLY) {
+        p->readers--;
+    } else {
+        p->writers--;
+    }
+
+    /* Sleepers on the other side see end of file or -EPIPE */
+    wake_up(&p->read_wq);
+    wake_up(&p->write_wq);
+
+    /* No file left, so nobody can be inside pipe_read()/pipe_write() */
+    if (p->readers == 0 && p->writers == 0) {
+        pmm_free_page(VIRT_TO_PHYS(p->buf));
+        kfree(p);
+    }
+}
+
+/* =============================================================================
+ * Reading and Writing
+ * =============================================================================
+ */
+
+int64_t pipe_read(file_t* file, void* buf, size_t count, bool user) {
+    pipe_t* p = file->pipe;
+    if (!p || (file->flags & O_ACCMODE) != O_RDONLY) {
+        return -EBADF;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    pipe_claim(&p->reader_busy, &p->read_wq);
+    wait_event(&p->read_wq, p->head != p->tail || p->writers == 0);
+
+    uint32_t tail = p->tail;
+    size_t want = MIN(count, (size_t)(p->head - tail));
+    pipe_barrier();     /* Data is read after the head that covers it */
+
+    size_t done = 0;
+    while (done < want) {
+        uint32_t off = (tail + (uint32_t)done) & PIPE_MASK;
+        size_t chunk = MIN(want - done, (size_t)(PIPE_SIZE - off));
+        if (pipe_copy_out((uint8_t*)buf + done, p->buf + off, chunk, user) < 0) {
+            break;
+        }
+        done += chunk;
+    }
+
+    pipe_barrier();     /* Space is handed back only after the copy */
+    p->tail = tail + (uint32_t)done;
+    pipe_unclaim(&p->reader_busy, &p->read_wq);
+
+    if (done > 0) {
+        wake_up(&p->write_wq);
+    }
+    if (done == 0 && want > 0) {
+        return -EFAULT;
+    }
+    return (int64_t)done;
+}
+
+int64_t pipe_write(file_t* file, const void* buf, size_t count, bool user) {
+    pipe_t* p = file->pipe;
+    if (!p || (file->flags & O_ACCMODE) != O_WRONLY) {
+        return -EBADF;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    pipe_claim(&p->writer_busy, &p->write_wq);
+
+    size_t done = 0;
+    int64_t err = 0;
+    while (done < count) {
+        wait_event(&p->write_wq, p->head - p->tail < PIPE_SIZE || p->readers == 0);
+        if (p->readers == 0) {
+            err = -EPIPE;
+            break;
+        }
+
+        uint32_t head = p->head;
+        size_t room = PIPE_SIZE - (head - p->tail);
+        size_t want = MIN(count - done, room);
+        pipe_barrier();     /* The reader is done with the space we reuse */
+
+        size_t copied = 0;
+        while (copied < want) {
+            uint32_t off = (head + (uint32_t)copied) & PIPE_MASK;
+            size_t chunk = MIN(want - copied, (size_t)(PIPE_SIZE - off));
+            if (pipe_copy_in(p->buf + off, (const uint8_t*)buf + done + copied,
+                             chunk, user) < 0) {
+                err = -EFAULT;
+                break;
+            }
+            copied += chunk;
+        }
+
+        pipe_barrier();     /* Data is in place before it is published */
+        p->head = head + (uint32_t)copied;
+        done += copied;
+        if (copied > 0) {
+            wake_up(&p->read_wq);
+        }
+        if (err < 0) {
+            break;
+        }
+    }
+
+    pipe_unclaim(&p->writer_busy, &p->write_wq);
+    return done > 0 ? (int64_t)done : err;
+}
+
+uint32_t pipe_available(file_t* file) {
+    pipe_t* p = file->pipe;
+    return p ? p->head - p->tail : 0;
+}
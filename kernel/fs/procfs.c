@@ -0,0 +1,428 @@
+/**
+ * =============================================================================
+ * Chanux OS - Process Filesystem (procfs)
+ * =============================================================================
+ * Live kernel statistics as read-only files under /proc (see procfs.h).
+ *
+ * Nothing is stored: every vnode carries a procfs_node_t naming what it
+ * shows (and the PID for the per-process files), and read() formats the
+ * numbers into a buffer kept with the vnode. Procfs vnodes are not hashed
+ * (they have no RAMFS inode), so each lookup makes a new one and every
+ * open file keeps its own snapshot. Calls come with the VFS lock held.
+ * =============================================================================
+ */
+
+#include "fs/procfs.h"
+#include "fs/vfs.h"
+#include "mm/heap.h"
+#include "mm/pmm.h"
+#include "proc/process.h"
+#include "proc/sched.h"
+#include "clock.h"
+#include "kernel.h"
+#include "printf.h"
+#include "smp.h"
+#include "string.h"
+#include "drivers/vga/vga.h"
+
+/* What a procfs vnode shows */
+typedef enum {
+    PROC_ROOT = 0,
+    PROC_MEMINFO,
+    PROC_HEAPINFO,
+    PROC_SCHED,
+    PROC_VNODES,
+    PROC_PID_DIR,
+    PROC_PID_STAT,
+} proc_kind_t;
+
+typedef struct {
+    proc_kind_t     kind;
+    pid_t           pid;                /* PROC_PID_*: the process */
+    char*           text;               /* Last snapshot (NULL until read) */
+    size_t          len;
+} procfs_node_t;
+
+/* Fixed entries of /proc, in readdir order */
+static const struct {
+    const char*     name;
+    proc_kind_t     kind;
+} proc_root_files[] = {
+    { "meminfo",    PROC_MEMINFO },
+    { "heapinfo",   PROC_HEAPINFO },
+    { "sched",      PROC_SCHED },
+    { "vnodes",     PROC_VNODES },
+};
+
+#define PROC_ROOT_FILES     (sizeof(proc_root_files) / sizeof(proc_root_files[0]))
+
+/* Inode numbers outside anything RAMFS hands out */
+#define PROC_INO(kind, pid) (0x80000000U | ((uint32_t)(pid) << 3) | (uint32_t)(kind))
+
+static procfs_node_t proc_root_node = { PROC_ROOT, 0, NULL, 0 };
+static vnode_t* proc_root_vnode = NULL;
+
+/* Forward declarations for procfs VFS ops */
+static int64_t procfs_read(vnode_t* vn, void* buf, size_t count, uint64_t offset);
+static int procfs_lookup(vnode_t* dir, const char* name, vnode_t** result);
+static int procfs_readdir(vnode_t* dir, uint32_t index, ramfs_dirent_t* entry);
+static int procfs_stat(vnode_t* vn, stat_t* buf);
+static void procfs_release(vnode_t* vn);
+
+/* Read-only: no write, create, unlink, truncate or mmap */
+static vfs_ops_t procfs_ops = {
+    .read = procfs_read,
+    .lookup = procfs_lookup,
+    .readdir = procfs_readdir,
+    .stat = procfs_stat,
+    .release = procfs_release,
+};
+
+/* =============================================================================
+ * Nodes
+ * =============================================================================
+ */
+
+static procfs_node_t* proc_node(vnode_t* vn) {
+    return (procfs_node_t*)vn->fs_data;
+}
+
+static vnode_t* proc_vnode_create(proc_kind_t kind, pid_t pid) {
+    procfs_node_t* node = kzalloc(sizeof(procfs_node_t));
+    if (!node) {
+        return NULL;
+    }
+    vnode_t* vn = vnode_alloc();
+    if (!vn) {
+        kfree(node);
+        return NULL;
+    }
+
+    node->kind = kind;
+    node->pid = pid;
+    vn->inode_num = PROC_INO(kind, pid);
+    vn->type = (kind == PROC_PID_DIR) ? INODE_TYPE_DIR : INODE_TYPE_FILE;
+    vn->ops = &procfs_ops;
+    vn->fs_data = node;
+    return vn;
+}
+
+static void procfs_release(vnode_t* vn) {
+    procfs_node_t* node = proc_node(vn);
+    if (node && node != &proc_root_node) {
+        kfree(node->text);
+        kfree(node);
+    }
+    vn->fs_data = NULL;
+}
+
+/* Parse a /proc/<pid> name; fails unless it is all digits */
+static int proc_parse_pid(const char* name, pid_t* pid) {
+    pid_t value = 0;
+    if (!*name) {
+        return -1;
+    }
+    for (const char* p = name; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        value = value * 10 + (pid_t)(*p - '0');
+    }
+    *pid = value;
+    return 0;
+}
+
+/* =============================================================================
+ * File Contents
+ * =============================================================================
+ */
+
+typedef struct {
+    char*   buf;
+    size_t  len;
+} proc_text_t;
+
+/* Append to a snapshot (truncated at PROCFS_TEXT_MAX) */
+static void proc_printf(proc_text_t* t, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (t->len < PROCFS_TEXT_MAX - 1) {
+        size_t n = kvsnprintf(t->buf + t->len, PROCFS_TEXT_MAX - t->len, fmt, args);
+        t->len = MIN(t->len + n, (size_t)PROCFS_TEXT_MAX - 1);
+    }
+    va_end(args);
+}
+
+static void proc_gen_meminfo(proc_text_t* t) {
+    pmm_stats_t s;
+    pmm_get_stats(&s);
+
+    proc_printf(t, "total_kb: %u\n", s.total_memory / 1024);
+    proc_printf(t, "free_kb: %u\n", s.free_memory / 1024);
+    proc_printf(t, "total_pages: %u\n", s.total_pages);
+    proc_printf(t, "free_pages: %u\n", s.free_pages);
+    proc_printf(t, "used_pages: %u\n", s.used_pages);
+    proc_printf(t, "reserved_pages: %u\n", s.reserved_pages);
+    proc_printf(t, "cached_pages: %u\n", s.cached_pages);
+    proc_printf(t, "zeroed_pages: %u\n", s.zeroed_pages);
+    proc_printf(t, "dma32_free_pages: %u\n", s.dma32_free_pages);
+    for (uint32_t node = 0; node < s.node_count; node++) {
+        proc_printf(t, "node%u_free_pages: %u\n", (uint64_t)node, s.node_free_pages[node]);
+    }
+    proc_printf(t, "free_blocks:");
+    for (uint32_t order = 0; order < PMM_ORDER_COUNT; order++) {
+        proc_printf(t, " %u", s.free_blocks[order]);
+    }
+    proc_printf(t, "\n");
+}
+
+static void proc_gen_heapinfo(proc_text_t* t) {
+    heap_stats_t s;
+    heap_get_stats(&s);
+
+    proc_printf(t, "total_size: %u\n", (uint64_t)s.total_size);
+    proc_printf(t, "used_size: %u\n", (uint64_t)s.used_size);
+    proc_printf(t, "free_size: %u\n", (uint64_t)s.free_size);
+    proc_printf(t, "largest_free: %u\n", (uint64_t)s.largest_free);
+    proc_printf(t, "released_size: %u\n", (uint64_t)s.released_size);
+    proc_printf(t, "blocks: %u\n", (uint64_t)s.block_count);
+    proc_printf(t, "free_blocks: %u\n", (uint64_t)s.free_block_count);
+    proc_printf(t, "allocs: %u\n", s.alloc_count);
+    proc_printf(t, "frees: %u\n", s.free_count);
+}
+
+static void proc_gen_sched(proc_text_t* t) {
+    proc_printf(t, "uptime_ns: %u\n", clock_ns());
+    proc_printf(t, "cpus: %u\n", (uint64_t)smp_cpu_count());
+    proc_printf(t, "ready: %u\n", (uint64_t)sched_ready_count());
+    proc_printf(t, "processes: %u\n", (uint64_t)process_count(-1));
+    proc_printf(t, "running: %u\n", (uint64_t)process_count(PROCESS_STATE_RUNNING));
+    proc_printf(t, "blocked: %u\n", (uint64_t)process_count(PROCESS_STATE_BLOCKED));
+    proc_printf(t, "terminated: %u\n", (uint64_t)process_count(PROCESS_STATE_TERMINATED));
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (!cpu) {
+            continue;
+        }
+        process_t* current = cpu->current;
+        proc_printf(t, "cpu%u: queued %u current %u\n", (uint64_t)i, (uint64_t)cpu->rq.count,
+                    current ? (uint64_t)current->pid : 0);
+    }
+}
+
+static void proc_gen_vnodes(proc_text_t* t) {
+    vfs_vnode_stats_t s;
+    vfs_vnode_stats(&s);
+
+    proc_printf(t, "live: %u\n", (uint64_t)s.live);
+    proc_printf(t, "hashed: %u\n", (uint64_t)s.hashed);
+    proc_printf(t, "buckets: %u\n", (uint64_t)s.buckets);
+    proc_printf(t, "longest_chain: %u\n", (uint64_t)s.longest_chain);
+}
+
+static const char* proc_state_name(process_state_t state) {
+    switch (state) {
+        case PROCESS_STATE_READY:       return "ready";
+        case PROCESS_STATE_RUNNING:     return "running";
+        case PROCESS_STATE_BLOCKED:     return "blocked";
+        case PROCESS_STATE_TERMINATED:  return "terminated";
+        default:                        return "unused";
+    }
+}
+
+/* Fails once the process is gone */
+static int proc_gen_pid_stat(proc_text_t* t, pid_t pid) {
+    process_t* proc = process_get(pid);
+    if (!proc) {
+        return -1;
+    }
+
+    proc_printf(t, "pid: %u\n", proc->pid);
+    proc_printf(t, "tgid: %u\n", proc->tgid);
+    proc_printf(t, "ppid: %u\n", proc->parent_pid);
+    proc_printf(t, "name: %s\n", proc->name);
+    proc_printf(t, "state: %s\n", proc_state_name(proc->state));
+    proc_printf(t, "flags: %x\n", (uint64_t)proc->flags);
+    proc_printf(t, "priority: %u\n", (uint64_t)proc->priority);
+    proc_printf(t, "cpu: %u\n", (uint64_t)proc->cpu);
+    proc_printf(t, "total_ticks: %u\n", proc->total_ticks);
+    proc_printf(t, "last_ran: %u\n", proc->last_ran);
+    return 0;
+}
+
+/* Take a new snapshot into the node's buffer */
+static int proc_generate(procfs_node_t* node) {
+    if (!node->text) {
+        node->text = kmalloc(PROCFS_TEXT_MAX);
+        if (!node->text) {
+            return -1;
+        }
+    }
+
+    proc_text_t t = { node->text, 0 };
+    int ret = 0;
+    switch (node->kind) {
+        case PROC_MEMINFO:  proc_gen_meminfo(&t);               break;
+        case PROC_HEAPINFO: proc_gen_heapinfo(&t);              break;
+        case PROC_SCHED:    proc_gen_sched(&t);                 break;
+        case PROC_VNODES:   proc_gen_vnodes(&t);                break;
+        case PROC_PID_STAT: ret = proc_gen_pid_stat(&t, node->pid); break;
+        default:            ret = -1;                           break;
+    }
+    node->len = t.len;
+    return ret;
+}
+
+/* =============================================================================
+ * Procfs VFS Operations Implementation
+ * =============================================================================
+ */
+
+static int64_t procfs_read(vnode_t* vn, void* buf, size_t count, uint64_t offset) {
+    procfs_node_t* node = proc_node(vn);
+    if (!node || vn->type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    /* Offset 0 starts over; later offsets continue the last snapshot */
+    if ((offset == 0 || !node->text) && proc_generate(node) < 0) {
+        node->len = 0;
+        return -1;
+    }
+    if (offset >= node->len) {
+        return 0;
+    }
+
+    size_t n = MIN(count, node->len - (size_t)offset);
+    memcpy(buf, node->text + offset, n);
+    return (int64_t)n;
+}
+
+static int procfs_lookup(vnode_t* dir, const char* name, vnode_t** result) {
+    procfs_node_t* node = dir ? proc_node(dir) : NULL;
+    if (!node || !name || !result) {
+        return -1;
+    }
+
+    vnode_t* vn = NULL;
+    if (node->kind == PROC_ROOT) {
+        for (uint32_t i = 0; i < PROC_ROOT_FILES && !vn; i++) {
+            if (strcmp(name, proc_root_files[i].name) == 0) {
+                vn = proc_vnode_create(proc_root_files[i].kind, 0);
+            }
+        }
+        pid_t pid;
+        if (!vn && proc_parse_pid(name, &pid) == 0 && process_get(pid)) {
+            vn = proc_vnode_create(PROC_PID_DIR, pid);
+        }
+    } else if (node->kind == PROC_PID_DIR && strcmp(name, "stat") == 0 &&
+               process_get(node->pid)) {
+        vn = proc_vnode_create(PROC_PID_STAT, node->pid);
+    } else if (node->kind == PROC_PID_DIR && strcmp(name, "..") == 0) {
+        /* ".." from the root itself is the VFS's: it leaves the mount */
+        vn = proc_root_vnode;
+        vnode_ref(vn);
+    }
+
+    *result = vn;
+    return vn ? 0 : -1;
+}
+
+static void proc_fill_dirent(ramfs_dirent_t* entry, const char* name, proc_kind_t kind,
+                             pid_t pid) {
+    memset(entry, 0, sizeof(ramfs_dirent_t));
+    size_t len = MIN(strlen(name), sizeof(entry->name) - 1);
+    memcpy(entry->name, name, len);
+    entry->name_len = (uint8_t)len;
+    entry->rec_len = sizeof(ramfs_dirent_t);
+    entry->inode = PROC_INO(kind, pid);
+    entry->type = (kind == PROC_PID_DIR) ? INODE_TYPE_DIR : INODE_TYPE_FILE;
+}
+
+static int procfs_readdir(vnode_t* dir, uint32_t index, ramfs_dirent_t* entry) {
+    procfs_node_t* node = dir ? proc_node(dir) : NULL;
+    if (!node || !entry) {
+        return -1;
+    }
+
+    if (node->kind == PROC_PID_DIR) {
+        if (index != 0 || !process_get(node->pid)) {
+            return -1;
+        }
+        proc_fill_dirent(entry, "stat", PROC_PID_STAT, node->pid);
+        return 0;
+    }
+    if (node->kind != PROC_ROOT) {
+        return -1;
+    }
+
+    if (index < PROC_ROOT_FILES) {
+        proc_fill_dirent(entry, proc_root_files[index].name, proc_root_files[index].kind, 0);
+        return 0;
+    }
+
+    /* Then one directory per live process, in process table order */
+    uint32_t skip = index - PROC_ROOT_FILES;
+    for (uint32_t slot = 0; slot < MAX_PROCESSES; slot++) {
+        process_t* proc = process_get_slot(slot);
+        if (proc && skip-- == 0) {
+            char name[24];
+            ksnprintf(name, sizeof(name), "%u", proc->pid);
+            proc_fill_dirent(entry, name, PROC_PID_DIR, proc->pid);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int procfs_stat(vnode_t* vn, stat_t* buf) {
+    if (!vn || !buf) {
+        return -1;
+    }
+
+    memset(buf, 0, sizeof(stat_t));
+    buf->st_ino = vn->inode_num;
+    buf->st_blksize = PROCFS_TEXT_MAX;
+    if (vn->type == INODE_TYPE_DIR) {
+        buf->st_mode = S_IFDIR | 0555;
+        buf->st_nlink = 2;
+    } else {
+        buf->st_mode = S_IFREG | 0444;
+        buf->st_nlink = 1;
+    }
+    return 0;
+}
+
+/* =============================================================================
+ * Initialization
+ * =============================================================================
+ */
+
+/**
+ * Mount procfs on /proc.
+ */
+void procfs_init(void) {
+    vnode_t* root = vnode_alloc();
+    if (!root) {
+        PANIC("Failed to allocate procfs root vnode");
+    }
+    root->inode_num = PROC_INO(PROC_ROOT, 0);
+    root->type = INODE_TYPE_DIR;
+    root->ops = &procfs_ops;
+    root->fs_data = &proc_root_node;
+
+    /* Already there after a snapshot restore */
+    vfs_mkdir(PROCFS_MOUNT);
+    if (vfs_mount(PROCFS_MOUNT, root) < 0) {
+        vnode_free(root);
+        kprintf("[PROCFS] Cannot mount on %s\n", PROCFS_MOUNT);
+        return;
+    }
+    proc_root_vnode = root;
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[PROCFS] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("Mounted on %s\n", PROCFS_MOUNT);
+}
@@ -4,25 +4,42 @@
  * =============================================================================
  * Simple in-memory filesystem for educational purposes.
  *
- * Memory Layout:
+ * Memory Layout (sized by ramfs_format() for the disk, see ramfs.h):
  *   Block 0:       Superblock
- *   Blocks 1-8:    Inode table (256 inodes * 128 bytes = 8 blocks)
- *   Blocks 9+:     Data blocks
+ *   Blocks 1+:     Block bitmap, inode bitmap
+ *   Then:          Inode table (one inode per 16KB of disk, at least 256)
+ *   Then:          Data blocks
  *
  * Design:
  *   - All data is stored in RAM (volatile)
- *   - Simple bitmap-based allocation for blocks and inodes
- *   - Direct block pointers only (no indirect blocks for simplicity)
- *   - Maximum file size: 12 * 4096 = 48KB
+ *   - Bitmap-based allocation for blocks and inodes (bitmap.h: 64 bits per
+ *     step, next-fit cursors, multi-block runs)
+ *   - Directories are hash-indexed (htree-style, see ramfs.h): lookup,
+ *     insert and remove touch the index root and one leaf block
+ *   - Name lookups go through the directory entry cache (fs/dcache.h),
+ *     which every directory change keeps up to date
+ *   - Files map their blocks through 12 direct pointers plus single and
+ *     double indirect blocks (up to ~4GB, bounded by the disk); new blocks
+ *     are placed right after the file's previous block where possible, and
+ *     read/write copy each run of adjacent blocks with one memcpy
+ *   - Every block is one page frame, taken from the PMM when the block is
+ *     first used and given back when it is freed, so the disk can be
+ *     sized from the memory map at mount time; mmap() maps data block
+ *     frames straight into user space
  * =============================================================================
  */
 
 #include "fs/ramfs.h"
+#include "fs/dcache.h"
 #include "mm/heap.h"
+#include "mm/pmm.h"
 #include "kernel.h"
+#include "bitmap.h"
 #include "string.h"
 #include "drivers/vga/vga.h"
 #include "drivers/pit.h"
+#include "drivers/blkdev.h"
+#include "drivers/bcache.h"
 
 /* Maximum path length (same as RAMFS_MAX_PATH in vfs.h) */
 #ifndef RAMFS_MAX_PATH
@@ -33,6 +50,30 @@
 ramdisk_t g_ramdisk = {0};
 ramfs_superblock_t* g_superblock = NULL;
 
+/* Allocation bitmaps (metadata blocks after the superblock) */
+static uint64_t* block_bitmap = NULL;
+static uint64_t* inode_bitmap = NULL;
+
+/*
+ * Owners of each data block (0 = free or metadata, 1 = one file).
+ * ramfs_copy_range() shares whole blocks between files; a shared block
+ * is copied on the first write through any of them.
+ */
+#define RAMFS_BLOCK_REFS_MAX    255
+static uint8_t* block_refs = NULL;
+
+/*
+ * User mappings of each data block (mmap). A mapped block is never
+ * shared by ramfs_copy_range(), and stays allocated after its last file
+ * lets go of it until the last mapping does.
+ */
+#define RAMFS_BLOCK_MAPS_MAX    0xFFFF
+static uint16_t* block_maps = NULL;
+
+/* Next-fit cursors: where the last block and inode allocations ended */
+static uint64_t block_cursor = 0;
+static uint64_t inode_cursor = 0;
+
 /* Debug flag */
 #define DEBUG_RAMFS 0
 
@@ -48,45 +89,24 @@ ramfs_superblock_t* g_superblock = NULL;
  */
 
 /**
- * Set a bit in a bitmap.
- */
-static void bitmap_set(uint8_t* bitmap, uint32_t index) {
-    bitmap[index / 8] |= (1 << (index % 8));
-}
-
-/**
- * Clear a bit in a bitmap.
+ * Minimum of two values.
  */
-static void bitmap_clear(uint8_t* bitmap, uint32_t index) {
-    bitmap[index / 8] &= ~(1 << (index % 8));
+static size_t min_size(size_t a, size_t b) {
+    return (a < b) ? a : b;
 }
 
-/**
- * Test a bit in a bitmap.
- */
-static bool bitmap_test(uint8_t* bitmap, uint32_t index) {
-    return (bitmap[index / 8] & (1 << (index % 8))) != 0;
+/* Blocks needed to hold 'bytes' */
+static uint32_t blocks_for(uint64_t bytes) {
+    return (uint32_t)((bytes + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE);
 }
 
-/**
- * Find first free bit in a bitmap.
- * Returns -1 if no free bit found.
- */
-static int bitmap_find_free(uint8_t* bitmap, uint32_t size) {
-    for (uint32_t i = 0; i < size; i++) {
-        if (!bitmap_test(bitmap, i)) {
-            return (int)i;
-        }
-    }
-    return -1;
+/* Inode table block holding an inode */
+static uint32_t inode_block(uint32_t inode_num) {
+    return g_superblock->inode_table_start + inode_num / RAMFS_INODES_PER_BLOCK;
 }
 
-/**
- * Minimum of two values.
- */
-static size_t min_size(size_t a, size_t b) {
-    return (a < b) ? a : b;
-}
+static void dx_free(ramfs_inode_t* dir);
+static void ramfs_free_blocks_from(ramfs_inode_t* inode, uint32_t first);
 
 /* =============================================================================
  * RAM Disk Layer
@@ -96,7 +116,8 @@ static size_t min_size(size_t a, size_t b) {
 /**
  * Initialize the RAM disk.
  *
- * Allocates memory for the filesystem.
+ * Only the frame table is allocated here; each block gets a zeroed page
+ * frame from the PMM when it is first backed.
  * Returns 0 on success, -1 on failure.
  */
 int ramdisk_init(size_t size_bytes) {
@@ -106,32 +127,95 @@ int ramdisk_init(size_t size_bytes) {
 
     /* Ensure size is a multiple of block size */
     size_bytes = (size_bytes + RAMFS_BLOCK_SIZE - 1) & ~(RAMFS_BLOCK_SIZE - 1);
+    uint32_t block_count = (uint32_t)(size_bytes / RAMFS_BLOCK_SIZE);
 
-    /* Allocate RAM disk memory */
-    g_ramdisk.data = kmalloc(size_bytes);
-    if (!g_ramdisk.data) {
-        kprintf("[RAMFS] Error: Failed to allocate %lu bytes for RAM disk\n",
-                (unsigned long)size_bytes);
+    g_ramdisk.frames = (uint32_t*)kzalloc(block_count * sizeof(uint32_t));
+    if (!g_ramdisk.frames) {
+        kprintf("[RAMFS] Error: Failed to allocate the frame table for %u blocks\n",
+                block_count);
         return -1;
     }
 
-    /* Clear the RAM disk */
-    memset(g_ramdisk.data, 0, size_bytes);
-
     g_ramdisk.size = size_bytes;
-    g_ramdisk.block_count = size_bytes / RAMFS_BLOCK_SIZE;
+    g_ramdisk.block_count = block_count;
     g_ramdisk.block_size = RAMFS_BLOCK_SIZE;
+    g_ramdisk.backed_blocks = 0;
     g_ramdisk.initialized = true;
 
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[RAMFS] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    kprintf("RAM disk initialized: %lu KB (%u blocks)\n",
-            (unsigned long)(size_bytes / 1024), g_ramdisk.block_count);
+    kprintf("RAM disk initialized: %u KB (%u blocks, backed on demand)\n",
+            (uint32_t)(size_bytes / 1024), g_ramdisk.block_count);
+
+    return 0;
+}
+
+/**
+ * Give a block a page frame.
+ * Returns 1 if the block was just backed (it reads as zeros), 0 if it
+ * already had a frame, -1 if out of range or out of memory.
+ */
+int ramdisk_back_block(uint32_t block_num) {
+    if (!g_ramdisk.initialized || block_num >= g_ramdisk.block_count) {
+        return -1;
+    }
+    if (g_ramdisk.frames[block_num]) {
+        return 0;
+    }
+
+    phys_addr_t frame = pmm_alloc_page_zeroed();
+    if (!frame) {
+        return -1;
+    }
+    g_ramdisk.frames[block_num] = (uint32_t)ADDR_TO_PFN(frame);
+    g_ramdisk.backed_blocks++;
+    return 1;
+}
+
+/**
+ * Back a run of unbacked blocks with physically contiguous, zeroed frames,
+ * so the run is also one contiguous range of kernel addresses.
+ * Returns 0 on success, -1 on failure.
+ */
+int ramdisk_back_range(uint32_t first, uint32_t count) {
+    if (!g_ramdisk.initialized || count == 0 || first >= g_ramdisk.block_count ||
+        count > g_ramdisk.block_count - first) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (g_ramdisk.frames[first + i]) {
+            return -1;
+        }
+    }
 
+    phys_addr_t frames = pmm_alloc_pages(count);
+    if (!frames) {
+        return -1;
+    }
+    memset(PHYS_TO_VIRT(frames), 0, (size_t)count * PAGE_SIZE);
+
+    for (uint32_t i = 0; i < count; i++) {
+        g_ramdisk.frames[first + i] = (uint32_t)ADDR_TO_PFN(frames) + i;
+    }
+    g_ramdisk.backed_blocks += count;
     return 0;
 }
 
+/**
+ * Return a block's page frame to the PMM (the block reads as zeros again).
+ */
+void ramdisk_release_block(uint32_t block_num) {
+    if (!g_ramdisk.initialized || block_num >= g_ramdisk.block_count ||
+        !g_ramdisk.frames[block_num]) {
+        return;
+    }
+
+    pmm_free_page(PFN_TO_ADDR((phys_addr_t)g_ramdisk.frames[block_num]));
+    g_ramdisk.frames[block_num] = 0;
+    g_ramdisk.backed_blocks--;
+}
+
 /**
  * Read a block from the RAM disk.
  */
@@ -140,7 +224,11 @@ int ramdisk_read_block(uint32_t block_num, void* buffer) {
         return -1;
     }
 
-    uint8_t* src = (uint8_t*)g_ramdisk.data + (block_num * RAMFS_BLOCK_SIZE);
+    void* src = ramdisk_get_block_ptr(block_num);
+    if (!src) {
+        memset(buffer, 0, RAMFS_BLOCK_SIZE);    /* Never written */
+        return 0;
+    }
     memcpy(buffer, src, RAMFS_BLOCK_SIZE);
     return 0;
 }
@@ -149,25 +237,37 @@ int ramdisk_read_block(uint32_t block_num, void* buffer) {
  * Write a block to the RAM disk.
  */
 int ramdisk_write_block(uint32_t block_num, const void* buffer) {
-    if (!g_ramdisk.initialized || block_num >= g_ramdisk.block_count) {
+    if (ramdisk_back_block(block_num) < 0) {
         return -1;
     }
 
-    uint8_t* dst = (uint8_t*)g_ramdisk.data + (block_num * RAMFS_BLOCK_SIZE);
-    memcpy(dst, buffer, RAMFS_BLOCK_SIZE);
+    memcpy(ramdisk_get_block_ptr(block_num), buffer, RAMFS_BLOCK_SIZE);
     return 0;
 }
 
 /**
  * Get direct pointer to a block in the RAM disk.
  * This avoids copying for in-memory filesystem.
+ * Returns NULL if the block has no frame yet.
  */
 void* ramdisk_get_block_ptr(uint32_t block_num) {
-    if (!g_ramdisk.initialized || block_num >= g_ramdisk.block_count) {
+    if (!g_ramdisk.initialized || block_num >= g_ramdisk.block_count ||
+        !g_ramdisk.frames[block_num]) {
         return NULL;
     }
 
-    return (uint8_t*)g_ramdisk.data + (block_num * RAMFS_BLOCK_SIZE);
+    return PHYS_TO_VIRT(PFN_TO_ADDR((phys_addr_t)g_ramdisk.frames[block_num]));
+}
+
+/**
+ * Get the physical page frame holding a block (0 if it has none).
+ */
+phys_addr_t ramdisk_get_block_phys(uint32_t block_num) {
+    if (!g_ramdisk.initialized || block_num >= g_ramdisk.block_count) {
+        return 0;
+    }
+
+    return PFN_TO_ADDR((phys_addr_t)g_ramdisk.frames[block_num]);
 }
 
 /* =============================================================================
@@ -175,40 +275,117 @@ void* ramdisk_get_block_ptr(uint32_t block_num) {
  * =============================================================================
  */
 
+/* Where each region of a disk of 'total_blocks' blocks starts */
+typedef struct {
+    uint32_t total_inodes;
+    uint32_t block_bitmap_start;
+    uint32_t inode_bitmap_start;
+    uint32_t inode_table_start;
+    uint32_t data_start;
+} ramfs_layout_t;
+
+/**
+ * Lay out a disk: superblock, block bitmap, inode bitmap, inode table,
+ * data. Returns 0 on success, -1 if the disk is too small.
+ */
+static int ramfs_compute_layout(uint32_t total_blocks, ramfs_layout_t* layout) {
+    uint32_t total_inodes = total_blocks / (RAMFS_BYTES_PER_INODE / RAMFS_BLOCK_SIZE);
+    if (total_inodes < RAMFS_MIN_INODES) {
+        total_inodes = RAMFS_MIN_INODES;
+    }
+    layout->total_inodes = ALIGN_UP(total_inodes, 64);
+
+    layout->block_bitmap_start = RAMFS_SUPERBLOCK_BLOCK + 1;
+    layout->inode_bitmap_start = layout->block_bitmap_start +
+        (total_blocks + RAMFS_BITS_PER_BLOCK - 1) / RAMFS_BITS_PER_BLOCK;
+    layout->inode_table_start = layout->inode_bitmap_start +
+        (layout->total_inodes + RAMFS_BITS_PER_BLOCK - 1) / RAMFS_BITS_PER_BLOCK;
+    layout->data_start = layout->inode_table_start +
+        blocks_for((uint64_t)layout->total_inodes * sizeof(ramfs_inode_t));
+
+    return (layout->data_start < total_blocks) ? 0 : -1;
+}
+
+/* Per-block owner and mapping counts, allocated once for the disk */
+static int ramfs_alloc_counts(uint32_t total_blocks) {
+    if (!block_refs) {
+        block_refs = (uint8_t*)kmalloc(total_blocks * sizeof(uint8_t));
+        block_maps = (uint16_t*)kmalloc(total_blocks * sizeof(uint16_t));
+        if (!block_refs || !block_maps) {
+            kprintf("[RAMFS] Error: Failed to allocate block reference counts\n");
+            return -1;
+        }
+    }
+    memset(block_refs, 0, total_blocks * sizeof(uint8_t));
+    memset(block_maps, 0, total_blocks * sizeof(uint16_t));
+    return 0;
+}
+
 /**
  * Format the filesystem.
- * Creates superblock and root directory.
+ * Sizes the bitmaps and inode table for the disk, then creates the
+ * superblock and root directory.
  */
 int ramfs_format(void) {
     if (!g_ramdisk.initialized) {
         return -1;
     }
 
-    /* Initialize superblock */
-    g_superblock = (ramfs_superblock_t*)ramdisk_get_block_ptr(RAMFS_SUPERBLOCK_BLOCK);
-    if (!g_superblock) {
+    uint32_t total_blocks = g_ramdisk.block_count;
+    ramfs_layout_t layout;
+    if (ramfs_compute_layout(total_blocks, &layout) < 0) {
+        kprintf("[RAMFS] Error: %u blocks is too small to format\n", total_blocks);
         return -1;
     }
+    uint32_t total_inodes = layout.total_inodes;
+    uint32_t inode_table_start = layout.inode_table_start;
+    uint32_t data_start = layout.data_start;
 
-    memset(g_superblock, 0, sizeof(ramfs_superblock_t));
+    /* Start over: drop every frame outside the metadata blocks */
+    for (uint32_t i = inode_table_start; i < total_blocks; i++) {
+        ramdisk_release_block(i);
+    }
+    if (!g_ramdisk.frames[RAMFS_SUPERBLOCK_BLOCK] &&
+        ramdisk_back_range(RAMFS_SUPERBLOCK_BLOCK, inode_table_start) < 0) {
+        kprintf("[RAMFS] Error: Failed to allocate %u metadata blocks\n", inode_table_start);
+        return -1;
+    }
+
+    if (ramfs_alloc_counts(total_blocks) < 0) {
+        return -1;
+    }
+
+    /* Initialize superblock */
+    g_superblock = (ramfs_superblock_t*)ramdisk_get_block_ptr(RAMFS_SUPERBLOCK_BLOCK);
+    memset(g_superblock, 0, (size_t)inode_table_start * RAMFS_BLOCK_SIZE);
+    block_bitmap = (uint64_t*)ramdisk_get_block_ptr(layout.block_bitmap_start);
+    inode_bitmap = (uint64_t*)ramdisk_get_block_ptr(layout.inode_bitmap_start);
+    block_cursor = data_start;
+    inode_cursor = 0;
+    dcache_init();
 
     g_superblock->magic = RAMFS_MAGIC;
     g_superblock->version = RAMFS_VERSION;
     g_superblock->block_size = RAMFS_BLOCK_SIZE;
-    g_superblock->total_blocks = g_ramdisk.block_count;
-    g_superblock->free_blocks = g_ramdisk.block_count - RAMFS_DATA_START_BLOCK;
-    g_superblock->total_inodes = RAMFS_MAX_FILES;
-    g_superblock->free_inodes = RAMFS_MAX_FILES - 1;  /* Root inode is used */
+    g_superblock->total_blocks = total_blocks;
+    g_superblock->free_blocks = total_blocks - data_start;
+    g_superblock->total_inodes = total_inodes;
+    g_superblock->free_inodes = total_inodes - 1;  /* Root inode is used */
     g_superblock->root_inode = RAMFS_ROOT_INODE;
     g_superblock->created_time = pit_get_ticks();
     g_superblock->mount_time = g_superblock->created_time;
+    g_superblock->block_bitmap_start = layout.block_bitmap_start;
+    g_superblock->inode_bitmap_start = layout.inode_bitmap_start;
+    g_superblock->inode_table_start = inode_table_start;
+    g_superblock->data_start = data_start;
 
-    /* Mark superblock and inode table blocks as used */
-    for (uint32_t i = 0; i < RAMFS_DATA_START_BLOCK; i++) {
-        bitmap_set(g_superblock->block_bitmap, i);
-    }
+    /* Mark superblock, bitmap and inode table blocks as used */
+    bitmap_set_range(block_bitmap, 0, data_start);
 
     /* Create root directory inode */
+    if (ramdisk_back_block(inode_block(RAMFS_ROOT_INODE)) < 0) {
+        return -1;
+    }
     ramfs_inode_t* root = ramfs_get_inode(RAMFS_ROOT_INODE);
     if (!root) {
         return -1;
@@ -223,26 +400,55 @@ int ramfs_format(void) {
     root->accessed = root->created;
     root->link_count = 2;  /* . and parent (for root, parent is self) */
     root->parent = RAMFS_ROOT_INODE;  /* Root's parent is itself */
+    root->number = RAMFS_ROOT_INODE;
 
     /* Mark root inode as used */
-    bitmap_set(g_superblock->inode_bitmap, RAMFS_ROOT_INODE);
+    bitmap_set(inode_bitmap, RAMFS_ROOT_INODE);
 
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[RAMFS] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    kprintf("Filesystem formatted: %u blocks, %u inodes\n",
-            g_superblock->total_blocks, g_superblock->total_inodes);
+    kprintf("Filesystem formatted: %u blocks, %u inodes, data from block %u\n",
+            g_superblock->total_blocks, g_superblock->total_inodes, data_start);
 
     return 0;
 }
 
+/**
+ * Choose the disk size: RAMFS_SIZE_MB if configured at build time,
+ * otherwise half of the memory still free.
+ */
+static size_t ramfs_disk_size(void) {
+#ifdef RAMFS_SIZE_MB
+    uint64_t size = (uint64_t)RAMFS_SIZE_MB * 1024 * 1024;
+#else
+    pmm_stats_t stats;
+    pmm_get_stats(&stats);
+    uint64_t size = stats.free_memory / 2;
+#endif
+
+    if (size < RAMFS_MIN_SIZE) {
+        size = RAMFS_MIN_SIZE;
+    }
+    if (size > RAMFS_MAX_SIZE) {
+        size = RAMFS_MAX_SIZE;
+    }
+    return (size_t)ALIGN_DOWN(size, RAMFS_BLOCK_SIZE);
+}
+
 /**
  * Initialize RAMFS.
- * Creates RAM disk and formats the filesystem.
+ * Loads the snapshot on the snapshot device if there is one, otherwise
+ * creates the RAM disk and formats the filesystem.
  */
 int ramfs_init(void) {
-    /* Initialize RAM disk (4MB default) */
-    if (ramdisk_init(RAMFS_MAX_BLOCKS * RAMFS_BLOCK_SIZE) < 0) {
+    /* Warm boot: a snapshot image sets the disk size and the contents */
+    blkdev_t* snapshot = ramfs_snapshot_device();
+    if (snapshot && ramfs_snapshot_load(snapshot) == 0) {
+        return 0;
+    }
+
+    if (ramdisk_init(ramfs_disk_size()) < 0) {
         return -1;
     }
 
@@ -261,27 +467,26 @@ int ramfs_init(void) {
 
 /**
  * Get pointer to an inode by number.
+ * Returns NULL for numbers past the table or in a table block that was
+ * never backed (no inode there was ever allocated).
  */
 ramfs_inode_t* ramfs_get_inode(uint32_t inode_num) {
-    if (inode_num >= RAMFS_MAX_FILES) {
+    if (!g_superblock || inode_num >= g_superblock->total_inodes) {
         return NULL;
     }
 
-    /* Calculate which block and offset within block */
-    uint32_t inodes_per_block = RAMFS_BLOCK_SIZE / sizeof(ramfs_inode_t);
-    uint32_t block_num = RAMFS_INODE_START_BLOCK + (inode_num / inodes_per_block);
-    uint32_t offset = inode_num % inodes_per_block;
-
-    ramfs_inode_t* block = (ramfs_inode_t*)ramdisk_get_block_ptr(block_num);
+    ramfs_inode_t* block = (ramfs_inode_t*)ramdisk_get_block_ptr(inode_block(inode_num));
     if (!block) {
         return NULL;
     }
 
-    return &block[offset];
+    return &block[inode_num % RAMFS_INODES_PER_BLOCK];
 }
 
 /**
  * Allocate a new inode.
+ * The inode table block holding it gets a frame the first time one of
+ * its inodes is used.
  * Returns 0 on success, -1 on failure.
  */
 int ramfs_alloc_inode(uint32_t type, uint32_t* inode_num) {
@@ -293,21 +498,22 @@ int ramfs_alloc_inode(uint32_t type, uint32_t* inode_num) {
         return -1;  /* No free inodes */
     }
 
-    /* Find free inode */
-    int free_inode = bitmap_find_free(g_superblock->inode_bitmap, RAMFS_MAX_FILES);
-    if (free_inode < 0) {
+    /* Find and claim a free inode */
+    uint64_t free_inode = bitmap_alloc(inode_bitmap, 0, g_superblock->total_inodes,
+                                       &inode_cursor);
+    if (free_inode == g_superblock->total_inodes) {
         return -1;
     }
-
-    /* Mark inode as used */
-    bitmap_set(g_superblock->inode_bitmap, free_inode);
     g_superblock->free_inodes--;
 
     /* Initialize the inode */
-    ramfs_inode_t* inode = ramfs_get_inode(free_inode);
+    ramfs_inode_t* inode = NULL;
+    if (ramdisk_back_block(inode_block((uint32_t)free_inode)) >= 0) {
+        inode = ramfs_get_inode((uint32_t)free_inode);
+    }
     if (!inode) {
         /* Rollback */
-        bitmap_clear(g_superblock->inode_bitmap, free_inode);
+        bitmap_clear(inode_bitmap, free_inode);
         g_superblock->free_inodes++;
         return -1;
     }
@@ -320,6 +526,7 @@ int ramfs_alloc_inode(uint32_t type, uint32_t* inode_num) {
     inode->modified = inode->created;
     inode->accessed = inode->created;
     inode->link_count = 1;
+    inode->number = (uint32_t)free_inode;
 
     *inode_num = (uint32_t)free_inode;
     RAMFS_DEBUG("Allocated inode %u (type %u)\n", *inode_num, type);
@@ -331,7 +538,7 @@ int ramfs_alloc_inode(uint32_t type, uint32_t* inode_num) {
  * Free an inode.
  */
 void ramfs_free_inode(uint32_t inode_num) {
-    if (!g_superblock || inode_num >= RAMFS_MAX_FILES) {
+    if (!g_superblock || inode_num >= g_superblock->total_inodes) {
         return;
     }
 
@@ -344,18 +551,22 @@ void ramfs_free_inode(uint32_t inode_num) {
         return;
     }
 
+    /* Names cached under a directory must not outlive its inode number */
+    if (inode->type == INODE_TYPE_DIR) {
+        dcache_purge_dir(inode_num);
+    }
+
     /* Free all data blocks */
-    for (int i = 0; i < RAMFS_DIRECT_BLOCKS; i++) {
-        if (inode->blocks[i] != 0) {
-            ramfs_free_block(inode->blocks[i]);
-        }
+    if (inode->type == INODE_TYPE_DIR) {
+        dx_free(inode);
     }
+    ramfs_free_blocks_from(inode, 0);
 
     /* Clear the inode */
     memset(inode, 0, sizeof(ramfs_inode_t));
 
     /* Mark inode as free */
-    bitmap_clear(g_superblock->inode_bitmap, inode_num);
+    bitmap_clear(inode_bitmap, inode_num);
     g_superblock->free_inodes++;
 
     RAMFS_DEBUG("Freed inode %u\n", inode_num);
@@ -367,55 +578,101 @@ void ramfs_free_inode(uint32_t inode_num) {
  */
 
 /**
- * Allocate a data block.
- * Returns 0 on success, -1 on failure.
+ * Mark a run of up to 'count' adjacent free data blocks allocated, without
+ * backing them (see ramfs_alloc_blocks() for 'goal').
+ * Returns the number of blocks taken (0 if the disk is full).
  */
-int ramfs_alloc_block(uint32_t* block_num) {
-    if (!g_superblock || !block_num) {
-        return -1;
+static uint32_t ramfs_take_blocks(uint32_t goal, uint32_t count, uint64_t* start) {
+    if (!g_superblock || count == 0 || g_superblock->free_blocks == 0) {
+        return 0;
     }
 
-    if (g_superblock->free_blocks == 0) {
-        return -1;  /* No free blocks */
+    if (goal >= g_superblock->data_start) {
+        block_cursor = goal;
     }
 
-    /* Find free block (start from data area) */
-    for (uint32_t i = RAMFS_DATA_START_BLOCK; i < g_ramdisk.block_count; i++) {
-        if (!bitmap_test(g_superblock->block_bitmap, i)) {
-            /* Mark block as used */
-            bitmap_set(g_superblock->block_bitmap, i);
-            g_superblock->free_blocks--;
+    uint32_t got = (uint32_t)bitmap_alloc_run(block_bitmap, g_superblock->data_start,
+                                              g_superblock->total_blocks,
+                                              count, &block_cursor, start);
+    g_superblock->free_blocks -= got;
+    return got;
+}
 
-            /* Clear the block */
-            void* block_ptr = ramdisk_get_block_ptr(i);
-            if (block_ptr) {
-                memset(block_ptr, 0, RAMFS_BLOCK_SIZE);
-            }
+/**
+ * Allocate a run of up to 'count' adjacent data blocks.
+ *
+ * The run starts at the first free block at or after 'goal' (0: where the
+ * last allocation ended, next fit) and is as long as the free blocks after it allow.
+ * Each block is backed by a zeroed page frame; if the PMM runs out, the
+ * run is cut short there.
+ * Returns the number of blocks allocated (0 if the disk is full).
+ */
+static uint32_t ramfs_alloc_blocks(uint32_t goal, uint32_t count, uint32_t* first) {
+    uint64_t start;
+    uint32_t got = ramfs_take_blocks(goal, count, &start);
+    if (got == 0) {
+        return 0;
+    }
 
-            *block_num = i;
-            RAMFS_DEBUG("Allocated block %u\n", i);
-            return 0;
+    for (uint32_t i = 0; i < got; i++) {
+        int backed = ramdisk_back_block((uint32_t)start + i);
+        if (backed < 0) {
+            /* Out of page frames: give back the rest of the run */
+            bitmap_clear_range(block_bitmap, start + i, got - i);
+            g_superblock->free_blocks += got - i;
+            got = i;
+            break;
         }
+        if (backed == 0) {
+            /* Kept its frame from earlier use: clear it */
+            memset(ramdisk_get_block_ptr((uint32_t)start + i), 0, RAMFS_BLOCK_SIZE);
+        }
+        block_refs[start + i] = 1;
+    }
+    if (got == 0) {
+        return 0;
     }
 
-    return -1;  /* No free blocks found */
+    *first = (uint32_t)start;
+    RAMFS_DEBUG("Allocated blocks %u-%u\n", *first, *first + got - 1);
+    return got;
+}
+
+/**
+ * Allocate a data block.
+ * Returns 0 on success, -1 on failure.
+ */
+int ramfs_alloc_block(uint32_t* block_num) {
+    return ramfs_alloc_blocks(0, 1, block_num) ? 0 : -1;
 }
 
 /**
- * Free a data block.
+ * Free a data block, or drop one owner of a shared block.
+ * A block that is really freed gives its page frame back to the PMM.
  */
 void ramfs_free_block(uint32_t block_num) {
-    if (!g_superblock || block_num < RAMFS_DATA_START_BLOCK ||
-        block_num >= g_ramdisk.block_count) {
+    if (!g_superblock || block_num < g_superblock->data_start ||
+        block_num >= g_superblock->total_blocks) {
         return;
     }
 
-    if (!bitmap_test(g_superblock->block_bitmap, block_num)) {
+    if (!bitmap_test(block_bitmap, block_num)) {
         return;  /* Already free */
     }
 
-    bitmap_clear(g_superblock->block_bitmap, block_num);
+    if (block_refs[block_num] > 1) {
+        block_refs[block_num]--;
+        return;  /* Still used by another file */
+    }
+    block_refs[block_num] = 0;
+
+    if (block_maps[block_num] > 0) {
+        return;  /* Freed by ramfs_unmap_pages() */
+    }
+
+    bitmap_clear(block_bitmap, block_num);
     g_superblock->free_blocks++;
+    ramdisk_release_block(block_num);
 
     RAMFS_DEBUG("Freed block %u\n", block_num);
 }
@@ -427,6 +684,177 @@ void* ramfs_get_block(uint32_t block_num) {
     return ramdisk_get_block_ptr(block_num);
 }
 
+/**
+ * Give a file its own copy of a shared block before it writes to it.
+ * 'slot' is the file's pointer to the block (see ramfs_block_slot()).
+ * Returns 0 on success, -1 if no block is free.
+ */
+static int ramfs_unshare_block(uint32_t* slot) {
+    uint32_t old_block = *slot;
+    if (block_refs[old_block] <= 1) {
+        return 0;
+    }
+
+    uint32_t new_block;
+    if (ramfs_alloc_block(&new_block) < 0) {
+        return -1;
+    }
+    memcpy(ramfs_get_block(new_block), ramfs_get_block(old_block), RAMFS_BLOCK_SIZE);
+    ramfs_free_block(old_block);
+    *slot = new_block;
+    return 0;
+}
+
+/* =============================================================================
+ * File Block Map
+ * =============================================================================
+ */
+
+_Static_assert(sizeof(ramfs_inode_t) == 128, "inode table layout");
+
+/* Contents of an indirect block, allocating it first if 'create' */
+static uint32_t* ramfs_map_table(uint32_t* table_block, bool create) {
+    if (*table_block == 0 && (!create || ramfs_alloc_block(table_block) < 0)) {
+        return NULL;
+    }
+    return (uint32_t*)ramfs_get_block(*table_block);
+}
+
+/*
+ * Slot holding logical block 'index' of a file: a direct pointer in the
+ * inode or an entry of an indirect block. With 'create', missing
+ * indirect blocks are allocated (zeroed, so each new slot reads 0).
+ * Returns NULL if the slot does not exist and was not created.
+ */
+static uint32_t* ramfs_block_slot(ramfs_inode_t* inode, uint32_t index, bool create) {
+    if (index < RAMFS_INDIRECT_FIRST) {
+        return &inode->blocks[index];
+    }
+    if (index >= RAMFS_MAX_FILE_BLOCKS) {
+        return NULL;
+    }
+
+    uint32_t* table_block;
+    if (index < RAMFS_DINDIRECT_FIRST) {
+        table_block = &inode->indirect;
+        index -= RAMFS_INDIRECT_FIRST;
+    } else {
+        index -= RAMFS_DINDIRECT_FIRST;
+        uint32_t* outer = ramfs_map_table(&inode->double_indirect, create);
+        if (!outer) {
+            return NULL;
+        }
+        table_block = &outer[index / RAMFS_PTRS_PER_BLOCK];
+        index %= RAMFS_PTRS_PER_BLOCK;
+    }
+
+    uint32_t* table = ramfs_map_table(table_block, create);
+    return table ? &table[index] : NULL;
+}
+
+/* Block number of logical block 'index' of a file (0 for a hole) */
+static uint32_t ramfs_file_block(ramfs_inode_t* inode, uint32_t index) {
+    uint32_t* slot = ramfs_block_slot(inode, index, false);
+    return slot ? *slot : 0;
+}
+
+/*
+ * Make logical block 'index' of a file one this file alone can write:
+ * fill a hole with a new block or unshare a shared block. 'want' is how
+ * many blocks from 'index' on the caller is about to use; the holes among
+ * them are filled with one run, placed right after the file's previous
+ * block when that is free.
+ * Returns the block number, or 0 if no block is free.
+ */
+static uint32_t ramfs_prepare_block(ramfs_inode_t* inode, uint32_t index, uint32_t want) {
+    uint32_t* slot = ramfs_block_slot(inode, index, true);
+    if (!slot) {
+        return 0;
+    }
+
+    if (*slot != 0) {
+        return (ramfs_unshare_block(slot) < 0) ? 0 : *slot;
+    }
+
+    uint32_t holes = 1;
+    while (holes < want && index + holes < RAMFS_MAX_FILE_BLOCKS &&
+           ramfs_file_block(inode, index + holes) == 0) {
+        holes++;
+    }
+
+    uint32_t goal = (index > 0) ? ramfs_file_block(inode, index - 1) + 1 : 0;
+    uint32_t first;
+    uint32_t got = ramfs_alloc_blocks(goal, holes, &first);
+    if (got == 0) {
+        return 0;
+    }
+
+    *slot = first;
+    inode->block_count++;
+    for (uint32_t i = 1; i < got; i++) {
+        uint32_t* next = ramfs_block_slot(inode, index + i, true);
+        if (!next) {
+            /* No indirect block: hand back the rest of the run */
+            for (; i < got; i++) {
+                ramfs_free_block(first + i);
+            }
+            break;
+        }
+        *next = first + i;
+        inode->block_count++;
+    }
+    return first;
+}
+
+/*
+ * Free what an indirect block maps from logical entry 'first' on
+ * (depth 1: data blocks, depth 2: indirect blocks of data blocks), and
+ * the indirect block itself when that is everything.
+ */
+static void ramfs_free_table(ramfs_inode_t* inode, uint32_t* table_block,
+                             uint32_t first, uint32_t depth) {
+    if (*table_block == 0) {
+        return;
+    }
+
+    uint32_t* table = (uint32_t*)ramfs_get_block(*table_block);
+    uint32_t span = (depth == 2) ? RAMFS_PTRS_PER_BLOCK : 1;    /* Blocks per entry */
+
+    for (uint32_t i = first / span; i < RAMFS_PTRS_PER_BLOCK; i++) {
+        if (table[i] == 0) {
+            continue;
+        }
+        if (depth == 2) {
+            ramfs_free_table(inode, &table[i], (i == first / span) ? first % span : 0, 1);
+        } else {
+            ramfs_free_block(table[i]);
+            table[i] = 0;
+            inode->block_count--;
+        }
+    }
+
+    if (first == 0) {
+        ramfs_free_block(*table_block);
+        *table_block = 0;
+    }
+}
+
+/* Free every block of a file from logical block 'first' on */
+static void ramfs_free_blocks_from(ramfs_inode_t* inode, uint32_t first) {
+    for (uint32_t i = first; i < RAMFS_DIRECT_BLOCKS; i++) {
+        if (inode->blocks[i] != 0) {
+            ramfs_free_block(inode->blocks[i]);
+            inode->blocks[i] = 0;
+            inode->block_count--;
+        }
+    }
+
+    ramfs_free_table(inode, &inode->indirect,
+                     (first > RAMFS_INDIRECT_FIRST) ? first - RAMFS_INDIRECT_FIRST : 0, 1);
+    ramfs_free_table(inode, &inode->double_indirect,
+                     (first > RAMFS_DINDIRECT_FIRST) ? first - RAMFS_DINDIRECT_FIRST : 0, 2);
+}
+
 /* =============================================================================
  * File Content Operations
  * =============================================================================
@@ -463,28 +891,28 @@ int64_t ramfs_read(ramfs_inode_t* inode, void* buf, size_t count, uint64_t offse
         /* Calculate which block and offset within block */
         uint32_t block_index = (offset + bytes_read) / RAMFS_BLOCK_SIZE;
         uint32_t block_offset = (offset + bytes_read) % RAMFS_BLOCK_SIZE;
-
-        if (block_index >= RAMFS_DIRECT_BLOCKS) {
-            break;  /* Beyond direct blocks */
-        }
-
-        uint32_t block_num = inode->blocks[block_index];
-        if (block_num == 0) {
-            /* Sparse file - return zeros */
-            size_t to_read = min_size(count - bytes_read, RAMFS_BLOCK_SIZE - block_offset);
-            memset(dest + bytes_read, 0, to_read);
-            bytes_read += to_read;
-        } else {
-            /* Read from block */
-            void* block_ptr = ramfs_get_block(block_num);
-            if (!block_ptr) {
+        uint32_t block_num = ramfs_file_block(inode, block_index);
+        uint8_t* base = (block_num != 0) ? (uint8_t*)ramfs_get_block(block_num) : NULL;
+
+        /* Extend the run over holes, or over blocks adjacent in memory */
+        size_t run = min_size(count - bytes_read, RAMFS_BLOCK_SIZE - block_offset);
+        for (uint32_t n = 1; bytes_read + run < count; n++) {
+            uint32_t next = ramfs_file_block(inode, block_index + n);
+            bool joins = base ? (next != 0 && ramfs_get_block(next) == base + n * RAMFS_BLOCK_SIZE)
+                              : (next == 0);
+            if (!joins) {
                 break;
             }
+            run += min_size(count - bytes_read - run, RAMFS_BLOCK_SIZE);
+        }
 
-            size_t to_read = min_size(count - bytes_read, RAMFS_BLOCK_SIZE - block_offset);
-            memcpy(dest + bytes_read, (uint8_t*)block_ptr + block_offset, to_read);
-            bytes_read += to_read;
+        if (base) {
+            memcpy(dest + bytes_read, base + block_offset, run);
+        } else {
+            /* Sparse file - return zeros */
+            memset(dest + bytes_read, 0, run);
         }
+        bytes_read += run;
     }
 
     /* Update access time */
@@ -508,7 +936,7 @@ int64_t ramfs_write(ramfs_inode_t* inode, const void* buf, size_t count, uint64_
     }
 
     /* Check if write would exceed max file size */
-    uint64_t max_size = RAMFS_DIRECT_BLOCKS * RAMFS_BLOCK_SIZE;
+    uint64_t max_size = RAMFS_MAX_FILE_SIZE;
     if (offset > max_size) {
         return -1;  /* Offset beyond max file size */
     }
@@ -525,29 +953,27 @@ int64_t ramfs_write(ramfs_inode_t* inode, const void* buf, size_t count, uint64_
         uint32_t block_index = (offset + bytes_written) / RAMFS_BLOCK_SIZE;
         uint32_t block_offset = (offset + bytes_written) % RAMFS_BLOCK_SIZE;
 
-        if (block_index >= RAMFS_DIRECT_BLOCKS) {
-            break;  /* Beyond direct blocks */
+        /* Allocate (or unshare) the block, and the rest of the write's holes */
+        uint32_t want = (uint32_t)((block_offset + count - bytes_written +
+                                    RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE);
+        uint32_t block_num = ramfs_prepare_block(inode, block_index, want);
+        if (block_num == 0) {
+            break;  /* No more blocks */
         }
-
-        /* Allocate block if needed */
-        if (inode->blocks[block_index] == 0) {
-            uint32_t new_block;
-            if (ramfs_alloc_block(&new_block) < 0) {
-                break;  /* No more blocks */
+        uint8_t* base = (uint8_t*)ramfs_get_block(block_num);
+
+        /* Extend the run over the following blocks while they are adjacent */
+        size_t run = min_size(count - bytes_written, RAMFS_BLOCK_SIZE - block_offset);
+        for (uint32_t n = 1; bytes_written + run < count; n++) {
+            uint32_t next = ramfs_prepare_block(inode, block_index + n, want - n);
+            if (next == 0 || ramfs_get_block(next) != base + n * RAMFS_BLOCK_SIZE) {
+                break;  /* Picked up by the next pass */
             }
-            inode->blocks[block_index] = new_block;
-            inode->block_count++;
-        }
-
-        /* Write to block */
-        void* block_ptr = ramfs_get_block(inode->blocks[block_index]);
-        if (!block_ptr) {
-            break;
+            run += min_size(count - bytes_written - run, RAMFS_BLOCK_SIZE);
         }
 
-        size_t to_write = min_size(count - bytes_written, RAMFS_BLOCK_SIZE - block_offset);
-        memcpy((uint8_t*)block_ptr + block_offset, src + bytes_written, to_write);
-        bytes_written += to_write;
+        memcpy(base + block_offset, src + bytes_written, run);
+        bytes_written += run;
     }
 
     /* Update file size if necessary */
@@ -563,35 +989,415 @@ int64_t ramfs_write(ramfs_inode_t* inode, const void* buf, size_t count, uint64_
 }
 
 /**
- * Truncate a file to a new size.
+ * Append whole page frames to a file as its next blocks, without copying.
+ *
+ * 'frames' is a physically contiguous run of 'count' frames the caller
+ * owns, full of file data; each one that is adopted becomes a data block
+ * of the file (from the end of the file on, which must be block-aligned)
+ * and goes back to the PMM when that block is freed. The file grows by
+ * a block per adopted frame.
+ *
+ * Returns the number of frames adopted, from the first on (fewer if the
+ * disk fills up); the caller keeps the rest.
  */
-int ramfs_truncate(ramfs_inode_t* inode, uint64_t new_size) {
-    if (!inode || inode->type != INODE_TYPE_FILE) {
-        return -1;
+uint32_t ramfs_adopt_pages(ramfs_inode_t* inode, phys_addr_t frames, uint32_t count) {
+    if (!inode || inode->type != INODE_TYPE_FILE || inode->size % RAMFS_BLOCK_SIZE != 0) {
+        return 0;
     }
 
-    uint64_t max_size = RAMFS_DIRECT_BLOCKS * RAMFS_BLOCK_SIZE;
-    if (new_size > max_size) {
-        new_size = max_size;
-    }
+    uint32_t index = (uint32_t)(inode->size / RAMFS_BLOCK_SIZE);
+    uint32_t adopted = 0;
 
-    if (new_size < inode->size) {
-        /* Shrinking - free unused blocks */
-        uint32_t first_free_block = (new_size + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE;
-        for (uint32_t i = first_free_block; i < RAMFS_DIRECT_BLOCKS; i++) {
-            if (inode->blocks[i] != 0) {
-                ramfs_free_block(inode->blocks[i]);
-                inode->blocks[i] = 0;
-                inode->block_count--;
+    while (adopted < count) {
+        /* A run of free blocks, right after the file's last block if it can be */
+        uint32_t goal = (index > 0) ? ramfs_file_block(inode, index - 1) + 1 : 0;
+        uint64_t start;
+        uint32_t got = ramfs_take_blocks(goal, count - adopted, &start);
+        if (got == 0) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < got; i++) {
+            uint32_t block = (uint32_t)start + i;
+            uint32_t* slot = ramfs_block_slot(inode, index, true);
+            if (!slot || *slot != 0) {
+                /* No indirect block: hand back the rest of the run */
+                bitmap_clear_range(block_bitmap, block, got - i);
+                g_superblock->free_blocks += got - i;
+                count = adopted;
+                break;
             }
+
+            /* Swap in the caller's frame for any left over from earlier use */
+            ramdisk_release_block(block);
+            g_ramdisk.frames[block] = (uint32_t)ADDR_TO_PFN(frames + (phys_addr_t)adopted * PAGE_SIZE);
+            g_ramdisk.backed_blocks++;
+            block_refs[block] = 1;
+
+            *slot = block;
+            inode->block_count++;
+            index++;
+            adopted++;
         }
     }
-    /* Note: Growing doesn't allocate blocks until write */
-
-    inode->size = new_size;
-    inode->modified = pit_get_ticks();
 
-    return 0;
+    if (adopted > 0) {
+        inode->size = (uint64_t)index * RAMFS_BLOCK_SIZE;
+        inode->modified = pit_get_ticks();
+        inode->accessed = inode->modified;
+    }
+    return adopted;
+}
+
+/**
+ * Copy a byte range from one file to another.
+ *
+ * Whole blocks at block-aligned offsets in both files are shared (the
+ * destination takes a reference, copy-on-write); the rest is copied
+ * straight from block to block. Both ranges may be in the same file if
+ * they do not overlap.
+ *
+ * Returns number of bytes copied, or negative error code.
+ */
+int64_t ramfs_copy_range(ramfs_inode_t* dst, uint64_t dst_offset,
+                         ramfs_inode_t* src, uint64_t src_offset, size_t count) {
+    if (!dst || !src || dst->type != INODE_TYPE_FILE || src->type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    /* Limit to the source data and the largest destination file */
+    uint64_t max_size = RAMFS_MAX_FILE_SIZE;
+    if (src_offset >= src->size || dst_offset >= max_size) {
+        return 0;
+    }
+    count = min_size(count, src->size - src_offset);
+    count = min_size(count, max_size - dst_offset);
+
+    if (dst == src && src_offset < dst_offset + count && dst_offset < src_offset + count) {
+        return -1;  /* Overlapping ranges */
+    }
+
+    size_t copied = 0;
+    while (copied < count) {
+        uint64_t s = src_offset + copied;
+        uint64_t d = dst_offset + copied;
+        uint32_t s_index = s / RAMFS_BLOCK_SIZE;
+        uint32_t d_index = d / RAMFS_BLOCK_SIZE;
+        uint32_t s_block = ramfs_file_block(src, s_index);
+        uint32_t d_block = ramfs_file_block(dst, d_index);
+        size_t chunk;
+
+        if (s % RAMFS_BLOCK_SIZE == 0 && d % RAMFS_BLOCK_SIZE == 0 &&
+            count - copied >= RAMFS_BLOCK_SIZE &&
+            (s_block == 0 || (block_refs[s_block] < RAMFS_BLOCK_REFS_MAX &&
+                              block_maps[s_block] == 0)) &&
+            block_maps[d_block] == 0) {
+            /* Whole block: share it (a hole stays a hole) */
+            if (d_block != s_block) {
+                uint32_t* d_slot = ramfs_block_slot(dst, d_index, s_block != 0);
+                if (!d_slot) {
+                    break;  /* No indirect block for the destination */
+                }
+                if (s_block != 0) {
+                    block_refs[s_block]++;
+                    dst->block_count += (d_block == 0) ? 1 : 0;
+                } else {
+                    dst->block_count--;
+                }
+                if (d_block != 0) {
+                    ramfs_free_block(d_block);
+                }
+                *d_slot = s_block;
+            }
+            chunk = RAMFS_BLOCK_SIZE;
+        } else {
+            /* Partial block: copy through the ramdisk mapping */
+            chunk = min_size(count - copied, RAMFS_BLOCK_SIZE - s % RAMFS_BLOCK_SIZE);
+            chunk = min_size(chunk, RAMFS_BLOCK_SIZE - d % RAMFS_BLOCK_SIZE);
+
+            if (s_block != 0) {
+                const uint8_t* from = (const uint8_t*)ramfs_get_block(s_block);
+                if (ramfs_write(dst, from + s % RAMFS_BLOCK_SIZE, chunk, d) != (int64_t)chunk) {
+                    break;
+                }
+            } else if (d_block != 0) {
+                /* Hole in the source: zero what the destination has there */
+                uint32_t* d_slot = ramfs_block_slot(dst, d_index, false);
+                if (ramfs_unshare_block(d_slot) < 0) {
+                    break;
+                }
+                memset((uint8_t*)ramfs_get_block(*d_slot) + d % RAMFS_BLOCK_SIZE, 0, chunk);
+            }
+        }
+        copied += chunk;
+    }
+
+    if (dst_offset + copied > dst->size) {
+        dst->size = dst_offset + copied;
+    }
+    dst->modified = pit_get_ticks();
+    dst->accessed = dst->modified;
+
+    return (int64_t)copied;
+}
+
+/**
+ * Prepare a run of file pages for mmap() and pin their blocks.
+ *
+ * Holes are filled with zeroed blocks. For a shared mapping, blocks the
+ * file shares with other files (ramfs_copy_range()) get a private copy
+ * first, so writes through the mapping reach only this file.
+ *
+ * Returns 0 on success (block numbers and frames filled in), or -1.
+ */
+int ramfs_map_pages(ramfs_inode_t* inode, uint32_t first, uint32_t count, bool shared,
+                    uint32_t* blocks, phys_addr_t* frames) {
+    if (!inode || inode->type != INODE_TYPE_FILE || count == 0 ||
+        first >= RAMFS_MAX_FILE_BLOCKS || count > RAMFS_MAX_FILE_BLOCKS - first) {
+        return -1;
+    }
+
+    for (uint32_t i = first; i < first + count; i++) {
+        uint32_t block = ramfs_file_block(inode, i);
+        if (block == 0 || shared) {
+            block = ramfs_prepare_block(inode, i, first + count - i);
+        }
+
+        if (block == 0 || block_maps[block] == RAMFS_BLOCK_MAPS_MAX) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = ramfs_file_block(inode, first + i);
+        block_maps[block]++;
+        blocks[i] = block;
+        frames[i] = ramdisk_get_block_phys(block);
+    }
+
+    return 0;
+}
+
+/**
+ * Add a mapping to blocks pinned by ramfs_map_pages() (fork). Block 0
+ * stands for a page not faulted in yet and is skipped.
+ * Returns 0 on success, -1 if a block has too many mappings.
+ */
+int ramfs_ref_pages(const uint32_t* blocks, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (blocks[i] != 0 && block_maps[blocks[i]] == RAMFS_BLOCK_MAPS_MAX) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (blocks[i] != 0) {
+            block_maps[blocks[i]]++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Drop a mapping of pinned blocks, freeing those no file uses any more.
+ */
+void ramfs_unmap_pages(const uint32_t* blocks, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = blocks[i];
+        if (!g_superblock || block < g_superblock->data_start ||
+            block >= g_superblock->total_blocks || block_maps[block] == 0) {
+            continue;
+        }
+
+        if (--block_maps[block] == 0 && block_refs[block] == 0 &&
+            bitmap_test(block_bitmap, block)) {
+            bitmap_clear(block_bitmap, block);
+            g_superblock->free_blocks++;
+            ramdisk_release_block(block);
+            RAMFS_DEBUG("Freed unmapped block %u\n", block);
+        }
+    }
+}
+
+/**
+ * Truncate a file to a new size.
+ */
+int ramfs_truncate(ramfs_inode_t* inode, uint64_t new_size) {
+    if (!inode || inode->type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    if (new_size > RAMFS_MAX_FILE_SIZE) {
+        new_size = RAMFS_MAX_FILE_SIZE;
+    }
+
+    if (new_size < inode->size) {
+        /* Shrinking - free unused blocks */
+        ramfs_free_blocks_from(inode, (new_size + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE);
+    }
+    /* Note: Growing doesn't allocate blocks until write */
+
+    inode->size = new_size;
+    inode->modified = pit_get_ticks();
+
+    return 0;
+}
+
+/* =============================================================================
+ * Directory Index
+ * =============================================================================
+ */
+
+_Static_assert(sizeof(ramfs_dx_root_t) <= RAMFS_BLOCK_SIZE, "dx root fits a block");
+_Static_assert(sizeof(ramfs_dx_leaf_t) == RAMFS_BLOCK_SIZE, "dx leaf fills a block");
+
+/* FNV-1a hash of a name */
+static uint32_t dx_hash(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static ramfs_dx_root_t* dx_root(ramfs_inode_t* dir) {
+    if (dir->blocks[0] == 0) {
+        return NULL;    /* Nothing was ever added */
+    }
+    return (ramfs_dx_root_t*)ramfs_get_block(dir->blocks[0]);
+}
+
+static ramfs_dx_leaf_t* dx_leaf(ramfs_dx_root_t* root, uint32_t index) {
+    return (ramfs_dx_leaf_t*)ramfs_get_block(root->entries[index].block);
+}
+
+/* Index of the leaf that holds 'hash' (entries[0].hash is always 0) */
+static uint32_t dx_find_leaf(ramfs_dx_root_t* root, uint32_t hash) {
+    uint32_t lo = 0;
+    uint32_t hi = root->count - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (root->entries[mid].hash <= hash) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/* Slot of 'name' in a leaf, or -1 */
+static int dx_leaf_find(ramfs_dx_leaf_t* leaf, const char* name, size_t len) {
+    for (uint32_t i = 0; i < leaf->count; i++) {
+        if (leaf->entries[i].name_len == len &&
+            memcmp(leaf->entries[i].name, name, len) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* Give a directory its index root and first leaf */
+static ramfs_dx_root_t* dx_create(ramfs_inode_t* dir) {
+    uint32_t root_block, leaf_block;
+    if (ramfs_alloc_block(&root_block) < 0) {
+        return NULL;
+    }
+    if (ramfs_alloc_block(&leaf_block) < 0) {
+        ramfs_free_block(root_block);
+        return NULL;
+    }
+
+    /* Blocks come back zeroed: both counts start at 0 */
+    ramfs_dx_root_t* root = (ramfs_dx_root_t*)ramfs_get_block(root_block);
+    root->count = 1;
+    root->entries[0].hash = 0;
+    root->entries[0].block = leaf_block;
+
+    dir->blocks[0] = root_block;
+    dir->block_count = 2;
+    return root;
+}
+
+/*
+ * Split a full leaf at its median hash; names with hashes at or above it
+ * move to a new leaf inserted right after it in the index.
+ * Returns 0 on success, -1 if the index is full, no block is free, or
+ * every name in the leaf has the same hash.
+ */
+static int dx_split(ramfs_inode_t* dir, ramfs_dx_root_t* root, uint32_t index) {
+    if (root->count == RAMFS_DX_MAX_LEAVES) {
+        return -1;
+    }
+
+    ramfs_dx_leaf_t* leaf = dx_leaf(root, index);
+    uint32_t hashes[RAMFS_DX_LEAF_ENTRIES];
+    uint32_t sorted[RAMFS_DX_LEAF_ENTRIES];
+    for (uint32_t i = 0; i < leaf->count; i++) {
+        hashes[i] = dx_hash(leaf->entries[i].name, leaf->entries[i].name_len);
+
+        /* Insertion sort; a leaf is small */
+        uint32_t j = i;
+        while (j > 0 && sorted[j - 1] > hashes[i]) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = hashes[i];
+    }
+
+    /* Keep equal hashes together: the split must be above the lowest */
+    uint32_t median = leaf->count / 2;
+    while (median < leaf->count && sorted[median] == sorted[0]) {
+        median++;
+    }
+    if (median == leaf->count) {
+        return -1;
+    }
+    uint32_t split = sorted[median];
+
+    uint32_t new_block;
+    if (ramfs_alloc_block(&new_block) < 0) {
+        return -1;
+    }
+    ramfs_dx_leaf_t* upper = (ramfs_dx_leaf_t*)ramfs_get_block(new_block);
+
+    for (uint32_t i = 0; i < leaf->count; ) {
+        if (hashes[i] < split) {
+            i++;
+            continue;
+        }
+        upper->entries[upper->count++] = leaf->entries[i];
+        leaf->count--;
+        leaf->entries[i] = leaf->entries[leaf->count];
+        hashes[i] = hashes[leaf->count];
+        memset(&leaf->entries[leaf->count], 0, sizeof(ramfs_dirent_t));
+    }
+
+    memmove(&root->entries[index + 2], &root->entries[index + 1],
+            (root->count - index - 1) * sizeof(ramfs_dx_entry_t));
+    root->entries[index + 1].hash = split;
+    root->entries[index + 1].block = new_block;
+    root->count++;
+    dir->block_count++;
+
+    RAMFS_DEBUG("Split directory leaf %u at hash %x\n", index, split);
+    return 0;
+}
+
+/* Release a directory's index and leaves */
+static void dx_free(ramfs_inode_t* dir) {
+    ramfs_dx_root_t* root = dx_root(dir);
+    if (!root) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < root->count; i++) {
+        ramfs_free_block(root->entries[i].block);
+    }
+    ramfs_free_block(dir->blocks[0]);
+    dir->blocks[0] = 0;
+    dir->block_count = 0;
 }
 
 /* =============================================================================
@@ -625,30 +1431,32 @@ int ramfs_dir_lookup(ramfs_inode_t* dir, const char* name, uint32_t* inode_out)
         return 0;
     }
 
-    /* Search directory entries */
-    uint32_t entries_per_block = RAMFS_BLOCK_SIZE / sizeof(ramfs_dirent_t);
     size_t name_len = strlen(name);
+    uint32_t dir_num = dir->number;
 
-    for (uint32_t i = 0; i < RAMFS_DIRECT_BLOCKS; i++) {
-        if (dir->blocks[i] == 0) {
-            continue;
-        }
-
-        ramfs_dirent_t* entries = (ramfs_dirent_t*)ramfs_get_block(dir->blocks[i]);
-        if (!entries) {
-            continue;
-        }
+    /* Cached answer, positive or negative */
+    switch (dcache_lookup(dir_num, name, name_len, inode_out)) {
+        case DCACHE_HIT:
+            return 0;
+        case DCACHE_NEGATIVE:
+            return -1;
+        default:
+            break;
+    }
 
-        for (uint32_t j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode != 0 && entries[j].name_len == name_len) {
-                if (strncmp(entries[j].name, name, name_len) == 0) {
-                    *inode_out = entries[j].inode;
-                    return 0;
-                }
-            }
+    /* Search the one leaf that can hold the name */
+    ramfs_dx_root_t* root = dx_root(dir);
+    if (root) {
+        ramfs_dx_leaf_t* leaf = dx_leaf(root, dx_find_leaf(root, dx_hash(name, name_len)));
+        int slot = dx_leaf_find(leaf, name, name_len);
+        if (slot >= 0) {
+            *inode_out = leaf->entries[slot].inode;
+            dcache_add(dir_num, name, name_len, *inode_out);
+            return 0;
         }
     }
 
+    dcache_add_negative(dir_num, name, name_len);
     return -1;  /* Not found */
 }
 
@@ -663,7 +1471,7 @@ int ramfs_dir_add_entry(ramfs_inode_t* dir, const char* name, uint32_t inode, ui
     }
 
     size_t name_len = strlen(name);
-    if (name_len == 0 || name_len >= RAMFS_MAX_FILENAME) {
+    if (name_len == 0 || name_len >= sizeof(((ramfs_dirent_t*)0)->name)) {
         return -1;
     }
 
@@ -673,45 +1481,41 @@ int ramfs_dir_add_entry(ramfs_inode_t* dir, const char* name, uint32_t inode, ui
         return -1;  /* Already exists */
     }
 
-    /* Find a free entry slot */
-    uint32_t entries_per_block = RAMFS_BLOCK_SIZE / sizeof(ramfs_dirent_t);
-
-    for (uint32_t i = 0; i < RAMFS_DIRECT_BLOCKS; i++) {
-        /* Allocate block if needed */
-        if (dir->blocks[i] == 0) {
-            uint32_t new_block;
-            if (ramfs_alloc_block(&new_block) < 0) {
-                return -1;
-            }
-            dir->blocks[i] = new_block;
-            dir->block_count++;
+    ramfs_dx_root_t* root = dx_root(dir);
+    if (!root) {
+        root = dx_create(dir);
+        if (!root) {
+            return -1;
         }
+    }
 
-        ramfs_dirent_t* entries = (ramfs_dirent_t*)ramfs_get_block(dir->blocks[i]);
-        if (!entries) {
-            continue;
-        }
+    uint32_t hash = dx_hash(name, name_len);
+    uint32_t index = dx_find_leaf(root, hash);
+    ramfs_dx_leaf_t* leaf = dx_leaf(root, index);
 
-        for (uint32_t j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode == 0) {
-                /* Found free slot */
-                entries[j].inode = inode;
-                entries[j].rec_len = sizeof(ramfs_dirent_t);
-                entries[j].name_len = (uint8_t)name_len;
-                entries[j].type = (uint8_t)type;
-                memcpy(entries[j].name, name, name_len);
-                entries[j].name[name_len] = '\0';
-
-                dir->size += sizeof(ramfs_dirent_t);
-                dir->modified = pit_get_ticks();
-
-                RAMFS_DEBUG("Added entry '%s' -> inode %u\n", name, inode);
-                return 0;
-            }
+    if (leaf->count == RAMFS_DX_LEAF_ENTRIES) {
+        if (dx_split(dir, root, index) < 0) {
+            return -1;  /* Directory full */
         }
+        index = dx_find_leaf(root, hash);
+        leaf = dx_leaf(root, index);
     }
 
-    return -1;  /* No free entry slots */
+    ramfs_dirent_t* entry = &leaf->entries[leaf->count++];
+    entry->inode = inode;
+    entry->rec_len = sizeof(ramfs_dirent_t);
+    entry->name_len = (uint8_t)name_len;
+    entry->type = (uint8_t)type;
+    memcpy(entry->name, name, name_len);
+    entry->name[name_len] = '\0';
+
+    dir->size += sizeof(ramfs_dirent_t);
+    dir->modified = pit_get_ticks();
+
+    dcache_add(dir->number, name, name_len, inode);
+
+    RAMFS_DEBUG("Added entry '%s' -> inode %u\n", name, inode);
+    return 0;
 }
 
 /**
@@ -724,40 +1528,49 @@ int ramfs_dir_remove_entry(ramfs_inode_t* dir, const char* name) {
         return -1;
     }
 
+    ramfs_dx_root_t* root = dx_root(dir);
+    if (!root) {
+        return -1;
+    }
+
     size_t name_len = strlen(name);
-    uint32_t entries_per_block = RAMFS_BLOCK_SIZE / sizeof(ramfs_dirent_t);
+    uint32_t index = dx_find_leaf(root, dx_hash(name, name_len));
+    ramfs_dx_leaf_t* leaf = dx_leaf(root, index);
+    int slot = dx_leaf_find(leaf, name, name_len);
+    if (slot < 0) {
+        return -1;  /* Not found */
+    }
 
-    for (uint32_t i = 0; i < RAMFS_DIRECT_BLOCKS; i++) {
-        if (dir->blocks[i] == 0) {
-            continue;
-        }
+    /* Keep the leaf packed: the last entry fills the hole */
+    leaf->count--;
+    leaf->entries[slot] = leaf->entries[leaf->count];
+    memset(&leaf->entries[leaf->count], 0, sizeof(ramfs_dirent_t));
 
-        ramfs_dirent_t* entries = (ramfs_dirent_t*)ramfs_get_block(dir->blocks[i]);
-        if (!entries) {
-            continue;
-        }
+    /* Drop an empty leaf; its hash range joins the previous leaf's */
+    if (leaf->count == 0 && root->count > 1) {
+        ramfs_free_block(root->entries[index].block);
+        memmove(&root->entries[index], &root->entries[index + 1],
+                (root->count - index - 1) * sizeof(ramfs_dx_entry_t));
+        root->count--;
+        root->entries[0].hash = 0;
+        dir->block_count--;
+    }
 
-        for (uint32_t j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode != 0 && entries[j].name_len == name_len) {
-                if (strncmp(entries[j].name, name, name_len) == 0) {
-                    /* Clear the entry */
-                    memset(&entries[j], 0, sizeof(ramfs_dirent_t));
-                    dir->size -= sizeof(ramfs_dirent_t);
-                    dir->modified = pit_get_ticks();
+    dir->size -= sizeof(ramfs_dirent_t);
+    dir->modified = pit_get_ticks();
 
-                    RAMFS_DEBUG("Removed entry '%s'\n", name);
-                    return 0;
-                }
-            }
-        }
-    }
+    dcache_add_negative(dir->number, name, name_len);
 
-    return -1;  /* Not found */
+    RAMFS_DEBUG("Removed entry '%s'\n", name);
+    return 0;
 }
 
 /**
  * Read a directory entry by index.
  *
+ * Entries come in index order (by hash), which is stable while the
+ * directory does not change.
+ *
  * Returns 0 on success, -1 if index out of range or error.
  */
 int ramfs_dir_read_entry(ramfs_inode_t* dir, uint32_t index, ramfs_dirent_t* entry) {
@@ -765,28 +1578,18 @@ int ramfs_dir_read_entry(ramfs_inode_t* dir, uint32_t index, ramfs_dirent_t* ent
         return -1;
     }
 
-    uint32_t entries_per_block = RAMFS_BLOCK_SIZE / sizeof(ramfs_dirent_t);
-    uint32_t current_index = 0;
-
-    for (uint32_t i = 0; i < RAMFS_DIRECT_BLOCKS; i++) {
-        if (dir->blocks[i] == 0) {
-            continue;
-        }
-
-        ramfs_dirent_t* entries = (ramfs_dirent_t*)ramfs_get_block(dir->blocks[i]);
-        if (!entries) {
-            continue;
-        }
+    ramfs_dx_root_t* root = dx_root(dir);
+    if (!root) {
+        return -1;
+    }
 
-        for (uint32_t j = 0; j < entries_per_block; j++) {
-            if (entries[j].inode != 0) {
-                if (current_index == index) {
-                    memcpy(entry, &entries[j], sizeof(ramfs_dirent_t));
-                    return 0;
-                }
-                current_index++;
-            }
+    for (uint32_t i = 0; i < root->count; i++) {
+        ramfs_dx_leaf_t* leaf = dx_leaf(root, i);
+        if (index < leaf->count) {
+            memcpy(entry, &leaf->entries[index], sizeof(ramfs_dirent_t));
+            return 0;
         }
+        index -= leaf->count;
     }
 
     return -1;  /* Index out of range */
@@ -1040,3 +1843,487 @@ int ramfs_create_dir(const char* path, uint32_t* inode_out) {
     *inode_out = new_inode;
     return 0;
 }
+
+/* =============================================================================
+ * Snapshot Image
+ * =============================================================================
+ */
+
+_Static_assert(sizeof(ramfs_image_header_t) == RAMFS_BLOCK_SIZE, "image header fills a block");
+_Static_assert(RAMFS_BLOCK_SIZE == BCACHE_BLOCK_SIZE, "image blocks are cache blocks");
+
+/* Sectors per block, and the most frames backed at once on load (1MB) */
+#define RAMFS_IMAGE_SECTORS     (RAMFS_BLOCK_SIZE / BLKDEV_SECTOR_SIZE)
+#define RAMFS_IMAGE_RUN_MAX     256
+
+/* Image blocks read ahead at a time on load: one cluster request each */
+#define RAMFS_IMAGE_RA_BLOCKS   (BCACHE_CLUSTERS * BCACHE_CLUSTER_BLOCKS)
+
+/**
+ * Find the disk that holds (or will hold) the snapshot.
+ * Returns the first of RAMFS_SNAPSHOT_DEVICES that exists, or NULL.
+ */
+blkdev_t* ramfs_snapshot_device(void) {
+    static const char* const names[] = RAMFS_SNAPSHOT_DEVICES;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        blkdev_t* dev = blkdev_find(names[i]);
+        if (dev) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+/* First sector of an image block */
+static uint64_t image_lba(uint64_t image_block) {
+    return image_block * RAMFS_IMAGE_SECTORS;
+}
+
+/* Whether a disk block goes into the image */
+static bool snapshot_saves(uint32_t block) {
+    if (block < g_superblock->inode_table_start) {
+        return true;                                    /* Superblock, bitmaps */
+    }
+    if (block < g_superblock->data_start) {
+        return ramdisk_get_block_ptr(block) != NULL;    /* Inode table in use */
+    }
+    return block_refs[block] > 0;                       /* Owned by a file */
+}
+
+/* Start a new extent here? (the metadata blocks are an extent of their own) */
+static bool snapshot_starts_extent(uint32_t block, bool prev_saved) {
+    return !prev_saved || block == g_superblock->inode_table_start;
+}
+
+/*
+ * A snapshot between ramfs_snapshot_take() and ramfs_snapshot_drop().
+ * File data blocks are only ever changed after ramfs_unshare_block(), so
+ * the snapshot holds those with an owner reference of its own and a write
+ * meanwhile copies them first; every other saved block (metadata,
+ * directories, indirect blocks, blocks a user mapping may write) is
+ * copied when the snapshot is taken.
+ */
+struct ramfs_snapshot {
+    blkdev_t*               dev;
+    ramfs_image_header_t*   header;         /* Final header (written last) */
+    uint8_t*                table;          /* Extents and owner counts */
+    const uint8_t**         data;           /* Contents of each saved block, in image order */
+    uint8_t*                copies;         /* Blocks copied by ramfs_snapshot_take() */
+    uint32_t                copy_count;
+};
+
+/* One snapshot at a time */
+static bool snapshot_active = false;
+
+/*
+ * Mark the file data blocks a snapshot can hold instead of copying: inside
+ * the file size, not mapped by any process, and able to take one more owner.
+ */
+static void snapshot_mark_held(uint64_t* held) {
+    uint32_t total = g_superblock->total_inodes;
+    for (uint64_t i = bitmap_find_one(inode_bitmap, 0, total); i < total;
+         i = bitmap_find_one(inode_bitmap, i + 1, total)) {
+        ramfs_inode_t* inode = ramfs_get_inode((uint32_t)i);
+        if (!inode || inode->type != INODE_TYPE_FILE) {
+            continue;
+        }
+
+        uint32_t count = blocks_for(inode->size);
+        for (uint32_t b = 0; b < count; b++) {
+            uint32_t block = ramfs_file_block(inode, b);
+            if (block != 0 && block_maps[block] == 0 &&
+                block_refs[block] < RAMFS_BLOCK_REFS_MAX) {
+                bitmap_set(held, block);
+            }
+        }
+    }
+}
+
+/* Whether a block's contents are one of the snapshot's copies */
+static bool snapshot_copied(const ramfs_snapshot_t* snap, const uint8_t* data) {
+    return data >= snap->copies &&
+           data < snap->copies + (size_t)snap->copy_count * RAMFS_BLOCK_SIZE;
+}
+
+static void snapshot_free(ramfs_snapshot_t* snap) {
+    kfree(snap->header);
+    kfree(snap->table);
+    kfree(snap->data);
+    kfree(snap->copies);
+    kfree(snap);
+}
+
+/**
+ * Take a snapshot of the filesystem for ramfs_snapshot_write().
+ * The caller holds the VFS lock, so the snapshot is consistent; the cost
+ * under the lock is copying the metadata and directories, not the I/O.
+ * Returns the snapshot, or NULL (no memory, device too small, or another
+ * snapshot still being written).
+ */
+ramfs_snapshot_t* ramfs_snapshot_take(blkdev_t* dev) {
+    if (!g_superblock || !dev || snapshot_active) {
+        return NULL;
+    }
+    uint32_t total_blocks = g_superblock->total_blocks;
+
+    uint64_t* held = (uint64_t*)kzalloc(BITMAP_WORDS(total_blocks) * sizeof(uint64_t));
+    if (!held) {
+        return NULL;
+    }
+    snapshot_mark_held(held);
+
+    /* Size the extent table and the copies */
+    uint32_t extent_count = 0;
+    uint32_t saved = 0;
+    uint32_t copies = 0;
+    bool prev = false;
+    for (uint32_t b = 0; b < total_blocks; b++) {
+        bool save = snapshot_saves(b);
+        if (save) {
+            extent_count += snapshot_starts_extent(b, prev);
+            saved++;
+            copies += !bitmap_test(held, b);
+        }
+        prev = save;
+    }
+
+    uint32_t table_blocks = blocks_for((uint64_t)extent_count * sizeof(ramfs_image_extent_t) +
+                                       saved);
+    if (image_lba(1 + (uint64_t)table_blocks + saved) > dev->sector_count) {
+        kprintf("[RAMFS] Error: %s is too small for a %u-block snapshot\n",
+                dev->name, 1 + table_blocks + saved);
+        kfree(held);
+        return NULL;
+    }
+
+    ramfs_snapshot_t* snap = (ramfs_snapshot_t*)kzalloc(sizeof(ramfs_snapshot_t));
+    if (snap) {
+        snap->dev = dev;
+        snap->header = (ramfs_image_header_t*)kzalloc(sizeof(ramfs_image_header_t));
+        snap->table = (uint8_t*)kzalloc((size_t)table_blocks * RAMFS_BLOCK_SIZE);
+        snap->data = (const uint8_t**)kmalloc((size_t)saved * sizeof(const uint8_t*));
+        snap->copies = (uint8_t*)kmalloc((size_t)copies * RAMFS_BLOCK_SIZE);
+        snap->copy_count = copies;
+    }
+    if (!snap || !snap->header || !snap->table || !snap->data || !snap->copies) {
+        if (snap) {
+            snapshot_free(snap);
+        }
+        kfree(held);
+        return NULL;
+    }
+
+    /* Fill in the extents and owner counts; copy or hold each saved block */
+    ramfs_image_extent_t* extents = (ramfs_image_extent_t*)snap->table;
+    uint8_t* refs = snap->table + (size_t)extent_count * sizeof(ramfs_image_extent_t);
+    uint8_t* copy = snap->copies;
+    uint32_t e = 0;
+    uint32_t i = 0;
+    prev = false;
+    for (uint32_t b = 0; b < total_blocks; b++) {
+        bool save = snapshot_saves(b);
+        if (save) {
+            if (snapshot_starts_extent(b, prev)) {
+                extents[e].first = b;
+                extents[e].count = 0;
+                e++;
+            }
+            extents[e - 1].count++;
+            *refs++ = block_refs[b];
+
+            if (bitmap_test(held, b)) {
+                block_refs[b]++;
+                snap->data[i++] = (const uint8_t*)ramdisk_get_block_ptr(b);
+            } else {
+                memcpy(copy, ramdisk_get_block_ptr(b), RAMFS_BLOCK_SIZE);
+                snap->data[i++] = copy;
+                copy += RAMFS_BLOCK_SIZE;
+            }
+        }
+        prev = save;
+    }
+    kfree(held);
+
+    ramfs_image_header_t* header = snap->header;
+    header->magic = RAMFS_IMAGE_MAGIC;
+    header->version = RAMFS_IMAGE_VERSION;
+    header->total_blocks = total_blocks;
+    header->extent_count = extent_count;
+    header->saved_blocks = saved;
+    header->table_blocks = table_blocks;
+    header->checksum = dx_hash((const char*)snap->table, (size_t)table_blocks * RAMFS_BLOCK_SIZE);
+    header->saved_time = pit_get_ticks();
+
+    snapshot_active = true;
+    return snap;
+}
+
+/* Put one image block into the cache, to be written by the next bcache_sync() */
+static int image_put(blkdev_t* dev, uint64_t image_block, const void* data) {
+    buf_t* buf = bcache_getblk(dev, image_block);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf->data, data, RAMFS_BLOCK_SIZE);
+    bcache_mark_dirty(buf);
+    bcache_release(buf);
+    return 0;
+}
+
+/* Copy one image block out of the cache */
+static int image_get(blkdev_t* dev, uint64_t image_block, void* data) {
+    buf_t* buf = bcache_read(dev, image_block);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(data, buf->data, RAMFS_BLOCK_SIZE);
+    bcache_release(buf);
+    return 0;
+}
+
+/**
+ * Write a snapshot to its device through the buffer cache, without the
+ * VFS lock (interrupts on, so the driver sleeps for each request instead
+ * of polling). The cache writes adjacent blocks back as one request.
+ *
+ * A zeroed header goes first and the real one last, each on its own
+ * bcache_sync(): until it replaces the zeroed one, the device holds no
+ * valid image, so a save that dies halfway is never loaded.
+ * Returns 0 on success, -1 on failure (the device then holds no image).
+ */
+int ramfs_snapshot_write(ramfs_snapshot_t* snap) {
+    blkdev_t* dev = snap->dev;
+    const ramfs_image_header_t* header = snap->header;
+
+    ramfs_image_header_t* zero_header = (ramfs_image_header_t*)kzalloc(sizeof(ramfs_image_header_t));
+    int result = (zero_header && image_put(dev, 0, zero_header) == 0 &&
+                  bcache_sync(dev) == 0) ? 0 : -1;
+    kfree(zero_header);
+
+    for (uint32_t i = 0; result == 0 && i < header->table_blocks; i++) {
+        result = image_put(dev, 1 + i, snap->table + (size_t)i * RAMFS_BLOCK_SIZE);
+    }
+
+    uint64_t next = 1 + header->table_blocks;
+    for (uint32_t i = 0; result == 0 && i < header->saved_blocks; i++) {
+        result = image_put(dev, next + i, snap->data[i]);
+    }
+
+    if (result == 0 &&
+        (bcache_sync(dev) < 0 || image_put(dev, 0, header) < 0 || bcache_sync(dev) < 0)) {
+        result = -1;
+    }
+
+    if (result < 0) {
+        kprintf("[RAMFS] Error: Snapshot to %s failed\n", dev->name);
+        return -1;
+    }
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[RAMFS] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("Snapshot saved to %s: %u blocks in %u extents (%u KB)\n",
+            dev->name, header->saved_blocks, header->extent_count,
+            header->saved_blocks * (RAMFS_BLOCK_SIZE / 1024));
+    return 0;
+}
+
+/**
+ * Let go of a snapshot: give back the blocks it held (freeing those the
+ * files let go of meanwhile) and its copies. The caller holds the VFS lock.
+ */
+void ramfs_snapshot_drop(ramfs_snapshot_t* snap) {
+    const ramfs_image_extent_t* extents = (const ramfs_image_extent_t*)snap->table;
+    uint32_t i = 0;
+
+    for (uint32_t e = 0; e < snap->header->extent_count; e++) {
+        uint32_t end = extents[e].first + extents[e].count;
+        for (uint32_t b = extents[e].first; b < end; b++, i++) {
+            if (!snapshot_copied(snap, snap->data[i])) {
+                ramfs_free_block(b);
+            }
+        }
+    }
+
+    snapshot_free(snap);
+    snapshot_active = false;
+}
+
+/* Check an extent table: ascending, in range, metadata first, 'saved' blocks */
+static bool snapshot_extents_ok(const ramfs_image_header_t* header,
+                                const ramfs_image_extent_t* extents,
+                                const ramfs_layout_t* layout) {
+    if (extents[0].first != 0 || extents[0].count != layout->inode_table_start) {
+        return false;
+    }
+
+    uint64_t end = 0;
+    uint64_t total = 0;
+    for (uint32_t e = 0; e < header->extent_count; e++) {
+        if (extents[e].count == 0 || extents[e].first < end ||
+            (uint64_t)extents[e].first + extents[e].count > header->total_blocks) {
+            return false;
+        }
+        end = (uint64_t)extents[e].first + extents[e].count;
+        total += extents[e].count;
+    }
+    return total == header->saved_blocks;
+}
+
+/*
+ * Read every extent into freshly backed frames through the cache, which
+ * reads ahead RAMFS_IMAGE_RA_BLOCKS at a time a window before they are needed
+ */
+static int snapshot_read(blkdev_t* dev, const ramfs_image_header_t* header,
+                         const uint8_t* table, const ramfs_layout_t* layout) {
+    const ramfs_image_extent_t* extents = (const ramfs_image_extent_t*)table;
+    const uint8_t* refs = table + (size_t)header->extent_count * sizeof(ramfs_image_extent_t);
+    uint64_t next = 1 + header->table_blocks;
+    uint64_t image_end = next + header->saved_blocks;
+    uint64_t ra_next = next;
+    bool contiguous = true;
+
+    for (uint32_t e = 0; e < header->extent_count; e++) {
+        uint32_t end = extents[e].first + extents[e].count;
+        for (uint32_t b = extents[e].first; b < end; ) {
+            /* Back a run of frames at once; block by block once memory is fragmented */
+            uint32_t n = end - b;
+            if (n > RAMFS_IMAGE_RUN_MAX) {
+                n = RAMFS_IMAGE_RUN_MAX;
+            }
+            if (n > 1 && (!contiguous || ramdisk_back_range(b, n) < 0)) {
+                if (e == 0) {
+                    return -1;  /* The bitmaps must be contiguous */
+                }
+                contiguous = false;
+                n = 1;
+            }
+            if (n == 1 && ramdisk_back_block(b) < 0) {
+                return -1;
+            }
+
+            for (uint32_t i = 0; i < n; i++, refs++) {
+                while (ra_next < image_end && ra_next < next + i + 2 * RAMFS_IMAGE_RA_BLOCKS) {
+                    uint32_t count = (uint32_t)MIN((uint64_t)RAMFS_IMAGE_RA_BLOCKS,
+                                                   image_end - ra_next);
+                    bcache_readahead(dev, ra_next, count);
+                    ra_next += count;
+                }
+                if (image_get(dev, next + i, ramdisk_get_block_ptr(b + i)) < 0) {
+                    return -1;
+                }
+                if (b + i >= layout->data_start) {
+                    block_refs[b + i] = *refs;
+                }
+            }
+            next += n;
+            b += n;
+        }
+    }
+
+    /* The superblock must describe the same layout */
+    ramfs_superblock_t* sb = (ramfs_superblock_t*)ramdisk_get_block_ptr(RAMFS_SUPERBLOCK_BLOCK);
+    if (sb->magic != RAMFS_MAGIC || sb->version != RAMFS_VERSION ||
+        sb->total_blocks != header->total_blocks ||
+        sb->total_inodes != layout->total_inodes ||
+        sb->inode_table_start != layout->inode_table_start ||
+        sb->data_start != layout->data_start) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Load the filesystem from a snapshot image instead of formatting.
+ * The RAM disk is created with the imaged size if it does not exist yet.
+ * Returns 0 on success, -1 if there is no usable image (nothing is kept).
+ */
+int ramfs_snapshot_load(blkdev_t* dev) {
+    if (!dev || g_superblock) {
+        return -1;
+    }
+
+    ramfs_image_header_t* header = (ramfs_image_header_t*)kmalloc(sizeof(ramfs_image_header_t));
+    if (!header) {
+        return -1;
+    }
+    uint64_t start = pit_get_ticks();
+
+    ramfs_layout_t layout;
+    if (image_get(dev, 0, header) < 0 ||
+        header->magic != RAMFS_IMAGE_MAGIC || header->version != RAMFS_IMAGE_VERSION ||
+        header->total_blocks < RAMFS_MIN_SIZE / RAMFS_BLOCK_SIZE ||
+        header->total_blocks > RAMFS_MAX_SIZE / RAMFS_BLOCK_SIZE ||
+        ramfs_compute_layout(header->total_blocks, &layout) < 0 ||
+        header->extent_count == 0 || header->saved_blocks > header->total_blocks ||
+        header->table_blocks != blocks_for((uint64_t)header->extent_count *
+                                           sizeof(ramfs_image_extent_t) +
+                                           header->saved_blocks)) {
+        kfree(header);
+        return -1;     /* No image */
+    }
+
+    if (g_ramdisk.initialized ? g_ramdisk.block_count != header->total_blocks
+                              : ramdisk_init((size_t)header->total_blocks * RAMFS_BLOCK_SIZE) < 0) {
+        kfree(header);
+        return -1;
+    }
+
+    uint8_t* table = (uint8_t*)kmalloc((size_t)header->table_blocks * RAMFS_BLOCK_SIZE);
+    int result = table ? 0 : -1;
+    if (table) {
+        bcache_readahead(dev, 1, MIN(header->table_blocks, (uint32_t)RAMFS_IMAGE_RA_BLOCKS));
+    }
+    for (uint32_t i = 0; result == 0 && i < header->table_blocks; i++) {
+        result = image_get(dev, 1 + i, table + (size_t)i * RAMFS_BLOCK_SIZE);
+    }
+    if (result == 0 &&
+        dx_hash((const char*)table, (size_t)header->table_blocks * RAMFS_BLOCK_SIZE) ==
+            header->checksum &&
+        snapshot_extents_ok(header, (const ramfs_image_extent_t*)table, &layout) &&
+        ramfs_alloc_counts(header->total_blocks) == 0) {
+        result = snapshot_read(dev, header, table, &layout);
+    } else {
+        result = -1;
+    }
+    uint32_t saved = header->saved_blocks;
+    kfree(table);
+    kfree(header);
+
+    if (result < 0) {
+        /* Leave a clean disk for ramfs_format() */
+        for (uint32_t b = 0; b < g_ramdisk.block_count; b++) {
+            ramdisk_release_block(b);
+        }
+        kprintf("[RAMFS] Snapshot on %s is damaged, ignoring it\n", dev->name);
+        return -1;
+    }
+
+    g_superblock = (ramfs_superblock_t*)ramdisk_get_block_ptr(RAMFS_SUPERBLOCK_BLOCK);
+    block_bitmap = (uint64_t*)ramdisk_get_block_ptr(g_superblock->block_bitmap_start);
+    inode_bitmap = (uint64_t*)ramdisk_get_block_ptr(g_superblock->inode_bitmap_start);
+
+    /* Blocks only a user mapping still held when the image was taken are free now */
+    uint32_t total = g_superblock->total_blocks;
+    for (uint64_t b = bitmap_find_one(block_bitmap, g_superblock->data_start, total);
+         b < total; b = bitmap_find_one(block_bitmap, b + 1, total)) {
+        if (block_refs[b] == 0) {
+            bitmap_clear(block_bitmap, b);
+            g_superblock->free_blocks++;
+            ramdisk_release_block((uint32_t)b);
+        }
+    }
+
+    block_cursor = g_superblock->data_start;
+    inode_cursor = 0;
+    dcache_init();
+    g_superblock->mount_time = pit_get_ticks();
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[RAMFS] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("Snapshot restored from %s: %u blocks (%u KB) in %u ms\n",
+            dev->name, saved, saved * (RAMFS_BLOCK_SIZE / 1024),
+            (uint32_t)((g_superblock->mount_time - start) * PIT_MS_PER_TICK));
+    return 0;
+}
@@ -3,28 +3,50 @@
  * Chanux OS - Virtual Filesystem Layer
  * =============================================================================
  * Provides a unified interface for filesystem operations.
- * Currently supports RAMFS only.
+ * RAMFS is the root filesystem; others (procfs) are mounted on one of its
+ * directories with vfs_mount().
  * =============================================================================
  */
 
 #include "fs/vfs.h"
 #include "fs/ramfs.h"
 #include "fs/file.h"
+#include "drivers/blkdev.h"
 #include "mm/heap.h"
+#include "mm/slab.h"
 #include "kernel.h"
 #include "string.h"
+#include "spinlock.h"
+#include "trace.h"
 #include "drivers/vga/vga.h"
 
-/* Maximum number of vnodes */
-#define MAX_VNODES  256
+/* Vnode hash chains, keyed by inode number (power of two) */
+#define VNODE_HASH_BUCKETS  64
+
+/* Filesystems mounted on RAMFS directories */
+#define VFS_MAX_MOUNTS      4
+
+typedef struct {
+    char        path[VFS_MAX_PATH];     /* Normalized mount point */
+    size_t      path_len;
+    uint32_t    covered;                /* RAMFS inode of the mount point */
+    vnode_t*    root;                   /* Root of the mounted filesystem */
+} vfs_mount_t;
 
 /* Global root vnode */
 vnode_t* g_root_vnode = NULL;
 
-/* Vnode table */
-static vnode_t vnode_table[MAX_VNODES];
+/* Live vnodes come from a slab cache and are found through the hash */
+static kmem_cache_t* vnode_cache = NULL;
+static vnode_t* vnode_hash[VNODE_HASH_BUCKETS];
+static uint32_t vnode_live = 0;
 static bool vfs_initialized = false;
 
+static vfs_mount_t vfs_mounts[VFS_MAX_MOUNTS];
+static uint32_t vfs_mount_count = 0;
+
+static spinlock_t vfs_spinlock = SPINLOCK_INIT;
+
 /* Forward declarations for RAMFS VFS ops */
 static int64_t ramfs_vfs_read(vnode_t* vn, void* buf, size_t count, uint64_t offset);
 static int64_t ramfs_vfs_write(vnode_t* vn, const void* buf, size_t count, uint64_t offset);
@@ -34,6 +56,12 @@ static int ramfs_vfs_unlink(vnode_t* dir, const char* name);
 static int ramfs_vfs_readdir(vnode_t* dir, uint32_t index, ramfs_dirent_t* entry);
 static int ramfs_vfs_stat(vnode_t* vn, stat_t* buf);
 static int ramfs_vfs_truncate(vnode_t* vn, uint64_t size);
+static int64_t ramfs_vfs_copy_range(vnode_t* dst, uint64_t dst_offset,
+                                    vnode_t* src, uint64_t src_offset, size_t count);
+static int ramfs_vfs_map_pages(vnode_t* vn, uint32_t first, uint32_t count, bool shared,
+                               uint32_t* pages, phys_addr_t* frames);
+static int ramfs_vfs_ref_pages(vnode_t* vn, const uint32_t* pages, uint32_t count);
+static void ramfs_vfs_unmap_pages(vnode_t* vn, const uint32_t* pages, uint32_t count);
 
 /* RAMFS VFS operations */
 static vfs_ops_t ramfs_vfs_ops = {
@@ -45,13 +73,51 @@ static vfs_ops_t ramfs_vfs_ops = {
     .readdir = ramfs_vfs_readdir,
     .stat = ramfs_vfs_stat,
     .truncate = ramfs_vfs_truncate,
+    .copy_range = ramfs_vfs_copy_range,
+    .map_pages = ramfs_vfs_map_pages,
+    .ref_pages = ramfs_vfs_ref_pages,
+    .unmap_pages = ramfs_vfs_unmap_pages,
 };
 
+/* =============================================================================
+ * Locking
+ * =============================================================================
+ */
+
+uint64_t vfs_lock(void) {
+    return spin_lock_irqsave(&vfs_spinlock);
+}
+
+void vfs_unlock(uint64_t flags) {
+    spin_unlock_irqrestore(&vfs_spinlock, flags);
+}
+
 /* =============================================================================
  * Vnode Management
  * =============================================================================
  */
 
+static vnode_t** vnode_hash_bucket(uint32_t inode_num) {
+    return &vnode_hash[inode_num & (VNODE_HASH_BUCKETS - 1)];
+}
+
+static void vnode_hash_insert(vnode_t* vn) {
+    vnode_t** bucket = vnode_hash_bucket(vn->inode_num);
+    vn->hash_next = *bucket;
+    *bucket = vn;
+}
+
+static void vnode_hash_remove(vnode_t* vn) {
+    vnode_t** link = vnode_hash_bucket(vn->inode_num);
+    while (*link && *link != vn) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = vn->hash_next;
+    }
+    vn->hash_next = NULL;
+}
+
 /**
  * Initialize the VFS.
  */
@@ -60,11 +126,11 @@ void vfs_init(void) {
         return;
     }
 
-    /* Clear vnode table */
-    for (int i = 0; i < MAX_VNODES; i++) {
-        vnode_table[i].ref_count = 0;
-        vnode_table[i].inode = NULL;
+    vnode_cache = kmem_cache_create("vnode", sizeof(vnode_t), 0);
+    if (!vnode_cache) {
+        PANIC("Failed to create vnode cache");
     }
+    memset(vnode_hash, 0, sizeof(vnode_hash));
 
     /* Initialize RAMFS */
     if (ramfs_init() < 0) {
@@ -83,6 +149,7 @@ void vfs_init(void) {
     g_root_vnode->inode = ramfs_get_inode(RAMFS_ROOT_INODE);
     g_root_vnode->ops = &ramfs_vfs_ops;
     g_root_vnode->fs_data = NULL;
+    vnode_hash_insert(g_root_vnode);
 
     vfs_initialized = true;
 
@@ -94,21 +161,25 @@ void vfs_init(void) {
 
 /**
  * Allocate a vnode.
+ *
+ * The vnode is not hashed; vnode_get_or_create() publishes it once it is
+ * bound to an inode.
  */
 vnode_t* vnode_alloc(void) {
-    for (int i = 0; i < MAX_VNODES; i++) {
-        if (vnode_table[i].ref_count == 0) {
-            vnode_t* vn = &vnode_table[i];
-            vn->ref_count = 1;
-            vn->inode_num = 0;
-            vn->type = 0;
-            vn->inode = NULL;
-            vn->ops = NULL;
-            vn->fs_data = NULL;
-            return vn;
-        }
+    vnode_t* vn = kmem_cache_alloc(vnode_cache);
+    if (!vn) {
+        return NULL;
     }
-    return NULL;
+
+    vnode_live++;
+    vn->ref_count = 1;
+    vn->inode_num = 0;
+    vn->type = 0;
+    vn->inode = NULL;
+    vn->ops = NULL;
+    vn->fs_data = NULL;
+    vn->hash_next = NULL;
+    return vn;
 }
 
 /**
@@ -120,9 +191,14 @@ void vnode_free(vnode_t* vn) {
     /* Don't free root vnode */
     if (vn == g_root_vnode) return;
 
-    vn->ref_count = 0;
-    vn->inode = NULL;
-    vn->ops = NULL;
+    if (vn->inode) {
+        vnode_hash_remove(vn);
+    }
+    if (vn->ops && vn->ops->release) {
+        vn->ops->release(vn);
+    }
+    vnode_live--;
+    kmem_cache_free(vnode_cache, vn);
 }
 
 /**
@@ -156,10 +232,10 @@ void vnode_unref(vnode_t* vn) {
  */
 static vnode_t* vnode_get_or_create(uint32_t inode_num) {
     /* Check if vnode already exists for this inode */
-    for (int i = 0; i < MAX_VNODES; i++) {
-        if (vnode_table[i].ref_count > 0 && vnode_table[i].inode_num == inode_num) {
-            vnode_ref(&vnode_table[i]);
-            return &vnode_table[i];
+    for (vnode_t* vn = *vnode_hash_bucket(inode_num); vn; vn = vn->hash_next) {
+        if (vn->inode_num == inode_num) {
+            vnode_ref(vn);
+            return vn;
         }
     }
 
@@ -179,10 +255,173 @@ static vnode_t* vnode_get_or_create(uint32_t inode_num) {
     vn->type = inode->type;
     vn->inode = inode;
     vn->ops = &ramfs_vfs_ops;
+    vnode_hash_insert(vn);
+
+    return vn;
+}
+
+/**
+ * Count live vnodes and measure the hash chains.
+ */
+void vfs_vnode_stats(vfs_vnode_stats_t* stats) {
+    memset(stats, 0, sizeof(vfs_vnode_stats_t));
+    stats->live = vnode_live;
+    stats->buckets = VNODE_HASH_BUCKETS;
+
+    for (uint32_t i = 0; i < VNODE_HASH_BUCKETS; i++) {
+        uint32_t chain = 0;
+        for (vnode_t* vn = vnode_hash[i]; vn; vn = vn->hash_next) {
+            chain++;
+        }
+        stats->hashed += chain;
+        stats->longest_chain = MAX(stats->longest_chain, chain);
+    }
+}
+
+/* =============================================================================
+ * Mount Points
+ * =============================================================================
+ */
+
+/**
+ * Find the mount a normalized path lies in. 'rest' is set to what follows
+ * the mount point ("" for the mount point itself).
+ */
+static vfs_mount_t* vfs_find_mount(const char* path, const char** rest) {
+    for (uint32_t i = 0; i < vfs_mount_count; i++) {
+        vfs_mount_t* mnt = &vfs_mounts[i];
+        if (strncmp(path, mnt->path, mnt->path_len) == 0 &&
+            (path[mnt->path_len] == '\0' || path[mnt->path_len] == '/')) {
+            *rest = path + mnt->path_len;
+            return mnt;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Mount a filesystem on an existing RAMFS directory.
+ *
+ * The VFS keeps the reference to 'root'; lookups at or below 'path' are
+ * handed to root->ops from then on. Mounts cannot be stacked or undone.
+ * Returns 0 on success, -1 on error.
+ */
+int vfs_mount(const char* path, vnode_t* root) {
+    if (!path || !root || !root->ops || !root->ops->lookup || root->type != INODE_TYPE_DIR) {
+        return -1;
+    }
+    if (vfs_mount_count >= VFS_MAX_MOUNTS) {
+        return -1;
+    }
+
+    char normalized[VFS_MAX_PATH];
+    if (path_normalize(path, "/", normalized, sizeof(normalized)) < 0 ||
+        strcmp(normalized, "/") == 0) {
+        return -1;
+    }
 
+    /* The mount point must be a directory, and not inside another mount */
+    const char* rest;
+    if (vfs_find_mount(normalized, &rest)) {
+        return -1;
+    }
+    uint32_t inode_num;
+    ramfs_inode_t* inode;
+    if (ramfs_lookup_path(normalized, &inode_num) < 0 ||
+        !(inode = ramfs_get_inode(inode_num)) || inode->type != INODE_TYPE_DIR) {
+        return -1;
+    }
+
+    vfs_mount_t* mnt = &vfs_mounts[vfs_mount_count++];
+    mnt->path_len = strlen(normalized);
+    memcpy(mnt->path, normalized, mnt->path_len + 1);
+    mnt->covered = inode_num;
+    mnt->root = root;
+    return 0;
+}
+
+/**
+ * If 'vn' is a RAMFS directory with a filesystem mounted on it, trade the
+ * reference for one on the mounted root.
+ */
+static vnode_t* vfs_cross_mount(vnode_t* vn) {
+    if (vn->ops != &ramfs_vfs_ops) {
+        return vn;
+    }
+    for (uint32_t i = 0; i < vfs_mount_count; i++) {
+        if (vfs_mounts[i].covered == vn->inode_num) {
+            vnode_unref(vn);
+            vnode_ref(vfs_mounts[i].root);
+            return vfs_mounts[i].root;
+        }
+    }
+    return vn;
+}
+
+/**
+ * If 'vn' is a mounted filesystem's root, trade the reference for one on
+ * the RAMFS directory it is mounted on, where ".." is then looked up.
+ */
+static vnode_t* vfs_uncross_mount(vnode_t* vn) {
+    for (uint32_t i = 0; i < vfs_mount_count; i++) {
+        if (vfs_mounts[i].root == vn) {
+            vnode_unref(vn);
+            return vnode_get_or_create(vfs_mounts[i].covered);
+        }
+    }
     return vn;
 }
 
+/**
+ * Walk the components of 'rest' down from 'start', one lookup each.
+ * "." is skipped and ".." goes to the parent, leaving mounted filesystems
+ * by the directory they cover.
+ */
+static int vfs_walk(vnode_t* start, const char* rest, vnode_t** result) {
+    vnode_t* vn = start;
+    vnode_ref(vn);
+
+    while (*rest) {
+        while (*rest == '/') {
+            rest++;
+        }
+        size_t len = 0;
+        while (rest[len] && rest[len] != '/') {
+            len++;
+        }
+        if (len == 0) {
+            break;
+        }
+
+        char name[RAMFS_MAX_FILENAME];
+        vnode_t* next = NULL;
+        if (len >= sizeof(name) || vn->type != INODE_TYPE_DIR || !vn->ops->lookup) {
+            vnode_unref(vn);
+            return -1;
+        }
+        memcpy(name, rest, len);
+        name[len] = '\0';
+        rest += len;
+
+        if (strcmp(name, ".") == 0) {
+            continue;
+        }
+        if (strcmp(name, "..") == 0 && !(vn = vfs_uncross_mount(vn))) {
+            return -1;
+        }
+
+        int ret = vn->ops->lookup(vn, name, &next);
+        vnode_unref(vn);
+        if (ret < 0 || !next) {
+            return -1;
+        }
+        vn = vfs_cross_mount(next);
+    }
+
+    *result = vn;
+    return 0;
+}
+
 /* =============================================================================
  * Path Resolution
  * =============================================================================
@@ -191,7 +430,8 @@ static vnode_t* vnode_get_or_create(uint32_t inode_num) {
 /**
  * Look up a path and return the vnode.
  *
- * Path can be absolute or relative (relative to root for now).
+ * Path can be absolute or relative (relative to root; see vfs_lookup_at()).
+ * Paths at or below a mount point are resolved by the mounted filesystem.
  * Returns 0 on success, -1 on error.
  */
 int vfs_lookup(const char* path, vnode_t** result) {
@@ -205,6 +445,12 @@ int vfs_lookup(const char* path, vnode_t** result) {
         return -1;
     }
 
+    const char* rest;
+    vfs_mount_t* mnt = vfs_find_mount(normalized, &rest);
+    if (mnt) {
+        return vfs_walk(mnt->root, rest, result);
+    }
+
     /* Look up in RAMFS */
     uint32_t inode_num;
     if (ramfs_lookup_path(normalized, &inode_num) < 0) {
@@ -257,17 +503,75 @@ int vfs_lookup_parent(const char* path, vnode_t** parent, char* name, size_t nam
     return vfs_lookup(parent_path, parent);
 }
 
-/* =============================================================================
- * File Operations
- * =============================================================================
+/**
+ * Look up a path relative to 'dir'.
+ *
+ * Returns 0 on success, -1 on error.
  */
+int vfs_lookup_at(vnode_t* dir, const char* path, vnode_t** result) {
+    if (!path || !result || !vfs_initialized) {
+        return -1;
+    }
+    if (path[0] == '/' || !dir) {
+        return vfs_lookup(path, result);
+    }
+    if (strlen(path) >= VFS_MAX_PATH) {
+        return -1;
+    }
+
+    return vfs_walk(dir, path, result);
+}
 
 /**
- * Open a file.
+ * Look up the parent directory of a path relative to 'dir'.
  *
+ * The last component is copied to 'name'; it cannot be "." or "..".
  * Returns 0 on success, -1 on error.
  */
-int vfs_open(const char* path, uint32_t flags, file_t** result) {
+int vfs_lookup_parent_at(vnode_t* dir, const char* path, vnode_t** parent,
+                         char* name, size_t name_size) {
+    if (!path || !parent || !name || name_size == 0 || !vfs_initialized) {
+        return -1;
+    }
+    if (path[0] == '/' || !dir) {
+        return vfs_lookup_parent(path, parent, name, name_size);
+    }
+
+    size_t end = strlen(path);
+    if (end >= VFS_MAX_PATH) {
+        return -1;
+    }
+    while (end > 0 && path[end - 1] == '/') {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+
+    size_t name_len = end - start;
+    if (name_len == 0 || name_len >= name_size) {
+        return -1;
+    }
+    memcpy(name, path + start, name_len);
+    name[name_len] = '\0';
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
+    }
+
+    char dir_path[VFS_MAX_PATH];
+    memcpy(dir_path, path, start);
+    dir_path[start] = '\0';
+    return vfs_walk(dir, dir_path, parent);
+}
+
+/* =============================================================================
+ * File Operations
+ * =============================================================================
+ */
+
+/* vfs_open() without the tracepoints */
+static int vfs_open_file(vnode_t* dir, const char* path, uint32_t flags, file_t** result) {
     if (!path || !result) {
         return -1;
     }
@@ -276,13 +580,13 @@ int vfs_open(const char* path, uint32_t flags, file_t** result) {
     bool created = false;
 
     /* Try to look up the file */
-    if (vfs_lookup(path, &vn) < 0) {
+    if (vfs_lookup_at(dir, path, &vn) < 0) {
         /* File doesn't exist */
         if (flags & O_CREAT) {
             /* Create the file */
             vnode_t* parent;
             char name[RAMFS_MAX_FILENAME];
-            if (vfs_lookup_parent(path, &parent, name, sizeof(name)) < 0) {
+            if (vfs_lookup_parent_at(dir, path, &parent, name, sizeof(name)) < 0) {
                 return -1;
             }
 
@@ -324,7 +628,7 @@ int vfs_open(const char* path, uint32_t flags, file_t** result) {
     }
 
     file->flags = flags;
-    file->offset = (flags & O_APPEND) ? vn->inode->size : 0;
+    file->offset = ((flags & O_APPEND) && vn->inode) ? vn->inode->size : 0;
     file->inode = vn->inode_num;
     file->type = (vn->type == INODE_TYPE_DIR) ? FILE_TYPE_DIR : FILE_TYPE_REGULAR;
     file->vnode = vn;
@@ -333,6 +637,27 @@ int vfs_open(const char* path, uint32_t flags, file_t** result) {
     return 0;
 }
 
+/**
+ * Open a file.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int vfs_open(const char* path, uint32_t flags, file_t** result) {
+    return vfs_open_at(NULL, path, flags, result);
+}
+
+/**
+ * Open a file by a path relative to 'dir'.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int vfs_open_at(vnode_t* dir, const char* path, uint32_t flags, file_t** result) {
+    TRACE(TRACE_VFS, TRACE_EV_VFS_OPEN, TRACE_BEGIN, flags, 0);
+    int ret = vfs_open_file(dir, path, flags, result);
+    TRACE(TRACE_VFS, TRACE_EV_VFS_OPEN, TRACE_END, (int64_t)ret, ret == 0 ? (*result)->inode : 0);
+    return ret;
+}
+
 /**
  * Close a file.
  */
@@ -347,11 +672,12 @@ int vfs_close(file_t* file) {
 }
 
 /**
- * Read from a file.
+ * Read from a file at an explicit offset.
+ * The file offset is neither used nor changed.
  *
  * Returns number of bytes read, or negative error code.
  */
-int64_t vfs_read(file_t* file, void* buf, size_t count) {
+int64_t vfs_pread(file_t* file, void* buf, size_t count, uint64_t offset) {
     if (!file || !buf) {
         return -1;
     }
@@ -364,20 +690,19 @@ int64_t vfs_read(file_t* file, void* buf, size_t count) {
         return -1;
     }
 
-    int64_t bytes = file->vnode->ops->read(file->vnode, buf, count, file->offset);
-    if (bytes > 0) {
-        file->offset += bytes;
-    }
-
+    TRACE(TRACE_VFS, TRACE_EV_VFS_READ, TRACE_BEGIN, count, offset);
+    int64_t bytes = file->vnode->ops->read(file->vnode, buf, count, offset);
+    TRACE(TRACE_VFS, TRACE_EV_VFS_READ, TRACE_END, bytes, file->inode);
     return bytes;
 }
 
 /**
- * Write to a file.
+ * Write to a file at an explicit offset.
+ * The file offset is neither used nor changed, and O_APPEND is ignored.
  *
  * Returns number of bytes written, or negative error code.
  */
-int64_t vfs_write(file_t* file, const void* buf, size_t count) {
+int64_t vfs_pwrite(file_t* file, const void* buf, size_t count, uint64_t offset) {
     if (!file || !buf) {
         return -1;
     }
@@ -390,12 +715,124 @@ int64_t vfs_write(file_t* file, const void* buf, size_t count) {
         return -1;
     }
 
+    TRACE(TRACE_VFS, TRACE_EV_VFS_WRITE, TRACE_BEGIN, count, offset);
+    int64_t bytes = file->vnode->ops->write(file->vnode, buf, count, offset);
+    TRACE(TRACE_VFS, TRACE_EV_VFS_WRITE, TRACE_END, bytes, file->inode);
+    return bytes;
+}
+
+/**
+ * Copy a byte range between two open files, without a trip through
+ * user space. Neither file offset is used or changed.
+ *
+ * Uses the filesystem's copy_range operation when both files live on
+ * it, and a small kernel buffer otherwise.
+ *
+ * Returns number of bytes copied, or negative error code.
+ */
+int64_t vfs_copy_range(file_t* in, uint64_t in_offset,
+                       file_t* out, uint64_t out_offset, size_t count) {
+    if (!in || !out || !in->vnode || !out->vnode) {
+        return -1;
+    }
+    if ((in->flags & O_ACCMODE) == O_WRONLY || (out->flags & O_ACCMODE) == O_RDONLY) {
+        return -1;
+    }
+
+    vfs_ops_t* ops = in->vnode->ops;
+    if (ops && ops == out->vnode->ops && ops->copy_range) {
+        return ops->copy_range(out->vnode, out_offset, in->vnode, in_offset, count);
+    }
+
+    uint8_t buf[256];
+    size_t copied = 0;
+    while (copied < count) {
+        size_t chunk = MIN(count - copied, sizeof(buf));
+        int64_t n = vfs_pread(in, buf, chunk, in_offset + copied);
+        int64_t w = (n > 0) ? vfs_pwrite(out, buf, (size_t)n, out_offset + copied) : n;
+        if (w < 0) {
+            return copied > 0 ? (int64_t)copied : w;
+        }
+        copied += (size_t)w;
+        if (w < (int64_t)chunk) {
+            break;          /* End of input or out of space */
+        }
+    }
+    return (int64_t)copied;
+}
+
+/**
+ * Pin 'count' pages of a file, starting at file page 'first', for mmap().
+ * 'frames' receives the page frames to map and 'pages' the ids to pass to
+ * vfs_ref_pages()/vfs_unmap_pages() later. The caller holds a reference
+ * to the vnode for as long as the pages stay pinned.
+ *
+ * Returns 0 on success, or negative error code.
+ */
+int vfs_map_pages(vnode_t* vn, uint32_t first, uint32_t count, bool shared,
+                  uint32_t* pages, phys_addr_t* frames) {
+    if (!vn || vn->type != INODE_TYPE_FILE || !vn->ops || !vn->ops->map_pages) {
+        return -1;
+    }
+    return vn->ops->map_pages(vn, first, count, shared, pages, frames);
+}
+
+/**
+ * Pin already mapped pages once more (the mapping was copied by fork()).
+ * Ids of 0 (pages never faulted in) are skipped.
+ *
+ * Returns 0 on success, or negative error code.
+ */
+int vfs_ref_pages(vnode_t* vn, const uint32_t* pages, uint32_t count) {
+    if (!vn || !vn->ops || !vn->ops->ref_pages) {
+        return -1;
+    }
+    return vn->ops->ref_pages(vn, pages, count);
+}
+
+/**
+ * Unpin pages pinned by vfs_map_pages() or vfs_ref_pages().
+ */
+void vfs_unmap_pages(vnode_t* vn, const uint32_t* pages, uint32_t count) {
+    if (vn && vn->ops && vn->ops->unmap_pages) {
+        vn->ops->unmap_pages(vn, pages, count);
+    }
+}
+
+/**
+ * Read from a file.
+ *
+ * Returns number of bytes read, or negative error code.
+ */
+int64_t vfs_read(file_t* file, void* buf, size_t count) {
+    if (!file) {
+        return -1;
+    }
+
+    int64_t bytes = vfs_pread(file, buf, count, file->offset);
+    if (bytes > 0) {
+        file->offset += bytes;
+    }
+
+    return bytes;
+}
+
+/**
+ * Write to a file.
+ *
+ * Returns number of bytes written, or negative error code.
+ */
+int64_t vfs_write(file_t* file, const void* buf, size_t count) {
+    if (!file) {
+        return -1;
+    }
+
     /* Handle O_APPEND */
-    if (file->flags & O_APPEND) {
+    if ((file->flags & O_APPEND) && file->vnode && file->vnode->inode) {
         file->offset = file->vnode->inode->size;
     }
 
-    int64_t bytes = file->vnode->ops->write(file->vnode, buf, count, file->offset);
+    int64_t bytes = vfs_pwrite(file, buf, count, file->offset);
     if (bytes > 0) {
         file->offset += bytes;
     }
@@ -413,8 +850,8 @@ int64_t vfs_lseek(file_t* file, int64_t offset, int whence) {
         return -1;
     }
 
-    if (file->type == FILE_TYPE_CONSOLE) {
-        return -1;  /* Can't seek console */
+    if (file->type == FILE_TYPE_CONSOLE || file->type == FILE_TYPE_PIPE) {
+        return -1;  /* Can't seek console or pipe */
     }
 
     int64_t new_offset;
@@ -453,12 +890,19 @@ int64_t vfs_lseek(file_t* file, int64_t offset, int whence) {
  * Get file status by path.
  */
 int vfs_stat(const char* path, stat_t* buf) {
+    return vfs_stat_at(NULL, path, buf);
+}
+
+/**
+ * Get file status by a path relative to 'dir'.
+ */
+int vfs_stat_at(vnode_t* dir, const char* path, stat_t* buf) {
     if (!path || !buf) {
         return -1;
     }
 
     vnode_t* vn;
-    if (vfs_lookup(path, &vn) < 0) {
+    if (vfs_lookup_at(dir, path, &vn) < 0) {
         return -1;
     }
 
@@ -585,6 +1029,14 @@ int vfs_unlink(const char* path) {
         return -1;
     }
 
+    /* A mount point stays while something is mounted on it */
+    char normalized[VFS_MAX_PATH];
+    const char* rest;
+    if (path_normalize(path, "/", normalized, sizeof(normalized)) < 0 ||
+        (vfs_find_mount(normalized, &rest) && *rest == '\0')) {
+        return -1;
+    }
+
     vnode_t* parent;
     char name[RAMFS_MAX_FILENAME];
 
@@ -601,6 +1053,34 @@ int vfs_unlink(const char* path) {
     return ret;
 }
 
+/**
+ * Save the filesystem to its snapshot device.
+ *
+ * Called without the VFS lock: it is held to take the snapshot and to
+ * drop it, not across the disk writes in between.
+ * Returns 0 on success, -1 on failure.
+ */
+int vfs_sync(void) {
+    blkdev_t* dev = ramfs_snapshot_device();
+    if (!dev) {
+        return -1;
+    }
+
+    uint64_t irq = vfs_lock();
+    ramfs_snapshot_t* snap = ramfs_snapshot_take(dev);
+    vfs_unlock(irq);
+    if (!snap) {
+        return -1;
+    }
+
+    int result = ramfs_snapshot_write(snap);
+
+    irq = vfs_lock();
+    ramfs_snapshot_drop(snap);
+    vfs_unlock(irq);
+    return result;
+}
+
 /* =============================================================================
  * RAMFS VFS Operations Implementation
  * =============================================================================
@@ -750,3 +1230,29 @@ static int ramfs_vfs_truncate(vnode_t* vn, uint64_t size) {
     }
     return ramfs_truncate(vn->inode, size);
 }
+
+static int64_t ramfs_vfs_copy_range(vnode_t* dst, uint64_t dst_offset,
+                                    vnode_t* src, uint64_t src_offset, size_t count) {
+    if (!dst || !dst->inode || !src || !src->inode) {
+        return -1;
+    }
+    return ramfs_copy_range(dst->inode, dst_offset, src->inode, src_offset, count);
+}
+
+static int ramfs_vfs_map_pages(vnode_t* vn, uint32_t first, uint32_t count, bool shared,
+                               uint32_t* pages, phys_addr_t* frames) {
+    if (!vn || !vn->inode) {
+        return -1;
+    }
+    return ramfs_map_pages(vn->inode, first, count, shared, pages, frames);
+}
+
+static int ramfs_vfs_ref_pages(vnode_t* vn, const uint32_t* pages, uint32_t count) {
+    (void)vn;
+    return ramfs_ref_pages(pages, count);
+}
+
+static void ramfs_vfs_unmap_pages(vnode_t* vn, const uint32_t* pages, uint32_t count) {
+    (void)vn;
+    ramfs_unmap_pages(pages, count);
+}
@@ -0,0 +1,218 @@
+/**
+ * =============================================================================
+ * Chanux OS - ACPI Table Discovery
+ * =============================================================================
+ * Finds the RSDP in the BIOS areas, walks the RSDT/XSDT and parses the MADT
+ * ("APIC" table) for the processors and interrupt controllers in the system.
+ *
+ * Only what SMP bring-up and interrupt routing need is kept:
+ *   - Local APIC IDs of the enabled processors (type 0)
+ *   - I/O APICs (type 1) and ISA interrupt source overrides (type 2)
+ *   - The local APIC address, including a 64-bit override (type 5)
+ *
+ * The SRAT and SLIT, when present, give the NUMA layout: which node each
+ * processor and memory range belongs to, and how far the nodes are from
+ * each other. Proximity domains are renumbered as nodes 0, 1, ... in the
+ * order the SRAT first mentions them.
+ *
+ * Tables may sit above the direct map, so they are reached through
+ * vmm_map_mmio() mappings that stay in place after boot.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_ACPI_H
+#define CHANUX_ACPI_H
+
+#include "types.h"
+
+/* =============================================================================
+ * Configuration
+ * =============================================================================
+ */
+
+#define ACPI_MAX_CPUS           16      /* Must cover SMP_MAX_CPUS */
+#define ACPI_MAX_IOAPICS        4
+#define ACPI_MAX_OVERRIDES      16
+#define ACPI_MAX_NODES          4       /* Further domains are folded into node 0 */
+#define ACPI_MAX_MEM_RANGES     16
+
+/* Where firmware is allowed to put the RSDP */
+#define ACPI_EBDA_PTR           0x40E   /* BDA word holding the EBDA segment */
+#define ACPI_BIOS_START         0xE0000
+#define ACPI_BIOS_END           0x100000
+
+/* =============================================================================
+ * ACPI Table Layouts
+ * =============================================================================
+ */
+
+/* Root System Description Pointer (ACPI 2.0+ fields after rsdt_address) */
+typedef struct {
+    char     signature[8];          /* "RSD PTR " */
+    uint8_t  checksum;              /* Covers the first 20 bytes */
+    char     oem_id[6];
+    uint8_t  revision;              /* 0 = ACPI 1.0, 2 = ACPI 2.0+ */
+    uint32_t rsdt_address;
+    uint32_t length;                /* Whole structure (2.0+) */
+    uint64_t xsdt_address;          /* 2.0+ */
+    uint8_t  ext_checksum;          /* Covers the whole structure */
+    uint8_t  reserved[3];
+} PACKED acpi_rsdp_t;
+
+/* Common header of every system description table */
+typedef struct {
+    char     signature[4];
+    uint32_t length;                /* Including this header */
+    uint8_t  revision;
+    uint8_t  checksum;              /* All bytes sum to zero */
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED acpi_sdt_header_t;
+
+/* Multiple APIC Description Table */
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;         /* 32-bit local APIC base */
+    uint32_t flags;                 /* Bit 0: dual 8259 PICs present */
+} PACKED acpi_madt_t;
+
+/* MADT entry header */
+typedef struct {
+    uint8_t  type;
+    uint8_t  length;
+} PACKED acpi_madt_entry_t;
+
+#define ACPI_MADT_LAPIC             0
+#define ACPI_MADT_IOAPIC            1
+#define ACPI_MADT_OVERRIDE          2
+#define ACPI_MADT_LAPIC_OVERRIDE    5
+
+#define ACPI_MADT_LAPIC_ENABLED     0x01
+#define ACPI_MADT_LAPIC_ONLINE_CAP  0x02
+
+/* System Resource Affinity Table; entries use the MADT entry header */
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t table_revision;
+    uint64_t reserved;
+} PACKED acpi_srat_t;
+
+#define ACPI_SRAT_LAPIC             0
+#define ACPI_SRAT_MEMORY            1
+#define ACPI_SRAT_X2APIC            2
+
+#define ACPI_SRAT_ENABLED           0x01
+
+/* System Locality Information Table: a count, then count x count distances */
+typedef struct {
+    acpi_sdt_header_t header;
+    uint64_t locality_count;
+} PACKED acpi_slit_t;
+
+#define ACPI_SLIT_LOCAL             10      /* Distance of a node to itself */
+#define ACPI_SLIT_REMOTE            20      /* Assumed without a SLIT */
+
+/* =============================================================================
+ * Parsed MADT Information
+ * =============================================================================
+ */
+
+typedef struct {
+    uint8_t     id;                 /* I/O APIC ID */
+    uint32_t    phys;               /* MMIO base */
+    uint32_t    gsi_base;           /* First global system interrupt */
+} acpi_ioapic_t;
+
+typedef struct {
+    uint8_t     source;             /* ISA IRQ */
+    uint32_t    gsi;                /* Global system interrupt it is wired to */
+    uint16_t    flags;              /* MPS INTI polarity/trigger flags */
+} acpi_override_t;
+
+typedef struct {
+    bool            found;                          /* A MADT was parsed */
+    phys_addr_t     lapic_phys;                     /* Local APIC MMIO base */
+    bool            has_8259;                       /* Legacy PICs present */
+
+    uint32_t        cpu_count;                      /* Enabled processors */
+    uint8_t         cpu_apic_ids[ACPI_MAX_CPUS];    /* Their local APIC IDs */
+
+    uint32_t        ioapic_count;
+    acpi_ioapic_t   ioapics[ACPI_MAX_IOAPICS];
+
+    uint32_t        override_count;
+    acpi_override_t overrides[ACPI_MAX_OVERRIDES];
+} acpi_madt_info_t;
+
+/* =============================================================================
+ * Parsed NUMA Information
+ * =============================================================================
+ */
+
+typedef struct {
+    phys_addr_t     base;
+    uint64_t        length;
+    uint32_t        node;
+} acpi_mem_range_t;
+
+typedef struct {
+    bool                found;                      /* A SRAT was parsed */
+    uint32_t            node_count;                 /* 1 without a SRAT */
+    uint32_t            domains[ACPI_MAX_NODES];    /* Proximity domain of each node */
+    uint8_t             distance[ACPI_MAX_NODES][ACPI_MAX_NODES];
+
+    uint32_t            cpu_count;
+    uint8_t             cpu_apic_ids[ACPI_MAX_CPUS];
+    uint8_t             cpu_nodes[ACPI_MAX_CPUS];
+
+    uint32_t            mem_count;
+    acpi_mem_range_t    mem[ACPI_MAX_MEM_RANGES];
+} acpi_numa_info_t;
+
+/* =============================================================================
+ * ACPI API
+ * =============================================================================
+ */
+
+/**
+ * Locate the ACPI tables and parse the MADT
+ * Must be called after vmm_init().
+ *
+ * @return 0 on success, -1 if no usable RSDP or MADT was found
+ */
+int acpi_init(void);
+
+/**
+ * Get the parsed MADT
+ *
+ * @return MADT information (found is false if acpi_init() failed)
+ */
+const acpi_madt_info_t* acpi_madt(void);
+
+/**
+ * Get the parsed SRAT and SLIT
+ *
+ * @return NUMA information (a single node if there is no SRAT)
+ */
+const acpi_numa_info_t* acpi_numa(void);
+
+/**
+ * Get the NUMA node of a processor
+ *
+ * @param apic_id Local APIC ID
+ * @return Node, 0 if the SRAT does not list the processor
+ */
+uint32_t acpi_cpu_node(uint32_t apic_id);
+
+/**
+ * Find a system description table by signature
+ *
+ * @param signature Four-character table signature (e.g. "APIC")
+ * @return Mapped table, or NULL if not present
+ */
+const acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+#endif /* CHANUX_ACPI_H */
@@ -0,0 +1,47 @@
+/**
+ * =============================================================================
+ * Chanux OS - Microbenchmarks
+ * =============================================================================
+ * The suite `make bench` runs: a kernel built with KERNEL_BENCH boots into
+ * a "bench" process instead of the demos and the shell. It times the
+ * allocators, the page table code, RAMFS, path lookup and memcpy/memset
+ * with RDTSC, then runs /bin/bench (user/bench/bench.c) for the costs only
+ * user space sees: the syscall round trip and context switches. When that
+ * exits, it powers QEMU off through the isa-debug-exit device.
+ *
+ * Every result is one line on the console (and so the serial port):
+ *
+ *   BENCH <name> iters=<n> cycles=<per op> ns=<per op>[ mbps=<MB/s>]
+ *
+ * Each benchmark runs BENCH_RUNS times and reports its fastest run, which
+ * keeps timer interrupts and other noise out of the numbers. The run is
+ * framed by "BENCH-INFO ..." (TSC rate, CPUs) and "BENCH-END" lines;
+ * scripts/benchcmp.c compares two result files.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_BENCH_H
+#define CHANUX_BENCH_H
+
+#include "types.h"
+
+/* Where the user half of the suite lives (shipped by make BENCH=1) */
+#define BENCH_USER_PATH         "/bin/bench"
+
+/* Timed runs per benchmark; the fastest one counts */
+#define BENCH_RUNS              5
+
+/* QEMU's isa-debug-exit device: writing v exits QEMU with (v << 1) | 1 */
+#define BENCH_DEBUG_EXIT_PORT   0xF4
+#define BENCH_EXIT_OK           0
+#define BENCH_EXIT_FAILED       1
+
+/**
+ * Create the benchmark process. It starts once the scheduler runs.
+ *
+ * @param user_prog ELF image of /bin/bench (NULL: kernel benchmarks only)
+ * @param user_size Size of the image in bytes
+ */
+void bench_start(const void* user_prog, size_t user_size);
+
+#endif /* CHANUX_BENCH_H */
@@ -0,0 +1,89 @@
+/**
+ * =============================================================================
+ * Chanux OS - Bitmap Utilities Header
+ * =============================================================================
+ * Allocation bitmaps stored as arrays of 64-bit words: bit n lives in
+ * word n / 64 at position n % 64 (on x86 this is also the byte order of a
+ * uint8_t bitmap, so the layout is the same as one byte per 8 bits).
+ *
+ * Searches look at a whole word per step and pick the bit with one
+ * count-trailing-zeros, so scanning a mostly full map costs one load per
+ * 64 entries instead of one test per entry.
+ *
+ * The allocators keep a caller-owned next-fit cursor: a search starts
+ * where the previous allocation ended and wraps around once, so repeated
+ * allocations do not rescan the allocated prefix of the map.
+ *
+ * None of this locks; callers serialize access to their own bitmaps.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_BITMAP_H
+#define CHANUX_BITMAP_H
+
+#include "types.h"
+
+#define BITMAP_WORD_BITS        64
+#define BITMAP_WORDS(bits)      (((bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+/* =============================================================================
+ * Single Bits
+ * =============================================================================
+ */
+
+static inline void bitmap_set(uint64_t* map, uint64_t bit) {
+    map[bit / BITMAP_WORD_BITS] |= 1ULL << (bit % BITMAP_WORD_BITS);
+}
+
+static inline void bitmap_clear(uint64_t* map, uint64_t bit) {
+    map[bit / BITMAP_WORD_BITS] &= ~(1ULL << (bit % BITMAP_WORD_BITS));
+}
+
+static inline bool bitmap_test(const uint64_t* map, uint64_t bit) {
+    return (map[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS)) & 1;
+}
+
+/* =============================================================================
+ * Ranges and Searches
+ * =============================================================================
+ */
+
+/**
+ * Set or clear 'count' bits starting at 'start'
+ */
+void bitmap_set_range(uint64_t* map, uint64_t start, uint64_t count);
+void bitmap_clear_range(uint64_t* map, uint64_t start, uint64_t count);
+
+/**
+ * Find the first clear (find_zero) or set (find_one) bit in [start, end)
+ *
+ * @return The bit number, or end if there is none
+ */
+uint64_t bitmap_find_zero(const uint64_t* map, uint64_t start, uint64_t end);
+uint64_t bitmap_find_one(const uint64_t* map, uint64_t start, uint64_t end);
+
+/* =============================================================================
+ * Next-Fit Allocation
+ * =============================================================================
+ */
+
+/**
+ * Claim a run of clear bits in [lo, hi)
+ * Takes the first clear bit at or after *cursor (wrapping around to lo
+ * once) and up to count - 1 clear bits that directly follow it, sets
+ * them, and moves *cursor past the run.
+ *
+ * @param first Set to the first bit of the run
+ * @return      Bits claimed (1..count), or 0 if every bit is set
+ */
+uint64_t bitmap_alloc_run(uint64_t* map, uint64_t lo, uint64_t hi, uint64_t count,
+                          uint64_t* cursor, uint64_t* first);
+
+/**
+ * Claim one clear bit in [lo, hi) (next fit, as bitmap_alloc_run())
+ *
+ * @return The bit number, or hi if every bit is set
+ */
+uint64_t bitmap_alloc(uint64_t* map, uint64_t lo, uint64_t hi, uint64_t* cursor);
+
+#endif /* CHANUX_BITMAP_H */
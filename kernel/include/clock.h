@@ -0,0 +1,108 @@
+/**
+ * =============================================================================
+ * Chanux OS - Clock Source and Clock Events
+ * =============================================================================
+ * Time keeping and timer interrupts for the scheduler and kernel timers.
+ *
+ * Clock source:
+ *   The TSC, calibrated against the PIT at boot. clock_ns() is a
+ *   nanosecond count since boot that continues the PIT tick count from
+ *   the moment of calibration. Without a TSC it falls back to the PIT
+ *   tick count (10ms resolution).
+ *
+ * Clock events (per CPU):
+ *   One-shot local APIC timer interrupts, armed through the TSC-deadline
+ *   MSR when the CPU has it and through the APIC timer's count register
+ *   otherwise. Once the scheduler starts, the PIT is stopped and every CPU
+ *   programs only its next scheduler tick or timer expiry; an idle CPU
+ *   with nothing due programs nothing (tickless idle).
+ *
+ *   Without a TSC or local APIC, the periodic PIT (boot CPU) and APIC
+ *   timer (other CPUs) keep driving sched_tick() at 100Hz as before.
+ *
+ * All CPUs are assumed to run synchronized TSCs, as they do on current
+ * hardware and in QEMU/KVM.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_CLOCK_H
+#define CHANUX_CLOCK_H
+
+#include "types.h"
+
+/* =============================================================================
+ * Units
+ * =============================================================================
+ */
+
+#define NSEC_PER_USEC           1000ULL
+#define NSEC_PER_MSEC           1000000ULL
+#define NSEC_PER_SEC            1000000000ULL
+
+/* =============================================================================
+ * Clock API
+ * =============================================================================
+ */
+
+/**
+ * Calibrate the TSC and choose the clock event mode
+ * Requires the PIT ticking with interrupts on, and lapic_init() done.
+ *
+ * @return 0 if one-shot clock events are available, -1 if the kernel
+ *         stays on periodic ticks
+ */
+int clock_init(void);
+
+/**
+ * Nanoseconds since boot
+ */
+uint64_t clock_ns(void);
+
+/**
+ * Get the calibrated TSC frequency
+ *
+ * @return TSC frequency in kHz, or 0 if there is no usable TSC
+ */
+uint64_t clock_tsc_khz(void);
+
+/**
+ * Convert a TSC interval to nanoseconds
+ *
+ * @return Nanoseconds, or 0 if there is no calibrated TSC
+ */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+/**
+ * Get the TSC to clock_ns() conversion (for the user vvar page)
+ * clock_ns() == ns_base + ((rdtsc() - tsc_base) * ns_per_cycle >> 32)
+ *
+ * @return false if there is no calibrated TSC
+ */
+bool clock_get_scale(uint64_t* tsc_base, uint64_t* ns_base, uint64_t* ns_per_cycle);
+
+/**
+ * Check whether one-shot clock events are in use (tickless mode)
+ * True from clock_start() on.
+ */
+bool clock_oneshot(void);
+
+/**
+ * Switch to one-shot clock events (stops the PIT)
+ * Called by sched_start() on the boot CPU; a no-op if clock_init() failed.
+ */
+void clock_start(void);
+
+/**
+ * Arm the calling CPU's clock event
+ * Replaces any earlier setting. Deadlines in the past fire immediately.
+ *
+ * @param deadline_ns clock_ns() value to interrupt at (or shortly after)
+ */
+void clock_event_program(uint64_t deadline_ns);
+
+/**
+ * Disarm the calling CPU's clock event
+ */
+void clock_event_stop(void);
+
+#endif /* CHANUX_CLOCK_H */
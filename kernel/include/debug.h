@@ -19,6 +19,7 @@
 #define CHANUX_DEBUG_H
 
 #include "kernel.h"
+#include "klog.h"
 
 /* =============================================================================
  * Master Debug Flag
@@ -41,6 +42,9 @@
     #ifndef DEBUG_SYSCALL
         #define DEBUG_SYSCALL 1
     #endif
+    #ifndef DEBUG_PMM
+        #define DEBUG_PMM 1
+    #endif
 #else
     /* Master debug disabled - disable all unless explicitly enabled */
     #ifndef DEBUG_SCHED
@@ -55,37 +59,46 @@
     #ifndef DEBUG_SYSCALL
         #define DEBUG_SYSCALL 0
     #endif
+    #ifndef DEBUG_PMM
+        #define DEBUG_PMM 0
+    #endif
 #endif
 
 /* =============================================================================
  * Subsystem Debug Macros
  * =============================================================================
- * Each macro expands to kprintf when enabled, or ((void)0) when disabled.
+ * Each macro expands to klog(KLOG_DEBUG, ...) when enabled, or ((void)0) when disabled.
  * The ((void)0) form ensures the macro can be used as a statement.
  */
 
 #if DEBUG_SCHED
-    #define DBG_SCHED(fmt, ...) kprintf(fmt, ##__VA_ARGS__)
+    #define DBG_SCHED(fmt, ...) klog(KLOG_DEBUG, fmt, ##__VA_ARGS__)
 #else
     #define DBG_SCHED(fmt, ...) ((void)0)
 #endif
 
 #if DEBUG_VMM
-    #define DBG_VMM(fmt, ...) kprintf(fmt, ##__VA_ARGS__)
+    #define DBG_VMM(fmt, ...) klog(KLOG_DEBUG, fmt, ##__VA_ARGS__)
 #else
     #define DBG_VMM(fmt, ...) ((void)0)
 #endif
 
 #if DEBUG_USER
-    #define DBG_USER(fmt, ...) kprintf(fmt, ##__VA_ARGS__)
+    #define DBG_USER(fmt, ...) klog(KLOG_DEBUG, fmt, ##__VA_ARGS__)
 #else
     #define DBG_USER(fmt, ...) ((void)0)
 #endif
 
 #if DEBUG_SYSCALL
-    #define DBG_SYSCALL(fmt, ...) kprintf(fmt, ##__VA_ARGS__)
+    #define DBG_SYSCALL(fmt, ...) klog(KLOG_DEBUG, fmt, ##__VA_ARGS__)
 #else
     #define DBG_SYSCALL(fmt, ...) ((void)0)
 #endif
 
+#if DEBUG_PMM
+    #define DBG_PMM(fmt, ...) klog(KLOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+    #define DBG_PMM(fmt, ...) ((void)0)
+#endif
+
 #endif /* CHANUX_DEBUG_H */
@@ -0,0 +1,78 @@
+/**
+ * =============================================================================
+ * Chanux OS - ATA (IDE) Disk Driver
+ * =============================================================================
+ * PIO driver for the two legacy IDE channels (primary 0x1F0, secondary
+ * 0x170), master and slave on each. Every ATA disk found by IDENTIFY is
+ * registered with the block layer as hda (primary master), hdb (primary
+ * slave), hdc or hdd. ATAPI devices are skipped.
+ *
+ * Transfers use 28-bit LBA, or 48-bit LBA when the disk supports it, and
+ * poll the status register; the channel interrupts are masked (nIEN).
+ * =============================================================================
+ */
+
+#ifndef CHANUX_ATA_H
+#define CHANUX_ATA_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * I/O Ports
+ * =============================================================================
+ */
+
+#define ATA_PRIMARY_IO      0x1F0
+#define ATA_PRIMARY_CTRL    0x3F6
+#define ATA_SECONDARY_IO    0x170
+#define ATA_SECONDARY_CTRL  0x376
+
+/* Registers (offsets from the I/O base) */
+#define ATA_REG_DATA        0
+#define ATA_REG_ERROR       1
+#define ATA_REG_SECCOUNT    2
+#define ATA_REG_LBA0        3
+#define ATA_REG_LBA1        4
+#define ATA_REG_LBA2        5
+#define ATA_REG_DRIVE       6
+#define ATA_REG_STATUS      7       /* Read */
+#define ATA_REG_COMMAND     7       /* Write */
+
+/* Device control register */
+#define ATA_CTRL_NIEN       0x02    /* Mask the channel interrupt */
+
+/* =============================================================================
+ * Status Bits and Commands
+ * =============================================================================
+ */
+
+#define ATA_SR_ERR          0x01    /* Error */
+#define ATA_SR_DRQ          0x08    /* Data request */
+#define ATA_SR_DF           0x20    /* Drive fault */
+#define ATA_SR_DRDY         0x40    /* Drive ready */
+#define ATA_SR_BSY          0x80    /* Busy */
+
+#define ATA_CMD_READ_PIO        0x20
+#define ATA_CMD_READ_PIO_EXT    0x24
+#define ATA_CMD_WRITE_PIO       0x30
+#define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_CACHE_FLUSH     0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY        0xEC
+
+/* Sectors per command (a full 28-bit LBA count, 128KB) */
+#define ATA_MAX_SECTORS     256
+
+/* =============================================================================
+ * ATA Functions
+ * =============================================================================
+ */
+
+/**
+ * Probe both channels and register every ATA disk found.
+ *
+ * @return Number of disks registered
+ */
+int ata_init(void);
+
+#endif /* CHANUX_ATA_H */
@@ -0,0 +1,120 @@
+/**
+ * =============================================================================
+ * Chanux OS - Block Buffer Cache
+ * =============================================================================
+ * Caches 4KB blocks of block devices for filesystems that live on a disk
+ * (today, the RAMFS snapshot image).
+ * A buffer is found through a (device, block) hash; idle buffers sit on
+ * an LRU list and the least recently released clean one is reused.
+ *
+ * Reads and writes go through blkdev_submit(), so they overlap:
+ * bcache_readahead() starts reads of many blocks without waiting, and
+ * bcache_sync() puts every dirty buffer of a device in flight at once
+ * before it waits for any of them.
+ *
+ * Adjacent blocks travel together: readahead and write-back gather runs
+ * of up to BCACHE_CLUSTER_BLOCKS consecutive blocks (and the device's
+ * max_sectors) into one request through a contiguous bounce buffer, so
+ * streaming costs one command per run instead of one per 4KB. A
+ * write-back thread (bcache_writeback_start()) writes dirty, unreferenced
+ * buffers the same way, BCACHE_WRITEBACK_MS after a buffer is dirtied;
+ * with nothing dirty it sleeps without a timer.
+ *
+ * Usage:
+ *   buf_t* b = bcache_read(dev, block);
+ *   ... read or change b->data ...
+ *   bcache_mark_dirty(b);              // if changed
+ *   bcache_release(b);
+ *   bcache_sync(dev);                  // write back and flush
+ * =============================================================================
+ */
+
+#ifndef CHANUX_BCACHE_H
+#define CHANUX_BCACHE_H
+
+#include "../types.h"
+#include "blkdev.h"
+
+#define BCACHE_BLOCK_SIZE       4096
+#define BCACHE_SECTORS          (BCACHE_BLOCK_SIZE / BLKDEV_SECTOR_SIZE)
+#define BCACHE_BUFFERS          256     /* Cached blocks (1MB when all used) */
+#define BCACHE_BUCKETS          128     /* Hash chains (power of two) */
+#define BCACHE_CLUSTER_BLOCKS   16      /* Most blocks in one request (64KB) */
+#define BCACHE_CLUSTERS         4       /* Multi-block requests in flight */
+#define BCACHE_WRITEBACK_MS     1000    /* Write-back delay while dirty */
+
+/* Buffer flags */
+#define BUF_VALID               0x01    /* Data holds the block */
+#define BUF_DIRTY               0x02    /* Data is newer than the disk */
+#define BUF_BUSY                0x04    /* Read or write in flight */
+
+typedef struct buf {
+    struct buf*         hash_next;
+    struct buf*         lru_prev;       /* Most recently released first */
+    struct buf*         lru_next;
+    struct buf*         sync_next;      /* bcache_sync() batch */
+    blkdev_t*           dev;
+    uint64_t            block;          /* In BCACHE_BLOCK_SIZE units */
+    uint8_t*            data;           /* One page frame */
+    volatile uint32_t   flags;          /* BUF_* */
+    uint32_t            refs;
+    blkdev_request_t    req;            /* Single-block I/O */
+    blkdev_request_t*   io;             /* Request of the last I/O (req or a cluster's) */
+} buf_t;
+
+/**
+ * Set up the (empty) cache. Frames are taken as buffers are first used.
+ */
+void bcache_init(void);
+
+/**
+ * Start the write-back thread (once processes can be created).
+ */
+void bcache_writeback_start(void);
+
+/**
+ * Get a block, reading it if it is not cached.
+ *
+ * @return The referenced buffer, or NULL on an I/O error or when every
+ *         buffer is in use
+ */
+buf_t* bcache_read(blkdev_t* dev, uint64_t block);
+
+/**
+ * Get a block the caller overwrites whole, without reading it.
+ * Fill in all of b->data, then bcache_mark_dirty() and bcache_release().
+ *
+ * @return The referenced buffer, or NULL when every buffer is in use
+ */
+buf_t* bcache_getblk(blkdev_t* dev, uint64_t block);
+
+/**
+ * Start reading 'count' blocks from 'block' into the cache, without waiting.
+ */
+void bcache_readahead(blkdev_t* dev, uint64_t block, uint32_t count);
+
+/**
+ * Note that b->data was changed (written back by bcache_sync()).
+ */
+void bcache_mark_dirty(buf_t* b);
+
+/**
+ * Write a buffer to the disk now and wait for it.
+ *
+ * @return 0 on success, -1 on an I/O error (the buffer stays dirty)
+ */
+int bcache_write(buf_t* b);
+
+/**
+ * Drop a reference from bcache_read() or bcache_getblk().
+ */
+void bcache_release(buf_t* b);
+
+/**
+ * Write back every dirty buffer of a device, then flush the device.
+ *
+ * @return 0 on success, -1 if any write failed
+ */
+int bcache_sync(blkdev_t* dev);
+
+#endif /* CHANUX_BCACHE_H */
@@ -0,0 +1,143 @@
+/**
+ * =============================================================================
+ * Chanux OS - Block Device Layer
+ * =============================================================================
+ * A registry of block devices with one read/write/flush interface, so
+ * filesystem code does not care which driver sits underneath.
+ *
+ * Devices are addressed in 512-byte sectors. blkdev_read()/blkdev_write()
+ * check the range against the device and split a transfer into requests
+ * of at most max_sectors; drivers only see requests they can issue as one
+ * command.
+ *
+ * Asynchronous requests:
+ *   blkdev_submit() hands a request to the driver and returns at once;
+ *   the driver calls blkdev_complete() when the device is done, usually
+ *   from its interrupt handler. Drivers with a 'submit' entry point keep
+ *   many requests in flight; for the others blkdev_submit() runs the
+ *   request synchronously. blkdev_read()/blkdev_write() submit up to
+ *   BLKDEV_BATCH requests of a large transfer before waiting for any.
+ *
+ *   blkdev_wait() sleeps on a wait queue when it can. At boot, or with
+ *   interrupts off, it reaps completions itself through the driver's
+ *   'poll' entry point instead.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_BLKDEV_H
+#define CHANUX_BLKDEV_H
+
+#include "../types.h"
+
+#define BLKDEV_SECTOR_SIZE  512
+#define BLKDEV_NAME_MAX     8
+#define BLKDEV_BATCH        8       /* Requests in flight per blkdev_read/write */
+
+/* Request operations */
+#define BLKDEV_OP_READ      0
+#define BLKDEV_OP_WRITE     1
+#define BLKDEV_OP_FLUSH     2
+
+/* Request status until blkdev_complete() sets 0 or -1 */
+#define BLKDEV_REQ_PENDING  1
+
+struct blkdev;
+
+typedef struct blkdev_request {
+    struct blkdev*          dev;
+    uint32_t                op;             /* BLKDEV_OP_* */
+    uint32_t                count;          /* Sectors (0 for a flush) */
+    uint64_t                lba;
+    void*                   buf;            /* count * 512 bytes */
+    volatile int            status;         /* BLKDEV_REQ_PENDING, 0 or -1 */
+    /* Called with the outcome before 'status' is set (may be in an IRQ) */
+    void                    (*done)(struct blkdev_request* req, int status);
+    void*                   priv;           /* Owner data */
+    struct blkdev_request*  next;           /* Driver queue link */
+} blkdev_request_t;
+
+/*
+ * Driver entry points: 0 on success, -1 on an I/O error. A driver
+ * provides read (and write/flush for writable disks), or submit.
+ */
+typedef struct {
+    int (*read)(struct blkdev* dev, uint64_t lba, uint32_t count, void* buf);
+    int (*write)(struct blkdev* dev, uint64_t lba, uint32_t count, const void* buf);
+    int (*flush)(struct blkdev* dev);
+    /* Queue a request; completion is reported through blkdev_complete() */
+    int (*submit)(struct blkdev* dev, blkdev_request_t* req);
+    /* Reap finished requests without an interrupt */
+    void (*poll)(struct blkdev* dev);
+} blkdev_ops_t;
+
+typedef struct blkdev {
+    char                name[BLKDEV_NAME_MAX];  /* "hda", "vda", ... */
+    uint64_t            sector_count;           /* Device size in sectors */
+    uint32_t            max_sectors;            /* Largest single request */
+    const blkdev_ops_t* ops;
+    void*               priv;                   /* Driver data */
+    struct blkdev*      next;                   /* Registry chain */
+} blkdev_t;
+
+/* =============================================================================
+ * Block Device Functions
+ * =============================================================================
+ */
+
+/**
+ * Add a device to the registry (the structure must stay allocated).
+ *
+ * @return 0 on success, -1 if the name is taken
+ */
+int blkdev_register(blkdev_t* dev);
+
+/**
+ * Look up a device by name.
+ *
+ * @return The device, or NULL
+ */
+blkdev_t* blkdev_find(const char* name);
+
+/**
+ * Read 'count' sectors starting at 'lba' into 'buf'.
+ *
+ * @return 0 on success, -1 on error or out-of-range request
+ */
+int blkdev_read(blkdev_t* dev, uint64_t lba, uint64_t count, void* buf);
+
+/**
+ * Write 'count' sectors from 'buf' starting at 'lba'.
+ *
+ * @return 0 on success, -1 on error or out-of-range request
+ */
+int blkdev_write(blkdev_t* dev, uint64_t lba, uint64_t count, const void* buf);
+
+/**
+ * Wait until written data is on stable storage.
+ *
+ * @return 0 on success, -1 on error
+ */
+int blkdev_flush(blkdev_t* dev);
+
+/**
+ * Start a request (dev, op, lba, count, buf and done filled in).
+ * At most max_sectors; the buffer must stay valid until completion.
+ *
+ * @return 0 if the request was started (its status tells the outcome),
+ *         -1 if it was refused (out of range, read-only device)
+ */
+int blkdev_submit(blkdev_request_t* req);
+
+/**
+ * Wait for a submitted request.
+ *
+ * @return The request's status: 0 on success, -1 on an I/O error
+ */
+int blkdev_wait(blkdev_request_t* req);
+
+/**
+ * Finish a request (drivers only; safe from interrupt handlers).
+ */
+void blkdev_complete(blkdev_request_t* req, int status);
+
+#endif /* CHANUX_BLKDEV_H */
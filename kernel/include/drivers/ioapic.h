@@ -0,0 +1,73 @@
+/**
+ * =============================================================================
+ * Chanux OS - I/O APIC Driver
+ * =============================================================================
+ * The I/O APICs listed in the MADT take over external interrupts from the
+ * 8259 PIC. Each input pin is a global system interrupt (GSI) with its own
+ * redirection entry: vector, trigger mode, polarity, mask and destination
+ * local APIC ID, so every line can be sent to the CPU that should handle it.
+ *
+ * ISA IRQs are wired to the GSI of the same number unless the MADT has an
+ * interrupt source override for them (the PIT's IRQ 0 usually sits on
+ * GSI 2). Routing and masking are done through the IRQ framework
+ * (interrupts/irq.h); this driver only programs the entries.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_IOAPIC_H
+#define CHANUX_IOAPIC_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * I/O APIC Registers
+ * =============================================================================
+ * Indirect: write the register index to IOREGSEL, then access IOWIN.
+ */
+
+#define IOAPIC_REGSEL           0x00    /* Byte offsets into the MMIO page */
+#define IOAPIC_WIN              0x10
+
+#define IOAPIC_REG_ID           0x00
+#define IOAPIC_REG_VERSION      0x01    /* Bits 16-23: highest entry index */
+#define IOAPIC_REG_REDTBL       0x10    /* Entry n: low at 0x10 + 2n, high at +1 */
+
+/* Redirection entry bits (low dword; destination APIC ID in bits 56-63) */
+#define IOAPIC_REDIR_LEVEL      0x8000  /* Level-triggered (clear: edge) */
+#define IOAPIC_REDIR_ACTIVE_LOW 0x2000  /* Active low (clear: active high) */
+#define IOAPIC_REDIR_MASKED     0x10000
+
+/* =============================================================================
+ * I/O APIC API
+ * =============================================================================
+ */
+
+/**
+ * Map the I/O APICs from the MADT and mask every entry.
+ * Must be called after acpi_init().
+ *
+ * @return Number of I/O APICs found (0: stay on the 8259)
+ */
+uint32_t ioapic_init(void);
+
+/**
+ * Program a GSI's redirection entry, leaving it masked.
+ *
+ * @param gsi     Global system interrupt
+ * @param vector  Vector to deliver
+ * @param flags   IOAPIC_REDIR_LEVEL and/or IOAPIC_REDIR_ACTIVE_LOW
+ * @param apic_id Destination local APIC ID
+ * @return 0 on success, -1 if no I/O APIC has that pin
+ */
+int ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags, uint32_t apic_id);
+
+/**
+ * Send a GSI to another CPU (the entry keeps its mask state).
+ */
+void ioapic_set_dest(uint32_t gsi, uint32_t apic_id);
+
+/* Mask / unmask a GSI */
+void ioapic_mask(uint32_t gsi);
+void ioapic_unmask(uint32_t gsi);
+
+#endif /* CHANUX_IOAPIC_H */
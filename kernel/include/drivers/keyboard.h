@@ -62,7 +62,8 @@
  * =============================================================================
  */
 
-#define KB_BUFFER_SIZE      256     /* Circular buffer size */
+/* Raw input ring, read by one consumer at a time (the TTY, see tty.h) */
+#define KB_BUFFER_SIZE      4096    /* Circular buffer size (power of 2) */
 
 /* =============================================================================
  * Keyboard Functions
@@ -82,6 +83,13 @@ void keyboard_init(void);
  */
 bool keyboard_has_key(void);
 
+/**
+ * Wait until a key is in the buffer.
+ * Once the scheduler runs, the caller sleeps on a wait queue that the
+ * keyboard IRQ wakes; before that it halts between interrupts.
+ */
+void keyboard_wait(void);
+
 /**
  * Get the next character from the keyboard buffer.
  * Blocks until a key is available.
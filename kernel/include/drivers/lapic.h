@@ -0,0 +1,174 @@
+/**
+ * =============================================================================
+ * Chanux OS - Local APIC Driver
+ * =============================================================================
+ * Every CPU has a local APIC, reached through the same physical MMIO page
+ * (each CPU sees its own). It is used for:
+ *   - Inter-processor interrupts: INIT/SIPI to start APs, reschedule and
+ *     TLB shootdown requests between running CPUs
+ *   - A per-CPU timer that drives sched_tick(): periodic at 100Hz, or
+ *     one-shot (count or TSC-deadline) once the clock code goes tickless
+ *   - Receiving device interrupts, from the I/O APIC or as PCI MSI
+ *     messages, and acknowledging them with one write to its EOI register
+ *
+ * Until irq_enable_apic() the 8259 PIC reaches the boot CPU through LINT0.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_LAPIC_H
+#define CHANUX_LAPIC_H
+
+#include "../types.h"
+#include "../interrupts/isr.h"
+
+/* =============================================================================
+ * Local APIC Registers (byte offsets into the MMIO page)
+ * =============================================================================
+ */
+
+#define LAPIC_DEFAULT_PHYS  0xFEE00000
+
+#define LAPIC_REG_ID        0x020   /* Local APIC ID (bits 24-31) */
+#define LAPIC_REG_VERSION   0x030
+#define LAPIC_REG_TPR       0x080   /* Task priority */
+#define LAPIC_REG_EOI       0x0B0   /* End of interrupt (write 0) */
+#define LAPIC_REG_SVR       0x0F0   /* Spurious interrupt vector */
+#define LAPIC_REG_ESR       0x280   /* Error status */
+#define LAPIC_REG_ICR_LOW   0x300   /* Interrupt command (low dword, sends) */
+#define LAPIC_REG_ICR_HIGH  0x310   /* Interrupt command (destination) */
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
+#define LAPIC_REG_LVT_ERROR 0x370
+#define LAPIC_REG_TIMER_INIT 0x380  /* Timer initial count */
+#define LAPIC_REG_TIMER_CUR 0x390   /* Timer current count */
+#define LAPIC_REG_TIMER_DIV 0x3E0   /* Timer divide configuration */
+
+/* Register bits */
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_TSC_DEADLINE 0x40000
+#define LAPIC_TIMER_DIV_16      0x3
+
+#define LAPIC_ICR_INIT          0x500
+#define LAPIC_ICR_STARTUP       0x600
+#define LAPIC_ICR_PENDING       0x1000  /* Delivery status: send pending */
+#define LAPIC_ICR_ASSERT        0x4000
+#define LAPIC_ICR_LEVEL         0x8000
+
+/* IA32_APIC_BASE MSR */
+#define MSR_APIC_BASE           0x1B
+#define MSR_APIC_BASE_ENABLE    (1ULL << 11)
+
+/* IA32_TSC_DEADLINE MSR (write a TSC value to arm, 0 to disarm) */
+#define MSR_TSC_DEADLINE        0x6E0
+
+/* =============================================================================
+ * Vectors
+ * =============================================================================
+ * Above the ISA range (32-47), below the vectors irq_alloc_vector() hands
+ * out (0x50-0xEF) and the spurious vector.
+ */
+
+#define LAPIC_TIMER_VECTOR      0x40
+#define LAPIC_RESCHED_VECTOR    0x41    /* "Look at your run queue" */
+#define LAPIC_TLB_VECTOR        0x42    /* Kernel TLB shootdown */
+#define LAPIC_SPURIOUS_VECTOR   0xFF
+
+/* =============================================================================
+ * Local APIC API
+ * =============================================================================
+ */
+
+/**
+ * Map and enable the boot CPU's local APIC, and calibrate its timer
+ * against the PIT. Requires interrupts on and the PIT ticking.
+ *
+ * @param phys Physical MMIO base (from the MADT)
+ * @return 0 on success, -1 if the CPU has no local APIC
+ */
+int lapic_init(phys_addr_t phys);
+
+/**
+ * Enable the calling AP's local APIC (the MMIO page is already mapped)
+ */
+void lapic_init_ap(void);
+
+/**
+ * Check whether lapic_init() succeeded
+ */
+bool lapic_is_ready(void);
+
+/**
+ * Get the calling CPU's local APIC ID
+ */
+uint32_t lapic_id(void);
+
+/**
+ * Signal end of interrupt for a local APIC vector
+ */
+void lapic_eoi(void);
+
+/**
+ * Mask LINT0 on the calling CPU, through which the 8259 PIC delivers
+ * (ExtINT); called once the I/O APIC has taken over
+ */
+void lapic_disable_extint(void);
+
+/**
+ * Send a fixed-vector IPI to one CPU
+ *
+ * @param apic_id Destination local APIC ID
+ * @param vector  Interrupt vector
+ */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * Send an INIT IPI (puts an AP in wait-for-SIPI)
+ */
+void lapic_send_init(uint32_t apic_id);
+
+/**
+ * Send a STARTUP IPI
+ *
+ * @param apic_id Destination local APIC ID
+ * @param page    Real-mode start page (start address / 4KB)
+ */
+void lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+/**
+ * Start the calling CPU's periodic timer at SCHED_TICK_RATE
+ * Uses the count calibrated by lapic_init().
+ */
+void lapic_timer_start(void);
+
+/**
+ * Get the APIC timer count (divide by 16) for one 10ms scheduler tick
+ */
+uint32_t lapic_timer_tick_count(void);
+
+/**
+ * Fire the calling CPU's timer once, after 'count' APIC timer units
+ *
+ * @param count Initial count (divide by 16), 0 stops the timer
+ */
+void lapic_timer_oneshot(uint32_t count);
+
+/**
+ * Fire the calling CPU's timer once the TSC reaches 'tsc'
+ * Only valid if the CPU supports TSC-deadline mode (CPUID.1:ECX.24).
+ *
+ * @param tsc TSC value to fire at, 0 stops the timer
+ */
+void lapic_timer_deadline(uint64_t tsc);
+
+/**
+ * Handle a local APIC vector (timer and IPIs)
+ * Called from irq_handler() for vectors >= LAPIC_TIMER_VECTOR.
+ *
+ * @param regs Saved registers
+ */
+void lapic_handle_interrupt(registers_t* regs);
+
+#endif /* CHANUX_LAPIC_H */
@@ -0,0 +1,209 @@
+/**
+ * =============================================================================
+ * Chanux OS - PCI Bus
+ * =============================================================================
+ * Configuration space access through the legacy 0xCF8/0xCFC mechanism
+ * and a table of the functions found at boot.
+ *
+ * pci_init() walks every bus once; drivers then look their hardware up
+ * with pci_find_device() and program it through the config helpers.
+ *
+ * Devices with an MSI or MSI-X capability can signal interrupts as
+ * memory writes to a local APIC instead of through a shared INTx line:
+ * no I/O APIC pin, no sharing, and the destination CPU is picked per
+ * vector (pci_enable_msi(), pci_enable_msix()).
+ * =============================================================================
+ */
+
+#ifndef CHANUX_PCI_H
+#define CHANUX_PCI_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * Configuration Space
+ * =============================================================================
+ */
+
+#define PCI_CONFIG_ADDRESS      0xCF8
+#define PCI_CONFIG_DATA         0xCFC
+
+/* Header registers (type 0 and common) */
+#define PCI_VENDOR_ID           0x00
+#define PCI_DEVICE_ID           0x02
+#define PCI_COMMAND             0x04
+#define PCI_STATUS              0x06
+#define PCI_REVISION_ID         0x08
+#define PCI_PROG_IF             0x09
+#define PCI_SUBCLASS            0x0A
+#define PCI_CLASS               0x0B
+#define PCI_HEADER_TYPE         0x0E
+#define PCI_BAR0                0x10
+#define PCI_CAP_POINTER         0x34
+#define PCI_SUBSYSTEM_ID        0x2E
+#define PCI_INTERRUPT_LINE      0x3C
+#define PCI_INTERRUPT_PIN       0x3D
+
+/* Command register */
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004
+#define PCI_COMMAND_INTX_OFF    0x0400
+
+/* Status register */
+#define PCI_STATUS_CAP_LIST     0x0010  /* Capability list at PCI_CAP_POINTER */
+
+/* Header type */
+#define PCI_HEADER_MULTIFUNC    0x80
+
+/* BAR bits */
+#define PCI_BAR_IO              0x01
+#define PCI_BAR_IO_MASK         0xFFFFFFFC
+#define PCI_BAR_MEM_MASK        0xFFFFFFF0
+#define PCI_BAR_MEM_64          0x04    /* 64-bit BAR: high half in the next one */
+
+/* =============================================================================
+ * Message Signalled Interrupts
+ * =============================================================================
+ */
+
+#define PCI_CAP_ID_MSI          0x05
+#define PCI_CAP_ID_MSIX         0x11
+
+/* MSI capability (offsets from the capability) */
+#define PCI_MSI_CTRL            0x02
+#define PCI_MSI_ADDR            0x04
+#define PCI_MSI_ADDR_HIGH       0x08    /* 64-bit capable only */
+#define PCI_MSI_DATA_32         0x08
+#define PCI_MSI_DATA_64         0x0C
+
+#define PCI_MSI_CTRL_ENABLE     0x0001
+#define PCI_MSI_CTRL_MME_MASK   0x0070  /* Vectors enabled (log2) */
+#define PCI_MSI_CTRL_64BIT      0x0080
+
+/* MSI-X capability */
+#define PCI_MSIX_CTRL           0x02
+#define PCI_MSIX_TABLE          0x04    /* BAR index in bits 0-2, offset above */
+
+#define PCI_MSIX_CTRL_SIZE      0x07FF  /* Table entries - 1 */
+#define PCI_MSIX_CTRL_MASKALL   0x4000
+#define PCI_MSIX_CTRL_ENABLE    0x8000
+#define PCI_MSIX_TABLE_BIR      0x07
+
+/* MSI-X table entry (16 bytes, in a memory BAR) */
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_ADDR     0x00
+#define PCI_MSIX_ENTRY_ADDR_HIGH 0x04
+#define PCI_MSIX_ENTRY_DATA     0x08
+#define PCI_MSIX_ENTRY_CTRL     0x0C
+#define PCI_MSIX_ENTRY_MASKED   0x01
+
+/* Message address: fixed delivery to one local APIC (ID in bits 12-19) */
+#define PCI_MSI_ADDRESS_BASE    0xFEE00000
+
+#define PCI_VENDOR_NONE         0xFFFF
+#define PCI_MAX_DEVICES         64
+#define PCI_MAX_BUSES           256
+#define PCI_MAX_SLOTS           32
+#define PCI_MAX_FUNCS           8
+
+/* =============================================================================
+ * Device Table
+ * =============================================================================
+ */
+
+typedef struct {
+    uint8_t     bus;
+    uint8_t     slot;
+    uint8_t     func;
+    uint8_t     irq_line;       /* PIC IRQ the firmware routed INTx to */
+    uint16_t    vendor;
+    uint16_t    device;
+    uint8_t     class_code;
+    uint8_t     subclass;
+    uint8_t     prog_if;
+    uint8_t     irq_pin;        /* 0: none, 1-4: INTA-INTD */
+    uint8_t     msi_cap;        /* Config offset of the capability, 0: none */
+    uint8_t     msix_cap;
+    uint16_t    msix_size;      /* MSI-X table entries */
+    volatile uint32_t* msix_table;  /* Mapped by pci_enable_msix() */
+} pci_device_t;
+
+/* =============================================================================
+ * PCI Functions
+ * =============================================================================
+ */
+
+/**
+ * Scan all buses and record every function found.
+ */
+void pci_init(void);
+
+/**
+ * Find a device by IDs.
+ *
+ * @param from Continue after this device (NULL: start of the table)
+ * @return The next matching device, or NULL
+ */
+pci_device_t* pci_find_device(uint16_t vendor, uint16_t device, pci_device_t* from);
+
+/* Config space access ('offset' aligned to the access size) */
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset);
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset);
+uint8_t pci_read8(const pci_device_t* dev, uint8_t offset);
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value);
+
+/**
+ * Get the port base of an I/O BAR.
+ *
+ * @return Port base, or 0 if the BAR is not an I/O BAR
+ */
+uint16_t pci_bar_io(const pci_device_t* dev, uint32_t bar);
+
+/**
+ * Get the physical base of a memory BAR (32- or 64-bit).
+ *
+ * @return Physical base, or 0 if the BAR is not a memory BAR
+ */
+phys_addr_t pci_bar_mem(const pci_device_t* dev, uint32_t bar);
+
+/**
+ * Turn on I/O and memory decoding and bus mastering (DMA).
+ */
+void pci_enable_device(const pci_device_t* dev);
+
+/**
+ * Find a capability in the device's capability list.
+ *
+ * @param id PCI_CAP_ID_*
+ * @return Config space offset of the capability, or 0 if absent
+ */
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t id);
+
+/**
+ * Have the device signal its (single) MSI as 'vector' on one CPU, and turn
+ * INTx off. Calling it again moves the interrupt to another CPU.
+ *
+ * @param vector Vector from irq_alloc_vector()
+ * @param cpu    Destination CPU index
+ * @return 0 on success, -1 if the device has no MSI or the CPU is not online
+ */
+int pci_enable_msi(pci_device_t* dev, uint8_t vector, uint32_t cpu);
+
+/**
+ * Point MSI-X table entry 'entry' at 'vector' on one CPU, unmask it and
+ * turn MSI-X on. Entries never set stay masked. Calling it again for the
+ * same entry moves the interrupt.
+ *
+ * @return 0 on success, -1 if the device has no MSI-X, 'entry' is past
+ *         its table, the table cannot be mapped or the CPU is not online
+ */
+int pci_enable_msix(pci_device_t* dev, uint16_t entry, uint8_t vector, uint32_t cpu);
+
+/**
+ * Turn MSI-X off again (back to INTx).
+ */
+void pci_disable_msix(pci_device_t* dev);
+
+#endif /* CHANUX_PCI_H */
@@ -80,13 +80,14 @@ void pit_init(void);
 
 /**
  * Get the current tick count since boot.
+ * After pit_stop() this is clock_ns() in 10ms units.
  *
  * @return Number of timer ticks since PIT initialization
  */
 uint64_t pit_get_ticks(void);
 
 /**
- * Get system uptime in milliseconds.
+ * Get system uptime in milliseconds (TSC resolution once calibrated).
  *
  * @return Milliseconds since PIT initialization
  */
@@ -115,4 +116,10 @@ void pit_sleep_ticks(uint64_t ticks);
  */
 void pit_sleep_ms(uint64_t ms);
 
+/**
+ * Mask IRQ0 for good (the kernel has switched to one-shot clock events).
+ * pit_get_ticks() keeps counting from the clock source.
+ */
+void pit_stop(void);
+
 #endif /* CHANUX_PIT_H */
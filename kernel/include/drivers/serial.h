@@ -0,0 +1,83 @@
+/**
+ * =============================================================================
+ * Chanux OS - Serial Port (16550 UART) Driver
+ * =============================================================================
+ * Transmit-only driver for COM1, which mirrors the console.
+ *
+ * Characters are queued in a ring buffer and fed to the UART's 16-byte
+ * FIFO from the transmitter-empty interrupt (IRQ4), so a process writing
+ * to the console never waits for the line. Output is written by polling
+ * instead:
+ *   - at boot, until serial_enable_irq() has run
+ *   - when the ring is full (the oldest bytes are pushed out first)
+ *   - after serial_panic(), for messages printed on the way down
+ * =============================================================================
+ */
+
+#ifndef CHANUX_SERIAL_H
+#define CHANUX_SERIAL_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * UART Registers (offsets from the base port)
+ * =============================================================================
+ */
+
+#define SERIAL_COM1         0x3F8   /* COM1 base port */
+#define SERIAL_IRQ          4       /* COM1 interrupt line */
+
+#define SERIAL_THR          0       /* Transmit holding register (write) */
+#define SERIAL_IER          1       /* Interrupt enable */
+#define SERIAL_IIR          2       /* Interrupt identification (read) */
+#define SERIAL_FCR          2       /* FIFO control (write) */
+#define SERIAL_LCR          3       /* Line control */
+#define SERIAL_MCR          4       /* Modem control */
+#define SERIAL_LSR          5       /* Line status */
+
+#define SERIAL_IER_THRE     0x02    /* Interrupt when the transmitter is empty */
+#define SERIAL_LSR_THRE     0x20    /* Transmit FIFO empty */
+
+#define SERIAL_FIFO_SIZE    16      /* 16550A transmit FIFO */
+
+/* Transmit ring buffer (power of 2) */
+#define SERIAL_TX_BUFFER_SIZE 4096
+
+/* =============================================================================
+ * Serial API
+ * =============================================================================
+ */
+
+/**
+ * Program COM1 for 38400 baud, 8N1, FIFOs on, transmit interrupt off.
+ * Called on first output; safe to call again.
+ */
+void serial_init(void);
+
+/**
+ * Install the IRQ4 handler and switch to buffered output.
+ * Call after pic_init().
+ */
+void serial_enable_irq(void);
+
+/**
+ * Queue one character for transmission.
+ *
+ * @param c Character to send
+ */
+void serial_putchar(char c);
+
+/**
+ * Wait until everything queued so far has gone out to the UART.
+ * For shutting down (make bench), where the machine stops right after.
+ */
+void serial_flush(void);
+
+/**
+ * Stop buffering: push out everything queued by polling, and poll for
+ * all later output. For panic and fatal exception paths, which run with
+ * interrupts disabled until the machine halts.
+ */
+void serial_panic(void);
+
+#endif /* CHANUX_SERIAL_H */
@@ -0,0 +1,53 @@
+/**
+ * =============================================================================
+ * Chanux OS - Console TTY
+ * =============================================================================
+ * Canonical-mode line discipline between the keyboard and stdin.
+ *
+ * Keys wait in the keyboard's input ring until someone reads stdin. The
+ * reader then runs them through the line discipline: printable
+ * characters are echoed and added to the line, backspace takes the last
+ * one back off the screen and the line, and Enter completes the line.
+ * read() returns the completed line, newline included, in one call; a
+ * line longer than the read is handed out over several reads.
+ *
+ * Input typed while nobody reads is kept (up to KB_BUFFER_SIZE keys) and
+ * echoed by the next read.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_TTY_H
+#define CHANUX_TTY_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * Configuration
+ * =============================================================================
+ */
+
+/* Longest line, newline included; keys past it are dropped until Enter */
+#define TTY_LINE_MAX        256
+
+/* =============================================================================
+ * TTY API
+ * =============================================================================
+ */
+
+/**
+ * Read input, sleeping until a whole line has been typed.
+ *
+ * @param buf Destination (kernel memory)
+ * @param len Room in buf (at least 1)
+ * @return Bytes read: up to the end of the current line
+ */
+size_t tty_read(char* buf, size_t len);
+
+/**
+ * Check whether a read would return without sleeping (unlocked snapshot).
+ *
+ * @return true if a completed line is waiting
+ */
+bool tty_input_ready(void);
+
+#endif /* CHANUX_TTY_H */
@@ -0,0 +1,210 @@
+/**
+ * =============================================================================
+ * Chanux OS - Virtio (Legacy PCI Transport) and Split Virtqueues
+ * =============================================================================
+ * Virtio devices are driven through the legacy register block in their
+ * I/O BAR, which QEMU's transitional devices (vendor 0x1AF4, device
+ * 0x1000-0x103F) still provide.
+ *
+ * A split virtqueue is three rings in one physically contiguous area:
+ *   desc:  buffer descriptors, chained through 'next'
+ *   avail: heads of the chains the driver has offered the device
+ *   used:  heads of the chains the device has finished with
+ * The driver adds chains and kicks the device; the device posts finished
+ * chains to the used ring and raises the interrupt. Any number of chains
+ * may be outstanding at once, which is how one queue keeps the device busy.
+ *
+ * The virtqueue functions do no locking; each driver serializes its
+ * own queues.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_VIRTIO_H
+#define CHANUX_VIRTIO_H
+
+#include "../types.h"
+#include "pci.h"
+
+/* =============================================================================
+ * PCI IDs and Legacy Registers
+ * =============================================================================
+ */
+
+#define VIRTIO_PCI_VENDOR           0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK       0x1001      /* Transitional block device */
+
+/* Legacy register block (BAR0, I/O space) */
+#define VIRTIO_PCI_HOST_FEATURES    0x00        /* 32-bit, read */
+#define VIRTIO_PCI_GUEST_FEATURES   0x04        /* 32-bit, write */
+#define VIRTIO_PCI_QUEUE_PFN        0x08        /* 32-bit: ring address >> 12 */
+#define VIRTIO_PCI_QUEUE_SIZE       0x0C        /* 16-bit, read */
+#define VIRTIO_PCI_QUEUE_SELECT     0x0E        /* 16-bit */
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10        /* 16-bit: queue index */
+#define VIRTIO_PCI_STATUS           0x12        /* 8-bit */
+#define VIRTIO_PCI_ISR              0x13        /* 8-bit, read clears */
+#define VIRTIO_PCI_CONFIG           0x14        /* Device config (no MSI-X) */
+
+/* Only while MSI-X is on; the device config then moves up */
+#define VIRTIO_MSI_CONFIG_VECTOR    0x14        /* 16-bit: entry for config changes */
+#define VIRTIO_MSI_QUEUE_VECTOR     0x16        /* 16-bit: entry for the selected queue */
+#define VIRTIO_PCI_CONFIG_MSIX      0x18
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+/* ISR status */
+#define VIRTIO_ISR_QUEUE            0x01
+
+/* =============================================================================
+ * Split Virtqueue Layout
+ * =============================================================================
+ */
+
+#define VIRTQ_DESC_F_NEXT           0x0001      /* Chain continues in 'next' */
+#define VIRTQ_DESC_F_WRITE          0x0002      /* Device writes this buffer */
+#define VIRTQ_USED_F_NO_NOTIFY      0x0001      /* Device does not need kicks */
+
+#define VIRTQ_ALIGN                 4096        /* Legacy used ring alignment */
+#define VIRTQ_MAX_SIZE              1024        /* Largest queue we set up */
+
+typedef struct {
+    uint64_t    addr;                   /* Physical address */
+    uint32_t    len;
+    uint16_t    flags;                  /* VIRTQ_DESC_F_* */
+    uint16_t    next;
+} PACKED virtq_desc_t;
+
+typedef struct {
+    uint16_t    flags;
+    uint16_t    idx;                    /* Next ring slot the driver fills */
+    uint16_t    ring[];
+} PACKED virtq_avail_t;
+
+typedef struct {
+    uint32_t    id;                     /* Head of the finished chain */
+    uint32_t    len;                    /* Bytes the device wrote */
+} PACKED virtq_used_elem_t;
+
+typedef struct {
+    uint16_t    flags;                  /* VIRTQ_USED_F_* */
+    uint16_t    idx;                    /* Next ring slot the device fills */
+    virtq_used_elem_t ring[];
+} PACKED virtq_used_t;
+
+/* =============================================================================
+ * Driver Structures
+ * =============================================================================
+ */
+
+typedef struct {
+    pci_device_t*   pci;
+    uint16_t        iobase;             /* Legacy register block */
+    uint16_t        config;             /* Device config offset in it */
+} virtio_dev_t;
+
+/* One buffer of a chain */
+typedef struct {
+    phys_addr_t     addr;
+    uint32_t        len;
+    bool            device_writes;      /* Device-to-driver (read data, status) */
+} virtq_seg_t;
+
+typedef struct {
+    virtio_dev_t*   vdev;
+    uint16_t        index;              /* Queue number on the device */
+    uint16_t        size;               /* Descriptors (set by the device) */
+    virtq_desc_t*   desc;
+    virtq_avail_t*  avail;
+    virtq_used_t*   used;
+    uint16_t        free_head;          /* Free descriptors, chained by 'next' */
+    uint16_t        num_free;
+    uint16_t        last_used;          /* Next used ring slot to consume */
+    void**          cookies;            /* Caller's pointer per chain head */
+    phys_addr_t     ring_phys;
+    size_t          ring_pages;
+} virtqueue_t;
+
+/* =============================================================================
+ * Device Functions
+ * =============================================================================
+ */
+
+/**
+ * Reset a device and announce a driver (ACKNOWLEDGE | DRIVER).
+ *
+ * @return 0 on success, -1 if the device has no legacy I/O BAR
+ */
+int virtio_pci_setup(virtio_dev_t* vdev, pci_device_t* pci);
+
+/* Feature bits the device offers / accepting a subset of them */
+uint32_t virtio_get_features(virtio_dev_t* vdev);
+void virtio_set_features(virtio_dev_t* vdev, uint32_t features);
+
+/* Device is configured and may start (or the driver gives up on it) */
+void virtio_driver_ok(virtio_dev_t* vdev);
+void virtio_fail(virtio_dev_t* vdev);
+
+/* Read and acknowledge the interrupt status (VIRTIO_ISR_*) */
+uint8_t virtio_read_isr(virtio_dev_t* vdev);
+
+/* Device-specific configuration */
+uint32_t virtio_config_read32(virtio_dev_t* vdev, uint32_t offset);
+uint64_t virtio_config_read64(virtio_dev_t* vdev, uint32_t offset);
+
+/* =============================================================================
+ * Virtqueue Functions
+ * =============================================================================
+ */
+
+/**
+ * Allocate queue 'index' of a device and hand it to the device.
+ *
+ * @return 0 on success, -1 if the queue does not exist or memory ran out
+ */
+int virtqueue_init(virtqueue_t* vq, virtio_dev_t* vdev, uint16_t index);
+
+/**
+ * Have a queue signal MSI-X table entry 'entry', delivered as 'vector' on
+ * one CPU, instead of the INTx line. Config change interrupts stay off.
+ * The ISR register is not used any more: the vector alone says which
+ * queue to look at.
+ *
+ * @return 0 on success, -1 if the device has no MSI-X or refused the
+ *         entry (it is back on INTx then)
+ */
+int virtqueue_enable_msix(virtqueue_t* vq, uint16_t entry, uint8_t vector, uint32_t cpu);
+
+/**
+ * Head descriptor the next virtqueue_add() will use, so a caller can
+ * keep per-request data in an array indexed by it.
+ */
+static inline uint16_t virtqueue_next_head(const virtqueue_t* vq) {
+    return vq->free_head;
+}
+
+/**
+ * Offer one chain of buffers to the device (not yet kicked).
+ *
+ * @param cookie Returned by virtqueue_get() when the chain is finished
+ * @return Head descriptor, or -1 if fewer than 'count' descriptors are free
+ */
+int virtqueue_add(virtqueue_t* vq, const virtq_seg_t* segs, uint32_t count, void* cookie);
+
+/**
+ * Tell the device new chains are available (skipped if it asked not to be).
+ */
+void virtqueue_kick(virtqueue_t* vq);
+
+/**
+ * Take the next finished chain and free its descriptors.
+ *
+ * @param head_out Head descriptor of the chain
+ * @return The chain's cookie, or NULL if nothing has finished
+ */
+void* virtqueue_get(virtqueue_t* vq, uint16_t* head_out);
+
+#endif /* CHANUX_VIRTIO_H */
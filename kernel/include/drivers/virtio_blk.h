@@ -0,0 +1,55 @@
+/**
+ * =============================================================================
+ * Chanux OS - Virtio Block Driver
+ * =============================================================================
+ * Registers each virtio-blk PCI device with the block layer as vda, vdb,
+ * ... Requests go onto the device's single virtqueue as soon as there
+ * are descriptors for them, so many can be in flight; completions are
+ * reaped by the interrupt handler (or by blkdev_wait() polling when
+ * interrupts are off). Requests that find the ring full wait in a
+ * software queue and are started as earlier ones complete.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_VIRTIO_BLK_H
+#define CHANUX_VIRTIO_BLK_H
+
+#include "../types.h"
+
+/* Feature bits */
+#define VIRTIO_BLK_F_RO         (1U << 5)       /* Read-only device */
+#define VIRTIO_BLK_F_FLUSH      (1U << 9)       /* Flush command, write cache */
+
+/* Device configuration */
+#define VIRTIO_BLK_CFG_CAPACITY 0x00            /* 64-bit, in 512-byte sectors */
+
+/* Request types */
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_BLK_T_OUT        1
+#define VIRTIO_BLK_T_FLUSH      4
+
+/* Request status (written by the device) */
+#define VIRTIO_BLK_S_OK         0
+#define VIRTIO_BLK_S_IOERR      1
+#define VIRTIO_BLK_S_UNSUPP     2
+
+#define VBLK_MAX_DEVICES        4
+#define VBLK_MAX_SECTORS        64              /* 32KB per request */
+
+/* Header, one segment per page of the buffer (it need not be aligned), status */
+#define VBLK_MAX_SEGS           ((VBLK_MAX_SECTORS * 512) / 4096 + 3)
+
+typedef struct {
+    uint32_t    type;                           /* VIRTIO_BLK_T_* */
+    uint32_t    reserved;
+    uint64_t    sector;
+} PACKED virtio_blk_req_hdr_t;
+
+/**
+ * Probe the virtio-blk devices found by pci_init() and register them.
+ *
+ * @return Number of devices registered
+ */
+int virtio_blk_init(void);
+
+#endif /* CHANUX_VIRTIO_BLK_H */
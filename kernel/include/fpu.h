@@ -0,0 +1,114 @@
+/**
+ * =============================================================================
+ * Chanux OS - FPU/SSE Support
+ * =============================================================================
+ * The kernel is built with -mno-sse, so the compiler never touches the
+ * FPU or XMM registers on its own. Code that wants them anyway (the SSE2
+ * memcpy/memset kernels in lib/string.c) brackets its use with
+ * kernel_fpu_begin()/kernel_fpu_end(), which save whatever state the
+ * registers hold (normally a user process's) and put it back afterwards.
+ *
+ * Typical use:
+ *   if (fpu_available()) {
+ *       kernel_fpu_begin();
+ *       ... SSE instructions ...
+ *       kernel_fpu_end();
+ *   }
+ *
+ * The section runs with interrupts disabled and must not nest or sleep.
+ *
+ * User processes get the FPU lazily. CR0.TS stays set while a process has
+ * not touched the FPU since it was switched in, and its first FPU or SSE
+ * instruction raises #NM; fpu_handle_nm() then loads the process's saved
+ * state (unless this CPU's registers still hold it) and clears TS. Only a
+ * process that used the FPU during its time slice has it saved on the way
+ * out (XSAVEOPT, XSAVE or FXSAVE), so one that never does pays nothing.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_FPU_H
+#define CHANUX_FPU_H
+
+#include "types.h"
+#include "interrupts/isr.h"
+
+struct process;
+
+/* FXSAVE/FXRSTOR image: x87, MXCSR and XMM0-15 */
+#define FPU_STATE_SIZE      512
+
+typedef struct {
+    uint8_t             bytes[FPU_STATE_SIZE];
+} ALIGNED(16) fpu_state_t;
+
+/* =============================================================================
+ * FPU API
+ * =============================================================================
+ */
+
+/**
+ * Detect FXSR/SSE2 (and XSAVE/AVX) and enable them on the boot CPU
+ * Call after mm_init(); process state areas come from a slab cache.
+ */
+void fpu_init(void);
+
+/**
+ * Enable the FPU and SSE on the calling CPU (APs, from ap_main())
+ */
+void fpu_init_cpu(void);
+
+/**
+ * Check whether SSE2 may be used inside kernel_fpu_begin()/end()
+ */
+bool fpu_available(void);
+
+/**
+ * Start using FPU/SSE registers in the kernel
+ * Disables interrupts and saves the current register contents.
+ */
+void kernel_fpu_begin(void);
+
+/**
+ * Stop using FPU/SSE registers: restore what kernel_fpu_begin() saved
+ * and the interrupt flag.
+ */
+void kernel_fpu_end(void);
+
+/* =============================================================================
+ * Process FPU State
+ * =============================================================================
+ */
+
+/**
+ * Handle #NM (device not available): give the current process the FPU.
+ * Allocates its state area on first use; a process that cannot get one
+ * is terminated.
+ */
+void fpu_handle_nm(registers_t* regs);
+
+/**
+ * Save the outgoing process's FPU state if it used the FPU this time
+ * slice, and set CR0.TS for whatever runs next.
+ * Called by schedule() with interrupts disabled, before context_switch().
+ *
+ * @param prev Process being switched out (the current one)
+ */
+void fpu_switch_out(struct process* prev);
+
+/**
+ * Copy a process's FPU state for a fork() child.
+ *
+ * @param proc The current process
+ * @param copy Set to the copy, or NULL if proc never used the FPU
+ * @return false if memory ran out
+ */
+bool fpu_state_clone(struct process* proc, void** copy);
+
+/**
+ * Free a state area from fpu_state_clone() or fpu_handle_nm().
+ *
+ * @param state State area, or NULL
+ */
+void fpu_state_free(void* state);
+
+#endif /* CHANUX_FPU_H */
@@ -0,0 +1,55 @@
+/*
+ * dcache.h - Directory entry cache
+ *
+ * Remembers the result of looking up a name in a directory, keyed by
+ * (directory inode, name), so resolving a hot path costs one hash probe
+ * per component instead of a scan of the directory's blocks. Negative
+ * entries remember names that do not exist.
+ *
+ * The filesystem keeps the cache exact: every directory change updates
+ * or drops the entries it affects. All calls are made with the VFS lock
+ * held.
+ */
+
+#ifndef _KERNEL_FS_DCACHE_H
+#define _KERNEL_FS_DCACHE_H
+
+#include "../types.h"
+
+#define DCACHE_ENTRIES      256     /* Cached names (recycled CLOCK-style) */
+#define DCACHE_BUCKETS      128     /* Hash chains (power of two) */
+#define DCACHE_NAME_MAX     60      /* Longer names are never cached */
+
+/* dcache_lookup() results */
+#define DCACHE_MISS         0       /* Not cached - look in the directory */
+#define DCACHE_HIT          1       /* Name exists (inode set) */
+#define DCACHE_NEGATIVE     2       /* Name known not to exist */
+
+typedef struct dentry {
+    struct dentry*  hash_next;      /* Next entry in the same bucket */
+    uint32_t        parent;         /* Directory inode number */
+    uint32_t        inode;          /* Inode the name refers to */
+    uint32_t        hash;           /* Hash of (parent, name) */
+    uint8_t         name_len;
+    bool            in_use;
+    bool            negative;       /* Name does not exist */
+    bool            referenced;     /* Used since the CLOCK hand last passed */
+    char            name[DCACHE_NAME_MAX];
+} dentry_t;
+
+/* Forget everything (filesystem formatted) */
+void dcache_init(void);
+
+/* Look up 'name' (len bytes) in directory 'parent' */
+int dcache_lookup(uint32_t parent, const char* name, size_t len, uint32_t* inode_out);
+
+/* Record that 'name' refers to 'inode' */
+void dcache_add(uint32_t parent, const char* name, size_t len, uint32_t inode);
+
+/* Record that 'name' does not exist */
+void dcache_add_negative(uint32_t parent, const char* name, size_t len);
+
+/* Drop every entry of a directory that is going away */
+void dcache_purge_dir(uint32_t parent);
+
+#endif /* _KERNEL_FS_DCACHE_H */
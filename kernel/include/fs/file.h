@@ -9,8 +9,9 @@
 
 #include "../types.h"
 
-/* Maximum open files per process */
-#define MAX_FD_PER_PROCESS  16
+/* Open files per process: tables start with FD_TABLE_INITIAL slots and double */
+#define MAX_FD_PER_PROCESS  1024
+#define FD_TABLE_INITIAL    64      /* One word of the open-fd bitmap */
 
 /* Standard file descriptors */
 #define FD_STDIN    0
@@ -36,9 +37,11 @@
 #define FILE_TYPE_REGULAR   0   /* Regular file */
 #define FILE_TYPE_DIR       1   /* Directory */
 #define FILE_TYPE_CONSOLE   2   /* Console (stdin/stdout/stderr) */
+#define FILE_TYPE_PIPE      3   /* One end of a pipe (fs/pipe.h) */
 
 /* Forward declarations */
 struct vnode;
+struct pipe;
 
 /*
  * Open file entry (system-wide table)
@@ -53,34 +56,57 @@ typedef struct file {
     uint32_t        inode;          /* Inode number (0 for special files) */
     uint32_t        type;           /* FILE_TYPE_* */
     struct vnode*   vnode;          /* VFS node pointer (NULL for console) */
+    struct pipe*    pipe;           /* Pipe (FILE_TYPE_PIPE only) */
 } file_t;
 
+/*
+ * Descriptor array
+ *
+ * The fd -> file_t slots and a bitmap of the open ones, so the lowest
+ * free fd is a find-first-zero over a few words. Grows by doubling.
+ * fork() shares the array between parent and child; the first of them to
+ * change its descriptors gets a private copy (copy-on-write). The array
+ * holds one file_t reference per open slot, however many tables share it.
+ */
+typedef struct fd_files {
+    uint32_t    shares;                         /* Tables using this array */
+    uint32_t    capacity;                       /* Slots (multiple of 64) */
+    uint32_t    num_open;                       /* Count of open descriptors */
+    uint64_t*   open_map;                       /* Bit per open slot */
+    file_t**    entries;                        /* File descriptor entries */
+} fd_files_t;
+
 /*
  * Per-process file descriptor table
  *
  * Each process has its own fd table mapping fd numbers to file_t pointers.
+ * Threads of one process share it, one reference each.
  */
 typedef struct fd_table {
-    file_t*     entries[MAX_FD_PER_PROCESS];    /* File descriptor entries */
-    uint32_t    num_open;                        /* Count of open descriptors */
+    fd_files_t* files;                          /* Descriptors (maybe shared) */
+    uint32_t    ref_count;                      /* Threads using this table */
 } fd_table_t;
 
 /* File descriptor table management */
 fd_table_t* fd_table_create(void);
 void fd_table_destroy(fd_table_t* table);
-fd_table_t* fd_table_clone(fd_table_t* src);    /* For fork */
+fd_table_t* fd_table_clone(fd_table_t* src);    /* For fork (shares the array) */
+void fd_table_ref(fd_table_t* table);           /* Share with a new thread */
+void fd_table_unref(fd_table_t* table);         /* Destroy when the last user goes */
 
 /* File descriptor operations */
-int fd_alloc(fd_table_t* table);                 /* Allocate lowest available fd */
+int fd_alloc(fd_table_t* table);                 /* Lowest available fd, room made for it */
 void fd_free(fd_table_t* table, int fd);         /* Free a file descriptor */
 file_t* fd_get_file(fd_table_t* table, int fd);  /* Get file from fd */
-int fd_set_file(fd_table_t* table, int fd, file_t* file);
+file_t* fd_get_file_ref(fd_table_t* table, int fd); /* Referenced, takes the VFS lock */
+int fd_set_file(fd_table_t* table, int fd, file_t* file); /* Cannot fail after fd_alloc() */
 
 /* Open file table (system-wide) */
 file_t* file_alloc(void);
 void file_free(file_t* file);
 void file_ref(file_t* file);        /* Increment reference count */
 void file_unref(file_t* file);      /* Decrement reference count, free if 0 */
+void file_put(file_t* file);        /* file_unref() under the VFS lock */
 
 /* Standard I/O initialization */
 int fd_init_stdio(fd_table_t* table);  /* Set up fd 0, 1, 2 for console */
@@ -0,0 +1,46 @@
+/**
+ * =============================================================================
+ * Chanux OS - Initramfs
+ * =============================================================================
+ * A cpio "newc" archive (packed by scripts/mkinitramfs.c from build/
+ * initramfs/) that Stage 2 loads after the kernel and reports in
+ * boot_info_t. fs_init() unpacks it into the root RAMFS, so programs and
+ * data ship on the disk instead of inside the kernel binary.
+ *
+ * Unpacking copies as little as it can: whole pages of file data that
+ * start on a page boundary of the archive (mkinitramfs puts the data of
+ * every file of a page or more there) become the file's blocks as they
+ * are, with ramfs_adopt_pages(); only the last partial page of such a
+ * file, and files that start elsewhere, are written with one
+ * ramfs_write() each. The archive pages that were not taken over go back
+ * to the PMM afterwards.
+ *
+ * Directories and regular files are unpacked, anything else is skipped.
+ * A file that already exists (restored from a snapshot) is replaced; a
+ * directory that exists is kept.
+ * =============================================================================
+ */
+
+#ifndef _KERNEL_FS_INITRAMFS_H
+#define _KERNEL_FS_INITRAMFS_H
+
+#include "../types.h"
+
+/* newc entry header: magic, then 13 fields of 8 hex digits */
+#define INITRAMFS_MAGIC         "070701"
+#define INITRAMFS_HEADER_SIZE   110
+#define INITRAMFS_TRAILER       "TRAILER!!!"
+
+/**
+ * Unpack the archive into the root filesystem and free its pages.
+ * Call once, after vfs_init() and before anything else uses the VFS.
+ *
+ * @param start Physical address of the archive (page-aligned, in the
+ *              direct map, reserved in the PMM)
+ * @param size  Archive size in bytes
+ * @return 0 on success, -1 if the archive is malformed (entries before
+ *         the bad one stay unpacked)
+ */
+int initramfs_unpack(phys_addr_t start, size_t size);
+
+#endif /* _KERNEL_FS_INITRAMFS_H */
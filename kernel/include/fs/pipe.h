@@ -0,0 +1,70 @@
+/*
+ * pipe.h - Anonymous pipes
+ *
+ * A pipe is a one-page ring buffer shared by two open files: the read
+ * end (O_RDONLY) and the write end (O_WRONLY). Readers sleep while it is
+ * empty and writers while it is full; reading an empty pipe whose write
+ * ends are all closed returns 0 (end of file), and writing to a pipe
+ * nobody can read fails with -EPIPE.
+ */
+
+#ifndef _KERNEL_FS_PIPE_H
+#define _KERNEL_FS_PIPE_H
+
+#include "../types.h"
+#include "../proc/wait.h"
+#include "file.h"
+
+/* Ring buffer size (one page frame, power of two) */
+#define PIPE_SIZE       4096
+#define PIPE_MASK       (PIPE_SIZE - 1)
+
+/*
+ * The ring is single-producer/single-consumer: only the writer holding
+ * writer_busy moves 'head' and only the reader holding reader_busy moves
+ * 'tail', so data moves between them without a shared lock. The busy
+ * flags only serialize several readers (or writers) of the same pipe,
+ * e.g. after fork().
+ */
+typedef struct pipe {
+    uint8_t*            buf;            /* PIPE_SIZE bytes */
+    volatile uint32_t   head;           /* Bytes ever written (free-running) */
+    volatile uint32_t   tail;           /* Bytes ever read (free-running) */
+    volatile uint32_t   reader_busy;    /* A reader is copying out */
+    volatile uint32_t   writer_busy;    /* A writer is copying in */
+    volatile uint32_t   readers;        /* Open read-end files */
+    volatile uint32_t   writers;        /* Open write-end files */
+    wait_queue_t        read_wq;        /* Waiting for data or reader_busy */
+    wait_queue_t        write_wq;       /* Waiting for room or writer_busy */
+} pipe_t;
+
+/*
+ * Create a pipe and its two open files (vfs_lock() held).
+ * Returns 0 on success, -1 if out of memory.
+ */
+int pipe_create(file_t** read_end, file_t** write_end);
+
+/*
+ * Read up to 'count' bytes, sleeping until there is at least one byte or
+ * no writer is left. Call without vfs_lock(): the caller may sleep.
+ *
+ * 'user' says whether 'buf' is a user address (copied with copy_to_user()).
+ * Returns bytes read (0 at end of file) or a negative error code.
+ */
+int64_t pipe_read(file_t* file, void* buf, size_t count, bool user);
+
+/*
+ * Write 'count' bytes, sleeping while the pipe is full. The whole write
+ * goes in before another writer's, so writes are never interleaved.
+ * Returns bytes written (short only on -EPIPE or -EFAULT part way) or a
+ * negative error code.
+ */
+int64_t pipe_write(file_t* file, const void* buf, size_t count, bool user);
+
+/* Bytes waiting to be read (unlocked snapshot) */
+uint32_t pipe_available(file_t* file);
+
+/* Drop an end when its file is freed (called by file_free()) */
+void pipe_release(file_t* file);
+
+#endif /* _KERNEL_FS_PIPE_H */
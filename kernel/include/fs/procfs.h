@@ -0,0 +1,30 @@
+/*
+ * procfs.h - Kernel statistics filesystem
+ *
+ * A read-only filesystem mounted on /proc whose files are generated when
+ * they are read, so a monitor can poll them with plain open/read/close:
+ *
+ *   /proc/meminfo       Physical memory (pmm_get_stats())
+ *   /proc/heapinfo      Kernel heap (heap_get_stats())
+ *   /proc/sched         Run queues and process counts
+ *   /proc/vnodes        Vnode cache (vfs_vnode_stats())
+ *   /proc/<pid>/stat    One process: state, priority, CPU, total_ticks
+ *
+ * Every file is "key: value" lines. A read at offset 0 takes a fresh
+ * snapshot; reads further on continue the snapshot of the same open file,
+ * so a reader with a small buffer still sees consistent numbers. Files
+ * report a size of 0, as they have none until read.
+ */
+
+#ifndef _KERNEL_FS_PROCFS_H
+#define _KERNEL_FS_PROCFS_H
+
+#include "../types.h"
+
+#define PROCFS_MOUNT        "/proc"
+#define PROCFS_TEXT_MAX     2048    /* Largest generated file */
+
+/* Create /proc if needed and mount procfs on it (after vfs_init()) */
+void procfs_init(void);
+
+#endif /* _KERNEL_FS_PROCFS_H */
@@ -12,13 +12,22 @@
 
 /* RAMFS constants */
 #define RAMFS_MAGIC         0x52414D46  /* "RAMF" in little-endian */
-#define RAMFS_VERSION       1
-#define RAMFS_MAX_FILES     256         /* Maximum number of files/dirs */
+#define RAMFS_VERSION       2
 #define RAMFS_MAX_FILENAME  60          /* Maximum filename length */
 #define RAMFS_BLOCK_SIZE    4096        /* Block size (matches page size) */
-#define RAMFS_MAX_BLOCKS    1024        /* 4MB total filesystem size */
 #define RAMFS_ROOT_INODE    0           /* Root directory inode number */
 
+/*
+ * Disk size, chosen when ramfs_init() mounts the filesystem: RAMFS_SIZE_MB
+ * (make RAMFS_MB=<n>) if set, otherwise half the free physical memory,
+ * clamped to [RAMFS_MIN_SIZE, RAMFS_MAX_SIZE]. Blocks only take a page
+ * frame while they are in use, so a large disk costs nothing until filled.
+ */
+#define RAMFS_MIN_SIZE          (4ULL * 1024 * 1024)
+#define RAMFS_MAX_SIZE          (1024ULL * 1024 * 1024)
+#define RAMFS_BYTES_PER_INODE   16384       /* One inode per 4 blocks */
+#define RAMFS_MIN_INODES        256
+
 /* Inode types */
 #define INODE_TYPE_FREE     0           /* Unused inode */
 #define INODE_TYPE_FILE     1           /* Regular file */
@@ -37,11 +46,24 @@
 /* Number of direct block pointers per inode */
 #define RAMFS_DIRECT_BLOCKS 12
 
+/*
+ * File block map (ext2-style): logical blocks 0-11 are direct, the next
+ * 1024 are listed in the single indirect block, and the rest in the
+ * blocks listed by the double indirect block. Indirect blocks belong to
+ * one file and are never shared.
+ */
+#define RAMFS_PTRS_PER_BLOCK    1024    /* Block numbers per indirect block */
+#define RAMFS_INDIRECT_FIRST    RAMFS_DIRECT_BLOCKS
+#define RAMFS_DINDIRECT_FIRST   (RAMFS_INDIRECT_FIRST + RAMFS_PTRS_PER_BLOCK)
+#define RAMFS_MAX_FILE_BLOCKS   (RAMFS_DINDIRECT_FIRST + RAMFS_PTRS_PER_BLOCK * RAMFS_PTRS_PER_BLOCK)
+#define RAMFS_MAX_FILE_SIZE     ((uint64_t)RAMFS_MAX_FILE_BLOCKS * RAMFS_BLOCK_SIZE)
+
 /*
  * RAMFS Superblock
  *
  * Located at block 0 of the RAM disk.
- * Contains filesystem metadata and allocation bitmaps.
+ * Contains filesystem metadata and where the variable-sized regions
+ * (allocation bitmaps, inode table) start; see the layout below.
  */
 typedef struct {
     uint32_t    magic;                              /* RAMFS_MAGIC */
@@ -54,16 +76,19 @@ typedef struct {
     uint32_t    root_inode;                         /* Root directory inode number */
     uint64_t    created_time;                       /* Creation timestamp (ticks) */
     uint64_t    mount_time;                         /* Last mount timestamp */
-    uint8_t     block_bitmap[RAMFS_MAX_BLOCKS / 8]; /* Block allocation bitmap */
-    uint8_t     inode_bitmap[RAMFS_MAX_FILES / 8];  /* Inode allocation bitmap */
-    uint8_t     reserved[3896];                     /* Pad to 4096 bytes */
-} PACKED ramfs_superblock_t;
+    uint32_t    block_bitmap_start;                 /* First block of the block bitmap */
+    uint32_t    inode_bitmap_start;                 /* First block of the inode bitmap */
+    uint32_t    inode_table_start;                  /* First block of the inode table */
+    uint32_t    data_start;                         /* First data block */
+    uint8_t     reserved[4032];                     /* Pad to 4096 bytes */
+} PACKED ALIGNED(8) ramfs_superblock_t;
 
 /*
  * RAMFS Inode
  *
  * Represents a file or directory in the filesystem.
- * Size: 128 bytes (32 inodes per block)
+ * Size: 128 bytes (32 inodes per block), every field naturally aligned
+ * so block pointers can be addressed directly
  */
 typedef struct {
     uint32_t    type;                           /* INODE_TYPE_* */
@@ -75,12 +100,14 @@ typedef struct {
     uint64_t    modified;                       /* Last modification time */
     uint64_t    accessed;                       /* Last access time */
     uint32_t    link_count;                     /* Number of hard links */
-    uint32_t    block_count;                    /* Number of allocated blocks */
+    uint32_t    block_count;                    /* Number of allocated data blocks */
     uint32_t    blocks[RAMFS_DIRECT_BLOCKS];    /* Direct block pointers */
-    uint32_t    indirect;                       /* Single indirect block (future) */
+    uint32_t    indirect;                       /* Single indirect block */
     uint32_t    parent;                         /* Parent directory inode number */
+    uint32_t    double_indirect;                /* Double indirect block */
+    uint32_t    number;                         /* This inode's number */
     uint8_t     reserved[4];                    /* Pad to 128 bytes */
-} PACKED ramfs_inode_t;
+} PACKED ALIGNED(8) ramfs_inode_t;
 
 /*
  * RAMFS Directory Entry
@@ -97,16 +124,51 @@ typedef struct {
 } PACKED ramfs_dirent_t;
 
 /*
- * RAMFS Memory Layout
+ * RAMFS Directory Index (htree-style)
  *
- * Block 0:       Superblock
- * Blocks 1-8:    Inode table (256 inodes * 128 bytes = 8 blocks)
- * Blocks 9+:     Data blocks
+ * A directory's blocks[0] is its index root: the leaf blocks sorted by
+ * the lowest name hash each one holds. Leaf i stores every name whose
+ * hash is in [entries[i].hash, entries[i + 1].hash), so a lookup is a
+ * binary search of the root and a scan of one leaf. A full leaf is split
+ * at its median hash. The other direct block pointers of a directory are
+ * unused; block_count counts the root and its leaves.
+ */
+#define RAMFS_DX_LEAF_ENTRIES   63          /* Dirents per leaf block */
+#define RAMFS_DX_MAX_LEAVES     511         /* Leaves per directory */
+#define RAMFS_DX_MAX_ENTRIES    (RAMFS_DX_LEAF_ENTRIES * RAMFS_DX_MAX_LEAVES)
+
+typedef struct {
+    uint32_t    hash;                           /* Lowest hash in the leaf */
+    uint32_t    block;                          /* Leaf block number */
+} PACKED ramfs_dx_entry_t;
+
+typedef struct {
+    uint32_t            count;                  /* Leaves in use (>= 1) */
+    uint32_t            reserved;
+    ramfs_dx_entry_t    entries[RAMFS_DX_MAX_LEAVES];
+} PACKED ramfs_dx_root_t;
+
+typedef struct {
+    uint32_t        count;                      /* Entries in use, packed at the front */
+    uint8_t         reserved[60];               /* Pad the header to one dirent */
+    ramfs_dirent_t  entries[RAMFS_DX_LEAF_ENTRIES];
+} PACKED ramfs_dx_leaf_t;
+
+/*
+ * RAMFS Memory Layout (sizes fixed at format time)
+ *
+ * Block 0:                 Superblock
+ * block_bitmap_start...:   Block bitmap (one bit per block, 64-bit words)
+ * inode_bitmap_start...:   Inode bitmap
+ * inode_table_start...:    Inode table (32 inodes per block)
+ * data_start...:           Data blocks
+ *
+ * The superblock and bitmaps are backed by one physically contiguous
+ * run of frames, so each bitmap is one array; inode table and data
+ * blocks get a frame when first used.
  */
 #define RAMFS_SUPERBLOCK_BLOCK  0
-#define RAMFS_INODE_START_BLOCK 1
-#define RAMFS_INODE_BLOCKS      8   /* Holds 256 inodes */
-#define RAMFS_DATA_START_BLOCK  9
+#define RAMFS_BITS_PER_BLOCK    (RAMFS_BLOCK_SIZE * 8)
 
 /* Inodes per block */
 #define RAMFS_INODES_PER_BLOCK  (RAMFS_BLOCK_SIZE / sizeof(ramfs_inode_t))
@@ -114,16 +176,57 @@ typedef struct {
 /* Directory entries per block */
 #define RAMFS_DIRENTS_PER_BLOCK (RAMFS_BLOCK_SIZE / sizeof(ramfs_dirent_t))
 
+/*
+ * Snapshot Image (ramfs_snapshot_take() / ramfs_snapshot_load())
+ *
+ * A copy of the blocks in use, written to a block device so a warm boot
+ * can load the filesystem back instead of formatting it. In 4KB image
+ * blocks:
+ *
+ * Block 0:     Header (written last; a torn save leaves no valid header)
+ * Then:        Extent table: runs of disk blocks that were saved
+ * Then:        Owner count (block_refs) of each saved block, one byte
+ * Then:        The saved blocks, in extent order
+ *
+ * Saved are the superblock and bitmaps (always the first extent), inode
+ * table blocks with a frame, and data blocks some file owns. Both ways go
+ * through the buffer cache (bcache), which moves runs of adjacent image
+ * blocks as one request and reads ahead on load, so the cost is the I/O.
+ */
+#define RAMFS_IMAGE_MAGIC       0x474D4953464D4152ULL   /* "RAMFSIMG" */
+#define RAMFS_IMAGE_VERSION     1
+/* Snapshot disks, in order of preference: virtio disk, ATA primary slave */
+#define RAMFS_SNAPSHOT_DEVICES  { "vda", "hdb" }
+
+typedef struct {
+    uint32_t    first;                          /* First disk block */
+    uint32_t    count;                          /* Blocks in the run */
+} PACKED ramfs_image_extent_t;
+
+typedef struct {
+    uint64_t    magic;                          /* RAMFS_IMAGE_MAGIC */
+    uint32_t    version;                        /* RAMFS_IMAGE_VERSION */
+    uint32_t    total_blocks;                   /* Size of the imaged disk */
+    uint32_t    extent_count;                   /* Entries in the extent table */
+    uint32_t    saved_blocks;                   /* Disk blocks in the image */
+    uint32_t    table_blocks;                   /* Image blocks of extents + owner counts */
+    uint32_t    checksum;                       /* FNV-1a of those table blocks */
+    uint64_t    saved_time;                     /* Save timestamp (ticks) */
+    uint8_t     reserved[4056];                 /* Pad to 4096 bytes */
+} PACKED ALIGNED(8) ramfs_image_header_t;
+
 /*
  * RAM Disk structure
  *
- * Represents the underlying block device (memory region).
+ * Represents the underlying block device: one page frame per block,
+ * allocated from the PMM when the block is first used.
  */
 typedef struct {
-    void*       data;           /* RAM disk memory region */
+    uint32_t*   frames;         /* Frame number backing each block (0: none) */
     size_t      size;           /* Total size in bytes */
     uint32_t    block_count;    /* Number of blocks */
     uint32_t    block_size;     /* Block size */
+    uint32_t    backed_blocks;  /* Blocks that have a frame */
     bool        initialized;    /* Is device ready? */
 } ramdisk_t;
 
@@ -136,11 +239,24 @@ int ramdisk_init(size_t size_bytes);
 int ramdisk_read_block(uint32_t block_num, void* buffer);
 int ramdisk_write_block(uint32_t block_num, const void* buffer);
 void* ramdisk_get_block_ptr(uint32_t block_num);
+phys_addr_t ramdisk_get_block_phys(uint32_t block_num);
+int ramdisk_back_block(uint32_t block_num);
+int ramdisk_back_range(uint32_t first, uint32_t count);
+void ramdisk_release_block(uint32_t block_num);
 
 /* RAMFS initialization and formatting */
 int ramfs_init(void);
 int ramfs_format(void);
 
+/* Snapshot image on a block device */
+struct blkdev;
+typedef struct ramfs_snapshot ramfs_snapshot_t;
+struct blkdev* ramfs_snapshot_device(void);
+ramfs_snapshot_t* ramfs_snapshot_take(struct blkdev* dev);     /* VFS lock held */
+int ramfs_snapshot_write(ramfs_snapshot_t* snap);              /* VFS lock not held */
+void ramfs_snapshot_drop(ramfs_snapshot_t* snap);              /* VFS lock held */
+int ramfs_snapshot_load(struct blkdev* dev);
+
 /* Inode operations */
 int ramfs_alloc_inode(uint32_t type, uint32_t* inode_num);
 void ramfs_free_inode(uint32_t inode_num);
@@ -155,6 +271,15 @@ void* ramfs_get_block(uint32_t block_num);
 int64_t ramfs_read(ramfs_inode_t* inode, void* buf, size_t count, uint64_t offset);
 int64_t ramfs_write(ramfs_inode_t* inode, const void* buf, size_t count, uint64_t offset);
 int ramfs_truncate(ramfs_inode_t* inode, uint64_t new_size);
+int64_t ramfs_copy_range(ramfs_inode_t* dst, uint64_t dst_offset,
+                         ramfs_inode_t* src, uint64_t src_offset, size_t count);
+uint32_t ramfs_adopt_pages(ramfs_inode_t* inode, phys_addr_t frames, uint32_t count);
+
+/* Memory mapping (data blocks are page frames) */
+int ramfs_map_pages(ramfs_inode_t* inode, uint32_t first, uint32_t count, bool shared,
+                    uint32_t* blocks, phys_addr_t* frames);
+int ramfs_ref_pages(const uint32_t* blocks, uint32_t count);
+void ramfs_unmap_pages(const uint32_t* blocks, uint32_t count);
 
 /* Directory operations */
 int ramfs_dir_lookup(ramfs_inode_t* dir, const char* name, uint32_t* inode_out);
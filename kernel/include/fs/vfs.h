@@ -2,7 +2,7 @@
  * vfs.h - Virtual Filesystem layer
  *
  * Provides a unified interface for filesystem operations.
- * Currently supports RAMFS, designed for future extension.
+ * RAMFS is the root; procfs is mounted on /proc.
  */
 
 #ifndef _KERNEL_FS_VFS_H
@@ -51,6 +51,7 @@ typedef struct vnode {
     ramfs_inode_t*      inode;          /* Pointer to underlying inode */
     struct vfs_ops*     ops;            /* Filesystem operations */
     void*               fs_data;        /* Filesystem-specific data */
+    struct vnode*       hash_next;      /* Next vnode in the same hash bucket */
 } vnode_t;
 
 /*
@@ -68,30 +69,87 @@ typedef struct vfs_ops {
     int (*readdir)(vnode_t* dir, uint32_t index, ramfs_dirent_t* entry);
     int (*stat)(vnode_t* vn, stat_t* buf);
     int (*truncate)(vnode_t* vn, uint64_t size);
+    /* Optional: copy between two vnodes of this filesystem */
+    int64_t (*copy_range)(vnode_t* dst, uint64_t dst_offset,
+                          vnode_t* src, uint64_t src_offset, size_t count);
+    /* Optional: pin file pages for mmap() (page ids name them to unpin) */
+    int (*map_pages)(vnode_t* vn, uint32_t first, uint32_t count, bool shared,
+                     uint32_t* pages, phys_addr_t* frames);
+    int (*ref_pages)(vnode_t* vn, const uint32_t* pages, uint32_t count);
+    void (*unmap_pages)(vnode_t* vn, const uint32_t* pages, uint32_t count);
+    /* Optional: free fs_data when the vnode is freed */
+    void (*release)(vnode_t* vn);
 } vfs_ops_t;
 
+/* Vnode cache statistics (vfs_vnode_stats()) */
+typedef struct {
+    uint32_t    live;           /* Allocated vnodes */
+    uint32_t    hashed;         /* Of those, RAMFS vnodes in the hash */
+    uint32_t    buckets;        /* Hash buckets */
+    uint32_t    longest_chain;  /* Longest hash chain */
+} vfs_vnode_stats_t;
+
 /* Global root vnode (defined in vfs.c) */
 extern vnode_t* g_root_vnode;
 
 /* VFS initialization */
 void vfs_init(void);
 
+/*
+ * One lock for the VFS layer, the file table and descriptor tables.
+ * Callers that may run concurrently (system calls, process creation and
+ * exit) hold it around VFS and fd_table calls; the VFS itself does not
+ * take it. Returns the saved interrupt flag for vfs_unlock().
+ */
+uint64_t vfs_lock(void);
+void vfs_unlock(uint64_t flags);
+
 /* Vnode management */
 vnode_t* vnode_alloc(void);
 void vnode_free(vnode_t* vn);
 void vnode_ref(vnode_t* vn);
 void vnode_unref(vnode_t* vn);
+void vfs_vnode_stats(vfs_vnode_stats_t* stats);
+
+/*
+ * Mount a filesystem, given its root vnode, on an existing RAMFS
+ * directory. Lookups at or below the mount point go to the mounted
+ * filesystem.
+ */
+int vfs_mount(const char* path, vnode_t* root);
 
 /* Path operations */
 int vfs_lookup(const char* path, vnode_t** result);
 int vfs_lookup_parent(const char* path, vnode_t** parent, char* name, size_t name_size);
 
+/*
+ * The *_at variants resolve a relative path from the directory 'dir' one
+ * component at a time, with "." and ".." (and mount points) handled on
+ * the way, so no absolute path string is ever built. Absolute paths, or a
+ * NULL 'dir', behave as the plain calls.
+ */
+int vfs_lookup_at(vnode_t* dir, const char* path, vnode_t** result);
+int vfs_lookup_parent_at(vnode_t* dir, const char* path, vnode_t** parent,
+                         char* name, size_t name_size);
+int vfs_open_at(vnode_t* dir, const char* path, uint32_t flags, file_t** result);
+int vfs_stat_at(vnode_t* dir, const char* path, stat_t* buf);
+
 /* File operations */
 int vfs_open(const char* path, uint32_t flags, file_t** result);
 int vfs_close(file_t* file);
 int64_t vfs_read(file_t* file, void* buf, size_t count);
 int64_t vfs_write(file_t* file, const void* buf, size_t count);
 int64_t vfs_lseek(file_t* file, int64_t offset, int whence);
+int64_t vfs_pread(file_t* file, void* buf, size_t count, uint64_t offset);
+int64_t vfs_pwrite(file_t* file, const void* buf, size_t count, uint64_t offset);
+int64_t vfs_copy_range(file_t* in, uint64_t in_offset,
+                       file_t* out, uint64_t out_offset, size_t count);
+
+/* Memory mapping */
+int vfs_map_pages(vnode_t* vn, uint32_t first, uint32_t count, bool shared,
+                  uint32_t* pages, phys_addr_t* frames);
+int vfs_ref_pages(vnode_t* vn, const uint32_t* pages, uint32_t count);
+void vfs_unmap_pages(vnode_t* vn, const uint32_t* pages, uint32_t count);
 
 /* Stat operations */
 int vfs_stat(const char* path, stat_t* buf);
@@ -106,6 +164,10 @@ int vfs_readdir(file_t* dir, ramfs_dirent_t* entry, uint32_t index);
 int vfs_create(const char* path, uint32_t type);
 int vfs_unlink(const char* path);
 
+/* Snapshot the filesystem to its snapshot disk (loaded on the next boot);
+ * takes the VFS lock itself */
+int vfs_sync(void);
+
 /* Path utilities (defined in path.c) */
 int path_is_absolute(const char* path);
 const char* path_basename(const char* path);
@@ -152,11 +152,20 @@ typedef struct {
  */
 void gdt_init(void);
 
+/**
+ * Build and load the GDT and TSS of one CPU.
+ * Called by gdt_init() for the boot CPU and by each AP as it starts.
+ * GS must already point at the CPU's data (cpu_this()).
+ *
+ * @param cpu CPU index
+ */
+void gdt_init_cpu(uint32_t cpu);
+
 /**
  * Get the kernel stack pointer for ring 0 transitions.
  * Used when switching from user mode to kernel mode.
  *
- * @return Current RSP0 value from TSS
+ * @return Current RSP0 value from this CPU's TSS
  */
 uint64_t gdt_get_rsp0(void);
 
@@ -164,7 +173,7 @@ uint64_t gdt_get_rsp0(void);
  * Set the kernel stack pointer for ring 0 transitions.
  * Called during task switching to update the kernel stack.
  *
- * @param rsp0 New RSP0 value for TSS
+ * @param rsp0 New RSP0 value for this CPU's TSS
  */
 void gdt_set_rsp0(uint64_t rsp0);
 
@@ -123,6 +123,12 @@ typedef struct {
  */
 void idt_init(void);
 
+/**
+ * Load the IDT built by idt_init() on the calling CPU.
+ * Used by application processors as they start.
+ */
+void idt_load_cpu(void);
+
 /**
  * Set an IDT entry.
  *
@@ -4,9 +4,21 @@
  * =============================================================================
  * Provides IRQ handler registration and dispatch for hardware interrupts.
  *
- * Hardware IRQs (0-15) are mapped to vectors 32-47 after PIC remapping.
- * Device drivers register their handlers here, and the common irq_handler()
- * dispatches to the appropriate registered handler.
+ * Every vector from 32 up has its own entry stub, and irq_handler()
+ * dispatches through one handler per vector:
+ *   - Vectors 32-47: ISA IRQs 0-15. They start out on the 8259 PIC and
+ *     move to the I/O APIC with irq_enable_apic(), which can send each
+ *     line to any CPU (irq_set_affinity()).
+ *   - Vectors IRQ_VECTOR_FIRST-IRQ_VECTOR_LAST: handed out by
+ *     irq_alloc_vector() for message-signalled interrupts (PCI MSI/MSI-X),
+ *     which the device writes straight to a local APIC.
+ * Local APIC vectors (timer, IPIs) are passed on to the LAPIC driver.
+ *
+ * Once off the 8259, an interrupt is acknowledged with a single write to
+ * the local APIC's EOI register: before the handler for edge-triggered
+ * sources, after it for level-triggered ones, so a line still asserted
+ * is not delivered again as soon as interrupts come back on. Handlers of
+ * level-triggered lines must therefore return rather than switch away.
  * =============================================================================
  */
 
@@ -22,6 +34,11 @@
 
 #define IRQ_COUNT           16      /* Total number of IRQs (0-15) */
 
+/* Vectors for irq_alloc_vector(), above the local APIC ones (matches idt.asm) */
+#define IRQ_VECTOR_FIRST    0x50
+#define IRQ_VECTOR_LAST     0xEF
+#define IRQ_VECTOR_COUNT    (IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1)
+
 /* =============================================================================
  * IRQ Functions
  * =============================================================================
@@ -48,6 +65,71 @@ void irq_register_handler(uint8_t irq, isr_handler_t handler);
  */
 void irq_unregister_handler(uint8_t irq);
 
+/**
+ * Unmask (enable) an IRQ line, on whichever controller it is on.
+ *
+ * @param irq IRQ number (0-15)
+ */
+void irq_unmask(uint8_t irq);
+
+/**
+ * Mask (disable) an IRQ line.
+ *
+ * @param irq IRQ number (0-15)
+ */
+void irq_mask(uint8_t irq);
+
+/**
+ * Move the ISA IRQs from the 8259 PIC to the I/O APIC.
+ * Lines keep their vectors and mask state and go to the calling (boot)
+ * CPU. Must be called after acpi_init() and lapic_init(), with the PIC
+ * initialized.
+ *
+ * @return 0 on success, -1 if there is no I/O APIC (the PIC stays on)
+ */
+int irq_enable_apic(void);
+
+/**
+ * Check whether external interrupts come through the I/O APIC
+ */
+bool irq_apic_enabled(void);
+
+/**
+ * Deliver an IRQ line to another CPU.
+ * The handler must be safe to run on any CPU.
+ *
+ * @param irq IRQ number (0-15)
+ * @param cpu CPU index (see smp.h)
+ * @return 0 on success, -1 if the CPU is not online, or is not the boot
+ *         CPU while the 8259 is still in use
+ */
+int irq_set_affinity(uint8_t irq, uint32_t cpu);
+
+/**
+ * Get the local APIC ID of an online CPU, for programming an interrupt
+ * destination.
+ *
+ * @param cpu     CPU index
+ * @param apic_id Destination APIC ID
+ * @return 0 on success, -1 if the CPU is not online
+ */
+int irq_cpu_apic_id(uint32_t cpu, uint32_t* apic_id);
+
+/**
+ * Allocate a vector for a message-signalled interrupt.
+ * The handler runs with regs->int_no set to the vector, so one handler
+ * can serve several devices.
+ *
+ * @param handler Handler function
+ * @return Vector, or -1 if all are in use
+ */
+int irq_alloc_vector(isr_handler_t handler);
+
+/**
+ * Free a vector from irq_alloc_vector() (the device must not use it any more)
+ */
+void irq_free_vector(uint8_t vector);
+
 /**
  * Common IRQ handler (called from assembly stubs).
  * Dispatches to registered handlers and sends EOI.
@@ -155,7 +155,16 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+/* Local APIC ISRs (timer, reschedule IPI, TLB shootdown IPI) */
+extern void irq64(void);
+extern void irq65(void);
+extern void irq66(void);
+extern void isr_spurious(void);
+
 /* ISR stub table (array of function pointers) */
 extern uint64_t isr_stub_table[];
 
+/* Device vector stubs, IRQ_VECTOR_FIRST onwards (see irq.h) */
+extern uint64_t irq_vector_stub_table[];
+
 #endif /* CHANUX_ISR_H */
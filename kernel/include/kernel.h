@@ -81,6 +81,8 @@ typedef struct {
 typedef struct {
     uint32_t memory_map_entries;
     memory_map_entry_t memory_map[32];  /* Up to 32 entries */
+    uint64_t initrd_start;              /* Initramfs archive (physical), 0 if none */
+    uint64_t initrd_size;               /* Its size in bytes */
 } PACKED boot_info_t;
 
 /* =============================================================================
@@ -114,6 +116,15 @@ static inline void halt(void) {
     __asm__ volatile ("hlt");
 }
 
+/*
+ * Enable interrupts and halt. STI takes effect after the next instruction,
+ * so an interrupt cannot slip in between a check made with interrupts off
+ * and the HLT.
+ */
+static inline void safe_halt(void) {
+    __asm__ volatile ("sti\n\thlt" : : : "memory");
+}
+
 /* Disable interrupts */
 static inline void cli(void) {
     __asm__ volatile ("cli");
@@ -124,6 +135,27 @@ static inline void sti(void) {
     __asm__ volatile ("sti");
 }
 
+/* Save RFLAGS and disable interrupts, for short critical sections */
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq\n\tpopq %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Restore the interrupt flag saved by irq_save() */
+static inline void irq_restore(uint64_t flags) {
+    if (flags & (1 << 9)) {     /* RFLAGS.IF */
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
+
+/* Check whether interrupts are enabled on this CPU */
+static inline bool interrupts_enabled(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq\n\tpopq %0" : "=r"(flags));
+    return (flags & (1 << 9)) != 0;
+}
+
 /* Read from I/O port (byte) */
 static inline uint8_t inb(uint16_t port) {
     uint8_t value;
@@ -148,6 +180,18 @@ static inline void outw(uint16_t port, uint16_t value) {
     __asm__ volatile ("outw %0, %1" : : "a"(value), "Nd"(port));
 }
 
+/* Read from I/O port (dword) */
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile ("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+/* Write to I/O port (dword) */
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile ("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
 /* I/O wait (small delay) */
 static inline void io_wait(void) {
     outb(0x80, 0);
@@ -160,6 +204,45 @@ static inline uint64_t read_cr0(void) {
     return value;
 }
 
+/* Write CR0 */
+static inline void write_cr0(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+/* CR0 bits */
+#define CR0_MP  (1ULL << 1)     /* WAIT/FWAIT honours TS */
+#define CR0_EM  (1ULL << 2)     /* No x87: FPU instructions raise #UD */
+#define CR0_TS  (1ULL << 3)     /* Task switched: FPU instructions raise #NM */
+#define CR0_NE  (1ULL << 5)     /* Report x87 errors as #MF */
+#define CR0_WP  (1ULL << 16)    /* Write protect: ring 0 honours read-only pages */
+
+/* Read CR4 */
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+/* Write CR4 */
+static inline void write_cr4(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+/* CR4 bits */
+#define CR4_PGE     (1ULL << 7)     /* Global pages */
+#define CR4_OSFXSR  (1ULL << 9)     /* FXSAVE/FXRSTOR and SSE instructions */
+#define CR4_OSXMMEXCPT (1ULL << 10) /* Unmasked SSE exceptions raise #XM */
+#define CR4_PCIDE   (1ULL << 17)    /* Process-context identifiers */
+#define CR4_OSXSAVE (1ULL << 18)    /* XSAVE and XCR0 */
+
+/* Execute CPUID for a leaf/subleaf */
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax,
+                         uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(subleaf));
+}
+
 /* Read CR3 */
 static inline uint64_t read_cr3(void) {
     uint64_t value;
@@ -179,4 +262,31 @@ static inline uint64_t read_cr2(void) {
     return value;
 }
 
+/* Read a model-specific register */
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* Write a model-specific register */
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr"
+                      :
+                      : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+                      : "memory");
+}
+
+/* Read the time-stamp counter */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* Spin-wait hint for busy loops */
+static inline void cpu_pause(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
 #endif /* CHANUX_KERNEL_H */
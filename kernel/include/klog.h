@@ -0,0 +1,119 @@
+/**
+ * =============================================================================
+ * Chanux OS - Kernel Log
+ * =============================================================================
+ * kprintf() and klog() append to the kernel log instead of writing to the
+ * screen. Each CPU has its own ring that only it writes, with interrupts
+ * off, so appending takes no lock: the message is formatted straight into
+ * the ring and published with one store.
+ *
+ * The klogd process takes records from every ring in sequence order,
+ * writes them to the console (VGA and serial) and keeps the text in a
+ * history buffer that user space reads with klog_read() (`dmesg`).
+ *
+ * Output is written synchronously instead:
+ *   - until klogd runs for the first time (early boot)
+ *   - for messages of level KLOG_ERR and more severe
+ *   - when a CPU's ring is full
+ *   - after klog_panic(), which bypasses the rings altogether
+ * =============================================================================
+ */
+
+#ifndef CHANUX_KLOG_H
+#define CHANUX_KLOG_H
+
+#include "types.h"
+#include "stdarg.h"
+
+/* =============================================================================
+ * Severity Levels
+ * =============================================================================
+ */
+
+#define KLOG_EMERG          0       /* System is unusable */
+#define KLOG_ALERT          1
+#define KLOG_CRIT           2
+#define KLOG_ERR            3       /* Flushed right away from here up */
+#define KLOG_WARNING        4
+#define KLOG_NOTICE         5
+#define KLOG_INFO           6       /* kprintf() */
+#define KLOG_DEBUG          7       /* DBG_*() */
+
+/* Messages above this level stay out of the console (make KLOG_CONSOLE_LEVEL=n) */
+#ifndef KLOG_CONSOLE_LEVEL
+#define KLOG_CONSOLE_LEVEL  KLOG_DEBUG
+#endif
+
+/* =============================================================================
+ * Sizes
+ * =============================================================================
+ */
+
+#define KLOG_TEXT_MAX       255     /* Longer messages are truncated */
+#define KLOG_RING_SIZE      16384   /* Per-CPU ring (power of 2) */
+#define KLOG_HISTORY_SIZE   32768   /* Text kept for klog_read() (power of 2) */
+
+/* =============================================================================
+ * Logging API
+ * =============================================================================
+ */
+
+/**
+ * Log a message at a severity level.
+ * Supports: %s (string), %c (char), %d (decimal), %x (hex), %p (pointer), %% (percent)
+ *
+ * @param level  KLOG_EMERG ... KLOG_DEBUG
+ * @param format Format string
+ * @param ...    Arguments
+ */
+void klog(int level, const char* format, ...);
+
+/**
+ * Log a message (see klog()).
+ */
+void klog_vprintf(int level, const char* format, va_list args);
+
+/**
+ * Simple printf-like function: klog() at KLOG_INFO.
+ *
+ * @param format Format string
+ * @param ...    Arguments
+ */
+void kprintf(const char* format, ...);
+
+/**
+ * Start klogd, which takes over console output from then on.
+ * Call once the scheduler can be started (after process_init()).
+ */
+void klog_start(void);
+
+/**
+ * Write everything logged so far to the console.
+ */
+void klog_flush(void);
+
+/**
+ * Wake klogd if messages are waiting.
+ * Called from the scheduler tick and the idle loop, where waking is
+ * always safe; kprintf() itself only wakes klogd when called with
+ * interrupts enabled.
+ */
+void klog_tick(void);
+
+/**
+ * Switch to synchronous output for good: flush the rings and write
+ * every later message straight to the console (and serial port).
+ * For panic and fatal exception paths.
+ */
+void klog_panic(void);
+
+/**
+ * Copy the newest logged text.
+ *
+ * @param buf Destination (kernel memory)
+ * @param len Room in buf
+ * @return Bytes copied: the last min(len, retained) bytes of the log
+ */
+size_t klog_read(char* buf, size_t len);
+
+#endif /* CHANUX_KLOG_H */
@@ -2,10 +2,20 @@
  * =============================================================================
  * Chanux OS - Kernel Heap Header
  * =============================================================================
- * First-fit memory allocator with block coalescing for kernel use.
+ * Segregated-fit memory allocator with boundary-tag coalescing for kernel use.
  *
- * The heap is located at virtual address 0xFFFFFFFF81000000 and can grow
- * up to 240MB. Physical pages are allocated on demand via the PMM and
+ * Free blocks are kept on HEAP_BIN_COUNT lists, one per power-of-two size
+ * class. Every block carries a header and a footer (boundary tag) holding
+ * its size and state, so both physical neighbours of a block are found in
+ * O(1) and kfree() coalesces without walking the heap.
+ *
+ * When a free block reaches the trim threshold, kfree() unmaps the whole
+ * pages inside it and returns them to the PMM; a free block at the end of
+ * the heap also lowers the heap break. Released pages are mapped again
+ * on demand when the block is reused.
+ *
+ * The heap is located at virtual address 0xFFFFFFFF84000000, just past the
+ * 64MB direct map, and can grow up to 240MB. Physical pages are allocated on demand via the PMM and
  * mapped via the VMM.
  * =============================================================================
  */
@@ -21,14 +31,20 @@
  * =============================================================================
  */
 
-#define HEAP_START          0xFFFFFFFF81000000ULL   /* Virtual start address */
+#define HEAP_START          0xFFFFFFFF84000000ULL   /* Virtual start address */
 #define HEAP_INITIAL_SIZE   (4 * 1024 * 1024)       /* 4MB initial size */
 #define HEAP_MAX_SIZE       (240 * 1024 * 1024)     /* 240MB maximum */
 #define HEAP_EXPAND_SIZE    (1 * 1024 * 1024)       /* 1MB expansion increment */
+#define HEAP_TRIM_THRESHOLD (256 * 1024)            /* Default trim threshold */
+#define HEAP_MAP_MAX_ORDER  9                       /* Back the heap in up to 2MB chunks */
 
 #define HEAP_MIN_BLOCK      32              /* Minimum allocation size */
 #define HEAP_ALIGNMENT      16              /* Allocation alignment */
 
+/* Free-list size classes: bin i holds blocks of [2^(i+5), 2^(i+6)) bytes */
+#define HEAP_BIN_MIN_SHIFT  5
+#define HEAP_BIN_COUNT      24              /* Last bin holds 256MB and up */
+
 /* Block header magic number for validation */
 #define HEAP_BLOCK_MAGIC    0xDEADBEEFUL
 
@@ -44,19 +60,39 @@
 /**
  * Block header structure
  * Placed before each allocation in memory.
- * Total size: 40 bytes (must be aligned to 16 bytes)
+ * Total size: 32 bytes (must be aligned to 16 bytes)
+ *
+ * next_free/prev_free link free blocks into their size-class bin and are
+ * unused while the block is allocated.
  */
 typedef struct heap_block {
     uint32_t magic;             /* Validation magic number */
     uint32_t flags;             /* HEAP_BLOCK_FREE or HEAP_BLOCK_USED */
-    size_t size;                /* Size of data area (excluding header) */
-    struct heap_block* next;    /* Next block in memory */
-    struct heap_block* prev;    /* Previous block in memory */
+    size_t size;                /* Size of data area (excluding header/footer) */
+    struct heap_block* next_free;   /* Next free block in the same bin */
+    struct heap_block* prev_free;   /* Previous free block in the same bin */
 } PACKED ALIGNED(16) heap_block_t;
 
+/**
+ * Block footer (boundary tag)
+ * Placed after each block's data area; mirrors the header's size and flags
+ * so the block before any header can be found without a list walk.
+ */
+typedef struct heap_footer {
+    size_t size;                /* Copy of header size */
+    uint32_t magic;             /* Validation magic number */
+    uint32_t flags;             /* Copy of header flags */
+} PACKED ALIGNED(16) heap_footer_t;
+
 /* Header size (must be multiple of HEAP_ALIGNMENT) */
 #define HEAP_HEADER_SIZE    ALIGN_UP(sizeof(heap_block_t), HEAP_ALIGNMENT)
 
+/* Footer size (must be multiple of HEAP_ALIGNMENT) */
+#define HEAP_FOOTER_SIZE    ALIGN_UP(sizeof(heap_footer_t), HEAP_ALIGNMENT)
+
+/* Per-block bookkeeping overhead */
+#define HEAP_OVERHEAD       (HEAP_HEADER_SIZE + HEAP_FOOTER_SIZE)
+
 /* =============================================================================
  * Heap Statistics
  * =============================================================================
@@ -69,6 +105,7 @@ typedef struct {
     size_t largest_free;        /* Largest free block */
     size_t block_count;         /* Total number of blocks */
     size_t free_block_count;    /* Number of free blocks */
+    size_t released_size;       /* Free space unmapped and given to the PMM */
     uint64_t alloc_count;       /* Total allocations */
     uint64_t free_count;        /* Total frees */
 } heap_stats_t;
@@ -80,7 +117,7 @@ typedef struct {
 
 /**
  * Initialize the kernel heap
- * Maps initial heap pages and sets up the free list.
+ * Maps initial heap pages and sets up the free lists.
  */
 void heap_init(void);
 
@@ -133,6 +170,24 @@ void* krealloc(void* ptr, size_t new_size);
  */
 bool heap_expand(size_t min_size);
 
+/**
+ * Release free heap memory back to the PMM
+ * Unmaps whole pages inside every free block at or above the trim
+ * threshold, and lowers the heap break past a free tail block.
+ * kfree() already does this for the block it frees; this is a full pass.
+ *
+ * @return Number of bytes returned to the PMM
+ */
+size_t heap_trim(void);
+
+/**
+ * Set the trim threshold
+ * Free blocks smaller than this keep their pages mapped.
+ *
+ * @param bytes New threshold in bytes (0 disables trimming)
+ */
+void heap_set_trim_threshold(size_t bytes);
+
 /**
  * Get heap statistics
  *
@@ -142,7 +197,7 @@ void heap_get_stats(heap_stats_t* stats);
 
 /**
  * Validate heap integrity
- * Checks all block headers for corruption.
+ * Checks every block's header and footer, and the free-list bins.
  *
  * @return true if heap is valid, false if corruption detected
  */
@@ -36,9 +36,31 @@
 #define MM_HEAP_PHYS_START      0x400000        /* Heap backing at 4MB */
 #define MM_HEAP_INITIAL_SIZE    (4 * 1024 * 1024)  /* 4MB initial heap */
 
+/*
+ * Direct-mapped physical memory.
+ * The loader maps the first 64MB with 2MB pages both identity and at
+ * KERNEL_VIRT_BASE, so PHYS_TO_VIRT() is only valid below this limit.
+ */
+#define MM_DIRECT_MAP_SIZE      0x4000000       /* 64MB */
+
 /* Virtual memory layout */
-#define MM_HEAP_VIRT_START      0xFFFFFFFF81000000ULL  /* Heap virtual address */
-#define MM_HEAP_VIRT_MAX        0xFFFFFFFF90000000ULL  /* Max heap end */
+/*
+ * The heap must start past the direct map: PHYS_TO_VIRT() of any frame
+ * below MM_DIRECT_MAP_SIZE has to keep resolving to that frame.
+ */
+#define MM_HEAP_VIRT_START      0xFFFFFFFF84000000ULL  /* Heap virtual address */
+#define MM_HEAP_VIRT_MAX        0xFFFFFFFF93000000ULL  /* Max heap end (240MB) */
+
+/* Device registers (vmm_map_mmio), uncached */
+#define MM_MMIO_VIRT_START      0xFFFFFFFFA0000000ULL
+#define MM_MMIO_VIRT_MAX        0xFFFFFFFFB0000000ULL  /* 256MB window */
+
+/*
+ * Kernel stacks, one per process slot, each above an unmapped guard page
+ * (see proc/process.c)
+ */
+#define MM_KSTACK_VIRT_START    0xFFFFFFFFB0000000ULL
+#define MM_KSTACK_VIRT_MAX      0xFFFFFFFFB0100000ULL  /* 1MB window */
 
 /* Maximum supported physical memory (32GB) */
 #define MM_MAX_PHYS_MEMORY      (32ULL * 1024 * 1024 * 1024)
@@ -2,14 +2,31 @@
  * =============================================================================
  * Chanux OS - Physical Memory Manager Header
  * =============================================================================
- * Bitmap-based physical page frame allocator.
+ * Buddy-system physical page frame allocator.
  *
- * The PMM tracks physical memory pages using a bitmap where:
+ * Free memory is kept in per-order free lists, where an order-N block is
+ * 2^N contiguous, naturally aligned pages. Allocation splits the smallest
+ * sufficient block and freeing merges a block with its buddy, so both are
+ * O(PMM_MAX_ORDER) regardless of how much memory is installed.
+ *
+ * The PMM also keeps a bitmap where:
  * - 0 = page is free
  * - 1 = page is used/reserved
  *
  * The bitmap is located at physical address 0x200000 and can track
- * up to 32GB of physical RAM (8 million 4KB pages = 1MB bitmap).
+ * up to 32GB of physical RAM (8 million 4KB pages = 1MB bitmap). It
+ * answers pmm_is_page_free() and is cross-checked against the free lists
+ * when built with DEBUG_PMM=1.
+ *
+ * Free list links live inside the free blocks themselves, so only memory
+ * below MM_DIRECT_MAP_SIZE is handed to the buddy allocator.
+ *
+ * Memory is split into zones, one per NUMA node and kind: DMA32 (below
+ * 4GB, reachable by 32-bit device DMA) and NORMAL (the rest). Each zone
+ * has its own free lists. Allocations start at the calling CPU's node and
+ * fall back to the other nodes nearest first, taking NORMAL before DMA32
+ * so that DMA32 lasts. Until pmm_numa_init() has read the SRAT, all
+ * memory is node 0.
  * =============================================================================
  */
 
@@ -19,6 +36,46 @@
 #include "../kernel.h"
 #include "../types.h"
 #include "mm.h"
+#include "../smp.h"
+
+/* =============================================================================
+ * Buddy Allocator Configuration
+ * =============================================================================
+ */
+
+#define PMM_MAX_ORDER       10      /* Largest block: 2^10 pages = 4MB */
+#define PMM_ORDER_COUNT     (PMM_MAX_ORDER + 1)
+
+/* =============================================================================
+ * Zone Configuration
+ * =============================================================================
+ */
+
+#define PMM_MAX_NODES       4       /* As ACPI_MAX_NODES */
+#define PMM_DMA32_LIMIT     0x100000000ULL
+
+typedef enum {
+    PMM_ZONE_DMA32 = 0,             /* Below PMM_DMA32_LIMIT */
+    PMM_ZONE_NORMAL,
+    PMM_ZONE_TYPES
+} pmm_zone_type_t;
+
+#define PMM_ZONE_COUNT      (PMM_MAX_NODES * PMM_ZONE_TYPES)
+
+/* =============================================================================
+ * Per-CPU Page Frame Cache Configuration
+ * =============================================================================
+ * Single-page allocations are served from a small per-CPU cache in front of
+ * the buddy lists. The hot list holds recently freed (cache-warm) frames;
+ * the zeroed list holds frames cleared ahead of time by the idle loop.
+ * Both are refilled from and drained to the buddy allocator in batches.
+ */
+
+#define PMM_PCP_CPUS        SMP_MAX_CPUS    /* One cache per CPU */
+#define PMM_PCP_BATCH_ORDER 4       /* Refill/drain 2^4 = 16 frames at a time */
+#define PMM_PCP_BATCH       (1 << PMM_PCP_BATCH_ORDER)
+#define PMM_PCP_HOT_HIGH    64      /* Drain the hot list above this many */
+#define PMM_PCP_ZERO_HIGH   32      /* Stop pre-zeroing at this many */
 
 /* =============================================================================
  * PMM Statistics
@@ -32,6 +89,12 @@ typedef struct {
     uint64_t reserved_pages;    /* Reserved pages (kernel, BIOS, etc.) */
     uint64_t total_memory;      /* Total memory in bytes */
     uint64_t free_memory;       /* Free memory in bytes */
+    uint64_t free_blocks[PMM_ORDER_COUNT];  /* Free blocks per buddy order */
+    uint64_t cached_pages;      /* Free pages parked in per-CPU hot lists */
+    uint64_t zeroed_pages;      /* Free pages parked in per-CPU zeroed lists */
+    uint32_t node_count;        /* NUMA nodes */
+    uint64_t node_free_pages[PMM_MAX_NODES];    /* Free in each node's buddy lists */
+    uint64_t dma32_free_pages;  /* Free in the DMA32 zones' buddy lists */
 } pmm_stats_t;
 
 /* =============================================================================
@@ -47,6 +110,13 @@ typedef struct {
  */
 void pmm_init(boot_info_t* boot_info);
 
+/**
+ * Split memory into per-node zones as described by the ACPI SRAT
+ * Must be called after acpi_init(); does nothing beyond reporting the
+ * zones on a single-node system.
+ */
+void pmm_numa_init(void);
+
 /**
  * Allocate a single physical page frame
  *
@@ -54,6 +124,14 @@ void pmm_init(boot_info_t* boot_info);
  */
 phys_addr_t pmm_alloc_page(void);
 
+/**
+ * Allocate a single physical page frame filled with zeros
+ * Served from the per-CPU pre-zeroed list when possible.
+ *
+ * @return Physical address of allocated page, or 0 on failure
+ */
+phys_addr_t pmm_alloc_page_zeroed(void);
+
 /**
  * Allocate multiple contiguous physical page frames
  *
@@ -62,6 +140,40 @@ phys_addr_t pmm_alloc_page(void);
  */
 phys_addr_t pmm_alloc_pages(size_t count);
 
+/**
+ * Allocate contiguous page frames, preferably on a given node
+ * Falls back to the other nodes when the node has none left.
+ *
+ * @param count Number of contiguous pages to allocate
+ * @param node  Preferred NUMA node
+ * @return Physical address of first page, or 0 on failure
+ */
+phys_addr_t pmm_alloc_pages_node(size_t count, uint32_t node);
+
+/**
+ * Allocate contiguous page frames below 4GB, for device DMA
+ *
+ * @param count Number of contiguous pages to allocate
+ * @return Physical address of first page, or 0 on failure
+ */
+phys_addr_t pmm_alloc_pages_dma32(size_t count);
+
+/**
+ * Allocate a naturally aligned block of 2^order contiguous page frames
+ *
+ * @param order Block order (0 to PMM_MAX_ORDER)
+ * @return Physical address of the block, or 0 on failure
+ */
+phys_addr_t pmm_alloc_order(uint32_t order);
+
+/**
+ * Free a block previously returned by pmm_alloc_order()
+ *
+ * @param addr Physical address of the block
+ * @param order Order the block was allocated with
+ */
+void pmm_free_order(phys_addr_t addr, uint32_t order);
+
 /**
  * Free a single physical page frame
  *
@@ -77,6 +189,50 @@ void pmm_free_page(phys_addr_t addr);
  */
 void pmm_free_pages(phys_addr_t addr, size_t count);
 
+/**
+ * Return every frame held in the per-CPU caches to the buddy allocator
+ */
+void pmm_pcp_drain(void);
+
+/**
+ * Pre-zero frames for pmm_alloc_page_zeroed()
+ * Called from the idle loop; clears at most one batch per call.
+ */
+void pmm_pcp_zero_idle(void);
+
+/* =============================================================================
+ * Page Reference Counts
+ * =============================================================================
+ * Frames mapped into more than one address space (copy-on-write after
+ * fork) carry a count of extra sharers. A freshly allocated frame has one
+ * owner and a count of zero; pmm_page_ref() adds a sharer and
+ * pmm_page_unref() drops one, freeing the frame when the last owner goes.
+ * Only frames below MM_DIRECT_MAP_SIZE are counted.
+ */
+
+/**
+ * Add a sharer to a page frame
+ *
+ * @param addr Physical address of the page
+ */
+void pmm_page_ref(phys_addr_t addr);
+
+/**
+ * Drop a sharer from a page frame, freeing it if none remain
+ *
+ * @param addr Physical address of the page
+ * @return true if the frame was freed
+ */
+bool pmm_page_unref(phys_addr_t addr);
+
+/**
+ * Get the number of extra sharers of a page frame
+ *
+ * @param addr Physical address of the page
+ * @return 0 if the frame has a single owner
+ */
+uint32_t pmm_page_refcount(phys_addr_t addr);
+
 /**
  * Mark a page as reserved (cannot be allocated)
  * Used for kernel, hardware, and BIOS reserved regions.
@@ -100,6 +256,15 @@ void pmm_reserve_pages(phys_addr_t addr, size_t count);
  */
 void pmm_unreserve_page(phys_addr_t addr);
 
+/**
+ * Turn a reserved page into an ordinary allocated one, owned by the
+ * caller from now on and given back with pmm_free_page().
+ * Used to take over pages the bootloader filled (the initramfs).
+ *
+ * @param addr Physical address of the reserved page
+ */
+void pmm_claim_reserved_page(phys_addr_t addr);
+
 /**
  * Check if a physical page is free
  *
@@ -108,6 +273,19 @@ void pmm_unreserve_page(phys_addr_t addr);
  */
 bool pmm_is_page_free(phys_addr_t addr);
 
+/**
+ * Get the NUMA node a page frame belongs to
+ *
+ * @param addr Physical address
+ * @return Node, 0 for memory the buddy allocator does not manage
+ */
+uint32_t pmm_addr_node(phys_addr_t addr);
+
+/**
+ * Get the number of NUMA nodes
+ */
+uint32_t pmm_node_count(void);
+
 /**
  * Get PMM statistics
  *
@@ -115,6 +293,14 @@ bool pmm_is_page_free(phys_addr_t addr);
  */
 void pmm_get_stats(pmm_stats_t* stats);
 
+/**
+ * Verify that the buddy free lists agree with the page bitmap
+ *
+ * @return true if every free block is free in the bitmap and the
+ *         free page count matches, false otherwise
+ */
+bool pmm_check(void);
+
 /**
  * Print PMM debug information
  * Shows memory map, allocation statistics, and bitmap info.
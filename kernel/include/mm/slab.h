@@ -0,0 +1,180 @@
+/**
+ * =============================================================================
+ * Chanux OS - Slab Allocator Header
+ * =============================================================================
+ * Object caches for fixed-size kernel objects.
+ *
+ * A cache hands out objects of one size. Objects are carved out of slabs:
+ * naturally aligned 2^order page blocks from the PMM, reached through the
+ * direct map. Each slab begins with a small header and keeps its free
+ * objects on an embedded singly linked list, so allocation and free are
+ * O(1) and carry no per-object header.
+ *
+ * Slabs live on one of three lists per cache:
+ *   - partial: some objects free (allocations come from here first)
+ *   - full:    no objects free
+ *   - empty:   all objects free (at most KMEM_EMPTY_KEEP are kept)
+ *
+ * kmalloc() routes requests up to KMALLOC_MAX_CACHE_SIZE through a set of
+ * power-of-two size-class caches ("kmalloc-32" ... "kmalloc-2048").
+ * =============================================================================
+ */
+
+#ifndef CHANUX_SLAB_H
+#define CHANUX_SLAB_H
+
+#include "../kernel.h"
+#include "../types.h"
+#include "../spinlock.h"
+
+/* =============================================================================
+ * Slab Configuration
+ * =============================================================================
+ */
+
+#define KMEM_NAME_MAX           24      /* Cache name length */
+#define KMEM_MAX_ORDER          5       /* Largest slab: 2^5 pages = 128KB */
+#define KMEM_EMPTY_KEEP         1       /* Empty slabs kept per cache */
+#define KMEM_MIN_ALIGN          16      /* Minimum object alignment */
+
+/* Slab header magic number for validation */
+#define KMEM_SLAB_MAGIC         0x51AB51ABUL
+
+/* kmalloc size classes: 2^KMALLOC_MIN_SHIFT .. 2^KMALLOC_MAX_SHIFT bytes */
+#define KMALLOC_MIN_SHIFT       5       /* 32 bytes */
+#define KMALLOC_MAX_SHIFT       11      /* 2048 bytes */
+#define KMALLOC_CACHE_COUNT     (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_CACHE_SIZE  (1UL << KMALLOC_MAX_SHIFT)
+
+/* =============================================================================
+ * Slab Structures
+ * =============================================================================
+ */
+
+struct kmem_cache;
+
+/**
+ * Slab header
+ * Placed at the start of each slab; objects follow at cache->first_offset.
+ */
+typedef struct kmem_slab {
+    uint32_t magic;                 /* KMEM_SLAB_MAGIC */
+    uint32_t inuse;                 /* Objects currently allocated */
+    struct kmem_cache* cache;       /* Owning cache */
+    struct kmem_slab* next;         /* Next slab on the same list */
+    struct kmem_slab* prev;         /* Previous slab on the same list */
+    void* free_list;                /* First free object */
+} kmem_slab_t;
+
+/**
+ * Object cache
+ */
+typedef struct kmem_cache {
+    spinlock_t lock;                /* Guards the slab lists and counters */
+    char name[KMEM_NAME_MAX];       /* Name for debugging */
+    size_t obj_size;                /* Object size (rounded to alignment) */
+    size_t align;                   /* Object alignment */
+    uint32_t order;                 /* Slab size is PAGE_SIZE << order */
+    uint32_t objs_per_slab;         /* Objects in each slab */
+    size_t first_offset;            /* Offset of first object in a slab */
+
+    kmem_slab_t* partial;           /* Slabs with free and used objects */
+    kmem_slab_t* full;              /* Slabs with no free objects */
+    kmem_slab_t* empty;             /* Slabs with no used objects */
+    uint32_t empty_count;           /* Length of the empty list */
+
+    uint64_t slab_count;            /* Slabs currently owned */
+    uint64_t active_objs;           /* Objects currently allocated */
+    uint64_t alloc_count;           /* Total allocations */
+    uint64_t free_count;            /* Total frees */
+
+    struct kmem_cache* next;        /* Next cache in the global list */
+} kmem_cache_t;
+
+/* =============================================================================
+ * Slab API
+ * =============================================================================
+ */
+
+/**
+ * Initialize the slab allocator and the kmalloc size-class caches
+ * Must be called after pmm_init().
+ */
+void slab_init(void);
+
+/**
+ * Check whether the slab allocator is ready for use
+ *
+ * @return true once slab_init() has completed
+ */
+bool slab_is_ready(void);
+
+/**
+ * Create an object cache
+ *
+ * @param name  Name for debugging (truncated to KMEM_NAME_MAX - 1)
+ * @param size  Object size in bytes
+ * @param align Object alignment (power of 2, 0 for KMEM_MIN_ALIGN)
+ * @return New cache, or NULL on failure
+ */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align);
+
+/**
+ * Destroy an object cache
+ * All objects must have been freed; remaining slabs are released.
+ *
+ * @param cache Cache to destroy
+ */
+void kmem_cache_destroy(kmem_cache_t* cache);
+
+/**
+ * Allocate an object from a cache
+ *
+ * @param cache Cache to allocate from
+ * @return Pointer to object, or NULL on failure
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/**
+ * Return an object to its cache
+ *
+ * @param cache Cache the object was allocated from
+ * @param obj   Object to free (can be NULL)
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/**
+ * Release all empty slabs held by a cache back to the PMM
+ *
+ * @param cache Cache to shrink
+ * @return Number of slabs released
+ */
+uint32_t kmem_cache_shrink(kmem_cache_t* cache);
+
+/* =============================================================================
+ * kmalloc Integration
+ * =============================================================================
+ */
+
+/**
+ * Allocate from the kmalloc size-class caches
+ *
+ * @param size Requested size (at most KMALLOC_MAX_CACHE_SIZE)
+ * @return Pointer to memory, or NULL on failure
+ */
+void* kmalloc_slab(size_t size);
+
+/**
+ * Find the slab holding an address
+ *
+ * @param ptr Address to look up
+ * @return Slab header, or NULL if ptr is not slab memory
+ */
+kmem_slab_t* slab_find(const void* ptr);
+
+/**
+ * Print statistics for every cache
+ */
+void slab_debug_print(void);
+
+#endif /* CHANUX_SLAB_H */
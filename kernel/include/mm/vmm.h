@@ -33,6 +33,8 @@
 #define PTE_DIRTY           (1ULL << 6)     /* Page has been written to */
 #define PTE_HUGE            (1ULL << 7)     /* 2MB/1GB huge page */
 #define PTE_GLOBAL          (1ULL << 8)     /* Global page (survives TLB flush) */
+#define PTE_COW             (1ULL << 9)     /* Software: copy-on-write page */
+#define PTE_SHARED          (1ULL << 10)    /* Software: frame owned by a file (mmap) or program image */
 #define PTE_NX              (1ULL << 63)    /* No execute (requires NX support) */
 
 /* Common flag combinations */
@@ -48,6 +50,14 @@
 /* Extract physical address from page table entry */
 #define PTE_GET_ADDR(pte)   ((pte) & PTE_ADDR_MASK)
 
+/* 2MB pages (PD-level leaves) */
+#define VMM_HUGE_PAGE_SIZE  0x200000UL
+#define VMM_HUGE_PAGE_ORDER 9           /* 2^9 x 4KB frames */
+#define VMM_HUGE_ADDR_MASK  0x000FFFFFFFE00000ULL
+
+/* Ranged flushes above this many pages flush the whole TLB instead */
+#define VMM_FLUSH_ALL_PAGES 32
+
 /* =============================================================================
  * Virtual Address Index Extraction
  * =============================================================================
@@ -72,6 +82,11 @@ typedef pte_t page_table_t[512];    /* 512 entries per level */
  * =============================================================================
  */
 
+/* Process-context identifiers (CR3 bits 0-11) */
+#define VMM_PCID_COUNT          4096            /* PCID 0 is the kernel's */
+#define CR3_PCID_MASK           0xFFFULL
+#define CR3_NOFLUSH             (1ULL << 63)    /* Keep this PCID's TLB entries */
+
 /* Recursive mapping index (PML4[510] points to itself) */
 #define VMM_RECURSIVE_INDEX     510
 
@@ -89,6 +104,12 @@ typedef pte_t page_table_t[512];    /* 512 entries per level */
  */
 void vmm_init(void);
 
+/**
+ * Load the kernel page tables on an AP and turn on the same paging
+ * features (CR0.WP, global pages, PCIDs) as the boot CPU
+ */
+void vmm_init_cpu(void);
+
 /**
  * Map a virtual address to a physical address
  *
@@ -101,6 +122,8 @@ bool vmm_map_page(virt_addr_t virt, phys_addr_t phys, uint64_t flags);
 
 /**
  * Unmap a virtual address
+ * The entry is shot down on every CPU before this returns. Mapping over a
+ * live kernel mapping only flushes the local TLB, so unmap first.
  *
  * @param virt Virtual address to unmap (must be page-aligned)
  * @return true if page was mapped and is now unmapped
@@ -125,6 +148,8 @@ bool vmm_is_mapped(virt_addr_t virt);
 
 /**
  * Map a range of virtual addresses to physical addresses
+ * Each table level is walked once per 2MB, 2MB pages are used where virt
+ * and phys are both 2MB-aligned, and the TLB is flushed once at the end.
  *
  * @param virt  Starting virtual address (must be page-aligned)
  * @param phys  Starting physical address (must be page-aligned)
@@ -136,12 +161,24 @@ bool vmm_map_range(virt_addr_t virt, phys_addr_t phys, size_t size, uint64_t fla
 
 /**
  * Unmap a range of virtual addresses
+ * Fully covered 2MB pages are dropped whole; partly covered ones are split.
+ * Other CPUs get one TLB shootdown for the whole range.
  *
  * @param virt Starting virtual address
  * @param size Number of bytes to unmap
  */
 void vmm_unmap_range(virt_addr_t virt, size_t size);
 
+/**
+ * Map device registers uncached into the kernel's MMIO window
+ * The window is only ever allocated from; mappings are permanent.
+ *
+ * @param phys Physical address (need not be page-aligned)
+ * @param size Number of bytes
+ * @return Virtual address corresponding to phys, or NULL on failure
+ */
+void* vmm_map_mmio(phys_addr_t phys, size_t size);
+
 /**
  * Flush TLB entry for a specific virtual address
  *
@@ -150,7 +187,16 @@ void vmm_unmap_range(virt_addr_t virt, size_t size);
 void vmm_flush_tlb(virt_addr_t virt);
 
 /**
- * Flush entire TLB (reload CR3)
+ * Flush TLB entries for a range of virtual addresses
+ * Falls back to a full flush above VMM_FLUSH_ALL_PAGES pages.
+ *
+ * @param virt Starting virtual address
+ * @param size Number of bytes
+ */
+void vmm_flush_tlb_range(virt_addr_t virt, size_t size);
+
+/**
+ * Flush entire TLB, including global pages and every PCID
  */
 void vmm_flush_tlb_all(void);
 
@@ -175,12 +221,15 @@ void vmm_debug_print(void);
 #define USER_SPACE_START    0x0000000000400000ULL   /* 4MB - avoid null pages */
 #define USER_SPACE_END      0x0000800000000000ULL   /* End of lower canonical half */
 #define USER_STACK_TOP      0x00007FFFFFFFE000ULL   /* Just below end of user space */
-#define USER_STACK_SIZE     (16 * PAGE_SIZE)        /* 64KB user stack */
+#define USER_STACK_SIZE     (256 * PAGE_SIZE)       /* 1MB user stack (demand-faulted) */
+#define USER_STACK_GUARD    PAGE_SIZE               /* Unmapped guard below the stack */
+#define USER_MMAP_BASE      0x0000100000000000ULL   /* File mappings (mmap), one slot each */
+#define USER_MMAP_SLOT_SIZE 0x10000000ULL           /* 256MB per mapping slot */
 
 /**
  * Create a new address space (PML4) for a user process.
  * The new address space has kernel mappings copied (higher half)
- * but no user-space mappings.
+ * but no user-space mappings. It gets its own PCID when supported.
  *
  * @return Physical address of new PML4, or 0 on failure
  */
@@ -188,12 +237,26 @@ phys_addr_t vmm_create_address_space(void);
 
 /**
  * Destroy an address space and free all associated page tables.
- * Does NOT free the physical pages that were mapped - caller must do that.
+ * Tables shared with the kernel are left alone. Pages mapped with PTE_USER
+ * are released with pmm_page_unref(), so frames still shared with another
+ * address space survive. PTE_SHARED frames belong to a file and are only
+ * unmapped.
  *
  * @param pml4_phys Physical address of PML4 to destroy
  */
 void vmm_destroy_address_space(phys_addr_t pml4_phys);
 
+/**
+ * Get the CR3 value that loads an address space.
+ * With PCIDs enabled this carries the address space's PCID and the
+ * no-flush bit, except on the first load after the PCID was (re)assigned
+ * and the first load on a different CPU than last time.
+ *
+ * @param pml4_phys Physical address of the PML4 (0 = kernel page tables)
+ * @return Value to write to CR3
+ */
+uint64_t vmm_address_space_cr3(phys_addr_t pml4_phys);
+
 /**
  * Switch to a different address space.
  *
@@ -213,6 +276,77 @@ void vmm_switch_address_space(phys_addr_t pml4_phys);
 bool vmm_map_user_page(phys_addr_t pml4_phys, virt_addr_t virt,
                        phys_addr_t phys, uint64_t flags);
 
+/**
+ * Map a physically contiguous range in a specific address space.
+ * Uses 2MB pages where alignment allows and flushes once at the end.
+ *
+ * @param pml4_phys Physical address of target PML4
+ * @param virt      Starting virtual address (user space)
+ * @param phys      Starting physical address
+ * @param size      Number of bytes (rounded up to page boundary)
+ * @param flags     Page table entry flags (PTE_USER is added)
+ * @return true on success, false on failure (earlier pages stay mapped)
+ */
+bool vmm_map_user_range(phys_addr_t pml4_phys, virt_addr_t virt, phys_addr_t phys,
+                        size_t size, uint64_t flags);
+
+/**
+ * Clone the user half of an address space for fork().
+ * Every user page is shared with the new address space rather than copied:
+ * writable pages become read-only + PTE_COW in both parent and child and
+ * are copied on the first write (see vmm_handle_cow_fault()). PTE_SHARED
+ * file pages are mapped as they are, so MAP_SHARED stays shared.
+ *
+ * @param src_pml4_phys Address space to clone
+ * @return Physical address of the new PML4, or 0 on failure
+ */
+phys_addr_t vmm_clone_user_space(phys_addr_t src_pml4_phys);
+
+/**
+ * Resolve a write fault on a copy-on-write page in the current address space.
+ * The faulting page gets a private copy (or is simply made writable again
+ * if no one else shares the frame any more). A MAP_PRIVATE file page is
+ * always copied; the file keeps its frame. A page that is writable already
+ * (another thread resolved it first) counts as resolved. Threads of one
+ * process must be serialized by the caller (user_handle_cow_fault()).
+ *
+ * @param virt Faulting virtual address
+ * @return true if the fault was a COW fault and has been resolved
+ */
+bool vmm_handle_cow_fault(virt_addr_t virt);
+
+/**
+ * Unmap a user page from a specific address space and release its frame
+ * (PTE_SHARED frames are left to their file).
+ *
+ * @param pml4_phys Physical address of target PML4
+ * @param virt      Virtual address to unmap
+ * @return true if a page was mapped there
+ */
+bool vmm_unmap_user_page(phys_addr_t pml4_phys, virt_addr_t virt);
+
+/**
+ * Flush a user range from every CPU after changing an address space that
+ * several threads may be running at once. Other CPUs flush the range in
+ * whatever address space they are in now, and the address space's PCID
+ * is flushed on its next load anywhere.
+ *
+ * @param pml4_phys Physical address of the changed PML4
+ * @param virt      Start of the changed range
+ * @param size      Size of the range in bytes
+ */
+void vmm_shootdown_user(phys_addr_t pml4_phys, virt_addr_t virt, size_t size);
+
+/**
+ * Translate a user address in a specific address space.
+ * Only pages owned by that address space are considered.
+ *
+ * @param pml4_phys Physical address of target PML4
+ * @param virt      User virtual address
+ * @return Physical address (including the page offset), or 0 if unmapped
+ */
+phys_addr_t vmm_user_physical(phys_addr_t pml4_phys, virt_addr_t virt);
+
 /**
  * Clone kernel mappings from one address space to another.
  * Only copies the higher-half (kernel) PML4 entries.
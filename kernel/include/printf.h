@@ -0,0 +1,38 @@
+/**
+ * =============================================================================
+ * Chanux OS - Formatted Output Header
+ * =============================================================================
+ * printf-style formatting into a caller's buffer, behind kprintf() and the
+ * kernel log.
+ *
+ * Supports: %s (string), %c (char), %d/%i (signed decimal), %u (unsigned
+ * decimal), %x/%X (hex with 0x prefix), %p (pointer), %% (percent).
+ * %d, %u and %x read a 64-bit argument.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_PRINTF_H
+#define CHANUX_PRINTF_H
+
+#include "types.h"
+#include "stdarg.h"
+
+/**
+ * Format into a buffer.
+ * The output is truncated to size - 1 characters and always terminated
+ * (unless size is 0).
+ *
+ * @param buf    Output buffer
+ * @param size   Buffer size in bytes
+ * @param format Format string
+ * @param args   Arguments
+ * @return Characters written, not counting the terminator
+ */
+size_t kvsnprintf(char* buf, size_t size, const char* format, va_list args);
+
+/**
+ * Format into a buffer (see kvsnprintf()).
+ */
+size_t ksnprintf(char* buf, size_t size, const char* format, ...);
+
+#endif /* CHANUX_PRINTF_H */
@@ -0,0 +1,54 @@
+/**
+ * =============================================================================
+ * Chanux OS - Futexes
+ * =============================================================================
+ * Sleeping on a 32-bit word in user memory. User-space locks do their
+ * uncontended work with atomic instructions alone and only enter the
+ * kernel to wait for the word to change, or to wake those waiting on it.
+ *
+ * A futex is identified by the physical address of its word, not the
+ * virtual one, so processes mapping the same frame (MAP_SHARED, threads
+ * sharing an address space) meet on the same futex wherever they map it.
+ * Private memory stays private: both calls write the word first, which
+ * breaks copy-on-write sharing with a fork parent or child.
+ *
+ * Typical use (see mutex_lock() in user/lib/libc.c):
+ *   // waiter: sleep while the lock word still reads 2
+ *   futex_wait(&m->state, 2);
+ *
+ *   // waker: after changing the word
+ *   futex_wake(&m->state, 1);
+ * =============================================================================
+ */
+
+#ifndef CHANUX_FUTEX_H
+#define CHANUX_FUTEX_H
+
+#include "../types.h"
+
+/* Hash buckets for waiters */
+#define FUTEX_HASH_BITS     6
+#define FUTEX_HASH_SIZE     (1 << FUTEX_HASH_BITS)
+
+/**
+ * Sleep until woken, provided *uaddr still holds 'val'
+ * The check and the sleep are atomic with respect to futex_wake(): a
+ * waker that changes the word before waking cannot be missed.
+ *
+ * @param uaddr User address of the word (4-byte aligned)
+ * @param val   Value the caller last saw
+ * @return      0 when woken (possibly spuriously), -EAGAIN if the word no
+ *              longer holds 'val', -EINVAL or -EFAULT for a bad address
+ */
+int64_t futex_wait(uint32_t* uaddr, uint32_t val);
+
+/**
+ * Wake up to 'count' processes waiting on *uaddr, oldest first
+ *
+ * @param uaddr User address of the word (4-byte aligned)
+ * @param count Maximum number of waiters to wake
+ * @return      Number woken, -EINVAL or -EFAULT for a bad address
+ */
+int64_t futex_wake(uint32_t* uaddr, int count);
+
+#endif /* CHANUX_FUTEX_H */
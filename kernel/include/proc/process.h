@@ -20,9 +20,14 @@
 
 #include "../types.h"
 #include "../interrupts/isr.h"
+#include "../spinlock.h"
+#include "timer.h"
 
 /* Forward declaration for filesystem support */
 struct fd_table;
+struct io_ring;
+struct user_image;
+struct vnode;
 
 /* =============================================================================
  * Configuration Constants
@@ -34,6 +39,9 @@ struct fd_table;
 #define KERNEL_STACK_SIZE   8192    /* 8KB kernel stack per process */
 #define DEFAULT_TIME_SLICE  10      /* Time slice in ticks (100ms at 100Hz) */
 #define CWD_MAX             256     /* Maximum current working directory length */
+#define PROCESS_MAX_THREADS 8       /* Threads per process besides the first */
+#define PROCESS_MAX_REGIONS (4 + PROCESS_MAX_THREADS) /* Demand-zero regions (one per thread stack) */
+#define PROCESS_MAX_MMAPS   8       /* File mappings per process */
 
 /* =============================================================================
  * Process States
@@ -45,7 +53,7 @@ typedef enum {
     PROCESS_STATE_READY,            /* Ready to run, in run queue */
     PROCESS_STATE_RUNNING,          /* Currently executing on CPU */
     PROCESS_STATE_BLOCKED,          /* Waiting for I/O or event */
-    PROCESS_STATE_TERMINATED        /* Finished execution, awaiting cleanup */
+    PROCESS_STATE_TERMINATED        /* Finished execution, awaiting the reaper */
 } process_state_t;
 
 /* =============================================================================
@@ -56,6 +64,48 @@ typedef enum {
 #define PROCESS_FLAG_KERNEL     0x01    /* Kernel process (Ring 0) */
 #define PROCESS_FLAG_IDLE       0x02    /* System idle process */
 #define PROCESS_FLAG_USER       0x04    /* User process (Ring 3) */
+#define PROCESS_FLAG_REAP_VM    0x08    /* Last thread out: reaper frees the address space */
+
+/* fpu_cpu of a process whose FPU state no CPU holds */
+#define PROCESS_FPU_CPU_NONE    0xFFFFFFFFU
+
+/* =============================================================================
+ * Demand-Zero User Regions
+ * =============================================================================
+ * Address ranges reserved in a user address space but not populated up
+ * front. The first touch of a page inside one faults in a zeroed frame
+ * mapped with the region's flags (see user_handle_page_fault()). A region
+ * may start out with data instead: the part of [init_start, init_end)
+ * that falls in the page is copied from 'init' (an ELF data segment).
+ */
+
+typedef struct {
+    uint64_t            start;                      /* First address (page-aligned) */
+    uint64_t            end;                        /* One past the end (page-aligned) */
+    uint64_t            flags;                      /* PTE flags for faulted-in pages */
+    const uint8_t*      init;                       /* Contents at init_start (NULL: zero) */
+    uint64_t            init_start;                 /* First initialized address */
+    uint64_t            init_end;                   /* One past the last */
+} user_region_t;
+
+/* =============================================================================
+ * File Mappings (mmap)
+ * =============================================================================
+ * A file range mapped straight onto the file's own page frames, which are
+ * entered with PTE_SHARED so the address space never frees them. Mapping
+ * slot i always lives at USER_MMAP_BASE + i * USER_MMAP_SLOT_SIZE. Pages
+ * are faulted in (and their blocks pinned) one at a time on first touch.
+ */
+
+typedef struct {
+    struct vnode*       vnode;                      /* Mapped file (referenced), NULL if free */
+    uint64_t            start;                      /* First address (page-aligned) */
+    uint64_t            flags;                      /* PTE flags for faulted-in pages */
+    uint32_t            first;                      /* File page mapped at start */
+    uint32_t            page_count;                 /* Pages in the mapping */
+    bool                shared;                     /* MAP_SHARED (else MAP_PRIVATE) */
+    uint32_t*           pages;                      /* Pinned page ids, 0 until faulted in (kmalloc'd) */
+} user_mmap_t;
 
 /* =============================================================================
  * Process Control Block (PCB)
@@ -66,6 +116,16 @@ typedef enum {
  *   kernel_stack      -> Base of allocated memory (low address)
  *   kernel_stack_top  -> Top of stack (high address, 16-byte aligned)
  *   rsp              -> Current stack pointer (context saved here)
+ * The stack belongs to the PCB slot: it sits above an unmapped guard page
+ * in the MM_KSTACK_VIRT window and stays mapped when the slot is reused.
+ *
+ * Threads: every user process is a thread group. Its first thread is the
+ * group leader and owns the address space bookkeeping (regions, mmaps,
+ * user_code, vm_lock); further threads (user_thread_create()) point
+ * 'group' at the leader and keep only a copy of pml4_phys, their own
+ * stacks and a reference on the shared descriptor table. The address
+ * space goes away when the last thread of the group exits, so the
+ * leader's PCB has to stay around until then.
  */
 
 typedef struct process {
@@ -88,21 +148,30 @@ typedef struct process {
 
     /* === Scheduling === */
     uint32_t            time_slice;                 /* Ticks remaining in quantum */
-    uint32_t            priority;                   /* Priority (for future use) */
+    uint32_t            priority;                   /* Run queue level (0 = most urgent) */
     uint64_t            total_ticks;                /* Total CPU ticks consumed */
+    uint32_t            cpu;                        /* CPU whose run queue it is on */
+    uint64_t            last_ran;                   /* Tick it was last switched out */
+    volatile bool       on_cpu;                     /* Context live on a CPU */
+
+    /* === FPU (see fpu.h) === */
+    void*               fpu_state;                  /* Save area (NULL until first use) */
+    uint32_t            fpu_cpu;                    /* CPU that last loaded it */
 
     /* === Linked List Pointers === */
     struct process*     next;                       /* Next in list (run queue) */
     struct process*     prev;                       /* Previous in list */
+    struct process*     reap_next;                  /* Next on the free slot or reaper list */
 
     /* === Exit Information === */
     int                 exit_code;                  /* Exit code (for terminated) */
 
-    /* === Parent/Child (for future fork support) === */
+    /* === Parent/Child (set by process_create, used by fork) === */
     pid_t               parent_pid;                 /* Parent process ID */
 
     /* === Sleep Support (Phase 5) === */
-    uint64_t            wake_tick;                  /* Tick to wake at (0 = not sleeping) */
+    uint64_t            wake_time;                  /* clock_ns() to wake at (0 = not sleeping) */
+    ktimer_t            sleep_timer;                /* Fires at wake_time */
 
     /* === User Mode Support (Phase 5) === */
     phys_addr_t         pml4_phys;                  /* Process page table physical address */
@@ -111,10 +180,24 @@ typedef struct process {
     uint64_t            user_rsp;                   /* Saved user RSP during syscall */
     void*               user_code;                  /* User code base (virtual) */
     size_t              user_code_size;             /* User code size */
+    user_region_t       regions[PROCESS_MAX_REGIONS]; /* Demand-zero regions (leader) */
+    uint32_t            region_count;               /* Regions in use (leader) */
+    user_mmap_t         mmaps[PROCESS_MAX_MMAPS];   /* File mappings (leader) */
+    struct user_image*  image;                      /* Program running (leader) */
+
+    /* === Threads === */
+    struct process*     group;                      /* Thread group leader (self for the leader) */
+    pid_t               tgid;                       /* Leader's PID, what getpid() returns */
+    uint32_t            thread_slot;                /* Thread stack slot + 1 (0: main stack) */
+    uint32_t            group_threads;              /* Leader: live threads, itself included */
+    uint32_t            thread_slots;               /* Leader: thread stack slots in use (bitmap) */
+    spinlock_t          vm_lock;                    /* Leader: regions, mmaps, demand faults */
 
     /* === File System Support (Phase 6) === */
     struct fd_table*    fd_table;                   /* Per-process file descriptor table */
     char                cwd[CWD_MAX];               /* Current working directory */
+    struct vnode*       cwd_vnode;                  /* cwd, referenced; relative paths start here (NULL: root) */
+    struct io_ring*     io_ring;                    /* Registered I/O ring (user address) */
 } process_t;
 
 /* =============================================================================
@@ -128,6 +211,24 @@ typedef struct process {
  */
 void process_init(void);
 
+/**
+ * Create the idle process for a CPU.
+ *
+ * Called by process_init() for the boot CPU and by smp_init() for each AP.
+ * The process is never put on a run queue; the scheduler falls back to it
+ * when the CPU's queue is empty.
+ *
+ * @param cpu CPU index
+ * @return    Idle process, or NULL if out of slots or memory
+ */
+process_t* process_create_idle(uint32_t cpu);
+
+/**
+ * Idle loop (pre-zero free pages, then halt until the next interrupt).
+ * APs enter it directly once the scheduler is running.
+ */
+NORETURN void process_idle_loop(void);
+
 /**
  * Create a new kernel process.
  *
@@ -145,17 +246,38 @@ pid_t process_create(const char* name, void (*entry)(void*), void* arg);
  * Terminate the current process.
  *
  * This function does not return. The process is marked as TERMINATED
- * and the scheduler picks the next process to run.
+ * and the scheduler picks the next process to run. Open files are closed
+ * here; the address space and the PCB slot are released later by the
+ * reaper.
  *
  * @param exit_code Exit code to store (retrievable by parent in future)
  */
 NORETURN void process_exit(int exit_code);
 
+/**
+ * Start the reaper.
+ *
+ * A kernel process that collects TERMINATED processes in batches, once
+ * they are off their CPU: it tears down the address space of a group's
+ * last thread and returns PCB slots to the free list. A group leader's
+ * slot is kept until its last thread is gone. Call once the scheduler is
+ * up; processes that exit before then are collected when it starts.
+ */
+void process_reaper_start(void);
+
+/**
+ * Find the process whose kernel stack guard page holds an address.
+ *
+ * @param addr Faulting address (CR2)
+ * @return     Process that overran its kernel stack, or NULL
+ */
+process_t* process_kstack_overflow(virt_addr_t addr);
+
 /**
  * Voluntarily yield the CPU to another process.
  *
- * The current process is moved to the end of the run queue and the
- * scheduler picks the next process to run.
+ * The current process is queued behind every other ready process and
+ * moves up one priority level (see sched_yield()).
  */
 void process_yield(void);
 
@@ -194,14 +316,36 @@ void process_block(void);
 void process_unblock(pid_t pid);
 
 /**
- * Wake up sleeping processes whose wake_tick has passed.
+ * Make a blocked process ready (wait queues, timers).
+ *
+ * @param proc Process to wake (ignored unless BLOCKED)
+ * @return     true if it was blocked
+ */
+bool process_wake(process_t* proc);
+
+/**
+ * Mark the current process BLOCKED without giving up the CPU.
  *
- * Called from the timer tick handler to unblock processes
- * that have finished sleeping.
+ * The caller then re-checks whatever it waits for and calls schedule()
+ * to sleep, or process_cancel_block() if it no longer needs to. A wake-up
+ * in between leaves it READY, so it is never lost. See proc/wait.h.
+ */
+void process_prepare_block(void);
+
+/**
+ * Return to RUNNING after process_prepare_block() without sleeping.
+ */
+void process_cancel_block(void);
+
+/**
+ * Sleep until a given time.
  *
- * @param current_tick Current system tick count
+ * Blocks the current process and arms its sleep timer; the timer wheel
+ * makes it READY again once wake_time has passed.
+ *
+ * @param wake_time clock_ns() value to wake at
  */
-void process_wake_sleeping(uint64_t current_tick);
+void process_sleep(uint64_t wake_time);
 
 /**
  * Get count of processes in a given state.
@@ -211,6 +355,14 @@ void process_wake_sleeping(uint64_t current_tick);
  */
 uint32_t process_count(int state);
 
+/**
+ * Get the process in a process table slot, for walking all processes.
+ *
+ * @param slot Slot index (0 to MAX_PROCESSES - 1)
+ * @return     Pointer to PCB, or NULL if the slot is free or out of range
+ */
+process_t* process_get_slot(uint32_t slot);
+
 /**
  * Process entry point wrapper.
  * Called by context switch to start a new process.
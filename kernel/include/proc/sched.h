@@ -2,16 +2,23 @@
  * =============================================================================
  * Chanux OS - Process Scheduler
  * =============================================================================
- * Implements a preemptive round-robin scheduler.
+ * Implements a preemptive priority scheduler.
  *
  * Scheduling Algorithm:
- *   - Round-robin with fixed time slices (100ms default)
- *   - Timer-based preemption via PIT IRQ0
- *   - Single run queue (FIFO ordering)
- *   - Idle process runs when no other process is ready
+ *   - Multi-level feedback queue: 8 levels with 20-160ms slices; processes
+ *     that use their whole slice sink, ones that yield or block rise
+ *   - Timer-based preemption. Tickless where the local APIC allows it:
+ *     each CPU programs a one-shot interrupt for its next scheduler tick
+ *     or kernel timer, and an idle CPU none at all. Otherwise periodic
+ *     PIT IRQ0 (boot CPU) and local APIC timer (other CPUs) ticks
+ *   - One run queue per CPU (FIFO ordering); new processes go to the CPU
+ *     with the shortest queue
+ *   - Idle CPUs steal from the busiest queue; a periodic rebalance moves
+ *     cache-cold processes off long queues
+ *   - Each CPU's idle process runs when nothing else is ready there
  *
  * Integration:
- *   - PIT timer calls sched_tick() on each IRQ0
+ *   - The timers call sched_tick() on each tick
  *   - Context switches update TSS.RSP0 for future interrupt handling
  *   - Processes can voluntarily yield via process_yield()
  * =============================================================================
@@ -21,6 +28,7 @@
 #define CHANUX_SCHED_H
 
 #include "process.h"
+#include "../smp.h"
 
 /* =============================================================================
  * Scheduler Configuration
@@ -28,8 +36,17 @@
  */
 
 #define SCHED_TICK_RATE         100     /* Scheduler runs at 100Hz (PIT rate) */
+#define SCHED_TICK_NS           10000000ULL /* One tick in ns (one-shot mode) */
 #define SCHED_MIN_TIME_SLICE    1       /* Minimum time slice (1 tick = 10ms) */
 #define SCHED_MAX_TIME_SLICE    100     /* Maximum time slice (1 second) */
+#define SCHED_BALANCE_TICKS     10      /* Rebalance run queues every 100ms */
+#define SCHED_BOOST_TICKS       100     /* Lift starved processes every second */
+
+/* Priority levels (SCHED_PRIORITY_LEVELS is in smp.h with the run queue) */
+#define SCHED_PRIORITY_HIGHEST  0
+#define SCHED_PRIORITY_DEFAULT  2       /* New processes start here */
+#define SCHED_PRIORITY_LOWEST   (SCHED_PRIORITY_LEVELS - 1)
+#define SCHED_CACHE_HOT_TICKS   2       /* Ran this recently: don't migrate */
 
 /* =============================================================================
  * Scheduler API
@@ -57,10 +74,22 @@ void sched_init(void);
  */
 NORETURN void sched_start(void);
 
+/**
+ * Enter the scheduler on an application processor.
+ *
+ * Called by ap_main() on the AP's idle process. Waits for sched_start()
+ * on the boot CPU, then runs whatever is queued on this CPU and idles.
+ * Never returns.
+ */
+NORETURN void sched_start_ap(void);
+
 /**
  * Timer tick handler.
  *
- * Called from PIT IRQ0 handler on each timer interrupt (100Hz).
+ * Called on each timer interrupt of every CPU: at 100Hz in periodic mode,
+ * or whenever the CPU's one-shot clock event fires. Kernel timers only run
+ * on the boot CPU; with one-shot events an interrupt before the CPU's
+ * next tick is due does no slice accounting.
  * Decrements the current process's time slice and triggers a
  * reschedule if the time quantum has expired.
  *
@@ -68,6 +97,26 @@ NORETURN void sched_start(void);
  */
 void sched_tick(registers_t* regs);
 
+/**
+ * Handle a reschedule IPI.
+ * Picks up newly queued work and re-arms the CPU's clock event (another
+ * CPU may have added an earlier kernel timer).
+ */
+void sched_handle_ipi(void);
+
+/**
+ * Idle step, called in a loop by the idle process.
+ * Switches to anything runnable here or stealable elsewhere; otherwise
+ * arms only the clock events that are needed and halts.
+ */
+void sched_idle(void);
+
+/**
+ * Note that the earliest kernel timer moved earlier (called by timer_add()).
+ * Re-arms the boot CPU's clock event so it is not slept through.
+ */
+void sched_timers_changed(void);
+
 /**
  * Request a reschedule at the next opportunity.
  *
@@ -76,6 +125,22 @@ void sched_tick(registers_t* regs);
  */
 void sched_reschedule(void);
 
+/**
+ * Give up the CPU to any other ready process.
+ *
+ * The caller is queued behind whatever else is ready (at any level) and
+ * moves up one priority level. Returns at once if nothing else is ready.
+ */
+void sched_yield(void);
+
+/**
+ * Get the time slice of a priority level.
+ *
+ * @param priority Level (SCHED_PRIORITY_HIGHEST..SCHED_PRIORITY_LOWEST)
+ * @return         Slice length in ticks
+ */
+uint32_t sched_time_slice(uint32_t priority);
+
 /**
  * Perform a context switch to the next ready process.
  *
@@ -85,10 +150,11 @@ void sched_reschedule(void);
 void schedule(void);
 
 /**
- * Add a process to the run queue.
+ * Add a process to the run queue of its CPU (proc->cpu).
  *
- * The process is added to the tail of the queue (FIFO ordering).
- * Its state is set to READY if not already.
+ * The process is added to the tail of its priority level (FIFO ordering).
+ * Its state is set to READY if not already. If the queue belongs to
+ * another CPU, that CPU is sent a reschedule IPI.
  *
  * @param proc Process to add (must not be NULL)
  */
@@ -104,15 +170,26 @@ void sched_add(process_t* proc);
 void sched_remove(process_t* proc);
 
 /**
- * Pick the next process to run.
+ * Pick the next process to run on the calling CPU.
  *
- * Removes and returns the process at the head of the run queue.
- * If the queue is empty, returns the idle process.
+ * Removes and returns the head of the most urgent non-empty level of this
+ * CPU's run queue.
+ * If the queue is empty, steals the tail of the busiest other queue;
+ * if every queue is empty, returns this CPU's idle process.
  *
  * @return Pointer to next process to run (never NULL)
  */
 process_t* sched_pick_next(void);
 
+/**
+ * Finish a context switch: mark the process switched away from as no
+ * longer on a CPU, so it may be stolen.
+ *
+ * Called right after context_switch() returns, and by
+ * process_entry_wrapper() for processes that start there instead.
+ */
+void sched_finish_switch(void);
+
 /**
  * Check if the scheduler is currently running.
  *
@@ -121,19 +198,26 @@ process_t* sched_pick_next(void);
 bool sched_is_running(void);
 
 /**
- * Get the idle process.
+ * Get the calling CPU's idle process.
  *
  * @return Pointer to the idle process PCB
  */
 process_t* sched_get_idle(void);
 
 /**
- * Get the number of processes in the run queue.
+ * Get the number of processes in the run queues of all CPUs.
  *
  * @return Number of ready processes (excluding idle)
  */
 uint32_t sched_ready_count(void);
 
+/**
+ * Choose the CPU a new process should run on.
+ *
+ * @return Index of the online CPU with the fewest queued processes
+ */
+uint32_t sched_select_cpu(void);
+
 /* =============================================================================
  * Context Switch Functions (Assembly)
  * =============================================================================
@@ -150,7 +234,8 @@ uint32_t sched_ready_count(void);
  * @param old_rsp_ptr Pointer to save current RSP (in old process's PCB)
  * @param new_rsp     RSP value to load for new process
  * @param new_rsp0    RSP0 value for TSS (new process's kernel stack top)
- * @param new_cr3     CR3 value for new process (0 = don't switch, kernel process)
+ * @param new_cr3     CR3 value for new process (0 = don't switch);
+ *                    see vmm_address_space_cr3()
  */
 extern void context_switch(uint64_t* old_rsp_ptr, uint64_t new_rsp,
                            uint64_t new_rsp0, uint64_t new_cr3);
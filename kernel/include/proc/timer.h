@@ -0,0 +1,119 @@
+/**
+ * =============================================================================
+ * Chanux OS - Kernel Timers
+ * =============================================================================
+ * One-shot callbacks at a given clock_ns() time, kept in a hierarchical
+ * timer wheel so processing only touches the timers that expire.
+ *
+ * The wheel counts in units of 2^16 ns (~65us); expiries are rounded up
+ * to the next unit, so a timer fires up to 65us late but never early.
+ *
+ * Wheel layout (five levels, each indexed by a slice of the expiry unit):
+ *   Level 0: 256 slots of 1 unit       (expires within ~16.8ms)
+ *   Level 1:  64 slots of 256 units    (within ~1.07s)
+ *   Level 2:  64 slots of 16K units    (within ~68.7s)
+ *   Level 3:  64 slots of 1M units     (within ~73 minutes)
+ *   Level 4:  64 slots of 64M units    (within ~3.3 days; later is parked)
+ *
+ * Adding and cancelling are O(1). When level 0 wraps, the next slot of
+ * level 1 is redistributed ("cascaded") into level 0, and so on upwards,
+ * so each timer is moved at most once per level.
+ *
+ * With one-shot clock events the boot CPU programs its timer interrupt
+ * for timer_next_expiry(), so an idle system takes no interrupts at all
+ * until something is due.
+ *
+ * Callbacks run from the boot CPU's timer interrupt, with interrupts
+ * disabled and no timer lock held: they may add timers and wake processes
+ * but must not block.
+ *
+ * Typical use:
+ *   timer_init(&t, my_timeout, arg);
+ *   timer_add(&t, clock_ns() + 500 * NSEC_PER_MSEC);
+ *   ...
+ *   timer_cancel(&t);                        // if it is no longer needed
+ * =============================================================================
+ */
+
+#ifndef CHANUX_TIMER_H
+#define CHANUX_TIMER_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * Timer Structure
+ * =============================================================================
+ */
+
+typedef struct ktimer {
+    struct ktimer*      next;                       /* Slot list */
+    struct ktimer**     pprev;                      /* Pointer that points at us */
+    uint64_t            expires;                    /* clock_ns() to fire at */
+    void                (*fn)(void* arg);           /* Callback */
+    void*               arg;                        /* Callback argument */
+    volatile bool       pending;                    /* Queued in the wheel */
+} ktimer_t;
+
+/* =============================================================================
+ * Timer API
+ * =============================================================================
+ */
+
+/**
+ * Initialize the timer wheel.
+ * Must be called before the first timer_add() (done by sched_init()).
+ */
+void timer_wheel_init(void);
+
+/**
+ * Prepare a timer (not pending)
+ *
+ * @param timer Timer to initialize
+ * @param fn    Callback to run when it expires
+ * @param arg   Argument passed to fn
+ */
+void timer_init(ktimer_t* timer, void (*fn)(void* arg), void* arg);
+
+/**
+ * Arm a timer, or move it if it is already pending
+ * A time already past fires at the next timer_tick().
+ *
+ * @param timer   Initialized timer
+ * @param expires clock_ns() value to fire at
+ */
+void timer_add(ktimer_t* timer, uint64_t expires);
+
+/**
+ * Disarm a timer
+ * The callback may already be running on the boot CPU when this returns.
+ *
+ * @param timer Timer to cancel
+ * @return true if it was pending (and now will not fire)
+ */
+bool timer_cancel(ktimer_t* timer);
+
+/**
+ * Check whether a timer is armed
+ */
+static inline bool timer_pending(const ktimer_t* timer) {
+    return timer->pending;
+}
+
+/**
+ * Get the time the wheel next needs timer_tick()
+ * This is a timer expiry or an internal cascade; it may be early (after
+ * a cancel) but is never late.
+ *
+ * @return clock_ns() value, or UINT64_MAX if no timer is pending
+ */
+uint64_t timer_next_expiry(void);
+
+/**
+ * Run every timer that has expired by 'now_ns'
+ * Called from sched_tick() on the boot CPU.
+ *
+ * @param now_ns Current clock_ns()
+ */
+void timer_tick(uint64_t now_ns);
+
+#endif /* CHANUX_TIMER_H */
@@ -0,0 +1,128 @@
+/**
+ * =============================================================================
+ * Chanux OS - Wait Queues
+ * =============================================================================
+ * Lets processes sleep until an event (input arriving, a pipe draining, a
+ * futex word changing) instead of polling for it.
+ *
+ * A waiter links a wait_entry_t (on its own kernel stack) into the queue,
+ * marks itself BLOCKED, re-checks its condition and only then gives up the
+ * CPU. A waker that changes the condition first and then calls wake_up()
+ * therefore cannot be missed: either the waiter sees the new condition,
+ * or it is already on the queue and is made READY.
+ *
+ * Wake-ups may be spurious (wake_up() wakes everyone), so waiters always
+ * loop on their condition; wait_event() does that.
+ *
+ * Typical use:
+ *   static wait_queue_t data_wq = WAIT_QUEUE_INIT(data_wq);
+ *
+ *   // consumer
+ *   wait_event(&data_wq, buffer_has_data());
+ *
+ *   // producer (may run in an interrupt handler)
+ *   buffer_put(c);
+ *   wake_up(&data_wq);
+ * =============================================================================
+ */
+
+#ifndef CHANUX_WAIT_H
+#define CHANUX_WAIT_H
+
+#include "../types.h"
+#include "../kernel.h"
+#include "../spinlock.h"
+
+struct process;
+
+/* For wait_event(), without pulling in sched.h */
+void schedule(void);
+
+/* =============================================================================
+ * Wait Queue Structures
+ * =============================================================================
+ */
+
+typedef struct wait_entry {
+    struct wait_entry*  next;
+    struct wait_entry*  prev;
+    struct process*     proc;                       /* Waiting process */
+    bool                queued;                     /* Linked into a queue */
+} wait_entry_t;
+
+typedef struct wait_queue {
+    spinlock_t          lock;
+    wait_entry_t*       head;                       /* Oldest waiter */
+    wait_entry_t*       tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT(name)   { SPINLOCK_INIT, NULL, NULL }
+
+/* =============================================================================
+ * Wait Queue API
+ * =============================================================================
+ */
+
+/**
+ * Initialize an empty wait queue
+ */
+void wait_queue_init(wait_queue_t* wq);
+
+/**
+ * Queue the current process and mark it BLOCKED (it keeps running)
+ * Call with interrupts disabled, then check the wake condition and either
+ * schedule() or wait_finish().
+ *
+ * @param wq    Queue to wait on
+ * @param entry Caller's entry (stays linked until woken or wait_finish())
+ */
+void wait_prepare(wait_queue_t* wq, wait_entry_t* entry);
+
+/**
+ * Stop waiting: make the current process RUNNING and unlink its entry
+ */
+void wait_finish(wait_queue_t* wq, wait_entry_t* entry);
+
+/**
+ * Wake every waiter (safe from interrupt handlers)
+ *
+ * @return Number of processes woken
+ */
+int wake_up(wait_queue_t* wq);
+
+/**
+ * Wake the longest waiting process only
+ *
+ * @return 1 if a process was woken, 0 if the queue was empty
+ */
+int wake_up_one(wait_queue_t* wq);
+
+/**
+ * Check whether anyone is waiting (unlocked snapshot)
+ */
+static inline bool wait_queue_active(const wait_queue_t* wq) {
+    return wq->head != NULL;
+}
+
+/**
+ * Sleep until 'condition' is true
+ * The condition is evaluated with interrupts disabled, once before
+ * sleeping and again after every wake-up. Must not be used by the idle
+ * process or before the scheduler runs.
+ */
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        wait_entry_t __wait_entry = { 0 };                          \
+        uint64_t __wait_flags = irq_save();                         \
+        for (;;) {                                                  \
+            wait_prepare((wq), &__wait_entry);                      \
+            if (condition) {                                        \
+                break;                                              \
+            }                                                       \
+            schedule();                                             \
+        }                                                           \
+        wait_finish((wq), &__wait_entry);                           \
+        irq_restore(__wait_flags);                                  \
+    } while (0)
+
+#endif /* CHANUX_WAIT_H */
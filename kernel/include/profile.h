@@ -0,0 +1,71 @@
+/**
+ * =============================================================================
+ * Chanux OS - Sampling Profiler
+ * =============================================================================
+ * While profiling is on, every scheduler tick records where the CPU was
+ * interrupted: RIP, the running PID, and whether it was in user or kernel
+ * mode. That is one sample per 10ms tick on each busy CPU; idle CPUs in
+ * tickless mode take no ticks and so no samples.
+ *
+ * Each CPU has its own ring that only it writes, from the timer interrupt,
+ * so taking a sample is a handful of stores and one release store of the
+ * head. When a ring is full, new samples are counted and dropped until
+ * user space drains it with profile(PROFILE_READ, ...).
+ *
+ * The shell's `profile dump` prints the samples on the console (and
+ * serial port), and scripts/profsym.c turns that into a flat profile or
+ * folded stacks against build/kernel.elf (`make profile`).
+ * =============================================================================
+ */
+
+#ifndef CHANUX_PROFILE_H
+#define CHANUX_PROFILE_H
+
+#include "types.h"
+#include "interrupts/isr.h"
+#include "syscall/syscall.h"
+
+/* Samples each CPU's ring holds (power of 2): about 20s of ticks */
+#define PROFILE_RING_SAMPLES    2048
+
+/* =============================================================================
+ * Profiler API
+ * =============================================================================
+ */
+
+/**
+ * Start profiling, discarding samples left from an earlier run.
+ * Allocates rings for CPUs that do not have one yet.
+ *
+ * @return 0 on success, -1 if a ring cannot be allocated
+ */
+int profile_start(void);
+
+/**
+ * Stop taking samples (the rings keep theirs until read or restarted).
+ */
+void profile_stop(void);
+
+/**
+ * Take one sample on the calling CPU.
+ * Called from sched_tick() with interrupts off.
+ *
+ * @param regs Interrupted context
+ */
+void profile_sample(const registers_t* regs);
+
+/**
+ * Move samples out of the rings, oldest first within each CPU.
+ *
+ * @param buf   Destination (kernel memory)
+ * @param count Room in buf, in samples
+ * @return Samples copied
+ */
+size_t profile_read(profile_sample_t* buf, size_t count);
+
+/**
+ * Samples dropped on full rings since profile_start().
+ */
+uint64_t profile_dropped(void);
+
+#endif /* CHANUX_PROFILE_H */
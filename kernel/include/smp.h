@@ -0,0 +1,171 @@
+/**
+ * =============================================================================
+ * Chanux OS - Symmetric Multiprocessing
+ * =============================================================================
+ * Per-CPU data and application processor (AP) bring-up.
+ *
+ * Each CPU owns a cpu_t. While in the kernel, IA32_GS_BASE points at it so
+ * cpu_this() is a single gs-relative load; SWAPGS exchanges it with the
+ * (zero) user GS base on every ring 3 <-> ring 0 transition. The first
+ * fields have fixed offsets because syscall.asm reads them directly.
+ *
+ * Boot sequence:
+ *   1. smp_init_bsp()  - per-CPU data for the boot CPU, before anything
+ *                        that calls cpu_this() (the PMM's page caches)
+ *   2. smp_init()      - start every other enabled CPU listed in the MADT:
+ *                        INIT, then two STARTUP IPIs pointing at the real
+ *                        mode trampoline (ap_boot.asm) copied to
+ *                        AP_TRAMPOLINE_ADDR
+ *   3. Each AP loads its own GDT/TSS, the IDT, the kernel page tables and
+ *      the SYSCALL MSRs, starts its APIC timer, and idles until the
+ *      scheduler is running.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_SMP_H
+#define CHANUX_SMP_H
+
+#include "types.h"
+#include "gdt.h"
+#include "spinlock.h"
+
+struct process;
+
+/* =============================================================================
+ * Configuration
+ * =============================================================================
+ */
+
+#define SMP_MAX_CPUS            16
+
+/* Run queue priority levels (see sched.h) */
+#define SCHED_PRIORITY_LEVELS   8
+
+/* Real-mode entry point for APs: must be page-aligned and below 1MB */
+#define AP_TRAMPOLINE_ADDR      0x8000
+
+/* IA32_GS_BASE / IA32_KERNEL_GS_BASE (the one SWAPGS swaps in) */
+#define MSR_GS_BASE             0xC0000101
+#define MSR_KERNEL_GS_BASE      0xC0000102
+
+/* cpu_t offsets used from assembly */
+#define CPU_OFFSET_SELF         0
+#define CPU_OFFSET_KSTACK_TOP   8
+#define CPU_OFFSET_USER_RSP     16
+#define CPU_OFFSET_CURRENT      24
+
+/* =============================================================================
+ * Per-CPU Data
+ * =============================================================================
+ */
+
+/**
+ * Run queue of one CPU: a FIFO per priority level
+ * Any CPU may add to it. The owner takes processes off the head of the
+ * most urgent level; other CPUs steal from the tail of the least urgent,
+ * skipping processes whose context is still live (process_t.on_cpu).
+ */
+typedef struct {
+    spinlock_t          lock;
+    struct process*     head[SCHED_PRIORITY_LEVELS];
+    struct process*     tail[SCHED_PRIORITY_LEVELS];
+    uint32_t            bitmap;                     /* Bit n: level n non-empty */
+    uint32_t            count;                      /* Processes queued */
+} sched_rq_t;
+
+typedef struct cpu {
+    struct cpu*         self;                       /* gs:0 - for cpu_this() */
+    uint64_t            kstack_top;                 /* gs:8 - RSP loaded on SYSCALL */
+    uint64_t            user_rsp;                   /* gs:16 - RSP saved on SYSCALL */
+    struct process*     current;                    /* gs:24 - running process */
+
+    uint32_t            id;                         /* Index into the CPU table */
+    uint32_t            apic_id;                    /* Local APIC ID */
+    uint32_t            node;                       /* NUMA node (acpi_cpu_node()) */
+    volatile bool       online;                     /* Running kernel code */
+    tss_t*              tss;                        /* This CPU's TSS */
+
+    /* Scheduling */
+    sched_rq_t          rq;                         /* Ready processes */
+    struct process*     idle;                       /* Runs when rq is empty */
+    struct process*     switched_from;              /* Until its context is saved */
+    volatile bool       need_reschedule;            /* Switch at the next tick */
+    bool                yielding;                   /* schedule() called from sched_yield() */
+    uint32_t            balance_ticks;              /* Ticks until the next rebalance */
+    uint32_t            boost_ticks;                /* Ticks until the next priority boost */
+    uint64_t            next_tick_ns;               /* Next scheduler tick (one-shot mode) */
+
+    /* Pending TLB shootdown (set by the sender, cleared here) */
+    volatile uint32_t   tlb_pending;
+} cpu_t;
+
+_Static_assert(__builtin_offsetof(cpu_t, self) == CPU_OFFSET_SELF, "cpu_t.self");
+_Static_assert(__builtin_offsetof(cpu_t, kstack_top) == CPU_OFFSET_KSTACK_TOP, "cpu_t.kstack_top");
+_Static_assert(__builtin_offsetof(cpu_t, user_rsp) == CPU_OFFSET_USER_RSP, "cpu_t.user_rsp");
+_Static_assert(__builtin_offsetof(cpu_t, current) == CPU_OFFSET_CURRENT, "cpu_t.current");
+
+/**
+ * Get the calling CPU's data
+ * Valid from smp_init_bsp() on (boot CPU) or ap_main() on (APs).
+ */
+static inline cpu_t* cpu_this(void) {
+    cpu_t* cpu;
+    __asm__ volatile ("movq %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+/* =============================================================================
+ * SMP API
+ * =============================================================================
+ */
+
+/**
+ * Set up per-CPU data for the boot CPU and point GS at it
+ * Must be the first thing kernel_main() does.
+ */
+void smp_init_bsp(void);
+
+/**
+ * Start the application processors listed in the MADT
+ * Must be called after acpi_init(), lapic_init() and process_init(), with
+ * interrupts enabled. CPUs that do not come up in time are skipped.
+ */
+void smp_init(void);
+
+/**
+ * Get a CPU by index
+ *
+ * @param id CPU index (0 = boot CPU)
+ * @return CPU data, or NULL if id is out of range or the CPU is not online
+ */
+cpu_t* cpu_get(uint32_t id);
+
+/**
+ * Get the number of CPUs online
+ */
+uint32_t smp_cpu_count(void);
+
+/**
+ * Ask another CPU to look at its run queue now
+ *
+ * @param cpu Target CPU (ignored if it is the caller)
+ */
+void smp_send_reschedule(cpu_t* cpu);
+
+/**
+ * Invalidate a kernel-half range in every other CPU's TLB
+ * Waits until all of them have flushed, so the caller may reuse the
+ * frames afterwards. The caller flushes its own TLB.
+ *
+ * @param virt Start of the range
+ * @param size Size in bytes
+ */
+void smp_tlb_shootdown(virt_addr_t virt, size_t size);
+
+/**
+ * Service a pending TLB shootdown for the calling CPU
+ * Safe to call with interrupts disabled; spin loops call it.
+ */
+void smp_poll_ipi(void);
+
+#endif /* CHANUX_SMP_H */
@@ -0,0 +1,86 @@
+/**
+ * =============================================================================
+ * Chanux OS - Spinlocks
+ * =============================================================================
+ * Test-and-test-and-set spinlocks for data shared between CPUs.
+ *
+ * A lock that is also taken from interrupt handlers must be held with
+ * interrupts off on the local CPU, so use spin_lock_irqsave() for those.
+ * spin_lock() alone only excludes other CPUs.
+ *
+ * A CPU spinning with interrupts off cannot take the TLB shootdown IPI, so
+ * the spin loop services pending shootdowns itself (smp_poll_ipi()). Without
+ * that, a CPU waiting on a lock held by a CPU that is waiting for its
+ * shootdown acknowledgement would deadlock.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_SPINLOCK_H
+#define CHANUX_SPINLOCK_H
+
+#include "kernel.h"
+#include "types.h"
+
+/* =============================================================================
+ * Spinlock Type
+ * =============================================================================
+ */
+
+typedef struct {
+    volatile uint32_t locked;       /* 1 while held */
+} spinlock_t;
+
+#define SPINLOCK_INIT   { 0 }
+
+/* Service IPIs that must not wait for interrupts to be re-enabled (smp.c) */
+void smp_poll_ipi(void);
+
+/* =============================================================================
+ * Spinlock API
+ * =============================================================================
+ */
+
+static inline void spin_init(spinlock_t* lock) {
+    lock->locked = 0;
+}
+
+/* Try to take the lock once; true on success */
+static inline bool spin_trylock(spinlock_t* lock) {
+    return __atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+/* Take the lock, spinning until it is free */
+static inline void spin_lock(spinlock_t* lock) {
+    while (!spin_trylock(lock)) {
+        /* Spin on a plain read so the cache line stays shared */
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            smp_poll_ipi();
+            cpu_pause();
+        }
+    }
+}
+
+/* Release the lock */
+static inline void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* Check whether the lock is currently held (by anyone) */
+static inline bool spin_is_locked(spinlock_t* lock) {
+    return __atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0;
+}
+
+/* Disable local interrupts, then take the lock; returns the saved RFLAGS */
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+/* Release the lock and restore the interrupt flag from spin_lock_irqsave() */
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif /* CHANUX_SPINLOCK_H */
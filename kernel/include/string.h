@@ -16,6 +16,12 @@
  * =============================================================================
  */
 
+/**
+ * Pick the fastest memcpy/memset path for this CPU (REP MOVSB, SSE2 or
+ * 64-bit words). Call after fpu_init(); until then the word path is used.
+ */
+void string_init(void);
+
 /**
  * Fill memory with a constant byte
  * @param dest  Pointer to the block of memory to fill
@@ -0,0 +1,86 @@
+/**
+ * =============================================================================
+ * Chanux OS - Batched File I/O Ring
+ * =============================================================================
+ * A submission/completion ring in the caller's own memory, registered once
+ * with SYS_IO_RING_SETUP. User space fills submission entries (SQEs) and
+ * advances sq_tail; one SYS_IO_RING_ENTER then runs the whole batch and
+ * posts a completion entry (CQE) per SQE, in submission order. Directory
+ * listings and many-small-file tools pay one kernel crossing per batch
+ * instead of one per operation.
+ *
+ * Ownership of the indices:
+ *   sq_head, cq_tail   written by the kernel
+ *   sq_tail, cq_head   written by user space
+ * All four count up without wrapping at IO_RING_ENTRIES; the slot of index
+ * i is i & IO_RING_MASK. The kernel stops consuming SQEs while the CQ is
+ * full, so completions are never dropped.
+ *
+ * Every pointer in an SQE is checked exactly as the matching system call
+ * would check it. Must match user/include/syscall.h.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_IO_RING_H
+#define CHANUX_IO_RING_H
+
+#include "../types.h"
+
+/* =============================================================================
+ * Ring Geometry
+ * =============================================================================
+ */
+
+#define IO_RING_ENTRIES         64                  /* Power of two */
+#define IO_RING_MASK            (IO_RING_ENTRIES - 1)
+
+/* =============================================================================
+ * Operations
+ * =============================================================================
+ * Each runs the same code as the system call of the same name; res is
+ * that call's return value.
+ */
+
+#define IO_OP_NOP               0       /* res = 0 */
+#define IO_OP_OPEN              1       /* addr = path, len = flags */
+#define IO_OP_CLOSE             2       /* fd */
+#define IO_OP_READ              3       /* fd, addr = buffer, len */
+#define IO_OP_WRITE             4       /* fd, addr = buffer, len */
+#define IO_OP_LSEEK             5       /* fd, off, len = whence */
+#define IO_OP_STAT              6       /* addr = path, addr2 = stat buffer */
+#define IO_OP_FSTAT             7       /* fd, addr = stat buffer */
+#define IO_OP_READDIR           8       /* fd, addr = dirent, off = index */
+#define IO_OP_PREAD             9       /* fd, addr = buffer, len, off */
+#define IO_OP_PWRITE            10      /* fd, addr = buffer, len, off */
+
+/* =============================================================================
+ * Ring Structures
+ * =============================================================================
+ */
+
+typedef struct io_sqe {
+    uint8_t             opcode;                     /* IO_OP_* */
+    uint8_t             reserved[3];
+    int32_t             fd;
+    uint64_t            addr;                       /* Buffer or path */
+    uint64_t            addr2;                      /* Second buffer */
+    uint64_t            len;                        /* Length, flags or whence */
+    int64_t             off;                        /* Offset or index */
+    uint64_t            user_data;                  /* Copied to the CQE */
+} io_sqe_t;
+
+typedef struct io_cqe {
+    uint64_t            user_data;                  /* From the SQE */
+    int64_t             res;                        /* Result or -errno */
+} io_cqe_t;
+
+typedef struct io_ring {
+    uint32_t            sq_head;                    /* Next SQE the kernel runs */
+    uint32_t            sq_tail;                    /* Next free SQE slot */
+    uint32_t            cq_head;                    /* Next CQE user space reads */
+    uint32_t            cq_tail;                    /* Next CQE slot the kernel fills */
+    io_sqe_t            sq[IO_RING_ENTRIES];
+    io_cqe_t            cq[IO_RING_ENTRIES];
+} io_ring_t;
+
+#endif /* CHANUX_IO_RING_H */
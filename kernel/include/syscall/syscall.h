@@ -21,6 +21,7 @@
 #define CHANUX_SYSCALL_H
 
 #include "../types.h"
+#include "../trace.h"
 
 /* =============================================================================
  * System Call Numbers
@@ -44,7 +45,30 @@
 #define SYS_GETCWD      12      /* int getcwd(char* buf, size_t size) */
 #define SYS_CHDIR       13      /* int chdir(const char* path) */
 
-#define SYS_MAX         14      /* Number of system calls */
+#define SYS_FORK        14      /* pid_t fork(void) */
+#define SYS_NANOSLEEP   15      /* int nanosleep(uint64_t ns) */
+#define SYS_IO_RING_SETUP 16    /* int io_ring_setup(io_ring_t* ring) */
+#define SYS_IO_RING_ENTER 17    /* int io_ring_enter(uint32_t to_submit) */
+#define SYS_READV       18      /* ssize_t readv(int fd, const iovec_t* iov, int iovcnt) */
+#define SYS_WRITEV      19      /* ssize_t writev(int fd, const iovec_t* iov, int iovcnt) */
+#define SYS_PREAD       20      /* ssize_t pread(int fd, void* buf, size_t len, off_t off) */
+#define SYS_PWRITE      21      /* ssize_t pwrite(int fd, const void* buf, size_t len, off_t off) */
+#define SYS_SENDFILE    22      /* ssize_t sendfile(int out, int in, off_t* off, size_t len) */
+#define SYS_COPY_FILE_RANGE 23  /* ssize_t copy_file_range(int in, off_t* in_off, int out, off_t* out_off, size_t len) */
+#define SYS_MMAP        24      /* void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off) */
+#define SYS_MUNMAP      25      /* int munmap(void* addr, size_t len) */
+#define SYS_SYNC        26      /* int sync(void) */
+#define SYS_PIPE        27      /* int pipe(int fds[2]) */
+#define SYS_DUP2        28      /* int dup2(int oldfd, int newfd) */
+#define SYS_FUTEX_WAIT  29      /* int futex_wait(uint32_t* addr, uint32_t val) */
+#define SYS_FUTEX_WAKE  30      /* int futex_wake(uint32_t* addr, int count) */
+#define SYS_THREAD_CREATE 31    /* pid_t thread_create(void* entry, void* arg0, void* arg1) */
+#define SYS_KLOG_READ   32      /* ssize_t klog_read(char* buf, size_t len) */
+#define SYS_SYSSTAT     33      /* int sysstat(syscall_stat_t* stats, size_t count) */
+#define SYS_PROFILE     34      /* ssize_t profile(int op, profile_sample_t* buf, size_t count) */
+#define SYS_TRACE       35      /* ssize_t trace(int op, trace_record_t* buf, size_t arg) */
+
+#define SYS_MAX         36      /* Number of system calls (also fed to syscall.asm by the Makefile) */
 
 /* =============================================================================
  * Error Codes (negative return values)
@@ -57,16 +81,20 @@
 #define EINVAL          22      /* Invalid argument */
 #define EINTR           4       /* Interrupted system call */
 #define ENOMEM          12      /* Out of memory */
+#define EAGAIN          11      /* Resource temporarily unavailable */
 
 /* Phase 6: Additional error codes */
 #define ENOENT          2       /* No such file or directory */
 #define EIO             5       /* I/O error */
 #define EACCES          13      /* Permission denied */
 #define EEXIST          17      /* File exists */
+#define ENODEV          19      /* No such device (mmap of the console, sync without a disk) */
 #define ENOTDIR         20      /* Not a directory */
 #define EISDIR          21      /* Is a directory */
 #define EMFILE          24      /* Too many open files */
 #define ENOSPC          28      /* No space left on device */
+#define ESPIPE          29      /* Illegal seek (positional I/O on the console or a pipe) */
+#define EPIPE           32      /* Write to a pipe with no reader */
 #define ERANGE          34      /* Result too large */
 #define ENAMETOOLONG    36      /* File name too long */
 
@@ -112,6 +140,96 @@ typedef struct {
     uint64_t user_rsp;
 } syscall_frame_t;
 
+/* =============================================================================
+ * User ABI Structures
+ * =============================================================================
+ * What stat/fstat and readdir hand to user space; the kernel's own stat_t
+ * and ramfs_dirent_t are converted. Must match user/include/syscall.h.
+ */
+
+#define USER_S_IFREG    1       /* Regular file */
+#define USER_S_IFDIR    2       /* Directory */
+#define USER_S_IFIFO    3       /* Pipe (fstat only) */
+
+typedef struct {
+    uint32_t    st_mode;        /* USER_S_IF* */
+    uint64_t    st_size;
+    uint64_t    st_ino;
+    uint32_t    st_nlink;
+    uint32_t    st_uid;
+    uint32_t    st_gid;
+    uint32_t    st_blksize;
+    uint64_t    st_blocks;
+} user_stat_t;
+
+typedef struct {
+    uint32_t    d_ino;
+    uint32_t    d_type;         /* USER_S_IF* */
+    char        d_name[256];
+} user_dirent_t;
+
+/* =============================================================================
+ * Vectored I/O
+ * =============================================================================
+ */
+
+#define IOV_MAX         16      /* Most iovec entries per readv/writev */
+
+typedef struct iovec {
+    void*       iov_base;       /* Buffer (user space) */
+    size_t      iov_len;        /* Buffer length */
+} iovec_t;
+
+/* =============================================================================
+ * Memory Mapping
+ * =============================================================================
+ */
+
+#define PROT_READ       0x1     /* Pages can be read (always true on x86) */
+#define PROT_WRITE      0x2     /* Pages can be written */
+#define PROT_EXEC       0x4     /* Pages can be executed */
+
+#define MAP_SHARED      0x01    /* Writes go to the file */
+#define MAP_PRIVATE     0x02    /* Writes go to a private copy */
+
+/* =============================================================================
+ * Syscall Statistics
+ * =============================================================================
+ * One record per syscall number, as sysstat() returns them (summed over
+ * all CPUs). Latency runs from entry to return, so time spent blocked or
+ * sleeping inside the call counts.
+ */
+
+#define SYSSTAT_BUCKETS 32      /* Bucket i: [2^i, 2^(i+1)) ns; the last one takes the rest */
+
+typedef struct {
+    uint64_t    calls;
+    uint64_t    errors;         /* Calls that returned a negative value */
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint32_t    hist[SYSSTAT_BUCKETS];
+} syscall_stat_t;
+
+/* =============================================================================
+ * Profiler
+ * =============================================================================
+ * profile() operations and the samples PROFILE_READ returns (profile.h).
+ */
+
+#define PROFILE_START       0   /* Discard old samples and start sampling */
+#define PROFILE_STOP        1   /* Stop sampling */
+#define PROFILE_READ        2   /* Move up to count samples into buf */
+#define PROFILE_DROPPED     3   /* Samples lost to full rings since the start */
+
+#define PROFILE_SAMPLE_USER 0x1 /* Interrupted in user mode */
+
+typedef struct {
+    uint64_t    rip;            /* Interrupted instruction */
+    uint32_t    pid;            /* Running process (0: none yet) */
+    uint16_t    cpu;
+    uint16_t    flags;          /* PROFILE_SAMPLE_* */
+} profile_sample_t;
+
 /* =============================================================================
  * Syscall Handler Function Type
  * =============================================================================
@@ -132,15 +250,49 @@ typedef int64_t (*syscall_fn_t)(uint64_t arg1, uint64_t arg2, uint64_t arg3,
 void syscall_init(void);
 
 /**
- * System call dispatcher.
- * Called from assembly after saving registers.
+ * Program the SYSCALL/SYSRET MSRs of the calling CPU.
+ * syscall_init() does this for the boot CPU; each AP calls it as it starts.
+ */
+void syscall_init_cpu(void);
+
+/**
+ * Set the kernel stack loaded on SYSCALL entry on this CPU.
+ * Implemented in syscall.asm; called on every context switch.
+ *
+ * @param stack_top Kernel stack top of the process about to run
+ */
+extern void syscall_set_kernel_stack(uint64_t stack_top);
+
+/**
+ * Get the kernel stack loaded on SYSCALL entry on this CPU.
+ */
+extern uint64_t syscall_get_kernel_stack(void);
+
+/**
+ * System call handlers, indexed by number.
+ * syscall_entry calls them directly with the user's arguments; a NULL
+ * entry or out-of-range number goes to syscall_invalid().
+ */
+extern syscall_fn_t syscall_table[SYS_MAX];
+
+/**
+ * Handle an unknown system call number.
+ * Called from assembly.
+ *
+ * @param num Syscall number (from RAX)
+ * @return    -ENOSYS
+ */
+int64_t syscall_invalid(uint64_t num);
+
+/**
+ * Count a finished system call on this CPU.
+ * Called from assembly, with interrupts off, for every call that returns.
  *
- * @param num  Syscall number (from RAX)
- * @param arg1-arg6  Syscall arguments
- * @return     Return value for syscall (placed in RAX)
+ * @param num       Syscall number
+ * @param start_tsc TSC read on entry
+ * @param ret       Value going back to user space
  */
-int64_t syscall_dispatch(uint64_t num, uint64_t arg1, uint64_t arg2,
-                         uint64_t arg3, uint64_t arg4, uint64_t arg5);
+void syscall_account(uint64_t num, uint64_t start_tsc, int64_t ret);
 
 /* =============================================================================
  * Individual System Call Handlers
@@ -152,10 +304,23 @@ NORETURN void sys_exit(int code);
 int64_t sys_yield(void);
 int64_t sys_getpid(void);
 int64_t sys_sleep(uint64_t ms);
+int64_t sys_fork(void);
+int64_t sys_nanosleep(uint64_t ns);
+int64_t sys_futex_wait(uint32_t* addr, uint32_t val);
+int64_t sys_futex_wake(uint32_t* addr, int count);
+int64_t sys_thread_create(void* entry, void* arg0, void* arg1);
 
 /* I/O operations */
 int64_t sys_write(int fd, const void* buf, size_t len);
 int64_t sys_read(int fd, void* buf, size_t len);
+int64_t sys_readv(int fd, const iovec_t* iov, int iovcnt);
+int64_t sys_writev(int fd, const iovec_t* iov, int iovcnt);
+int64_t sys_pread(int fd, void* buf, size_t len, int64_t offset);
+int64_t sys_pwrite(int fd, const void* buf, size_t len, int64_t offset);
+int64_t sys_sendfile(int out_fd, int in_fd, int64_t* offset, size_t count);
+int64_t sys_copy_file_range(int fd_in, int64_t* off_in, int fd_out, int64_t* off_out,
+                            size_t len);
+int64_t sys_klog_read(char* buf, size_t len);
 
 /* File system operations (Phase 6) */
 int64_t sys_open(const char* path, int flags);
@@ -166,6 +331,22 @@ int64_t sys_fstat(int fd, void* buf);
 int64_t sys_readdir(int fd, void* entry, int index);
 int64_t sys_getcwd(char* buf, size_t size);
 int64_t sys_chdir(const char* path);
+int64_t sys_sync(void);
+int64_t sys_pipe(int* fds);
+int64_t sys_dup2(int oldfd, int newfd);
+
+/* Batched file I/O (syscall/io_ring.h) */
+int64_t sys_io_ring_setup(void* ring);
+int64_t sys_io_ring_enter(uint32_t to_submit);
+
+/* Memory mapping */
+int64_t sys_mmap(void* addr, size_t length, int prot, int flags, int fd, int64_t offset);
+int64_t sys_munmap(void* addr, size_t length);
+
+/* Statistics */
+int64_t sys_sysstat(syscall_stat_t* stats, size_t count);
+int64_t sys_profile(int op, profile_sample_t* buf, size_t count);
+int64_t sys_trace(int op, trace_record_t* buf, size_t arg);
 
 /* =============================================================================
  * Assembly Functions (defined in syscall.asm)
@@ -174,8 +355,17 @@ int64_t sys_chdir(const char* path);
 
 /**
  * Syscall entry point (called by SYSCALL instruction).
- * Saves registers and calls syscall_dispatch().
+ * Saves registers and calls the handler from syscall_table.
  */
 extern void syscall_entry(void);
 
+/**
+ * Return from fork() in a new child process.
+ * Restores the user context from a copy of the parent's syscall frame and
+ * enters user mode via SYSRET with RAX = 0.
+ *
+ * @param frame Saved frame (on the child's kernel stack)
+ */
+extern NORETURN void syscall_fork_return(const syscall_frame_t* frame);
+
 #endif /* CHANUX_SYSCALL_H */
@@ -0,0 +1,143 @@
+/**
+ * =============================================================================
+ * Chanux OS - Tracepoints
+ * =============================================================================
+ * Static tracepoints in the scheduler, memory management, VFS and IRQ paths
+ * that can be switched on at run time, unlike the DBG_*() printf toggles.
+ * Each one writes a fixed-size binary record (timestamp, CPU, PID, event,
+ * two arguments) to its CPU's trace ring.
+ *
+ * A disabled tracepoint costs one load and a not-taken branch: TRACE()
+ * tests the category against trace_mask before calling out. Enabled, it
+ * is a few stores with interrupts briefly off (an IRQ tracepoint may
+ * interrupt any other one on the same CPU). When a ring is full, new
+ * records are counted and dropped until user space drains it.
+ *
+ * Events are either instants or BEGIN/END pairs, which the host tool
+ * (scripts/trace2json.c) turns into slices of a Chrome trace / Perfetto
+ * timeline. A pair always ends in the process it began in, even when the
+ * process blocked or moved to another CPU in between.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_TRACE_H
+#define CHANUX_TRACE_H
+
+#include "types.h"
+
+/* =============================================================================
+ * Categories (trace(TRACE_START, NULL, categories))
+ * =============================================================================
+ */
+
+#define TRACE_SCHED             0x01    /* Context switches */
+#define TRACE_MM                0x02    /* Page faults, page and heap allocations */
+#define TRACE_VFS               0x04    /* vfs_open(), reads and writes */
+#define TRACE_IRQ               0x08    /* Hardware interrupts */
+#define TRACE_ALL               0x0F
+
+/* =============================================================================
+ * Events
+ * =============================================================================
+ * Arguments, in order; END records carry their own.
+ */
+
+#define TRACE_EV_SCHED_SWITCH   1       /* Instant: prev PID, next PID */
+#define TRACE_EV_PAGE_FAULT     2       /* BEGIN: address, error code */
+#define TRACE_EV_PMM_ALLOC      3       /* Instant: frame (0: failed), pages */
+#define TRACE_EV_KMALLOC        4       /* Instant: size, pointer (0: failed) */
+#define TRACE_EV_VFS_OPEN       5       /* BEGIN: flags; END: result, inode */
+#define TRACE_EV_VFS_READ       6       /* BEGIN: count, offset; END: result, inode */
+#define TRACE_EV_VFS_WRITE      7       /* BEGIN: count, offset; END: result, inode */
+#define TRACE_EV_IRQ            8       /* BEGIN and END: vector */
+
+#define TRACE_INSTANT           0
+#define TRACE_BEGIN             1
+#define TRACE_END               2
+
+/* =============================================================================
+ * Records and trace() Operations
+ * =============================================================================
+ * Shared with user space (user/include/syscall.h).
+ */
+
+typedef struct {
+    uint64_t    ts_ns;          /* clock_ns() */
+    uint32_t    pid;            /* Running process (0: none yet) */
+    uint16_t    cpu;
+    uint8_t     event;          /* TRACE_EV_* */
+    uint8_t     phase;          /* TRACE_INSTANT, TRACE_BEGIN or TRACE_END */
+    uint64_t    arg0;
+    uint64_t    arg1;
+} trace_record_t;
+
+#define TRACE_START             0       /* Drop old records, trace these categories */
+#define TRACE_STOP              1
+#define TRACE_READ              2       /* Move up to count records into buf */
+#define TRACE_DROPPED           3       /* Records lost to full rings since the start */
+
+/* Records each CPU's ring holds (power of 2) */
+#define TRACE_RING_RECORDS      4096
+
+/* =============================================================================
+ * Tracepoints
+ * =============================================================================
+ */
+
+/* Categories being traced (0: all tracepoints off) */
+extern volatile uint32_t trace_mask;
+
+/**
+ * Record an event if its category is on.
+ *
+ * @param cat   TRACE_SCHED, TRACE_MM, TRACE_VFS or TRACE_IRQ
+ * @param event TRACE_EV_*
+ * @param phase TRACE_INSTANT, TRACE_BEGIN or TRACE_END
+ */
+#define TRACE(cat, event, phase, arg0, arg1)                                    \
+    do {                                                                        \
+        if (__builtin_expect(trace_mask & (cat), 0)) {                          \
+            trace_emit((event), (phase), (uint64_t)(arg0), (uint64_t)(arg1));   \
+        }                                                                       \
+    } while (0)
+
+/**
+ * Append a record to the calling CPU's ring (use TRACE()).
+ * Safe in any context, interrupts on or off.
+ */
+void trace_emit(uint8_t event, uint8_t phase, uint64_t arg0, uint64_t arg1);
+
+/* =============================================================================
+ * Trace Control
+ * =============================================================================
+ */
+
+/**
+ * Start tracing, discarding records left from an earlier run.
+ * Allocates rings for CPUs that do not have one yet.
+ *
+ * @param categories TRACE_* bits
+ * @return 0 on success, -1 if a ring cannot be allocated
+ */
+int trace_start(uint32_t categories);
+
+/**
+ * Turn every tracepoint off (the rings keep their records).
+ */
+void trace_stop(void);
+
+/**
+ * Move records out of the rings, in order within each CPU.
+ *
+ * @param buf   Destination (kernel memory)
+ * @param count Room in buf, in records
+ * @return Records copied
+ */
+size_t trace_read(trace_record_t* buf, size_t count);
+
+/**
+ * Records dropped on full rings since trace_start().
+ */
+uint64_t trace_dropped(void);
+
+#endif /* CHANUX_TRACE_H */
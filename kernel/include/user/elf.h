@@ -0,0 +1,132 @@
+/**
+ * =============================================================================
+ * Chanux OS - ELF Program Images
+ * =============================================================================
+ * User programs are ELF64 executables kept in kernel memory (the shell is
+ * linked into the kernel image). A program is parsed once into a
+ * user_image_t, which every process running it shares:
+ *
+ *   - Read-only PT_LOAD segments (text, rodata) are copied into frames
+ *     once and mapped into each process with PTE_SHARED: the image owns
+ *     them, so address spaces never free them and fork() maps them as is
+ *   - Writable segments (data, BSS) become demand-paged regions; a page is
+ *     filled from the ELF file (or zeroed past p_filesz) on first touch
+ *
+ * Images are counted per address space using them and freed with the
+ * last one. The ELF bytes themselves must stay valid meanwhile.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_ELF_H
+#define CHANUX_ELF_H
+
+#include "../types.h"
+#include "../proc/process.h"
+
+/* =============================================================================
+ * ELF64 File Format
+ * =============================================================================
+ */
+
+#define ELF_MAGIC           0x464C457FU     /* "\x7FELF", little-endian */
+#define ELFCLASS64          2
+#define ELFDATA2LSB         1
+#define ET_EXEC             2
+#define EM_X86_64           62
+
+#define PT_LOAD             1
+
+#define PF_X                0x1
+#define PF_W                0x2
+#define PF_R                0x4
+
+typedef struct {
+    uint8_t             e_ident[16];                /* Magic, class, data, version */
+    uint16_t            e_type;                     /* ET_EXEC */
+    uint16_t            e_machine;                  /* EM_X86_64 */
+    uint32_t            e_version;
+    uint64_t            e_entry;                    /* Entry point (virtual) */
+    uint64_t            e_phoff;                    /* Program header table offset */
+    uint64_t            e_shoff;
+    uint32_t            e_flags;
+    uint16_t            e_ehsize;
+    uint16_t            e_phentsize;                /* sizeof(elf64_phdr_t) */
+    uint16_t            e_phnum;                    /* Program headers */
+    uint16_t            e_shentsize;
+    uint16_t            e_shnum;
+    uint16_t            e_shstrndx;
+} PACKED elf64_ehdr_t;
+
+typedef struct {
+    uint32_t            p_type;                     /* PT_LOAD, ... */
+    uint32_t            p_flags;                    /* PF_R | PF_W | PF_X */
+    uint64_t            p_offset;                   /* File offset of the contents */
+    uint64_t            p_vaddr;                    /* Virtual address */
+    uint64_t            p_paddr;
+    uint64_t            p_filesz;                   /* Bytes in the file */
+    uint64_t            p_memsz;                    /* Bytes in memory (rest is zero) */
+    uint64_t            p_align;
+} PACKED elf64_phdr_t;
+
+/* =============================================================================
+ * Program Images
+ * =============================================================================
+ */
+
+#define USER_IMAGE_MAX_SEGMENTS 8
+
+/* A PT_LOAD segment */
+typedef struct {
+    virt_addr_t         vaddr;                      /* p_vaddr */
+    uint64_t            memsz;                      /* p_memsz */
+    uint64_t            filesz;                     /* p_filesz */
+    const uint8_t*      data;                       /* Contents in the ELF file */
+    uint64_t            flags;                      /* PTE flags */
+    phys_addr_t*        frames;                     /* Read-only: one per page; NULL if writable */
+} user_image_segment_t;
+
+typedef struct user_image {
+    const void*         elf;                        /* ELF file (kernel memory) */
+    size_t              size;                       /* File size */
+    uint32_t            users;                      /* Address spaces using it */
+    uint64_t            entry;                      /* e_entry */
+    virt_addr_t         low;                        /* Lowest segment address */
+    virt_addr_t         high;                       /* One past the highest */
+    uint32_t            segment_count;              /* PT_LOAD segments */
+    user_image_segment_t segments[USER_IMAGE_MAX_SEGMENTS];
+    struct user_image*  next;                       /* Image list */
+} user_image_t;
+
+/* =============================================================================
+ * Image API
+ * =============================================================================
+ */
+
+/**
+ * Load an ELF executable into a new address space.
+ *
+ * Finds or builds the program's image, maps its read-only segments and
+ * reserves demand-paged regions for the writable ones. Sets user_code,
+ * user_code_size and image (one reference) in proc.
+ *
+ * @param proc Process whose pml4_phys is set and nothing else loaded yet
+ * @param elf  ELF file in kernel memory (kept valid while in use)
+ * @param size File size in bytes
+ * @return true on success, false if the file is invalid or memory ran out
+ */
+bool user_elf_load(process_t* proc, const void* elf, size_t size);
+
+/**
+ * Take another reference on an image (fork()).
+ */
+void user_image_ref(user_image_t* image);
+
+/**
+ * Drop a reference; the last one frees the image's frames.
+ * Call once the address space using it is gone.
+ *
+ * @param image Image, or NULL
+ */
+void user_image_put(user_image_t* image);
+
+#endif /* CHANUX_ELF_H */
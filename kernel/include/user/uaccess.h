@@ -0,0 +1,95 @@
+/**
+ * =============================================================================
+ * Chanux OS - Safe Access to User Memory
+ * =============================================================================
+ * System calls never dereference user pointers themselves; they copy
+ * through these helpers. The range check is only against USER_SPACE_END:
+ * whether the pages are actually mapped is left to the MMU. A fault the
+ * page fault handler cannot resolve (unmapped address, write to read-only
+ * code) is caught through the exception table and turned into -EFAULT
+ * instead of a kernel panic, so demand-zero and copy-on-write pages work
+ * exactly as they do for user mode accesses.
+ *
+ * Never call these with a spinlock held: a fault may allocate a page.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_UACCESS_H
+#define CHANUX_UACCESS_H
+
+#include "../types.h"
+#include "../interrupts/isr.h"
+#include "../mm/vmm.h"
+
+/* =============================================================================
+ * Range Check
+ * =============================================================================
+ */
+
+/**
+ * Check that [ptr, ptr + len) lies in the user half of the address space
+ * NULL is rejected, a zero length always passes otherwise.
+ */
+static inline bool user_access_ok(const void* ptr, size_t len) {
+    uintptr_t addr = (uintptr_t)ptr;
+    return ptr != NULL && addr < USER_SPACE_END && len <= USER_SPACE_END - addr;
+}
+
+/* =============================================================================
+ * Copy API
+ * =============================================================================
+ */
+
+/**
+ * Copy from user memory
+ *
+ * @return 0 on success, -EFAULT if any byte could not be read
+ */
+int copy_from_user(void* dst, const void* user_src, size_t len);
+
+/**
+ * Copy to user memory
+ *
+ * @return 0 on success, -EFAULT if any byte could not be written
+ */
+int copy_to_user(void* user_dst, const void* src, size_t len);
+
+/**
+ * Copy a NUL-terminated string from user memory
+ *
+ * @param dst      Kernel buffer
+ * @param user_src User string
+ * @param size     Size of dst, including the NUL
+ * @return         String length on success, -EFAULT on a bad pointer,
+ *                 -ENAMETOOLONG if it does not fit in dst
+ */
+int64_t strncpy_from_user(char* dst, const char* user_src, size_t size);
+
+/**
+ * Atomically replace a user word if it holds 'expected'
+ * The word is written in either case, so afterwards its page is present
+ * and private to the calling address space.
+ *
+ * @param uaddr    User address, 4-byte aligned
+ * @param expected Value to compare with
+ * @param desired  Value to store on a match
+ * @param old      Receives the value that was found
+ * @return         0 on success (compare *old with 'expected'), -EINVAL if
+ *                 misaligned, -EFAULT if the word could not be written
+ */
+int cmpxchg_user_u32(uint32_t* uaddr, uint32_t expected, uint32_t desired, uint32_t* old);
+
+/* =============================================================================
+ * Fault Recovery
+ * =============================================================================
+ */
+
+/**
+ * Redirect a faulting kernel access to user memory to its fixup code
+ * Called by the page fault handler for faults it could not resolve.
+ *
+ * @return true if regs->rip was in the exception table and was replaced
+ */
+bool uaccess_fixup(registers_t* regs);
+
+#endif /* CHANUX_UACCESS_H */
@@ -20,22 +20,118 @@
  * 0x0000_0000_0000_0000 - 0x0000_0000_003F_FFFF  Reserved (null guard)
  * 0x0000_0000_0040_0000 - 0x0000_0000_007F_FFFF  Code segment (4MB)
  * 0x0000_0000_0080_0000 - 0x0000_0000_00FF_FFFF  Data segment (8MB)
- * 0x0000_0000_1000_0000 - 0x0000_7FFF_FFEF_FFFF  Heap (grows up)
+ * 0x0000_0000_1000_0000 - 0x0000_0FFF_FFFF_FFFF  Heap (grows up)
+ * 0x0000_1000_0000_0000 - 0x0000_1000_7FFF_FFFF  File mappings (mmap, 256MB slots)
+ * 0x0000_7FFF_FFCF_6000 - 0x0000_7FFF_FFEF_CFFF  Thread stacks (256KB slots)
  * 0x0000_7FFF_FFF0_0000 - 0x0000_7FFF_FFFD_FFFF  Stack (grows down)
  * 0x0000_7FFF_FFFE_0000 - 0x0000_7FFF_FFFF_FFFF  Reserved
  * =============================================================================
  */
 
-/* User code is loaded at 4MB */
+/* User programs are linked at 4MB */
 #define USER_CODE_BASE      0x0000000000400000ULL
 
+/*
+ * Stacks of further threads, below the main stack's guard page. Slot i
+ * ends at USER_THREAD_STACK_TOP - i * USER_THREAD_STACK_STRIDE and has
+ * its own unmapped guard page below it.
+ */
+#define USER_THREAD_STACK_SIZE   (64 * PAGE_SIZE)
+#define USER_THREAD_STACK_STRIDE (USER_THREAD_STACK_SIZE + USER_STACK_GUARD)
+#define USER_THREAD_STACK_TOP    (USER_STACK_TOP - USER_STACK_SIZE - USER_STACK_GUARD)
+
+/* =============================================================================
+ * Demand Paging
+ * =============================================================================
+ */
+
+/**
+ * Reserve a demand-zero region in a process's address space.
+ * Nothing is allocated until a page in the region is first touched.
+ *
+ * @param proc  Process to reserve in
+ * @param start Start address (rounded down to a page)
+ * @param size  Size in bytes (rounded up to a page)
+ * @param flags PTE flags for faulted-in pages
+ * @return true on success, false if the region table is full
+ */
+bool user_region_add(process_t* proc, virt_addr_t start, size_t size, uint64_t flags);
+
+/**
+ * Reserve a demand-paged region whose first bytes come from kernel memory.
+ * Pages are filled from 'data' on first touch and zeroed beyond it.
+ *
+ * @param proc      Process to reserve in
+ * @param start     Start address (need not be page-aligned)
+ * @param size      Size in bytes
+ * @param flags     PTE flags for faulted-in pages
+ * @param data      Contents at 'start' (must stay valid while mapped)
+ * @param data_size Bytes of data (at most size)
+ * @return true on success, false if the region table is full
+ */
+bool user_region_add_data(process_t* proc, virt_addr_t start, size_t size,
+                          uint64_t flags, const void* data, size_t data_size);
+
+/**
+ * Handle a not-present page fault in the current process.
+ * Maps a fresh page if the address lies in one of its demand-paged regions,
+ * or the file's page if it lies in a file mapping.
+ *
+ * @param addr Faulting virtual address
+ * @return true if the fault was resolved
+ */
+bool user_handle_page_fault(virt_addr_t addr);
+
+/**
+ * Handle a write fault on a present page in the current process.
+ * Resolves copy-on-write through vmm_handle_cow_fault(), serialized
+ * against the process's other threads.
+ *
+ * @param addr Faulting virtual address
+ * @return true if the fault was resolved
+ */
+bool user_handle_cow_fault(virt_addr_t addr);
+
+/* =============================================================================
+ * File Mappings
+ * =============================================================================
+ */
+
+/**
+ * Remove a file mapping: unmap its pages from the process and unpin them.
+ * Other threads' TLBs are shot down too.
+ *
+ * @param proc Group leader owning the mapping (vm_lock held)
+ * @param map  Mapping (one of proc->mmaps), free on return
+ */
+void user_mmap_remove(process_t* proc, user_mmap_t* map);
+
+/**
+ * Take another reference on every mapping in a copied table (fork()),
+ * and give each a page id list of its own. The page tables are copied
+ * separately by vmm_clone_user_space().
+ *
+ * @param maps Table of PROCESS_MAX_MMAPS entries
+ * @return true on success, false (nothing taken) on failure
+ */
+bool user_mmap_copy(user_mmap_t* maps);
+
+/**
+ * Unpin every mapping in a table, leaving the page tables alone.
+ * Used once the address space is gone (exit) or was never used.
+ *
+ * @param maps Table of PROCESS_MAX_MMAPS entries, all free on return
+ */
+void user_mmap_release(user_mmap_t* maps);
+
 /* =============================================================================
  * User Stack Management
  * =============================================================================
  */
 
 /**
- * Allocate and map a user stack for a process.
+ * Reserve a user stack for a process.
+ * Stack pages are demand-faulted; a guard page below it stays unmapped.
  *
  * @param proc Process to allocate stack for (must have pml4_phys set)
  * @return true on success, false on failure
@@ -50,36 +146,48 @@ bool user_stack_alloc(process_t* proc);
 void user_stack_free(process_t* proc);
 
 /* =============================================================================
- * User Code Loading
+ * User Process Creation
  * =============================================================================
  */
 
 /**
- * Load user code into a process's address space.
+ * Create a user-mode process.
  *
- * @param proc      Process to load code into
- * @param code      Pointer to code data (in kernel space)
- * @param code_size Size of code in bytes
- * @param entry     Virtual address to load code at
- * @return true on success, false on failure
+ * Instances of the same program share its read-only pages (see user/elf.h).
+ *
+ * @param name     Process name
+ * @param elf      ELF executable in kernel memory
+ * @param elf_size Size of the file
+ * @return PID on success, (pid_t)-1 on failure
  */
-bool user_load_code(process_t* proc, const void* code, size_t code_size,
-                    virt_addr_t entry);
+pid_t user_process_create(const char* name, const void* elf, size_t elf_size);
 
 /* =============================================================================
- * User Process Creation
+ * Threads
  * =============================================================================
  */
 
 /**
- * Create a user-mode process.
+ * Start another thread in the current process.
+ * It shares the address space and descriptor table and gets a kernel
+ * stack and a demand-zero user stack of its own; it enters user mode at
+ * entry(arg0, arg1). Switching between threads of a process leaves CR3
+ * alone.
  *
- * @param name      Process name
- * @param code      Pointer to user code (binary)
- * @param code_size Size of user code
- * @return PID on success, (pid_t)-1 on failure
+ * @return PID of the new thread, -EAGAIN if the process has
+ *         PROCESS_MAX_THREADS threads already, other negative error
+ */
+int64_t user_thread_create(uint64_t entry, uint64_t arg0, uint64_t arg1);
+
+/**
+ * Take an exiting thread out of its group.
+ * Releases the thread's own user stack, unless it is the last thread.
+ *
+ * @param proc Exiting thread (the current process)
+ * @return true if it was the last thread: the caller tears down the
+ *         address space (the leader's regions and mmaps)
  */
-pid_t user_process_create(const char* name, const void* code, size_t code_size);
+bool user_thread_leave(process_t* proc);
 
 /* =============================================================================
  * User Mode Entry
@@ -96,6 +204,17 @@ pid_t user_process_create(const char* name, const void* code, size_t code_size);
  */
 NORETURN void user_mode_enter(uint64_t entry_point, uint64_t user_stack);
 
+/**
+ * Enter user mode with two arguments (in RDI and RSI).
+ *
+ * @param entry_point User mode entry point (RIP)
+ * @param user_stack  User mode stack pointer (RSP)
+ * @param arg1        First argument
+ * @param arg2        Second argument
+ */
+NORETURN void user_mode_enter_with_args(uint64_t entry_point, uint64_t user_stack,
+                                        uint64_t arg1, uint64_t arg2);
+
 /**
  * Set up a process to enter user mode.
  * Called during context switch to prepare for first user mode entry.
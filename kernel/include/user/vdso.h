@@ -0,0 +1,90 @@
+/**
+ * =============================================================================
+ * Chanux OS - User-Visible Kernel Data (vvar pages)
+ * =============================================================================
+ * Two read-only pages mapped at the top of every user address space let
+ * libc answer getpid() and clock queries without entering the kernel:
+ *
+ *   VDSO_CLOCK_ADDR  Shared by all processes: the TSC calibration and the
+ *                    PIT tick count (kept current only while the PIT runs)
+ *   VDSO_PROC_ADDR   Private to the process: its PID
+ *
+ * With a calibrated TSC, user code computes
+ *   ns = ns_base + ((rdtsc() - tsc_base) * ns_per_cycle >> 32)
+ * exactly as clock_ns() does; otherwise it falls back to ticks * 10ms.
+ *
+ * The layouts are duplicated in user/include/syscall.h and must match.
+ * =============================================================================
+ */
+
+#ifndef CHANUX_VDSO_H
+#define CHANUX_VDSO_H
+
+#include "../types.h"
+#include "../proc/process.h"
+
+/* =============================================================================
+ * Layout
+ * =============================================================================
+ */
+
+#define VDSO_CLOCK_ADDR     0x00007FFFFFFFE000ULL   /* Above USER_STACK_TOP */
+#define VDSO_PROC_ADDR      0x00007FFFFFFFF000ULL
+
+/* vdso_clock_t.flags */
+#define VDSO_CLOCK_TSC      0x01    /* tsc_base/ns_base/ns_per_cycle are valid */
+
+typedef struct {
+    volatile uint32_t   seq;                        /* Odd while being updated */
+    uint32_t            flags;                      /* VDSO_CLOCK_* */
+    volatile uint64_t   ticks;                      /* PIT ticks since boot */
+    uint64_t            tsc_base;                   /* TSC at ns_base */
+    uint64_t            ns_base;                    /* clock_ns() at tsc_base */
+    uint64_t            ns_per_cycle;               /* 32.32 fixed point */
+    uint64_t            tsc_khz;                    /* TSC frequency */
+} vdso_clock_t;
+
+typedef struct {
+    uint64_t            pid;                        /* getpid() */
+} vdso_proc_t;
+
+/* =============================================================================
+ * vvar API
+ * =============================================================================
+ */
+
+/**
+ * Allocate the shared clock page and publish the clock calibration
+ * Call after clock_init() and before the first user process is created.
+ */
+void vdso_init(void);
+
+/**
+ * Publish the PIT tick count (called from the PIT interrupt)
+ */
+void vdso_update_ticks(uint64_t ticks);
+
+/**
+ * Map the clock page and a fresh process page into a new process
+ *
+ * @param proc Process whose pml4_phys and pid are set
+ * @return true on success
+ */
+bool vdso_map(process_t* proc);
+
+/**
+ * Allocate a process page for a forked child (in the parent)
+ *
+ * @return Physical address, or 0 if out of memory
+ */
+phys_addr_t vdso_alloc_proc_page(void);
+
+/**
+ * Replace the process page a forked child inherited with its own
+ *
+ * @param proc Child, running in its cloned address space
+ * @param page Page from vdso_alloc_proc_page()
+ */
+void vdso_install_proc_page(process_t* proc, phys_addr_t page);
+
+#endif /* CHANUX_VDSO_H */
@@ -7,12 +7,18 @@
  * The IDT is initialized with:
  *   - Exception handlers for vectors 0-31
  *   - IRQ handlers for vectors 32-47
- *   - Empty entries for vectors 48-255 (available for software interrupts)
+ *   - Local APIC timer and IPI handlers (vectors 0x40-0x42, spurious 0xFF)
+ *   - Device (MSI) vectors 0x50-0xEF, one stub each
+ *   - Empty entries for the rest (available for software interrupts)
+ *
+ * All CPUs share the one table; APs only need to load it.
  * =============================================================================
  */
 
 #include "../include/interrupts/idt.h"
 #include "../include/interrupts/isr.h"
+#include "../include/interrupts/irq.h"
+#include "../include/drivers/lapic.h"
 #include "../drivers/vga/vga.h"
 
 /* =============================================================================
@@ -131,6 +137,18 @@ void idt_init(void) {
     idt_set_entry(46, (uint64_t)irq14, KERNEL_CS, IDT_GATE_INTERRUPT, 0);
     idt_set_entry(47, (uint64_t)irq15, KERNEL_CS, IDT_GATE_INTERRUPT, 0);
 
+    /* Local APIC vectors */
+    idt_set_entry(LAPIC_TIMER_VECTOR,   (uint64_t)irq64, KERNEL_CS, IDT_GATE_INTERRUPT, 0);
+    idt_set_entry(LAPIC_RESCHED_VECTOR, (uint64_t)irq65, KERNEL_CS, IDT_GATE_INTERRUPT, 0);
+    idt_set_entry(LAPIC_TLB_VECTOR,     (uint64_t)irq66, KERNEL_CS, IDT_GATE_INTERRUPT, 0);
+    idt_set_entry(LAPIC_SPURIOUS_VECTOR, (uint64_t)isr_spurious, KERNEL_CS, IDT_GATE_INTERRUPT, 0);
+
+    /* Device vectors for irq_alloc_vector() */
+    for (int i = 0; i < IRQ_VECTOR_COUNT; i++) {
+        idt_set_entry((uint8_t)(IRQ_VECTOR_FIRST + i), irq_vector_stub_table[i],
+                      KERNEL_CS, IDT_GATE_INTERRUPT, 0);
+    }
+
     /* Set up the IDT pointer */
     idtr.limit = (sizeof(idt_entry_t) * IDT_ENTRIES) - 1;
     idtr.base = (uint64_t)&idt;
@@ -138,3 +156,10 @@ void idt_init(void) {
     /* Load the IDT */
     idt_load(&idtr);
 }
+
+/**
+ * Load the already-built IDT on an application processor.
+ */
+void idt_load_cpu(void) {
+    idt_load(&idtr);
+}
@@ -5,26 +5,63 @@
  * Dispatches hardware IRQs to registered device driver handlers.
  *
  * When an IRQ fires:
- *   1. Assembly stub saves registers and calls irq_handler()
- *   2. irq_handler() checks for spurious IRQ
- *   3. irq_handler() dispatches to registered handler (if any)
- *   4. irq_handler() sends EOI to PIC
- *   5. Assembly stub restores registers and returns
+ *   1. The vector's assembly stub saves registers and calls irq_handler()
+ *   2. On the 8259: irq_handler() checks for a spurious IRQ and sends the
+ *      PIC its EOI (port I/O)
+ *      On the APICs: irq_handler() writes the local APIC's EOI register
+ *   3. irq_handler() calls the vector's handler (if any)
+ *   4. Assembly stub restores registers and returns
+ *
+ * Handlers are looked up by vector, so the path from the stub to the
+ * driver is one table load whichever controller raised the interrupt.
  * =============================================================================
  */
 
 #include "../include/interrupts/irq.h"
 #include "../include/interrupts/idt.h"
 #include "../include/drivers/pic.h"
+#include "../include/drivers/lapic.h"
+#include "../include/drivers/ioapic.h"
+#include "../include/acpi.h"
+#include "../include/kernel.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/trace.h"
 #include "../drivers/vga/vga.h"
 
+/* MPS INTI flags of an interrupt source override */
+#define MPS_POLARITY_MASK   0x03
+#define MPS_POLARITY_LOW    0x03
+#define MPS_TRIGGER_MASK    0x0C
+#define MPS_TRIGGER_LEVEL   0x0C
+
+#define IRQ_NO_GSI          0xFFFFFFFF  /* Pin taken by another IRQ's override */
+
 /* =============================================================================
  * Static Data
  * =============================================================================
  */
 
-/* Table of registered IRQ handlers */
-static isr_handler_t irq_handlers[IRQ_COUNT];
+/* Handler for each vector (ISA IRQs at 32-47, allocated vectors above) */
+static isr_handler_t irq_vectors[IDT_ENTRIES];
+
+/* Vectors with a level-triggered source: EOI after the handler */
+static bool irq_level[IDT_ENTRIES];
+
+/* Where each ISA IRQ is wired on the I/O APIC */
+typedef struct {
+    uint32_t    gsi;
+    uint32_t    flags;              /* IOAPIC_REDIR_LEVEL, IOAPIC_REDIR_ACTIVE_LOW */
+    bool        enabled;            /* Unmasked by its driver */
+} irq_line_t;
+
+static irq_line_t irq_lines[IRQ_COUNT];
+
+/* External interrupts come through the I/O APIC */
+static bool irq_apic = false;
+
+/* Line state and vector allocation */
+static spinlock_t irq_lock = SPINLOCK_INIT;
 
 /* =============================================================================
  * IRQ Framework Initialization
@@ -36,8 +73,14 @@ static isr_handler_t irq_handlers[IRQ_COUNT];
  */
 void irq_init(void) {
     /* Clear all handler pointers */
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        irq_vectors[i] = NULL;
+        irq_level[i] = false;
+    }
     for (int i = 0; i < IRQ_COUNT; i++) {
-        irq_handlers[i] = NULL;
+        irq_lines[i].gsi = (uint32_t)i;
+        irq_lines[i].flags = 0;
+        irq_lines[i].enabled = false;
     }
 }
 
@@ -51,7 +94,7 @@ void irq_init(void) {
  */
 void irq_register_handler(uint8_t irq, isr_handler_t handler) {
     if (irq < IRQ_COUNT) {
-        irq_handlers[irq] = handler;
+        irq_vectors[IRQ_VECTOR_BASE + irq] = handler;
     }
 }
 
@@ -60,29 +103,188 @@ void irq_register_handler(uint8_t irq, isr_handler_t handler) {
  */
 void irq_unregister_handler(uint8_t irq) {
     if (irq < IRQ_COUNT) {
-        irq_handlers[irq] = NULL;
+        irq_vectors[IRQ_VECTOR_BASE + irq] = NULL;
+    }
+}
+
+int irq_alloc_vector(isr_handler_t handler) {
+    int vector = -1;
+
+    uint64_t flags = spin_lock_irqsave(&irq_lock);
+    for (int v = IRQ_VECTOR_FIRST; v <= IRQ_VECTOR_LAST; v++) {
+        if (irq_vectors[v] == NULL) {
+            irq_vectors[v] = handler;
+            irq_level[v] = false;   /* Messages are edges */
+            vector = v;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    return vector;
+}
+
+void irq_free_vector(uint8_t vector) {
+    if (vector >= IRQ_VECTOR_FIRST && vector <= IRQ_VECTOR_LAST) {
+        irq_vectors[vector] = NULL;
     }
 }
 
 /* =============================================================================
- * Common IRQ Handler
+ * Masking and Routing
  * =============================================================================
  */
 
-/**
- * Common IRQ handler called from assembly stubs.
- */
-void irq_handler(registers_t* regs) {
-    /* Calculate IRQ number from interrupt vector */
-    uint8_t irq = (uint8_t)(regs->int_no - IRQ_VECTOR_BASE);
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&irq_lock);
+    irq_lines[irq].enabled = true;
+    if (!irq_apic) {
+        pic_unmask_irq(irq);
+    } else if (irq_lines[irq].gsi != IRQ_NO_GSI) {
+        ioapic_unmask(irq_lines[irq].gsi);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
 
-    /* Validate IRQ number */
+void irq_mask(uint8_t irq) {
     if (irq >= IRQ_COUNT) {
-        /* Invalid IRQ, just send EOI and return */
-        pic_send_eoi(irq);
         return;
     }
 
+    uint64_t flags = spin_lock_irqsave(&irq_lock);
+    irq_lines[irq].enabled = false;
+    if (!irq_apic) {
+        pic_mask_irq(irq);
+    } else if (irq_lines[irq].gsi != IRQ_NO_GSI) {
+        ioapic_mask(irq_lines[irq].gsi);
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+int irq_cpu_apic_id(uint32_t cpu, uint32_t* apic_id) {
+    cpu_t* c = cpu_get(cpu);
+    if (!c || !lapic_is_ready()) {
+        return -1;
+    }
+    *apic_id = c->apic_id;
+    return 0;
+}
+
+int irq_set_affinity(uint8_t irq, uint32_t cpu) {
+    uint32_t apic_id;
+    if (irq >= IRQ_COUNT || irq_cpu_apic_id(cpu, &apic_id) < 0) {
+        return -1;
+    }
+    if (!irq_apic) {
+        return cpu == 0 ? 0 : -1;   /* The 8259 only reaches the boot CPU */
+    }
+    if (irq_lines[irq].gsi == IRQ_NO_GSI) {
+        return -1;
+    }
+
+    ioapic_set_dest(irq_lines[irq].gsi, apic_id);
+    return 0;
+}
+
+bool irq_apic_enabled(void) {
+    return irq_apic;
+}
+
+/* Apply the MADT's interrupt source overrides to the ISA lines */
+static void irq_apply_overrides(void) {
+    const acpi_madt_info_t* madt = acpi_madt();
+
+    for (uint32_t i = 0; i < madt->override_count; i++) {
+        const acpi_override_t* ovr = &madt->overrides[i];
+        if (ovr->source >= IRQ_COUNT) {
+            continue;
+        }
+
+        /* An ISA IRQ wired to another one's pin loses it (IRQ 2 to IRQ 0) */
+        for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+            if (irq != ovr->source && irq_lines[irq].gsi == ovr->gsi) {
+                irq_lines[irq].gsi = IRQ_NO_GSI;
+            }
+        }
+
+        irq_line_t* line = &irq_lines[ovr->source];
+        line->gsi = ovr->gsi;
+        line->flags = 0;
+        if ((ovr->flags & MPS_POLARITY_MASK) == MPS_POLARITY_LOW) {
+            line->flags |= IOAPIC_REDIR_ACTIVE_LOW;
+        }
+        if ((ovr->flags & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL) {
+            line->flags |= IOAPIC_REDIR_LEVEL;
+        }
+    }
+
+    /* The cascade input means nothing without the 8259s */
+    irq_lines[2].gsi = IRQ_NO_GSI;
+}
+
+int irq_enable_apic(void) {
+    if (!lapic_is_ready() || !acpi_madt()->found || ioapic_init() == 0) {
+        kprintf("[IRQ] No I/O APIC, external interrupts stay on the 8259\n");
+        return -1;
+    }
+    irq_apply_overrides();
+
+    uint32_t apic_id = lapic_id();
+    uint64_t flags = spin_lock_irqsave(&irq_lock);
+
+    /* Edges the PIC has latched but not delivered (interrupts are off) */
+    uint16_t pending = pic_get_irr();
+
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        irq_line_t* line = &irq_lines[irq];
+        if (line->gsi == IRQ_NO_GSI ||
+            ioapic_route(line->gsi, (uint8_t)(IRQ_VECTOR_BASE + irq), line->flags, apic_id) < 0) {
+            line->gsi = IRQ_NO_GSI;
+            continue;
+        }
+        irq_level[IRQ_VECTOR_BASE + irq] = (line->flags & IOAPIC_REDIR_LEVEL) != 0;
+        if (line->enabled) {
+            ioapic_unmask(line->gsi);
+        }
+    }
+
+    /* The 8259 reaches the boot CPU through LINT0 (ExtINT): shut both off */
+    pic_disable();
+    lapic_disable_extint();
+    irq_apic = true;
+
+    /*
+     * The I/O APIC never saw those edges; raise them again as self-IPIs
+     * so no device waits forever for its interrupt to be serviced. The
+     * PIT just ticks again.
+     */
+    for (uint32_t irq = 1; irq < IRQ_COUNT; irq++) {
+        irq_line_t* line = &irq_lines[irq];
+        if ((pending & (1U << irq)) && line->enabled && line->gsi != IRQ_NO_GSI &&
+            !(line->flags & IOAPIC_REDIR_LEVEL)) {
+            lapic_send_ipi(apic_id, (uint8_t)(IRQ_VECTOR_BASE + irq));
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[IRQ] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("ISA IRQs routed through the I/O APIC to APIC ID %d, 8259 disabled\n", apic_id);
+    return 0;
+}
+
+/* =============================================================================
+ * Common IRQ Handler
+ * =============================================================================
+ */
+
+/* An ISA IRQ while the 8259 is in charge */
+static void irq_handle_pic(registers_t* regs, uint8_t irq) {
     /* Check for spurious IRQ */
     if (pic_is_spurious(irq)) {
         /* Spurious IRQ7 - don't send EOI to master */
@@ -93,11 +295,59 @@ void irq_handler(registers_t* regs) {
         return;
     }
 
+    /*
+     * Send End of Interrupt to PIC before the handler: the timer handler
+     * may switch to another process, and the PIC would hold back every
+     * IRQ until this one is acknowledged. Interrupts stay off until iretq.
+     */
+    pic_send_eoi(irq);
+
     /* Call registered handler if present */
-    if (irq_handlers[irq] != NULL) {
-        irq_handlers[irq](regs);
+    isr_handler_t handler = irq_vectors[IRQ_VECTOR_BASE + irq];
+    if (handler != NULL) {
+        handler(regs);
     }
+}
 
-    /* Send End of Interrupt to PIC */
-    pic_send_eoi(irq);
+/* irq_handler() without the tracepoints */
+static void irq_dispatch(registers_t* regs, uint8_t vector) {
+
+    /* Local APIC timer and IPIs acknowledge themselves */
+    if (vector >= LAPIC_TIMER_VECTOR && vector <= LAPIC_TLB_VECTOR) {
+        lapic_handle_interrupt(regs);
+        return;
+    }
+
+    if (!irq_apic && vector >= IRQ_VECTOR_BASE && vector < IRQ_VECTOR_BASE + IRQ_COUNT) {
+        irq_handle_pic(regs, (uint8_t)(vector - IRQ_VECTOR_BASE));
+        return;
+    }
+
+    isr_handler_t handler = irq_vectors[vector];
+
+    /* A level-triggered line is only quiet once its device was serviced */
+    if (irq_level[vector]) {
+        if (handler != NULL) {
+            handler(regs);
+        }
+        lapic_eoi();
+        return;
+    }
+
+    /* Same reasoning as for the PIC: acknowledge before a possible switch */
+    lapic_eoi();
+    if (handler != NULL) {
+        handler(regs);
+    }
+}
+
+/**
+ * Common IRQ handler called from assembly stubs.
+ */
+void irq_handler(registers_t* regs) {
+    uint8_t vector = (uint8_t)regs->int_no;
+
+    TRACE(TRACE_IRQ, TRACE_EV_IRQ, TRACE_BEGIN, vector, 0);
+    irq_dispatch(regs, vector);
+    TRACE(TRACE_IRQ, TRACE_EV_IRQ, TRACE_END, vector, 0);
 }
@@ -15,6 +15,13 @@
 #include "../include/interrupts/isr.h"
 #include "../include/interrupts/idt.h"
 #include "../include/kernel.h"
+#include "../include/fpu.h"
+#include "../include/klog.h"
+#include "../include/trace.h"
+#include "../include/mm/vmm.h"
+#include "../include/proc/process.h"
+#include "../include/user/user.h"
+#include "../include/user/uaccess.h"
 #include "../drivers/vga/vga.h"
 
 /* =============================================================================
@@ -72,11 +79,28 @@ static isr_handler_t isr_handlers[IDT_ENTRIES];
 
 /**
  * Handle page fault exception.
- * Displays fault address and error code details.
+ * Copy-on-write and demand-zero faults are resolved and execution resumes,
+ * and a bad user pointer in a system call fails it with -EFAULT; anything
+ * else displays fault address and error code details.
  */
 static void exception_page_fault(registers_t* regs) {
     uint64_t fault_addr = read_cr2();
 
+    /* Write to a present page: may be a copy-on-write page after fork() */
+    if ((regs->err_code & 0x03) == 0x03 && user_handle_cow_fault(fault_addr)) {
+        return;
+    }
+
+    /* First touch of a demand-zero page (stack, BSS) */
+    if (!(regs->err_code & 0x01) && user_handle_page_fault(fault_addr)) {
+        return;
+    }
+
+    /* Bad user pointer passed to a system call: fail it with -EFAULT */
+    if (fault_addr < USER_SPACE_END && uaccess_fixup(regs)) {
+        return;
+    }
+
     /* Decode error code */
     bool present = (regs->err_code & 0x01) != 0;
     bool write = (regs->err_code & 0x02) != 0;
@@ -85,6 +109,7 @@ static void exception_page_fault(registers_t* regs) {
     bool fetch = (regs->err_code & 0x10) != 0;
 
     cli();
+    klog_panic();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n*** PAGE FAULT ***\n");
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -127,12 +152,24 @@ static void exception_page_fault(registers_t* regs) {
  */
 static void exception_double_fault(registers_t* regs) {
     cli();
+    klog_panic();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n*** DOUBLE FAULT ***\n");
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
 
     kprintf("\nA double fault occurred!\n");
-    kprintf("This usually indicates a kernel stack overflow or corrupted IDT.\n");
+
+    /*
+     * Running off a kernel stack hits its guard page, and the page fault
+     * frame cannot be pushed there either
+     */
+    process_t* overflow = process_kstack_overflow(read_cr2());
+    if (overflow) {
+        kprintf("Kernel stack overflow in '%s' (PID %d), CR2=0x%p\n",
+                overflow->name, (int)overflow->pid, (void*)read_cr2());
+    } else {
+        kprintf("This usually indicates a kernel stack overflow or corrupted IDT.\n");
+    }
     kprintf("\nError Code: 0x%x\n", (uint32_t)regs->err_code);
     kprintf("RIP: 0x%p\n", (void*)regs->rip);
     kprintf("RSP: 0x%p\n", (void*)regs->rsp);
@@ -149,6 +186,7 @@ static void exception_double_fault(registers_t* regs) {
  */
 static void exception_gpf(registers_t* regs) {
     cli();
+    klog_panic();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n*** GENERAL PROTECTION FAULT ***\n");
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -192,6 +230,7 @@ static void exception_gpf(registers_t* regs) {
  */
 static void exception_divide_error(registers_t* regs) {
     cli();
+    klog_panic();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n*** DIVIDE ERROR ***\n");
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -211,6 +250,7 @@ static void exception_divide_error(registers_t* regs) {
  */
 static void exception_invalid_opcode(registers_t* regs) {
     cli();
+    klog_panic();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n*** INVALID OPCODE ***\n");
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -233,6 +273,7 @@ static void exception_default(registers_t* regs) {
     uint8_t int_no = (uint8_t)regs->int_no;
 
     cli();
+    klog_panic();
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n*** EXCEPTION ***\n");
     vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
@@ -294,6 +335,10 @@ void isr_handler(registers_t* regs) {
             exception_invalid_opcode(regs);
             break;
 
+        case EXCEPTION_NM:  /* Device Not Available: lazy FPU switch */
+            fpu_handle_nm(regs);
+            break;
+
         case EXCEPTION_DF:  /* Double Fault */
             exception_double_fault(regs);
             break;
@@ -303,7 +348,9 @@ void isr_handler(registers_t* regs) {
             break;
 
         case EXCEPTION_PF:  /* Page Fault */
+            TRACE(TRACE_MM, TRACE_EV_PAGE_FAULT, TRACE_BEGIN, read_cr2(), regs->err_code);
             exception_page_fault(regs);
+            TRACE(TRACE_MM, TRACE_EV_PAGE_FAULT, TRACE_END, 0, 0);
             break;
 
         default:
@@ -26,30 +26,50 @@
 #include "include/mm/pmm.h"
 #include "include/mm/vmm.h"
 #include "include/mm/heap.h"
+#include "include/mm/slab.h"
 #include "include/gdt.h"
 #include "include/interrupts/idt.h"
 #include "include/interrupts/irq.h"
 #include "include/drivers/pic.h"
 #include "include/drivers/pit.h"
 #include "include/drivers/keyboard.h"
+#include "include/drivers/serial.h"
+#include "include/klog.h"
+#include "include/drivers/ata.h"
+#include "include/drivers/pci.h"
+#include "include/drivers/virtio_blk.h"
+#include "include/drivers/bcache.h"
 #include "include/proc/process.h"
 #include "include/proc/sched.h"
 #include "include/syscall/syscall.h"
+#include "include/acpi.h"
+#include "include/clock.h"
+#include "include/smp.h"
+#include "include/drivers/lapic.h"
 #include "include/user/user.h"
+#include "include/user/vdso.h"
 #include "include/fs/vfs.h"
 #include "include/fs/ramfs.h"
+#include "include/fs/initramfs.h"
+#include "include/fs/procfs.h"
 #include "include/string.h"
+#include "include/fpu.h"
+#include "include/bench.h"
 #include "drivers/vga/vga.h"
 
 /* =============================================================================
  * Embedded Shell Program
  * =============================================================================
- * These symbols are created by objcopy from the user shell binary.
+ * These symbols are created by objcopy from the user shell's stripped ELF
+ * executable (see user_elf_load()).
  */
 extern const char _user_shell_start[];
 extern const char _user_shell_end[];
 extern const char _user_shell_size[];
 
+/* Shipped in the initramfs instead, when it has one; started in its place */
+#define SHELL_PATH "/bin/shell"
+
 /* =============================================================================
  * Kernel Version Banner
  * =============================================================================
@@ -145,6 +165,9 @@ void mm_init(boot_info_t* boot_info) {
     /* Step 3: Kernel Heap */
     heap_init();
 
+    /* Step 4: Slab Object Caches */
+    slab_init();
+
     kprintf("\n");
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[MM] ");
@@ -157,21 +180,35 @@ void mm_init(boot_info_t* boot_info) {
  * =============================================================================
  */
 
-static void fs_init(void) {
+static void fs_init(const boot_info_t* boot_info) {
     kprintf("\n");
     vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
     kprintf("[FS] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     kprintf("Initializing filesystem...\n");
 
-    /* Initialize VFS and mount RAMFS as root */
+    /* Find disks: the snapshot disk, if any, holds the last saved RAMFS */
+    pci_init();
+    ata_init();
+    virtio_blk_init();
+    bcache_init();
+
+    /* Initialize VFS and mount RAMFS as root (restored from a snapshot if present) */
     vfs_init();
 
-    /* Create initial directories */
+    /* Unpack the initramfs archive from the bootloader, if the disk had one */
+    if (boot_info && boot_info->initrd_size > 0) {
+        initramfs_unpack(boot_info->initrd_start, boot_info->initrd_size);
+    }
+
+    /* Create initial directories (already there, from the initramfs or a restore) */
     vfs_mkdir("/bin");
     vfs_mkdir("/home");
     vfs_mkdir("/tmp");
 
+    /* Kernel statistics under /proc */
+    procfs_init();
+
     /* Create a welcome file */
     vnode_t* file = NULL;
     if (vfs_lookup("/hello.txt", &file) < 0) {
@@ -188,7 +225,10 @@ static void fs_init(void) {
 
     /* Create a README file */
     file_t* readme = NULL;
-    if (vfs_open("/README", O_CREAT | O_WRONLY, &readme) >= 0) {
+    vnode_t* existing = NULL;
+    if (vfs_lookup("/README", &existing) == 0) {
+        vnode_unref(existing);  /* Restored from a snapshot: keep it */
+    } else if (vfs_open("/README", O_CREAT | O_WRONLY, &readme) >= 0) {
         const char* msg = "=== Chanux OS ===\n\n"
                           "An educational x86_64 operating system.\n\n"
                           "Features:\n"
@@ -209,6 +249,35 @@ static void fs_init(void) {
     kprintf("Filesystem ready (RAMFS mounted at /)\n");
 }
 
+/**
+ * Read a program from the filesystem into kernel memory for
+ * user_process_create(). The copy is kept: processes running the program
+ * use its ELF bytes for as long as they live.
+ *
+ * @return The ELF image, or NULL if the file is missing or unreadable
+ */
+static const void* load_program(const char* path, size_t* size) {
+    stat_t st;
+    if (vfs_stat(path, &st) < 0 || st.st_size == 0) {
+        return NULL;
+    }
+
+    file_t* file = NULL;
+    if (vfs_open(path, O_RDONLY, &file) < 0) {
+        return NULL;
+    }
+
+    void* image = kmalloc(st.st_size);
+    if (image && vfs_read(file, image, st.st_size) != (int64_t)st.st_size) {
+        kfree(image);
+        image = NULL;
+    }
+    vfs_close(file);
+
+    *size = st.st_size;
+    return image;
+}
+
 /* =============================================================================
  * Interrupt Subsystem Initialization
  * =============================================================================
@@ -217,8 +286,11 @@ static void fs_init(void) {
 /* =============================================================================
  * Demo Processes for Phase 4
  * =============================================================================
+ * Left out of benchmark kernels (make bench), where they would only add noise.
  */
 
+#ifndef KERNEL_BENCH
+
 /**
  * Demo process A - prints tick messages.
  */
@@ -287,6 +359,7 @@ static void demo_process_b(void* arg) {
         }
     }
 }
+#endif
 
 /* =============================================================================
  * Interrupt Subsystem Initialization
@@ -338,13 +411,26 @@ static void interrupts_init(void) {
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     kprintf("PS/2 keyboard driver initialized\n");
 
-    /* Step 7: Enable interrupts */
+    /* Step 7: Buffered serial output */
+    serial_enable_irq();
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[INT] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("COM1 output buffered, drained by IRQ4\n");
+
+    /* Step 8: Enable interrupts */
     sti();
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[INT] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     kprintf("Interrupts enabled!\n");
 
+    /* Step 9: Local APIC (calibrated against the PIT), then the I/O APIC */
+    acpi_init();
+    pmm_numa_init();                        /* Per-node zones from the SRAT */
+    lapic_init(acpi_madt()->lapic_phys);    /* 0 = architectural default */
+    irq_enable_apic();
+
     kprintf("\n");
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[INT] ");
@@ -359,6 +445,7 @@ static void interrupts_init(void) {
 
 NORETURN void kernel_panic(const char* file, int line, const char* msg) {
     cli();  /* Disable interrupts */
+    klog_panic();       /* Nothing will drain the log or serial buffer now */
 
     vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
     kprintf("\n\n");
@@ -386,6 +473,9 @@ void kernel_main(void* boot_info_ptr) {
     /* Cast boot info pointer */
     boot_info_t* boot_info = (boot_info_t*)boot_info_ptr;
 
+    /* Per-CPU data for the boot CPU (everything below uses cpu_this()) */
+    smp_init_bsp();
+
     /* ==========================================================================
      * Step 1: Initialize VGA Driver
      * ==========================================================================
@@ -416,6 +506,10 @@ void kernel_main(void* boot_info_ptr) {
      */
     mm_init(boot_info);
 
+    /* SSE (its state areas are slab objects) and the memcpy/memset paths */
+    fpu_init();
+    string_init();
+
     /* ==========================================================================
      * Step 4: Initialize Interrupt Subsystem
      * ==========================================================================
@@ -441,7 +535,7 @@ void kernel_main(void* boot_info_ptr) {
      * Step 5: Initialize Filesystem (Phase 6)
      * ==========================================================================
      */
-    fs_init();
+    fs_init(boot_info);
 
     /* ==========================================================================
      * Step 6: Initialize Process Management (Phase 4)
@@ -477,9 +571,33 @@ void kernel_main(void* boot_info_ptr) {
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     kprintf("System call interface ready!\n");
 
+    /* ==========================================================================
+     * Step 7b: Start the Other CPUs
+     * ==========================================================================
+     */
+    clock_init();                           /* Tickless from sched_start() */
+    vdso_init();
+    smp_init();
+
+    /* Collects exited processes from here on */
+    process_reaper_start();
+
+    /* Writes dirty disk blocks back in the background */
+    bcache_writeback_start();
+
+    /* Takes over console output once the scheduler runs */
+    klog_start();
+
+#ifdef KERNEL_BENCH
+    /* make bench: the benchmark suite runs instead of the demos and the shell */
+    size_t bench_size = 0;
+    const void* bench = load_program(BENCH_USER_PATH, &bench_size);
+    bench_start(bench, bench_size);
+#else
     /* Create demo kernel processes */
     process_create("demo_a", demo_process_a, (void*)1);
     process_create("demo_b", demo_process_b, (void*)2);
+#endif
 
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[PROC] ");
@@ -490,18 +608,26 @@ void kernel_main(void* boot_info_ptr) {
      * Step 8: Create Shell User Process (Phase 6)
      * ==========================================================================
      */
+#ifndef KERNEL_BENCH
     kprintf("\n");
     vga_set_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
     kprintf("[USER] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
     kprintf("Creating shell user process...\n");
 
-    /* Get the size of the embedded shell program */
-    size_t shell_size = (size_t)((uintptr_t)_user_shell_end - (uintptr_t)_user_shell_start);
-    kprintf("[USER] Shell program size: %d bytes\n", (int)shell_size);
+    /* The shell from the filesystem, or else the embedded one */
+    size_t shell_size = 0;
+    const void* shell = load_program(SHELL_PATH, &shell_size);
+    if (shell) {
+        kprintf("[USER] Shell program: %s (%d bytes)\n", SHELL_PATH, (int)shell_size);
+    } else {
+        shell = _user_shell_start;
+        shell_size = (size_t)((uintptr_t)_user_shell_end - (uintptr_t)_user_shell_start);
+        kprintf("[USER] Shell program size: %d bytes\n", (int)shell_size);
+    }
 
     /* Create the shell user process */
-    pid_t shell_pid = user_process_create("shell", _user_shell_start, shell_size);
+    pid_t shell_pid = user_process_create("shell", shell, shell_size);
     if (shell_pid != (pid_t)-1) {
         vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
         kprintf("[USER] ");
@@ -513,6 +639,7 @@ void kernel_main(void* boot_info_ptr) {
         vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
         kprintf("Failed to create shell process!\n");
     }
+#endif
 
     /* ==========================================================================
      * Phase 6 Complete - File System & Shell
@@ -527,7 +654,7 @@ void kernel_main(void* boot_info_ptr) {
     kprintf("\n");
     kprintf("Filesystem Features:\n");
     kprintf("  [x] Virtual File System (VFS) layer\n");
-    kprintf("  [x] RAM-based filesystem (RAMFS) - 4MB\n");
+    kprintf("  [x] RAM-based filesystem (RAMFS) - sized at mount\n");
     kprintf("  [x] Inode-based file management\n");
     kprintf("  [x] Directory support with path resolution\n");
     kprintf("  [x] Per-process file descriptor tables\n");
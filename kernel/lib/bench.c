@@ -0,0 +1,349 @@
+/**
+ * =============================================================================
+ * Chanux OS - Microbenchmark Suite
+ * =============================================================================
+ * The kernel half of `make bench` (see bench.h). Each benchmark is a loop
+ * over one operation, timed as a whole with RDTSC; per-op figures are the
+ * run's total divided by the iteration count, so the loop and the RDTSC
+ * pair are amortised away.
+ *
+ * The operations run the way the rest of the kernel calls them: RAMFS and
+ * path lookups under vfs_lock(), page unmaps with their TLB shootdown.
+ * =============================================================================
+ */
+
+#include "../include/bench.h"
+#include "../include/kernel.h"
+#include "../include/clock.h"
+#include "../include/smp.h"
+#include "../include/string.h"
+#include "../include/printf.h"
+#include "../include/klog.h"
+#include "../include/drivers/serial.h"
+#include "../include/mm/pmm.h"
+#include "../include/mm/vmm.h"
+#include "../include/mm/heap.h"
+#include "../include/fs/vfs.h"
+#include "../include/fs/ramfs.h"
+#include "../include/proc/process.h"
+#include "../include/user/user.h"
+
+/* Largest buffer of the RAMFS and memcpy/memset benchmarks */
+#define BENCH_MAX_BYTES         (256 * 1024)
+
+/* Bytes the sized benchmarks move per run (iterations = this / size) */
+#define BENCH_BYTES_PER_RUN     (16 * 1024 * 1024)
+
+/* Directory chain for the path lookup benchmarks: /b1/b2/.../b8 */
+#define BENCH_MAX_DEPTH         8
+
+/* How long /bin/bench may take before the run counts as failed */
+#define BENCH_USER_TIMEOUT_NS   (120ULL * 1000000000ULL)
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static const void* bench_user_prog = NULL;
+static size_t bench_user_size = 0;
+
+/* Shared by the benchmark bodies */
+static uint8_t* bench_src;
+static uint8_t* bench_dst;
+static size_t bench_size;
+static ramfs_inode_t* bench_inode;
+static virt_addr_t bench_virt;
+static phys_addr_t bench_frame;
+static char bench_paths[BENCH_MAX_DEPTH + 1][4 * BENCH_MAX_DEPTH + 1];
+static int bench_depth;
+
+/* =============================================================================
+ * Timing and Reporting
+ * =============================================================================
+ */
+
+typedef void (*bench_fn_t)(uint64_t iters);
+
+/**
+ * Time BENCH_RUNS runs of fn and print the fastest.
+ *
+ * @param bytes Bytes one operation moves (0: no bandwidth figure)
+ */
+static void bench_run(const char* name, bench_fn_t fn, uint64_t iters, uint64_t bytes) {
+    uint64_t best = ~0ULL;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        uint64_t start = rdtsc();
+        fn(iters);
+        uint64_t cycles = rdtsc() - start;
+        best = MIN(best, cycles);
+    }
+
+    uint64_t ns = clock_cycles_to_ns(best);
+    uint64_t ns10 = ns * 10 / iters;
+    kprintf("BENCH %s iters=%u cycles=%u ns=%u.%u", name, iters, best / iters,
+            ns10 / 10, ns10 % 10);
+    if (bytes && ns) {
+        /* bytes per ns is GB/s, so bytes * 1000 per ns is MB/s */
+        kprintf(" mbps=%u", bytes * iters * 1000 / ns);
+    }
+    kprintf("\n");
+}
+
+/* Iterations that move BENCH_BYTES_PER_RUN, within sane bounds */
+static uint64_t bench_sized_iters(size_t size, uint64_t max) {
+    return MAX(64, MIN(max, BENCH_BYTES_PER_RUN / size));
+}
+
+/* Name a benchmark "<base>.<size or depth>" */
+static const char* bench_name(const char* base, uint64_t n) {
+    static char name[48];
+    ksnprintf(name, sizeof(name), "%s.%u", base, n);
+    return name;
+}
+
+/* =============================================================================
+ * Memory Management
+ * =============================================================================
+ */
+
+static void bench_kmalloc(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        kfree(kmalloc(bench_size));
+    }
+}
+
+static void bench_pmm(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        pmm_free_page(pmm_alloc_page());
+    }
+}
+
+static void bench_vmm_map(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        vmm_map_page(bench_virt, bench_frame, PTE_KERNEL_RW);
+        vmm_unmap_page(bench_virt);
+    }
+}
+
+static void bench_aspace(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        vmm_destroy_address_space(vmm_create_address_space());
+    }
+}
+
+/* With one user page, so the walk down to a page table is included */
+static void bench_aspace_page(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        phys_addr_t pml4 = vmm_create_address_space();
+        vmm_map_user_page(pml4, USER_SPACE_START, pmm_alloc_page(), PTE_USER_RW);
+        vmm_destroy_address_space(pml4);
+    }
+}
+
+static void bench_mm(void) {
+    static const size_t sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_size = sizes[i];
+        bench_run(bench_name("kmalloc_kfree", sizes[i]), bench_kmalloc, 10000, 0);
+    }
+
+    bench_run("pmm_alloc_free", bench_pmm, 10000, 0);
+
+    /* A page of the MMIO window to map and unmap over and over */
+    bench_frame = pmm_alloc_page();
+    bench_virt = (virt_addr_t)vmm_map_mmio(bench_frame, PAGE_SIZE);
+    if (bench_frame && bench_virt) {
+        vmm_unmap_page(bench_virt);
+        bench_run("vmm_map_unmap", bench_vmm_map, 10000, 0);
+    }
+
+    bench_run("vmm_aspace_create_destroy", bench_aspace, 1000, 0);
+    bench_run("vmm_aspace_map_destroy", bench_aspace_page, 1000, 0);
+}
+
+/* =============================================================================
+ * RAMFS and Path Lookup
+ * =============================================================================
+ */
+
+static void bench_ramfs_write(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        uint64_t irq = vfs_lock();
+        ramfs_write(bench_inode, bench_src, bench_size, 0);
+        vfs_unlock(irq);
+    }
+}
+
+static void bench_ramfs_read(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        uint64_t irq = vfs_lock();
+        ramfs_read(bench_inode, bench_dst, bench_size, 0);
+        vfs_unlock(irq);
+    }
+}
+
+static void bench_lookup(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        vnode_t* vn;
+        uint64_t irq = vfs_lock();
+        if (vfs_lookup(bench_paths[bench_depth], &vn) == 0) {
+            vnode_unref(vn);
+        }
+        vfs_unlock(irq);
+    }
+}
+
+static void bench_fs(void) {
+    static const size_t sizes[] = { 64, 512, 4096, 65536, BENCH_MAX_BYTES };
+
+    /* The file is written once at full size first: later writes overwrite */
+    uint32_t inode_num;
+    uint64_t irq = vfs_lock();
+    int ret = vfs_create("/bench.dat", INODE_TYPE_FILE);
+    if (ret == 0 && ramfs_lookup_path("/bench.dat", &inode_num) == 0) {
+        bench_inode = ramfs_get_inode(inode_num);
+    }
+    if (bench_inode &&
+        ramfs_write(bench_inode, bench_src, BENCH_MAX_BYTES, 0) != BENCH_MAX_BYTES) {
+        bench_inode = NULL;
+    }
+    vfs_unlock(irq);
+
+    if (!bench_inode) {
+        kprintf("BENCH-ERROR cannot create /bench.dat\n");
+    } else {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            bench_size = sizes[i];
+            uint64_t iters = bench_sized_iters(sizes[i], 10000);
+            bench_run(bench_name("ramfs_write", sizes[i]), bench_ramfs_write, iters, sizes[i]);
+            bench_run(bench_name("ramfs_read", sizes[i]), bench_ramfs_read, iters, sizes[i]);
+        }
+    }
+
+    /* bench_paths[d] is the d-deep directory /b1/.../b<d> */
+    size_t len = 0;
+    for (int d = 1; d <= BENCH_MAX_DEPTH; d++) {
+        memcpy(bench_paths[d], bench_paths[d - 1], len);
+        len += ksnprintf(bench_paths[d] + len, sizeof(bench_paths[d]) - len, "/b%d", d);
+
+        irq = vfs_lock();
+        ret = vfs_mkdir(bench_paths[d]);
+        vfs_unlock(irq);
+        if (ret < 0) {
+            kprintf("BENCH-ERROR cannot create %s\n", bench_paths[d]);
+            return;
+        }
+    }
+
+    for (bench_depth = 1; bench_depth <= BENCH_MAX_DEPTH; bench_depth *= 2) {
+        bench_run(bench_name("path_lookup", bench_depth), bench_lookup, 10000, 0);
+    }
+}
+
+/* =============================================================================
+ * memcpy / memset
+ * =============================================================================
+ */
+
+static void bench_memcpy(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        memcpy(bench_dst, bench_src, bench_size);
+    }
+}
+
+static void bench_memset(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        memset(bench_dst, (int)i, bench_size);
+    }
+}
+
+static void bench_string(void) {
+    static const size_t sizes[] = { 64, 1024, 4096, 65536, BENCH_MAX_BYTES };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_size = sizes[i];
+        uint64_t iters = bench_sized_iters(sizes[i], 100000);
+        bench_run(bench_name("memcpy", sizes[i]), bench_memcpy, iters, sizes[i]);
+        bench_run(bench_name("memset", sizes[i]), bench_memset, iters, sizes[i]);
+    }
+}
+
+/* =============================================================================
+ * User Benchmarks
+ * =============================================================================
+ */
+
+/**
+ * Run /bin/bench and wait for it to exit.
+ *
+ * @return true if it ran to the end in time
+ */
+static bool bench_user(void) {
+    if (!bench_user_prog) {
+        kprintf("BENCH-ERROR %s not found (build with make bench)\n", BENCH_USER_PATH);
+        return false;
+    }
+
+    pid_t pid = user_process_create("bench", bench_user_prog, bench_user_size);
+    if (pid == (pid_t)-1) {
+        kprintf("BENCH-ERROR cannot start %s\n", BENCH_USER_PATH);
+        return false;
+    }
+
+    /* There is no wait() for kernel processes: poll until the reaper has it */
+    uint64_t deadline = clock_ns() + BENCH_USER_TIMEOUT_NS;
+    for (;;) {
+        process_t* proc = process_get(pid);
+        if (!proc || proc->state == PROCESS_STATE_TERMINATED) {
+            return proc ? proc->exit_code == 0 : true;
+        }
+        if (clock_ns() >= deadline) {
+            kprintf("BENCH-ERROR %s timed out\n", BENCH_USER_PATH);
+            return false;
+        }
+        process_sleep(clock_ns() + 10000000ULL);
+    }
+}
+
+/* =============================================================================
+ * Benchmark Process
+ * =============================================================================
+ */
+
+static void bench_main(void* arg) {
+    (void)arg;
+    bool ok = true;
+
+    kprintf("BENCH-INFO tsc_khz=%u cpus=%u runs=%u\n", clock_tsc_khz(),
+            (uint64_t)smp_cpu_count(), (uint64_t)BENCH_RUNS);
+
+    bench_src = (uint8_t*)kmalloc(BENCH_MAX_BYTES);
+    bench_dst = (uint8_t*)kmalloc(BENCH_MAX_BYTES);
+    if (!bench_src || !bench_dst) {
+        kprintf("BENCH-ERROR out of memory\n");
+        ok = false;
+    } else {
+        memset(bench_src, 0x5A, BENCH_MAX_BYTES);
+        bench_mm();
+        bench_fs();
+        bench_string();
+        ok = bench_user();
+    }
+
+    kprintf("BENCH-END %s\n", ok ? "ok" : "failed");
+    klog_flush();
+    serial_flush();
+
+    /* Ends QEMU when it has the device; on anything else, just exit */
+    outb(BENCH_DEBUG_EXIT_PORT, ok ? BENCH_EXIT_OK : BENCH_EXIT_FAILED);
+}
+
+void bench_start(const void* user_prog, size_t user_size) {
+    bench_user_prog = user_prog;
+    bench_user_size = user_size;
+
+    if (process_create("bench", bench_main, NULL) == (pid_t)-1) {
+        PANIC("Failed to create the benchmark process");
+    }
+}
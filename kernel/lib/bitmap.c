@@ -0,0 +1,101 @@
+/**
+ * =============================================================================
+ * Chanux OS - Bitmap Utilities Implementation
+ * =============================================================================
+ * Word-at-a-time range updates, searches and next-fit allocation over
+ * 64-bit bitmaps (see bitmap.h).
+ * =============================================================================
+ */
+
+#include "../include/bitmap.h"
+
+/* Bits [from, to) of one word, 0 <= from < to <= 64 */
+static inline uint64_t word_mask(uint64_t from, uint64_t to) {
+    uint64_t high = (to == BITMAP_WORD_BITS) ? ~0ULL : (1ULL << to) - 1;
+    return high & (~0ULL << from);
+}
+
+/* =============================================================================
+ * Ranges and Searches
+ * =============================================================================
+ */
+
+void bitmap_set_range(uint64_t* map, uint64_t start, uint64_t count) {
+    uint64_t end = start + count;
+    while (start < end) {
+        uint64_t word = start / BITMAP_WORD_BITS;
+        uint64_t from = start % BITMAP_WORD_BITS;
+        uint64_t to = (end - word * BITMAP_WORD_BITS < BITMAP_WORD_BITS) ?
+                      end - word * BITMAP_WORD_BITS : BITMAP_WORD_BITS;
+        map[word] |= word_mask(from, to);
+        start = word * BITMAP_WORD_BITS + to;
+    }
+}
+
+void bitmap_clear_range(uint64_t* map, uint64_t start, uint64_t count) {
+    uint64_t end = start + count;
+    while (start < end) {
+        uint64_t word = start / BITMAP_WORD_BITS;
+        uint64_t from = start % BITMAP_WORD_BITS;
+        uint64_t to = (end - word * BITMAP_WORD_BITS < BITMAP_WORD_BITS) ?
+                      end - word * BITMAP_WORD_BITS : BITMAP_WORD_BITS;
+        map[word] &= ~word_mask(from, to);
+        start = word * BITMAP_WORD_BITS + to;
+    }
+}
+
+/* First bit in [start, end) that is set in (word ^ flip) */
+static uint64_t find_bit(const uint64_t* map, uint64_t start, uint64_t end, uint64_t flip) {
+    while (start < end) {
+        uint64_t word = start / BITMAP_WORD_BITS;
+        uint64_t bits = (map[word] ^ flip) & (~0ULL << (start % BITMAP_WORD_BITS));
+        if (bits) {
+            uint64_t bit = word * BITMAP_WORD_BITS + (uint64_t)__builtin_ctzll(bits);
+            return (bit < end) ? bit : end;
+        }
+        start = (word + 1) * BITMAP_WORD_BITS;
+    }
+    return end;
+}
+
+uint64_t bitmap_find_zero(const uint64_t* map, uint64_t start, uint64_t end) {
+    return find_bit(map, start, end, ~0ULL);
+}
+
+uint64_t bitmap_find_one(const uint64_t* map, uint64_t start, uint64_t end) {
+    return find_bit(map, start, end, 0);
+}
+
+/* =============================================================================
+ * Next-Fit Allocation
+ * =============================================================================
+ */
+
+uint64_t bitmap_alloc_run(uint64_t* map, uint64_t lo, uint64_t hi, uint64_t count,
+                          uint64_t* cursor, uint64_t* first) {
+    if (count == 0 || lo >= hi) {
+        return 0;
+    }
+
+    uint64_t start = (*cursor >= lo && *cursor < hi) ? *cursor : lo;
+    uint64_t bit = bitmap_find_zero(map, start, hi);
+    if (bit == hi) {
+        bit = bitmap_find_zero(map, lo, start);
+        if (bit == start) {
+            return 0;   /* Full */
+        }
+    }
+
+    uint64_t limit = (count < hi - bit) ? bit + count : hi;
+    uint64_t end = bitmap_find_one(map, bit, limit);
+    bitmap_set_range(map, bit, end - bit);
+
+    *first = bit;
+    *cursor = end;
+    return end - bit;
+}
+
+uint64_t bitmap_alloc(uint64_t* map, uint64_t lo, uint64_t hi, uint64_t* cursor) {
+    uint64_t bit;
+    return bitmap_alloc_run(map, lo, hi, 1, cursor, &bit) ? bit : hi;
+}
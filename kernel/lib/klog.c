@@ -0,0 +1,368 @@
+/**
+ * =============================================================================
+ * Chanux OS - Kernel Log Implementation
+ * =============================================================================
+ * Per-CPU log rings with a single consumer (see klog.h).
+ *
+ * Ring layout: variable-length records, each an 8-byte header followed by
+ * the text, padded to 8 bytes. A record never wraps; when the next one
+ * would not fit before the end, a pad record fills the gap. head and tail
+ * are free-running byte counts:
+ *   - head is written only by the owning CPU, with interrupts off, and is
+ *     published with a release store once the record is complete
+ *   - tail is written only by the flusher, under klog_flush_lock
+ *
+ * Every record takes a number from klog_seq so the flusher can put the
+ * CPUs' messages back in the order they were logged.
+ * =============================================================================
+ */
+
+#include "../include/klog.h"
+#include "../include/printf.h"
+#include "../include/kernel.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/proc/process.h"
+#include "../include/proc/wait.h"
+#include "../include/drivers/serial.h"
+#include "../drivers/vga/vga.h"
+
+/* =============================================================================
+ * Records and Rings
+ * =============================================================================
+ */
+
+#define KLOG_PAD            0xFFFF  /* len of a pad record: skip to the ring start */
+#define KLOG_NO_CPU         0xFFFFFFFF
+
+typedef struct {
+    uint32_t    seq;        /* Global order */
+    uint16_t    len;        /* Text bytes (no terminator), or KLOG_PAD */
+    uint8_t     level;      /* KLOG_* */
+    uint8_t     color;      /* VGA attribute when logged */
+} klog_record_t;
+
+_Static_assert(sizeof(klog_record_t) == 8, "records stay 8-byte aligned");
+
+/* Most a record can take: header, text and the formatter's terminator */
+#define KLOG_RECORD_MAX     ALIGN_UP(sizeof(klog_record_t) + KLOG_TEXT_MAX + 1, 8)
+
+typedef struct {
+    uint32_t    head;       /* Producer: this CPU */
+    uint32_t    tail;       /* Consumer: the flusher */
+    bool        busy;       /* Producer is formatting a record */
+    char        data[KLOG_RING_SIZE] ALIGNED(8);
+} klog_ring_t;
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static klog_ring_t klog_rings[SMP_MAX_CPUS];
+static uint32_t klog_seq = 0;
+
+/* Flushed text, for klog_read() (klog_flush_lock) */
+static char klog_history[KLOG_HISTORY_SIZE];
+static uint64_t klog_history_head = 0;
+
+/*
+ * One flusher at a time, so records come out in order. The owner is
+ * recorded so that a producer on the flushing CPU (a fault taken while
+ * writing to the console) does not wait for itself.
+ */
+static spinlock_t klog_flush_lock = SPINLOCK_INIT;
+static volatile uint32_t klog_flush_owner = KLOG_NO_CPU;
+
+/* klogd has run and owns console output */
+static volatile bool klog_deferred = false;
+
+/* klog_panic() has run: write everything straight out */
+static volatile bool klog_panicked = false;
+
+/* A message was logged with interrupts off and klogd is yet to hear of it */
+static volatile bool klog_wake_pending = false;
+
+static wait_queue_t klog_wq = WAIT_QUEUE_INIT(klog_wq);
+
+/* =============================================================================
+ * Helper Functions
+ * =============================================================================
+ */
+
+static inline uint32_t record_size(uint16_t len) {
+    return ALIGN_UP(sizeof(klog_record_t) + len, 8);
+}
+
+static inline klog_record_t* ring_record(klog_ring_t* ring, uint32_t pos) {
+    return (klog_record_t*)&ring->data[pos & (KLOG_RING_SIZE - 1)];
+}
+
+/**
+ * Next record the flusher has not taken, skipping pad records.
+ * Caller holds klog_flush_lock (or has panicked).
+ *
+ * @return The record, or NULL if the ring is drained
+ */
+static klog_record_t* ring_peek(klog_ring_t* ring) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while (ring->tail != head) {
+        klog_record_t* rec = ring_record(ring, ring->tail);
+        if (rec->len != KLOG_PAD) {
+            return rec;
+        }
+        ring->tail += KLOG_RING_SIZE - (ring->tail & (KLOG_RING_SIZE - 1));
+    }
+    return NULL;
+}
+
+static bool klog_pending(void) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        klog_ring_t* ring = &klog_rings[i];
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Write one record's text to the console and history.
+ */
+static void klog_emit(const klog_record_t* rec) {
+    const char* text = (const char*)(rec + 1);
+
+    if (rec->level <= KLOG_CONSOLE_LEVEL) {
+        vga_write_attr(rec->color, text, rec->len);
+    }
+
+    for (uint16_t i = 0; i < rec->len; i++) {
+        klog_history[klog_history_head++ & (KLOG_HISTORY_SIZE - 1)] = text[i];
+    }
+}
+
+/**
+ * Drain every ring, oldest record first.
+ * Caller holds klog_flush_lock (or has panicked).
+ */
+static void klog_drain(void) {
+    for (;;) {
+        klog_ring_t* oldest = NULL;
+        klog_record_t* next = NULL;
+
+        for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+            klog_record_t* rec = ring_peek(&klog_rings[i]);
+            if (rec && (!next || (int32_t)(rec->seq - next->seq) < 0)) {
+                oldest = &klog_rings[i];
+                next = rec;
+            }
+        }
+        if (!next) {
+            return;
+        }
+
+        klog_emit(next);
+
+        /* The producer may reuse the space from here */
+        __atomic_store_n(&oldest->tail, oldest->tail + record_size(next->len),
+                         __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Write a message straight to the console, without a record.
+ */
+static void klog_write_direct(int level, uint8_t color, const char* format, va_list args) {
+    char text[KLOG_TEXT_MAX + 1];
+    size_t len = kvsnprintf(text, sizeof(text), format, args);
+    if (level <= KLOG_CONSOLE_LEVEL) {
+        vga_write_attr(color, text, len);
+    }
+}
+
+/**
+ * Reserve room for a record on this CPU's ring (interrupts off).
+ * A pad record is written if the record would cross the end.
+ *
+ * @param pos Set to the record's position (head once a pad is skipped)
+ * @return The record, or NULL if the ring is full
+ */
+static klog_record_t* ring_reserve(klog_ring_t* ring, uint32_t* pos) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t offset = head & (KLOG_RING_SIZE - 1);
+    uint32_t pad = 0;
+
+    if (offset + KLOG_RECORD_MAX > KLOG_RING_SIZE) {
+        pad = KLOG_RING_SIZE - offset;
+    }
+    if (KLOG_RING_SIZE - (head - tail) < pad + KLOG_RECORD_MAX) {
+        return NULL;
+    }
+
+    if (pad) {
+        ring_record(ring, head)->len = KLOG_PAD;
+        head += pad;
+    }
+    *pos = head;
+    return ring_record(ring, head);
+}
+
+/* =============================================================================
+ * Logging
+ * =============================================================================
+ */
+
+void klog_vprintf(int level, const char* format, va_list args) {
+    uint8_t color = vga_get_color();
+
+    if (klog_panicked) {
+        klog_write_direct(level, color, format, args);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    klog_ring_t* ring = &klog_rings[cpu_this()->id];
+
+    /* Logging from a fault taken while this CPU was appending */
+    if (ring->busy) {
+        klog_write_direct(level, color, format, args);
+        irq_restore(flags);
+        return;
+    }
+    ring->busy = true;
+
+    uint32_t pos = 0;
+    klog_record_t* rec = ring_reserve(ring, &pos);
+    if (!rec && klog_flush_owner != cpu_this()->id) {
+        /* Full: make room by writing it out here */
+        klog_flush();
+        rec = ring_reserve(ring, &pos);
+    }
+    if (!rec) {
+        /* Full, and this CPU is the one flushing it: drop the message */
+        ring->busy = false;
+        irq_restore(flags);
+        return;
+    }
+
+    /* Format straight into the ring */
+    size_t len = kvsnprintf((char*)(rec + 1), KLOG_TEXT_MAX + 1, format, args);
+    rec->seq = __atomic_fetch_add(&klog_seq, 1, __ATOMIC_RELAXED);
+    rec->len = (uint16_t)len;
+    rec->level = (uint8_t)level;
+    rec->color = color;
+
+    /* Publish the pad (if any) and the record together */
+    __atomic_store_n(&ring->head, pos + record_size(rec->len), __ATOMIC_RELEASE);
+    ring->busy = false;
+
+    if (!klog_deferred || level <= KLOG_ERR) {
+        klog_flush();
+    } else if (flags & (1 << 9)) {     /* RFLAGS.IF: waking is safe */
+        klog_wake_pending = true;
+        irq_restore(flags);
+        klog_tick();
+        return;
+    } else {
+        klog_wake_pending = true;
+    }
+
+    irq_restore(flags);
+}
+
+void klog(int level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    klog_vprintf(level, format, args);
+    va_end(args);
+}
+
+void kprintf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    klog_vprintf(KLOG_INFO, format, args);
+    va_end(args);
+}
+
+/* =============================================================================
+ * Flushing
+ * =============================================================================
+ */
+
+void klog_flush(void) {
+    if (klog_panicked) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&klog_flush_lock);
+    klog_flush_owner = cpu_this()->id;
+    klog_drain();
+    klog_flush_owner = KLOG_NO_CPU;
+    spin_unlock_irqrestore(&klog_flush_lock, flags);
+}
+
+void klog_tick(void) {
+    if (klog_wake_pending && wait_queue_active(&klog_wq)) {
+        klog_wake_pending = false;
+        wake_up(&klog_wq);
+    }
+}
+
+void klog_panic(void) {
+    serial_panic();
+
+    /*
+     * As with the serial ring: the flusher may never let go, so take the
+     * rings without the lock. Producers elsewhere bypass them from now on.
+     */
+    klog_panicked = true;
+    klog_drain();
+}
+
+/* =============================================================================
+ * klogd
+ * =============================================================================
+ */
+
+static void klogd(void* arg) {
+    (void)arg;
+
+    /* Console output is ours from here on */
+    klog_deferred = true;
+
+    for (;;) {
+        wait_event(&klog_wq, klog_pending());
+        klog_flush();
+    }
+}
+
+void klog_start(void) {
+    if (process_create("klogd", klogd, NULL) == (pid_t)-1) {
+        PANIC("Failed to create klogd");
+    }
+}
+
+/* =============================================================================
+ * Reading
+ * =============================================================================
+ */
+
+size_t klog_read(char* buf, size_t len) {
+    uint64_t flags = spin_lock_irqsave(&klog_flush_lock);
+
+    uint64_t avail = klog_history_head < KLOG_HISTORY_SIZE ?
+                     klog_history_head : KLOG_HISTORY_SIZE;
+    if (len > avail) {
+        len = avail;
+    }
+
+    uint64_t pos = klog_history_head - len;
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = klog_history[(pos + i) & (KLOG_HISTORY_SIZE - 1)];
+    }
+
+    spin_unlock_irqrestore(&klog_flush_lock, flags);
+    return len;
+}
@@ -0,0 +1,172 @@
+/**
+ * =============================================================================
+ * Chanux OS - Formatted Output Implementation
+ * =============================================================================
+ * The format loop kprintf() used to run straight onto the screen, now
+ * writing into a buffer (see printf.h).
+ * =============================================================================
+ */
+
+#include "../include/printf.h"
+
+/* =============================================================================
+ * Output Buffer
+ * =============================================================================
+ */
+
+typedef struct {
+    char*       buf;
+    size_t      size;       /* Room, terminator included */
+    size_t      len;        /* Characters written */
+} fmt_out_t;
+
+static inline void fmt_putc(fmt_out_t* out, char c) {
+    if (out->len + 1 < out->size) {
+        out->buf[out->len++] = c;
+    }
+}
+
+static void fmt_puts(fmt_out_t* out, const char* str) {
+    while (*str) {
+        fmt_putc(out, *str++);
+    }
+}
+
+static void fmt_dec(fmt_out_t* out, uint64_t value) {
+    char buffer[21];  /* Max 20 digits for 64-bit + null */
+    int i = 0;
+
+    if (value == 0) {
+        fmt_putc(out, '0');
+        return;
+    }
+
+    /* Build string in reverse */
+    while (value > 0) {
+        buffer[i++] = '0' + (value % 10);
+        value /= 10;
+    }
+
+    /* Emit in correct order */
+    while (i > 0) {
+        fmt_putc(out, buffer[--i]);
+    }
+}
+
+static void fmt_hex(fmt_out_t* out, uint64_t value) {
+    static const char hex_chars[] = "0123456789ABCDEF";
+    char buffer[17];  /* Max 16 hex digits + null */
+    int i = 0;
+
+    if (value == 0) {
+        fmt_puts(out, "0x0");
+        return;
+    }
+
+    /* Build string in reverse */
+    while (value > 0) {
+        buffer[i++] = hex_chars[value & 0xF];
+        value >>= 4;
+    }
+
+    /* Emit prefix and value */
+    fmt_puts(out, "0x");
+    while (i > 0) {
+        fmt_putc(out, buffer[--i]);
+    }
+}
+
+/* =============================================================================
+ * Formatting
+ * =============================================================================
+ */
+
+size_t kvsnprintf(char* buf, size_t size, const char* format, va_list args) {
+    fmt_out_t out = { buf, size, 0 };
+
+    while (*format) {
+        if (*format == '%') {
+            format++;
+
+            switch (*format) {
+                case 's': {
+                    /* String */
+                    const char* str = va_arg(args, const char*);
+                    fmt_puts(&out, str ? str : "(null)");
+                    break;
+                }
+
+                case 'c': {
+                    /* Character */
+                    fmt_putc(&out, (char)va_arg(args, int));
+                    break;
+                }
+
+                case 'd':
+                case 'i': {
+                    /* Signed decimal */
+                    int64_t value = va_arg(args, int64_t);
+                    if (value < 0) {
+                        fmt_putc(&out, '-');
+                        value = -value;
+                    }
+                    fmt_dec(&out, (uint64_t)value);
+                    break;
+                }
+
+                case 'u': {
+                    /* Unsigned decimal */
+                    fmt_dec(&out, va_arg(args, uint64_t));
+                    break;
+                }
+
+                case 'x':
+                case 'X': {
+                    /* Hexadecimal */
+                    fmt_hex(&out, va_arg(args, uint64_t));
+                    break;
+                }
+
+                case 'p': {
+                    /* Pointer */
+                    fmt_hex(&out, (uint64_t)va_arg(args, void*));
+                    break;
+                }
+
+                case '%':
+                    /* Percent sign */
+                    fmt_putc(&out, '%');
+                    break;
+
+                case '\0':
+                    /* Lone '%' at the end */
+                    fmt_putc(&out, '%');
+                    format--;
+                    break;
+
+                default:
+                    /* Unknown format, print as-is */
+                    fmt_putc(&out, '%');
+                    fmt_putc(&out, *format);
+                    break;
+            }
+        } else {
+            fmt_putc(&out, *format);
+        }
+
+        format++;
+    }
+
+    if (size > 0) {
+        buf[out.len] = '\0';
+    }
+    return out.len;
+}
+
+size_t ksnprintf(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t len = kvsnprintf(buf, size, format, args);
+    va_end(args);
+    return len;
+}
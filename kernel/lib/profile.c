@@ -0,0 +1,157 @@
+/**
+ * =============================================================================
+ * Chanux OS - Sampling Profiler Implementation
+ * =============================================================================
+ * Per-CPU sample rings with a single consumer at a time (see profile.h).
+ *
+ * head and tail are free-running sample counts:
+ *   - head is written only by the owning CPU, in the timer interrupt, and
+ *     is published with a release store once the sample is complete
+ *   - tail is written only under profile_lock (profile_read() and
+ *     profile_start())
+ *
+ * Rings are allocated by the first profile_start() that finds a CPU
+ * without one, and kept from then on.
+ * =============================================================================
+ */
+
+#include "../include/profile.h"
+#include "../include/kernel.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/mm/heap.h"
+#include "../include/proc/process.h"
+
+/* =============================================================================
+ * Rings
+ * =============================================================================
+ */
+
+typedef struct {
+    uint32_t            head;       /* Producer: this CPU */
+    uint32_t            tail;       /* Consumer: under profile_lock */
+    uint32_t            dropped;    /* Samples lost to a full ring */
+    profile_sample_t    samples[PROFILE_RING_SAMPLES];
+} profile_ring_t;
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static profile_ring_t* profile_rings[SMP_MAX_CPUS];
+static volatile bool profile_enabled = false;
+static spinlock_t profile_lock = SPINLOCK_INIT;
+
+/* =============================================================================
+ * Sampling
+ * =============================================================================
+ */
+
+void profile_sample(const registers_t* regs) {
+    if (!profile_enabled) {
+        return;
+    }
+
+    cpu_t* cpu = cpu_this();
+    profile_ring_t* ring = profile_rings[cpu->id];
+    if (!ring) {
+        return;     /* Came online after profile_start() */
+    }
+
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= PROFILE_RING_SAMPLES) {
+        ring->dropped++;
+        return;
+    }
+
+    profile_sample_t* sample = &ring->samples[head & (PROFILE_RING_SAMPLES - 1)];
+    sample->rip = regs->rip;
+    sample->pid = cpu->current ? (uint32_t)cpu->current->pid : 0;
+    sample->cpu = (uint16_t)cpu->id;
+    sample->flags = (regs->cs & 3) ? PROFILE_SAMPLE_USER : 0;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* =============================================================================
+ * Profiler API
+ * =============================================================================
+ */
+
+int profile_start(void) {
+    /* Allocate outside the lock; a racing start may beat us to a slot */
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (profile_rings[i] || !cpu_get(i)) {
+            continue;
+        }
+
+        profile_ring_t* ring = (profile_ring_t*)kzalloc(sizeof(profile_ring_t));
+        if (!ring) {
+            return -1;
+        }
+
+        uint64_t flags = spin_lock_irqsave(&profile_lock);
+        if (!profile_rings[i]) {
+            profile_rings[i] = ring;
+            ring = NULL;
+        }
+        spin_unlock_irqrestore(&profile_lock, flags);
+
+        if (ring) {
+            kfree(ring);
+        }
+    }
+
+    uint64_t flags = spin_lock_irqsave(&profile_lock);
+    profile_enabled = false;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        profile_ring_t* ring = profile_rings[i];
+        if (ring) {
+            __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+            ring->dropped = 0;
+        }
+    }
+    profile_enabled = true;
+    spin_unlock_irqrestore(&profile_lock, flags);
+
+    return 0;
+}
+
+void profile_stop(void) {
+    profile_enabled = false;
+}
+
+size_t profile_read(profile_sample_t* buf, size_t count) {
+    size_t copied = 0;
+
+    uint64_t flags = spin_lock_irqsave(&profile_lock);
+    for (uint32_t i = 0; i < SMP_MAX_CPUS && copied < count; i++) {
+        profile_ring_t* ring = profile_rings[i];
+        if (!ring) {
+            continue;
+        }
+
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring->tail;
+        while (tail != head && copied < count) {
+            buf[copied++] = ring->samples[tail & (PROFILE_RING_SAMPLES - 1)];
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&profile_lock, flags);
+
+    return copied;
+}
+
+uint64_t profile_dropped(void) {
+    uint64_t dropped = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (profile_rings[i]) {
+            dropped += profile_rings[i]->dropped;
+        }
+    }
+    return dropped;
+}
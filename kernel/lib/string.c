@@ -7,6 +7,76 @@
  */
 
 #include "../include/string.h"
+#include "../include/fpu.h"
+#include "../include/kernel.h"
+#include "../drivers/vga/vga.h"
+
+/* =============================================================================
+ * Kernel Selection
+ * =============================================================================
+ * memcpy()/memset() pick one of three bulk paths, chosen once per boot by
+ * string_init() from CPUID:
+ *
+ *   - ERMS/FSRM: REP MOVSB/STOSB, which the CPU runs in cache-line chunks;
+ *     with FSRM it is also the fastest way to move short buffers
+ *   - SSE2: 64-byte XMM loops (arch/x86_64/simd.asm) for large buffers,
+ *     worth the FXSAVE/FXRSTOR of a kernel FPU section
+ *   - 8-byte words, with unaligned loads where the source needs them
+ *
+ * Until string_init() runs (early boot) only the word path is used.
+ */
+
+#define STRING_ERMS         0x01    /* Enhanced REP MOVSB/STOSB */
+#define STRING_FSRM         0x02    /* Fast short REP MOVSB */
+#define STRING_SSE2         0x04    /* Kernel FPU sections available */
+
+#define STRING_REP_MIN      128     /* ERMS: REP beats the word loop from here */
+#define STRING_SIMD_MIN     1024    /* SSE2: pays for the FPU save/restore */
+
+static uint32_t string_features = 0;
+
+/* SSE2 kernels (arch/x86_64/simd.asm) */
+extern void memcpy_sse2(void* dst, const void* src, size_t len);
+extern void memset_sse2(void* dst, uint64_t pattern, size_t len);
+
+/* A 64-bit word at any address (x86 loads it in one go) */
+typedef struct {
+    uint64_t value;
+} PACKED unaligned_u64_t;
+
+void string_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t features = 0;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & (1U << 9)) {
+            features |= STRING_ERMS;
+        }
+        if (edx & (1U << 4)) {
+            features |= STRING_FSRM;
+        }
+    }
+    if (fpu_available()) {
+        features |= STRING_SSE2;
+    }
+    string_features = features;
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[LIB] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("memcpy/memset: %s\n",
+            (features & STRING_FSRM) ? "rep movsb (FSRM)" :
+            (features & STRING_ERMS) ? "rep movsb (ERMS)" :
+            (features & STRING_SSE2) ? "SSE2" : "64-bit words");
+}
+
+/* Whether a buffer of 'count' bytes goes to REP MOVSB/STOSB */
+static inline bool string_use_rep(size_t count) {
+    return (string_features & STRING_FSRM) ||
+           ((string_features & STRING_ERMS) && count >= STRING_REP_MIN);
+}
 
 /* =============================================================================
  * Memory Functions
@@ -17,6 +87,14 @@ void* memset(void* dest, int val, size_t count) {
     uint8_t* ptr = (uint8_t*)dest;
     uint8_t byte = (uint8_t)val;
 
+    if (string_use_rep(count)) {
+        __asm__ volatile ("rep stosb"
+                          : "+D"(ptr), "+c"(count)
+                          : "a"(byte)
+                          : "memory");
+        return dest;
+    }
+
     /* Optimize for large fills using 64-bit writes */
     if (count >= 8) {
         uint64_t pattern = byte;
@@ -30,6 +108,21 @@ void* memset(void* dest, int val, size_t count) {
             count--;
         }
 
+        /* Large fills: 64 bytes at a time through XMM registers */
+        if ((string_features & STRING_SSE2) && count >= STRING_SIMD_MIN) {
+            if ((uintptr_t)ptr & 8) {
+                *(uint64_t*)ptr = pattern;
+                ptr += 8;
+                count -= 8;
+            }
+            size_t bulk = count & ~(size_t)63;
+            kernel_fpu_begin();
+            memset_sse2(ptr, pattern, bulk);
+            kernel_fpu_end();
+            ptr += bulk;
+            count -= bulk;
+        }
+
         /* Fill 8 bytes at a time */
         uint64_t* ptr64 = (uint64_t*)ptr;
         while (count >= 8) {
@@ -51,19 +144,44 @@ void* memcpy(void* dest, const void* src, size_t count) {
     uint8_t* d = (uint8_t*)dest;
     const uint8_t* s = (const uint8_t*)src;
 
-    /* Optimize for large copies using 64-bit reads/writes */
-    if (count >= 8 && ((uintptr_t)d & 7) == ((uintptr_t)s & 7)) {
-        /* Align to 8-byte boundary */
+    if (string_use_rep(count)) {
+        __asm__ volatile ("rep movsb"
+                          : "+D"(d), "+S"(s), "+c"(count)
+                          :
+                          : "memory");
+        return dest;
+    }
+
+    /* Optimize for large copies using 64-bit writes; loads may be unaligned */
+    if (count >= 8) {
+        /* Align the destination to an 8-byte boundary */
         while (((uintptr_t)d & 7) && count) {
             *d++ = *s++;
             count--;
         }
 
+        /* Large copies: 64 bytes at a time through XMM registers */
+        if ((string_features & STRING_SSE2) && count >= STRING_SIMD_MIN) {
+            if ((uintptr_t)d & 8) {
+                *(uint64_t*)d = ((const unaligned_u64_t*)s)->value;
+                d += 8;
+                s += 8;
+                count -= 8;
+            }
+            size_t bulk = count & ~(size_t)63;
+            kernel_fpu_begin();
+            memcpy_sse2(d, s, bulk);
+            kernel_fpu_end();
+            d += bulk;
+            s += bulk;
+            count -= bulk;
+        }
+
         /* Copy 8 bytes at a time */
         uint64_t* d64 = (uint64_t*)d;
-        const uint64_t* s64 = (const uint64_t*)s;
+        const unaligned_u64_t* s64 = (const unaligned_u64_t*)s;
         while (count >= 8) {
-            *d64++ = *s64++;
+            *d64++ = (s64++)->value;
             count -= 8;
         }
         d = (uint8_t*)d64;
@@ -91,9 +209,19 @@ void* memmove(void* dest, const void* src, size_t count) {
         return memcpy(dest, src, count);
     }
 
-    /* Copy backward to handle overlap */
+    /*
+     * Copy backward to handle overlap, 8 bytes at a time (backward REP
+     * MOVSB is not a fast string operation)
+     */
     d += count;
     s += count;
+    while (count >= 8) {
+        d -= 8;
+        s -= 8;
+        uint64_t word = ((const unaligned_u64_t*)s)->value;
+        ((unaligned_u64_t*)d)->value = word;
+        count -= 8;
+    }
     while (count--) {
         *--d = *--s;
     }
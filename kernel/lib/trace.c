@@ -0,0 +1,160 @@
+/**
+ * =============================================================================
+ * Chanux OS - Tracepoint Implementation
+ * =============================================================================
+ * Per-CPU record rings with a single consumer at a time (see trace.h).
+ *
+ * head and tail are free-running record counts:
+ *   - head is written only by the owning CPU, with interrupts off, and is
+ *     published with a release store once the record is complete
+ *   - tail is written only under trace_lock (trace_read() and
+ *     trace_start())
+ *
+ * Rings are allocated by the first trace_start() that finds a CPU without
+ * one, before any category is switched on, and kept from then on. Nothing
+ * here allocates or takes a lock on the tracepoint path, so tracepoints in
+ * the allocators and the IRQ path cannot recurse.
+ * =============================================================================
+ */
+
+#include "../include/trace.h"
+#include "../include/kernel.h"
+#include "../include/clock.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/mm/heap.h"
+#include "../include/proc/process.h"
+
+/* =============================================================================
+ * Rings
+ * =============================================================================
+ */
+
+typedef struct {
+    uint32_t        head;       /* Producer: this CPU */
+    uint32_t        tail;       /* Consumer: under trace_lock */
+    uint32_t        dropped;    /* Records lost to a full ring */
+    trace_record_t  records[TRACE_RING_RECORDS];
+} trace_ring_t;
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+volatile uint32_t trace_mask = 0;
+
+static trace_ring_t* trace_rings[SMP_MAX_CPUS];
+static spinlock_t trace_lock = SPINLOCK_INIT;
+
+/* =============================================================================
+ * Tracepoints
+ * =============================================================================
+ */
+
+void trace_emit(uint8_t event, uint8_t phase, uint64_t arg0, uint64_t arg1) {
+    uint64_t flags = irq_save();
+    cpu_t* cpu = cpu_this();
+    trace_ring_t* ring = trace_rings[cpu->id];
+
+    if (!ring) {
+        /* Came online after trace_start() */
+    } else if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+               TRACE_RING_RECORDS) {
+        ring->dropped++;
+    } else {
+        trace_record_t* rec = &ring->records[ring->head & (TRACE_RING_RECORDS - 1)];
+        rec->ts_ns = clock_ns();
+        rec->pid = cpu->current ? (uint32_t)cpu->current->pid : 0;
+        rec->cpu = (uint16_t)cpu->id;
+        rec->event = event;
+        rec->phase = phase;
+        rec->arg0 = arg0;
+        rec->arg1 = arg1;
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+
+    irq_restore(flags);
+}
+
+/* =============================================================================
+ * Trace Control
+ * =============================================================================
+ */
+
+int trace_start(uint32_t categories) {
+    /* Allocate outside the lock; a racing start may beat us to a slot */
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (trace_rings[i] || !cpu_get(i)) {
+            continue;
+        }
+
+        trace_ring_t* ring = (trace_ring_t*)kzalloc(sizeof(trace_ring_t));
+        if (!ring) {
+            return -1;
+        }
+
+        uint64_t flags = spin_lock_irqsave(&trace_lock);
+        if (!trace_rings[i]) {
+            trace_rings[i] = ring;
+            ring = NULL;
+        }
+        spin_unlock_irqrestore(&trace_lock, flags);
+
+        if (ring) {
+            kfree(ring);
+        }
+    }
+
+    uint64_t flags = spin_lock_irqsave(&trace_lock);
+    trace_mask = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        trace_ring_t* ring = trace_rings[i];
+        if (ring) {
+            __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELEASE);
+            ring->dropped = 0;
+        }
+    }
+    trace_mask = categories & TRACE_ALL;
+    spin_unlock_irqrestore(&trace_lock, flags);
+
+    return 0;
+}
+
+void trace_stop(void) {
+    trace_mask = 0;
+}
+
+size_t trace_read(trace_record_t* buf, size_t count) {
+    size_t copied = 0;
+
+    uint64_t flags = spin_lock_irqsave(&trace_lock);
+    for (uint32_t i = 0; i < SMP_MAX_CPUS && copied < count; i++) {
+        trace_ring_t* ring = trace_rings[i];
+        if (!ring) {
+            continue;
+        }
+
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring->tail;
+        while (tail != head && copied < count) {
+            buf[copied++] = ring->records[tail & (TRACE_RING_RECORDS - 1)];
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&trace_lock, flags);
+
+    return copied;
+}
+
+uint64_t trace_dropped(void) {
+    uint64_t dropped = 0;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (trace_rings[i]) {
+            dropped += trace_rings[i]->dropped;
+        }
+    }
+    return dropped;
+}
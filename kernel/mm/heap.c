@@ -2,7 +2,27 @@
  * =============================================================================
  * Chanux OS - Kernel Heap Implementation
  * =============================================================================
- * First-fit memory allocator with block coalescing.
+ * Segregated-fit memory allocator with boundary-tag coalescing.
+ *
+ * Requests up to KMALLOC_MAX_CACHE_SIZE are served by the slab size-class
+ * caches once slab_init() has run; the block heap handles everything
+ * larger, and everything allocated before the slab layer exists.
+ *
+ * Block layout (blocks tile [HEAP_START, heap_break) with no gaps):
+ *
+ *   +--------------+----------------------+--------------+
+ *   | heap_block_t |  data (size bytes)   | heap_footer_t|
+ *   +--------------+----------------------+--------------+
+ *
+ * Allocation searches the bin for the request's size class first-fit,
+ * then takes the head of the next non-empty larger bin, whose blocks are
+ * all big enough. Used blocks are never visited.
+ *
+ * Trimming: once a free block is at least heap_trim_threshold bytes, the
+ * pages strictly between its header page and footer page are unmapped and
+ * freed. Header and footer pages always stay mapped, so coalescing and
+ * heap walks never touch a released page; heap_populate() maps released
+ * pages back before a block's data area is handed out again.
  * =============================================================================
  */
 
@@ -10,7 +30,10 @@
 #include "../include/mm/vmm.h"
 #include "../include/mm/pmm.h"
 #include "../include/mm/mm.h"
+#include "../include/mm/slab.h"
 #include "../include/string.h"
+#include "../include/spinlock.h"
+#include "../include/trace.h"
 #include "../drivers/vga/vga.h"
 
 /* =============================================================================
@@ -18,8 +41,11 @@
  * =============================================================================
  */
 
-/* First block in the heap */
-static heap_block_t* heap_first = NULL;
+/* Free lists, one per size class */
+static heap_block_t* heap_bins[HEAP_BIN_COUNT];
+
+/* Bit i set when heap_bins[i] is non-empty */
+static uint32_t heap_bin_map = 0;
 
 /* Current heap size and break (end address) */
 static size_t heap_size = 0;
@@ -29,6 +55,15 @@ static virt_addr_t heap_break = HEAP_START;
 static uint64_t heap_alloc_count = 0;
 static uint64_t heap_free_count = 0;
 
+/* Trimming: threshold and pages inside the heap currently unmapped */
+static size_t heap_trim_threshold = HEAP_TRIM_THRESHOLD;
+static uint64_t heap_released_pages = 0;
+
+/* Guards the bins, the block list and the counters above */
+static spinlock_t heap_lock = SPINLOCK_INIT;
+
+static bool heap_expand_locked(size_t min_size);
+
 /* =============================================================================
  * Helper Functions
  * =============================================================================
@@ -49,48 +84,296 @@ static inline bool block_valid(heap_block_t* block) {
     return block && block->magic == HEAP_BLOCK_MAGIC;
 }
 
-/* Split a block if it's large enough */
+/* Get a block's footer */
+static inline heap_footer_t* block_footer(heap_block_t* block) {
+    return (heap_footer_t*)((uint8_t*)block + HEAP_HEADER_SIZE + block->size);
+}
+
+/* Write header and footer for a block */
+static void block_set(heap_block_t* block, size_t size, uint32_t flags) {
+    block->magic = HEAP_BLOCK_MAGIC;
+    block->flags = flags;
+    block->size = size;
+
+    heap_footer_t* footer = block_footer(block);
+    footer->size = size;
+    footer->magic = HEAP_BLOCK_MAGIC;
+    footer->flags = flags;
+}
+
+/* Physically next block, or NULL at the heap break */
+static inline heap_block_t* block_next(heap_block_t* block) {
+    virt_addr_t next = (virt_addr_t)block + HEAP_OVERHEAD + block->size;
+    return next < heap_break ? (heap_block_t*)next : NULL;
+}
+
+/* Physically previous block (found through its footer), or NULL */
+static inline heap_block_t* block_prev(heap_block_t* block) {
+    if ((virt_addr_t)block <= HEAP_START) return NULL;
+
+    heap_footer_t* footer = (heap_footer_t*)((uint8_t*)block - HEAP_FOOTER_SIZE);
+    if (footer->magic != HEAP_BLOCK_MAGIC) return NULL;
+
+    return (heap_block_t*)((uint8_t*)footer - footer->size - HEAP_HEADER_SIZE);
+}
+
+/* Size class for a data size */
+static inline uint32_t size_to_bin(size_t size) {
+    uint32_t log2 = 63 - (uint32_t)__builtin_clzll(size);
+    if (log2 < HEAP_BIN_MIN_SHIFT) return 0;
+    return MIN(log2 - HEAP_BIN_MIN_SHIFT, HEAP_BIN_COUNT - 1);
+}
+
+/* Push a free block onto its bin */
+static void bin_insert(heap_block_t* block) {
+    uint32_t bin = size_to_bin(block->size);
+
+    block->prev_free = NULL;
+    block->next_free = heap_bins[bin];
+    if (heap_bins[bin]) {
+        heap_bins[bin]->prev_free = block;
+    }
+    heap_bins[bin] = block;
+    heap_bin_map |= (1U << bin);
+}
+
+/* Unlink a free block from its bin */
+static void bin_remove(heap_block_t* block) {
+    uint32_t bin = size_to_bin(block->size);
+
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        heap_bins[bin] = block->next_free;
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (!heap_bins[bin]) {
+        heap_bin_map &= ~(1U << bin);
+    }
+
+    block->next_free = NULL;
+    block->prev_free = NULL;
+}
+
+/*
+ * Split a block if it's large enough
+ * The block keeps its flags; the remainder becomes a free block.
+ */
 static void block_split(heap_block_t* block, size_t size) {
     /* Check if there's enough space for a new block */
-    size_t remaining = block->size - size - HEAP_HEADER_SIZE;
-    if (remaining < HEAP_MIN_BLOCK) {
+    if (block->size < size + HEAP_OVERHEAD + HEAP_MIN_BLOCK) {
         return;  /* Not enough space to split */
     }
 
+    size_t remaining = block->size - size - HEAP_OVERHEAD;
+    block_set(block, size, block->flags);
+
     /* Create new block after the current one */
-    heap_block_t* new_block = (heap_block_t*)((uint8_t*)block + HEAP_HEADER_SIZE + size);
-    new_block->magic = HEAP_BLOCK_MAGIC;
-    new_block->flags = HEAP_BLOCK_FREE;
-    new_block->size = remaining;
-    new_block->prev = block;
-    new_block->next = block->next;
+    heap_block_t* new_block = block_next(block);
+    block_set(new_block, remaining, HEAP_BLOCK_FREE);
+    bin_insert(new_block);
+}
 
-    if (block->next) {
-        block->next->prev = new_block;
+/*
+ * Merge a free block with its free physical neighbours
+ * The block must not be on a bin; the merged block is returned unbinned.
+ */
+static heap_block_t* block_coalesce(heap_block_t* block) {
+    heap_block_t* next = block_next(block);
+    if (next && block_valid(next) && next->flags == HEAP_BLOCK_FREE) {
+        bin_remove(next);
+        next->magic = 0;
+        block_set(block, block->size + HEAP_OVERHEAD + next->size,
+                  HEAP_BLOCK_FREE);
     }
 
-    block->next = new_block;
-    block->size = size;
+    heap_block_t* prev = block_prev(block);
+    if (prev && block_valid(prev) && prev->flags == HEAP_BLOCK_FREE) {
+        bin_remove(prev);
+        block->magic = 0;
+        block_set(prev, prev->size + HEAP_OVERHEAD + block->size,
+                  HEAP_BLOCK_FREE);
+        block = prev;
+    }
+
+    return block;
 }
 
-/* Merge with next block if it's free */
-static void block_merge_next(heap_block_t* block) {
-    if (!block->next) return;
-    if (block->next->flags != HEAP_BLOCK_FREE) return;
-    if (!block_valid(block->next)) return;
+/* Find and unbin a free block of at least size bytes */
+static heap_block_t* bin_find(size_t size) {
+    uint32_t bin = size_to_bin(size);
+
+    /* The request's own bin may hold smaller blocks: first fit */
+    for (heap_block_t* block = heap_bins[bin]; block; block = block->next_free) {
+        if (!block_valid(block)) {
+            kprintf("[HEAP] ERROR: Corrupted free block at 0x%p\n", block);
+            return NULL;
+        }
+        if (block->size >= size) {
+            bin_remove(block);
+            return block;
+        }
+    }
+
+    /* Any block in a larger bin fits */
+    uint32_t larger = (bin + 1 < HEAP_BIN_COUNT) ? heap_bin_map >> (bin + 1) : 0;
+    if (larger == 0) {
+        return NULL;
+    }
 
-    heap_block_t* next = block->next;
+    bin += 1 + (uint32_t)__builtin_ctz(larger);
+    heap_block_t* block = heap_bins[bin];
+    bin_remove(block);
+    return block;
+}
 
-    /* Absorb next block */
-    block->size += HEAP_HEADER_SIZE + next->size;
-    block->next = next->next;
+/* =============================================================================
+ * Page Release and Repopulation
+ * =============================================================================
+ */
 
-    if (next->next) {
-        next->next->prev = block;
+/* Unmap and free the whole pages inside [start, end) */
+static uint64_t heap_release_range(virt_addr_t start, virt_addr_t end) {
+    uint64_t released = 0;
+
+    for (virt_addr_t page = ALIGN_UP(start, PAGE_SIZE);
+         page + PAGE_SIZE <= end; page += PAGE_SIZE) {
+        phys_addr_t phys = vmm_get_physical(page);
+        if (phys == 0) continue;
+
+        vmm_unmap_page(page);
+        pmm_free_page(phys);
+        released++;
+    }
+
+    heap_released_pages += released;
+    return released;
+}
+
+/* Map back any released pages touching [start, end) */
+static bool heap_populate(virt_addr_t start, virt_addr_t end) {
+    if (heap_released_pages == 0) return true;
+
+    for (virt_addr_t page = ALIGN_DOWN(start, PAGE_SIZE);
+         page < end; page += PAGE_SIZE) {
+        if (vmm_is_mapped(page)) continue;
+
+        phys_addr_t phys = pmm_alloc_page();
+        if (phys == 0) {
+            kprintf("[HEAP] ERROR: Cannot repopulate heap page\n");
+            return false;
+        }
+
+        if (!vmm_map_page(page, phys, PTE_KERNEL_RW)) {
+            pmm_free_page(phys);
+            kprintf("[HEAP] ERROR: Cannot remap heap page\n");
+            return false;
+        }
+        heap_released_pages--;
+    }
+
+    return true;
+}
+
+/*
+ * Back [virt, virt + size) with fresh frames
+ * Frames come in the largest naturally aligned blocks that fit, so
+ * vmm_map_range() can use 2MB pages. Undone completely on failure.
+ */
+static bool heap_map_pages(virt_addr_t virt, size_t size) {
+    size_t offset = 0;
+
+    while (offset < size) {
+        uint32_t order = HEAP_MAP_MAX_ORDER;
+        while (order > 0 &&
+               (!IS_ALIGNED(virt + offset, (size_t)PAGE_SIZE << order) ||
+                size - offset < ((size_t)PAGE_SIZE << order))) {
+            order--;
+        }
+
+        /* Memory may be too fragmented for a big block - try smaller ones */
+        phys_addr_t phys;
+        while ((phys = pmm_alloc_order(order)) == 0 && order > 0) {
+            order--;
+        }
+        if (phys == 0) break;
+
+        if (!vmm_map_range(virt + offset, phys, (size_t)PAGE_SIZE << order, PTE_KERNEL_RW)) {
+            pmm_free_order(phys, order);
+            break;
+        }
+        offset += (size_t)PAGE_SIZE << order;
     }
 
-    /* Clear the merged block's magic */
-    next->magic = 0;
+    if (offset == size) return true;
+
+    /* Give back what was mapped so far */
+    for (size_t done = 0; done < offset; done += PAGE_SIZE) {
+        pmm_free_page(vmm_get_physical(virt + done));
+    }
+    vmm_unmap_range(virt, offset);
+    return false;
+}
+
+/*
+ * Lower the heap break to just past a free last block
+ * The heap never shrinks below HEAP_INITIAL_SIZE.
+ */
+static uint64_t heap_shrink_tail(heap_block_t* block) {
+    virt_addr_t new_break = ALIGN_UP((virt_addr_t)block + HEAP_OVERHEAD +
+                                     HEAP_MIN_BLOCK, PAGE_SIZE);
+    new_break = MAX(new_break, HEAP_START + HEAP_INITIAL_SIZE);
+    if (new_break >= heap_break) return 0;
+
+    /* The new footer must land on a mapped page */
+    if (!heap_populate(new_break - HEAP_FOOTER_SIZE, new_break)) return 0;
+
+    uint64_t released = 0;
+    for (virt_addr_t page = new_break; page < heap_break; page += PAGE_SIZE) {
+        phys_addr_t phys = vmm_get_physical(page);
+        if (phys == 0) {
+            heap_released_pages--;  /* Was released while inside a block */
+            continue;
+        }
+
+        vmm_unmap_page(page);
+        pmm_free_page(phys);
+        released++;
+    }
+
+    heap_size -= heap_break - new_break;
+    heap_break = new_break;
+    block_set(block, new_break - (virt_addr_t)block - HEAP_OVERHEAD,
+              HEAP_BLOCK_FREE);
+
+    return released;
+}
+
+/*
+ * Trim a free, unbinned block
+ * Only pages inside [lo, hi) are released; the rest of the block was
+ * already trimmed when it was freed.
+ */
+static uint64_t heap_trim_block(heap_block_t* block, virt_addr_t lo, virt_addr_t hi) {
+    if (heap_trim_threshold == 0 || block->size < heap_trim_threshold) {
+        return 0;
+    }
+
+    uint64_t released = 0;
+    if (!block_next(block)) {
+        released += heap_shrink_tail(block);
+    }
+
+    /* Keep the header page and the footer page mapped */
+    virt_addr_t start = MAX((virt_addr_t)block + HEAP_HEADER_SIZE, lo);
+    virt_addr_t end = MIN((virt_addr_t)block_footer(block), hi);
+    if (start < end) {
+        released += heap_release_range(start, end);
+    }
+
+    return released;
 }
 
 /* =============================================================================
@@ -105,31 +388,26 @@ void heap_init(void) {
     kprintf("[HEAP] Initial size: %d KB\n", HEAP_INITIAL_SIZE / 1024);
 
     /* Map initial heap pages */
-    for (size_t offset = 0; offset < HEAP_INITIAL_SIZE; offset += PAGE_SIZE) {
-        phys_addr_t page = pmm_alloc_page();
-        if (page == 0) {
-            PANIC("Cannot allocate heap pages");
-        }
-
-        if (!vmm_map_page(HEAP_START + offset, page, PTE_KERNEL_RW)) {
-            PANIC("Cannot map heap pages");
-        }
+    if (!heap_map_pages(HEAP_START, HEAP_INITIAL_SIZE)) {
+        PANIC("Cannot map heap pages");
     }
 
-    /* Initialize first free block */
-    heap_first = (heap_block_t*)HEAP_START;
-    heap_first->magic = HEAP_BLOCK_MAGIC;
-    heap_first->flags = HEAP_BLOCK_FREE;
-    heap_first->size = HEAP_INITIAL_SIZE - HEAP_HEADER_SIZE;
-    heap_first->next = NULL;
-    heap_first->prev = NULL;
+    for (int i = 0; i < HEAP_BIN_COUNT; i++) {
+        heap_bins[i] = NULL;
+    }
+    heap_bin_map = 0;
 
     heap_size = HEAP_INITIAL_SIZE;
     heap_break = HEAP_START + HEAP_INITIAL_SIZE;
 
+    /* Initialize first free block */
+    heap_block_t* first = (heap_block_t*)HEAP_START;
+    block_set(first, HEAP_INITIAL_SIZE - HEAP_OVERHEAD, HEAP_BLOCK_FREE);
+    bin_insert(first);
+
     kprintf("[HEAP] Initialization complete.\n");
-    kprintf("[HEAP] Usable space: %d KB\n",
-            (uint32_t)(heap_first->size / 1024));
+    kprintf("[HEAP] Usable space: %d KB, %d size classes\n",
+            (uint32_t)(first->size / 1024), HEAP_BIN_COUNT);
 }
 
 /* =============================================================================
@@ -137,43 +415,68 @@ void heap_init(void) {
  * =============================================================================
  */
 
-void* kmalloc(size_t size) {
+/* kmalloc() without the tracepoint */
+static void* heap_alloc(size_t size) {
     if (size == 0) return NULL;
 
+    /* Small sizes go to the slab size classes */
+    if (size <= KMALLOC_MAX_CACHE_SIZE && slab_is_ready()) {
+        void* ptr = kmalloc_slab(size);
+        if (ptr) return ptr;
+    }
+
+    if (size > HEAP_MAX_SIZE) {
+        kprintf("[HEAP] ERROR: Out of memory (requested %d bytes)\n", (int)size);
+        return NULL;
+    }
+
     /* Align size */
     size = ALIGN_UP(size, HEAP_ALIGNMENT);
     if (size < HEAP_MIN_BLOCK) {
         size = HEAP_MIN_BLOCK;
     }
 
-    /* First-fit search */
-    heap_block_t* block = heap_first;
-    while (block) {
-        if (!block_valid(block)) {
-            kprintf("[HEAP] ERROR: Corrupted block at 0x%p\n", block);
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+
+    heap_block_t* block = bin_find(size);
+    if (!block) {
+        /* No suitable block found - try to expand heap */
+        size_t expand_size = MAX(size + HEAP_OVERHEAD, HEAP_EXPAND_SIZE);
+        if (!heap_expand_locked(expand_size)) {
+            spin_unlock_irqrestore(&heap_lock, flags);
+            kprintf("[HEAP] ERROR: Out of memory (requested %d bytes)\n", (int)size);
             return NULL;
         }
 
-        if (block->flags == HEAP_BLOCK_FREE && block->size >= size) {
-            /* Found suitable block */
-            block_split(block, size);
-            block->flags = HEAP_BLOCK_USED;
-            heap_alloc_count++;
-            return block_to_ptr(block);
+        block = bin_find(size);
+        if (!block) {
+            spin_unlock_irqrestore(&heap_lock, flags);
+            return NULL;
         }
-
-        block = block->next;
     }
 
-    /* No suitable block found - try to expand heap */
-    size_t expand_size = MAX(size + HEAP_HEADER_SIZE, HEAP_EXPAND_SIZE);
-    if (!heap_expand(expand_size)) {
-        kprintf("[HEAP] ERROR: Out of memory (requested %d bytes)\n", (int)size);
+    /* Map back released pages under the data area and a split remainder */
+    virt_addr_t end = MIN((virt_addr_t)block + HEAP_OVERHEAD + size + HEAP_HEADER_SIZE,
+                          (virt_addr_t)block + HEAP_OVERHEAD + block->size);
+    if (!heap_populate((virt_addr_t)block, end)) {
+        bin_insert(block);
+        spin_unlock_irqrestore(&heap_lock, flags);
         return NULL;
     }
 
-    /* Retry allocation after expansion */
-    return kmalloc(size);
+    block->flags = HEAP_BLOCK_USED;
+    block_split(block, size);
+    block_set(block, block->size, HEAP_BLOCK_USED);
+    heap_alloc_count++;
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return block_to_ptr(block);
+}
+
+void* kmalloc(size_t size) {
+    void* ptr = heap_alloc(size);
+    TRACE(TRACE_MM, TRACE_EV_KMALLOC, TRACE_INSTANT, size, ptr);
+    return ptr;
 }
 
 void* kzalloc(size_t size) {
@@ -213,32 +516,47 @@ void* kmalloc_aligned(size_t size, size_t alignment) {
 void kfree(void* ptr) {
     if (!ptr) return;
 
+    /* Slab objects go back to their cache */
+    kmem_slab_t* slab = slab_find(ptr);
+    if (slab) {
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+
     /* Check if this is an aligned allocation */
     /* (This is a simplification - a real implementation would track this) */
 
     heap_block_t* block = ptr_to_block(ptr);
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
 
     /* Validate block */
-    if (!block_valid(block)) {
+    if ((virt_addr_t)block < HEAP_START || (virt_addr_t)ptr >= heap_break ||
+        !block_valid(block)) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         kprintf("[HEAP] ERROR: Invalid free at 0x%p\n", ptr);
         return;
     }
 
     if (block->flags != HEAP_BLOCK_USED) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         kprintf("[HEAP] WARNING: Double free at 0x%p\n", ptr);
         return;
     }
 
     /* Mark as free */
-    block->flags = HEAP_BLOCK_FREE;
+    block_set(block, block->size, HEAP_BLOCK_FREE);
     heap_free_count++;
 
     /* Coalesce with adjacent free blocks */
-    block_merge_next(block);
+    virt_addr_t lo = (virt_addr_t)block - PAGE_SIZE;
+    virt_addr_t hi = (virt_addr_t)block + HEAP_OVERHEAD + block->size + PAGE_SIZE;
+    block = block_coalesce(block);
 
-    if (block->prev && block->prev->flags == HEAP_BLOCK_FREE) {
-        block_merge_next(block->prev);
-    }
+    /* Give whole free pages back to the PMM */
+    heap_trim_block(block, lo, hi);
+    bin_insert(block);
+
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 void* krealloc(void* ptr, size_t new_size) {
@@ -251,32 +569,61 @@ void* krealloc(void* ptr, size_t new_size) {
         return NULL;
     }
 
+    /* Slab object: keep it if the new size still fits its class */
+    kmem_slab_t* slab = slab_find(ptr);
+    if (slab) {
+        size_t old_size = slab->cache->obj_size;
+        if (new_size <= old_size) {
+            return ptr;
+        }
+
+        void* new_ptr = kmalloc(new_size);
+        if (!new_ptr) return NULL;
+
+        memcpy(new_ptr, ptr, old_size);
+        kfree(ptr);
+        return new_ptr;
+    }
+
     heap_block_t* block = ptr_to_block(ptr);
-    if (!block_valid(block)) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+
+    if (!block_valid(block) || new_size > HEAP_MAX_SIZE) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         return NULL;
     }
 
     /* If new size fits in current block, just return */
     new_size = ALIGN_UP(new_size, HEAP_ALIGNMENT);
-    if (new_size <= block->size) {
+    size_t old_size = block->size;
+    if (new_size <= old_size) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         return ptr;
     }
 
     /* Try to expand into next free block */
-    if (block->next && block->next->flags == HEAP_BLOCK_FREE) {
-        size_t combined = block->size + HEAP_HEADER_SIZE + block->next->size;
-        if (combined >= new_size) {
-            block_merge_next(block);
+    heap_block_t* next = block_next(block);
+    if (next && block_valid(next) && next->flags == HEAP_BLOCK_FREE) {
+        size_t combined = block->size + HEAP_OVERHEAD + next->size;
+        virt_addr_t end = MIN((virt_addr_t)block + HEAP_OVERHEAD + new_size + HEAP_HEADER_SIZE,
+                              (virt_addr_t)block + HEAP_OVERHEAD + combined);
+        if (combined >= new_size && heap_populate((virt_addr_t)next, end)) {
+            bin_remove(next);
+            next->magic = 0;
+            block_set(block, combined, HEAP_BLOCK_USED);
             block_split(block, new_size);
+            spin_unlock_irqrestore(&heap_lock, flags);
             return ptr;
         }
     }
 
+    spin_unlock_irqrestore(&heap_lock, flags);
+
     /* Allocate new block and copy */
     void* new_ptr = kmalloc(new_size);
     if (!new_ptr) return NULL;
 
-    memcpy(new_ptr, ptr, block->size);
+    memcpy(new_ptr, ptr, old_size);
     kfree(ptr);
 
     return new_ptr;
@@ -288,6 +635,13 @@ void* krealloc(void* ptr, size_t new_size) {
  */
 
 bool heap_expand(size_t min_size) {
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    bool ok = heap_expand_locked(min_size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ok;
+}
+
+static bool heap_expand_locked(size_t min_size) {
     /* Align to page size */
     size_t expand_size = ALIGN_UP(min_size, PAGE_SIZE);
 
@@ -300,46 +654,59 @@ bool heap_expand(size_t min_size) {
     kprintf("[HEAP] Expanding by %d KB...\n", (int)(expand_size / 1024));
 
     /* Map new pages */
-    for (size_t offset = 0; offset < expand_size; offset += PAGE_SIZE) {
-        phys_addr_t page = pmm_alloc_page();
-        if (page == 0) {
-            kprintf("[HEAP] Expansion failed: out of physical memory\n");
-            return false;
-        }
-
-        if (!vmm_map_page(heap_break + offset, page, PTE_KERNEL_RW)) {
-            pmm_free_page(page);
-            kprintf("[HEAP] Expansion failed: cannot map page\n");
-            return false;
-        }
+    if (!heap_map_pages(heap_break, expand_size)) {
+        kprintf("[HEAP] Expansion failed: out of memory\n");
+        return false;
     }
 
     /* Create new free block at end of heap */
     heap_block_t* new_block = (heap_block_t*)heap_break;
-    new_block->magic = HEAP_BLOCK_MAGIC;
-    new_block->flags = HEAP_BLOCK_FREE;
-    new_block->size = expand_size - HEAP_HEADER_SIZE;
-    new_block->next = NULL;
-    new_block->prev = NULL;
 
-    /* Find last block and link */
-    heap_block_t* last = heap_first;
-    while (last->next) {
-        last = last->next;
-    }
+    heap_break += expand_size;
+    heap_size += expand_size;
+
+    block_set(new_block, expand_size - HEAP_OVERHEAD, HEAP_BLOCK_FREE);
+
+    /* Merge with the old last block if it's free */
+    new_block = block_coalesce(new_block);
+    bin_insert(new_block);
+
+    return true;
+}
+
+/* =============================================================================
+ * Heap Trimming
+ * =============================================================================
+ */
 
-    last->next = new_block;
-    new_block->prev = last;
+size_t heap_trim(void) {
+    if (heap_size == 0) return 0;
+
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    uint64_t released = 0;
+    heap_block_t* block = (heap_block_t*)HEAP_START;
+    while (block) {
+        if (!block_valid(block)) break;
+
+        if (block->flags == HEAP_BLOCK_FREE) {
+            bin_remove(block);
+            released += heap_trim_block(block, HEAP_START, heap_break);
+            bin_insert(block);
+        }
 
-    /* Try to merge with previous if it's free */
-    if (last->flags == HEAP_BLOCK_FREE) {
-        block_merge_next(last);
+        block = block_next(block);
     }
 
-    heap_break += expand_size;
-    heap_size += expand_size;
+    spin_unlock_irqrestore(&heap_lock, flags);
 
-    return true;
+    if (released) {
+        kprintf("[HEAP] Trimmed %d KB\n", (uint32_t)(released * PAGE_SIZE / 1024));
+    }
+    return released * PAGE_SIZE;
+}
+
+void heap_set_trim_threshold(size_t bytes) {
+    heap_trim_threshold = bytes;
 }
 
 /* =============================================================================
@@ -354,8 +721,12 @@ void heap_get_stats(heap_stats_t* stats) {
     stats->total_size = heap_size;
     stats->alloc_count = heap_alloc_count;
     stats->free_count = heap_free_count;
+    stats->released_size = heap_released_pages * PAGE_SIZE;
 
-    heap_block_t* block = heap_first;
+    if (heap_size == 0) return;
+
+    uint64_t flags = spin_lock_irqsave(&heap_lock);
+    heap_block_t* block = (heap_block_t*)HEAP_START;
     while (block) {
         if (!block_valid(block)) break;
 
@@ -371,13 +742,17 @@ void heap_get_stats(heap_stats_t* stats) {
             stats->used_size += block->size;
         }
 
-        block = block->next;
+        block = block_next(block);
     }
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 bool heap_validate(void) {
-    heap_block_t* block = heap_first;
+    if (heap_size == 0) return true;
+
+    heap_block_t* block = (heap_block_t*)HEAP_START;
     heap_block_t* prev = NULL;
+    size_t free_blocks = 0;
 
     while (block) {
         /* Check magic */
@@ -386,20 +761,70 @@ bool heap_validate(void) {
             return false;
         }
 
-        /* Check prev pointer */
-        if (block->prev != prev) {
-            kprintf("[HEAP] Validation FAILED: bad prev at 0x%p\n", block);
-            return false;
-        }
-
         /* Check flags */
         if (block->flags != HEAP_BLOCK_FREE && block->flags != HEAP_BLOCK_USED) {
             kprintf("[HEAP] Validation FAILED: bad flags at 0x%p\n", block);
             return false;
         }
 
+        /* Check the block stays inside the heap */
+        if ((virt_addr_t)block + HEAP_OVERHEAD + block->size > heap_break) {
+            kprintf("[HEAP] Validation FAILED: block overruns heap at 0x%p\n", block);
+            return false;
+        }
+
+        /* Check boundary tag */
+        heap_footer_t* footer = block_footer(block);
+        if (footer->magic != HEAP_BLOCK_MAGIC || footer->size != block->size ||
+            footer->flags != block->flags) {
+            kprintf("[HEAP] Validation FAILED: bad footer at 0x%p\n", block);
+            return false;
+        }
+
+        /* Check the footer leads back to the previous block */
+        if (block_prev(block) != prev) {
+            kprintf("[HEAP] Validation FAILED: bad prev at 0x%p\n", block);
+            return false;
+        }
+
+        if (block->flags == HEAP_BLOCK_FREE) {
+            /* Adjacent free blocks should have been coalesced */
+            if (prev && prev->flags == HEAP_BLOCK_FREE) {
+                kprintf("[HEAP] Validation FAILED: uncoalesced block at 0x%p\n", block);
+                return false;
+            }
+            free_blocks++;
+        }
+
         prev = block;
-        block = block->next;
+        block = block_next(block);
+    }
+
+    /* Check every bin holds only free blocks of its size class */
+    size_t binned = 0;
+    for (uint32_t bin = 0; bin < HEAP_BIN_COUNT; bin++) {
+        if (((heap_bin_map >> bin) & 1) != (heap_bins[bin] != NULL)) {
+            kprintf("[HEAP] Validation FAILED: bin map mismatch at bin %d\n", bin);
+            return false;
+        }
+
+        heap_block_t* prev_free = NULL;
+        for (block = heap_bins[bin]; block; block = block->next_free) {
+            if (!block_valid(block) || block->flags != HEAP_BLOCK_FREE ||
+                size_to_bin(block->size) != bin || block->prev_free != prev_free) {
+                kprintf("[HEAP] Validation FAILED: bad free block 0x%p in bin %d\n",
+                        block, bin);
+                return false;
+            }
+            prev_free = block;
+            if (++binned > free_blocks) break;
+        }
+    }
+
+    if (binned != free_blocks) {
+        kprintf("[HEAP] Validation FAILED: %d free blocks, %d on bins\n",
+                (uint32_t)free_blocks, (uint32_t)binned);
+        return false;
     }
 
     return true;
@@ -414,6 +839,7 @@ void heap_debug_print(void) {
     kprintf("  Used:            %d KB\n", (uint32_t)(stats.used_size / 1024));
     kprintf("  Free:            %d KB\n", (uint32_t)(stats.free_size / 1024));
     kprintf("  Largest free:    %d KB\n", (uint32_t)(stats.largest_free / 1024));
+    kprintf("  Released:        %d KB\n", (uint32_t)(stats.released_size / 1024));
     kprintf("  Total blocks:    %d\n", (uint32_t)stats.block_count);
     kprintf("  Free blocks:     %d\n", (uint32_t)stats.free_block_count);
     kprintf("  Allocations:     %d\n", (uint32_t)stats.alloc_count);
@@ -2,14 +2,48 @@
  * =============================================================================
  * Chanux OS - Physical Memory Manager Implementation
  * =============================================================================
- * Bitmap-based physical page frame allocator.
+ * Buddy-system physical page frame allocator.
+ *
+ * Every free page below MM_DIRECT_MAP_SIZE belongs to exactly one free
+ * block of order 0..PMM_MAX_ORDER. A block of order N starts on a 2^N page
+ * boundary, and its buddy is the block whose PFN differs only in bit N:
+ *
+ *   order 2:  [ 0  1  2  3 ][ 4  5  6  7 ]   buddy(0) = 4, buddy(4) = 0
+ *   order 3:  [ 0  1  2  3  4  5  6  7 ]
+ *
+ * Allocation takes the first block from the smallest non-empty list at or
+ * above the requested order and splits it down, returning the upper halves
+ * to their lists. Freeing merges with the buddy while the buddy is a free
+ * block of the same order.
+ *
+ * Each free block stores its list links in its first page (accessed through
+ * the direct map). The page bitmap is still maintained alongside the lists:
+ * it tells whether a buddy is free, backs pmm_is_page_free(), and is cross-
+ * checked against the free lists by pmm_check() when DEBUG_PMM is enabled.
+ *
+ * The free lists are per zone (see "Zones" below). Blocks never span two
+ * zones: buddy_build() cuts runs at zone changes and buddy_release() only
+ * merges buddies of the same zone.
+ *
+ * Single pages go through a per-CPU cache first (see "Per-CPU Page Frame
+ * Caches" below). Frames in a cache are marked used in the bitmap and are
+ * not counted in pmm_free_count, but pmm_get_stats() reports them as free.
+ *
+ * Locking: pmm_lock covers the zones, the bitmap, the counters and the
+ * reference counts. Each cache has its own lock so that another CPU can
+ * drain it; when both are needed the cache lock is taken first.
  * =============================================================================
  */
 
 #include "../include/mm/pmm.h"
 #include "../include/mm/mm.h"
 #include "../include/string.h"
+#include "../include/bitmap.h"
 #include "../drivers/vga/vga.h"
+#include "../include/debug.h"
+#include "../include/spinlock.h"
+#include "../include/trace.h"
+#include "../include/acpi.h"
 
 /* =============================================================================
  * PMM Internal State
@@ -17,29 +51,129 @@
  */
 
 /* Bitmap is stored at physical 0x200000, accessed via higher-half mapping */
-static uint8_t* pmm_bitmap = NULL;
+static uint64_t* pmm_bitmap = NULL;
 
 /* Statistics */
 static uint64_t pmm_total_pages = 0;
 static uint64_t pmm_free_count = 0;
 static uint64_t pmm_reserved_pages = 0;
 
-/* First free page hint for faster allocation */
-static uint64_t pmm_first_free_hint = 0;
-
 /* Total detected memory */
 static uint64_t pmm_total_memory = 0;
 
+/* Buddy lists, bitmap, counters and reference counts */
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
 /* =============================================================================
- * Bitmap Manipulation Macros
+ * Buddy Free Lists
  * =============================================================================
  */
 
-#define BITMAP_INDEX(page)      ((page) / 8)
-#define BITMAP_OFFSET(page)     ((page) % 8)
-#define BITMAP_SET(page)        (pmm_bitmap[BITMAP_INDEX(page)] |= (1 << BITMAP_OFFSET(page)))
-#define BITMAP_CLEAR(page)      (pmm_bitmap[BITMAP_INDEX(page)] &= ~(1 << BITMAP_OFFSET(page)))
-#define BITMAP_TEST(page)       (pmm_bitmap[BITMAP_INDEX(page)] & (1 << BITMAP_OFFSET(page)))
+#define PMM_BLOCK_MAGIC     0x42554444594652EEULL   /* "BUDDYFR" */
+
+/* Header written into the first page of every free block */
+typedef struct pmm_free_block {
+    uint64_t magic;                 /* PMM_BLOCK_MAGIC while on a free list */
+    uint32_t order;                 /* Order of this block */
+    uint32_t reserved;
+    struct pmm_free_block* next;    /* Next free block of the same order */
+    struct pmm_free_block* prev;    /* Previous free block of the same order */
+} pmm_free_block_t;
+
+/* First PFN past the memory managed by the buddy allocator */
+static uint64_t pmm_max_pfn = 0;
+
+/* Set once buddy_build() has populated the free lists */
+static bool pmm_buddy_ready = false;
+
+/* =============================================================================
+ * Zones
+ * =============================================================================
+ * Zone index = node * PMM_ZONE_TYPES + type. Which zone a frame is in is
+ * kept per frame (like the reference counts), as SRAT ranges need not be
+ * aligned or contiguous.
+ */
+
+_Static_assert(PMM_MAX_NODES >= ACPI_MAX_NODES, "PMM_MAX_NODES");
+
+typedef struct {
+    pmm_free_block_t* free_area[PMM_ORDER_COUNT];   /* Free list heads per order */
+    uint64_t free_blocks[PMM_ORDER_COUNT];          /* Block counts per order */
+    uint64_t free_pages;                            /* Pages on the lists */
+} pmm_zone_t;
+
+static pmm_zone_t pmm_zones[PMM_ZONE_COUNT];
+static uint8_t pmm_page_zone[MM_DIRECT_MAP_SIZE / PAGE_SIZE];
+
+static uint32_t pmm_nodes = 1;
+
+/* Nodes to try for an allocation preferring node n, nearest first */
+static uint8_t pmm_node_order[PMM_MAX_NODES][PMM_MAX_NODES] = { { 0 } };
+
+static inline uint32_t zone_index(uint32_t node, pmm_zone_type_t type) {
+    return node * PMM_ZONE_TYPES + type;
+}
+
+static inline pmm_zone_t* pfn_zone(uint64_t pfn) {
+    return &pmm_zones[pmm_page_zone[pfn]];
+}
+
+static inline pmm_zone_type_t pfn_zone_type(uint64_t pfn) {
+    return (pfn * PAGE_SIZE >= PMM_DMA32_LIMIT) ? PMM_ZONE_NORMAL : PMM_ZONE_DMA32;
+}
+
+/* Node of the calling CPU (a preference only, so no need to pin) */
+static inline uint32_t node_this(void) {
+    uint32_t node = cpu_this()->node;
+    return node < pmm_nodes ? node : 0;
+}
+
+/* =============================================================================
+ * Per-CPU Page Frame Caches
+ * =============================================================================
+ * Frames are kept as plain address stacks rather than intrusive lists so
+ * that pre-zeroed frames stay entirely zero.
+ */
+
+typedef struct {
+    spinlock_t  lock;
+    phys_addr_t hot[PMM_PCP_HOT_HIGH];      /* Recently freed, top is hottest */
+    uint32_t    hot_count;
+    phys_addr_t zeroed[PMM_PCP_ZERO_HIGH];  /* Known to be all zeros */
+    uint32_t    zeroed_count;
+} pmm_pcp_t;
+
+static pmm_pcp_t pmm_pcp[PMM_PCP_CPUS];
+
+/* Cache for the executing CPU (call with interrupts off) */
+static inline pmm_pcp_t* pcp_this(void) {
+    return &pmm_pcp[cpu_this()->id];
+}
+
+/* =============================================================================
+ * Page Reference Counts
+ * =============================================================================
+ * One counter per direct-mapped frame, holding the number of owners beyond
+ * the first. Kept out of the frames themselves so shared pages stay intact.
+ */
+
+#define PMM_REF_PAGES       (MM_DIRECT_MAP_SIZE / PAGE_SIZE)
+
+static uint16_t pmm_page_refs[PMM_REF_PAGES];
+
+/* =============================================================================
+ * Bitmap Access
+ * =============================================================================
+ */
+
+#define BITMAP_SET(page)        bitmap_set(pmm_bitmap, (page))
+#define BITMAP_CLEAR(page)      bitmap_clear(pmm_bitmap, (page))
+#define BITMAP_TEST(page)       bitmap_test(pmm_bitmap, (page))
+
+/* Every page of [pfn, pfn + count) used in the bitmap */
+static inline bool bitmap_all_used(uint64_t pfn, uint64_t count) {
+    return bitmap_find_zero(pmm_bitmap, pfn, pfn + count) == pfn + count;
+}
 
 /* =============================================================================
  * Helper Functions
@@ -56,6 +190,32 @@ static inline phys_addr_t pfn_to_addr(uint64_t pfn) {
     return pfn * PAGE_SIZE;
 }
 
+/* Number of pages in a block of the given order */
+static inline uint64_t order_pages(uint32_t order) {
+    return 1ULL << order;
+}
+
+/* Smallest order whose block holds at least count pages */
+static inline uint32_t pages_to_order(size_t count) {
+    uint32_t order = 0;
+    while (order_pages(order) < count) {
+        order++;
+    }
+    return order;
+}
+
+/* Free block header for a PFN (only valid below MM_DIRECT_MAP_SIZE) */
+static inline pmm_free_block_t* pfn_to_block(uint64_t pfn) {
+    return (pmm_free_block_t*)PHYS_TO_VIRT(pfn_to_addr(pfn));
+}
+
+static inline uint64_t block_to_pfn(pmm_free_block_t* block) {
+    return addr_to_pfn(VIRT_TO_PHYS(block));
+}
+
+static void buddy_build(void);
+static void zones_assign(const acpi_numa_info_t* numa);
+
 /* Memory type to string for debug output */
 static const char* memory_type_str(uint32_t type) {
     switch (type) {
@@ -77,7 +237,7 @@ void pmm_init(boot_info_t* boot_info) {
     kprintf("[PMM] Initializing Physical Memory Manager...\n");
 
     /* Set up bitmap pointer (physical 0x200000 mapped in higher-half) */
-    pmm_bitmap = (uint8_t*)PHYS_TO_VIRT(MM_PMM_BITMAP_START);
+    pmm_bitmap = (uint64_t*)PHYS_TO_VIRT(MM_PMM_BITMAP_START);
 
     /* Initially mark ALL pages as used (safe default) */
     memset(pmm_bitmap, 0xFF, MM_PMM_BITMAP_SIZE);
@@ -111,22 +271,40 @@ void pmm_init(boot_info_t* boot_info) {
             phys_addr_t end = ALIGN_DOWN(entry->base + entry->length, PAGE_SIZE);
 
             if (end > start) {
+                pmm_total_memory += (end - start);
+
+                /*
+                 * Only direct-mapped memory can hold free list links.
+                 * Anything above stays marked used in the bitmap.
+                 */
+                if (end > MM_DIRECT_MAP_SIZE) {
+                    end = MM_DIRECT_MAP_SIZE;
+                }
+
                 /* Mark pages as free */
-                for (phys_addr_t addr = start; addr < end; addr += PAGE_SIZE) {
-                    uint64_t pfn = addr_to_pfn(addr);
-                    if (pfn < MM_MAX_PAGES) {
-                        BITMAP_CLEAR(pfn);
-                        pmm_free_count++;
+                uint64_t first = addr_to_pfn(start);
+                uint64_t last = addr_to_pfn(end);
+                if (last > MM_MAX_PAGES) {
+                    last = MM_MAX_PAGES;
+                }
+                if (last > first) {
+                    bitmap_clear_range(pmm_bitmap, first, last - first);
+                    pmm_free_count += last - first;
+                    if (last > pmm_max_pfn) {
+                        pmm_max_pfn = last;
                     }
                 }
-
-                pmm_total_memory += (end - start);
             }
         }
     }
 
     pmm_total_pages = pmm_free_count;
 
+    if (pmm_total_memory > pmm_total_pages * PAGE_SIZE) {
+        kprintf("[PMM] Note: %d MB above the 64MB direct map is not managed\n",
+                (uint32_t)((pmm_total_memory - pmm_total_pages * PAGE_SIZE) / (1024 * 1024)));
+    }
+
     /* Reserve critical regions */
     kprintf("[PMM] Reserving system regions...\n");
 
@@ -146,15 +324,20 @@ void pmm_init(boot_info_t* boot_info) {
     kprintf("  - Page tables (1MB at 0x300000)\n");
     pmm_reserve_pages(MM_PAGE_TABLES_START, MM_PAGE_TABLES_SIZE / PAGE_SIZE);
 
-    /* Find first free page */
-    pmm_first_free_hint = 0;
-    for (uint64_t pfn = 0; pfn < MM_MAX_PAGES; pfn++) {
-        if (!BITMAP_TEST(pfn)) {
-            pmm_first_free_hint = pfn;
-            break;
-        }
+    /* Reserve the initramfs archive until fs/initramfs.c has unpacked it */
+    if (boot_info->initrd_size > 0) {
+        kprintf("  - Initramfs (%d KB at 0x%x)\n",
+                (uint32_t)(boot_info->initrd_size / 1024), (uint32_t)boot_info->initrd_start);
+        pmm_reserve_pages(boot_info->initrd_start,
+                          ALIGN_UP(boot_info->initrd_size, PAGE_SIZE) / PAGE_SIZE);
     }
 
+    /* Everything is node 0 until pmm_numa_init(); then build the free lists */
+    zones_assign(NULL);
+    buddy_build();
+
+    DBG_PMM("[PMM] Buddy consistency check: %s\n", pmm_check() ? "ok" : "FAILED");
+
     kprintf("[PMM] Initialization complete!\n");
     kprintf("  Total memory:    %d MB\n", (uint32_t)(pmm_total_memory / (1024 * 1024)));
     kprintf("  Free pages:      %d (%d MB)\n",
@@ -163,89 +346,497 @@ void pmm_init(boot_info_t* boot_info) {
     kprintf("  Reserved pages:  %d (%d MB)\n",
             (uint32_t)pmm_reserved_pages,
             (uint32_t)(pmm_reserved_pages * PAGE_SIZE / (1024 * 1024)));
-    kprintf("  First free page: 0x%x\n", (uint32_t)pfn_to_addr(pmm_first_free_hint));
+    kprintf("  Buddy range:     0x0 - 0x%x (max order %d = %d KB blocks)\n",
+            (uint32_t)pfn_to_addr(pmm_max_pfn), PMM_MAX_ORDER,
+            (uint32_t)(order_pages(PMM_MAX_ORDER) * PAGE_SIZE / 1024));
 }
 
 /* =============================================================================
- * Page Allocation
+ * NUMA Zones
  * =============================================================================
  */
 
-phys_addr_t pmm_alloc_page(void) {
-    /* Search from hint position */
-    for (uint64_t pfn = pmm_first_free_hint; pfn < MM_MAX_PAGES; pfn++) {
-        if (!BITMAP_TEST(pfn)) {
-            BITMAP_SET(pfn);
-            pmm_free_count--;
-            pmm_first_free_hint = pfn + 1;
-            return pfn_to_addr(pfn);
+/* Put every managed frame in the zone of its SRAT node (node 0 if none) */
+static void zones_assign(const acpi_numa_info_t* numa) {
+    for (uint64_t pfn = 0; pfn < pmm_max_pfn; pfn++) {
+        phys_addr_t addr = pfn_to_addr(pfn);
+        uint32_t node = 0;
+        for (uint32_t i = 0; numa && i < numa->mem_count; i++) {
+            const acpi_mem_range_t* range = &numa->mem[i];
+            if (addr >= range->base && addr - range->base < range->length) {
+                node = range->node;
+                break;
+            }
         }
+        pmm_page_zone[pfn] = (uint8_t)zone_index(node, pfn_zone_type(pfn));
     }
+}
 
-    /* Wrap around and search from beginning */
-    for (uint64_t pfn = 0; pfn < pmm_first_free_hint; pfn++) {
-        if (!BITMAP_TEST(pfn)) {
-            BITMAP_SET(pfn);
-            pmm_free_count--;
-            pmm_first_free_hint = pfn + 1;
-            return pfn_to_addr(pfn);
+/* Fallback order for each node: itself, then the others by SLIT distance */
+static void zones_order(const acpi_numa_info_t* numa) {
+    for (uint32_t node = 0; node < pmm_nodes; node++) {
+        uint8_t* order = pmm_node_order[node];
+        for (uint32_t i = 0; i < pmm_nodes; i++) {
+            order[i] = (uint8_t)i;
+        }
+
+        /* Insertion sort; ties keep node order */
+        for (uint32_t i = 1; i < pmm_nodes; i++) {
+            uint8_t n = order[i];
+            uint32_t d = (n == node) ? 0 : numa->distance[node][n];
+            uint32_t j = i;
+            while (j > 0) {
+                uint8_t prev = order[j - 1];
+                uint32_t prev_d = (prev == node) ? 0 : numa->distance[node][prev];
+                if (prev_d <= d) {
+                    break;
+                }
+                order[j] = prev;
+                j--;
+            }
+            order[j] = n;
         }
     }
+}
 
-    /* Out of memory */
-    kprintf("[PMM] ERROR: Out of physical memory!\n");
-    return 0;
+void pmm_numa_init(void) {
+    const acpi_numa_info_t* numa = acpi_numa();
+
+    if (numa->found && numa->node_count > 1) {
+        /* Cached frames go back first so that they land in their new zones */
+        pmm_pcp_drain();
+
+        uint64_t flags = spin_lock_irqsave(&pmm_lock);
+        pmm_nodes = numa->node_count;
+        zones_order(numa);
+        zones_assign(numa);
+        buddy_build();
+        spin_unlock_irqrestore(&pmm_lock, flags);
+
+        DBG_PMM("[PMM] Zone consistency check: %s\n", pmm_check() ? "ok" : "FAILED");
+    }
+
+    pmm_stats_t stats;
+    pmm_get_stats(&stats);
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[PMM] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("%d NUMA node%s, %d MB free in DMA32\n", pmm_nodes, pmm_nodes == 1 ? "" : "s",
+            (uint32_t)(stats.dma32_free_pages * PAGE_SIZE / (1024 * 1024)));
+    for (uint32_t node = 0; pmm_nodes > 1 && node < pmm_nodes; node++) {
+        kprintf("  Node %d: %d MB free\n", node,
+                (uint32_t)(stats.node_free_pages[node] * PAGE_SIZE / (1024 * 1024)));
+    }
 }
 
-phys_addr_t pmm_alloc_pages(size_t count) {
-    if (count == 0) return 0;
-    if (count == 1) return pmm_alloc_page();
+uint32_t pmm_addr_node(phys_addr_t addr) {
+    uint64_t pfn = addr_to_pfn(addr);
+    if (pfn >= pmm_max_pfn) return 0;
+    return pmm_page_zone[pfn] / PMM_ZONE_TYPES;
+}
+
+uint32_t pmm_node_count(void) {
+    return pmm_nodes;
+}
+
+/* =============================================================================
+ * Buddy Free List Management
+ * =============================================================================
+ */
+
+/* Push a block onto the free list for its order */
+static void free_list_add(uint64_t pfn, uint32_t order) {
+    pmm_free_block_t* block = pfn_to_block(pfn);
+    pmm_zone_t* zone = pfn_zone(pfn);
+
+    block->magic = PMM_BLOCK_MAGIC;
+    block->order = order;
+    block->reserved = 0;
+    block->prev = NULL;
+    block->next = zone->free_area[order];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    zone->free_area[order] = block;
+    zone->free_blocks[order]++;
+    zone->free_pages += order_pages(order);
+}
 
-    /* Find contiguous free pages */
-    uint64_t start_pfn = 0;
-    size_t found = 0;
+/* Unlink a block from the free list for its order */
+static void free_list_remove(pmm_free_block_t* block) {
+    uint32_t order = block->order;
+    pmm_zone_t* zone = pfn_zone(block_to_pfn(block));
 
-    for (uint64_t pfn = pmm_first_free_hint; pfn < MM_MAX_PAGES && found < count; pfn++) {
-        if (!BITMAP_TEST(pfn)) {
-            if (found == 0) {
-                start_pfn = pfn;
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        zone->free_area[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+
+    /* Clear the header so stale data is never mistaken for a free block */
+    block->magic = 0;
+    block->next = NULL;
+    block->prev = NULL;
+    zone->free_blocks[order]--;
+    zone->free_pages -= order_pages(order);
+}
+
+/*
+ * Check whether pfn is the head of a free block of exactly this order.
+ * A free buddy is always a block head: any free block covering the buddy's
+ * first page but starting earlier would also cover the block being freed.
+ */
+static bool buddy_is_free_block(uint64_t pfn, uint32_t order) {
+    if (pfn >= pmm_max_pfn || BITMAP_TEST(pfn)) {
+        return false;
+    }
+    pmm_free_block_t* block = pfn_to_block(pfn);
+    return block->magic == PMM_BLOCK_MAGIC && block->order == order;
+}
+
+/* Mark every page of a block used (true) or free (false) in the bitmap */
+static void bitmap_mark_block(uint64_t pfn, uint32_t order, bool used) {
+    uint64_t count = order_pages(order);
+#if DEBUG_PMM
+    uint64_t end = pfn + count;
+    uint64_t bad = used ? bitmap_find_one(pmm_bitmap, pfn, end)
+                        : bitmap_find_zero(pmm_bitmap, pfn, end);
+    if (bad != end) {
+        kprintf("[PMM] CHECK: page 0x%x already %s\n",
+                (uint32_t)pfn_to_addr(bad), used ? "used" : "free");
+    }
+#endif
+    if (used) {
+        bitmap_set_range(pmm_bitmap, pfn, count);
+    } else {
+        bitmap_clear_range(pmm_bitmap, pfn, count);
+    }
+}
+
+/*
+ * Return a block to the free lists, merging with free buddies of the
+ * same zone. All pages of the block must already be clear in the bitmap.
+ */
+static void buddy_release(uint64_t pfn, uint32_t order) {
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ order_pages(order);
+        if (!buddy_is_free_block(buddy, order) || pmm_page_zone[buddy] != pmm_page_zone[pfn]) {
+            break;
+        }
+        free_list_remove(pfn_to_block(buddy));
+        pfn &= ~order_pages(order);     /* Merged block starts at the lower half */
+        order++;
+    }
+    free_list_add(pfn, order);
+}
+
+/*
+ * Take a block of the requested order off one zone's free lists, splitting
+ * a larger block if needed. Returns the PFN, or 0 if nothing is available.
+ */
+static uint64_t zone_take(pmm_zone_t* zone, uint32_t order) {
+    uint32_t found = order;
+    while (found <= PMM_MAX_ORDER && zone->free_area[found] == NULL) {
+        found++;
+    }
+    if (found > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    pmm_free_block_t* block = zone->free_area[found];
+    uint64_t pfn = block_to_pfn(block);
+    free_list_remove(block);
+
+    /* Split down, handing each upper half back to its free list */
+    while (found > order) {
+        found--;
+        free_list_add(pfn + order_pages(found), found);
+    }
+
+    bitmap_mark_block(pfn, order, true);
+    return pfn;
+}
+
+/*
+ * Take a block from the zones in fallback order: the nodes nearest 'node'
+ * first, and within a node NORMAL before DMA32 (DMA32 only if 'dma32').
+ */
+static uint64_t buddy_take_node(uint32_t order, uint32_t node, bool dma32) {
+    for (uint32_t i = 0; i < pmm_nodes; i++) {
+        uint32_t n = pmm_node_order[node][i];
+        for (int type = dma32 ? PMM_ZONE_DMA32 : PMM_ZONE_NORMAL; type >= PMM_ZONE_DMA32; type--) {
+            uint64_t pfn = zone_take(&pmm_zones[zone_index(n, (pmm_zone_type_t)type)], order);
+            if (pfn != 0) {
+                return pfn;
             }
-            found++;
-        } else {
-            found = 0;
         }
     }
+    return 0;
+}
 
-    /* If not found from hint, search from beginning */
-    if (found < count) {
-        found = 0;
-        for (uint64_t pfn = 0; pfn < pmm_first_free_hint && found < count; pfn++) {
-            if (!BITMAP_TEST(pfn)) {
-                if (found == 0) {
-                    start_pfn = pfn;
-                }
-                found++;
+/* Take a block, preferring the calling CPU's node */
+static uint64_t buddy_take(uint32_t order) {
+    return buddy_take_node(order, node_this(), false);
+}
+
+/*
+ * Remove a single free page from whichever free block contains it.
+ * Used when a page is reserved after the lists have been built.
+ */
+static void buddy_carve(uint64_t pfn) {
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        uint64_t head = pfn & ~(order_pages(order) - 1);
+        if (!buddy_is_free_block(head, order)) {
+            continue;
+        }
+
+        free_list_remove(pfn_to_block(head));
+
+        /* Split around pfn, keeping the halves that don't contain it */
+        while (order > 0) {
+            order--;
+            uint64_t upper = head + order_pages(order);
+            if (pfn >= upper) {
+                free_list_add(head, order);
+                head = upper;
             } else {
-                found = 0;
+                free_list_add(upper, order);
+            }
+        }
+        return;
+    }
+}
+
+/*
+ * Populate the free lists from the bitmap after reservations are applied.
+ * Each run of free pages in one zone is cut into the largest aligned
+ * blocks that fit.
+ */
+static void buddy_build(void) {
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        pmm_zone_t* zone = &pmm_zones[z];
+        for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+            zone->free_area[order] = NULL;
+            zone->free_blocks[order] = 0;
+        }
+        zone->free_pages = 0;
+    }
+
+    uint64_t pfn = bitmap_find_zero(pmm_bitmap, 0, pmm_max_pfn);
+    while (pfn < pmm_max_pfn) {
+        /* Length of the free run starting here, capped at one max block */
+        uint64_t limit = pfn + order_pages(PMM_MAX_ORDER);
+        if (limit > pmm_max_pfn) {
+            limit = pmm_max_pfn;
+        }
+        uint64_t run = bitmap_find_one(pmm_bitmap, pfn, limit) - pfn;
+        for (uint64_t i = 1; i < run; i++) {
+            if (pmm_page_zone[pfn + i] != pmm_page_zone[pfn]) {
+                run = i;
+                break;
             }
         }
+
+        /* Largest order that is aligned at pfn and fits in the run */
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               ((pfn & (order_pages(order) - 1)) != 0 || order_pages(order) > run)) {
+            order--;
+        }
+
+        free_list_add(pfn, order);
+        pfn = bitmap_find_zero(pmm_bitmap, pfn + order_pages(order), pmm_max_pfn);
     }
 
-    if (found < count) {
+    pmm_buddy_ready = true;
+}
+
+/* =============================================================================
+ * Page Allocation
+ * =============================================================================
+ */
+
+phys_addr_t pmm_alloc_order(uint32_t order) {
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    uint64_t pfn = buddy_take(order);
+    if (pfn != 0) {
+        pmm_free_count -= order_pages(order);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    if (pfn == 0) {
+        kprintf("[PMM] ERROR: Out of physical memory (order %d)!\n", order);
+        return 0;
+    }
+    return pfn_to_addr(pfn);
+}
+
+/*
+ * Refill the hot list with one batch from the buddy allocator.
+ * Falls back to single pages when no batch-sized block is left.
+ * Called with the cache locked.
+ */
+static void pcp_refill(pmm_pcp_t* pcp) {
+    spin_lock(&pmm_lock);
+
+    uint64_t pfn = buddy_take(PMM_PCP_BATCH_ORDER);
+    if (pfn != 0) {
+        pmm_free_count -= PMM_PCP_BATCH;
+        for (uint32_t i = PMM_PCP_BATCH; i > 0; i--) {
+            pcp->hot[pcp->hot_count++] = pfn_to_addr(pfn + i - 1);
+        }
+    } else {
+        for (uint32_t i = 0; i < PMM_PCP_BATCH; i++) {
+            pfn = buddy_take(0);
+            if (pfn == 0) {
+                break;
+            }
+            pmm_free_count--;
+            pcp->hot[pcp->hot_count++] = pfn_to_addr(pfn);
+        }
+    }
+
+    spin_unlock(&pmm_lock);
+}
+
+/* Hand one cached frame back to the buddy lists (pmm_lock held) */
+static void pcp_release(phys_addr_t addr) {
+    uint64_t pfn = addr_to_pfn(addr);
+    BITMAP_CLEAR(pfn);
+    pmm_free_count++;
+    buddy_release(pfn, 0);
+}
+
+/* Drain the coldest batch (bottom of the stack) of the hot list (cache locked) */
+static void pcp_drain_batch(pmm_pcp_t* pcp) {
+    uint32_t count = MIN(pcp->hot_count, (uint32_t)PMM_PCP_BATCH);
+
+    spin_lock(&pmm_lock);
+    for (uint32_t i = 0; i < count; i++) {
+        pcp_release(pcp->hot[i]);
+    }
+    spin_unlock(&pmm_lock);
+    for (uint32_t i = count; i < pcp->hot_count; i++) {
+        pcp->hot[i - count] = pcp->hot[i];
+    }
+    pcp->hot_count -= count;
+}
+
+phys_addr_t pmm_alloc_page(void) {
+    uint64_t flags = irq_save();
+    pmm_pcp_t* pcp = pcp_this();
+    phys_addr_t addr = 0;
+    spin_lock(&pcp->lock);
+
+    if (pcp->hot_count == 0 && pcp->zeroed_count == 0) {
+        pcp_refill(pcp);
+    }
+
+    if (pcp->hot_count > 0) {
+        addr = pcp->hot[--pcp->hot_count];
+    } else if (pcp->zeroed_count > 0) {
+        addr = pcp->zeroed[--pcp->zeroed_count];
+    }
+
+    spin_unlock(&pcp->lock);
+    irq_restore(flags);
+
+    if (addr == 0) {
+        kprintf("[PMM] ERROR: Out of physical memory!\n");
+    }
+    TRACE(TRACE_MM, TRACE_EV_PMM_ALLOC, TRACE_INSTANT, addr, 1);
+    return addr;
+}
+
+phys_addr_t pmm_alloc_page_zeroed(void) {
+    uint64_t flags = irq_save();
+    pmm_pcp_t* pcp = pcp_this();
+    phys_addr_t addr = 0;
+    spin_lock(&pcp->lock);
+
+    if (pcp->zeroed_count > 0) {
+        addr = pcp->zeroed[--pcp->zeroed_count];
+    }
+
+    spin_unlock(&pcp->lock);
+    irq_restore(flags);
+
+    if (addr != 0) {
+        return addr;
+    }
+
+    /* Nothing pre-zeroed: take any frame and clear it now */
+    addr = pmm_alloc_page();
+    if (addr != 0) {
+        memset(PHYS_TO_VIRT(addr), 0, PAGE_SIZE);
+    }
+    return addr;
+}
+
+/* Contiguous frames from the buddy lists, bypassing the per-CPU caches */
+static phys_addr_t pmm_alloc_block(size_t count, uint32_t node, bool dma32) {
+    if (count == 0) return 0;
+
+    if (count > order_pages(PMM_MAX_ORDER)) {
         kprintf("[PMM] ERROR: Cannot allocate %d contiguous pages!\n", (int)count);
         return 0;
     }
 
-    /* Mark pages as used */
-    for (size_t i = 0; i < count; i++) {
-        BITMAP_SET(start_pfn + i);
+    uint32_t order = pages_to_order(count);
+    if (node >= pmm_nodes) {
+        node = 0;
+    }
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    uint64_t pfn = buddy_take_node(order, node, dma32);
+    if (pfn == 0) {
+        /* Frames parked in the caches may be what's blocking a merge */
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        pmm_pcp_drain();
+        flags = spin_lock_irqsave(&pmm_lock);
+        pfn = buddy_take_node(order, node, dma32);
+    }
+    if (pfn != 0) {
+        pmm_free_count -= order_pages(order);
     }
-    pmm_free_count -= count;
+    spin_unlock_irqrestore(&pmm_lock, flags);
 
-    /* Update hint */
-    pmm_first_free_hint = start_pfn + count;
+    if (pfn == 0) {
+        kprintf("[PMM] ERROR: Cannot allocate %d contiguous pages!\n", (int)count);
+        return 0;
+    }
+    phys_addr_t addr = pfn_to_addr(pfn);
+
+    /*
+     * Give back the unused tail so callers can free exactly the pages
+     * they asked for with pmm_free_pages(addr, count).
+     */
+    if (order_pages(order) > count) {
+        pmm_free_pages(addr + count * PAGE_SIZE, order_pages(order) - count);
+    }
 
-    return pfn_to_addr(start_pfn);
+    TRACE(TRACE_MM, TRACE_EV_PMM_ALLOC, TRACE_INSTANT, addr, count);
+    return addr;
+}
+
+phys_addr_t pmm_alloc_pages(size_t count) {
+    if (count == 1) return pmm_alloc_page();
+    return pmm_alloc_block(count, node_this(), false);
+}
+
+phys_addr_t pmm_alloc_pages_node(size_t count, uint32_t node) {
+    return pmm_alloc_block(count, node, false);
+}
+
+phys_addr_t pmm_alloc_pages_dma32(size_t count) {
+    return pmm_alloc_block(count, node_this(), true);
 }
 
 /* =============================================================================
@@ -253,6 +844,29 @@ phys_addr_t pmm_alloc_pages(size_t count) {
  * =============================================================================
  */
 
+void pmm_free_order(phys_addr_t addr, uint32_t order) {
+    if (addr == 0 || order > PMM_MAX_ORDER) return;
+
+    uint64_t pfn = addr_to_pfn(addr);
+    if ((pfn & (order_pages(order) - 1)) != 0 || pfn + order_pages(order) > pmm_max_pfn) {
+        kprintf("[PMM] WARNING: Bad order-%d free at 0x%x\n", order, (uint32_t)addr);
+        return;
+    }
+
+    /* Any page already free means a double free; fall back to per-page frees */
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (!bitmap_all_used(pfn, order_pages(order))) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        pmm_free_pages(addr, order_pages(order));
+        return;
+    }
+
+    bitmap_mark_block(pfn, order, false);
+    pmm_free_count += order_pages(order);
+    buddy_release(pfn, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
 void pmm_free_page(phys_addr_t addr) {
     if (addr == 0) return;
 
@@ -262,7 +876,7 @@ void pmm_free_page(phys_addr_t addr) {
     }
 
     uint64_t pfn = addr_to_pfn(addr);
-    if (pfn >= MM_MAX_PAGES) {
+    if (pfn >= pmm_max_pfn) {
         kprintf("[PMM] WARNING: Address 0x%x out of range\n", (uint32_t)addr);
         return;
     }
@@ -272,18 +886,184 @@ void pmm_free_page(phys_addr_t addr) {
         return;
     }
 
-    BITMAP_CLEAR(pfn);
-    pmm_free_count++;
+#if DEBUG_PMM
+    if (pfn < PMM_REF_PAGES && pmm_page_refs[pfn] != 0) {
+        kprintf("[PMM] WARNING: Freeing shared page 0x%x (%d refs)\n",
+                (uint32_t)addr, pmm_page_refs[pfn]);
+    }
+#endif
+
+    uint64_t flags = irq_save();
 
-    /* Update hint if this page is before current hint */
-    if (pfn < pmm_first_free_hint) {
-        pmm_first_free_hint = pfn;
+    /* Another node's frame would only be handed out here again: return it */
+    if (pmm_addr_node(addr) != node_this()) {
+        spin_lock(&pmm_lock);
+        pcp_release(addr);
+        spin_unlock(&pmm_lock);
+        irq_restore(flags);
+        return;
     }
+
+    pmm_pcp_t* pcp = pcp_this();
+    spin_lock(&pcp->lock);
+
+#if DEBUG_PMM
+    for (uint32_t i = 0; i < pcp->hot_count; i++) {
+        if (pcp->hot[i] == addr) {
+            spin_unlock(&pcp->lock);
+            irq_restore(flags);
+            kprintf("[PMM] WARNING: Double free at 0x%x (cached)\n", (uint32_t)addr);
+            return;
+        }
+    }
+#endif
+
+    if (pcp->hot_count == PMM_PCP_HOT_HIGH) {
+        pcp_drain_batch(pcp);
+    }
+    pcp->hot[pcp->hot_count++] = addr;
+
+    spin_unlock(&pcp->lock);
+    irq_restore(flags);
 }
 
 void pmm_free_pages(phys_addr_t addr, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        pmm_free_page(addr + i * PAGE_SIZE);
+    uint64_t pfn = addr_to_pfn(addr);
+    uint64_t end = pfn + count;
+
+    /* Free in the largest aligned blocks that fit in the range */
+    while (pfn < end) {
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               ((pfn & (order_pages(order) - 1)) != 0 || pfn + order_pages(order) > end)) {
+            order--;
+        }
+
+        uint64_t flags = spin_lock_irqsave(&pmm_lock);
+        bool all_used = (pfn + order_pages(order) <= pmm_max_pfn) &&
+                        bitmap_all_used(pfn, order_pages(order));
+
+        if (all_used) {
+            bitmap_mark_block(pfn, order, false);
+            pmm_free_count += order_pages(order);
+            buddy_release(pfn, order);
+        }
+        spin_unlock_irqrestore(&pmm_lock, flags);
+
+        if (!all_used) {
+            /* Let pmm_free_page() report the bad pages individually */
+            for (uint64_t i = 0; i < order_pages(order); i++) {
+                pmm_free_page(pfn_to_addr(pfn + i));
+            }
+        }
+        pfn += order_pages(order);
+    }
+}
+
+/* =============================================================================
+ * Page Reference Counting
+ * =============================================================================
+ */
+
+void pmm_page_ref(phys_addr_t addr) {
+    uint64_t pfn = addr_to_pfn(addr);
+    if (pfn >= PMM_REF_PAGES) {
+        kprintf("[PMM] WARNING: Cannot share page 0x%x\n", (uint32_t)addr);
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (pmm_page_refs[pfn] == 0xFFFF) {
+        PANIC("Page reference count overflow");
+    }
+    pmm_page_refs[pfn]++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+bool pmm_page_unref(phys_addr_t addr) {
+    uint64_t pfn = addr_to_pfn(addr);
+    bool last = true;
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (pfn < PMM_REF_PAGES && pmm_page_refs[pfn] > 0) {
+        pmm_page_refs[pfn]--;
+        last = false;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    if (last) {
+        pmm_free_page(ALIGN_DOWN(addr, PAGE_SIZE));
+    }
+    return last;
+}
+
+uint32_t pmm_page_refcount(phys_addr_t addr) {
+    uint64_t pfn = addr_to_pfn(addr);
+    if (pfn >= PMM_REF_PAGES) return 0;
+    return pmm_page_refs[pfn];
+}
+
+/* =============================================================================
+ * Per-CPU Cache Maintenance
+ * =============================================================================
+ */
+
+void pmm_pcp_drain(void) {
+    uint64_t flags = irq_save();
+
+    for (uint32_t cpu = 0; cpu < PMM_PCP_CPUS; cpu++) {
+        pmm_pcp_t* pcp = &pmm_pcp[cpu];
+        spin_lock(&pcp->lock);
+        spin_lock(&pmm_lock);
+
+        while (pcp->hot_count > 0) {
+            pcp_release(pcp->hot[--pcp->hot_count]);
+        }
+        while (pcp->zeroed_count > 0) {
+            pcp_release(pcp->zeroed[--pcp->zeroed_count]);
+        }
+
+        spin_unlock(&pmm_lock);
+        spin_unlock(&pcp->lock);
+    }
+
+    irq_restore(flags);
+}
+
+void pmm_pcp_zero_idle(void) {
+    /* The idle process never leaves its CPU */
+    pmm_pcp_t* pcp = pcp_this();
+
+    for (uint32_t i = 0; i < PMM_PCP_BATCH; i++) {
+        /* Claim a frame with the cache locked, clear it unlocked */
+        uint64_t flags = spin_lock_irqsave(&pcp->lock);
+        if (pcp->zeroed_count >= PMM_PCP_ZERO_HIGH) {
+            spin_unlock_irqrestore(&pcp->lock, flags);
+            return;
+        }
+        if (pcp->hot_count == 0) {
+            pcp_refill(pcp);
+        }
+        if (pcp->hot_count == 0) {
+            spin_unlock_irqrestore(&pcp->lock, flags);
+            return;
+        }
+        phys_addr_t addr = pcp->hot[--pcp->hot_count];
+        spin_unlock_irqrestore(&pcp->lock, flags);
+
+        memset(PHYS_TO_VIRT(addr), 0, PAGE_SIZE);
+
+        flags = spin_lock_irqsave(&pcp->lock);
+        if (pcp->zeroed_count < PMM_PCP_ZERO_HIGH) {
+            pcp->zeroed[pcp->zeroed_count++] = addr;
+        } else if (pcp->hot_count < PMM_PCP_HOT_HIGH) {
+            pcp->hot[pcp->hot_count++] = addr;
+        } else {
+            spin_lock(&pmm_lock);
+            pcp_release(addr);
+            spin_unlock(&pmm_lock);
+        }
+        spin_unlock_irqrestore(&pcp->lock, flags);
     }
 }
 
@@ -296,11 +1076,16 @@ void pmm_reserve_page(phys_addr_t addr) {
     uint64_t pfn = addr_to_pfn(addr);
     if (pfn >= MM_MAX_PAGES) return;
 
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
     if (!BITMAP_TEST(pfn)) {
+        if (pmm_buddy_ready) {
+            buddy_carve(pfn);
+        }
         BITMAP_SET(pfn);
         pmm_free_count--;
         pmm_reserved_pages++;
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 void pmm_reserve_pages(phys_addr_t addr, size_t count) {
@@ -311,15 +1096,31 @@ void pmm_reserve_pages(phys_addr_t addr, size_t count) {
 
 void pmm_unreserve_page(phys_addr_t addr) {
     uint64_t pfn = addr_to_pfn(addr);
-    if (pfn >= MM_MAX_PAGES) return;
+    if (pfn >= pmm_max_pfn) return;
 
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
     if (BITMAP_TEST(pfn)) {
         BITMAP_CLEAR(pfn);
         pmm_free_count++;
         if (pmm_reserved_pages > 0) {
             pmm_reserved_pages--;
         }
+        if (pmm_buddy_ready) {
+            buddy_release(pfn, 0);
+        }
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_claim_reserved_page(phys_addr_t addr) {
+    uint64_t pfn = addr_to_pfn(addr);
+    if (pfn >= pmm_max_pfn) return;
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    if (BITMAP_TEST(pfn) && pmm_reserved_pages > 0) {
+        pmm_reserved_pages--;   /* Still in use, now by its new owner */
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 /* =============================================================================
@@ -342,6 +1143,102 @@ void pmm_get_stats(pmm_stats_t* stats) {
     stats->reserved_pages = pmm_reserved_pages;
     stats->total_memory = pmm_total_memory;
     stats->free_memory = pmm_free_count * PAGE_SIZE;
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        stats->free_blocks[order] = 0;
+    }
+    stats->node_count = pmm_nodes;
+    stats->dma32_free_pages = 0;
+    for (uint32_t node = 0; node < PMM_MAX_NODES; node++) {
+        stats->node_free_pages[node] = 0;
+    }
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+            stats->free_blocks[order] += pmm_zones[z].free_blocks[order];
+        }
+        stats->node_free_pages[z / PMM_ZONE_TYPES] += pmm_zones[z].free_pages;
+        if (z % PMM_ZONE_TYPES == PMM_ZONE_DMA32) {
+            stats->dma32_free_pages += pmm_zones[z].free_pages;
+        }
+    }
+
+    stats->cached_pages = 0;
+    stats->zeroed_pages = 0;
+    for (uint32_t cpu = 0; cpu < PMM_PCP_CPUS; cpu++) {
+        stats->cached_pages += pmm_pcp[cpu].hot_count;
+        stats->zeroed_pages += pmm_pcp[cpu].zeroed_count;
+    }
+
+    /* Cached frames are free as far as callers are concerned */
+    stats->free_pages += stats->cached_pages + stats->zeroed_pages;
+    stats->used_pages = pmm_total_pages - stats->free_pages;
+    stats->free_memory = stats->free_pages * PAGE_SIZE;
+}
+
+/* Check one zone's free lists, adding the pages on them to *free_pages */
+static bool zone_check(uint32_t z, uint64_t* free_pages) {
+    pmm_zone_t* zone = &pmm_zones[z];
+    bool ok = true;
+
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        uint64_t blocks = 0;
+        for (pmm_free_block_t* block = zone->free_area[order]; block; block = block->next) {
+            uint64_t pfn = block_to_pfn(block);
+
+            if (block->magic != PMM_BLOCK_MAGIC || block->order != order ||
+                (pfn & (order_pages(order) - 1)) != 0) {
+                kprintf("[PMM] CHECK: bad block header at 0x%x (order %d)\n",
+                        (uint32_t)pfn_to_addr(pfn), order);
+                ok = false;
+                break;
+            }
+
+            uint64_t end = pfn + order_pages(order);
+            for (uint64_t used = bitmap_find_one(pmm_bitmap, pfn, end); used < end;
+                 used = bitmap_find_one(pmm_bitmap, used + 1, end)) {
+                kprintf("[PMM] CHECK: page 0x%x on free list but used in bitmap\n",
+                        (uint32_t)pfn_to_addr(used));
+                ok = false;
+            }
+            for (uint64_t page = pfn; page < end; page++) {
+                if (pmm_page_zone[page] != z) {
+                    kprintf("[PMM] CHECK: page 0x%x on zone %d's list but in zone %d\n",
+                            (uint32_t)pfn_to_addr(page), z, pmm_page_zone[page]);
+                    ok = false;
+                    break;
+                }
+            }
+
+            *free_pages += order_pages(order);
+            blocks++;
+        }
+
+        if (blocks != zone->free_blocks[order]) {
+            kprintf("[PMM] CHECK: zone %d order %d has %d blocks, expected %d\n",
+                    z, order, (uint32_t)blocks, (uint32_t)zone->free_blocks[order]);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+bool pmm_check(void) {
+    bool ok = true;
+    uint64_t free_pages = 0;
+
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        if (!zone_check(z, &free_pages)) {
+            ok = false;
+        }
+    }
+
+    if (free_pages != pmm_free_count) {
+        kprintf("[PMM] CHECK: free lists hold %d pages, counter says %d\n",
+                (uint32_t)free_pages, (uint32_t)pmm_free_count);
+        ok = false;
+    }
+
+    return ok;
 }
 
 void pmm_debug_print(void) {
@@ -355,4 +1252,20 @@ void pmm_debug_print(void) {
     kprintf("  Reserved pages:  %d\n", (uint32_t)stats.reserved_pages);
     kprintf("  Total memory:    %d MB\n", (uint32_t)(stats.total_memory / (1024 * 1024)));
     kprintf("  Free memory:     %d MB\n", (uint32_t)(stats.free_memory / (1024 * 1024)));
+    kprintf("  Cached pages:    %d hot, %d zeroed\n",
+            (uint32_t)stats.cached_pages, (uint32_t)stats.zeroed_pages);
+    kprintf("  Free blocks by order:");
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        kprintf(" %d", (uint32_t)stats.free_blocks[order]);
+    }
+    kprintf("\n");
+    kprintf("  Free by node:   ");
+    for (uint32_t node = 0; node < stats.node_count; node++) {
+        kprintf(" %d: %d MB", node,
+                (uint32_t)(stats.node_free_pages[node] * PAGE_SIZE / (1024 * 1024)));
+    }
+    kprintf(" (DMA32 %d MB)\n", (uint32_t)(stats.dma32_free_pages * PAGE_SIZE / (1024 * 1024)));
+#if DEBUG_PMM
+    kprintf("  Consistency:     %s\n", pmm_check() ? "ok" : "FAILED");
+#endif
 }
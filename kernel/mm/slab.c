@@ -0,0 +1,492 @@
+/**
+ * =============================================================================
+ * Chanux OS - Slab Allocator Implementation
+ * =============================================================================
+ * Object caches layered on the buddy allocator.
+ *
+ * Slab layout (one 2^order page block, reached through the direct map):
+ *
+ *   +-------------+-----+-------+-------+-----+-------+-------+
+ *   | kmem_slab_t | pad | obj 0 | obj 1 | ... | obj N | waste |
+ *   +-------------+-----+-------+-------+-----+-------+-------+
+ *   ^ block start       ^ first_offset
+ *
+ * A free object stores the pointer to the next free object in its first
+ * eight bytes. Every page of a slab is recorded in a page-owner table
+ * indexed by page frame number, which lets kfree() map an arbitrary
+ * pointer back to its slab and cache in O(1).
+ *
+ * Each cache has its own spinlock, so CPUs allocating from different size
+ * classes do not contend.
+ * =============================================================================
+ */
+
+#include "../include/mm/slab.h"
+#include "../include/mm/pmm.h"
+#include "../include/mm/mm.h"
+#include "../include/string.h"
+#include "../drivers/vga/vga.h"
+
+/* =============================================================================
+ * Slab Internal State
+ * =============================================================================
+ */
+
+/* Page frames covered by the direct map (the only frames a slab can use) */
+#define SLAB_OWNER_ENTRIES      (MM_DIRECT_MAP_SIZE / PAGE_SIZE)
+
+/* Page-owner table: slab holding each direct-mapped frame, or NULL */
+static kmem_slab_t** slab_owner = NULL;
+
+/* Bootstrap cache that kmem_cache_t objects themselves come from */
+static kmem_cache_t cache_cache;
+
+/* All caches, for debug output */
+static kmem_cache_t* cache_list = NULL;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+
+/* kmalloc size-class caches */
+static kmem_cache_t* kmalloc_caches[KMALLOC_CACHE_COUNT];
+
+static bool slab_ready = false;
+
+/* =============================================================================
+ * Helper Functions
+ * =============================================================================
+ */
+
+/* Page frame number of a direct-mapped address */
+static inline uint64_t slab_virt_to_pfn(const void* addr) {
+    return VIRT_TO_PHYS(addr) / PAGE_SIZE;
+}
+
+/* First object of a slab */
+static inline uint8_t* slab_objects(kmem_cache_t* cache, kmem_slab_t* slab) {
+    return (uint8_t*)slab + cache->first_offset;
+}
+
+/* Unlink a slab from one of the cache lists */
+static void slab_list_remove(kmem_slab_t** head, kmem_slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+/* Push a slab onto the front of one of the cache lists */
+static void slab_list_add(kmem_slab_t** head, kmem_slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+/*
+ * Choose the slab order for an object size: the smallest order whose
+ * unused tail is at most 1/8 of the slab, or KMEM_MAX_ORDER if none is.
+ */
+static bool cache_compute_layout(kmem_cache_t* cache) {
+    cache->first_offset = ALIGN_UP(sizeof(kmem_slab_t), cache->align);
+
+    for (uint32_t order = 0; order <= KMEM_MAX_ORDER; order++) {
+        size_t slab_size = PAGE_SIZE << order;
+        if (slab_size < cache->first_offset + cache->obj_size) {
+            continue;
+        }
+
+        size_t objs = (slab_size - cache->first_offset) / cache->obj_size;
+        size_t waste = slab_size - cache->first_offset - objs * cache->obj_size;
+
+        if (waste <= slab_size / 8 || order == KMEM_MAX_ORDER) {
+            cache->order = order;
+            cache->objs_per_slab = (uint32_t)objs;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Fill in a cache descriptor */
+static bool cache_setup(kmem_cache_t* cache, const char* name,
+                        size_t size, size_t align) {
+    if (align == 0) {
+        align = KMEM_MIN_ALIGN;
+    }
+    if ((align & (align - 1)) != 0 || align > PAGE_SIZE) {
+        return false;
+    }
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    strncpy(cache->name, name, KMEM_NAME_MAX - 1);
+    cache->name[KMEM_NAME_MAX - 1] = '\0';
+
+    /* Free objects hold a next pointer, so objects are at least that big */
+    cache->align = MAX(align, sizeof(void*));
+    cache->obj_size = ALIGN_UP(MAX(size, sizeof(void*)), cache->align);
+
+    return cache_compute_layout(cache);
+}
+
+/* =============================================================================
+ * Slab Creation and Release
+ * =============================================================================
+ */
+
+/* Take a new slab from the PMM and thread its free list */
+static kmem_slab_t* slab_grow(kmem_cache_t* cache) {
+    phys_addr_t phys = pmm_alloc_order(cache->order);
+    if (phys == 0) {
+        return NULL;
+    }
+
+    kmem_slab_t* slab = (kmem_slab_t*)PHYS_TO_VIRT(phys);
+    slab->magic = KMEM_SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->next = NULL;
+    slab->prev = NULL;
+
+    /* Build the free list in address order */
+    uint8_t* obj = slab_objects(cache, slab);
+    slab->free_list = obj;
+    for (uint32_t i = 0; i + 1 < cache->objs_per_slab; i++) {
+        *(void**)obj = obj + cache->obj_size;
+        obj += cache->obj_size;
+    }
+    *(void**)obj = NULL;
+
+    /* Record ownership of every page in the slab */
+    uint64_t pfn = phys / PAGE_SIZE;
+    for (uint64_t i = 0; i < (1ULL << cache->order); i++) {
+        slab_owner[pfn + i] = slab;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+/* Return a slab's pages to the PMM */
+static void slab_release(kmem_cache_t* cache, kmem_slab_t* slab) {
+    uint64_t pfn = slab_virt_to_pfn(slab);
+    for (uint64_t i = 0; i < (1ULL << cache->order); i++) {
+        slab_owner[pfn + i] = NULL;
+    }
+
+    slab->magic = 0;
+    cache->slab_count--;
+    pmm_free_order(VIRT_TO_PHYS(slab), cache->order);
+}
+
+/* =============================================================================
+ * Slab Initialization
+ * =============================================================================
+ */
+
+void slab_init(void) {
+    kprintf("[SLAB] Initializing slab allocator...\n");
+
+    /* Page-owner table, one pointer per direct-mapped frame */
+    size_t table_size = SLAB_OWNER_ENTRIES * sizeof(kmem_slab_t*);
+    uint32_t table_order = 0;
+    while (((size_t)PAGE_SIZE << table_order) < table_size) {
+        table_order++;
+    }
+
+    phys_addr_t table = pmm_alloc_order(table_order);
+    if (table == 0) {
+        PANIC("Cannot allocate slab page-owner table");
+    }
+    slab_owner = (kmem_slab_t**)PHYS_TO_VIRT(table);
+    memset(slab_owner, 0, PAGE_SIZE << table_order);
+
+    /* Bootstrap the cache of caches */
+    if (!cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0)) {
+        PANIC("Cannot set up kmem_cache cache");
+    }
+    cache_cache.next = cache_list;
+    cache_list = &cache_cache;
+
+    /* kmalloc size classes */
+    static const char* kmalloc_names[KMALLOC_CACHE_COUNT] = {
+        "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+        "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+    };
+
+    for (int i = 0; i < KMALLOC_CACHE_COUNT; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i],
+                                              1UL << (KMALLOC_MIN_SHIFT + i), 0);
+        if (!kmalloc_caches[i]) {
+            PANIC("Cannot create kmalloc size-class caches");
+        }
+    }
+
+    slab_ready = true;
+
+    kprintf("[SLAB] Page-owner table: %d KB, %d size classes (%d-%d bytes)\n",
+            (uint32_t)((PAGE_SIZE << table_order) / 1024),
+            KMALLOC_CACHE_COUNT,
+            1 << KMALLOC_MIN_SHIFT, 1 << KMALLOC_MAX_SHIFT);
+    kprintf("[SLAB] Initialization complete.\n");
+}
+
+bool slab_is_ready(void) {
+    return slab_ready;
+}
+
+/* =============================================================================
+ * Cache Management
+ * =============================================================================
+ */
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align) {
+    if (!name || size == 0) {
+        return NULL;
+    }
+
+    kmem_cache_t* cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return NULL;
+    }
+
+    if (!cache_setup(cache, name, size, align)) {
+        kprintf("[SLAB] ERROR: Cannot create cache '%s' (size %d)\n",
+                name, (uint32_t)size);
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t* cache) {
+    if (!cache || cache == &cache_cache) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    if (cache->partial || cache->full) {
+        kprintf("[SLAB] WARNING: Destroying cache '%s' with %d live objects\n",
+                cache->name, (uint32_t)cache->active_objs);
+    }
+
+    kmem_slab_t* lists[3] = { cache->partial, cache->full, cache->empty };
+    for (int i = 0; i < 3; i++) {
+        kmem_slab_t* slab = lists[i];
+        while (slab) {
+            kmem_slab_t* next = slab->next;
+            slab_release(cache, slab);
+            slab = next;
+        }
+    }
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    /* Unlink from the global list */
+    flags = spin_lock_irqsave(&cache_list_lock);
+    kmem_cache_t** link = &cache_list;
+    while (*link && *link != cache) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = cache->next;
+    }
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+
+    kmem_cache_free(&cache_cache, cache);
+}
+
+uint32_t kmem_cache_shrink(kmem_cache_t* cache) {
+    if (!cache) {
+        return 0;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    uint32_t released = 0;
+    while (cache->empty) {
+        kmem_slab_t* slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_release(cache, slab);
+        released++;
+    }
+    cache->empty_count = 0;
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return released;
+}
+
+/* =============================================================================
+ * Object Allocation
+ * =============================================================================
+ */
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    if (!cache) {
+        return NULL;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    kmem_slab_t* slab = cache->partial;
+    if (!slab) {
+        /* Reuse an empty slab before asking the PMM for a new one */
+        slab = cache->empty;
+        if (slab) {
+            slab_list_remove(&cache->empty, slab);
+            cache->empty_count--;
+        } else {
+            slab = slab_grow(cache);
+            if (!slab) {
+                spin_unlock_irqrestore(&cache->lock, flags);
+                kprintf("[SLAB] ERROR: Out of memory in cache '%s'\n",
+                        cache->name);
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    /* Pop an object off the slab's free list */
+    void* obj = slab->free_list;
+    slab->free_list = *(void**)obj;
+    slab->inuse++;
+
+    if (slab->inuse == cache->objs_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->active_objs++;
+    cache->alloc_count++;
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    if (!obj) {
+        return;
+    }
+
+    kmem_slab_t* slab = slab_find(obj);
+    if (!slab || slab->cache != cache) {
+        kprintf("[SLAB] ERROR: Invalid free of 0x%p to cache '%s'\n",
+                obj, cache ? cache->name : "(null)");
+        return;
+    }
+
+    /* Round interior pointers (e.g. from kmalloc_aligned) to the object */
+    uint8_t* base = slab_objects(cache, slab);
+    size_t offset = (uint8_t*)obj - base;
+    if ((uint8_t*)obj < base ||
+        offset / cache->obj_size >= cache->objs_per_slab) {
+        kprintf("[SLAB] ERROR: Free of 0x%p outside objects of '%s'\n",
+                obj, cache->name);
+        return;
+    }
+    obj = base + (offset / cache->obj_size) * cache->obj_size;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    if (slab->inuse == 0) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        kprintf("[SLAB] WARNING: Double free at 0x%p in '%s'\n",
+                obj, cache->name);
+        return;
+    }
+
+    bool was_full = (slab->inuse == cache->objs_per_slab);
+
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->inuse--;
+
+    cache->active_objs--;
+    cache->free_count++;
+
+    if (was_full) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    if (slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty_count < KMEM_EMPTY_KEEP) {
+            slab_list_add(&cache->empty, slab);
+            cache->empty_count++;
+        } else {
+            slab_release(cache, slab);
+        }
+    }
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/* =============================================================================
+ * kmalloc Integration
+ * =============================================================================
+ */
+
+void* kmalloc_slab(size_t size) {
+    if (!slab_ready || size == 0 || size > KMALLOC_MAX_CACHE_SIZE) {
+        return NULL;
+    }
+
+    /* Smallest size class that fits */
+    int index = 0;
+    while ((1UL << (KMALLOC_MIN_SHIFT + index)) < size) {
+        index++;
+    }
+
+    return kmem_cache_alloc(kmalloc_caches[index]);
+}
+
+kmem_slab_t* slab_find(const void* ptr) {
+    uint64_t addr = (uint64_t)ptr;
+
+    if (!slab_owner || addr < KERNEL_VIRT_BASE ||
+        addr >= KERNEL_VIRT_BASE + MM_DIRECT_MAP_SIZE) {
+        return NULL;
+    }
+
+    kmem_slab_t* slab = slab_owner[slab_virt_to_pfn(ptr)];
+    if (slab && slab->magic != KMEM_SLAB_MAGIC) {
+        kprintf("[SLAB] ERROR: Corrupted slab header at 0x%p\n", slab);
+        return NULL;
+    }
+
+    return slab;
+}
+
+/* =============================================================================
+ * Statistics and Debug
+ * =============================================================================
+ */
+
+void slab_debug_print(void) {
+    kprintf("\n[SLAB] Object Caches:\n");
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        kprintf("  %s: size %d, %d objs/slab, order %d, %d slabs, %d active\n",
+                cache->name,
+                (uint32_t)cache->obj_size,
+                cache->objs_per_slab,
+                cache->order,
+                (uint32_t)cache->slab_count,
+                (uint32_t)cache->active_objs);
+    }
+}
@@ -11,6 +11,8 @@
 #include "../include/mm/mm.h"
 #include "../include/string.h"
 #include "../include/debug.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
 #include "../drivers/vga/vga.h"
 
 /* =============================================================================
@@ -27,6 +29,60 @@ static phys_addr_t vmm_pml4_phys = 0;
 /* Statistics */
 static uint64_t vmm_pages_mapped = 0;
 
+/* TLB features turned on by vmm_init() */
+static bool vmm_pge_enabled = false;
+static bool vmm_pcid_enabled = false;
+
+/*
+ * Protects the kernel page tables. User address spaces are only changed
+ * by the process that owns them and are not covered.
+ */
+static spinlock_t vmm_lock = SPINLOCK_INIT;
+
+/* Next free address in the MMIO window */
+static virt_addr_t vmm_mmio_next = MM_MMIO_VIRT_START;
+
+/* =============================================================================
+ * PCID Assignment
+ * =============================================================================
+ * Every user address space gets its own PCID so CR3 switches can keep TLB
+ * entries. A PCID handed out again may still have the previous owner's
+ * entries cached, so it starts STALE and its first CR3 load flushes.
+ */
+
+#define VMM_PCID_FRAMES     (MM_DIRECT_MAP_SIZE / PAGE_SIZE)
+
+#define VMM_PCID_FREE       0
+#define VMM_PCID_LIVE       1
+#define VMM_PCID_STALE      2
+
+/* PCID of each PML4 frame (0 = untagged, flushed on every load) */
+static uint16_t vmm_pcid_of[VMM_PCID_FRAMES];
+
+/* State of each PCID */
+static uint8_t vmm_pcid_state[VMM_PCID_COUNT];
+
+/* Next-fit allocation cursor */
+static uint32_t vmm_pcid_next = 1;
+
+/*
+ * CPU that last loaded each PCID. Its entries are only known to be fresh
+ * on that CPU, so a load anywhere else has to flush.
+ */
+#define VMM_PCID_NO_CPU     0xFF
+
+static uint8_t vmm_pcid_cpu[VMM_PCID_COUNT];
+
+/*
+ * PCID 0 is the kernel's, but an untagged user address space (PCIDs all
+ * taken) fills it with user entries. The next kernel CR3 load on that CPU
+ * must then flush.
+ */
+static bool vmm_kernel_pcid_dirty[SMP_MAX_CPUS];
+
+/* Guards the tables above */
+static spinlock_t vmm_pcid_lock = SPINLOCK_INIT;
+
 /* =============================================================================
  * Helper Functions
  * =============================================================================
@@ -37,17 +93,15 @@ static inline phys_addr_t read_cr3_addr(void) {
     return read_cr3() & PTE_ADDR_MASK;
 }
 
-/* Allocate and zero a page table */
+/* Allocate a zeroed page table */
 static pte_t* vmm_alloc_table(void) {
-    phys_addr_t phys = pmm_alloc_page();
+    phys_addr_t phys = pmm_alloc_page_zeroed();
     if (phys == 0) {
         kprintf("[VMM] ERROR: Cannot allocate page table!\n");
         return NULL;
     }
 
-    pte_t* table = (pte_t*)PHYS_TO_VIRT(phys);
-    memset(table, 0, PAGE_SIZE);
-    return table;
+    return (pte_t*)PHYS_TO_VIRT(phys);
 }
 
 /* Get physical address of a page table */
@@ -55,11 +109,161 @@ static inline phys_addr_t vmm_table_phys(pte_t* table) {
     return VIRT_TO_PHYS((virt_addr_t)table);
 }
 
+/* Table entry that points to a table private to a user address space */
+static inline bool vmm_is_user_table(pte_t entry) {
+    return (entry & (PTE_PRESENT | PTE_USER | PTE_HUGE)) == (PTE_PRESENT | PTE_USER);
+}
+
+/* A 2MB page owned by this address space */
+static inline bool vmm_is_user_huge(pte_t entry) {
+    return (entry & (PTE_PRESENT | PTE_USER | PTE_HUGE)) == (PTE_PRESENT | PTE_USER | PTE_HUGE);
+}
+
+/*
+ * Find the 4KB leaf entry for a user address, following only tables
+ * private to this address space. Returns NULL if there is none.
+ */
+static pte_t* vmm_user_pte(phys_addr_t pml4_phys, virt_addr_t virt) {
+    pte_t* pml4 = (pte_t*)PHYS_TO_VIRT(pml4_phys);
+    if (!vmm_is_user_table(pml4[PML4_INDEX(virt)])) return NULL;
+
+    pte_t* pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pml4[PML4_INDEX(virt)]));
+    if (!vmm_is_user_table(pdpt[PDPT_INDEX(virt)])) return NULL;
+
+    pte_t* pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpt[PDPT_INDEX(virt)]));
+    if (!vmm_is_user_table(pd[PD_INDEX(virt)])) return NULL;
+
+    pte_t* pt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pd[PD_INDEX(virt)]));
+    return &pt[PT_INDEX(virt)];
+}
+
+/* Flush the current PCID's non-global entries */
+static inline void vmm_flush_tlb_local(void) {
+    write_cr3(read_cr3());
+}
+
+/* Assign a PCID to a new PML4 */
+static void vmm_pcid_assign(phys_addr_t pml4_phys) {
+    uint64_t pfn = pml4_phys / PAGE_SIZE;
+    if (!vmm_pcid_enabled || pfn >= VMM_PCID_FRAMES) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&vmm_pcid_lock);
+
+    /* All PCIDs in use: run untagged */
+    vmm_pcid_of[pfn] = 0;
+
+    for (uint32_t i = 0; i < VMM_PCID_COUNT - 1; i++) {
+        uint32_t pcid = vmm_pcid_next;
+        vmm_pcid_next = (vmm_pcid_next + 1 < VMM_PCID_COUNT) ? vmm_pcid_next + 1 : 1;
+
+        if (vmm_pcid_state[pcid] == VMM_PCID_FREE) {
+            vmm_pcid_state[pcid] = VMM_PCID_STALE;
+            vmm_pcid_cpu[pcid] = VMM_PCID_NO_CPU;
+            vmm_pcid_of[pfn] = (uint16_t)pcid;
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&vmm_pcid_lock, flags);
+}
+
+/* Return a PML4's PCID to the pool */
+static void vmm_pcid_release(phys_addr_t pml4_phys) {
+    uint64_t pfn = pml4_phys / PAGE_SIZE;
+    if (pfn >= VMM_PCID_FRAMES || vmm_pcid_of[pfn] == 0) {
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&vmm_pcid_lock);
+    vmm_pcid_state[vmm_pcid_of[pfn]] = VMM_PCID_FREE;
+    vmm_pcid_of[pfn] = 0;
+    spin_unlock_irqrestore(&vmm_pcid_lock, flags);
+}
+
+/* Force a flush on the next load of an inactive address space */
+static void vmm_pcid_invalidate(phys_addr_t pml4_phys) {
+    uint64_t pfn = pml4_phys / PAGE_SIZE;
+    if (pfn < VMM_PCID_FRAMES && vmm_pcid_of[pfn] != 0) {
+        uint64_t flags = spin_lock_irqsave(&vmm_pcid_lock);
+        vmm_pcid_state[vmm_pcid_of[pfn]] = VMM_PCID_STALE;
+        spin_unlock_irqrestore(&vmm_pcid_lock, flags);
+    }
+}
+
 /* =============================================================================
  * VMM Initialization
  * =============================================================================
  */
 
+/*
+ * The bootloader points PML4[0] and PML4[511] at the same PDPT and PD, so
+ * the higher half cannot be marked global without also making the identity
+ * map global (and user mappings at low addresses would then hit stale
+ * kernel entries). Give the higher half private copies and mark those
+ * leaves global.
+ */
+static void vmm_split_kernel_half(pte_t* pml4, bool global) {
+    for (int i = 256; i < 512; i++) {
+        if (i == VMM_RECURSIVE_INDEX || !(pml4[i] & PTE_PRESENT)) {
+            continue;
+        }
+
+        pte_t* old_pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pml4[i]));
+        pte_t* pdpt = vmm_alloc_table();
+        if (!pdpt) {
+            PANIC("Cannot allocate kernel PDPT");
+        }
+
+        for (int j = 0; j < 512; j++) {
+            pdpt[j] = old_pdpt[j];
+            if (!(pdpt[j] & PTE_PRESENT)) {
+                continue;
+            }
+            if (pdpt[j] & PTE_HUGE) {
+                if (global) pdpt[j] |= PTE_GLOBAL;
+                continue;
+            }
+
+            pte_t* old_pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpt[j]));
+            pte_t* pd = vmm_alloc_table();
+            if (!pd) {
+                PANIC("Cannot allocate kernel PD");
+            }
+
+            for (int k = 0; k < 512; k++) {
+                pd[k] = old_pd[k];
+                if (global && (pd[k] & PTE_PRESENT) && (pd[k] & PTE_HUGE)) {
+                    pd[k] |= PTE_GLOBAL;
+                }
+            }
+            pdpt[j] = vmm_table_phys(pd) | (pdpt[j] & ~PTE_ADDR_MASK);
+        }
+
+        pml4[i] = vmm_table_phys(pdpt) | (pml4[i] & ~PTE_ADDR_MASK);
+    }
+}
+
+/* Turn on the paging features vmm_init() picked, on the calling CPU */
+static void vmm_enable_features(void) {
+    /*
+     * Make ring 0 honour read-only pages too, so that kernel writes into
+     * copy-on-write user pages (e.g. a read() buffer) fault and get copied.
+     */
+    write_cr0(read_cr0() | CR0_WP);
+
+    /* Kernel-half TLB entries survive CR3 switches */
+    if (vmm_pge_enabled) {
+        write_cr4(read_cr4() | CR4_PGE);
+    }
+
+    /* Tag address spaces so CR3 switches need not flush (CR3 PCID is 0 here) */
+    if (vmm_pcid_enabled) {
+        write_cr4(read_cr4() | CR4_PCIDE);
+    }
+}
+
 void vmm_init(void) {
     kprintf("[VMM] Initializing Virtual Memory Manager...\n");
 
@@ -85,6 +289,15 @@ void vmm_init(void) {
         vmm_pml4[i] = boot_pml4[i];
     }
 
+    /* Check for global pages and PCIDs */
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    bool has_pge = (edx & (1U << 13)) != 0;
+    bool has_pcid = (ecx & (1U << 17)) != 0;
+
+    /* Unshare the higher half from the identity map, marking it global */
+    vmm_split_kernel_half(vmm_pml4, has_pge);
+
     /* Keep identity mapping (entry 0) for now */
     /* This is needed until we fully transition to higher-half */
     vmm_pml4[0] = boot_pml4[0];
@@ -99,9 +312,22 @@ void vmm_init(void) {
     write_cr3(vmm_pml4_phys);
 
     kprintf("[VMM] Switched to new page tables!\n");
+
+    vmm_pge_enabled = has_pge;
+    vmm_pcid_enabled = has_pcid;
+    vmm_enable_features();
+
+    kprintf("[VMM] Global pages: %s, PCID: %s\n",
+            vmm_pge_enabled ? "on" : "off", vmm_pcid_enabled ? "on" : "off");
     kprintf("[VMM] Initialization complete.\n");
 }
 
+void vmm_init_cpu(void) {
+    /* The AP trampoline already runs on vmm_pml4 */
+    write_cr3(vmm_pml4_phys);
+    vmm_enable_features();
+}
+
 /* =============================================================================
  * Huge Page Splitting
  * =============================================================================
@@ -111,15 +337,16 @@ void vmm_init(void) {
  * Split a 2MB huge page into 512 x 4KB pages.
  * This is needed when the bootloader sets up huge pages but we need
  * fine-grained control for heap or other kernel allocations.
+ * The 4KB entries keep the huge page's flags; the PD entry gets table_flags.
  */
-static bool vmm_split_huge_page(pte_t* pd, uint64_t pd_idx) {
+static bool vmm_split_huge_page(pte_t* pd, uint64_t pd_idx, uint64_t table_flags) {
     pte_t huge_entry = pd[pd_idx];
 
     /* Get the physical base address of the 2MB region */
-    phys_addr_t huge_base = PTE_GET_ADDR(huge_entry);
+    phys_addr_t huge_base = huge_entry & VMM_HUGE_ADDR_MASK;
 
     /* Extract flags (excluding address and HUGE bit) */
-    uint64_t flags = huge_entry & ~(PTE_ADDR_MASK | PTE_HUGE);
+    uint64_t flags = huge_entry & ~(VMM_HUGE_ADDR_MASK | PTE_HUGE);
 
     /* Allocate a new page table */
     pte_t* pt = vmm_alloc_table();
@@ -134,87 +361,163 @@ static bool vmm_split_huge_page(pte_t* pd, uint64_t pd_idx) {
     }
 
     /* Replace PD entry: point to new PT instead of huge page */
-    /* Use kernel RW flags for the PD entry itself */
-    pd[pd_idx] = vmm_table_phys(pt) | PTE_KERNEL_RW;
+    pd[pd_idx] = vmm_table_phys(pt) | table_flags;
 
     /* Flush entire TLB since we changed the page structure */
     vmm_flush_tlb_all();
 
-    kprintf("[VMM] Split 2MB huge page at phys 0x%x into 4KB pages\n",
+    DBG_VMM("[VMM] Split 2MB huge page at phys 0x%x into 4KB pages\n",
             (uint32_t)huge_base);
 
     return true;
 }
 
 /* =============================================================================
- * Page Mapping
+ * Page Table Walking
  * =============================================================================
+ * Kernel walks create tables with kernel flags. User walks mark every
+ * table PTE_USER and first give the address space a private copy of any
+ * table it still shares with the kernel (an entry without PTE_USER).
  */
 
-bool vmm_map_page(virt_addr_t virt, phys_addr_t phys, uint64_t flags) {
-    /* Validate alignment */
-    if (!IS_ALIGNED(virt, PAGE_SIZE) || !IS_ALIGNED(phys, PAGE_SIZE)) {
-        kprintf("[VMM] ERROR: Unaligned addresses (virt=0x%p, phys=0x%x)\n",
-                (void*)virt, (uint32_t)phys);
-        return false;
+/* Flags for an entry pointing at a table */
+static inline uint64_t vmm_table_flags(bool user) {
+    return user ? (PTE_PRESENT | PTE_WRITABLE | PTE_USER) : PTE_KERNEL_RW;
+}
+
+/* Follow (or create) the table an entry points to; NULL for huge pages */
+static pte_t* vmm_next_table(pte_t* entry, bool user) {
+    if (!(*entry & PTE_PRESENT)) {
+        pte_t* table = vmm_alloc_table();
+        if (!table) return NULL;
+        *entry = vmm_table_phys(table) | vmm_table_flags(user);
+        return table;
     }
 
-    /* Extract indices */
-    uint64_t pml4_idx = PML4_INDEX(virt);
-    uint64_t pdpt_idx = PDPT_INDEX(virt);
-    uint64_t pd_idx = PD_INDEX(virt);
-    uint64_t pt_idx = PT_INDEX(virt);
+    if (*entry & PTE_HUGE) {
+        return NULL;
+    }
 
-    /* Get or create PDPT */
-    pte_t* pdpt;
-    if (!(vmm_pml4[pml4_idx] & PTE_PRESENT)) {
-        pdpt = vmm_alloc_table();
-        if (!pdpt) return false;
-        vmm_pml4[pml4_idx] = vmm_table_phys(pdpt) | PTE_KERNEL_RW;
-    } else {
-        pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(vmm_pml4[pml4_idx]));
+    pte_t* table = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(*entry));
+
+    if (user && !(*entry & PTE_USER)) {
+        /* Entry copied from kernel - create a copy with USER flag */
+        DBG_VMM("[VMM-U] Copying shared table 0x%x\n", (uint32_t)PTE_GET_ADDR(*entry));
+        pte_t* copy = vmm_alloc_table();
+        if (!copy) return NULL;
+        for (int i = 0; i < 512; i++) {
+            copy[i] = table[i];
+        }
+        *entry = vmm_table_phys(copy) | vmm_table_flags(user);
+        table = copy;
     }
 
-    /* Get or create PD */
-    pte_t* pd;
-    if (!(pdpt[pdpt_idx] & PTE_PRESENT)) {
-        pd = vmm_alloc_table();
-        if (!pd) return false;
-        pdpt[pdpt_idx] = vmm_table_phys(pd) | PTE_KERNEL_RW;
-    } else {
-        /* Check for 1GB huge page */
-        if (pdpt[pdpt_idx] & PTE_HUGE) {
-            kprintf("[VMM] ERROR: Cannot map 4KB page in 1GB huge page region\n");
-            return false;
+    return table;
+}
+
+/* Page directory covering virt */
+static pte_t* vmm_walk_pd(pte_t* pml4, virt_addr_t virt, bool user) {
+    pte_t* pdpt = vmm_next_table(&pml4[PML4_INDEX(virt)], user);
+    if (!pdpt) return NULL;
+
+    pte_t* pd = vmm_next_table(&pdpt[PDPT_INDEX(virt)], user);
+    if (!pd && (pdpt[PDPT_INDEX(virt)] & PTE_HUGE)) {
+        kprintf("[VMM] ERROR: Cannot map 4KB page in 1GB huge page region\n");
+    }
+    return pd;
+}
+
+/* Page table covering virt, splitting a 2MB page in the way */
+static pte_t* vmm_walk_pt(pte_t* pml4, virt_addr_t virt, bool user) {
+    pte_t* pd = vmm_walk_pd(pml4, virt, user);
+    if (!pd) return NULL;
+
+    uint64_t pd_idx = PD_INDEX(virt);
+    if ((pd[pd_idx] & PTE_PRESENT) && (pd[pd_idx] & PTE_HUGE)) {
+        if (!vmm_split_huge_page(pd, pd_idx, vmm_table_flags(user))) {
+            kprintf("[VMM] ERROR: Cannot split 2MB huge page\n");
+            return NULL;
         }
-        pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpt[pdpt_idx]));
     }
 
-    /* Get or create PT */
-    pte_t* pt;
-    if (!(pd[pd_idx] & PTE_PRESENT)) {
-        pt = vmm_alloc_table();
-        if (!pt) return false;
-        pd[pd_idx] = vmm_table_phys(pt) | PTE_KERNEL_RW;
-    } else {
-        /* Check for 2MB huge page - split it if needed */
-        if (pd[pd_idx] & PTE_HUGE) {
-            if (!vmm_split_huge_page(pd, pd_idx)) {
-                kprintf("[VMM] ERROR: Cannot split 2MB huge page\n");
-                return false;
+    return vmm_next_table(&pd[pd_idx], user);
+}
+
+/*
+ * Map a physically contiguous range in one pass.
+ * Each table level is walked once per 2MB (or per PT) rather than once per
+ * page, and 2MB pages are used whenever virt and phys are both aligned and
+ * the PD slot is free or already a 2MB page. No TLB flush is done here.
+ * On failure, *done receives the number of bytes that were mapped.
+ */
+static bool vmm_map_range_in(pte_t* pml4, virt_addr_t virt, phys_addr_t phys,
+                             size_t size, uint64_t flags, bool user, size_t* done) {
+    virt_addr_t start = virt;
+    virt_addr_t end = virt + size;
+
+    /* Kernel-half pages are the same in every address space */
+    if (!user && vmm_pge_enabled && virt >= 0xFFFF800000000000ULL) {
+        flags |= PTE_GLOBAL;
+    }
+
+    while (virt < end) {
+        if (IS_ALIGNED(virt, VMM_HUGE_PAGE_SIZE) && IS_ALIGNED(phys, VMM_HUGE_PAGE_SIZE) &&
+            end - virt >= VMM_HUGE_PAGE_SIZE) {
+            pte_t* pd = vmm_walk_pd(pml4, virt, user);
+            if (!pd) break;
+
+            pte_t* pde = &pd[PD_INDEX(virt)];
+            if (!(*pde & PTE_PRESENT) || (*pde & PTE_HUGE)) {
+                if (!(*pde & PTE_PRESENT)) {
+                    vmm_pages_mapped += VMM_HUGE_PAGE_SIZE / PAGE_SIZE;
+                }
+                *pde = phys | flags | PTE_HUGE;
+                virt += VMM_HUGE_PAGE_SIZE;
+                phys += VMM_HUGE_PAGE_SIZE;
+                continue;
             }
+            /* A page table is already there - fill it with 4KB pages */
+        }
+
+        pte_t* pt = vmm_walk_pt(pml4, virt, user);
+        if (!pt) break;
+
+        /* Fill this table up to the next 2MB boundary or the end */
+        virt_addr_t table_end = MIN(ALIGN_DOWN(virt, VMM_HUGE_PAGE_SIZE) + VMM_HUGE_PAGE_SIZE, end);
+        for (; virt < table_end; virt += PAGE_SIZE, phys += PAGE_SIZE) {
+            pte_t* pte = &pt[PT_INDEX(virt)];
+            if (!(*pte & PTE_PRESENT)) {
+                vmm_pages_mapped++;
+            }
+            *pte = (phys & PTE_ADDR_MASK) | flags;
         }
-        pt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pd[pd_idx]));
     }
 
-    /* Map the page */
-    if (pt[pt_idx] & PTE_PRESENT) {
-        /* Page already mapped - update entry */
-        pt[pt_idx] = phys | flags;
-    } else {
-        /* New mapping */
-        pt[pt_idx] = phys | flags;
-        vmm_pages_mapped++;
+    if (done) {
+        *done = virt - start;
+    }
+    return virt >= end;
+}
+
+/* =============================================================================
+ * Page Mapping
+ * =============================================================================
+ */
+
+bool vmm_map_page(virt_addr_t virt, phys_addr_t phys, uint64_t flags) {
+    /* Validate alignment */
+    if (!IS_ALIGNED(virt, PAGE_SIZE) || !IS_ALIGNED(phys, PAGE_SIZE)) {
+        kprintf("[VMM] ERROR: Unaligned addresses (virt=0x%p, phys=0x%x)\n",
+                (void*)virt, (uint32_t)phys);
+        return false;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    bool ok = vmm_map_range_in(vmm_pml4, virt, phys, PAGE_SIZE, flags, false, NULL);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    if (!ok) {
+        return false;
     }
 
     /* Flush TLB for this address */
@@ -223,11 +526,8 @@ bool vmm_map_page(virt_addr_t virt, phys_addr_t phys, uint64_t flags) {
     return true;
 }
 
-bool vmm_unmap_page(virt_addr_t virt) {
-    if (!IS_ALIGNED(virt, PAGE_SIZE)) {
-        virt = ALIGN_DOWN(virt, PAGE_SIZE);
-    }
-
+/* Clear one kernel PTE (vmm_lock held); only the local TLB is flushed */
+static bool vmm_unmap_page_locked(virt_addr_t virt) {
     uint64_t pml4_idx = PML4_INDEX(virt);
     uint64_t pdpt_idx = PDPT_INDEX(virt);
     uint64_t pd_idx = PD_INDEX(virt);
@@ -252,8 +552,10 @@ bool vmm_unmap_page(virt_addr_t virt) {
         return false;
     }
     if (pd[pd_idx] & PTE_HUGE) {
-        /* Cannot unmap part of 2MB huge page */
-        return false;
+        /* Break the 2MB page up so the rest of it stays mapped */
+        if (!vmm_split_huge_page(pd, pd_idx, PTE_KERNEL_RW)) {
+            return false;
+        }
     }
 
     pte_t* pt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pd[pd_idx]));
@@ -271,6 +573,19 @@ bool vmm_unmap_page(virt_addr_t virt) {
     return true;
 }
 
+bool vmm_unmap_page(virt_addr_t virt) {
+    virt = ALIGN_DOWN(virt, PAGE_SIZE);
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    bool ok = vmm_unmap_page_locked(virt);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    if (ok) {
+        smp_tlb_shootdown(virt, PAGE_SIZE);
+    }
+    return ok;
+}
+
 /* =============================================================================
  * Address Translation
  * =============================================================================
@@ -334,28 +649,85 @@ bool vmm_map_range(virt_addr_t virt, phys_addr_t phys, size_t size, uint64_t fla
     phys = ALIGN_DOWN(phys, PAGE_SIZE);
     size = ALIGN_UP(size, PAGE_SIZE);
 
-    size_t pages = size / PAGE_SIZE;
-    for (size_t i = 0; i < pages; i++) {
-        if (!vmm_map_page(virt + i * PAGE_SIZE, phys + i * PAGE_SIZE, flags)) {
-            /* Rollback on failure */
-            for (size_t j = 0; j < i; j++) {
-                vmm_unmap_page(virt + j * PAGE_SIZE);
-            }
-            return false;
-        }
+    size_t done = 0;
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    bool ok = vmm_map_range_in(vmm_pml4, virt, phys, size, flags, false, &done);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    /* One flush for the whole range (remapped entries may be cached) */
+    vmm_flush_tlb_range(virt, done);
+
+    if (!ok) {
+        /* Rollback on failure */
+        vmm_unmap_range(virt, done);
     }
 
-    return true;
+    return ok;
 }
 
 void vmm_unmap_range(virt_addr_t virt, size_t size) {
+    virt_addr_t end = ALIGN_UP(virt + size, PAGE_SIZE);
     virt = ALIGN_DOWN(virt, PAGE_SIZE);
-    size = ALIGN_UP(size, PAGE_SIZE);
+    virt_addr_t start = virt;
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+
+    while (virt < end) {
+        /* Drop whole 2MB pages without splitting them first */
+        if (IS_ALIGNED(virt, VMM_HUGE_PAGE_SIZE) && end - virt >= VMM_HUGE_PAGE_SIZE) {
+            pte_t pml4e = vmm_pml4[PML4_INDEX(virt)];
+            if ((pml4e & PTE_PRESENT) && !(pml4e & PTE_HUGE)) {
+                pte_t* pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pml4e));
+                pte_t pdpte = pdpt[PDPT_INDEX(virt)];
+                if ((pdpte & PTE_PRESENT) && !(pdpte & PTE_HUGE)) {
+                    pte_t* pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpte));
+                    pte_t* pde = &pd[PD_INDEX(virt)];
+                    if ((*pde & PTE_PRESENT) && (*pde & PTE_HUGE)) {
+                        *pde = 0;
+                        vmm_pages_mapped -= VMM_HUGE_PAGE_SIZE / PAGE_SIZE;
+                        vmm_flush_tlb(virt);
+                        virt += VMM_HUGE_PAGE_SIZE;
+                        continue;
+                    }
+                }
+            }
+        }
 
-    size_t pages = size / PAGE_SIZE;
-    for (size_t i = 0; i < pages; i++) {
-        vmm_unmap_page(virt + i * PAGE_SIZE);
+        vmm_unmap_page_locked(virt);
+        virt += PAGE_SIZE;
     }
+
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    /* One shootdown for the range, before the caller frees the frames */
+    smp_tlb_shootdown(start, end - start);
+}
+
+void* vmm_map_mmio(phys_addr_t phys, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    phys_addr_t base = ALIGN_DOWN(phys, PAGE_SIZE);
+    size_t length = ALIGN_UP(phys + size, PAGE_SIZE) - base;
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    virt_addr_t virt = vmm_mmio_next;
+    if (length > MM_MMIO_VIRT_MAX - virt) {
+        spin_unlock_irqrestore(&vmm_lock, irq);
+        kprintf("[VMM] ERROR: MMIO window full\n");
+        return NULL;
+    }
+    vmm_mmio_next += length;
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    /* Device registers must not be cached or executed */
+    if (!vmm_map_range(virt, base, length,
+                       PTE_KERNEL_RW | PTE_NOCACHE | PTE_WRITETHROUGH | PTE_NX)) {
+        return NULL;
+    }
+
+    return (void*)(virt + (phys - base));
 }
 
 /* =============================================================================
@@ -367,9 +739,30 @@ void vmm_flush_tlb(virt_addr_t virt) {
     __asm__ volatile ("invlpg (%0)" : : "r"(virt) : "memory");
 }
 
+void vmm_flush_tlb_range(virt_addr_t virt, size_t size) {
+    virt_addr_t end = ALIGN_UP(virt + size, PAGE_SIZE);
+    virt = ALIGN_DOWN(virt, PAGE_SIZE);
+
+    if ((end - virt) / PAGE_SIZE > VMM_FLUSH_ALL_PAGES) {
+        vmm_flush_tlb_all();
+        return;
+    }
+
+    for (; virt < end; virt += PAGE_SIZE) {
+        vmm_flush_tlb(virt);
+    }
+}
+
 void vmm_flush_tlb_all(void) {
-    /* Reload CR3 to flush all TLB entries */
-    write_cr3(read_cr3());
+    if (vmm_pge_enabled) {
+        /* Toggling CR4.PGE drops global entries and every PCID */
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        /* Reload CR3 to flush all TLB entries */
+        write_cr3(read_cr3());
+    }
 }
 
 /* =============================================================================
@@ -394,19 +787,14 @@ void vmm_debug_print(void) {
 
 phys_addr_t vmm_create_address_space(void) {
     /* Allocate a new PML4 */
-    phys_addr_t new_pml4_phys = pmm_alloc_page();
+    phys_addr_t new_pml4_phys = pmm_alloc_page_zeroed();
     if (new_pml4_phys == 0) {
         return 0;
     }
 
-    /* Get virtual address to access the new PML4 */
+    /* Get virtual address to access the new (zeroed) PML4 */
     pte_t* new_pml4 = (pte_t*)PHYS_TO_VIRT(new_pml4_phys);
 
-    /* Clear the entire PML4 */
-    for (int i = 0; i < 512; i++) {
-        new_pml4[i] = 0;
-    }
-
     /* Copy kernel mappings from current PML4 (entries 256-511 for higher half) */
     pte_t* current_pml4 = (pte_t*)PHYS_TO_VIRT(vmm_pml4_phys);
     for (int i = 256; i < 512; i++) {
@@ -421,6 +809,8 @@ phys_addr_t vmm_create_address_space(void) {
      */
     new_pml4[0] = current_pml4[0];
 
+    vmm_pcid_assign(new_pml4_phys);
+
     return new_pml4_phys;
 }
 
@@ -430,11 +820,19 @@ void vmm_destroy_address_space(phys_addr_t pml4_phys) {
         return;
     }
 
+    /* Never pull the tables out from under ourselves */
+    if (pml4_phys == read_cr3_addr()) {
+        write_cr3(vmm_pml4_phys);
+    }
+
     pte_t* pml4 = (pte_t*)PHYS_TO_VIRT(pml4_phys);
 
-    /* Only free user-space page tables (entries 0-255) */
+    /*
+     * Only free user-space page tables (entries 0-255). Entries without
+     * PTE_USER still point at the kernel's shared tables and are skipped.
+     */
     for (int pml4_idx = 0; pml4_idx < 256; pml4_idx++) {
-        if (!(pml4[pml4_idx] & PTE_PRESENT)) {
+        if (!vmm_is_user_table(pml4[pml4_idx])) {
             continue;
         }
 
@@ -442,7 +840,7 @@ void vmm_destroy_address_space(phys_addr_t pml4_phys) {
         pte_t* pdpt = (pte_t*)PHYS_TO_VIRT(pdpt_phys);
 
         for (int pdpt_idx = 0; pdpt_idx < 512; pdpt_idx++) {
-            if (!(pdpt[pdpt_idx] & PTE_PRESENT)) {
+            if (!vmm_is_user_table(pdpt[pdpt_idx])) {
                 continue;
             }
 
@@ -450,16 +848,30 @@ void vmm_destroy_address_space(phys_addr_t pml4_phys) {
             pte_t* pd = (pte_t*)PHYS_TO_VIRT(pd_phys);
 
             for (int pd_idx = 0; pd_idx < 512; pd_idx++) {
-                if (!(pd[pd_idx] & PTE_PRESENT)) {
+                if (vmm_is_user_huge(pd[pd_idx])) {
+                    /* 2MB user page: release each of its frames */
+                    phys_addr_t base = pd[pd_idx] & VMM_HUGE_ADDR_MASK;
+                    for (int i = 0; i < 512; i++) {
+                        pmm_page_unref(base + (phys_addr_t)i * PAGE_SIZE);
+                    }
                     continue;
                 }
-
-                if (pd[pd_idx] & PTE_HUGE) {
-                    /* 2MB huge page - skip, don't free */
+                if (!vmm_is_user_table(pd[pd_idx])) {
+                    /* Not present, 2MB huge page, or kernel table */
                     continue;
                 }
 
                 phys_addr_t pt_phys = PTE_GET_ADDR(pd[pd_idx]);
+                pte_t* pt = (pte_t*)PHYS_TO_VIRT(pt_phys);
+
+                /* Release user pages (shared COW frames just lose a ref) */
+                for (int pt_idx = 0; pt_idx < 512; pt_idx++) {
+                    if ((pt[pt_idx] & (PTE_PRESENT | PTE_USER | PTE_SHARED)) ==
+                        (PTE_PRESENT | PTE_USER)) {
+                        pmm_page_unref(PTE_GET_ADDR(pt[pt_idx]));
+                    }
+                }
+
                 /* Free the page table */
                 pmm_free_page(pt_phys);
             }
@@ -473,12 +885,51 @@ void vmm_destroy_address_space(phys_addr_t pml4_phys) {
     }
 
     /* Free the PML4 itself */
+    vmm_pcid_release(pml4_phys);
     pmm_free_page(pml4_phys);
 }
 
+uint64_t vmm_address_space_cr3(phys_addr_t pml4_phys) {
+    if (!vmm_pcid_enabled) {
+        return pml4_phys ? pml4_phys : vmm_pml4_phys;
+    }
+
+    uint32_t cpu = cpu_this()->id;
+    uint64_t flags = spin_lock_irqsave(&vmm_pcid_lock);
+    uint64_t cr3;
+
+    if (pml4_phys == 0 || pml4_phys == vmm_pml4_phys) {
+        /* Kernel tables, PCID 0 */
+        cr3 = vmm_kernel_pcid_dirty[cpu] ? vmm_pml4_phys : (vmm_pml4_phys | CR3_NOFLUSH);
+        vmm_kernel_pcid_dirty[cpu] = false;
+    } else {
+        uint64_t pfn = pml4_phys / PAGE_SIZE;
+        uint16_t pcid = (pfn < VMM_PCID_FRAMES) ? vmm_pcid_of[pfn] : 0;
+
+        if (pcid == 0) {
+            /* Untagged: flushes PCID 0 now, and again before the kernel uses it */
+            vmm_kernel_pcid_dirty[cpu] = true;
+            cr3 = pml4_phys;
+        } else if (vmm_pcid_state[pcid] == VMM_PCID_STALE || vmm_pcid_cpu[pcid] != cpu) {
+            /* Flush whatever a previous owner, or an earlier run elsewhere, left behind */
+            vmm_pcid_state[pcid] = VMM_PCID_LIVE;
+            cr3 = pml4_phys | pcid;
+        } else {
+            cr3 = pml4_phys | pcid | CR3_NOFLUSH;
+        }
+
+        if (pcid != 0) {
+            vmm_pcid_cpu[pcid] = (uint8_t)cpu;
+        }
+    }
+
+    spin_unlock_irqrestore(&vmm_pcid_lock, flags);
+    return cr3;
+}
+
 void vmm_switch_address_space(phys_addr_t pml4_phys) {
-    if (pml4_phys != 0 && pml4_phys != read_cr3()) {
-        write_cr3(pml4_phys);
+    if (pml4_phys != 0 && pml4_phys != read_cr3_addr()) {
+        write_cr3(vmm_address_space_cr3(pml4_phys));
     }
 }
 
@@ -489,125 +940,249 @@ bool vmm_map_user_page(phys_addr_t pml4_phys, virt_addr_t virt,
         return false;
     }
 
+    DBG_VMM("[VMM-U] map 0x%llx -> 0x%llx in pml4 0x%x\n",
+            (unsigned long long)virt, (unsigned long long)phys, (uint32_t)pml4_phys);
+
     /* Ensure user flag is set */
-    flags |= PTE_USER;
+    pte_t* pml4 = (pte_t*)PHYS_TO_VIRT(pml4_phys);
+    return vmm_map_range_in(pml4, ALIGN_DOWN(virt, PAGE_SIZE), ALIGN_DOWN(phys, PAGE_SIZE),
+                            PAGE_SIZE, flags | PTE_USER, true, NULL);
+}
+
+bool vmm_map_user_range(phys_addr_t pml4_phys, virt_addr_t virt, phys_addr_t phys,
+                        size_t size, uint64_t flags) {
+    virt = ALIGN_DOWN(virt, PAGE_SIZE);
+    phys = ALIGN_DOWN(phys, PAGE_SIZE);
+    size = ALIGN_UP(size, PAGE_SIZE);
+
+    /* Ensure address range is in user space */
+    if (virt >= USER_SPACE_END || size > USER_SPACE_END - virt) {
+        return false;
+    }
 
     pte_t* pml4 = (pte_t*)PHYS_TO_VIRT(pml4_phys);
+    size_t done = 0;
+    bool ok = vmm_map_range_in(pml4, virt, phys, size, flags | PTE_USER, true, &done);
 
-    /* Get indices */
-    uint64_t pml4_idx = PML4_INDEX(virt);
-    uint64_t pdpt_idx = PDPT_INDEX(virt);
-    uint64_t pd_idx = PD_INDEX(virt);
-    uint64_t pt_idx = PT_INDEX(virt);
+    if (pml4_phys == read_cr3_addr()) {
+        vmm_flush_tlb_range(virt, done);
+    } else {
+        vmm_pcid_invalidate(pml4_phys);
+    }
 
-    DBG_VMM("[VMM-U] map 0x%llx: idx=%d/%d/%d/%d pml4[%d]=0x%llx\n",
-            (unsigned long long)virt, (int)pml4_idx, (int)pdpt_idx,
-            (int)pd_idx, (int)pt_idx, (int)pml4_idx, pml4[pml4_idx]);
+    return ok;
+}
 
-    /* Walk/create PDPT - create copy if shared with kernel (no USER flag) */
-    if (!(pml4[pml4_idx] & PTE_PRESENT)) {
-        phys_addr_t new_pdpt = pmm_alloc_page();
-        if (new_pdpt == 0) {
-            return false;
-        }
-        pte_t* pdpt_ptr = (pte_t*)PHYS_TO_VIRT(new_pdpt);
-        for (int i = 0; i < 512; i++) {
-            pdpt_ptr[i] = 0;
-        }
-        pml4[pml4_idx] = new_pdpt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-    } else if (!(pml4[pml4_idx] & PTE_USER)) {
-        /* Entry copied from kernel - create a copy with USER flag */
-        DBG_VMM("[VMM-U] Copying PDPT (pml4[%d] has no USER)\n", (int)pml4_idx);
-        phys_addr_t old_pdpt_phys = PTE_GET_ADDR(pml4[pml4_idx]);
-        phys_addr_t new_pdpt = pmm_alloc_page();
-        if (new_pdpt == 0) {
-            return false;
-        }
-        pte_t* old_pdpt = (pte_t*)PHYS_TO_VIRT(old_pdpt_phys);
-        pte_t* new_pdpt_ptr = (pte_t*)PHYS_TO_VIRT(new_pdpt);
-        for (int i = 0; i < 512; i++) {
-            new_pdpt_ptr[i] = old_pdpt[i];
-        }
-        pml4[pml4_idx] = new_pdpt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-        DBG_VMM("[VMM-U] pml4[%d] now = 0x%llx\n", (int)pml4_idx, pml4[pml4_idx]);
+bool vmm_unmap_user_page(phys_addr_t pml4_phys, virt_addr_t virt) {
+    if (virt >= USER_SPACE_END) {
+        return false;
     }
 
-    pte_t* pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pml4[pml4_idx]));
+    virt = ALIGN_DOWN(virt, PAGE_SIZE);
+    pte_t* pte = vmm_user_pte(pml4_phys, virt);
+    if (!pte || (*pte & (PTE_PRESENT | PTE_USER)) != (PTE_PRESENT | PTE_USER)) {
+        return false;
+    }
 
-    /* Walk/create PD - create copy if shared with kernel (no USER flag) */
-    if (!(pdpt[pdpt_idx] & PTE_PRESENT)) {
-        phys_addr_t new_pd = pmm_alloc_page();
-        if (new_pd == 0) {
-            return false;
-        }
-        pte_t* pd_ptr = (pte_t*)PHYS_TO_VIRT(new_pd);
-        for (int i = 0; i < 512; i++) {
-            pd_ptr[i] = 0;
-        }
-        pdpt[pdpt_idx] = new_pd | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-    } else if (!(pdpt[pdpt_idx] & PTE_USER)) {
-        /* Entry copied from kernel - create a copy with USER flag */
-        DBG_VMM("[VMM-U] Copying PD (pdpt[%d] has no USER)\n", (int)pdpt_idx);
-        phys_addr_t old_pd_phys = PTE_GET_ADDR(pdpt[pdpt_idx]);
-        phys_addr_t new_pd = pmm_alloc_page();
-        if (new_pd == 0) {
-            return false;
-        }
-        pte_t* old_pd = (pte_t*)PHYS_TO_VIRT(old_pd_phys);
-        pte_t* new_pd_ptr = (pte_t*)PHYS_TO_VIRT(new_pd);
-        for (int i = 0; i < 512; i++) {
-            new_pd_ptr[i] = old_pd[i];
-        }
-        pdpt[pdpt_idx] = new_pd | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-        DBG_VMM("[VMM-U] pdpt[%d] now = 0x%llx\n", (int)pdpt_idx, pdpt[pdpt_idx]);
+    phys_addr_t phys = PTE_GET_ADDR(*pte);
+    bool owned = !(*pte & PTE_SHARED);
+    *pte = 0;
+    if (pml4_phys == read_cr3_addr()) {
+        vmm_flush_tlb(virt);
+    } else {
+        vmm_pcid_invalidate(pml4_phys);
+    }
+    if (owned) {
+        pmm_page_unref(phys);
     }
 
-    pte_t* pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpt[pdpt_idx]));
+    return true;
+}
 
-    DBG_VMM("[VMM-U] pd[%d] = 0x%llx (HUGE=%d)\n",
-            (int)pd_idx, pd[pd_idx], (pd[pd_idx] & PTE_HUGE) ? 1 : 0);
+void vmm_shootdown_user(phys_addr_t pml4_phys, virt_addr_t virt, size_t size) {
+    /* CPUs that load it later flush, CPUs running it now flush the range */
+    vmm_pcid_invalidate(pml4_phys);
+    smp_tlb_shootdown(virt, size);
+}
 
-    /* Check for 2MB huge page that needs splitting */
-    if ((pd[pd_idx] & PTE_PRESENT) && (pd[pd_idx] & PTE_HUGE)) {
-        DBG_VMM("[VMM-U] Splitting 2MB huge page at pd[%d]\n", (int)pd_idx);
-        pte_t huge_entry = pd[pd_idx];
-        phys_addr_t huge_base = PTE_GET_ADDR(huge_entry);
+phys_addr_t vmm_user_physical(phys_addr_t pml4_phys, virt_addr_t virt) {
+    if (virt >= USER_SPACE_END) {
+        return 0;
+    }
 
-        /* Allocate new PT for split 4KB pages */
-        phys_addr_t new_pt = pmm_alloc_page();
-        if (new_pt == 0) {
-            return false;
-        }
-        pte_t* pt_ptr = (pte_t*)PHYS_TO_VIRT(new_pt);
+    pte_t* pml4 = (pte_t*)PHYS_TO_VIRT(pml4_phys);
+    if (!vmm_is_user_table(pml4[PML4_INDEX(virt)])) return 0;
 
-        /* Split: map 512 x 4KB pages with USER flag for accessibility */
-        uint64_t split_flags = PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-        for (int i = 0; i < 512; i++) {
-            pt_ptr[i] = (huge_base + i * PAGE_SIZE) | split_flags;
+    pte_t* pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pml4[PML4_INDEX(virt)]));
+    if (!vmm_is_user_table(pdpt[PDPT_INDEX(virt)])) return 0;
+
+    pte_t* pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpt[PDPT_INDEX(virt)]));
+    pte_t pde = pd[PD_INDEX(virt)];
+    if (vmm_is_user_huge(pde)) {
+        return (pde & VMM_HUGE_ADDR_MASK) + (virt & (VMM_HUGE_PAGE_SIZE - 1));
+    }
+    if (!vmm_is_user_table(pde)) return 0;
+
+    pte_t pte = ((pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pde)))[PT_INDEX(virt)];
+    if ((pte & (PTE_PRESENT | PTE_USER)) != (PTE_PRESENT | PTE_USER)) {
+        return 0;
+    }
+    return PTE_GET_ADDR(pte) + PAGE_OFFSET(virt);
+}
+
+/* =============================================================================
+ * Copy-on-Write (fork)
+ * =============================================================================
+ */
+
+phys_addr_t vmm_clone_user_space(phys_addr_t src_pml4_phys) {
+    phys_addr_t dst_pml4_phys = vmm_create_address_space();
+    if (dst_pml4_phys == 0) {
+        return 0;
+    }
+
+    pte_t* src_pml4 = (pte_t*)PHYS_TO_VIRT(src_pml4_phys);
+    uint64_t shared = 0;
+
+    for (uint64_t pml4_idx = 0; pml4_idx < 256; pml4_idx++) {
+        if (!vmm_is_user_table(src_pml4[pml4_idx])) continue;
+        pte_t* pdpt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(src_pml4[pml4_idx]));
+
+        for (uint64_t pdpt_idx = 0; pdpt_idx < 512; pdpt_idx++) {
+            if (!vmm_is_user_table(pdpt[pdpt_idx])) continue;
+            pte_t* pd = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pdpt[pdpt_idx]));
+
+            for (uint64_t pd_idx = 0; pd_idx < 512; pd_idx++) {
+                if (vmm_is_user_huge(pd[pd_idx])) {
+                    if (pd[pd_idx] & PTE_WRITABLE) {
+                        /* COW works per 4KB page - split and share below */
+                        if (!vmm_split_huge_page(pd, pd_idx, vmm_table_flags(true))) {
+                            vmm_destroy_address_space(dst_pml4_phys);
+                            return 0;
+                        }
+                    } else {
+                        /* Read-only 2MB page: share it whole */
+                        virt_addr_t virt = (pml4_idx << 39) | (pdpt_idx << 30) | (pd_idx << 21);
+                        phys_addr_t base = pd[pd_idx] & VMM_HUGE_ADDR_MASK;
+                        uint64_t flags = pd[pd_idx] & ~(VMM_HUGE_ADDR_MASK | PTE_HUGE |
+                                                        PTE_ACCESSED | PTE_DIRTY);
+                        for (int i = 0; i < 512; i++) {
+                            pmm_page_ref(base + (phys_addr_t)i * PAGE_SIZE);
+                        }
+                        if (!vmm_map_range_in((pte_t*)PHYS_TO_VIRT(dst_pml4_phys), virt, base,
+                                              VMM_HUGE_PAGE_SIZE, flags, true, NULL)) {
+                            kprintf("[VMM] ERROR: Out of memory cloning address space\n");
+                            for (int i = 0; i < 512; i++) {
+                                pmm_page_unref(base + (phys_addr_t)i * PAGE_SIZE);
+                            }
+                            vmm_destroy_address_space(dst_pml4_phys);
+                            return 0;
+                        }
+                        shared += 512;
+                        continue;
+                    }
+                }
+                if (!vmm_is_user_table(pd[pd_idx])) continue;
+                pte_t* pt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pd[pd_idx]));
+
+                for (uint64_t pt_idx = 0; pt_idx < 512; pt_idx++) {
+                    pte_t pte = pt[pt_idx];
+                    if ((pte & (PTE_PRESENT | PTE_USER)) != (PTE_PRESENT | PTE_USER)) {
+                        continue;
+                    }
+
+                    /*
+                     * Writable pages turn read-only + COW on both sides. File
+                     * pages are mapped unchanged and not counted: the file
+                     * owns the frame, and MAP_SHARED writes stay shared.
+                     */
+                    bool file_page = (pte & PTE_SHARED) != 0;
+                    if ((pte & PTE_WRITABLE) && !file_page) {
+                        pte = (pte & ~PTE_WRITABLE) | PTE_COW;
+                        pt[pt_idx] = pte;
+                    }
+
+                    virt_addr_t virt = (pml4_idx << 39) | (pdpt_idx << 30) |
+                                       (pd_idx << 21) | (pt_idx << 12);
+                    phys_addr_t phys = PTE_GET_ADDR(pte);
+                    uint64_t flags = pte & ~(PTE_ADDR_MASK | PTE_ACCESSED | PTE_DIRTY);
+
+                    if (!file_page) {
+                        pmm_page_ref(phys);
+                    }
+                    if (!vmm_map_user_page(dst_pml4_phys, virt, phys, flags)) {
+                        kprintf("[VMM] ERROR: Out of memory cloning address space\n");
+                        if (!file_page) {
+                            pmm_page_unref(phys);
+                        }
+                        vmm_destroy_address_space(dst_pml4_phys);
+                        return 0;
+                    }
+                    shared++;
+                }
+            }
         }
+    }
 
-        /* Replace PD entry with pointer to new PT */
-        pd[pd_idx] = new_pt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-        vmm_flush_tlb_all();
+    /* Parent mappings just lost their write permission */
+    if (src_pml4_phys == read_cr3_addr()) {
+        vmm_flush_tlb_local();
+    } else {
+        vmm_pcid_invalidate(src_pml4_phys);
     }
 
-    /* Walk/create PT */
-    if (!(pd[pd_idx] & PTE_PRESENT)) {
-        phys_addr_t new_pt = pmm_alloc_page();
-        if (new_pt == 0) {
+    DBG_VMM("[VMM] Cloned address space 0x%x -> 0x%x (%d pages shared)\n",
+            (uint32_t)src_pml4_phys, (uint32_t)dst_pml4_phys, (uint32_t)shared);
+    (void)shared;
+
+    return dst_pml4_phys;
+}
+
+bool vmm_handle_cow_fault(virt_addr_t virt) {
+    if (virt >= USER_SPACE_END) {
+        return false;
+    }
+
+    virt = ALIGN_DOWN(virt, PAGE_SIZE);
+
+    uint64_t irq = irq_save();
+
+    pte_t* pte = vmm_user_pte(read_cr3_addr(), virt);
+    if (pte && (*pte & (PTE_PRESENT | PTE_WRITABLE | PTE_USER)) ==
+               (PTE_PRESENT | PTE_WRITABLE | PTE_USER)) {
+        /* Another thread got here first; the fault dropped our stale TLB entry */
+        irq_restore(irq);
+        return true;
+    }
+    if (!pte || (*pte & (PTE_PRESENT | PTE_COW)) != (PTE_PRESENT | PTE_COW)) {
+        irq_restore(irq);
+        return false;
+    }
+
+    phys_addr_t old_phys = PTE_GET_ADDR(*pte);
+    bool file_page = (*pte & PTE_SHARED) != 0;
+    uint64_t flags = (*pte & ~(PTE_ADDR_MASK | PTE_COW | PTE_SHARED)) | PTE_WRITABLE;
+
+    if (!file_page && pmm_page_refcount(old_phys) == 0) {
+        /* Every other sharer already has its own copy - take the frame */
+        *pte = old_phys | flags;
+    } else {
+        phys_addr_t new_phys = pmm_alloc_page();
+        if (new_phys == 0) {
+            irq_restore(irq);
+            kprintf("[VMM] ERROR: Out of memory for copy-on-write at 0x%p\n", (void*)virt);
             return false;
         }
-        pte_t* pt_ptr = (pte_t*)PHYS_TO_VIRT(new_pt);
-        for (int i = 0; i < 512; i++) {
-            pt_ptr[i] = 0;
+
+        memcpy(PHYS_TO_VIRT(new_phys), PHYS_TO_VIRT(old_phys), PAGE_SIZE);
+        *pte = new_phys | flags;
+        if (!file_page) {
+            pmm_page_unref(old_phys);
         }
-        pd[pd_idx] = new_pt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
     }
 
-    pte_t* pt = (pte_t*)PHYS_TO_VIRT(PTE_GET_ADDR(pd[pd_idx]));
-
-    /* Map the page */
-    pt[pt_idx] = (phys & PTE_ADDR_MASK) | flags;
+    vmm_flush_tlb(virt);
+    irq_restore(irq);
 
     return true;
 }
@@ -0,0 +1,190 @@
+/**
+ * =============================================================================
+ * Chanux OS - Futexes Implementation
+ * =============================================================================
+ * Waiters are kept in FUTEX_HASH_SIZE buckets hashed from the physical
+ * address of their word. Each bucket is a FIFO list of futex_waiter_t
+ * (on the waiter's kernel stack) with its own lock; unrelated futexes in
+ * one bucket just share that lock.
+ *
+ * futex_wait() queues itself and marks itself BLOCKED under the bucket
+ * lock, then re-reads the word through the kernel mapping of its frame.
+ * A waker changes the word before calling futex_wake(), which takes the
+ * same lock, so either the waiter sees the new value or it is already
+ * queued and gets woken.
+ *
+ * A waker unlinks each waiter it wakes, and a waiter always takes the
+ * bucket lock once more before returning, so a waker never touches a
+ * waiter_t that has gone out of scope.
+ *
+ * Lock order: bucket lock, then process_lock (process_wake() and
+ * process_prepare_block()), as for wait queues.
+ * =============================================================================
+ */
+
+#include "../include/proc/futex.h"
+#include "../include/proc/process.h"
+#include "../include/proc/sched.h"
+#include "../include/mm/vmm.h"
+#include "../include/user/uaccess.h"
+#include "../include/syscall/syscall.h"
+#include "../include/spinlock.h"
+#include "../include/kernel.h"
+
+typedef struct futex_waiter {
+    struct futex_waiter*    next;
+    struct futex_waiter*    prev;
+    process_t*              proc;           /* Waiting process */
+    phys_addr_t             key;            /* Physical address of the word */
+    bool                    queued;         /* Linked into its bucket */
+} futex_waiter_t;
+
+typedef struct futex_bucket {
+    spinlock_t              lock;
+    futex_waiter_t*         head;           /* Oldest waiter */
+    futex_waiter_t*         tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_buckets[FUTEX_HASH_SIZE];
+
+/* =============================================================================
+ * Helpers
+ * =============================================================================
+ */
+
+static futex_bucket_t* futex_bucket(phys_addr_t key) {
+    /* Fibonacci hashing of the word index: neighbouring words spread out */
+    uint64_t hash = (key >> 2) * 0x9E3779B97F4A7C15ULL;
+    return &futex_buckets[hash >> (64 - FUTEX_HASH_BITS)];
+}
+
+static void futex_link(futex_bucket_t* b, futex_waiter_t* w) {
+    w->next = NULL;
+    w->prev = b->tail;
+
+    if (b->tail) {
+        b->tail->next = w;
+    } else {
+        b->head = w;
+    }
+    b->tail = w;
+    w->queued = true;
+}
+
+static void futex_unlink(futex_bucket_t* b, futex_waiter_t* w) {
+    if (w->prev) {
+        w->prev->next = w->next;
+    } else {
+        b->head = w->next;
+    }
+
+    if (w->next) {
+        w->next->prev = w->prev;
+    } else {
+        b->tail = w->prev;
+    }
+
+    w->next = NULL;
+    w->prev = NULL;
+    w->queued = false;
+}
+
+/* Key of a word the caller has just written (interrupts disabled) */
+static phys_addr_t futex_key(uint32_t* uaddr) {
+    return vmm_user_physical(process_current()->pml4_phys, (virt_addr_t)uaddr);
+}
+
+/* =============================================================================
+ * Futex API
+ * =============================================================================
+ */
+
+int64_t futex_wait(uint32_t* uaddr, uint32_t val) {
+    uint32_t cur;
+
+    /* Write access first: resolves demand-zero and copy-on-write (may sleep) */
+    int err = cmpxchg_user_u32(uaddr, val, val, &cur);
+    if (err < 0) {
+        return err;
+    }
+    if (cur != val) {
+        return -EAGAIN;
+    }
+
+    uint64_t irq = irq_save();
+
+    phys_addr_t key = futex_key(uaddr);
+    if (key == 0) {
+        irq_restore(irq);
+        return -EFAULT;
+    }
+
+    futex_bucket_t* b = futex_bucket(key);
+    futex_waiter_t w = { 0 };
+    w.proc = process_current();
+    w.key = key;
+
+    spin_lock(&b->lock);
+    futex_link(b, &w);
+    process_prepare_block();
+    bool changed = *(volatile uint32_t*)PHYS_TO_VIRT(key) != val;
+    spin_unlock(&b->lock);
+
+    if (changed) {
+        process_cancel_block();
+    } else {
+        schedule();
+    }
+
+    /* Woken by anything other than futex_wake(), we are still queued */
+    spin_lock(&b->lock);
+    if (w.queued) {
+        futex_unlink(b, &w);
+    }
+    spin_unlock(&b->lock);
+
+    irq_restore(irq);
+    return changed ? -EAGAIN : 0;
+}
+
+int64_t futex_wake(uint32_t* uaddr, int count) {
+    uint32_t cur;
+
+    /* Same write access as futex_wait(), so both end up on the same frame */
+    int err = cmpxchg_user_u32(uaddr, 0, 0, &cur);
+    if (err < 0) {
+        return err;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+
+    uint64_t irq = irq_save();
+
+    phys_addr_t key = futex_key(uaddr);
+    if (key == 0) {
+        irq_restore(irq);
+        return -EFAULT;
+    }
+
+    futex_bucket_t* b = futex_bucket(key);
+    int woken = 0;
+
+    spin_lock(&b->lock);
+    futex_waiter_t* w = b->head;
+    while (w && woken < count) {
+        futex_waiter_t* next = w->next;
+        if (w->key == key) {
+            process_t* proc = w->proc;
+            futex_unlink(b, w);
+            if (process_wake(proc)) {
+                woken++;
+            }
+        }
+        w = next;
+    }
+    spin_unlock(&b->lock);
+
+    irq_restore(irq);
+    return woken;
+}
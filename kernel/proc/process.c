@@ -7,22 +7,46 @@
  * Process Table:
  *   - Fixed array of MAX_PROCESSES PCBs
  *   - PID 0 reserved for idle process
- *   - Linear scan for free slots (simple but O(n))
+ *   - Free slots are kept on a list, so taking one is O(1)
  *
  * Stack Setup:
- *   - Each process gets KERNEL_STACK_SIZE bytes
+ *   - Each slot owns KERNEL_STACK_SIZE bytes in the MM_KSTACK_VIRT window,
+ *     above an unmapped guard page; they are mapped on the slot's first
+ *     use and kept when it is recycled
  *   - Stack grows downward (high to low addresses)
  *   - Initial stack frame set up for context_switch to "return" to
+ *
+ * Reaper:
+ *   - process_exit() only closes files and queues the process; a kernel
+ *     process collects the queue in batches once each process is off its
+ *     CPU, frees the address space of a group's last thread and puts the
+ *     slot back on the free list
+ *
+ * SMP:
+ *   - Every CPU has its own idle process; the running process is
+ *     cpu_this()->current
+ *   - process_lock covers slot allocation and the BLOCKED -> READY
+ *     transitions, which other CPUs (and the timer) may make
  * =============================================================================
  */
 
 #include "../include/proc/process.h"
 #include "../include/proc/sched.h"
+#include "../include/proc/timer.h"
+#include "../include/proc/wait.h"
 #include "../include/mm/heap.h"
+#include "../include/mm/pmm.h"
+#include "../include/mm/vmm.h"
 #include "../include/kernel.h"
 #include "../include/fs/file.h"
+#include "../include/fs/vfs.h"
+#include "../include/user/user.h"
+#include "../include/user/elf.h"
 #include "../drivers/vga/vga.h"
 #include "../include/gdt.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/fpu.h"
 
 /* =============================================================================
  * Static Data
@@ -35,8 +59,20 @@ static process_t process_table[MAX_PROCESSES];
 /* Next PID to assign */
 static pid_t next_pid = 0;
 
-/* Currently running process */
-static process_t* current_process = NULL;
+/* Slot allocation, PIDs and wake-ups */
+static spinlock_t process_lock = SPINLOCK_INIT;
+
+/* Unused PCB slots, linked through reap_next (process_lock) */
+static process_t* free_slots = NULL;
+
+/* TERMINATED processes not yet collected (process_lock) */
+static process_t* reap_list = NULL;
+static wait_queue_t reaper_wq = WAIT_QUEUE_INIT(reaper_wq);
+
+/* Kernel stack slot: guard page, then the stack */
+#define KSTACK_STRIDE       (PAGE_SIZE + KERNEL_STACK_SIZE)
+
+static void process_sleep_expired(void* arg);
 
 /* Process state names for debugging */
 const char* process_state_names[] = {
@@ -53,16 +89,60 @@ const char* process_state_names[] = {
  */
 
 /**
- * Find a free slot in the process table.
+ * Take a slot off the free list (process_lock held).
  * Returns NULL if no free slots available.
  */
-static process_t* find_free_slot(void) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_STATE_UNUSED) {
-            return &process_table[i];
+static process_t* alloc_slot(void) {
+    process_t* proc = free_slots;
+    if (proc) {
+        free_slots = proc->reap_next;
+        proc->reap_next = NULL;
+    }
+    return proc;
+}
+
+/**
+ * Put a slot back on the free list (process_lock held).
+ */
+static void free_slot(process_t* proc) {
+    proc->state = PROCESS_STATE_UNUSED;
+    proc->reap_next = free_slots;
+    free_slots = proc;
+}
+
+/**
+ * Give a slot its kernel stack.
+ *
+ * A recycled slot still has its stack mapped; a fresh one gets its pages
+ * now. Pages mapped before a failure are kept for the next attempt.
+ *
+ * @return true once the whole stack is mapped
+ */
+static bool kstack_map(process_t* proc) {
+    if (proc->kernel_stack) {
+        return true;
+    }
+
+    uint64_t slot = (uint64_t)(proc - process_table);
+    virt_addr_t base = MM_KSTACK_VIRT_START + slot * KSTACK_STRIDE + PAGE_SIZE;
+
+    for (virt_addr_t page = base; page < base + KERNEL_STACK_SIZE; page += PAGE_SIZE) {
+        if (vmm_is_mapped(page)) {
+            continue;
+        }
+        phys_addr_t frame = pmm_alloc_page();
+        if (frame == 0) {
+            return false;
+        }
+        if (!vmm_map_page(page, frame, PTE_KERNEL_RW | PTE_NX)) {
+            pmm_free_page(frame);
+            return false;
         }
     }
-    return NULL;
+
+    proc->kernel_stack = (void*)base;
+    proc->kernel_stack_top = (base + KERNEL_STACK_SIZE) & ~0xFULL;
+    return true;
 }
 
 /**
@@ -110,70 +190,115 @@ static void setup_initial_stack(process_t* proc) {
     proc->rsp = (uint64_t)stack;
 }
 
+/**
+ * Wait until every other thread of a group is off its CPU.
+ *
+ * They have all exited, but one may still be switching away on another
+ * CPU with the group's page tables loaded.
+ */
+static void process_wait_group_off_cpu(process_t* leader) {
+    process_t* current = process_current();
+
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* p = &process_table[i];
+        if (p == current || p->state == PROCESS_STATE_UNUSED || p->group != leader) {
+            continue;
+        }
+        while (__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE)) {
+            cpu_pause();
+        }
+    }
+}
+
 /* =============================================================================
  * Idle Process
  * =============================================================================
  */
 
 /**
- * Idle process entry point.
+ * Idle loop.
  * Runs when no other process is ready.
- * Just halts the CPU until the next interrupt.
+ * Tops up the pre-zeroed page cache and wakes klogd if needed, then halts
+ * until the next interrupt
+ * (see sched_idle()).
  */
-static void idle_process_entry(void* arg) {
-    (void)arg;
-
+NORETURN void process_idle_loop(void) {
     for (;;) {
-        /* Enable interrupts and halt until next interrupt */
-        halt();
+        /* Clear a batch of free frames for pmm_alloc_page_zeroed() */
+        pmm_pcp_zero_idle();
+
+        /* Hand klogd what was logged with interrupts off */
+        klog_tick();
+
+        /* Run anything that became ready, else halt until an interrupt */
+        sched_idle();
     }
 }
 
-/* =============================================================================
- * Process Management API Implementation
- * =============================================================================
- */
+/* Idle process entry point (boot CPU; APs enter the loop directly) */
+static void idle_process_entry(void* arg) {
+    (void)arg;
+    process_idle_loop();
+}
 
 /**
- * Initialize the process management subsystem.
+ * Create the idle process for a CPU.
  */
-void process_init(void) {
-    /* Clear process table */
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_table[i].state = PROCESS_STATE_UNUSED;
-        process_table[i].pid = 0;
-        process_table[i].kernel_stack = NULL;
-        process_table[i].fd_table = NULL;
-        process_table[i].cwd[0] = '/';
-        process_table[i].cwd[1] = '\0';
-    }
+process_t* process_create_idle(uint32_t cpu) {
+    uint64_t flags = spin_lock_irqsave(&process_lock);
 
-    /* Reset PID counter */
-    next_pid = 0;
+    process_t* idle = alloc_slot();
+    if (!idle) {
+        spin_unlock_irqrestore(&process_lock, flags);
+        return NULL;
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
 
-    /* Create idle process (PID 0) */
-    process_t* idle = &process_table[0];
+    /* Allocate kernel stack for idle process */
+    if (!kstack_map(idle)) {
+        flags = spin_lock_irqsave(&process_lock);
+        free_slot(idle);
+        spin_unlock_irqrestore(&process_lock, flags);
+        return NULL;
+    }
 
+    flags = spin_lock_irqsave(&process_lock);
     idle->pid = next_pid++;
-    str_copy(idle->name, "idle", PROCESS_NAME_MAX);
     idle->state = PROCESS_STATE_READY;
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    /* "idle" on the boot CPU, "idle/N" elsewhere */
+    str_copy(idle->name, "idle", PROCESS_NAME_MAX);
+    if (cpu > 0) {
+        char* p = idle->name + 4;
+        *p++ = '/';
+        if (cpu >= 10) {
+            *p++ = (char)('0' + cpu / 10);
+        }
+        *p++ = (char)('0' + cpu % 10);
+        *p = '\0';
+    }
+
     idle->flags = PROCESS_FLAG_KERNEL | PROCESS_FLAG_IDLE;
-    idle->priority = 0;  /* Lowest priority */
+    idle->priority = SCHED_PRIORITY_LOWEST;  /* Never queued anyway */
     idle->time_slice = DEFAULT_TIME_SLICE;
     idle->total_ticks = 0;
     idle->exit_code = 0;
     idle->parent_pid = 0;
+    idle->cpu = cpu;
+    idle->last_ran = 0;
+    idle->on_cpu = false;
+    idle->fpu_state = NULL;
+    idle->fpu_cpu = PROCESS_FPU_CPU_NONE;
     idle->next = NULL;
     idle->prev = NULL;
-
-    /* Allocate kernel stack for idle process */
-    idle->kernel_stack = kmalloc(KERNEL_STACK_SIZE);
-    if (!idle->kernel_stack) {
-        PANIC("Failed to allocate idle process stack");
-    }
-
-    /* Calculate stack top (stack grows downward, must be 16-byte aligned) */
-    idle->kernel_stack_top = ((uint64_t)idle->kernel_stack + KERNEL_STACK_SIZE) & ~0xFULL;
+    idle->pml4_phys = 0;
+    idle->image = NULL;
+    idle->group = idle;
+    idle->tgid = idle->pid;
+    idle->thread_slot = 0;
+    idle->group_threads = 1;
+    idle->thread_slots = 0;
 
     /* Set up entry point */
     idle->entry = idle_process_entry;
@@ -183,15 +308,59 @@ void process_init(void) {
     setup_initial_stack(idle);
 
     /* Initialize file descriptor table for idle process */
+    flags = vfs_lock();
     idle->fd_table = fd_table_create();
     if (idle->fd_table) {
         fd_init_stdio(idle->fd_table);
     }
+    vfs_unlock(flags);
     idle->cwd[0] = '/';
     idle->cwd[1] = '\0';
+    idle->cwd_vnode = NULL;
+
+    return idle;
+}
+
+/* =============================================================================
+ * Process Management API Implementation
+ * =============================================================================
+ */
+
+/**
+ * Initialize the process management subsystem.
+ */
+void process_init(void) {
+    if (MAX_PROCESSES * KSTACK_STRIDE > MM_KSTACK_VIRT_MAX - MM_KSTACK_VIRT_START) {
+        PANIC("Kernel stack window too small for MAX_PROCESSES");
+    }
+
+    /* Clear process table; slot 0 ends up first on the free list */
+    free_slots = NULL;
+    reap_list = NULL;
+    for (int i = MAX_PROCESSES - 1; i >= 0; i--) {
+        process_table[i].state = PROCESS_STATE_UNUSED;
+        process_table[i].pid = 0;
+        process_table[i].kernel_stack = NULL;
+        process_table[i].fd_table = NULL;
+        process_table[i].cwd[0] = '/';
+        process_table[i].cwd[1] = '\0';
+        process_table[i].cwd_vnode = NULL;
+        process_table[i].reap_next = free_slots;
+        free_slots = &process_table[i];
+    }
+
+    /* Reset PID counter */
+    next_pid = 0;
+
+    /* Create the boot CPU's idle process (PID 0) */
+    process_t* idle = process_create_idle(0);
+    if (!idle) {
+        PANIC("Failed to allocate idle process stack");
+    }
 
     /* Idle process is special - it's the initial current process */
-    current_process = idle;
+    cpu_this()->idle = idle;
+    cpu_this()->current = idle;
 
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[PROC] ");
@@ -203,53 +372,63 @@ void process_init(void) {
  * Create a new kernel process.
  */
 pid_t process_create(const char* name, void (*entry)(void*), void* arg) {
-    /* Disable interrupts during process creation */
-    cli();
+    process_t* current = process_current();
 
-    /* Find a free PCB slot */
-    process_t* proc = find_free_slot();
+    /* Take a free PCB slot; nobody else sees it until it is queued */
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    process_t* proc = alloc_slot();
+    spin_unlock_irqrestore(&process_lock, flags);
     if (!proc) {
-        sti();
         kprintf("[PROC] Error: No free process slots\n");
         return (pid_t)-1;
     }
 
-    /* Clean up any old kernel stack from previous use of this slot */
-    if (proc->kernel_stack) {
-        kfree(proc->kernel_stack);
-        proc->kernel_stack = NULL;
-    }
-
-    /* Clean up any old fd_table from previous use of this slot */
-    if (proc->fd_table) {
-        fd_table_destroy(proc->fd_table);
-        proc->fd_table = NULL;
-    }
-
-    /* Allocate kernel stack */
-    void* stack = kmalloc(KERNEL_STACK_SIZE);
-    if (!stack) {
-        sti();
+    /* Map its kernel stack unless the slot kept one from a previous use */
+    if (!kstack_map(proc)) {
+        flags = spin_lock_irqsave(&process_lock);
+        free_slot(proc);
+        spin_unlock_irqrestore(&process_lock, flags);
         kprintf("[PROC] Error: Failed to allocate stack for '%s'\n", name);
         return (pid_t)-1;
     }
 
     /* Initialize PCB */
-    proc->pid = next_pid++;
     str_copy(proc->name, name ? name : "unnamed", PROCESS_NAME_MAX);
-    proc->state = PROCESS_STATE_READY;
     proc->flags = PROCESS_FLAG_KERNEL;
-    proc->priority = 1;  /* Default priority */
-    proc->time_slice = DEFAULT_TIME_SLICE;
+    proc->priority = SCHED_PRIORITY_DEFAULT;
+    proc->time_slice = sched_time_slice(proc->priority);
     proc->total_ticks = 0;
     proc->exit_code = 0;
-    proc->parent_pid = current_process ? current_process->pid : 0;
+    proc->parent_pid = current ? current->pid : 0;
+    proc->cpu = sched_select_cpu();
+    proc->last_ran = 0;
+    proc->on_cpu = false;
+    proc->fpu_state = NULL;
+    proc->fpu_cpu = PROCESS_FPU_CPU_NONE;
+    proc->wake_time = 0;
+    timer_init(&proc->sleep_timer, process_sleep_expired, proc);
     proc->next = NULL;
     proc->prev = NULL;
 
-    /* Set up stack */
-    proc->kernel_stack = stack;
-    proc->kernel_stack_top = ((uint64_t)stack + KERNEL_STACK_SIZE) & ~0xFULL;
+    /* No address space of its own until a user-mode creator installs one */
+    proc->pml4_phys = 0;
+    proc->user_stack = NULL;
+    proc->user_stack_top = 0;
+    proc->user_code = NULL;
+    proc->user_code_size = 0;
+    proc->image = NULL;
+    proc->region_count = 0;
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        proc->mmaps[i].vnode = NULL;
+    }
+    proc->io_ring = NULL;
+
+    /* A group of its own until user_thread_create() says otherwise */
+    proc->group = proc;
+    proc->thread_slot = 0;
+    proc->group_threads = 1;
+    proc->thread_slots = 0;
+    spin_init(&proc->vm_lock);
 
     /* Set up entry point */
     proc->entry = entry;
@@ -259,29 +438,39 @@ pid_t process_create(const char* name, void (*entry)(void*), void* arg) {
     setup_initial_stack(proc);
 
     /* Initialize file descriptor table */
+    uint64_t irq = vfs_lock();
     proc->fd_table = fd_table_create();
     if (proc->fd_table) {
         fd_init_stdio(proc->fd_table);
     }
 
     /* Set current working directory (inherit from parent or use root) */
-    if (current_process && current_process->cwd[0]) {
-        str_copy(proc->cwd, current_process->cwd, CWD_MAX);
+    if (current && current->cwd[0]) {
+        str_copy(proc->cwd, current->cwd, CWD_MAX);
+        proc->cwd_vnode = current->cwd_vnode;
+        vnode_ref(proc->cwd_vnode);
     } else {
         proc->cwd[0] = '/';
         proc->cwd[1] = '\0';
+        proc->cwd_vnode = NULL;
     }
+    vfs_unlock(irq);
 
-    /* Add to scheduler's run queue */
+    /* Give it a PID and add it to the scheduler's run queue */
+    flags = spin_lock_irqsave(&process_lock);
+    pid_t pid = next_pid++;
+    proc->pid = pid;
+    proc->tgid = pid;
+    proc->state = PROCESS_STATE_READY;
     sched_add(proc);
+    spin_unlock_irqrestore(&process_lock, flags);
 
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[PROC] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    kprintf("Created process '%s' (PID %d)\n", proc->name, (int)proc->pid);
+    kprintf("Created process '%s' (PID %d)\n", name ? name : "unnamed", (int)pid);
 
-    sti();
-    return proc->pid;
+    return pid;
 }
 
 /**
@@ -290,6 +479,7 @@ pid_t process_create(const char* name, void (*entry)(void*), void* arg) {
 NORETURN void process_exit(int exit_code) {
     cli();
 
+    process_t* current_process = process_current();
     if (!current_process) {
         PANIC("process_exit called with no current process");
     }
@@ -305,21 +495,52 @@ NORETURN void process_exit(int exit_code) {
     kprintf("Process '%s' (PID %d) exiting with code %d\n",
             current_process->name, (int)current_process->pid, exit_code);
 
-    /* Clean up file descriptor table */
+    /* Drop our reference on the (possibly shared) descriptor table */
     if (current_process->fd_table) {
-        fd_table_destroy(current_process->fd_table);
+        uint64_t irq = vfs_lock();
+        fd_table_unref(current_process->fd_table);
+        vfs_unlock(irq);
         current_process->fd_table = NULL;
     }
+    if (current_process->cwd_vnode) {
+        uint64_t irq = vfs_lock();
+        vnode_unref(current_process->cwd_vnode);
+        vfs_unlock(irq);
+        current_process->cwd_vnode = NULL;
+    }
 
-    /* Mark as terminated */
-    current_process->state = PROCESS_STATE_TERMINATED;
-    current_process->exit_code = exit_code;
+    /*
+     * Leave the thread group. The last thread out leaves the address space
+     * to the reaper, which cannot free it while we still run on it.
+     */
+    if (current_process->pml4_phys) {
+        process_t* leader = current_process->group;
+        if (user_thread_leave(current_process)) {
+            current_process->flags |= PROCESS_FLAG_REAP_VM;
+        }
+
+        /* The leader's copy stays valid for its threads until the last one is out */
+        if (current_process != leader) {
+            current_process->pml4_phys = 0;
+        }
+        current_process->user_stack = NULL;
+    } else {
+        /* A kernel process is a group of one */
+        current_process->group_threads = 0;
+    }
 
     /*
-     * IMPORTANT: Do NOT free kernel_stack here!
-     * We are still running on this stack. The stack will be freed
-     * when this process slot is reused in process_create().
+     * Mark as terminated and queue for the reaper. We keep running on
+     * our kernel stack until schedule() switches away; the reaper waits
+     * for on_cpu to drop before it recycles the slot.
      */
+    spin_lock(&process_lock);
+    current_process->state = PROCESS_STATE_TERMINATED;
+    current_process->exit_code = exit_code;
+    current_process->reap_next = reap_list;
+    reap_list = current_process;
+    spin_unlock(&process_lock);
+    wake_up(&reaper_wq);
 
     /* Switch to another process (never returns for this process) */
     schedule();
@@ -329,21 +550,131 @@ NORETURN void process_exit(int exit_code) {
     for (;;) halt();
 }
 
+/* =============================================================================
+ * Reaper
+ * =============================================================================
+ */
+
+/**
+ * Release what a TERMINATED process still holds.
+ *
+ * The last thread of a group frees the group's address space. Shared
+ * copy-on-write frames only lose a reference, and file mappings and the
+ * program image are released once their frames can no longer be reached.
+ *
+ * @return false if the slot must stay (a leader whose group is not gone)
+ */
+static bool process_reap(process_t* proc) {
+    while (__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE)) {
+        cpu_pause();
+    }
+
+    /* Saved by fpu_switch_out() on the way off its CPU */
+    fpu_state_free(proc->fpu_state);
+    proc->fpu_state = NULL;
+
+    if (proc->flags & PROCESS_FLAG_REAP_VM) {
+        process_t* leader = proc->group;
+        process_wait_group_off_cpu(leader);
+        vmm_destroy_address_space(leader->pml4_phys);
+        leader->pml4_phys = 0;
+        leader->region_count = 0;
+        user_mmap_release(leader->mmaps);
+        user_image_put(leader->image);
+        leader->image = NULL;
+        proc->flags &= ~PROCESS_FLAG_REAP_VM;
+    }
+
+    /* Threads still point at the leader's regions, mmaps and vm_lock */
+    if (proc->group == proc &&
+        (__atomic_load_n(&proc->group_threads, __ATOMIC_ACQUIRE) > 0 ||
+         proc->pml4_phys != 0)) {
+        return false;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    free_slot(proc);
+    spin_unlock_irqrestore(&process_lock, flags);
+    return true;
+}
+
+/**
+ * Reaper loop: take the whole queue at once, then retry the leaders that
+ * were still waiting for their threads.
+ */
+static void process_reaper(void* arg) {
+    (void)arg;
+    process_t* deferred = NULL;
+
+    for (;;) {
+        wait_event(&reaper_wq, __atomic_load_n(&reap_list, __ATOMIC_ACQUIRE) != NULL);
+
+        uint64_t flags = spin_lock_irqsave(&process_lock);
+        process_t* batch = reap_list;
+        reap_list = NULL;
+        spin_unlock_irqrestore(&process_lock, flags);
+
+        while (batch) {
+            process_t* proc = batch;
+            batch = proc->reap_next;
+            if (!process_reap(proc)) {
+                proc->reap_next = deferred;
+                deferred = proc;
+            }
+        }
+
+        process_t* waiting = deferred;
+        deferred = NULL;
+        while (waiting) {
+            process_t* proc = waiting;
+            waiting = proc->reap_next;
+            if (!process_reap(proc)) {
+                proc->reap_next = deferred;
+                deferred = proc;
+            }
+        }
+    }
+}
+
+/**
+ * Start the reaper.
+ */
+void process_reaper_start(void) {
+    if (process_create("reaper", process_reaper, NULL) == (pid_t)-1) {
+        PANIC("Failed to create the reaper");
+    }
+}
+
+/**
+ * Find the process whose kernel stack guard page holds an address.
+ */
+process_t* process_kstack_overflow(virt_addr_t addr) {
+    if (addr < MM_KSTACK_VIRT_START ||
+        addr >= MM_KSTACK_VIRT_START + MAX_PROCESSES * KSTACK_STRIDE) {
+        return NULL;
+    }
+
+    uint64_t offset = addr - MM_KSTACK_VIRT_START;
+    if (offset % KSTACK_STRIDE >= PAGE_SIZE) {
+        return NULL;
+    }
+    return &process_table[offset / KSTACK_STRIDE];
+}
+
 /**
  * Voluntarily yield the CPU.
  */
 void process_yield(void) {
     cli();
 
-    if (!current_process) {
+    process_t* current = process_current();
+    if (!current) {
         sti();
         return;
     }
 
-    /* Reset time slice and reschedule */
-    current_process->time_slice = DEFAULT_TIME_SLICE;
-    sched_reschedule();
-    schedule();
+    /* Let anything else that is ready run first */
+    sched_yield();
 
     sti();
 }
@@ -352,14 +683,14 @@ void process_yield(void) {
  * Get the currently running process.
  */
 process_t* process_current(void) {
-    return current_process;
+    return cpu_this()->current;
 }
 
 /**
  * Set the current process (called by scheduler).
  */
 void process_set_current(process_t* proc) {
-    current_process = proc;
+    cpu_this()->current = proc;
 }
 
 /**
@@ -381,18 +712,25 @@ process_t* process_get(pid_t pid) {
 void process_block(void) {
     cli();
 
-    if (!current_process) {
+    process_t* current = process_current();
+    if (!current) {
         sti();
         return;
     }
 
     /* Can't block idle process */
-    if (current_process->flags & PROCESS_FLAG_IDLE) {
+    if (current->flags & PROCESS_FLAG_IDLE) {
         sti();
         return;
     }
 
-    current_process->state = PROCESS_STATE_BLOCKED;
+    /*
+     * A wake-up from another CPU may land between here and schedule();
+     * it re-queues us on this CPU, and schedule() then picks us again.
+     */
+    spin_lock(&process_lock);
+    current->state = PROCESS_STATE_BLOCKED;
+    spin_unlock(&process_lock);
     schedule();
 
     sti();
@@ -402,16 +740,52 @@ void process_block(void) {
  * Unblock a process.
  */
 void process_unblock(pid_t pid) {
-    cli();
+    process_wake(process_get(pid));
+}
+
+/**
+ * Make a blocked process ready.
+ */
+bool process_wake(process_t* proc) {
+    bool woken = false;
+    uint64_t flags = spin_lock_irqsave(&process_lock);
 
-    process_t* proc = process_get(pid);
     if (proc && proc->state == PROCESS_STATE_BLOCKED) {
         proc->state = PROCESS_STATE_READY;
-        proc->time_slice = DEFAULT_TIME_SLICE;
         sched_add(proc);
+        woken = true;
     }
 
-    sti();
+    spin_unlock_irqrestore(&process_lock, flags);
+    return woken;
+}
+
+/**
+ * Mark the current process BLOCKED but keep running.
+ */
+void process_prepare_block(void) {
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    process_current()->state = PROCESS_STATE_BLOCKED;
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+/**
+ * Undo process_prepare_block().
+ */
+void process_cancel_block(void) {
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    process_t* current = process_current();
+
+    /*
+     * Woken in the meantime: sched_add() queued us although we never left
+     * the CPU. Take us back out, or we could be picked while blocked later.
+     */
+    if (current->state == PROCESS_STATE_READY) {
+        sched_remove(current);
+    }
+    current->state = PROCESS_STATE_RUNNING;
+
+    spin_unlock_irqrestore(&process_lock, flags);
 }
 
 /**
@@ -436,23 +810,56 @@ uint32_t process_count(int state) {
 }
 
 /**
- * Wake sleeping processes whose wake_tick has passed.
+ * Get the PCB in a process table slot.
  */
-void process_wake_sleeping(uint64_t current_tick) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t* proc = &process_table[i];
-        /* Check if process is blocked and has a wake_tick set */
-        if (proc->state == PROCESS_STATE_BLOCKED && proc->wake_tick > 0) {
-            /* Check if it's time to wake up */
-            if (current_tick >= proc->wake_tick) {
-                /* Unblock the process */
-                proc->state = PROCESS_STATE_READY;
-                proc->wake_tick = 0;
-                proc->time_slice = DEFAULT_TIME_SLICE;
-                sched_add(proc);
-            }
-        }
+process_t* process_get_slot(uint32_t slot) {
+    if (slot >= MAX_PROCESSES || process_table[slot].state == PROCESS_STATE_UNUSED) {
+        return NULL;
+    }
+    return &process_table[slot];
+}
+
+/**
+ * Sleep timer callback: wake the process if it is still asleep.
+ */
+static void process_sleep_expired(void* arg) {
+    process_t* proc = (process_t*)arg;
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+
+    if (proc->state == PROCESS_STATE_BLOCKED && proc->wake_time > 0) {
+        proc->state = PROCESS_STATE_READY;
+        proc->wake_time = 0;
+        sched_add(proc);
     }
+
+    spin_unlock_irqrestore(&process_lock, flags);
+}
+
+/**
+ * Block the current process until a given time.
+ */
+void process_sleep(uint64_t wake_time) {
+    cli();
+
+    process_t* current = process_current();
+    if (!current || (current->flags & PROCESS_FLAG_IDLE)) {
+        sti();
+        return;
+    }
+
+    /*
+     * Block and arm under process_lock: the callback takes it too, so it
+     * cannot run before we are BLOCKED and lose the wake-up.
+     */
+    spin_lock(&process_lock);
+    current->wake_time = wake_time;
+    current->state = PROCESS_STATE_BLOCKED;
+    timer_add(&current->sleep_timer, wake_time);
+    spin_unlock(&process_lock);
+
+    schedule();
+
+    sti();
 }
 
 /**
@@ -462,6 +869,9 @@ void process_wake_sleeping(uint64_t current_tick) {
  * We enable interrupts, call the actual entry point, and exit on return.
  */
 void process_entry_wrapper(void) {
+    /* We got here through context_switch(): let go of the previous process */
+    sched_finish_switch();
+
     /* Enable interrupts for this process */
     sti();
 
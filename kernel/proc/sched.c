@@ -2,31 +2,65 @@
  * =============================================================================
  * Chanux OS - Process Scheduler Implementation
  * =============================================================================
- * Implements a preemptive round-robin scheduler.
+ * Implements a preemptive multi-level feedback queue with one run queue
+ * per CPU.
  *
  * Algorithm:
- *   - Each process gets a fixed time slice (DEFAULT_TIME_SLICE ticks)
- *   - When time slice expires, process goes to end of run queue
- *   - Next process is taken from head of run queue
- *   - If run queue is empty, idle process runs
+ *   - SCHED_PRIORITY_LEVELS levels, 0 most urgent; process_t.priority is
+ *     the level. Lower levels get longer slices (sched_time_slice())
+ *   - Using a whole slice drops a process one level; yielding or blocking
+ *     before the slice runs out lifts it one level. Interactive processes
+ *     such as the shell collect at the top; CPU hogs sink to the bottom
+ *   - A tick preempts the running process if a more urgent level has work
+ *   - Every SCHED_BOOST_TICKS, queued processes below SCHED_PRIORITY_DEFAULT
+ *     are lifted back to it so nothing starves
+ *   - If run queue is empty, the CPU's idle process runs
  *
- * Run Queue:
- *   - Doubly-linked list for O(1) add/remove
+ * Run Queues:
+ *   - One doubly-linked FIFO per level, one set per CPU (cpu_t.rq)
+ *   - A bitmap of non-empty levels makes picking the next process a
+ *     find-first-set
  *   - Add to tail, remove from head (FIFO)
- *   - Idle process is never in the queue
+ *   - Idle processes are never in a queue
+ *   - New processes go to the CPU with the shortest queue (proc->cpu).
+ *     Any CPU may add to a queue (wake-ups); the owner takes from the head
+ *
+ * Load Balancing:
+ *   - A CPU whose queue is empty steals from the tail of the busiest
+ *     queue before falling back to its idle process
+ *   - Every SCHED_BALANCE_TICKS each CPU pulls one process from the
+ *     busiest queue if that queue is longer than its own by two or more,
+ *     passing over processes that ran within SCHED_CACHE_HOT_TICKS
+ *     (their working set is likely still in the other CPU's caches)
+ *   - A process re-queued on its way out of schedule() is not stolen
+ *     until its context is saved: proc->on_cpu stays set until the next
+ *     process on that CPU calls sched_finish_switch()
  *
  * Preemption:
- *   - PIT timer (100Hz) calls sched_tick() on each interrupt
+ *   - Periodic mode: the PIT (100Hz) calls sched_tick() on the boot CPU,
+ *     the local APIC timer on the others
+ *   - One-shot mode (clock_oneshot()): every CPU arms its APIC timer for
+ *     the earliest of its next 10ms tick (cpu->next_tick_ns, only while a
+ *     real process runs) and, on the boot CPU, the next kernel timer.
+ *     An idle CPU with no timers sleeps until an interrupt; sched_add()
+ *     IPIs idle CPUs so they can still steal queued work
  *   - sched_tick() decrements time slice and reschedules if expired
  * =============================================================================
  */
 
 #include "../include/proc/sched.h"
 #include "../include/proc/process.h"
+#include "../include/proc/timer.h"
 #include "../include/kernel.h"
+#include "../include/clock.h"
+#include "../include/profile.h"
+#include "../include/trace.h"
+#include "../include/mm/vmm.h"
 #include "../include/gdt.h"
 #include "../include/drivers/pit.h"
 #include "../include/debug.h"
+#include "../include/smp.h"
+#include "../include/fpu.h"
 #include "../drivers/vga/vga.h"
 
 /* =============================================================================
@@ -34,67 +68,163 @@
  * =============================================================================
  */
 
-/* Run queue head and tail */
-static process_t* run_queue_head = NULL;
-static process_t* run_queue_tail = NULL;
-
 /* Scheduler state */
-static bool scheduler_running = false;
-static bool need_reschedule = false;
+static volatile bool scheduler_running = false;
+
+/*
+ * Processes in all run queues. Every queue updates it under its own lock,
+ * so it is changed atomically; sched_ready_count() reads it without
+ * walking the CPUs.
+ */
+static volatile uint32_t ready_total = 0;
 
-/* Pointer to idle process (PID 0) */
-static process_t* idle_process = NULL;
+/* Update the current process pointer in process.c */
+extern void process_set_current(process_t* proc);
 
 /* =============================================================================
- * Run Queue Management
+ * Priority Levels
  * =============================================================================
  */
 
 /**
- * Add a process to the run queue (at tail for FIFO ordering).
+ * Get the time slice for a priority level.
  */
-void sched_add(process_t* proc) {
-    if (!proc) return;
+uint32_t sched_time_slice(uint32_t priority) {
+    return SCHED_MIN_TIME_SLICE * 2 * (priority + 1);
+}
 
-    /* Don't add idle process to queue */
-    if (proc->flags & PROCESS_FLAG_IDLE) return;
+/* Move up a level after giving up the CPU early (yield, block) */
+static void sched_promote(process_t* proc) {
+    if (proc->priority > SCHED_PRIORITY_HIGHEST) {
+        proc->priority--;
+    }
+    proc->time_slice = sched_time_slice(proc->priority);
+}
 
-    /* Don't add if already in queue */
-    if (proc->next != NULL || proc->prev != NULL ||
-        proc == run_queue_head) {
-        return;
+/* Move down a level after using a whole slice */
+static void sched_demote(process_t* proc) {
+    if (proc->priority < SCHED_PRIORITY_LOWEST) {
+        proc->priority++;
     }
+    proc->time_slice = sched_time_slice(proc->priority);
+}
 
-    /* Set state to READY */
-    if (proc->state != PROCESS_STATE_READY) {
-        proc->state = PROCESS_STATE_READY;
+/* Highest non-empty level of a run queue (rq->bitmap must be non-zero) */
+static inline uint32_t rq_top_level(sched_rq_t* rq) {
+    return (uint32_t)__builtin_ctz(rq->bitmap);
+}
+
+/* =============================================================================
+ * Clock Events
+ * =============================================================================
+ */
+
+/* Is the CPU running its idle process? */
+static inline bool cpu_is_idle(cpu_t* cpu) {
+    return !cpu->current || cpu->current == cpu->idle;
+}
+
+/*
+ * Arm this CPU's one-shot clock event for the next thing it must do: its
+ * next tick while a process runs, and the next kernel timer on the boot
+ * CPU. Interrupts must be disabled.
+ */
+static void sched_program_event(cpu_t* cpu) {
+    if (!clock_oneshot()) {
+        return;
     }
 
-    /* Add to tail of queue */
-    proc->prev = run_queue_tail;
-    proc->next = NULL;
+    uint64_t deadline = UINT64_MAX;
+    if (!cpu_is_idle(cpu)) {
+        deadline = cpu->next_tick_ns;
+    }
+    if (cpu->id == 0) {
+        uint64_t expiry = timer_next_expiry();
+        if (expiry < deadline) {
+            deadline = expiry;
+        }
+    }
 
-    if (run_queue_tail) {
-        run_queue_tail->next = proc;
+    if (deadline == UINT64_MAX) {
+        clock_event_stop();
     } else {
-        /* Queue was empty */
-        run_queue_head = proc;
+        clock_event_program(deadline);
+    }
+}
+
+/* Wake an idle CPU to steal work queued behind a running process */
+static void sched_kick_idle(cpu_t* busy) {
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cpu_t* cpu = cpu_get(i);
+        /* An idle caller finds the work itself before it halts */
+        if (cpu == cpu_this()) {
+            continue;
+        }
+        if (cpu && cpu != busy && cpu_is_idle(cpu) && cpu->rq.count == 0) {
+            smp_send_reschedule(cpu);
+            return;
+        }
     }
-    run_queue_tail = proc;
 }
 
 /**
- * Remove a process from the run queue.
+ * The earliest kernel timer moved earlier: re-arm the boot CPU.
  */
-void sched_remove(process_t* proc) {
-    if (!proc) return;
+void sched_timers_changed(void) {
+    if (!scheduler_running || !clock_oneshot()) {
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    cpu_t* cpu = cpu_this();
+    if (cpu->id == 0) {
+        sched_program_event(cpu);
+    } else {
+        smp_send_reschedule(cpu_get(0));
+    }
+    irq_restore(flags);
+}
+
+/* =============================================================================
+ * Run Queue Management
+ * =============================================================================
+ */
+
+/* Run queue a process belongs on (falls back to the boot CPU) */
+static sched_rq_t* sched_rq_of(process_t* proc) {
+    cpu_t* cpu = cpu_get(proc->cpu);
+    return cpu ? &cpu->rq : &cpu_get(0)->rq;
+}
+
+/* Append a process to its level (rq->lock held) */
+static void rq_link(sched_rq_t* rq, process_t* proc) {
+    uint32_t level = proc->priority;
+
+    proc->prev = rq->tail[level];
+    proc->next = NULL;
+
+    if (rq->tail[level]) {
+        rq->tail[level]->next = proc;
+    } else {
+        /* Level was empty */
+        rq->head[level] = proc;
+        rq->bitmap |= 1U << level;
+    }
+    rq->tail[level] = proc;
+    rq->count++;
+    __atomic_fetch_add(&ready_total, 1, __ATOMIC_RELAXED);
+}
+
+/* Unlink a queued process (rq->lock held) */
+static void rq_unlink(sched_rq_t* rq, process_t* proc) {
+    uint32_t level = proc->priority;
 
     /* Update previous node's next pointer */
     if (proc->prev) {
         proc->prev->next = proc->next;
     } else {
         /* Removing head */
-        run_queue_head = proc->next;
+        rq->head[level] = proc->next;
     }
 
     /* Update next node's prev pointer */
@@ -102,51 +232,242 @@ void sched_remove(process_t* proc) {
         proc->next->prev = proc->prev;
     } else {
         /* Removing tail */
-        run_queue_tail = proc->prev;
+        rq->tail[level] = proc->prev;
+    }
+
+    if (!rq->head[level]) {
+        rq->bitmap &= ~(1U << level);
     }
 
     /* Clear the process's queue pointers */
     proc->next = NULL;
     proc->prev = NULL;
+    rq->count--;
+    __atomic_fetch_sub(&ready_total, 1, __ATOMIC_RELAXED);
+}
+
+/* Is the process on a level list? (rq->lock held) */
+static inline bool rq_contains(sched_rq_t* rq, process_t* proc) {
+    return proc->next != NULL || proc->prev != NULL ||
+           proc == rq->head[proc->priority];
 }
 
 /**
- * Pick the next process to run.
- * Removes from head of queue. Returns idle if queue empty.
+ * Add a process to its CPU's run queue (at the tail of its level).
  */
-process_t* sched_pick_next(void) {
-    if (run_queue_head != NULL) {
-        process_t* next = run_queue_head;
-
-        /* Remove from head */
-        run_queue_head = next->next;
-        if (run_queue_head) {
-            run_queue_head->prev = NULL;
-        } else {
-            run_queue_tail = NULL;
+void sched_add(process_t* proc) {
+    if (!proc) return;
+
+    /* Don't add idle process to queue */
+    if (proc->flags & PROCESS_FLAG_IDLE) return;
+
+    sched_rq_t* rq = sched_rq_of(proc);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+
+    /* Don't add if already in queue */
+    if (rq_contains(rq, proc)) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    /* Set state to READY */
+    if (proc->state != PROCESS_STATE_READY) {
+        proc->state = PROCESS_STATE_READY;
+    }
+
+    rq_link(rq, proc);
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (!scheduler_running) {
+        return;
+    }
+
+    /* Let an idle CPU know straight away rather than at its next tick */
+    cpu_t* target = cpu_get(proc->cpu);
+    if (proc->cpu != cpu_this()->id) {
+        smp_send_reschedule(target);
+    }
+
+    /* Without idle ticks, nobody would notice the queue to steal from */
+    if (clock_oneshot() && target && !cpu_is_idle(target)) {
+        sched_kick_idle(target);
+    }
+}
+
+/**
+ * Remove a process from its CPU's run queue.
+ */
+void sched_remove(process_t* proc) {
+    if (!proc) return;
+
+    sched_rq_t* rq = sched_rq_of(proc);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+
+    /* Only if queued */
+    if (rq_contains(rq, proc)) {
+        rq_unlink(rq, proc);
+    }
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/**
+ * Lift every queued process below SCHED_PRIORITY_DEFAULT back to it,
+ * so a steady stream of interactive work cannot starve CPU hogs forever.
+ */
+static void sched_boost(cpu_t* cpu) {
+    sched_rq_t* rq = &cpu->rq;
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+
+    for (uint32_t level = SCHED_PRIORITY_DEFAULT + 1; level < SCHED_PRIORITY_LEVELS; level++) {
+        while (rq->head[level]) {
+            process_t* proc = rq->head[level];
+            rq_unlink(rq, proc);
+            proc->priority = SCHED_PRIORITY_DEFAULT;
+            proc->time_slice = sched_time_slice(proc->priority);
+            rq_link(rq, proc);
+        }
+    }
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/* =============================================================================
+ * Load Balancing
+ * =============================================================================
+ */
+
+/* The other online CPU with the longest run queue, or NULL */
+static cpu_t* sched_busiest(cpu_t* self) {
+    cpu_t* busiest = NULL;
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (cpu && cpu != self && cpu->rq.count > 0 &&
+            (!busiest || cpu->rq.count > busiest->rq.count)) {
+            busiest = cpu;
+        }
+    }
+    return busiest;
+}
+
+/**
+ * Take a process from the tail of another CPU's queue.
+ * The lowest level's tail is the process that would run last there, and
+ * the coldest.
+ *
+ * @param self     Stealing CPU
+ * @param min_diff Only steal if the victim's queue is this much longer
+ * @param cold     Skip processes that ran within SCHED_CACHE_HOT_TICKS
+ * @return         The process (now assigned to self, not queued), or NULL
+ */
+static process_t* sched_steal(cpu_t* self, uint32_t min_diff, bool cold) {
+    cpu_t* victim = sched_busiest(self);
+    if (!victim || victim->rq.count < self->rq.count + min_diff) {
+        return NULL;
+    }
+
+    uint64_t now = pit_get_ticks();
+    sched_rq_t* rq = &victim->rq;
+    spin_lock(&rq->lock);
+
+    process_t* proc = NULL;
+    for (int level = SCHED_PRIORITY_LEVELS - 1; level >= 0 && !proc; level--) {
+        for (process_t* p = rq->tail[level]; p; p = p->prev) {
+            bool hot = cold && now - p->last_ran < SCHED_CACHE_HOT_TICKS;
+            if (!__atomic_load_n(&p->on_cpu, __ATOMIC_ACQUIRE) && !hot) {
+                proc = p;
+                break;
+            }
         }
+    }
 
-        next->next = NULL;
-        next->prev = NULL;
+    if (proc) {
+        rq_unlink(rq, proc);
+        proc->cpu = self->id;
+    }
+
+    spin_unlock(&rq->lock);
+
+    if (proc) {
+        DBG_SCHED("[SCHED] cpu %d took '%s' (PID %d) from cpu %d\n",
+                  self->id, proc->name, (int)proc->pid, victim->id);
+    }
+    return proc;
+}
+
+/* Periodic rebalance: pull one cache-cold process if we are much shorter */
+static void sched_balance(cpu_t* self) {
+    uint64_t flags = irq_save();
+
+    process_t* proc = sched_steal(self, 2, true);
+    if (proc) {
+        sched_add(proc);
+    }
+
+    irq_restore(flags);
+}
+
+/* =============================================================================
+ * Picking the Next Process
+ * =============================================================================
+ */
 
+/**
+ * Pick the next process to run on this CPU.
+ * Removes the head of the highest non-empty level. Returns idle if
+ * nothing is ready here or on any other CPU.
+ */
+process_t* sched_pick_next(void) {
+    cpu_t* cpu = cpu_this();
+    sched_rq_t* rq = &cpu->rq;
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+
+    if (rq->bitmap) {
+        process_t* next = rq->head[rq_top_level(rq)];
+        rq_unlink(rq, next);
+
+        spin_unlock_irqrestore(&rq->lock, flags);
         return next;
     }
 
-    /* Queue is empty - return idle process */
-    return idle_process;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    /* Queue is empty - take work from a busier CPU */
+    flags = irq_save();
+    process_t* stolen = sched_steal(cpu, 1, false);
+    irq_restore(flags);
+    if (stolen) {
+        return stolen;
+    }
+
+    /* Nothing anywhere - return idle process */
+    return cpu->idle;
 }
 
 /**
- * Get number of processes in run queue.
+ * Get number of processes in all run queues.
  */
 uint32_t sched_ready_count(void) {
-    uint32_t count = 0;
-    process_t* p = run_queue_head;
-    while (p) {
-        count++;
-        p = p->next;
+    return __atomic_load_n(&ready_total, __ATOMIC_RELAXED);
+}
+
+/**
+ * Choose a CPU for a new process (the one with the shortest run queue).
+ */
+uint32_t sched_select_cpu(void) {
+    uint32_t best = 0;
+    uint32_t best_count = 0xFFFFFFFF;
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        cpu_t* cpu = cpu_get(i);
+        if (cpu && cpu->rq.count < best_count) {
+            best = i;
+            best_count = cpu->rq.count;
+        }
     }
-    return count;
+    return best;
 }
 
 /* =============================================================================
@@ -158,35 +479,37 @@ uint32_t sched_ready_count(void) {
  * Initialize the scheduler.
  */
 void sched_init(void) {
-    /* Get the idle process (created by process_init) */
-    idle_process = process_get(0);
-    if (!idle_process) {
+    /* The boot CPU's idle process (created by process_init) */
+    if (!cpu_this()->idle) {
         PANIC("sched_init: idle process not found");
     }
 
-    /* Initialize run queue */
-    run_queue_head = NULL;
-    run_queue_tail = NULL;
-
     scheduler_running = false;
-    need_reschedule = false;
+    cpu_this()->need_reschedule = false;
+
+    timer_wheel_init();
 
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[SCHED] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    kprintf("Scheduler initialized (round-robin, %d ms quantum)\n",
-            DEFAULT_TIME_SLICE * 10);
+    kprintf("Scheduler initialized (%d-level feedback queue, %d-%d ms quanta)\n",
+            SCHED_PRIORITY_LEVELS,
+            sched_time_slice(SCHED_PRIORITY_HIGHEST) * 10,
+            sched_time_slice(SCHED_PRIORITY_LOWEST) * 10);
 }
 
 /**
- * Start the scheduler.
+ * Start the scheduler on the boot CPU.
  * This function never returns.
  */
 NORETURN void sched_start(void) {
     vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     kprintf("[SCHED] ");
     vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-    kprintf("Starting scheduler with %d ready processes\n", sched_ready_count());
+    kprintf("Starting scheduler with %d ready processes on %d CPUs\n",
+            sched_ready_count(), smp_cpu_count());
+
+    cli();
 
     /* Pick the first process to run */
     process_t* first = sched_pick_next();
@@ -194,15 +517,9 @@ NORETURN void sched_start(void) {
         PANIC("sched_start: no processes to run");
     }
 
-    /* Set scheduler as running */
-    scheduler_running = true;
-
     /* Update current process */
     first->state = PROCESS_STATE_RUNNING;
-    first->time_slice = DEFAULT_TIME_SLICE;
-
-    /* Update the current process pointer in process.c */
-    extern void process_set_current(process_t* proc);
+    first->on_cpu = true;
     process_set_current(first);
 
     vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
@@ -211,60 +528,164 @@ NORETURN void sched_start(void) {
     kprintf("Switching to first process: '%s' (PID %d)\n",
             first->name, (int)first->pid);
 
-    /* Perform initial context switch (pass CR3 for user processes) */
-    context_switch_first(first->rsp, first->kernel_stack_top, first->pml4_phys);
+    /* Go tickless if the hardware allows, before the APs start */
+    clock_start();
+    cpu_this()->next_tick_ns = clock_ns() + SCHED_TICK_NS;
+    sched_program_event(cpu_this());
+
+    /* Set scheduler as running (releases the APs) */
+    __atomic_store_n(&scheduler_running, true, __ATOMIC_RELEASE);
+
+    /* Perform initial context switch */
+    context_switch_first(first->rsp, first->kernel_stack_top,
+                         vmm_address_space_cr3(first->pml4_phys));
 
     /* Should never reach here */
     PANIC("sched_start: context_switch_first returned");
     for (;;) halt();
 }
 
+/**
+ * Enter the scheduler on an application processor.
+ * Runs on the AP's idle process; never returns.
+ */
+NORETURN void sched_start_ap(void) {
+    while (!__atomic_load_n(&scheduler_running, __ATOMIC_ACQUIRE)) {
+        smp_poll_ipi();
+        cpu_pause();
+    }
+
+    /* Pick up anything queued here while we waited */
+    sti();
+    schedule();
+    process_idle_loop();
+}
+
+/**
+ * Idle step: run whatever is ready, or sleep until an interrupt.
+ */
+void sched_idle(void) {
+    cpu_t* cpu = cpu_this();
+
+    /* With interrupts off, so a wake-up cannot slip in before the halt */
+    cli();
+
+    if (cpu->rq.count != 0 || sched_busiest(cpu) != NULL) {
+        schedule();
+        sti();
+        return;
+    }
+
+    sched_program_event(cpu);
+    safe_halt();
+}
+
+/**
+ * Reschedule IPI handler.
+ */
+void sched_handle_ipi(void) {
+    schedule();
+    sched_program_event(cpu_this());
+}
+
 /**
  * Timer tick handler.
- * Called from PIT IRQ0 at 100Hz.
+ * Called from PIT IRQ0 (boot CPU) or the local APIC timer (APs) at 100Hz,
+ * or from the local APIC one-shot event of any CPU.
  */
 void sched_tick(registers_t* regs) {
-    (void)regs;  /* Unused in current implementation */
-
     if (!scheduler_running) return;
 
-    /* Wake up any sleeping processes whose wake time has passed */
-    process_wake_sleeping(pit_get_ticks());
+    cpu_t* cpu = cpu_this();
+    bool oneshot = clock_oneshot();
+    uint64_t now = clock_ns();
 
-    process_t* current = process_current();
+    /* Run expired timers (sleeping processes, timeouts) */
+    if (cpu->id == 0) {
+        timer_tick(now);
+        klog_tick();
+    }
+
+    process_t* current = cpu->current;
     if (!current) return;
 
-    /* Account CPU time */
+    /* A timer-only event between two ticks */
+    if (oneshot && !cpu_is_idle(cpu) && now < cpu->next_tick_ns) {
+        if (cpu->need_reschedule) {
+            cpu->need_reschedule = false;
+            schedule();
+        }
+        sched_program_event(cpu);
+        return;
+    }
+    if (oneshot) {
+        cpu->next_tick_ns = now + SCHED_TICK_NS;
+    }
+
+    /* Account CPU time (and sample it, once per tick, for the profiler) */
     current->total_ticks++;
+    profile_sample(regs);
 
     /* Decrement time slice */
     if (current->time_slice > 0) {
         current->time_slice--;
     }
 
-    /* Check for preemption */
-    if (current->time_slice == 0) {
-        /* Don't preempt idle if nothing else to run */
-        if (!(current->flags & PROCESS_FLAG_IDLE) || run_queue_head != NULL) {
-            need_reschedule = true;
-        } else {
-            /* Reset idle's time slice */
-            current->time_slice = DEFAULT_TIME_SLICE;
+    if (current->flags & PROCESS_FLAG_IDLE) {
+        /* Idle runs until anything is ready, here or elsewhere */
+        current->time_slice = DEFAULT_TIME_SLICE;
+        if (cpu->rq.count != 0 || sched_busiest(cpu) != NULL) {
+            cpu->need_reschedule = true;
         }
+    } else if (current->time_slice == 0) {
+        /* Used the whole slice: drop a level (and get a longer slice) */
+        sched_demote(current);
+        cpu->need_reschedule = true;
+    } else if (cpu->rq.bitmap && rq_top_level(&cpu->rq) < current->priority) {
+        /* Something more urgent is ready: it may run for the rest of our slice */
+        cpu->need_reschedule = true;
+    }
+
+    /* Periodic priority boost */
+    if (cpu->boost_ticks == 0) {
+        cpu->boost_ticks = SCHED_BOOST_TICKS;
+        sched_boost(cpu);
+    } else {
+        cpu->boost_ticks--;
+    }
+
+    /* Periodic rebalance */
+    if (cpu->balance_ticks == 0) {
+        cpu->balance_ticks = SCHED_BALANCE_TICKS;
+        sched_balance(cpu);
+    } else {
+        cpu->balance_ticks--;
     }
 
     /* Perform context switch if needed */
-    if (need_reschedule) {
-        need_reschedule = false;
+    if (cpu->need_reschedule) {
+        cpu->need_reschedule = false;
         schedule();
     }
+
+    sched_program_event(cpu);
 }
 
 /**
  * Request a reschedule.
  */
 void sched_reschedule(void) {
-    need_reschedule = true;
+    cpu_this()->need_reschedule = true;
+}
+
+/**
+ * Give up the CPU to any other ready process.
+ */
+void sched_yield(void) {
+    uint64_t flags = irq_save();
+    cpu_this()->yielding = true;
+    schedule();
+    irq_restore(flags);
 }
 
 /**
@@ -274,41 +695,111 @@ void sched_reschedule(void) {
 void schedule(void) {
     if (!scheduler_running) return;
 
-    process_t* prev = process_current();
-    if (!prev) return;
+    uint64_t flags = irq_save();
+    cpu_t* cpu = cpu_this();
+
+    process_t* prev = cpu->current;
+    if (!prev) {
+        irq_restore(flags);
+        return;
+    }
+
+    /*
+     * A process that gives up the CPU early (yield, block) moves up a
+     * level; that is what keeps the shell ahead of CPU-bound work.
+     */
+    bool yielding = cpu->yielding;
+    cpu->yielding = false;
+    bool runnable = prev->state == PROCESS_STATE_RUNNING &&
+                    !(prev->flags & PROCESS_FLAG_IDLE);
+
+    if (yielding || prev->state == PROCESS_STATE_BLOCKED) {
+        sched_promote(prev);
+    }
+
+    /*
+     * A preempted process competes with the queue on priority. A yielding
+     * one is queued only after the pick, so anything else ready runs first.
+     */
+    if (runnable && !yielding) {
+        sched_add(prev);
+    }
 
     process_t* next = sched_pick_next();
-    if (!next) {
-        next = idle_process;
+
+    if (runnable && yielding && next != cpu->idle) {
+        sched_add(prev);
+    } else if (runnable && yielding) {
+        next = prev;
     }
 
-    DBG_SCHED("[SCHED] schedule: prev='%s' (PID %d, state=%d) -> next='%s' (PID %d)\n",
-              prev->name, (int)prev->pid, prev->state,
+    DBG_SCHED("[SCHED] schedule: cpu %d prev='%s' (PID %d, state=%d) -> next='%s' (PID %d)\n",
+              cpu->id, prev->name, (int)prev->pid, prev->state,
               next->name, (int)next->pid);
 
-    /* Same process - just reset time slice */
+    /*
+     * Same process - keep running. This also covers a process that was
+     * woken (and re-queued here) on its way into process_block().
+     */
     if (next == prev) {
-        next->time_slice = DEFAULT_TIME_SLICE;
+        next->state = PROCESS_STATE_RUNNING;
+        irq_restore(flags);
         return;
     }
 
-    /* Put previous process back in run queue if still runnable */
-    if (prev->state == PROCESS_STATE_RUNNING) {
-        prev->state = PROCESS_STATE_READY;
-        prev->time_slice = DEFAULT_TIME_SLICE;
-        sched_add(prev);
-    }
+    /*
+     * prev is back in the queue if still runnable; on_cpu keeps other
+     * CPUs from stealing it until its context is saved.
+     */
+    prev->last_ran = pit_get_ticks();
+    cpu->switched_from = prev;
 
     /* Switch to next process */
     next->state = PROCESS_STATE_RUNNING;
-    next->time_slice = DEFAULT_TIME_SLICE;
+    if (next->time_slice == 0) {
+        next->time_slice = sched_time_slice(next->priority);
+    }
+    next->cpu = cpu->id;
+    next->on_cpu = true;
 
     /* Update current process pointer */
-    extern void process_set_current(process_t* proc);
+    TRACE(TRACE_SCHED, TRACE_EV_SCHED_SWITCH, TRACE_INSTANT, prev->pid, next->pid);
     process_set_current(next);
 
-    /* Perform context switch (pass CR3 for user processes, 0 for kernel) */
-    context_switch(&prev->rsp, next->rsp, next->kernel_stack_top, next->pml4_phys);
+    /* Coming out of idle, the tick clock has stood still */
+    if (clock_oneshot()) {
+        uint64_t now = clock_ns();
+        if (cpu->next_tick_ns <= now) {
+            cpu->next_tick_ns = now + SCHED_TICK_NS;
+        }
+        sched_program_event(cpu);
+    }
+
+    /*
+     * Perform context switch. Kernel processes load the kernel page tables
+     * too: the previous process's address space may be torn down by
+     * another CPU once it is no longer live here.
+     */
+    uint64_t cr3 = vmm_address_space_cr3(next->pml4_phys);
+    fpu_switch_out(prev);
+    context_switch(&prev->rsp, next->rsp, next->kernel_stack_top, cr3);
+
+    /* Back in prev, possibly on another CPU */
+    sched_finish_switch();
+    irq_restore(flags);
+}
+
+/**
+ * Complete a context switch on the new process's side.
+ */
+void sched_finish_switch(void) {
+    cpu_t* cpu = cpu_this();
+    process_t* prev = cpu->switched_from;
+
+    if (prev) {
+        cpu->switched_from = NULL;
+        __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+    }
 }
 
 /**
@@ -319,8 +810,8 @@ bool sched_is_running(void) {
 }
 
 /**
- * Get the idle process.
+ * Get the calling CPU's idle process.
  */
 process_t* sched_get_idle(void) {
-    return idle_process;
+    return cpu_this()->idle;
 }
@@ -0,0 +1,368 @@
+/**
+ * =============================================================================
+ * Chanux OS - Kernel Timer Wheel Implementation
+ * =============================================================================
+ * Cascading timer wheel in the style of the classic Unix callout wheels.
+ *
+ * The wheel counts in units of TIMER_RES_NS (2^16 ns, ~65us); expiry
+ * times are rounded up to a whole unit so no timer fires early.
+ *
+ * wheel_clk is the next unit to process. A timer due 'delta' units after
+ * it goes into the lowest level whose span covers delta, in the slot
+ * picked by that level's bits of the expiry tick. When the low 8 bits of
+ * wheel_clk wrap to zero, the current slot of level 1 is emptied and its
+ * timers re-inserted (now landing in level 0); when level 1's index wraps
+ * too, level 2 is cascaded, and so on.
+ *
+ * Slot lists are singly linked with a back pointer to whichever pointer
+ * references the timer (the slot head or the previous timer's next), so
+ * a timer can be unlinked without knowing its slot.
+ *
+ * Tickless operation: a bitmap per level records which slots may be
+ * non-empty (bits are set on insert and cleared lazily when a scan finds
+ * the slot empty). wheel_find_next() uses them to find the first unit at
+ * which anything fires or cascades; the scheduler programs the clock
+ * event for then, and timer_tick() jumps wheel_clk straight over the
+ * empty units in between.
+ *
+ * Locking: timer_lock covers the wheel. Callbacks are run with it
+ * released, so they may re-arm timers and take the process lock
+ * (lock order: process_lock -> timer_lock).
+ * =============================================================================
+ */
+
+#include "../include/proc/timer.h"
+#include "../include/proc/sched.h"
+#include "../include/clock.h"
+#include "../include/kernel.h"
+#include "../include/spinlock.h"
+
+/* =============================================================================
+ * Wheel Geometry
+ * =============================================================================
+ */
+
+#define TIMER_RES_SHIFT     16
+#define TIMER_RES_NS        (1ULL << TIMER_RES_SHIFT)
+
+#define TIMER_L0_BITS       8
+#define TIMER_LN_BITS       6
+#define TIMER_L0_SIZE       (1U << TIMER_L0_BITS)      /* 256 */
+#define TIMER_LN_SIZE       (1U << TIMER_LN_BITS)      /* 64 */
+#define TIMER_L0_MASK       (TIMER_L0_SIZE - 1)
+#define TIMER_LN_MASK       (TIMER_LN_SIZE - 1)
+#define TIMER_UPPER_LEVELS  4
+
+/* Shift of level n's index bits (n >= 1) */
+#define TIMER_SHIFT(n)      (TIMER_L0_BITS + ((n) - 1) * TIMER_LN_BITS)
+
+/* Furthest a timer can be placed ahead of wheel_clk */
+#define TIMER_MAX_DELTA     ((1ULL << TIMER_SHIFT(TIMER_UPPER_LEVELS + 1)) - 1)
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static ktimer_t* wheel_l0[TIMER_L0_SIZE];
+static ktimer_t* wheel_ln[TIMER_UPPER_LEVELS][TIMER_LN_SIZE];
+
+/* Slots that may be non-empty */
+static uint64_t wheel_l0_map[TIMER_L0_SIZE / 64];
+static uint64_t wheel_ln_map[TIMER_UPPER_LEVELS];
+
+/* Next unit to process */
+static uint64_t wheel_clk = 0;
+
+/* No work before this unit (UINT64_MAX = none at all) */
+static uint64_t wheel_next = UINT64_MAX;
+
+/* Timers pending (lets timer_tick() skip the wheel when there are none) */
+static uint32_t wheel_count = 0;
+
+static spinlock_t timer_lock = SPINLOCK_INIT;
+
+/* =============================================================================
+ * Slot Lists (timer_lock held)
+ * =============================================================================
+ */
+
+static void slot_push(ktimer_t** slot, ktimer_t* timer) {
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void timer_unlink(ktimer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->pending = false;
+    wheel_count--;
+}
+
+/* Expiry in wheel units, rounded up */
+static inline uint64_t timer_unit(const ktimer_t* timer) {
+    return (timer->expires + TIMER_RES_NS - 1) >> TIMER_RES_SHIFT;
+}
+
+/* Put a timer into the slot matching its distance from wheel_clk */
+static void wheel_insert(ktimer_t* timer) {
+    uint64_t expires = timer_unit(timer);
+    uint64_t delta = expires - wheel_clk;
+    ktimer_t** slot;
+
+    if ((int64_t)delta < 0) {
+        /* Already due: the next unit processed */
+        expires = wheel_clk;
+        delta = 0;
+    }
+
+    if (delta < TIMER_L0_SIZE) {
+        uint32_t index = (uint32_t)expires & TIMER_L0_MASK;
+        slot = &wheel_l0[index];
+        wheel_l0_map[index / 64] |= 1ULL << (index % 64);
+        if (expires < wheel_next) {
+            wheel_next = expires;
+        }
+    } else {
+        if (delta > TIMER_MAX_DELTA) {
+            /* Park it as far out as possible; it is re-placed on cascade */
+            expires = wheel_clk + TIMER_MAX_DELTA;
+            delta = TIMER_MAX_DELTA;
+        }
+
+        int level = 1;
+        while (level < TIMER_UPPER_LEVELS && delta >= (1ULL << TIMER_SHIFT(level + 1))) {
+            level++;
+        }
+        uint32_t index = (uint32_t)(expires >> TIMER_SHIFT(level)) & TIMER_LN_MASK;
+        slot = &wheel_ln[level - 1][index];
+        wheel_ln_map[level - 1] |= 1ULL << index;
+
+        /* It is cascaded once wheel_clk reaches its slot's span */
+        uint64_t cascade = (expires >> TIMER_SHIFT(level)) << TIMER_SHIFT(level);
+        if (cascade < wheel_next) {
+            wheel_next = cascade;
+        }
+    }
+
+    slot_push(slot, timer);
+}
+
+/* Re-insert every timer of one upper-level slot; returns the slot index */
+static uint32_t wheel_cascade(int level) {
+    uint32_t index = (uint32_t)(wheel_clk >> TIMER_SHIFT(level)) & TIMER_LN_MASK;
+    ktimer_t* timer = wheel_ln[level - 1][index];
+    wheel_ln[level - 1][index] = NULL;
+    wheel_ln_map[level - 1] &= ~(1ULL << index);
+
+    while (timer) {
+        ktimer_t* next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+    return index;
+}
+
+/* First level 0 slot at or after wheel_clk with timers, as an offset */
+static uint64_t wheel_next_l0(void) {
+    uint32_t k = 0;
+
+    while (k < TIMER_L0_SIZE) {
+        uint32_t index = (uint32_t)(wheel_clk + k) & TIMER_L0_MASK;
+        uint64_t word = wheel_l0_map[index / 64] >> (index % 64);
+
+        if (!word) {
+            k += 64 - index % 64;
+            continue;
+        }
+
+        uint32_t bit = (uint32_t)__builtin_ctzll(word);
+        if (k + bit >= TIMER_L0_SIZE) {
+            break;
+        }
+        index += bit;
+        if (wheel_l0[index]) {
+            return k + bit;
+        }
+
+        /* Emptied by cancels: clear lazily */
+        wheel_l0_map[index / 64] &= ~(1ULL << (index % 64));
+        k += bit + 1;
+    }
+    return UINT64_MAX;
+}
+
+/* First unit at which a non-empty slot of an upper level is cascaded */
+static uint64_t wheel_next_cascade(int level) {
+    uint64_t base = wheel_clk >> TIMER_SHIFT(level);
+    uint32_t start = (uint32_t)(base + 1) & TIMER_LN_MASK;
+    uint64_t* map = &wheel_ln_map[level - 1];
+
+    while (*map) {
+        /* Rotate so bit 0 is the slot cascaded next (the current one is last) */
+        uint64_t rot = start ? (*map >> start) | (*map << (64 - start)) : *map;
+        uint32_t offset = (uint32_t)__builtin_ctzll(rot);
+        uint32_t index = (start + offset) & TIMER_LN_MASK;
+
+        if (wheel_ln[level - 1][index]) {
+            return (base + offset + 1) << TIMER_SHIFT(level);
+        }
+        *map &= ~(1ULL << index);
+    }
+    return UINT64_MAX;
+}
+
+/* Recompute wheel_next from the bitmaps (timer_lock held) */
+static void wheel_find_next(void) {
+    if (wheel_count == 0) {
+        wheel_next = UINT64_MAX;
+        return;
+    }
+
+    uint64_t next = UINT64_MAX;
+    uint64_t offset = wheel_next_l0();
+    if (offset != UINT64_MAX) {
+        next = wheel_clk + offset;
+    }
+
+    for (int level = 1; level <= TIMER_UPPER_LEVELS; level++) {
+        uint64_t cascade = wheel_next_cascade(level);
+        if (cascade < next) {
+            next = cascade;
+        }
+    }
+    wheel_next = next;
+}
+
+/* =============================================================================
+ * Timer API
+ * =============================================================================
+ */
+
+void timer_wheel_init(void) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+    wheel_clk = clock_ns() >> TIMER_RES_SHIFT;
+    wheel_next = UINT64_MAX;
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+void timer_init(ktimer_t* timer, void (*fn)(void* arg), void* arg) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->pending = false;
+}
+
+void timer_add(ktimer_t* timer, uint64_t expires) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+
+    if (timer->pending) {
+        timer_unlink(timer);
+    }
+
+    uint64_t old_next = wheel_next;
+    timer->expires = expires;
+    timer->pending = true;
+    wheel_count++;
+    wheel_insert(timer);
+    bool sooner = wheel_next < old_next;
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    /* The timer CPU may be sleeping past the new expiry */
+    if (sooner) {
+        sched_timers_changed();
+    }
+}
+
+bool timer_cancel(ktimer_t* timer) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+
+    bool was_pending = timer->pending;
+    if (was_pending) {
+        timer_unlink(timer);
+    }
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return was_pending;
+}
+
+uint64_t timer_next_expiry(void) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+    uint64_t next = wheel_next;
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    return next == UINT64_MAX ? UINT64_MAX : next << TIMER_RES_SHIFT;
+}
+
+void timer_tick(uint64_t now_ns) {
+    uint64_t now = now_ns >> TIMER_RES_SHIFT;
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+
+    /* Nothing armed: just keep the clock in step */
+    if (wheel_count == 0) {
+        wheel_clk = now + 1;
+        wheel_next = UINT64_MAX;
+        spin_unlock_irqrestore(&timer_lock, flags);
+        return;
+    }
+
+    while (wheel_clk <= now) {
+        /* Skip straight over units with nothing to fire or cascade */
+        if (wheel_next > wheel_clk) {
+            wheel_clk = wheel_next < now + 1 ? wheel_next : now + 1;
+            continue;
+        }
+
+        uint32_t index = (uint32_t)wheel_clk & TIMER_L0_MASK;
+
+        /* Level 0 wrapped: pull the next span down from above */
+        if (index == 0) {
+            for (int level = 1; level <= TIMER_UPPER_LEVELS; level++) {
+                if (wheel_cascade(level) != 0) {
+                    break;
+                }
+            }
+        }
+
+        wheel_clk++;
+
+        /*
+         * Detach the slot first: anything a callback arms from here on
+         * belongs to a later tick, even if it hashes to this slot.
+         * timer_cancel() still works on the detached list.
+         */
+        ktimer_t* work = wheel_l0[index];
+        wheel_l0[index] = NULL;
+        wheel_l0_map[index / 64] &= ~(1ULL << (index % 64));
+        if (work) {
+            work->pprev = &work;
+        }
+
+        while (work) {
+            ktimer_t* timer = work;
+            timer_unlink(timer);
+
+            void (*fn)(void*) = timer->fn;
+            void* arg = timer->arg;
+
+            spin_unlock(&timer_lock);
+            fn(arg);
+            spin_lock(&timer_lock);
+        }
+
+        wheel_find_next();
+    }
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
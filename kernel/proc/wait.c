@@ -0,0 +1,117 @@
+/**
+ * =============================================================================
+ * Chanux OS - Wait Queues Implementation
+ * =============================================================================
+ * FIFO lists of wait entries. A waker unlinks each entry it wakes, so
+ * wake_up_one() never picks the same waiter twice; a waiter whose
+ * condition is still false after waking simply queues itself again.
+ *
+ * Lock order: wq->lock, then process_lock (taken by process_wake() and
+ * process_prepare_block()).
+ * =============================================================================
+ */
+
+#include "../include/proc/wait.h"
+#include "../include/proc/process.h"
+
+/* =============================================================================
+ * List Helpers (wq->lock held)
+ * =============================================================================
+ */
+
+static void wait_link(wait_queue_t* wq, wait_entry_t* entry) {
+    entry->next = NULL;
+    entry->prev = wq->tail;
+
+    if (wq->tail) {
+        wq->tail->next = entry;
+    } else {
+        wq->head = entry;
+    }
+    wq->tail = entry;
+    entry->queued = true;
+}
+
+static void wait_unlink(wait_queue_t* wq, wait_entry_t* entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        wq->head = entry->next;
+    }
+
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        wq->tail = entry->prev;
+    }
+
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->queued = false;
+}
+
+/* =============================================================================
+ * Wait Queue API
+ * =============================================================================
+ */
+
+void wait_queue_init(wait_queue_t* wq) {
+    spin_init(&wq->lock);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void wait_prepare(wait_queue_t* wq, wait_entry_t* entry) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+
+    entry->proc = process_current();
+    if (!entry->queued) {
+        wait_link(wq, entry);
+    }
+
+    /* Still under wq->lock: a waker either sees us BLOCKED, or comes later */
+    process_prepare_block();
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_finish(wait_queue_t* wq, wait_entry_t* entry) {
+    process_cancel_block();
+
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    if (entry->queued) {
+        wait_unlink(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+int wake_up(wait_queue_t* wq) {
+    int woken = 0;
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+
+    while (wq->head) {
+        wait_entry_t* entry = wq->head;
+        wait_unlink(wq, entry);
+        if (process_wake(entry->proc)) {
+            woken++;
+        }
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+int wake_up_one(wait_queue_t* wq) {
+    int woken = 0;
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+
+    /* Skip entries whose process already woke another way */
+    while (wq->head && !woken) {
+        wait_entry_t* entry = wq->head;
+        wait_unlink(wq, entry);
+        woken = process_wake(entry->proc) ? 1 : 0;
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
@@ -11,79 +11,65 @@
  *   - sys_readdir: Read directory entry
  *   - sys_getcwd:  Get current working directory
  *   - sys_chdir:   Change current working directory
+ *   - sys_sync:    Save a filesystem snapshot to disk
+ *   - sys_pipe:    Create a pipe
+ *   - sys_dup2:    Make one descriptor refer to another's open file
  * =============================================================================
  */
 
 #include "syscall/syscall.h"
 #include "fs/vfs.h"
 #include "fs/file.h"
+#include "fs/pipe.h"
 #include "fs/ramfs.h"
 #include "proc/process.h"
 #include "kernel.h"
 #include "string.h"
+#include "user/uaccess.h"
 
 /* =============================================================================
- * User Pointer Validation
+ * User Arguments
  * =============================================================================
  */
 
-/* User space address limit (canonical lower half) */
-#define USER_SPACE_END  0x0000800000000000ULL
-
 /**
- * Validate a user-space pointer for reading.
+ * Copy a path argument in. Relative paths are resolved later from the
+ * process's cwd vnode (vfs_*_at()), without building an absolute path.
+ *
+ * @param user_path Path (user space)
+ * @param path      Copy (VFS_MAX_PATH bytes)
+ * @return          0 on success, negative error on failure
  */
-static bool validate_user_ptr_read(const void* ptr, size_t len) {
-    uintptr_t addr = (uintptr_t)ptr;
-
-    if (ptr == NULL || len == 0) {
-        return false;
-    }
-    if (addr >= USER_SPACE_END) {
-        return false;
-    }
-    if (addr + len < addr) {
-        return false;
-    }
-    if (addr + len > USER_SPACE_END) {
-        return false;
-    }
-
-    return true;
+static int user_path_copy(const char* user_path, char* path) {
+    int64_t len = strncpy_from_user(path, user_path, VFS_MAX_PATH);
+    return len < 0 ? (int)len : 0;
 }
 
 /**
- * Validate a user-space pointer for writing.
+ * Look up an open file of a process.
+ *
+ * Other threads may close the fd meanwhile, so the file comes with a
+ * reference of its own; give it back with file_put().
+ *
+ * @return File, or NULL if fd is not open
  */
-static bool validate_user_ptr_write(void* ptr, size_t len) {
-    return validate_user_ptr_read(ptr, len);
+static file_t* fd_to_file(process_t* proc, int fd) {
+    return fd_get_file_ref(proc->fd_table, fd);
 }
 
 /**
- * Validate a user-space string (null-terminated).
+ * Convert a kernel stat_t to the user ABI layout.
  */
-static bool validate_user_string(const char* str, size_t max_len) {
-    if (str == NULL) {
-        return false;
-    }
-
-    uintptr_t addr = (uintptr_t)str;
-    if (addr >= USER_SPACE_END) {
-        return false;
-    }
-
-    /* Check each character up to max_len */
-    for (size_t i = 0; i < max_len; i++) {
-        if (addr + i >= USER_SPACE_END) {
-            return false;
-        }
-        if (str[i] == '\0') {
-            return true;
-        }
-    }
-
-    /* String too long */
-    return false;
+static void stat_export(const stat_t* st, user_stat_t* out) {
+    memset(out, 0, sizeof(*out));
+    out->st_mode = (st->st_mode & S_IFDIR) ? USER_S_IFDIR : USER_S_IFREG;
+    out->st_size = st->st_size;
+    out->st_ino = st->st_ino;
+    out->st_nlink = st->st_nlink;
+    out->st_uid = st->st_uid;
+    out->st_gid = st->st_gid;
+    out->st_blksize = (uint32_t)st->st_blksize;
+    out->st_blocks = st->st_blocks;
 }
 
 /* =============================================================================
@@ -99,40 +85,41 @@ static bool validate_user_string(const char* str, size_t max_len) {
  * @return      File descriptor on success, negative error on failure
  */
 int64_t sys_open(const char* path, int flags) {
-    /* Validate path */
-    if (!validate_user_string(path, VFS_MAX_PATH)) {
-        return -EFAULT;
-    }
-
     /* Get current process */
     process_t* proc = process_current();
     if (!proc || !proc->fd_table) {
         return -ENOMEM;
     }
 
-    /* Resolve path to absolute */
-    char abs_path[VFS_MAX_PATH];
-    if (path_normalize(path, proc->cwd, abs_path, VFS_MAX_PATH) < 0) {
-        return -ENAMETOOLONG;
+    /* Copy in path */
+    char kpath[VFS_MAX_PATH];
+    int err = user_path_copy(path, kpath);
+    if (err < 0) {
+        return err;
     }
 
+    uint64_t irq = vfs_lock();
+
     /* Allocate a file descriptor */
     int fd = fd_alloc(proc->fd_table);
     if (fd < 0) {
+        vfs_unlock(irq);
         return -EMFILE;
     }
 
     /* Open the file via VFS */
     file_t* file = NULL;
-    int result = vfs_open(abs_path, (uint32_t)flags, &file);
+    int result = vfs_open_at(proc->cwd_vnode, kpath, (uint32_t)flags, &file);
     if (result < 0) {
         fd_free(proc->fd_table, fd);
+        vfs_unlock(irq);
         return result;
     }
 
-    /* Install file in fd table */
-    proc->fd_table->entries[fd] = file;
+    /* Install file in fd table (room was made by fd_alloc) */
+    fd_set_file(proc->fd_table, fd, file);
 
+    vfs_unlock(irq);
     return fd;
 }
 
@@ -159,23 +146,24 @@ int64_t sys_close(int fd) {
         return -EBADF;
     }
 
-    file_t* file = proc->fd_table->entries[fd];
+    uint64_t irq = vfs_lock();
+    file_t* file = fd_get_file(proc->fd_table, fd);
     if (!file) {
+        vfs_unlock(irq);
         return -EBADF;
     }
 
     /* Don't allow closing stdin/stdout/stderr via this syscall */
     if (fd < 3) {
+        vfs_unlock(irq);
         return -EINVAL;
     }
 
-    /* Close the file via VFS */
-    int result = vfs_close(file);
-
-    /* Remove from fd table */
-    proc->fd_table->entries[fd] = NULL;
+    /* Remove from fd table, which closes the file (copies a shared table) */
+    int result = fd_set_file(proc->fd_table, fd, NULL);
+    vfs_unlock(irq);
 
-    return result;
+    return result < 0 ? -ENOMEM : 0;
 }
 
 /* =============================================================================
@@ -203,13 +191,21 @@ int64_t sys_lseek(int fd, int64_t offset, int whence) {
         return -EBADF;
     }
 
-    file_t* file = proc->fd_table->entries[fd];
+    file_t* file = fd_to_file(proc, fd);
     if (!file) {
         return -EBADF;
     }
+    if (file->type == FILE_TYPE_PIPE) {
+        file_put(file);
+        return -ESPIPE;
+    }
 
     /* Perform seek via VFS */
-    return vfs_lseek(file, offset, whence);
+    uint64_t irq = vfs_lock();
+    int64_t result = vfs_lseek(file, offset, whence);
+    vfs_unlock(irq);
+    file_put(file);
+    return result;
 }
 
 /* =============================================================================
@@ -225,13 +221,8 @@ int64_t sys_lseek(int fd, int64_t offset, int whence) {
  * @return     0 on success, negative error on failure
  */
 int64_t sys_stat(const char* path, void* buf) {
-    /* Validate path */
-    if (!validate_user_string(path, VFS_MAX_PATH)) {
-        return -EFAULT;
-    }
-
     /* Validate buffer */
-    if (!validate_user_ptr_write(buf, sizeof(stat_t))) {
+    if (!user_access_ok(buf, sizeof(user_stat_t))) {
         return -EFAULT;
     }
 
@@ -241,14 +232,25 @@ int64_t sys_stat(const char* path, void* buf) {
         return -ENOMEM;
     }
 
-    /* Resolve path to absolute */
-    char abs_path[VFS_MAX_PATH];
-    if (path_normalize(path, proc->cwd, abs_path, VFS_MAX_PATH) < 0) {
-        return -ENAMETOOLONG;
+    /* Copy in path */
+    char kpath[VFS_MAX_PATH];
+    int err = user_path_copy(path, kpath);
+    if (err < 0) {
+        return err;
     }
 
     /* Get status via VFS */
-    return vfs_stat(abs_path, (stat_t*)buf);
+    stat_t st;
+    uint64_t irq = vfs_lock();
+    int result = vfs_stat_at(proc->cwd_vnode, kpath, &st);
+    vfs_unlock(irq);
+    if (result < 0) {
+        return result;
+    }
+
+    user_stat_t ust;
+    stat_export(&st, &ust);
+    return copy_to_user(buf, &ust, sizeof(ust));
 }
 
 /* =============================================================================
@@ -265,7 +267,7 @@ int64_t sys_stat(const char* path, void* buf) {
  */
 int64_t sys_fstat(int fd, void* buf) {
     /* Validate buffer */
-    if (!validate_user_ptr_write(buf, sizeof(stat_t))) {
+    if (!user_access_ok(buf, sizeof(user_stat_t))) {
         return -EFAULT;
     }
 
@@ -280,25 +282,43 @@ int64_t sys_fstat(int fd, void* buf) {
         return -EBADF;
     }
 
-    file_t* file = proc->fd_table->entries[fd];
+    file_t* file = fd_to_file(proc, fd);
+    if (file && file->type == FILE_TYPE_PIPE) {
+        /* Size is what is waiting to be read */
+        user_stat_t st;
+        memset(&st, 0, sizeof(st));
+        st.st_mode = USER_S_IFIFO;
+        st.st_size = pipe_available(file);
+        st.st_nlink = 1;
+        st.st_blksize = PIPE_SIZE;
+        file_put(file);
+        return copy_to_user(buf, &st, sizeof(st));
+    }
     if (!file || !file->vnode) {
+        if (file) {
+            file_put(file);
+        }
         return -EBADF;
     }
 
     /* Fill stat structure from vnode */
-    stat_t* st = (stat_t*)buf;
+    user_stat_t st;
     vnode_t* vn = file->vnode;
-
-    st->st_mode = (vn->type == INODE_TYPE_DIR) ? S_IFDIR : S_IFREG;
-    st->st_size = vn->inode ? vn->inode->size : 0;
-    st->st_ino = vn->inode_num;
-    st->st_nlink = 1;  /* Simplified */
-    st->st_uid = 0;
-    st->st_gid = 0;
-    st->st_blksize = RAMFS_BLOCK_SIZE;
-    st->st_blocks = (st->st_size + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE;
-
-    return 0;
+    uint64_t irq = vfs_lock();
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = (vn->type == INODE_TYPE_DIR) ? USER_S_IFDIR : USER_S_IFREG;
+    st.st_size = vn->inode ? vn->inode->size : 0;
+    st.st_ino = vn->inode_num;
+    st.st_nlink = 1;  /* Simplified */
+    st.st_uid = 0;
+    st.st_gid = 0;
+    st.st_blksize = RAMFS_BLOCK_SIZE;
+    st.st_blocks = (st.st_size + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE;
+
+    vfs_unlock(irq);
+    file_put(file);
+    return copy_to_user(buf, &st, sizeof(st));
 }
 
 /* =============================================================================
@@ -316,7 +336,7 @@ int64_t sys_fstat(int fd, void* buf) {
  */
 int64_t sys_readdir(int fd, void* entry, int index) {
     /* Validate buffer */
-    if (!validate_user_ptr_write(entry, sizeof(ramfs_dirent_t))) {
+    if (!user_access_ok(entry, sizeof(user_dirent_t))) {
         return -EFAULT;
     }
 
@@ -331,13 +351,30 @@ int64_t sys_readdir(int fd, void* entry, int index) {
         return -EBADF;
     }
 
-    file_t* file = proc->fd_table->entries[fd];
+    file_t* file = fd_to_file(proc, fd);
     if (!file) {
         return -EBADF;
     }
 
     /* Read directory entry via VFS */
-    return vfs_readdir(file, (ramfs_dirent_t*)entry, (uint32_t)index);
+    ramfs_dirent_t dent;
+    uint64_t irq = vfs_lock();
+    int result = vfs_readdir(file, &dent, (uint32_t)index);
+    vfs_unlock(irq);
+    file_put(file);
+    if (result != 0) {
+        return result;
+    }
+
+    user_dirent_t out;
+    memset(&out, 0, sizeof(out));
+    out.d_ino = dent.inode;
+    out.d_type = (dent.type == INODE_TYPE_DIR) ? USER_S_IFDIR : USER_S_IFREG;
+    for (size_t i = 0; i < sizeof(dent.name) && dent.name[i]; i++) {
+        out.d_name[i] = dent.name[i];
+    }
+
+    return copy_to_user(entry, &out, sizeof(out));
 }
 
 /* =============================================================================
@@ -354,7 +391,7 @@ int64_t sys_readdir(int fd, void* entry, int index) {
  */
 int64_t sys_getcwd(char* buf, size_t size) {
     /* Validate buffer */
-    if (!validate_user_ptr_write(buf, size)) {
+    if (!user_access_ok(buf, size)) {
         return -EFAULT;
     }
 
@@ -374,8 +411,7 @@ int64_t sys_getcwd(char* buf, size_t size) {
         return -ERANGE;
     }
 
-    memcpy(buf, proc->cwd, cwd_len + 1);
-    return 0;
+    return copy_to_user(buf, proc->cwd, cwd_len + 1);
 }
 
 /* =============================================================================
@@ -383,47 +419,237 @@ int64_t sys_getcwd(char* buf, size_t size) {
  * =============================================================================
  */
 
+/**
+ * Work out the string getcwd reports after a successful chdir to path.
+ *
+ * Only the components of path are applied to the old string, so no path
+ * is built for the lookup itself.
+ *
+ * @param cwd  Current string
+ * @param path Path chdir resolved (absolute, or relative to cwd)
+ * @param out  New string (CWD_MAX bytes)
+ * @return     0 on success, -ENAMETOOLONG if it doesn't fit
+ */
+static int cwd_string_update(const char* cwd, const char* path, char* out) {
+    size_t len = 1;
+    out[0] = '/';
+    if (path[0] != '/') {
+        len = strlen(cwd);
+        memcpy(out, cwd, len);
+    }
+
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+        const char* name = path;
+        while (*path && *path != '/') {
+            path++;
+        }
+        size_t n = (size_t)(path - name);
+
+        if (n == 0 || (n == 1 && name[0] == '.')) {
+            continue;
+        }
+        if (n == 2 && name[0] == '.' && name[1] == '.') {
+            /* Drop the last component ("/.." stays "/") */
+            while (len > 1 && out[len - 1] != '/') {
+                len--;
+            }
+            if (len > 1) {
+                len--;
+            }
+            continue;
+        }
+
+        if (len + 1 + n >= CWD_MAX) {
+            return -ENAMETOOLONG;
+        }
+        if (len > 1) {
+            out[len++] = '/';
+        }
+        memcpy(out + len, name, n);
+        len += n;
+    }
+
+    out[len] = '\0';
+    return 0;
+}
+
 /**
  * Change current working directory.
  *
+ * The path is resolved from the cwd vnode, which is kept referenced for
+ * resolving relative paths; the string is only kept for getcwd.
+ *
  * @param path Path to new directory (user space)
  * @return     0 on success, negative error on failure
  */
 int64_t sys_chdir(const char* path) {
-    /* Validate path */
-    if (!validate_user_string(path, VFS_MAX_PATH)) {
-        return -EFAULT;
-    }
-
     /* Get current process */
     process_t* proc = process_current();
     if (!proc) {
         return -ENOMEM;
     }
 
-    /* Resolve path to absolute */
-    char abs_path[VFS_MAX_PATH];
-    if (path_normalize(path, proc->cwd, abs_path, VFS_MAX_PATH) < 0) {
-        return -ENAMETOOLONG;
+    char kpath[VFS_MAX_PATH];
+    int err = user_path_copy(path, kpath);
+    if (err < 0) {
+        return err;
     }
 
     /* Verify path exists and is a directory */
-    stat_t st;
-    int result = vfs_stat(abs_path, &st);
-    if (result < 0) {
-        return result;
+    vnode_t* vn;
+    uint64_t irq = vfs_lock();
+    if (vfs_lookup_at(proc->cwd_vnode, kpath, &vn) < 0) {
+        vfs_unlock(irq);
+        return -ENOENT;
+    }
+    if (vn->type != INODE_TYPE_DIR) {
+        vnode_unref(vn);
+        vfs_unlock(irq);
+        return -ENOTDIR;
     }
 
-    if (st.st_mode != S_IFDIR) {
-        return -ENOTDIR;
+    /* Work out what getcwd will report */
+    char cwd[CWD_MAX];
+    err = cwd_string_update(proc->cwd, kpath, cwd);
+    if (err < 0) {
+        vnode_unref(vn);
+        vfs_unlock(irq);
+        return err;
     }
 
     /* Update process cwd */
-    size_t len = strlen(abs_path);
-    if (len >= CWD_MAX) {
-        return -ENAMETOOLONG;
+    vnode_unref(proc->cwd_vnode);
+    proc->cwd_vnode = vn;
+    memcpy(proc->cwd, cwd, strlen(cwd) + 1);
+    vfs_unlock(irq);
+    return 0;
+}
+
+/* =============================================================================
+ * sys_sync - Save a Filesystem Snapshot
+ * =============================================================================
+ */
+
+/**
+ * Write the whole filesystem to the snapshot disk; the next boot
+ * loads it instead of starting from an empty disk.
+ *
+ * @return 0 on success, negative error code on failure
+ */
+int64_t sys_sync(void) {
+    if (!ramfs_snapshot_device()) {
+        return -ENODEV;
     }
 
-    memcpy(proc->cwd, abs_path, len + 1);
+    /* Other processes keep using the filesystem while the disk is written */
+    return (vfs_sync() < 0) ? -EIO : 0;
+}
+
+/* =============================================================================
+ * sys_pipe - Create a Pipe
+ * =============================================================================
+ */
+
+/**
+ * Create a pipe: fds[0] is the read end, fds[1] the write end.
+ *
+ * @param fds Two descriptors, filled in on success (user space)
+ * @return    0 on success, negative error on failure
+ */
+int64_t sys_pipe(int* fds) {
+    if (!user_access_ok(fds, 2 * sizeof(int))) {
+        return -EFAULT;
+    }
+
+    process_t* proc = process_current();
+    if (!proc || !proc->fd_table) {
+        return -ENOMEM;
+    }
+
+    uint64_t irq = vfs_lock();
+
+    file_t* read_end;
+    file_t* write_end;
+    if (pipe_create(&read_end, &write_end) < 0) {
+        vfs_unlock(irq);
+        return -ENOMEM;
+    }
+
+    /* Two descriptors, the read end getting the lower one */
+    int kfds[2];
+    kfds[0] = fd_alloc(proc->fd_table);
+    if (kfds[0] < 0) {
+        file_unref(read_end);
+        file_unref(write_end);
+        vfs_unlock(irq);
+        return -EMFILE;
+    }
+    fd_set_file(proc->fd_table, kfds[0], read_end);
+
+    kfds[1] = fd_alloc(proc->fd_table);
+    if (kfds[1] < 0) {
+        fd_free(proc->fd_table, kfds[0]);
+        file_unref(write_end);
+        vfs_unlock(irq);
+        return -EMFILE;
+    }
+    fd_set_file(proc->fd_table, kfds[1], write_end);
+
+    vfs_unlock(irq);
+
+    if (copy_to_user(fds, kfds, sizeof(kfds)) < 0) {
+        irq = vfs_lock();
+        fd_free(proc->fd_table, kfds[0]);
+        fd_free(proc->fd_table, kfds[1]);
+        vfs_unlock(irq);
+        return -EFAULT;
+    }
     return 0;
 }
+
+/* =============================================================================
+ * sys_dup2 - Duplicate a File Descriptor
+ * =============================================================================
+ */
+
+/**
+ * Make newfd refer to oldfd's open file, closing whatever newfd had.
+ * Both share the file offset, like descriptors inherited over fork().
+ *
+ * @param oldfd Open descriptor
+ * @param newfd Descriptor to replace (0-2 included, to redirect stdio)
+ * @return      newfd on success, negative error on failure
+ */
+int64_t sys_dup2(int oldfd, int newfd) {
+    process_t* proc = process_current();
+    if (!proc || !proc->fd_table) {
+        return -EBADF;
+    }
+
+    if (oldfd < 0 || oldfd >= MAX_FD_PER_PROCESS ||
+        newfd < 0 || newfd >= MAX_FD_PER_PROCESS) {
+        return -EBADF;
+    }
+
+    uint64_t irq = vfs_lock();
+
+    file_t* file = fd_get_file(proc->fd_table, oldfd);
+    if (!file) {
+        vfs_unlock(irq);
+        return -EBADF;
+    }
+    if (oldfd != newfd) {
+        file_ref(file);
+        if (fd_set_file(proc->fd_table, newfd, file) < 0) {
+            file_unref(file);
+            vfs_unlock(irq);
+            return -ENOMEM;
+        }
+    }
+
+    vfs_unlock(irq);
+    return newfd;
+}
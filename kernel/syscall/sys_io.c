@@ -5,124 +5,295 @@
  * Implements system calls for input/output operations:
  *   - sys_write: Write data to a file descriptor
  *   - sys_read: Read data from a file descriptor
+ *   - sys_readv/sys_writev: Scatter/gather versions of read and write
+ *   - sys_pread/sys_pwrite: Read/write at an offset, leaving the file
+ *     offset alone
+ *   - sys_sendfile/sys_copy_file_range: File to console, pipe or file
+ *     without passing through user space
+ *   - sys_klog_read: Read the kernel log (klog.h)
+ *   - sys_profile: Control the sampling profiler and drain its samples
+ *     (profile.h)
+ *   - sys_trace: Switch tracepoints on and off and drain their records
+ *     (trace.h)
  *
- * Supported file descriptors:
- *   - 0 (stdin):  Keyboard input
- *   - 1 (stdout): VGA console output
- *   - 2 (stderr): VGA console output (same as stdout)
- *   - 3+: VFS file operations (Phase 6)
+ * Descriptors are routed by the type of their open file, not by number,
+ * so dup2() can put a pipe or a file on 0-2:
+ *   - Console: keyboard lines from the TTY (stdin) or VGA output
+ *     (stdout/stderr)
+ *   - Pipe: fs/pipe.c, copying straight to and from the user buffer
+ *   - Regular files and directories: VFS file operations
+ *
+ * User buffers are staged through a kernel buffer, taken once per call,
+ * and moved with copy_from_user()/copy_to_user(): those may fault
+ * (demand-zero, COW, or a bad pointer), which must not happen while
+ * vfs_lock() is held. The VFS lock is taken once per buffer load, so up
+ * to IO_STAGE_MAX bytes move per round trip.
  * =============================================================================
  */
 
 #include "syscall/syscall.h"
 #include "kernel.h"
+#include "klog.h"
+#include "profile.h"
+#include "trace.h"
 #include "drivers/vga/vga.h"
-#include "drivers/keyboard.h"
+#include "drivers/tty.h"
 #include "fs/vfs.h"
 #include "fs/file.h"
+#include "fs/pipe.h"
+#include "mm/heap.h"
 #include "proc/process.h"
+#include "user/uaccess.h"
 
 /* =============================================================================
- * User Pointer Validation
+ * File Descriptor Lookup
  * =============================================================================
  */
 
-/* User space address limit (canonical lower half) */
-#define USER_SPACE_END  0x0000800000000000ULL
-
 /**
- * Validate a user-space pointer.
+ * Look up an open VFS file of the current process.
+ *
+ * Other threads may close the fd meanwhile, so the file comes with a
+ * reference of its own; give it back with file_put().
  *
- * @param ptr Pointer to validate
- * @param len Length of memory region
- * @return    true if valid, false otherwise
+ * @return File, or NULL if fd is not open
+ */
+static file_t* fd_to_file(int fd) {
+    process_t* proc = process_current();
+    if (!proc || !proc->fd_table) {
+        return NULL;
+    }
+    if (fd < 0 || fd >= MAX_FD_PER_PROCESS) {
+        return NULL;
+    }
+
+    return fd_get_file_ref(proc->fd_table, fd);
+}
+
+/* Console files: stdin is opened O_RDONLY, stdout and stderr O_WRONLY */
+static bool console_readable(const file_t* file) {
+    return file->type == FILE_TYPE_CONSOLE && (file->flags & O_ACCMODE) != O_WRONLY;
+}
+
+static bool console_writable(const file_t* file) {
+    return file->type == FILE_TYPE_CONSOLE && (file->flags & O_ACCMODE) != O_RDONLY;
+}
+
+/* =============================================================================
+ * Bounce Buffer Transfers
+ * =============================================================================
+ */
+
+#define IO_STACK_SIZE   512             /* Transfers this short stage on the stack */
+#define IO_STAGE_MAX    (64 * 1024)     /* Largest staging buffer (heap) */
+
+/* Staging buffer of one transfer */
+typedef struct {
+    char*   buf;
+    size_t  size;
+    char    local[IO_STACK_SIZE];
+} io_stage_t;
+
+/**
+ * Set up the staging buffer for a transfer of 'len' bytes: on the stack
+ * when that is enough, else up to IO_STAGE_MAX bytes from the heap (or
+ * the stack buffer again if the heap is out of memory).
  */
-static bool validate_user_ptr(const void* ptr, size_t len) {
-    uintptr_t addr = (uintptr_t)ptr;
+static void io_stage_get(io_stage_t* stage, size_t len) {
+    stage->buf = stage->local;
+    stage->size = IO_STACK_SIZE;
+    if (len > IO_STACK_SIZE) {
+        size_t size = MIN(len, (size_t)IO_STAGE_MAX);
+        char* buf = (char*)kmalloc(size);
+        if (buf) {
+            stage->buf = buf;
+            stage->size = size;
+        }
+    }
+}
 
-    /* Null pointer check */
-    if (ptr == NULL) {
-        return false;
+static void io_stage_put(io_stage_t* stage) {
+    if (stage->buf != stage->local) {
+        kfree(stage->buf);
     }
+}
+
+/**
+ * Copy a user buffer to the console.
+ */
+static int64_t console_write_user(const void* buf, size_t len) {
+    io_stage_t stage;
+    size_t done = 0;
+
+    /* Kernel messages logged before this write come out first */
+    klog_flush();
+
+    io_stage_get(&stage, len);
+    while (done < len) {
+        size_t chunk = MIN(len - done, stage.size);
+        if (copy_from_user(stage.buf, (const char*)buf + done, chunk) < 0) {
+            break;
+        }
+        vga_write(stage.buf, chunk);
+        done += chunk;
+    }
+    io_stage_put(&stage);
+
+    return (done > 0 || len == 0) ? (int64_t)done : -EFAULT;
+}
+
+/**
+ * Read a line of keyboard input into a user buffer.
+ * Sleeps until a line has been typed (see drivers/tty.h).
+ */
+static int64_t stdin_read_user(void* buf, size_t len) {
+    char kbuf[TTY_LINE_MAX];
 
-    /* Must be in user space (lower canonical addresses) */
-    if (addr >= USER_SPACE_END) {
-        return false;
+    if (len == 0) {
+        return 0;
     }
 
-    /* Check for overflow */
-    if (addr + len < addr) {
-        return false;
+    size_t count = tty_read(kbuf, MIN(len, sizeof(kbuf)));
+    if (copy_to_user(buf, kbuf, count) < 0) {
+        return -EFAULT;
     }
+    return (int64_t)count;
+}
+
+/**
+ * Read from a VFS file into a user buffer.
+ *
+ * @param pos Offset to read at, or -1 to use and advance the file offset
+ */
+static int64_t file_read_user(file_t* file, void* buf, size_t len, int64_t pos) {
+    io_stage_t stage;
+    size_t done = 0;
+    int64_t err = 0;
+
+    io_stage_get(&stage, len);
+    while (done < len) {
+        size_t chunk = MIN(len - done, stage.size);
 
-    /* Check end address is also in user space */
-    if (addr + len > USER_SPACE_END) {
-        return false;
+        uint64_t irq = vfs_lock();
+        int64_t n = (pos < 0) ? vfs_read(file, stage.buf, chunk)
+                              : vfs_pread(file, stage.buf, chunk, (uint64_t)pos + done);
+        vfs_unlock(irq);
+
+        if (n < 0) {
+            err = n;
+            break;
+        }
+        if (copy_to_user((char*)buf + done, stage.buf, (size_t)n) < 0) {
+            err = -EFAULT;
+            break;
+        }
+        done += (size_t)n;
+        if ((size_t)n < chunk) {
+            break;          /* End of file */
+        }
     }
+    io_stage_put(&stage);
+
+    return (done > 0 || err == 0) ? (int64_t)done : err;
+}
+
+/**
+ * Write a user buffer to a VFS file.
+ *
+ * @param pos Offset to write at, or -1 to use and advance the file offset
+ */
+static int64_t file_write_user(file_t* file, const void* buf, size_t len, int64_t pos) {
+    io_stage_t stage;
+    size_t done = 0;
+    int64_t err = 0;
+
+    /* Kernel messages logged before this write come out first */
+    klog_flush();
+
+    io_stage_get(&stage, len);
+    while (done < len) {
+        size_t chunk = MIN(len - done, stage.size);
+        if (copy_from_user(stage.buf, (const char*)buf + done, chunk) < 0) {
+            err = -EFAULT;
+            break;
+        }
 
-    /* TODO: Check that pages are actually mapped with PTE_USER */
-    /* For now, we trust the address is valid if it's in the range */
+        uint64_t irq = vfs_lock();
+        int64_t n = (pos < 0) ? vfs_write(file, stage.buf, chunk)
+                              : vfs_pwrite(file, stage.buf, chunk, (uint64_t)pos + done);
+        vfs_unlock(irq);
+
+        if (n < 0) {
+            err = n;
+            break;
+        }
+        done += (size_t)n;
+        if ((size_t)n < chunk) {
+            break;          /* Out of space */
+        }
+    }
+    io_stage_put(&stage);
 
-    return true;
+    return (done > 0 || err == 0) ? (int64_t)done : err;
 }
 
-/* =============================================================================
- * File Descriptor Constants
- * =============================================================================
+/**
+ * Write a user buffer to any open file.
+ */
+static int64_t write_user(file_t* file, const void* buf, size_t len) {
+    switch (file->type) {
+        case FILE_TYPE_CONSOLE:
+            /* Cannot write to stdin */
+            return console_writable(file) ? console_write_user(buf, len) : -EBADF;
+
+        case FILE_TYPE_PIPE:
+            return pipe_write(file, buf, len, true);
+
+        default:
+            return file_write_user(file, buf, len, -1);
+    }
+}
+
+/**
+ * Read any open file into a user buffer.
  */
+static int64_t read_user(file_t* file, void* buf, size_t len) {
+    switch (file->type) {
+        case FILE_TYPE_CONSOLE:
+            /* Cannot read from stdout/stderr */
+            return console_readable(file) ? stdin_read_user(buf, len) : -EBADF;
 
-#define STDIN_FILENO    0
-#define STDOUT_FILENO   1
-#define STDERR_FILENO   2
+        case FILE_TYPE_PIPE:
+            return pipe_read(file, buf, len, true);
+
+        default:
+            return file_read_user(file, buf, len, -1);
+    }
+}
 
 /* =============================================================================
  * sys_write - Write to File Descriptor
  * =============================================================================
  * Write data from a user buffer to a file descriptor.
  *
- * @param fd  File descriptor (0=stdin, 1=stdout, 2=stderr)
+ * @param fd  File descriptor (1=stdout, 2=stderr, a pipe or a file)
  * @param buf Pointer to data to write (user space)
  * @param len Number of bytes to write
  * @return    Number of bytes written on success, negative error on failure
  */
 int64_t sys_write(int fd, const void* buf, size_t len) {
     /* Validate buffer pointer */
-    if (!validate_user_ptr(buf, len)) {
+    if (!user_access_ok(buf, len)) {
         return -EFAULT;
     }
 
-    /* Handle based on file descriptor */
-    switch (fd) {
-        case STDOUT_FILENO:
-        case STDERR_FILENO: {
-            /* Write to VGA console */
-            const char* str = (const char*)buf;
-            for (size_t i = 0; i < len; i++) {
-                vga_putchar(str[i]);
-            }
-            return (int64_t)len;
-        }
-
-        case STDIN_FILENO:
-            /* Cannot write to stdin */
-            return -EBADF;
-
-        default: {
-            /* File descriptor > 2: route to VFS */
-            process_t* proc = process_current();
-            if (!proc || !proc->fd_table) {
-                return -EBADF;
-            }
-            if (fd < 0 || fd >= MAX_FD_PER_PROCESS) {
-                return -EBADF;
-            }
-            file_t* file = proc->fd_table->entries[fd];
-            if (!file) {
-                return -EBADF;
-            }
-            return vfs_write(file, buf, len);
-        }
+    file_t* file = fd_to_file(fd);
+    if (!file) {
+        return -EBADF;
     }
+    int64_t n = write_user(file, buf, len);
+    file_put(file);
+    return n;
 }
 
 /* =============================================================================
@@ -130,69 +301,574 @@ int64_t sys_write(int fd, const void* buf, size_t len) {
  * =============================================================================
  * Read data from a file descriptor into a user buffer.
  *
- * For stdin (fd=0), this reads from the keyboard buffer.
- * The call may block if no input is available.
+ * For the console and pipes, the call blocks until at least one byte is
+ * available (a pipe with no writers left returns 0 instead).
  *
- * @param fd  File descriptor (0=stdin, 1=stdout, 2=stderr)
+ * @param fd  File descriptor (0=stdin, a pipe or a file)
  * @param buf Pointer to buffer to fill (user space)
  * @param len Maximum number of bytes to read
  * @return    Number of bytes read on success, negative error on failure
  */
 int64_t sys_read(int fd, void* buf, size_t len) {
     /* Validate buffer pointer */
-    if (!validate_user_ptr(buf, len)) {
+    if (!user_access_ok(buf, len)) {
         return -EFAULT;
     }
 
-    /* Handle based on file descriptor */
-    switch (fd) {
-        case STDIN_FILENO: {
-            /* Read from keyboard */
-            if (len == 0) {
-                return 0;
-            }
+    file_t* file = fd_to_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    int64_t n = read_user(file, buf, len);
+    file_put(file);
+    return n;
+}
 
-            char* str = (char*)buf;
-            size_t count = 0;
-
-            /* Try to read available characters (non-blocking) */
-            while (count < len) {
-                if (!keyboard_has_key()) {
-                    /* No more input available */
-                    break;
-                }
-                char c = keyboard_getchar_nonblock();
-                if (c == 0) {
-                    /* No more input available */
-                    break;
-                }
-                str[count++] = c;
-            }
+/* =============================================================================
+ * sys_readv / sys_writev - Vectored I/O
+ * =============================================================================
+ * Moves several buffers in one call, each in turn, stopping at the first
+ * short transfer.
+ */
+
+/**
+ * Copy in and check an iovec array.
+ *
+ * @param iov    User iovec array
+ * @param iovcnt Number of entries
+ * @param out    Kernel copy (IOV_MAX entries)
+ * @return       0 on success, negative error on failure
+ */
+static int iov_import(const iovec_t* iov, int iovcnt, iovec_t* out) {
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return -EINVAL;
+    }
+    if (copy_from_user(out, iov, (size_t)iovcnt * sizeof(iovec_t)) < 0) {
+        return -EFAULT;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (out[i].iov_len == 0) {
+            continue;
+        }
+        if (!user_access_ok(out[i].iov_base, out[i].iov_len)) {
+            return -EFAULT;
+        }
+        total += out[i].iov_len;
+        if (total > (uint64_t)INT64_MAX) {
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
 
-            /* If no data available, we could block here */
-            /* For now, return what we have (or 0 if nothing) */
-            return (int64_t)count;
+/**
+ * @param fd     File descriptor
+ * @param iov    Buffers to fill, in order (user space)
+ * @param iovcnt Number of buffers (at most IOV_MAX)
+ * @return       Total bytes read, or negative error on failure
+ */
+int64_t sys_readv(int fd, const iovec_t* iov, int iovcnt) {
+    if (iovcnt == 0) {
+        return 0;
+    }
+
+    iovec_t vec[IOV_MAX];
+    int err = iov_import(iov, iovcnt, vec);
+    if (err < 0) {
+        return err;
+    }
+
+    file_t* file = fd_to_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+
+    int64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (vec[i].iov_len == 0) {
+            continue;
         }
 
-        case STDOUT_FILENO:
-        case STDERR_FILENO:
-            /* Cannot read from stdout/stderr */
-            return -EBADF;
+        /* Console and pipes block for the first byte only, like a single read() */
+        if (total > 0 && ((console_readable(file) && !tty_input_ready()) ||
+                          (file->type == FILE_TYPE_PIPE && pipe_available(file) == 0))) {
+            break;
+        }
+        int64_t n = read_user(file, vec[i].iov_base, vec[i].iov_len);
 
-        default: {
-            /* File descriptor > 2: route to VFS */
-            process_t* proc = process_current();
-            if (!proc || !proc->fd_table) {
-                return -EBADF;
+        if (n < 0) {
+            if (total == 0) {
+                total = n;
             }
-            if (fd < 0 || fd >= MAX_FD_PER_PROCESS) {
-                return -EBADF;
+            break;
+        }
+        total += n;
+        if ((size_t)n < vec[i].iov_len) {
+            break;
+        }
+    }
+    file_put(file);
+    return total;
+}
+
+/**
+ * @param fd     File descriptor
+ * @param iov    Buffers to write, in order (user space)
+ * @param iovcnt Number of buffers (at most IOV_MAX)
+ * @return       Total bytes written, or negative error on failure
+ */
+int64_t sys_writev(int fd, const iovec_t* iov, int iovcnt) {
+    if (iovcnt == 0) {
+        return 0;
+    }
+
+    iovec_t vec[IOV_MAX];
+    int err = iov_import(iov, iovcnt, vec);
+    if (err < 0) {
+        return err;
+    }
+
+    file_t* file = fd_to_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+
+    int64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (vec[i].iov_len == 0) {
+            continue;
+        }
+
+        int64_t n = write_user(file, vec[i].iov_base, vec[i].iov_len);
+        if (n < 0) {
+            if (total == 0) {
+                total = n;
             }
-            file_t* file = proc->fd_table->entries[fd];
-            if (!file) {
-                return -EBADF;
+            break;
+        }
+        total += n;
+        if ((size_t)n < vec[i].iov_len) {
+            break;
+        }
+    }
+    file_put(file);
+    return total;
+}
+
+/* =============================================================================
+ * sys_pread / sys_pwrite - Positional I/O
+ * =============================================================================
+ * Read or write at 'offset' without using or moving the file offset, so
+ * processes sharing a file (after fork()) need no lseek() in between.
+ * The console and pipes have no offsets and return -ESPIPE.
+ */
+
+/**
+ * Look up a file for positional I/O.
+ *
+ * @return 0 and *out (referenced, see fd_to_file()) on success,
+ *         negative error on failure
+ */
+static int positional_file(int fd, file_t** out) {
+    file_t* file = fd_to_file(fd);
+    if (!file) {
+        return -EBADF;
+    }
+    if (file->type == FILE_TYPE_CONSOLE || file->type == FILE_TYPE_PIPE) {
+        file_put(file);
+        return -ESPIPE;
+    }
+    *out = file;
+    return 0;
+}
+
+/**
+ * @param fd     File descriptor
+ * @param buf    Buffer to fill (user space)
+ * @param len    Maximum number of bytes to read
+ * @param offset File position to read from
+ * @return       Number of bytes read, or negative error on failure
+ */
+int64_t sys_pread(int fd, void* buf, size_t len, int64_t offset) {
+    if (!user_access_ok(buf, len)) {
+        return -EFAULT;
+    }
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    file_t* file;
+    int err = positional_file(fd, &file);
+    if (err < 0) {
+        return err;
+    }
+    int64_t n = file_read_user(file, buf, len, offset);
+    file_put(file);
+    return n;
+}
+
+/**
+ * @param fd     File descriptor
+ * @param buf    Data to write (user space)
+ * @param len    Number of bytes to write
+ * @param offset File position to write at (O_APPEND is ignored)
+ * @return       Number of bytes written, or negative error on failure
+ */
+int64_t sys_pwrite(int fd, const void* buf, size_t len, int64_t offset) {
+    if (!user_access_ok(buf, len)) {
+        return -EFAULT;
+    }
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    file_t* file;
+    int err = positional_file(fd, &file);
+    if (err < 0) {
+        return err;
+    }
+    int64_t n = file_write_user(file, buf, len, offset);
+    file_put(file);
+    return n;
+}
+
+/* =============================================================================
+ * sys_sendfile / sys_copy_file_range - In-Kernel Copies
+ * =============================================================================
+ * The data never crosses into user space. File to file goes through
+ * vfs_copy_range(), which on ramfs shares whole blocks copy-on-write;
+ * file to console or pipe is staged a buffer load at a time so the
+ * console is written with interrupts enabled and a full pipe can sleep.
+ */
+
+/**
+ * Read an optional user offset argument.
+ *
+ * @return 0 on success (*pos = -1 if uoff is NULL), negative error on failure
+ */
+static int offset_import(const int64_t* uoff, int64_t* pos) {
+    *pos = -1;
+    if (!uoff) {
+        return 0;
+    }
+    if (copy_from_user(pos, uoff, sizeof(int64_t)) < 0) {
+        return -EFAULT;
+    }
+    return (*pos < 0) ? -EINVAL : 0;
+}
+
+/**
+ * Copy from a file to the console or a pipe.
+ *
+ * @param pos Offset to read at, or -1 to use and advance the file offset
+ */
+static int64_t file_to_stream(file_t* in, int64_t pos, file_t* out, size_t count) {
+    io_stage_t stage;
+    size_t done = 0;
+    int64_t err = 0;
+
+    io_stage_get(&stage, count);
+    while (done < count) {
+        size_t chunk = MIN(count - done, stage.size);
+
+        uint64_t irq = vfs_lock();
+        uint64_t at = (pos < 0) ? in->offset : (uint64_t)pos + done;
+        int64_t n = vfs_pread(in, stage.buf, chunk, at);
+        if (n > 0 && pos < 0) {
+            in->offset += (uint64_t)n;
+        }
+        vfs_unlock(irq);
+
+        if (n < 0) {
+            err = n;
+            break;
+        }
+        if (out->type == FILE_TYPE_PIPE) {
+            int64_t w = pipe_write(out, stage.buf, (size_t)n, false);
+            if (w < n) {
+                /* No reader left */
+                done += (size_t)MAX(w, 0);
+                err = (w < 0) ? w : 0;
+                break;
             }
-            return vfs_read(file, buf, len);
+        } else {
+            klog_flush();
+            vga_write(stage.buf, (size_t)n);
+        }
+        done += (size_t)n;
+        if ((size_t)n < chunk) {
+            break;          /* End of file */
+        }
+    }
+    io_stage_put(&stage);
+
+    return (done > 0 || err == 0) ? (int64_t)done : err;
+}
+
+/**
+ * Copy between two files.
+ *
+ * @param in_pos  Input offset, or -1 to use and advance in->offset
+ * @param out_pos Output offset, or -1 to use and advance out->offset
+ */
+static int64_t file_to_file(file_t* in, int64_t in_pos, file_t* out, int64_t out_pos,
+                            size_t count) {
+    uint64_t irq = vfs_lock();
+
+    if (out_pos < 0 && (out->flags & O_APPEND) && out->vnode && out->vnode->inode) {
+        out->offset = out->vnode->inode->size;
+    }
+    uint64_t from = (in_pos < 0) ? in->offset : (uint64_t)in_pos;
+    uint64_t to = (out_pos < 0) ? out->offset : (uint64_t)out_pos;
+
+    int64_t n = vfs_copy_range(in, from, out, to, count);
+    if (n > 0) {
+        if (in_pos < 0) {
+            in->offset += (uint64_t)n;
+        }
+        if (out_pos < 0) {
+            out->offset += (uint64_t)n;
+        }
+    }
+
+    vfs_unlock(irq);
+    return n;
+}
+
+/**
+ * Look up a regular file to copy from or to (referenced, see fd_to_file()).
+ */
+static file_t* copy_file(int fd) {
+    file_t* file = fd_to_file(fd);
+    if (file && file->type != FILE_TYPE_REGULAR) {
+        file_put(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * @param out_fd Destination: stdout/stderr, a pipe or a regular file
+ * @param in_fd  Source regular file
+ * @param offset Source offset, updated on return (user space), or NULL
+ *               to use and advance the source file offset
+ * @param count  Maximum bytes to copy
+ * @return       Bytes copied (0 at end of file), or negative error
+ */
+int64_t sys_sendfile(int out_fd, int in_fd, int64_t* offset, size_t count) {
+    int64_t pos;
+    int err = offset_import(offset, &pos);
+    if (err < 0) {
+        return err;
+    }
+
+    file_t* in = copy_file(in_fd);
+    if (!in) {
+        return -EBADF;
+    }
+
+    file_t* out = fd_to_file(out_fd);
+    int64_t n = -EBADF;
+    if (out && (console_writable(out) || out->type == FILE_TYPE_PIPE)) {
+        n = file_to_stream(in, pos, out, count);
+    } else if (out && out->type == FILE_TYPE_REGULAR) {
+        n = file_to_file(in, pos, out, -1, count);
+    }
+    file_put(out);
+    file_put(in);
+
+    if (offset && n > 0) {
+        pos += n;
+        if (copy_to_user(offset, &pos, sizeof(pos)) < 0) {
+            return -EFAULT;
+        }
+    }
+    return n;
+}
+
+/**
+ * @param fd_in   Source regular file
+ * @param off_in  Source offset, updated on return, or NULL for the file offset
+ * @param fd_out  Destination regular file
+ * @param off_out Destination offset, updated on return, or NULL for the file offset
+ * @param len     Maximum bytes to copy
+ * @return        Bytes copied (0 at end of file), or negative error
+ */
+int64_t sys_copy_file_range(int fd_in, int64_t* off_in, int fd_out, int64_t* off_out,
+                            size_t len) {
+    int64_t in_pos, out_pos;
+    int err = offset_import(off_in, &in_pos);
+    if (err == 0) {
+        err = offset_import(off_out, &out_pos);
+    }
+    if (err < 0) {
+        return err;
+    }
+
+    file_t* in = copy_file(fd_in);
+    file_t* out = copy_file(fd_out);
+    int64_t n = -EBADF;
+    if (in && out) {
+        n = file_to_file(in, in_pos, out, out_pos, len);
+        if (n < 0 && in == out) {
+            n = -EINVAL;
+        }
+    }
+    file_put(out);
+    file_put(in);
+    if (n < 0) {
+        return n;
+    }
+
+    if (off_in) {
+        in_pos += n;
+        if (copy_to_user(off_in, &in_pos, sizeof(in_pos)) < 0) {
+            return -EFAULT;
+        }
+    }
+    if (off_out) {
+        out_pos += n;
+        if (copy_to_user(off_out, &out_pos, sizeof(out_pos)) < 0) {
+            return -EFAULT;
+        }
+    }
+    return n;
+}
+
+/* =============================================================================
+ * sys_klog_read - Read the Kernel Log
+ * =============================================================================
+ * Copies the newest kernel log text: everything logged so far, up to the
+ * KLOG_HISTORY_SIZE bytes klog keeps. Whatever is still queued for the
+ * console is flushed first.
+ *
+ * @param buf User buffer
+ * @param len Buffer size
+ * @return    Bytes copied, or negative error
+ */
+int64_t sys_klog_read(char* buf, size_t len) {
+    len = MIN(len, (size_t)KLOG_HISTORY_SIZE);
+    if (len == 0) {
+        return 0;
+    }
+
+    /* Staged on the heap: the log is too big for the kernel stack */
+    char* kbuf = (char*)kmalloc(len);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+
+    klog_flush();
+    size_t n = klog_read(kbuf, len);
+
+    int64_t ret = (int64_t)n;
+    if (copy_to_user(buf, kbuf, n) < 0) {
+        ret = -EFAULT;
+    }
+    kfree(kbuf);
+    return ret;
+}
+
+/* =============================================================================
+ * sys_profile - Control the Sampling Profiler
+ * =============================================================================
+ * PROFILE_READ stages the samples on the heap, PROFILE_READ_MAX at a time:
+ * the rings are read under a spinlock, and copy_to_user() may fault.
+ *
+ * @param op    PROFILE_START, PROFILE_STOP, PROFILE_READ or PROFILE_DROPPED
+ * @param buf   User buffer (PROFILE_READ)
+ * @param count Room in buf, in samples (PROFILE_READ)
+ * @return      Samples read (PROFILE_READ), samples dropped
+ *              (PROFILE_DROPPED), 0, or negative error
+ */
+#define PROFILE_READ_MAX    256
+
+int64_t sys_profile(int op, profile_sample_t* buf, size_t count) {
+    switch (op) {
+    case PROFILE_START:
+        return profile_start() < 0 ? -ENOMEM : 0;
+    case PROFILE_STOP:
+        profile_stop();
+        return 0;
+    case PROFILE_DROPPED:
+        return (int64_t)profile_dropped();
+    case PROFILE_READ:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    count = MIN(count, (size_t)PROFILE_READ_MAX);
+    if (count == 0) {
+        return 0;
+    }
+
+    profile_sample_t* kbuf = (profile_sample_t*)kmalloc(count * sizeof(profile_sample_t));
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+
+    size_t n = profile_read(kbuf, count);
+
+    int64_t ret = (int64_t)n;
+    if (copy_to_user(buf, kbuf, n * sizeof(profile_sample_t)) < 0) {
+        ret = -EFAULT;
+    }
+    kfree(kbuf);
+    return ret;
+}
+
+/* =============================================================================
+ * sys_trace - Control the Tracepoints
+ * =============================================================================
+ * TRACE_READ stages the records on the heap, TRACE_READ_MAX at a time,
+ * like PROFILE_READ.
+ *
+ * @param op  TRACE_START, TRACE_STOP, TRACE_READ or TRACE_DROPPED
+ * @param buf User buffer (TRACE_READ)
+ * @param arg Categories to trace (TRACE_START), or room in buf, in
+ *            records (TRACE_READ)
+ * @return    Records read (TRACE_READ), records dropped (TRACE_DROPPED),
+ *            0, or negative error
+ */
+#define TRACE_READ_MAX      256
+
+int64_t sys_trace(int op, trace_record_t* buf, size_t arg) {
+    switch (op) {
+    case TRACE_START:
+        if (arg == 0 || (arg & ~(size_t)TRACE_ALL) != 0) {
+            return -EINVAL;
         }
+        return trace_start((uint32_t)arg) < 0 ? -ENOMEM : 0;
+    case TRACE_STOP:
+        trace_stop();
+        return 0;
+    case TRACE_DROPPED:
+        return (int64_t)trace_dropped();
+    case TRACE_READ:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    size_t count = MIN(arg, (size_t)TRACE_READ_MAX);
+    if (count == 0) {
+        return 0;
+    }
+
+    trace_record_t* kbuf = (trace_record_t*)kmalloc(count * sizeof(trace_record_t));
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+
+    size_t n = trace_read(kbuf, count);
+
+    int64_t ret = (int64_t)n;
+    if (copy_to_user(buf, kbuf, n * sizeof(trace_record_t)) < 0) {
+        ret = -EFAULT;
     }
+    kfree(kbuf);
+    return ret;
 }
@@ -0,0 +1,150 @@
+/**
+ * =============================================================================
+ * Chanux OS - Batched File I/O Ring System Calls
+ * =============================================================================
+ * Implements the submission/completion ring of syscall/io_ring.h:
+ *   - sys_io_ring_setup: Register the caller's ring
+ *   - sys_io_ring_enter: Run the queued submissions
+ *
+ * The ring stays in user memory and is only touched through
+ * copy_from_user()/copy_to_user(), so copy-on-write after fork(),
+ * demand-zero BSS and a ring that was unmapped behave as for any other
+ * user buffer. Each SQE is copied in before use; user space rewriting a
+ * slot mid-batch can only change its own results.
+ * =============================================================================
+ */
+
+#include "syscall/syscall.h"
+#include "syscall/io_ring.h"
+#include "proc/process.h"
+#include "kernel.h"
+#include "user/uaccess.h"
+
+/* =============================================================================
+ * Operation Dispatch
+ * =============================================================================
+ */
+
+static int64_t io_ring_dispatch(const io_sqe_t* sqe) {
+    switch (sqe->opcode) {
+        case IO_OP_NOP:
+            return 0;
+        case IO_OP_OPEN:
+            return sys_open((const char*)sqe->addr, (int)sqe->len);
+        case IO_OP_CLOSE:
+            return sys_close(sqe->fd);
+        case IO_OP_READ:
+            return sys_read(sqe->fd, (void*)sqe->addr, (size_t)sqe->len);
+        case IO_OP_WRITE:
+            return sys_write(sqe->fd, (const void*)sqe->addr, (size_t)sqe->len);
+        case IO_OP_LSEEK:
+            return sys_lseek(sqe->fd, sqe->off, (int)sqe->len);
+        case IO_OP_STAT:
+            return sys_stat((const char*)sqe->addr, (void*)sqe->addr2);
+        case IO_OP_FSTAT:
+            return sys_fstat(sqe->fd, (void*)sqe->addr);
+        case IO_OP_READDIR:
+            return sys_readdir(sqe->fd, (void*)sqe->addr, (int)sqe->off);
+        case IO_OP_PREAD:
+            return sys_pread(sqe->fd, (void*)sqe->addr, (size_t)sqe->len, sqe->off);
+        case IO_OP_PWRITE:
+            return sys_pwrite(sqe->fd, (const void*)sqe->addr, (size_t)sqe->len, sqe->off);
+        default:
+            return -EINVAL;
+    }
+}
+
+/* =============================================================================
+ * sys_io_ring_setup - Register a Ring
+ * =============================================================================
+ */
+
+/**
+ * Register (or, with NULL, unregister) the caller's ring.
+ * Resets all four indices. A forked child inherits the registration along
+ * with its copy of the memory.
+ *
+ * @param ring io_ring_t in user memory
+ * @return     0 on success, negative error on failure
+ */
+int64_t sys_io_ring_setup(void* ring) {
+    process_t* proc = process_current();
+
+    if (ring == NULL) {
+        proc->io_ring = NULL;
+        return 0;
+    }
+    if (!user_access_ok(ring, sizeof(io_ring_t)) ||
+        ((uintptr_t)ring & (sizeof(uint64_t) - 1)) != 0) {
+        return -EFAULT;
+    }
+
+    /* Reset the four indices at the start of the ring */
+    uint32_t indices[4] = { 0, 0, 0, 0 };
+    if (copy_to_user(ring, indices, sizeof(indices)) < 0) {
+        return -EFAULT;
+    }
+
+    proc->io_ring = (io_ring_t*)ring;
+    return 0;
+}
+
+/* =============================================================================
+ * sys_io_ring_enter - Run Submissions
+ * =============================================================================
+ */
+
+/**
+ * Run up to 'to_submit' queued SQEs, posting one CQE for each.
+ * Stops early when the SQ is empty or the CQ is full.
+ *
+ * @param to_submit Maximum SQEs to consume
+ * @return          Number of SQEs consumed, or negative error
+ */
+int64_t sys_io_ring_enter(uint32_t to_submit) {
+    io_ring_t* ring = process_current()->io_ring;
+    if (!ring) {
+        return -EINVAL;
+    }
+
+    uint32_t sq_head, sq_tail, cq_tail;
+    if (copy_from_user(&sq_head, &ring->sq_head, sizeof(uint32_t)) < 0 ||
+        copy_from_user(&sq_tail, &ring->sq_tail, sizeof(uint32_t)) < 0 ||
+        copy_from_user(&cq_tail, &ring->cq_tail, sizeof(uint32_t)) < 0) {
+        return -EFAULT;
+    }
+
+    /* Indices the kernel owns must still be sane */
+    if (sq_tail - sq_head > IO_RING_ENTRIES) {
+        return -EINVAL;
+    }
+
+    uint32_t done = 0;
+    while (done < to_submit && sq_head != sq_tail) {
+        uint32_t cq_head;
+        if (copy_from_user(&cq_head, &ring->cq_head, sizeof(uint32_t)) < 0) {
+            break;
+        }
+        if (cq_tail - cq_head >= IO_RING_ENTRIES) {
+            break;
+        }
+
+        io_sqe_t sqe;
+        if (copy_from_user(&sqe, &ring->sq[sq_head & IO_RING_MASK], sizeof(sqe)) < 0) {
+            break;
+        }
+        io_cqe_t cqe = { .user_data = sqe.user_data, .res = io_ring_dispatch(&sqe) };
+
+        /* x86 keeps stores in order: the CQE is visible before cq_tail moves */
+        sq_head++;
+        cq_tail++;
+        done++;
+        if (copy_to_user(&ring->cq[(cq_tail - 1) & IO_RING_MASK], &cqe, sizeof(cqe)) < 0 ||
+            copy_to_user(&ring->cq_tail, &cq_tail, sizeof(uint32_t)) < 0 ||
+            copy_to_user(&ring->sq_head, &sq_head, sizeof(uint32_t)) < 0) {
+            break;
+        }
+    }
+
+    return (int64_t)done;
+}
@@ -0,0 +1,183 @@
+/**
+ * =============================================================================
+ * Chanux OS - Memory Mapping System Calls
+ * =============================================================================
+ * Implements mmap()/munmap() of regular files:
+ *   - sys_mmap:   Map a file range into the caller's address space
+ *   - sys_munmap: Remove a mapping
+ *
+ * ramfs data blocks are page frames, so a mapping is the file data itself:
+ * its frames are entered directly (PTE_SHARED) and reading or writing a
+ * mapped file takes no copy and no system call. MAP_SHARED pages are
+ * writable and every change is the file's; MAP_PRIVATE pages are mapped
+ * read-only + PTE_COW and copied on the first write. A mapping fills at
+ * most its USER_MMAP_SLOT_SIZE slot; mmap() only reserves it, and each
+ * page is entered by the demand-fault path on first touch
+ * (user_handle_page_fault()).
+ *
+ * Faulted-in blocks stay pinned (ramfs_map_pages()): if the file is
+ * truncated or removed, they outlive it until the mapping goes away, and
+ * nothing else can be stored in them meanwhile.
+ * =============================================================================
+ */
+
+#include "syscall/syscall.h"
+#include "proc/process.h"
+#include "user/user.h"
+#include "mm/vmm.h"
+#include "fs/vfs.h"
+#include "fs/file.h"
+#include "mm/heap.h"
+#include "kernel.h"
+
+/* =============================================================================
+ * sys_mmap - Map a File
+ * =============================================================================
+ */
+
+/**
+ * @param addr   Placement hint (ignored; each mapping has its own slot)
+ * @param length Bytes to map (rounded up to whole pages, at most one slot)
+ * @param prot   PROT_* (pages are always readable)
+ * @param flags  MAP_SHARED or MAP_PRIVATE
+ * @param fd     Regular file, opened for reading (and writing for a
+ *               writable MAP_SHARED mapping)
+ * @param offset Page-aligned file position to map from
+ * @return Address of the mapping, or negative error code
+ */
+int64_t sys_mmap(void* addr, size_t length, int prot, int flags, int fd, int64_t offset) {
+    process_t* proc = process_current();
+    (void)addr;
+
+    if (!(proc->flags & PROCESS_FLAG_USER) || proc->pml4_phys == 0) {
+        return -EINVAL;
+    }
+
+    int type = flags & (MAP_SHARED | MAP_PRIVATE);
+    if ((type != MAP_SHARED && type != MAP_PRIVATE) || (flags & ~type) ||
+        (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))) {
+        return -EINVAL;
+    }
+    if (length == 0 || length > USER_MMAP_SLOT_SIZE ||
+        offset < 0 || offset % PAGE_SIZE != 0) {
+        return -EINVAL;
+    }
+    bool shared = (type == MAP_SHARED);
+    uint32_t count = (uint32_t)(ALIGN_UP(length, PAGE_SIZE) / PAGE_SIZE);
+
+    /* Referenced, as another thread may close fd while this one maps it */
+    file_t* file = NULL;
+    if (proc->fd_table && fd >= 0 && fd < MAX_FD_PER_PROCESS) {
+        file = fd_get_file_ref(proc->fd_table, fd);
+    }
+    if (!file) {
+        return -EBADF;
+    }
+
+    /* Pinned page ids, filled in as the pages fault in */
+    uint32_t* pages = (uint32_t*)kzalloc((size_t)count * sizeof(uint32_t));
+    if (!pages) {
+        file_put(file);
+        return -ENOMEM;
+    }
+
+    /* The mapping table is the thread group's */
+    process_t* vm = proc->group;
+    uint64_t vm_irq = spin_lock_irqsave(&vm->vm_lock);
+
+    user_mmap_t* map = NULL;
+    uint32_t slot;
+    for (slot = 0; slot < PROCESS_MAX_MMAPS; slot++) {
+        if (!vm->mmaps[slot].vnode) {
+            map = &vm->mmaps[slot];
+            break;
+        }
+    }
+    if (!map) {
+        spin_unlock_irqrestore(&vm->vm_lock, vm_irq);
+        kfree(pages);
+        file_put(file);
+        return -ENOMEM;
+    }
+
+    /* Claim the slot; nothing is mapped until it is touched */
+    int64_t err = 0;
+    uint64_t irq = vfs_lock();
+
+    if (!file->vnode) {
+        err = -ENODEV;
+    } else if (file->vnode->type != INODE_TYPE_FILE) {
+        err = -EISDIR;
+    } else if ((file->flags & O_ACCMODE) == O_WRONLY ||
+               (shared && (prot & PROT_WRITE) && (file->flags & O_ACCMODE) == O_RDONLY)) {
+        err = -EACCES;
+    } else if ((uint64_t)offset / PAGE_SIZE > RAMFS_MAX_FILE_BLOCKS - count) {
+        err = -EINVAL;
+    } else {
+        uint64_t pte_flags = PTE_PRESENT | PTE_USER | PTE_SHARED;
+        if (prot & PROT_WRITE) {
+            pte_flags |= shared ? PTE_WRITABLE : PTE_COW;
+        }
+        if (!(prot & PROT_EXEC)) {
+            pte_flags |= PTE_NX;
+        }
+
+        vnode_ref(file->vnode);
+        map->vnode = file->vnode;
+        map->start = USER_MMAP_BASE + (uint64_t)slot * USER_MMAP_SLOT_SIZE;
+        map->flags = pte_flags;
+        map->first = (uint32_t)((uint64_t)offset / PAGE_SIZE);
+        map->page_count = count;
+        map->shared = shared;
+        map->pages = pages;
+    }
+
+    /* The mapping holds the vnode from here on, not the file */
+    file_unref(file);
+    vfs_unlock(irq);
+
+    uint64_t start = map->start;
+    spin_unlock_irqrestore(&vm->vm_lock, vm_irq);
+    if (err < 0) {
+        kfree(pages);
+        return err;
+    }
+    return (int64_t)start;
+}
+
+/* =============================================================================
+ * sys_munmap - Remove a Mapping
+ * =============================================================================
+ */
+
+/**
+ * @param addr   Start of a mapping returned by mmap()
+ * @param length Its length (whole mappings only)
+ * @return 0 on success, negative error code on failure
+ */
+int64_t sys_munmap(void* addr, size_t length) {
+    process_t* vm = process_current()->group;
+    uint64_t start = (uint64_t)addr;
+
+    if (length == 0 || start % PAGE_SIZE != 0) {
+        return -EINVAL;
+    }
+
+    int64_t err = -EINVAL;
+    uint64_t irq = spin_lock_irqsave(&vm->vm_lock);
+
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        user_mmap_t* map = &vm->mmaps[i];
+        if (!map->vnode || map->start != start) {
+            continue;
+        }
+        if (ALIGN_UP(length, PAGE_SIZE) == (uint64_t)map->page_count * PAGE_SIZE) {
+            user_mmap_remove(vm, map);
+            err = 0;
+        }
+        break;
+    }
+
+    spin_unlock_irqrestore(&vm->vm_lock, irq);
+    return err;
+}
@@ -7,14 +7,28 @@
  *   - sys_yield: Voluntarily yield CPU to other processes
  *   - sys_getpid: Get the current process ID
  *   - sys_sleep: Sleep for a specified number of milliseconds
+ *   - sys_nanosleep: Sleep for a specified number of nanoseconds
+ *   - sys_futex_wait/sys_futex_wake: Sleep on and wake a user memory word
+ *   - sys_fork: Create a copy-on-write child process
+ *   - sys_thread_create: Start another thread in the caller's address space
  * =============================================================================
  */
 
 #include "syscall/syscall.h"
 #include "proc/process.h"
 #include "proc/sched.h"
+#include "proc/futex.h"
+#include "mm/vmm.h"
+#include "mm/heap.h"
+#include "mm/pmm.h"
+#include "user/user.h"
+#include "user/vdso.h"
+#include "user/elf.h"
+#include "fs/file.h"
+#include "fs/vfs.h"
 #include "kernel.h"
-#include "drivers/pit.h"
+#include "clock.h"
+#include "fpu.h"
 #include "drivers/vga/vga.h"
 
 /* =============================================================================
@@ -55,13 +69,14 @@ int64_t sys_yield(void) {
 /* =============================================================================
  * sys_getpid - Get Process ID
  * =============================================================================
- * Returns the process ID of the calling process.
+ * Returns the process ID of the calling process; every thread of a
+ * process gets the same one.
  *
  * @return Process ID (always >= 0)
  */
 int64_t sys_getpid(void) {
     process_t* current = process_current();
-    return (int64_t)current->pid;
+    return (int64_t)current->tgid;
 }
 
 /* =============================================================================
@@ -81,19 +96,250 @@ int64_t sys_sleep(uint64_t ms) {
         return 0;
     }
 
-    process_t* current = process_current();
+    return sys_nanosleep(ms * NSEC_PER_MSEC);
+}
 
-    /* Calculate wake tick */
-    /* PIT runs at 100Hz, so 1 tick = 10ms */
-    uint64_t current_tick = pit_get_ticks();
-    uint64_t ticks_to_sleep = (ms + 9) / 10;  /* Round up */
-    current->wake_tick = current_tick + ticks_to_sleep;
+/* =============================================================================
+ * sys_nanosleep - Sleep for Nanoseconds
+ * =============================================================================
+ * Like sys_sleep, at the timer wheel's resolution (about 65us) rather than
+ * the 10ms scheduler tick.
+ *
+ * @param ns Number of nanoseconds to sleep
+ * @return   0 on success, negative on error
+ */
+int64_t sys_nanosleep(uint64_t ns) {
+    if (ns == 0) {
+        process_yield();
+        return 0;
+    }
 
-    /* Block the process */
-    process_block();
+    process_t* current = process_current();
+    process_sleep(clock_ns() + ns);
 
     /* When we return here, we've been unblocked */
-    current->wake_tick = 0;
+    current->wake_time = 0;
 
     return 0;
 }
+
+/* =============================================================================
+ * sys_futex_wait - Sleep on a User Word
+ * =============================================================================
+ * Blocks until woken by sys_futex_wake on the same word, unless the word
+ * no longer holds 'val' (see proc/futex.h).
+ *
+ * @param addr User address of the word (4-byte aligned)
+ * @param val  Value the caller expects it to hold
+ * @return     0 when woken, -EAGAIN if the word changed, -EINVAL/-EFAULT
+ */
+int64_t sys_futex_wait(uint32_t* addr, uint32_t val) {
+    return futex_wait(addr, val);
+}
+
+/* =============================================================================
+ * sys_futex_wake - Wake Waiters on a User Word
+ * =============================================================================
+ * @param addr  User address of the word (4-byte aligned)
+ * @param count Maximum number of waiters to wake
+ * @return      Number of processes woken, -EINVAL/-EFAULT
+ */
+int64_t sys_futex_wake(uint32_t* addr, int count) {
+    return futex_wake(addr, count);
+}
+
+/* =============================================================================
+ * sys_fork - Create Child Process
+ * =============================================================================
+ * Creates a child that resumes from the same syscall with a return value of
+ * 0. The child's address space shares every user page with the parent
+ * copy-on-write, so the cost is one page-table copy; the descriptor array
+ * is shared copy-on-write too (fd_table_clone()). File mappings keep
+ * pointing at the same file pages (MAP_SHARED writes are seen by both
+ * sides). Forking a process with several threads copies only the calling
+ * one.
+ */
+
+/* Everything the child needs, handed over through its entry argument */
+typedef struct {
+    syscall_frame_t     frame;          /* Parent's user context at syscall entry */
+    phys_addr_t         pml4_phys;      /* Cloned address space */
+    struct fd_table*    fd_table;       /* Cloned descriptor table */
+    void*               user_stack;
+    uint64_t            user_stack_top;
+    void*               user_code;
+    size_t              user_code_size;
+    struct user_image*  image;          /* Program, referenced again */
+    user_region_t       regions[PROCESS_MAX_REGIONS];
+    uint32_t            region_count;
+    uint32_t            thread_slots;   /* Thread stacks stay reserved in the copy */
+    user_mmap_t         mmaps[PROCESS_MAX_MMAPS]; /* Same file pages, referenced again */
+    phys_addr_t         vdso_page;      /* The child's own vvar process page */
+    struct io_ring*     io_ring;        /* Same address in the copied memory */
+    void*               fpu_state;      /* Copy of the FPU registers, or NULL */
+} fork_args_t;
+
+/**
+ * Kernel entry point of a forked child.
+ * Installs the inherited state into the child's PCB and drops to user mode
+ * at the instruction after the parent's SYSCALL.
+ */
+static void fork_child_entry(void* arg) {
+    fork_args_t* args = (fork_args_t*)arg;
+    process_t* proc = process_current();
+    syscall_frame_t frame = args->frame;
+
+    /* Replace the default stdio table process_create() gave us */
+    struct fd_table* default_table = proc->fd_table;
+
+    cli();
+    proc->fd_table = args->fd_table;
+    proc->flags |= PROCESS_FLAG_USER;
+    proc->pml4_phys = args->pml4_phys;
+    proc->user_stack = args->user_stack;
+    proc->user_stack_top = args->user_stack_top;
+    proc->user_code = args->user_code;
+    proc->user_code_size = args->user_code_size;
+    proc->image = args->image;
+    for (uint32_t i = 0; i < args->region_count; i++) {
+        proc->regions[i] = args->regions[i];
+    }
+    proc->region_count = args->region_count;
+    proc->thread_slots = args->thread_slots;
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        proc->mmaps[i] = args->mmaps[i];
+    }
+    proc->io_ring = args->io_ring;
+    proc->fpu_state = args->fpu_state;
+    sti();
+
+    if (default_table) {
+        uint64_t irq = vfs_lock();
+        fd_table_destroy(default_table);
+        vfs_unlock(irq);
+    }
+    phys_addr_t vdso_page = args->vdso_page;
+    kfree(args);
+
+    vmm_switch_address_space(proc->pml4_phys);
+    vdso_install_proc_page(proc, vdso_page);
+    syscall_fork_return(&frame);
+}
+
+/**
+ * @return Child PID in the parent, 0 in the child, negative on error
+ */
+int64_t sys_fork(void) {
+    process_t* parent = process_current();
+    process_t* vm = parent->group;
+
+    if (!(parent->flags & PROCESS_FLAG_USER) || parent->pml4_phys == 0) {
+        return -EINVAL;
+    }
+
+    fork_args_t* args = (fork_args_t*)kmalloc(sizeof(fork_args_t));
+    if (!args) {
+        return -ENOMEM;
+    }
+
+    /* syscall_entry built this frame at the top of our kernel stack */
+    args->frame = *(const syscall_frame_t*)(parent->kernel_stack_top -
+                                            sizeof(syscall_frame_t));
+    args->user_stack = parent->user_stack;
+    args->user_stack_top = parent->user_stack_top;
+    args->user_code = parent->user_code;
+    args->user_code_size = parent->user_code_size;
+    args->image = vm->image;
+    args->io_ring = parent->io_ring;
+
+    args->vdso_page = vdso_alloc_proc_page();
+    if (args->vdso_page == 0) {
+        kfree(args);
+        return -ENOMEM;
+    }
+
+    /* Other threads must not fault pages in or unmap them meanwhile */
+    uint64_t vm_irq = spin_lock_irqsave(&vm->vm_lock);
+    for (uint32_t i = 0; i < vm->region_count; i++) {
+        args->regions[i] = vm->regions[i];
+    }
+    args->region_count = vm->region_count;
+    args->thread_slots = vm->thread_slots;
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        args->mmaps[i] = vm->mmaps[i];
+    }
+
+    args->pml4_phys = vmm_clone_user_space(parent->pml4_phys);
+    if (args->pml4_phys != 0 && vm->group_threads > 1) {
+        /* Our pages are read-only now, but other CPUs may still cache them writable */
+        vmm_shootdown_user(parent->pml4_phys, USER_SPACE_START,
+                           USER_SPACE_END - USER_SPACE_START);
+    }
+    bool mmaps_ok = args->pml4_phys != 0 && user_mmap_copy(args->mmaps);
+    spin_unlock_irqrestore(&vm->vm_lock, vm_irq);
+
+    if (args->pml4_phys == 0) {
+        pmm_free_page(args->vdso_page);
+        kfree(args);
+        return -ENOMEM;
+    }
+
+    if (!mmaps_ok) {
+        vmm_destroy_address_space(args->pml4_phys);
+        pmm_free_page(args->vdso_page);
+        kfree(args);
+        return -ENOMEM;
+    }
+
+    uint64_t irq = vfs_lock();
+    args->fd_table = fd_table_clone(parent->fd_table);
+    vfs_unlock(irq);
+    if (!args->fd_table) {
+        vmm_destroy_address_space(args->pml4_phys);
+        user_mmap_release(args->mmaps);
+        pmm_free_page(args->vdso_page);
+        kfree(args);
+        return -ENOMEM;
+    }
+
+    /* The child's copy of the page tables maps the image too */
+    if (args->image) {
+        user_image_ref(args->image);
+    }
+
+    /* The child resumes with our FPU registers too */
+    bool fpu_ok = fpu_state_clone(parent, &args->fpu_state);
+
+    pid_t pid = fpu_ok ? process_create(parent->name, fork_child_entry, args) : (pid_t)-1;
+    if (pid == (pid_t)-1) {
+        fpu_state_free(args->fpu_state);
+        user_image_put(args->image);
+        irq = vfs_lock();
+        fd_table_destroy(args->fd_table);
+        vfs_unlock(irq);
+        vmm_destroy_address_space(args->pml4_phys);
+        user_mmap_release(args->mmaps);
+        pmm_free_page(args->vdso_page);
+        kfree(args);
+        return fpu_ok ? -EAGAIN : -ENOMEM;
+    }
+
+    return (int64_t)pid;
+}
+
+/* =============================================================================
+ * sys_thread_create - Start a Thread
+ * =============================================================================
+ * The new thread shares the caller's memory and open files, and starts in
+ * user mode at entry(arg0, arg1) on a stack of its own (see
+ * user_thread_create()). It ends with sys_exit; the process ends when its
+ * last thread does.
+ *
+ * @param entry User function to run
+ * @param arg0  First argument (RDI)
+ * @param arg1  Second argument (RSI)
+ * @return      PID of the new thread, or negative error code
+ */
+int64_t sys_thread_create(void* entry, void* arg0, void* arg1) {
+    return user_thread_create((uint64_t)entry, (uint64_t)arg0, (uint64_t)arg1);
+}
@@ -11,343 +11,239 @@
  *   - STAR: Segment selectors (kernel CS/SS in bits 32-47, user in bits 48-63)
  *   - LSTAR: 64-bit syscall entry point address
  *   - SFMASK: RFLAGS bits to clear on syscall (we clear IF)
+ *
+ * syscall_entry also times every call with the TSC and hands it to
+ * syscall_account(), which keeps per-CPU counters and latency histograms
+ * (read back with sysstat()).
  * =============================================================================
  */
 
 #include "syscall/syscall.h"
 #include "gdt.h"
 #include "kernel.h"
+#include "string.h"
+#include "clock.h"
+#include "smp.h"
+#include "mm/pmm.h"
+#include "user/uaccess.h"
 #include "drivers/vga/vga.h"
 
-/* =============================================================================
- * MSR Read/Write Helpers
- * =============================================================================
- */
-
-/**
- * Read a Model-Specific Register.
- */
-static inline uint64_t rdmsr(uint32_t msr) {
-    uint32_t low, high;
-    __asm__ volatile (
-        "rdmsr"
-        : "=a"(low), "=d"(high)
-        : "c"(msr)
-    );
-    return ((uint64_t)high << 32) | low;
-}
-
-/**
- * Write to a Model-Specific Register.
- */
-static inline void wrmsr(uint32_t msr, uint64_t value) {
-    uint32_t low = (uint32_t)value;
-    uint32_t high = (uint32_t)(value >> 32);
-    __asm__ volatile (
-        "wrmsr"
-        :
-        : "c"(msr), "a"(low), "d"(high)
-    );
-}
-
 /* =============================================================================
  * Syscall Table
  * =============================================================================
- */
-
-/* Forward declarations of syscall handlers */
-static int64_t sys_exit_wrapper(uint64_t code, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_write_wrapper(uint64_t fd, uint64_t buf, uint64_t len, uint64_t, uint64_t, uint64_t);
-static int64_t sys_read_wrapper(uint64_t fd, uint64_t buf, uint64_t len, uint64_t, uint64_t, uint64_t);
-static int64_t sys_yield_wrapper(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_getpid_wrapper(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_sleep_wrapper(uint64_t ms, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-
-/* Phase 6: File system syscall wrappers */
-static int64_t sys_open_wrapper(uint64_t path, uint64_t flags, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_close_wrapper(uint64_t fd, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_lseek_wrapper(uint64_t fd, uint64_t offset, uint64_t whence, uint64_t, uint64_t, uint64_t);
-static int64_t sys_stat_wrapper(uint64_t path, uint64_t buf, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_fstat_wrapper(uint64_t fd, uint64_t buf, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_readdir_wrapper(uint64_t fd, uint64_t entry, uint64_t index, uint64_t, uint64_t, uint64_t);
-static int64_t sys_getcwd_wrapper(uint64_t buf, uint64_t size, uint64_t, uint64_t, uint64_t, uint64_t);
-static int64_t sys_chdir_wrapper(uint64_t path, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-
-/* Syscall handler table */
-static syscall_fn_t syscall_table[SYS_MAX] = {
-    [SYS_EXIT]    = sys_exit_wrapper,
-    [SYS_WRITE]   = sys_write_wrapper,
-    [SYS_READ]    = sys_read_wrapper,
-    [SYS_YIELD]   = sys_yield_wrapper,
-    [SYS_GETPID]  = sys_getpid_wrapper,
-    [SYS_SLEEP]   = sys_sleep_wrapper,
+ * syscall_entry calls these handlers directly, with the user's argument
+ * registers in place (R10 moved to RCX). Every parameter is an integer or
+ * a pointer, so under the SysV ABI each handler can be called through the
+ * generic six-register type: unused registers are ignored and narrower
+ * parameters read only the low bits.
+ */
+
+#define SYSCALL(fn)     ((syscall_fn_t)(void (*)(void))(fn))
+
+/* Syscall handler table (indexed by syscall_entry) */
+syscall_fn_t syscall_table[SYS_MAX] = {
+    [SYS_EXIT]    = SYSCALL(sys_exit),
+    [SYS_WRITE]   = SYSCALL(sys_write),
+    [SYS_READ]    = SYSCALL(sys_read),
+    [SYS_YIELD]   = SYSCALL(sys_yield),
+    [SYS_GETPID]  = SYSCALL(sys_getpid),
+    [SYS_SLEEP]   = SYSCALL(sys_sleep),
     /* Phase 6: File system syscalls */
-    [SYS_OPEN]    = sys_open_wrapper,
-    [SYS_CLOSE]   = sys_close_wrapper,
-    [SYS_LSEEK]   = sys_lseek_wrapper,
-    [SYS_STAT]    = sys_stat_wrapper,
-    [SYS_FSTAT]   = sys_fstat_wrapper,
-    [SYS_READDIR] = sys_readdir_wrapper,
-    [SYS_GETCWD]  = sys_getcwd_wrapper,
-    [SYS_CHDIR]   = sys_chdir_wrapper,
-};
-
-/* Syscall names for debugging */
-static const char* syscall_names[SYS_MAX] = {
-    [SYS_EXIT]    = "exit",
-    [SYS_WRITE]   = "write",
-    [SYS_READ]    = "read",
-    [SYS_YIELD]   = "yield",
-    [SYS_GETPID]  = "getpid",
-    [SYS_SLEEP]   = "sleep",
-    /* Phase 6: File system syscalls */
-    [SYS_OPEN]    = "open",
-    [SYS_CLOSE]   = "close",
-    [SYS_LSEEK]   = "lseek",
-    [SYS_STAT]    = "stat",
-    [SYS_FSTAT]   = "fstat",
-    [SYS_READDIR] = "readdir",
-    [SYS_GETCWD]  = "getcwd",
-    [SYS_CHDIR]   = "chdir",
+    [SYS_OPEN]    = SYSCALL(sys_open),
+    [SYS_CLOSE]   = SYSCALL(sys_close),
+    [SYS_LSEEK]   = SYSCALL(sys_lseek),
+    [SYS_STAT]    = SYSCALL(sys_stat),
+    [SYS_FSTAT]   = SYSCALL(sys_fstat),
+    [SYS_READDIR] = SYSCALL(sys_readdir),
+    [SYS_GETCWD]  = SYSCALL(sys_getcwd),
+    [SYS_CHDIR]   = SYSCALL(sys_chdir),
+    [SYS_FORK]    = SYSCALL(sys_fork),
+    [SYS_NANOSLEEP] = SYSCALL(sys_nanosleep),
+    [SYS_IO_RING_SETUP] = SYSCALL(sys_io_ring_setup),
+    [SYS_IO_RING_ENTER] = SYSCALL(sys_io_ring_enter),
+    [SYS_READV]   = SYSCALL(sys_readv),
+    [SYS_WRITEV]  = SYSCALL(sys_writev),
+    [SYS_PREAD]   = SYSCALL(sys_pread),
+    [SYS_PWRITE]  = SYSCALL(sys_pwrite),
+    [SYS_SENDFILE] = SYSCALL(sys_sendfile),
+    [SYS_COPY_FILE_RANGE] = SYSCALL(sys_copy_file_range),
+    [SYS_MMAP]    = SYSCALL(sys_mmap),
+    [SYS_MUNMAP]  = SYSCALL(sys_munmap),
+    [SYS_SYNC]    = SYSCALL(sys_sync),
+    [SYS_PIPE]    = SYSCALL(sys_pipe),
+    [SYS_DUP2]    = SYSCALL(sys_dup2),
+    [SYS_FUTEX_WAIT] = SYSCALL(sys_futex_wait),
+    [SYS_FUTEX_WAKE] = SYSCALL(sys_futex_wake),
+    [SYS_THREAD_CREATE] = SYSCALL(sys_thread_create),
+    [SYS_KLOG_READ] = SYSCALL(sys_klog_read),
+    [SYS_SYSSTAT] = SYSCALL(sys_sysstat),
+    [SYS_PROFILE] = SYSCALL(sys_profile),
+    [SYS_TRACE]   = SYSCALL(sys_trace),
 };
 
 /* =============================================================================
- * Syscall Initialization
+ * Syscall Statistics
  * =============================================================================
- */
-
-/**
- * Initialize the system call subsystem.
+ * One block of SYS_MAX records per CPU, written only by that CPU with
+ * interrupts off, so counting needs no lock or atomic. Blocks are padded
+ * to whole cache lines, so CPUs never share one.
  *
- * Configures the MSRs required for SYSCALL/SYSRET:
- *   - STAR: Segment selector bases
- *   - LSTAR: Syscall entry point
- *   - SFMASK: RFLAGS mask
+ * 16 CPUs' worth is too big for the kernel image, so the blocks come
+ * from the PMM in syscall_init(); calls before that are not counted.
  */
-void syscall_init(void) {
-    kprintf("syscall: Initializing system call interface...\n");
-
-    /*
-     * Enable SYSCALL/SYSRET by setting EFER.SCE (bit 0).
-     * The bootloader already set EFER.LME and EFER.NXE.
-     */
-    uint64_t efer = rdmsr(MSR_EFER);
-    efer |= EFER_SCE;
-    wrmsr(MSR_EFER, efer);
-    kprintf("syscall: EFER.SCE enabled (EFER = 0x%x)\n", (uint32_t)efer);
-
-    /*
-     * STAR MSR (0xC0000081):
-     *   Bits 31:0  - Reserved (EIP for 32-bit SYSCALL, not used in 64-bit)
-     *   Bits 47:32 - Kernel CS (SYSCALL loads CS from here, SS = CS + 8)
-     *   Bits 63:48 - User CS base (SYSRET loads CS from here + 16, SS from here + 8)
-     *
-     * For our GDT:
-     *   Kernel CS = 0x08, Kernel SS = 0x10
-     *   User Data = 0x28 (SYSRET SS = base + 8)
-     *   User Code = 0x30 (SYSRET CS = base + 16)
-     *
-     * So: STAR[47:32] = 0x08 (kernel CS)
-     *     STAR[63:48] = 0x20 (user base, so SS=0x28, CS=0x30)
-     */
-    uint64_t star = ((uint64_t)0x0020 << 48) |  /* User segment base */
-                    ((uint64_t)0x0008 << 32);   /* Kernel code segment */
-    wrmsr(MSR_STAR, star);
-    kprintf("syscall: STAR MSR = 0x%016llX\n", star);
 
-    /*
-     * LSTAR MSR (0xC0000082):
-     *   64-bit syscall entry point address
-     */
-    extern void syscall_entry(void);
-    uint64_t lstar = (uint64_t)syscall_entry;
-    wrmsr(MSR_LSTAR, lstar);
-    kprintf("syscall: LSTAR MSR = 0x%016llX (syscall_entry)\n", lstar);
+typedef struct {
+    syscall_stat_t  stats[SYS_MAX];
+} ALIGNED(64) syscall_stat_block_t;
 
-    /*
-     * SFMASK MSR (0xC0000084):
-     *   RFLAGS bits to clear on SYSCALL
-     *   We clear IF (bit 9) to disable interrupts on entry
-     */
-    uint64_t sfmask = SYSCALL_RFLAGS_MASK;
-    wrmsr(MSR_SFMASK, sfmask);
-    kprintf("syscall: SFMASK MSR = 0x%016llX (clear IF)\n", sfmask);
-
-    kprintf("syscall: System call interface initialized\n");
-    kprintf("syscall: %d system calls registered\n", SYS_MAX);
-}
+static syscall_stat_block_t* syscall_stats = NULL;
 
 /* =============================================================================
- * Syscall Dispatcher
+ * Syscall Initialization
  * =============================================================================
  */
 
-/**
- * Dispatch a system call to the appropriate handler.
+/*
+ * STAR MSR (0xC0000081):
+ *   Bits 31:0  - Reserved (EIP for 32-bit SYSCALL, not used in 64-bit)
+ *   Bits 47:32 - Kernel CS (SYSCALL loads CS from here, SS = CS + 8)
+ *   Bits 63:48 - User CS base (SYSRET loads CS from here + 16, SS from here + 8)
  *
- * Called from syscall_entry assembly after saving registers.
+ * For our GDT:
+ *   Kernel CS = 0x08, Kernel SS = 0x10
+ *   User Data = 0x28 (SYSRET SS = base + 8)
+ *   User Code = 0x30 (SYSRET CS = base + 16)
  *
- * @param num    Syscall number (from RAX)
- * @param arg1-5 Syscall arguments
- * @return       Return value (placed in RAX for user)
+ * So: STAR[47:32] = 0x08 (kernel CS)
+ *     STAR[63:48] = 0x20 (user base, so SS=0x28, CS=0x30)
  */
-int64_t syscall_dispatch(uint64_t num, uint64_t arg1, uint64_t arg2,
-                         uint64_t arg3, uint64_t arg4, uint64_t arg5) {
-    /* Validate syscall number */
-    if (num >= SYS_MAX) {
-        kprintf("syscall: Invalid syscall number %llu\n", num);
-        return -ENOSYS;
-    }
-
-    /* Get handler from table */
-    syscall_fn_t handler = syscall_table[num];
-    if (!handler) {
-        kprintf("syscall: No handler for syscall %llu (%s)\n",
-                num, syscall_names[num]);
-        return -ENOSYS;
-    }
-
-    /* Call the handler */
-    int64_t result = handler(arg1, arg2, arg3, arg4, arg5, 0);
+#define SYSCALL_STAR    (((uint64_t)0x0020 << 48) |  /* User segment base */ \
+                         ((uint64_t)0x0008 << 32))   /* Kernel code segment */
 
-    return result;
-}
-
-/* =============================================================================
- * Syscall Handler Wrappers
- * =============================================================================
- * These wrap the actual syscall implementations to match the generic signature.
- */
+extern void syscall_entry(void);
 
 /**
- * sys_exit wrapper - terminates current process
+ * Program the SYSCALL/SYSRET MSRs of the calling CPU.
+ *
+ *   - EFER.SCE: enable SYSCALL/SYSRET (the loader set LME and NXE)
+ *   - STAR: Segment selector bases
+ *   - LSTAR: 64-bit syscall entry point
+ *   - SFMASK: RFLAGS bits to clear on SYSCALL (IF, so entry runs with
+ *     interrupts off until it is on the kernel stack)
  */
-static int64_t sys_exit_wrapper(uint64_t code, uint64_t arg2 UNUSED,
-                                uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    sys_exit((int)code);
-    /* Never returns */
-    return 0;
+void syscall_init_cpu(void) {
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    wrmsr(MSR_STAR, SYSCALL_STAR);
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_SFMASK, SYSCALL_RFLAGS_MASK);
 }
 
 /**
- * sys_write wrapper - write to file descriptor
+ * Initialize the system call subsystem on the boot CPU.
  */
-static int64_t sys_write_wrapper(uint64_t fd, uint64_t buf, uint64_t len,
-                                 uint64_t arg4 UNUSED, uint64_t arg5 UNUSED,
-                                 uint64_t arg6 UNUSED) {
-    return sys_write((int)fd, (const void*)buf, (size_t)len);
-}
+void syscall_init(void) {
+    kprintf("syscall: Initializing system call interface...\n");
 
-/**
- * sys_read wrapper - read from file descriptor
- */
-static int64_t sys_read_wrapper(uint64_t fd, uint64_t buf, uint64_t len,
-                                uint64_t arg4 UNUSED, uint64_t arg5 UNUSED,
-                                uint64_t arg6 UNUSED) {
-    return sys_read((int)fd, (void*)buf, (size_t)len);
-}
+    syscall_init_cpu();
 
-/**
- * sys_yield wrapper - yield CPU to other processes
- */
-static int64_t sys_yield_wrapper(uint64_t arg1 UNUSED, uint64_t arg2 UNUSED,
-                                 uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                 uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_yield();
-}
+    size_t stats_size = sizeof(syscall_stat_block_t) * SMP_MAX_CPUS;
+    size_t stats_pages = ALIGN_UP(stats_size, PAGE_SIZE) / PAGE_SIZE;
+    phys_addr_t stats = pmm_alloc_pages(stats_pages);
+    if (stats) {
+        memset(PHYS_TO_VIRT(stats), 0, stats_pages * PAGE_SIZE);
+        syscall_stats = PHYS_TO_VIRT(stats);
+    } else {
+        kprintf("syscall: No memory for statistics, not counting calls\n");
+    }
 
-/**
- * sys_getpid wrapper - get process ID
- */
-static int64_t sys_getpid_wrapper(uint64_t arg1 UNUSED, uint64_t arg2 UNUSED,
-                                  uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                  uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_getpid();
-}
+    kprintf("syscall: EFER.SCE enabled (EFER = 0x%x)\n", (uint32_t)rdmsr(MSR_EFER));
+    kprintf("syscall: STAR MSR = 0x%016llX\n", rdmsr(MSR_STAR));
+    kprintf("syscall: LSTAR MSR = 0x%016llX (syscall_entry)\n", rdmsr(MSR_LSTAR));
+    kprintf("syscall: SFMASK MSR = 0x%016llX (clear IF)\n", rdmsr(MSR_SFMASK));
 
-/**
- * sys_sleep wrapper - sleep for milliseconds
- */
-static int64_t sys_sleep_wrapper(uint64_t ms, uint64_t arg2 UNUSED,
-                                 uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                 uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_sleep(ms);
+    kprintf("syscall: System call interface initialized\n");
+    kprintf("syscall: %d system calls registered\n", SYS_MAX);
 }
 
 /* =============================================================================
- * Phase 6: File System Syscall Wrappers
+ * Syscall Dispatcher
  * =============================================================================
  */
 
 /**
- * sys_open wrapper - open a file
+ * Slow path for a number with no handler.
  */
-static int64_t sys_open_wrapper(uint64_t path, uint64_t flags,
-                                uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_open((const char*)path, (int)flags);
+int64_t syscall_invalid(uint64_t num) {
+    kprintf("syscall: Invalid syscall number %llu\n", num);
+    return -ENOSYS;
 }
 
-/**
- * sys_close wrapper - close a file descriptor
+/* =============================================================================
+ * Syscall Accounting
+ * =============================================================================
  */
-static int64_t sys_close_wrapper(uint64_t fd, uint64_t arg2 UNUSED,
-                                 uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                 uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_close((int)fd);
-}
 
-/**
- * sys_lseek wrapper - seek in file
- */
-static int64_t sys_lseek_wrapper(uint64_t fd, uint64_t offset, uint64_t whence,
-                                 uint64_t arg4 UNUSED, uint64_t arg5 UNUSED,
-                                 uint64_t arg6 UNUSED) {
-    return sys_lseek((int)fd, (int64_t)offset, (int)whence);
+/* Histogram bucket for a latency: floor(log2(ns)), capped */
+static uint32_t sysstat_bucket(uint64_t ns) {
+    if (ns < 2) {
+        return 0;
+    }
+    uint32_t bucket = 63 - (uint32_t)__builtin_clzll(ns);
+    return MIN(bucket, SYSSTAT_BUCKETS - 1);
 }
 
-/**
- * sys_stat wrapper - get file status by path
- */
-static int64_t sys_stat_wrapper(uint64_t path, uint64_t buf,
-                                uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_stat((const char*)path, (void*)buf);
-}
+void syscall_account(uint64_t num, uint64_t start_tsc, int64_t ret) {
+    if (num >= SYS_MAX || !syscall_stats) {
+        return;
+    }
 
-/**
- * sys_fstat wrapper - get file status by fd
- */
-static int64_t sys_fstat_wrapper(uint64_t fd, uint64_t buf,
-                                 uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                 uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_fstat((int)fd, (void*)buf);
-}
+    /* A call that blocked may finish on another CPU; it counts there */
+    uint64_t ns = clock_cycles_to_ns(rdtsc() - start_tsc);
+    syscall_stat_t* stat = &syscall_stats[cpu_this()->id].stats[num];
 
-/**
- * sys_readdir wrapper - read directory entry
- */
-static int64_t sys_readdir_wrapper(uint64_t fd, uint64_t entry, uint64_t index,
-                                   uint64_t arg4 UNUSED, uint64_t arg5 UNUSED,
-                                   uint64_t arg6 UNUSED) {
-    return sys_readdir((int)fd, (void*)entry, (int)index);
+    stat->calls++;
+    if (ret < 0) {
+        stat->errors++;
+    }
+    stat->total_ns += ns;
+    if (ns > stat->max_ns) {
+        stat->max_ns = ns;
+    }
+    stat->hist[sysstat_bucket(ns)]++;
 }
 
 /**
- * sys_getcwd wrapper - get current working directory
- */
-static int64_t sys_getcwd_wrapper(uint64_t buf, uint64_t size,
-                                  uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                  uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_getcwd((char*)buf, (size_t)size);
-}
+ * sys_sysstat - Read the Syscall Statistics
+ *
+ * Sums every CPU's records; counters still moving on other CPUs may be
+ * a call or two ahead of each other, which is fine for statistics.
+ *
+ * @param stats User array, filled from syscall number 0 on
+ * @param count Number of records it has room for
+ * @return      SYS_MAX (records available), or -EFAULT
+ */
+int64_t sys_sysstat(syscall_stat_t* stats, size_t count) {
+    count = MIN(count, (size_t)SYS_MAX);
+
+    for (size_t num = 0; num < count; num++) {
+        syscall_stat_t sum;
+        memset(&sum, 0, sizeof(sum));
+
+        for (uint32_t cpu = 0; syscall_stats && cpu < SMP_MAX_CPUS; cpu++) {
+            const volatile syscall_stat_t* stat = &syscall_stats[cpu].stats[num];
+            sum.calls += stat->calls;
+            sum.errors += stat->errors;
+            sum.total_ns += stat->total_ns;
+            sum.max_ns = MAX(sum.max_ns, stat->max_ns);
+            for (int i = 0; i < SYSSTAT_BUCKETS; i++) {
+                sum.hist[i] += stat->hist[i];
+            }
+        }
+
+        if (copy_to_user(&stats[num], &sum, sizeof(sum)) < 0) {
+            return -EFAULT;
+        }
+    }
 
-/**
- * sys_chdir wrapper - change working directory
- */
-static int64_t sys_chdir_wrapper(uint64_t path, uint64_t arg2 UNUSED,
-                                 uint64_t arg3 UNUSED, uint64_t arg4 UNUSED,
-                                 uint64_t arg5 UNUSED, uint64_t arg6 UNUSED) {
-    return sys_chdir((const char*)path);
+    return SYS_MAX;
 }
@@ -0,0 +1,312 @@
+/**
+ * =============================================================================
+ * Chanux OS - ELF Program Loader
+ * =============================================================================
+ * Maps ELF64 executables into user address spaces (see user/elf.h).
+ *
+ * Images are looked up by the address of their ELF file, so every
+ * instance of a program linked into the kernel finds the same one. Only
+ * the first instance copies the read-only segments; the rest map the
+ * same frames and fault their data in from the file as they touch it.
+ * =============================================================================
+ */
+
+#include "user/elf.h"
+#include "user/user.h"
+#include "mm/pmm.h"
+#include "mm/vmm.h"
+#include "mm/heap.h"
+#include "kernel.h"
+#include "spinlock.h"
+#include "drivers/vga/vga.h"
+#include "string.h"
+#include "debug.h"
+
+/* =============================================================================
+ * Image Cache
+ * =============================================================================
+ */
+
+/* Images in use; image_lock also covers every 'users' count */
+static user_image_t* images = NULL;
+static spinlock_t image_lock = SPINLOCK_INIT;
+
+/**
+ * Free an image and whatever frames it holds.
+ */
+static void image_free(user_image_t* image) {
+    for (uint32_t i = 0; i < image->segment_count; i++) {
+        user_image_segment_t* seg = &image->segments[i];
+        if (!seg->frames) {
+            continue;
+        }
+        virt_addr_t start = ALIGN_DOWN(seg->vaddr, PAGE_SIZE);
+        uint64_t pages = (ALIGN_UP(seg->vaddr + seg->memsz, PAGE_SIZE) - start) / PAGE_SIZE;
+        for (uint64_t p = 0; p < pages; p++) {
+            if (seg->frames[p]) {
+                pmm_free_page(seg->frames[p]);
+            }
+        }
+        kfree(seg->frames);
+    }
+    kfree(image);
+}
+
+/**
+ * Copy a read-only segment into frames of its own.
+ * Bytes before p_vaddr and after p_filesz stay zero.
+ */
+static bool image_fill_segment(user_image_segment_t* seg) {
+    virt_addr_t start = ALIGN_DOWN(seg->vaddr, PAGE_SIZE);
+    uint64_t pages = (ALIGN_UP(seg->vaddr + seg->memsz, PAGE_SIZE) - start) / PAGE_SIZE;
+
+    seg->frames = (phys_addr_t*)kmalloc(pages * sizeof(phys_addr_t));
+    if (!seg->frames) {
+        return false;
+    }
+    memset(seg->frames, 0, pages * sizeof(phys_addr_t));
+
+    for (uint64_t p = 0; p < pages; p++) {
+        phys_addr_t frame = pmm_alloc_page_zeroed();
+        if (frame == 0) {
+            return false;
+        }
+        seg->frames[p] = frame;
+
+        virt_addr_t page = start + p * PAGE_SIZE;
+        uint64_t lo = MAX(page, seg->vaddr);
+        uint64_t hi = MIN(page + PAGE_SIZE, seg->vaddr + seg->filesz);
+        if (lo < hi) {
+            memcpy((uint8_t*)PHYS_TO_VIRT(frame) + (lo - page),
+                   seg->data + (lo - seg->vaddr), hi - lo);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Parse an ELF file and build its image.
+ *
+ * @return Image with users == 0, or NULL if the file is invalid or
+ *         memory ran out
+ */
+static user_image_t* image_build(const void* elf, size_t size) {
+    const uint8_t* file = (const uint8_t*)elf;
+    const elf64_ehdr_t* ehdr = (const elf64_ehdr_t*)elf;
+
+    if (size < sizeof(elf64_ehdr_t) ||
+        *(const uint32_t*)ehdr->e_ident != ELF_MAGIC ||
+        ehdr->e_ident[4] != ELFCLASS64 || ehdr->e_ident[5] != ELFDATA2LSB ||
+        ehdr->e_type != ET_EXEC || ehdr->e_machine != EM_X86_64 ||
+        ehdr->e_phentsize != sizeof(elf64_phdr_t) ||
+        ehdr->e_phoff > size ||
+        (uint64_t)ehdr->e_phnum * sizeof(elf64_phdr_t) > size - ehdr->e_phoff) {
+        kprintf("elf: Not an x86_64 executable\n");
+        return NULL;
+    }
+
+    user_image_t* image = (user_image_t*)kmalloc(sizeof(user_image_t));
+    if (!image) {
+        return NULL;
+    }
+    memset(image, 0, sizeof(user_image_t));
+    image->elf = elf;
+    image->size = size;
+    image->entry = ehdr->e_entry;
+    image->low = USER_MMAP_BASE;
+
+    const elf64_phdr_t* phdrs = (const elf64_phdr_t*)(file + ehdr->e_phoff);
+    virt_addr_t prev_end = USER_CODE_BASE;
+    bool entry_ok = false;
+
+    for (uint32_t i = 0; i < ehdr->e_phnum; i++) {
+        const elf64_phdr_t* ph = &phdrs[i];
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+            continue;
+        }
+
+        /*
+         * Segments come in address order and must not share a page: a
+         * page is either one of the image's read-only frames or private.
+         */
+        if (ph->p_filesz > ph->p_memsz || ph->p_offset > size ||
+            ph->p_filesz > size - ph->p_offset ||
+            ph->p_vaddr >= USER_MMAP_BASE ||
+            ph->p_memsz > USER_MMAP_BASE - ph->p_vaddr ||
+            ALIGN_DOWN(ph->p_vaddr, PAGE_SIZE) < prev_end) {
+            kprintf("elf: Bad PT_LOAD segment at 0x%p\n", (void*)ph->p_vaddr);
+            image_free(image);
+            return NULL;
+        }
+        if (image->segment_count >= USER_IMAGE_MAX_SEGMENTS) {
+            kprintf("elf: Too many segments\n");
+            image_free(image);
+            return NULL;
+        }
+
+        user_image_segment_t* seg = &image->segments[image->segment_count++];
+        seg->vaddr = ph->p_vaddr;
+        seg->memsz = ph->p_memsz;
+        seg->filesz = ph->p_filesz;
+        seg->data = file + ph->p_offset;
+        seg->flags = PTE_PRESENT | PTE_USER;
+        if (!(ph->p_flags & PF_X)) {
+            seg->flags |= PTE_NX;
+        }
+        if (ph->p_flags & PF_W) {
+            seg->flags |= PTE_WRITABLE;
+        } else {
+            seg->flags |= PTE_SHARED;
+            if (!image_fill_segment(seg)) {
+                kprintf("elf: Out of memory loading text\n");
+                image_free(image);
+                return NULL;
+            }
+        }
+
+        if ((ph->p_flags & PF_X) && image->entry >= ph->p_vaddr &&
+            image->entry < ph->p_vaddr + ph->p_memsz) {
+            entry_ok = true;
+        }
+
+        prev_end = ALIGN_UP(ph->p_vaddr + ph->p_memsz, PAGE_SIZE);
+        image->low = MIN(image->low, ALIGN_DOWN(ph->p_vaddr, PAGE_SIZE));
+        image->high = prev_end;
+    }
+
+    if (!entry_ok) {
+        kprintf("elf: Entry point 0x%p is not in an executable segment\n",
+                (void*)image->entry);
+        image_free(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+/**
+ * Find the image of an ELF file, building it on first use.
+ *
+ * @return Image with a reference taken, or NULL
+ */
+static user_image_t* image_get(const void* elf, size_t size) {
+    uint64_t irq = spin_lock_irqsave(&image_lock);
+    for (user_image_t* image = images; image; image = image->next) {
+        if (image->elf == elf && image->size == size) {
+            image->users++;
+            spin_unlock_irqrestore(&image_lock, irq);
+            return image;
+        }
+    }
+    spin_unlock_irqrestore(&image_lock, irq);
+
+    /* Copy the text without the lock held */
+    user_image_t* built = image_build(elf, size);
+    if (!built) {
+        return NULL;
+    }
+
+    /* Another CPU may have built it meanwhile; keep the first one */
+    irq = spin_lock_irqsave(&image_lock);
+    for (user_image_t* image = images; image; image = image->next) {
+        if (image->elf == elf && image->size == size) {
+            image->users++;
+            spin_unlock_irqrestore(&image_lock, irq);
+            image_free(built);
+            return image;
+        }
+    }
+    built->users = 1;
+    built->next = images;
+    images = built;
+    spin_unlock_irqrestore(&image_lock, irq);
+
+    DBG_USER("elf: Built image of %u bytes, %u segments\n",
+            (uint32_t)size, built->segment_count);
+    return built;
+}
+
+/**
+ * Take another reference on an image.
+ */
+void user_image_ref(user_image_t* image) {
+    uint64_t irq = spin_lock_irqsave(&image_lock);
+    image->users++;
+    spin_unlock_irqrestore(&image_lock, irq);
+}
+
+/**
+ * Drop a reference; the last one frees the image.
+ */
+void user_image_put(user_image_t* image) {
+    if (!image) {
+        return;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&image_lock);
+    bool last = --image->users == 0;
+    if (last) {
+        user_image_t** link = &images;
+        while (*link != image) {
+            link = &(*link)->next;
+        }
+        *link = image->next;
+    }
+    spin_unlock_irqrestore(&image_lock, irq);
+
+    if (last) {
+        image_free(image);
+    }
+}
+
+/* =============================================================================
+ * Loading
+ * =============================================================================
+ */
+
+/**
+ * Load an ELF executable into a new address space.
+ */
+bool user_elf_load(process_t* proc, const void* elf, size_t size) {
+    if (!proc || !elf || proc->pml4_phys == 0) {
+        return false;
+    }
+
+    user_image_t* image = image_get(elf, size);
+    if (!image) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < image->segment_count; i++) {
+        const user_image_segment_t* seg = &image->segments[i];
+
+        /* Data and BSS: private pages, filled in on first touch */
+        if (!seg->frames) {
+            if (!user_region_add_data(proc, seg->vaddr, seg->memsz, seg->flags,
+                                      seg->data, seg->filesz)) {
+                kprintf("elf: No region left for a data segment\n");
+                user_image_put(image);
+                return false;
+            }
+            continue;
+        }
+
+        /* Text and rodata: the image's frames, never freed by the address space */
+        virt_addr_t start = ALIGN_DOWN(seg->vaddr, PAGE_SIZE);
+        uint64_t pages = (ALIGN_UP(seg->vaddr + seg->memsz, PAGE_SIZE) - start) / PAGE_SIZE;
+        for (uint64_t p = 0; p < pages; p++) {
+            if (!vmm_map_user_page(proc->pml4_phys, start + p * PAGE_SIZE,
+                                   seg->frames[p], seg->flags)) {
+                user_image_put(image);
+                return false;
+            }
+        }
+    }
+
+    proc->user_code = (void*)image->entry;
+    proc->user_code_size = image->high - image->low;
+    proc->image = image;
+
+    return true;
+}
@@ -0,0 +1,104 @@
+/**
+ * =============================================================================
+ * Chanux OS - Safe Access to User Memory
+ * =============================================================================
+ * Range checks and the exception table lookup around the copy routines in
+ * arch/x86_64/uaccess.asm.
+ * =============================================================================
+ */
+
+#include "user/uaccess.h"
+#include "syscall/syscall.h"
+
+/* =============================================================================
+ * Exception Table
+ * =============================================================================
+ * One entry per instruction in uaccess.asm that may fault, collected by
+ * the linker between __ex_table_start and __ex_table_end. There are only
+ * a handful, so a linear search is enough.
+ */
+
+typedef struct {
+    uint64_t fault_rip;
+    uint64_t fixup_rip;
+} ex_entry_t;
+
+extern const ex_entry_t __ex_table_start[];
+extern const ex_entry_t __ex_table_end[];
+
+/* Defined in uaccess.asm */
+extern uint64_t uaccess_copy(void* dst, const void* src, size_t len);
+extern int64_t uaccess_strncpy(char* dst, const char* src, size_t size);
+extern int uaccess_cmpxchg32(uint32_t* uaddr, uint32_t expected, uint32_t desired,
+                             uint32_t* old);
+
+bool uaccess_fixup(registers_t* regs) {
+    /* User mode faults are never fixed up */
+    if (regs->cs & 3) {
+        return false;
+    }
+
+    for (const ex_entry_t* e = __ex_table_start; e < __ex_table_end; e++) {
+        if (e->fault_rip == regs->rip) {
+            regs->rip = e->fixup_rip;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* =============================================================================
+ * Copy API
+ * =============================================================================
+ */
+
+int copy_from_user(void* dst, const void* user_src, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (!user_access_ok(user_src, len)) {
+        return -EFAULT;
+    }
+    return uaccess_copy(dst, user_src, len) == 0 ? 0 : -EFAULT;
+}
+
+int copy_to_user(void* user_dst, const void* src, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (!user_access_ok(user_dst, len)) {
+        return -EFAULT;
+    }
+    return uaccess_copy(user_dst, src, len) == 0 ? 0 : -EFAULT;
+}
+
+int64_t strncpy_from_user(char* dst, const char* user_src, size_t size) {
+    if (size == 0 || user_src == NULL || (uintptr_t)user_src >= USER_SPACE_END) {
+        return -EFAULT;
+    }
+
+    /* Never read past the end of user space */
+    if (size > USER_SPACE_END - (uintptr_t)user_src) {
+        size = USER_SPACE_END - (uintptr_t)user_src;
+    }
+
+    int64_t len = uaccess_strncpy(dst, user_src, size);
+    if (len < 0) {
+        return -EFAULT;
+    }
+    if ((size_t)len >= size) {
+        dst[size - 1] = '\0';
+        return -ENAMETOOLONG;
+    }
+    return len;
+}
+
+int cmpxchg_user_u32(uint32_t* uaddr, uint32_t expected, uint32_t desired, uint32_t* old) {
+    if (!user_access_ok(uaddr, sizeof(uint32_t))) {
+        return -EFAULT;
+    }
+    if ((uintptr_t)uaddr & (sizeof(uint32_t) - 1)) {
+        return -EINVAL;
+    }
+    return uaccess_cmpxchg32(uaddr, expected, desired, old) == 0 ? 0 : -EFAULT;
+}
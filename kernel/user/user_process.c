@@ -4,16 +4,30 @@
  * =============================================================================
  * Implements user-mode process creation and management:
  *   - User address space creation
- *   - User stack allocation
- *   - User code loading
+ *   - User stack allocation (demand-zero)
+ *   - Demand paging for reserved user regions
+ *   - File mapping bookkeeping (mmap)
+ *   - Program loading (through user/elf.c)
  *   - Entry to user mode via IRETQ
+ *   - Threads sharing one address space
+ *
+ * The leader's vm_lock serializes its threads' changes to the address
+ * space: demand-zero and copy-on-write faults, mmap()/munmap(), thread
+ * stacks and fork(). It nests outside the vfs lock; nothing that holds
+ * the vfs lock may touch user memory, so it can never fault into here.
  * =============================================================================
  */
 
 #include "user/user.h"
+#include "user/vdso.h"
+#include "user/elf.h"
 #include "proc/process.h"
 #include "mm/pmm.h"
 #include "mm/vmm.h"
+#include "fs/vfs.h"
+#include "fs/file.h"
+#include "mm/heap.h"
+#include "syscall/syscall.h"
 #include "kernel.h"
 #include "gdt.h"
 #include "drivers/vga/vga.h"
@@ -21,170 +35,348 @@
 #include "debug.h"
 
 /* =============================================================================
- * User Stack Allocation
+ * Demand Paging
  * =============================================================================
  */
 
 /**
- * Allocate and map a user stack for a process.
+ * Reserve a demand-zero region in a process's address space.
+ */
+bool user_region_add(process_t* proc, virt_addr_t start, size_t size, uint64_t flags) {
+    if (!proc || proc->region_count >= PROCESS_MAX_REGIONS) {
+        return false;
+    }
+
+    virt_addr_t end = ALIGN_UP(start + size, PAGE_SIZE);
+    start = ALIGN_DOWN(start, PAGE_SIZE);
+    if (start < USER_SPACE_START || end > USER_SPACE_END || start >= end) {
+        return false;
+    }
+
+    user_region_t* region = &proc->regions[proc->region_count++];
+    region->start = start;
+    region->end = end;
+    region->flags = flags | PTE_PRESENT | PTE_USER;
+    region->init = NULL;
+    region->init_start = 0;
+    region->init_end = 0;
+
+    return true;
+}
+
+/**
+ * Reserve a demand-paged region whose first bytes come from kernel memory.
+ */
+bool user_region_add_data(process_t* proc, virt_addr_t start, size_t size,
+                          uint64_t flags, const void* data, size_t data_size) {
+    if (data_size > size || !user_region_add(proc, start, size, flags)) {
+        return false;
+    }
+
+    user_region_t* region = &proc->regions[proc->region_count - 1];
+    if (data_size > 0) {
+        region->init = (const uint8_t*)data;
+        region->init_start = start;
+        region->init_end = start + data_size;
+    }
+
+    return true;
+}
+
+/**
+ * Fault in one page of a file mapping: pin its block and enter its frame.
+ * Called with the leader's vm_lock held.
  *
- * @param proc Process to allocate stack for
- * @return true on success, false on failure
+ * @return true if addr lies in a mapping and its page is now mapped
  */
-bool user_stack_alloc(process_t* proc) {
-    if (!proc || proc->pml4_phys == 0) {
+static bool user_mmap_fault(process_t* proc, process_t* vm, virt_addr_t addr) {
+    user_mmap_t* map = NULL;
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        user_mmap_t* m = &vm->mmaps[i];
+        if (m->vnode && addr >= m->start &&
+            addr < m->start + (uint64_t)m->page_count * PAGE_SIZE) {
+            map = m;
+            break;
+        }
+    }
+    if (!map) {
         return false;
     }
 
-    /* Calculate stack base (grows down from USER_STACK_TOP) */
-    virt_addr_t stack_base = USER_STACK_TOP - USER_STACK_SIZE;
-    uint32_t pages = USER_STACK_SIZE / PAGE_SIZE;
+    /* Another thread may have faulted the same page in meanwhile */
+    virt_addr_t page_addr = ALIGN_DOWN(addr, PAGE_SIZE);
+    uint32_t index = (uint32_t)((page_addr - map->start) / PAGE_SIZE);
+    if (map->pages[index] != 0) {
+        return true;
+    }
 
-    /* Allocate and map each page */
-    for (uint32_t i = 0; i < pages; i++) {
-        phys_addr_t page = pmm_alloc_page();
-        if (page == 0) {
-            /* Allocation failed - unmap what we've done */
-            for (uint32_t j = 0; j < i; j++) {
-                /* TODO: Properly free pages - need vmm_get_physical for user space */
-            }
-            return false;
+    uint32_t block;
+    phys_addr_t frame;
+    uint64_t irq = vfs_lock();
+    int err = vfs_map_pages(map->vnode, map->first + index, 1, map->shared, &block, &frame);
+    vfs_unlock(irq);
+    if (err < 0) {
+        kprintf("user: Cannot fault in mapped file page 0x%p\n", (void*)page_addr);
+        return false;
+    }
+
+    if (!vmm_map_user_page(proc->pml4_phys, page_addr, frame, map->flags)) {
+        irq = vfs_lock();
+        vfs_unmap_pages(map->vnode, &block, 1);
+        vfs_unlock(irq);
+        return false;
+    }
+    map->pages[index] = block;
+    vmm_flush_tlb(page_addr);
+
+    return true;
+}
+
+/**
+ * Handle a not-present page fault in the current process.
+ */
+bool user_handle_page_fault(virt_addr_t addr) {
+    process_t* proc = process_current();
+    if (!proc || proc->pml4_phys == 0 || addr >= USER_SPACE_END) {
+        return false;
+    }
+
+    /* Only the active address space can be fixed up from here */
+    if ((read_cr3() & PTE_ADDR_MASK) != proc->pml4_phys) {
+        return false;
+    }
+
+    process_t* vm = proc->group;
+    uint64_t irq = spin_lock_irqsave(&vm->vm_lock);
+
+    const user_region_t* region = NULL;
+    for (uint32_t i = 0; i < vm->region_count; i++) {
+        if (addr >= vm->regions[i].start && addr < vm->regions[i].end) {
+            region = &vm->regions[i];
+            break;
         }
+    }
 
-        /* Zero the page */
-        memset(PHYS_TO_VIRT(page), 0, PAGE_SIZE);
+    if (!region) {
+        bool mapped = user_mmap_fault(proc, vm, addr);
+        spin_unlock_irqrestore(&vm->vm_lock, irq);
+        if (mapped) {
+            return true;
+        }
+        if (addr >= USER_STACK_TOP - USER_STACK_SIZE - USER_STACK_GUARD &&
+            addr < USER_STACK_TOP - USER_STACK_SIZE) {
+            kprintf("user: Stack overflow in process '%s' (PID %d)\n",
+                    proc->name, proc->pid);
+        }
+        return false;
+    }
 
-        /* Map with user RW, no execute */
-        if (!vmm_map_user_page(proc->pml4_phys,
-                               stack_base + i * PAGE_SIZE,
-                               page,
-                               PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX)) {
-            pmm_free_page(page);
-            return false;
+    /* Another thread may have faulted the same page in meanwhile */
+    virt_addr_t page_addr = ALIGN_DOWN(addr, PAGE_SIZE);
+    if (vmm_user_physical(proc->pml4_phys, page_addr) != 0) {
+        spin_unlock_irqrestore(&vm->vm_lock, irq);
+        return true;
+    }
+
+    phys_addr_t page = pmm_alloc_page_zeroed();
+    if (page == 0) {
+        spin_unlock_irqrestore(&vm->vm_lock, irq);
+        kprintf("user: Out of memory faulting in 0x%p\n", (void*)page_addr);
+        return false;
+    }
+
+    /* Initialized data: copy the part of the segment in this page */
+    if (region->init) {
+        uint64_t lo = MAX(page_addr, region->init_start);
+        uint64_t hi = MIN(page_addr + PAGE_SIZE, region->init_end);
+        if (lo < hi) {
+            memcpy((uint8_t*)PHYS_TO_VIRT(page) + (lo - page_addr),
+                   region->init + (lo - region->init_start), hi - lo);
         }
     }
 
-    /* Set up stack pointer (points to top of stack, 16-byte aligned) */
-    proc->user_stack = (void*)stack_base;
-    proc->user_stack_top = (USER_STACK_TOP - 16) & ~0xFULL;  /* 16-byte aligned */
+    if (!vmm_map_user_page(proc->pml4_phys, page_addr, page, region->flags)) {
+        spin_unlock_irqrestore(&vm->vm_lock, irq);
+        pmm_free_page(page);
+        return false;
+    }
+    vmm_flush_tlb(page_addr);
+    spin_unlock_irqrestore(&vm->vm_lock, irq);
+
+    DBG_USER("user: Demand-zero page 0x%llx for PID %d\n",
+            (unsigned long long)page_addr, proc->pid);
 
     return true;
 }
 
 /**
- * Free a user stack.
- *
- * @param proc Process whose stack to free
+ * Handle a copy-on-write fault in the current process.
  */
-void user_stack_free(process_t* proc) {
-    if (!proc || proc->pml4_phys == 0 || proc->user_stack == 0) {
+bool user_handle_cow_fault(virt_addr_t addr) {
+    process_t* proc = process_current();
+    if (!proc || proc->pml4_phys == 0) {
+        return false;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&proc->group->vm_lock);
+    bool resolved = vmm_handle_cow_fault(addr);
+    spin_unlock_irqrestore(&proc->group->vm_lock, irq);
+
+    return resolved;
+}
+
+/* =============================================================================
+ * File Mappings
+ * =============================================================================
+ */
+
+/* Unpin one mapping (vfs lock held) */
+static void user_mmap_put(user_mmap_t* map) {
+    vfs_unmap_pages(map->vnode, map->pages, map->page_count);
+    vnode_unref(map->vnode);
+    kfree(map->pages);
+    map->vnode = NULL;
+    map->start = 0;
+    map->page_count = 0;
+    map->pages = NULL;
+}
+
+/**
+ * Remove a file mapping from a process.
+ */
+void user_mmap_remove(process_t* proc, user_mmap_t* map) {
+    if (!map || !map->vnode) {
         return;
     }
 
-    virt_addr_t stack_base = (virt_addr_t)proc->user_stack;
-    uint32_t pages = USER_STACK_SIZE / PAGE_SIZE;
+    /* File frames (PTE_SHARED) are only unmapped; private copies are freed */
+    if (proc && proc->pml4_phys) {
+        for (uint32_t i = 0; i < map->page_count; i++) {
+            if (map->pages[i] != 0) {
+                vmm_unmap_user_page(proc->pml4_phys, map->start + (uint64_t)i * PAGE_SIZE);
+            }
+        }
+        if (proc->group_threads > 1) {
+            vmm_shootdown_user(proc->pml4_phys, map->start,
+                               (size_t)map->page_count * PAGE_SIZE);
+        }
+    }
 
-    /* We need to switch to the process's address space to unmap */
-    phys_addr_t current_cr3 = read_cr3();
-    vmm_switch_address_space(proc->pml4_phys);
+    uint64_t irq = vfs_lock();
+    user_mmap_put(map);
+    vfs_unlock(irq);
+}
 
-    /* Free each page */
-    for (uint32_t i = 0; i < pages; i++) {
-        virt_addr_t addr = stack_base + i * PAGE_SIZE;
-        phys_addr_t phys = vmm_get_physical(addr);
-        if (phys != 0) {
-            pmm_free_page(phys);
+/**
+ * Reference every mapping of a copied table, giving each its own copy of
+ * the page id list.
+ */
+bool user_mmap_copy(user_mmap_t* maps) {
+    uint64_t irq = vfs_lock();
+
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        if (!maps[i].vnode) {
+            continue;
+        }
+        size_t size = (size_t)maps[i].page_count * sizeof(uint32_t);
+        uint32_t* pages = (uint32_t*)kmalloc(size);
+        if (!pages || vfs_ref_pages(maps[i].vnode, maps[i].pages, maps[i].page_count) < 0) {
+            /* Undo the ones already taken, forget the rest */
+            kfree(pages);
+            for (uint32_t j = 0; j < PROCESS_MAX_MMAPS; j++) {
+                if (j < i && maps[j].vnode) {
+                    user_mmap_put(&maps[j]);
+                } else {
+                    maps[j].vnode = NULL;
+                    maps[j].pages = NULL;
+                }
+            }
+            vfs_unlock(irq);
+            return false;
         }
+        memcpy(pages, maps[i].pages, size);
+        maps[i].pages = pages;
+        vnode_ref(maps[i].vnode);
     }
 
-    /* Switch back */
-    vmm_switch_address_space(current_cr3);
+    vfs_unlock(irq);
+    return true;
+}
 
-    proc->user_stack = NULL;
-    proc->user_stack_top = 0;
+/**
+ * Unpin every mapping in a table.
+ */
+void user_mmap_release(user_mmap_t* maps) {
+    uint64_t irq = vfs_lock();
+    for (uint32_t i = 0; i < PROCESS_MAX_MMAPS; i++) {
+        if (maps[i].vnode) {
+            user_mmap_put(&maps[i]);
+        }
+    }
+    vfs_unlock(irq);
 }
 
 /* =============================================================================
- * User Code Loading
+ * User Stack Allocation
  * =============================================================================
  */
 
 /**
- * Load user code into a process's address space.
+ * Reserve a user stack for a process.
  *
- * @param proc      Process to load code into
- * @param code      Pointer to code data (in kernel space)
- * @param code_size Size of code in bytes
- * @param entry     Virtual address to load code at
+ * @param proc Process to allocate stack for
  * @return true on success, false on failure
  */
-bool user_load_code(process_t* proc, const void* code, size_t code_size,
-                    virt_addr_t entry) {
-    DBG_USER(">>> user_load_code START <<<\n");
-
-    if (!proc || !code || code_size == 0 || proc->pml4_phys == 0) {
-        kprintf("user_load_code: validation failed\n");
+bool user_stack_alloc(process_t* proc) {
+    if (!proc || proc->pml4_phys == 0) {
         return false;
     }
 
-    /* Ensure entry is in user space and page-aligned */
-    if (entry >= USER_SPACE_END || entry < USER_SPACE_START) {
-        kprintf("user_load_code: entry out of range\n");
+    /*
+     * Stack grows down from USER_STACK_TOP. Pages are faulted in on first
+     * touch; the guard page below the reservation is never mapped.
+     */
+    virt_addr_t stack_base = USER_STACK_TOP - USER_STACK_SIZE;
+    if (!user_region_add(proc, stack_base, USER_STACK_SIZE,
+                         PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX)) {
         return false;
     }
 
-    virt_addr_t code_base = ALIGN_DOWN(entry, PAGE_SIZE);
-    size_t aligned_size = ALIGN_UP(code_size + (entry - code_base), PAGE_SIZE);
-    uint32_t pages = aligned_size / PAGE_SIZE;
-    DBG_USER("user_load_code: pages=%u, code_base=0x%llx\n",
-            pages, (unsigned long long)code_base);
-
-    const uint8_t* src = (const uint8_t*)code;
-    size_t bytes_copied = 0;
-    size_t offset = entry - code_base;  /* Offset for first page */
+    /* Set up stack pointer (points to top of stack, 16-byte aligned) */
+    proc->user_stack = (void*)stack_base;
+    proc->user_stack_top = (USER_STACK_TOP - 16) & ~0xFULL;  /* 16-byte aligned */
 
-    /* Allocate, map, and copy code - all in one pass */
-    for (uint32_t i = 0; i < pages; i++) {
-        phys_addr_t page = pmm_alloc_page();
-        if (page == 0) {
-            return false;
-        }
+    return true;
+}
 
-        /* Get kernel virtual address for this physical page */
-        uint8_t* dst = (uint8_t*)PHYS_TO_VIRT(page);
+/**
+ * Free a user stack.
+ *
+ * @param proc Process whose stack to free
+ */
+void user_stack_free(process_t* proc) {
+    if (!proc || proc->pml4_phys == 0 || proc->user_stack == 0) {
+        return;
+    }
 
-        /* Zero the page first */
-        memset(dst, 0, PAGE_SIZE);
+    virt_addr_t stack_base = (virt_addr_t)proc->user_stack;
+    uint32_t pages = USER_STACK_SIZE / PAGE_SIZE;
 
-        /* Copy code to this page (use physical address via kernel mapping) */
-        if (bytes_copied < code_size) {
-            size_t page_offset = (i == 0) ? offset : 0;
-            size_t to_copy = PAGE_SIZE - page_offset;
-            if (to_copy > code_size - bytes_copied) {
-                to_copy = code_size - bytes_copied;
-            }
-            memcpy(dst + page_offset, src + bytes_copied, to_copy);
-            bytes_copied += to_copy;
-        }
+    /* Release whatever pages have been faulted in */
+    for (uint32_t i = 0; i < pages; i++) {
+        vmm_unmap_user_page(proc->pml4_phys, stack_base + i * PAGE_SIZE);
+    }
 
-        /* Map with user RO (code should be read-only) */
-        DBG_USER("user_load_code: mapping page %d at 0x%llx (pml4=0x%x)\n",
-                i, code_base + i * PAGE_SIZE, (uint32_t)proc->pml4_phys);
-        if (!vmm_map_user_page(proc->pml4_phys,
-                               code_base + i * PAGE_SIZE,
-                               page,
-                               PTE_PRESENT | PTE_USER)) {
-            kprintf("user_load_code: vmm_map_user_page FAILED!\n");
-            pmm_free_page(page);
-            return false;
+    /* Drop the reservation */
+    for (uint32_t i = 0; i < proc->region_count; i++) {
+        if (proc->regions[i].start == stack_base) {
+            proc->regions[i] = proc->regions[--proc->region_count];
+            break;
         }
-        DBG_USER("user_load_code: page mapped successfully\n");
     }
 
-    proc->user_code = (void*)entry;
-    proc->user_code_size = code_size;
-
-    return true;
+    proc->user_stack = NULL;
+    proc->user_stack_top = 0;
 }
 
 /* =============================================================================
@@ -232,17 +424,17 @@ static void user_process_entry(void* arg) {
  * @param code_size Size of user code
  * @return PID on success, (pid_t)-1 on failure
  */
-pid_t user_process_create(const char* name, const void* code, size_t code_size) {
+pid_t user_process_create(const char* name, const void* elf, size_t elf_size) {
     /*
      * Create a user-mode process:
      * 1. Create address space (PML4)
-     * 2. Load user code into address space
+     * 2. Map the program's ELF segments
      * 3. Allocate user stack
      * 4. Create kernel process with user mode flag
      * 5. Set up initial user RSP and RIP
      */
 
-    DBG_USER("user: Creating user process '%s' (%u bytes)\n", name, (uint32_t)code_size);
+    DBG_USER("user: Creating user process '%s' (%u bytes)\n", name, (uint32_t)elf_size);
 
     /* Create address space */
     phys_addr_t pml4 = vmm_create_address_space();
@@ -257,22 +449,21 @@ pid_t user_process_create(const char* name, const void* code, size_t code_size)
     process_t temp_proc = {0};
     temp_proc.pml4_phys = pml4;
 
-    /* Load user code at USER_CODE_BASE */
-    DBG_USER("user: About to call user_load_code\n");
-    bool load_result = user_load_code(&temp_proc, code, code_size, USER_CODE_BASE);
-    DBG_USER("user: user_load_code returned %d\n", load_result);
-    if (!load_result) {
-        kprintf("user: Failed to load user code\n");
+    /* Map the program (text shared with other instances, data on demand) */
+    if (!user_elf_load(&temp_proc, elf, elf_size)) {
+        kprintf("user: Failed to load program '%s'\n", name);
         vmm_destroy_address_space(pml4);
         return (pid_t)-1;
     }
 
-    DBG_USER("user: Loaded code at 0x%x\n", (uint32_t)USER_CODE_BASE);
+    DBG_USER("user: Loaded program, entry=0x%llx\n",
+            (unsigned long long)(uint64_t)temp_proc.user_code);
 
     /* Allocate user stack */
     if (!user_stack_alloc(&temp_proc)) {
         kprintf("user: Failed to allocate user stack\n");
         vmm_destroy_address_space(pml4);
+        user_image_put(temp_proc.image);
         return (pid_t)-1;
     }
 
@@ -287,6 +478,7 @@ pid_t user_process_create(const char* name, const void* code, size_t code_size)
     if (pid == (pid_t)-1) {
         kprintf("user: Failed to create kernel process\n");
         vmm_destroy_address_space(pml4);
+        user_image_put(temp_proc.image);
         return (pid_t)-1;
     }
 
@@ -295,6 +487,7 @@ pid_t user_process_create(const char* name, const void* code, size_t code_size)
     if (!proc) {
         kprintf("user: Failed to get process %d\n", pid);
         vmm_destroy_address_space(pml4);
+        user_image_put(temp_proc.image);
         return (pid_t)-1;
     }
 
@@ -304,8 +497,174 @@ pid_t user_process_create(const char* name, const void* code, size_t code_size)
     proc->user_stack_top = temp_proc.user_stack_top;
     proc->user_code = temp_proc.user_code;
     proc->user_code_size = temp_proc.user_code_size;
+    proc->image = temp_proc.image;
+    for (uint32_t i = 0; i < temp_proc.region_count; i++) {
+        proc->regions[i] = temp_proc.regions[i];
+    }
+    proc->region_count = temp_proc.region_count;
+
+    if (!vdso_map(proc)) {
+        kprintf("user: Failed to map vvar pages for PID %d\n", pid);
+    }
 
     DBG_USER("user: Created user process '%s' with PID %d\n", name, pid);
 
     return pid;
 }
+
+/* =============================================================================
+ * Threads
+ * =============================================================================
+ */
+
+/* Everything a new thread needs, handed over through its entry argument */
+typedef struct {
+    process_t*          leader;         /* Group it joins */
+    struct fd_table*    fd_table;       /* Shared table, referenced for us */
+    uint64_t            entry;          /* User entry point */
+    uint64_t            arg0;           /* RDI */
+    uint64_t            arg1;           /* RSI */
+    uint32_t            slot;           /* Thread stack slot */
+} thread_args_t;
+
+static virt_addr_t user_thread_stack_base(uint32_t slot) {
+    return USER_THREAD_STACK_TOP - (virt_addr_t)slot * USER_THREAD_STACK_STRIDE -
+           USER_THREAD_STACK_SIZE;
+}
+
+/* Drop a thread stack's pages and reservation (leader's vm_lock held) */
+static void user_thread_stack_put(process_t* leader, uint32_t slot) {
+    virt_addr_t base = user_thread_stack_base(slot);
+
+    for (uint32_t i = 0; i < USER_THREAD_STACK_SIZE / PAGE_SIZE; i++) {
+        vmm_unmap_user_page(leader->pml4_phys, base + (uint64_t)i * PAGE_SIZE);
+    }
+    if (leader->group_threads > 1) {
+        vmm_shootdown_user(leader->pml4_phys, base, USER_THREAD_STACK_SIZE);
+    }
+
+    for (uint32_t i = 0; i < leader->region_count; i++) {
+        if (leader->regions[i].start == base) {
+            leader->regions[i] = leader->regions[--leader->region_count];
+            break;
+        }
+    }
+    leader->thread_slots &= ~(1U << slot);
+}
+
+/*
+ * Kernel entry point of a new thread: swap in the group's address space
+ * and descriptor table, then drop to user mode on the thread's own stack.
+ */
+static void user_thread_entry(void* arg) {
+    thread_args_t* args = (thread_args_t*)arg;
+    process_t* proc = process_current();
+    process_t* leader = args->leader;
+    virt_addr_t stack_base = user_thread_stack_base(args->slot);
+
+    /* Replace the default stdio table process_create() gave us */
+    struct fd_table* default_table = proc->fd_table;
+
+    cli();
+    proc->fd_table = args->fd_table;
+    proc->flags |= PROCESS_FLAG_USER;
+    proc->pml4_phys = leader->pml4_phys;
+    proc->user_stack = (void*)stack_base;
+    /* As if entry had been called: RSP + 8 is 16-byte aligned */
+    proc->user_stack_top = ((stack_base + USER_THREAD_STACK_SIZE) & ~0xFULL) - 8;
+    proc->user_code = leader->user_code;
+    proc->user_code_size = leader->user_code_size;
+    proc->group = leader;
+    proc->tgid = leader->tgid;
+    proc->thread_slot = args->slot + 1;
+    sti();
+
+    if (default_table) {
+        uint64_t irq = vfs_lock();
+        fd_table_destroy(default_table);
+        vfs_unlock(irq);
+    }
+
+    uint64_t entry = args->entry;
+    uint64_t arg0 = args->arg0;
+    uint64_t arg1 = args->arg1;
+    kfree(args);
+
+    vmm_switch_address_space(proc->pml4_phys);
+    user_mode_enter_with_args(entry, proc->user_stack_top, arg0, arg1);
+}
+
+int64_t user_thread_create(uint64_t entry, uint64_t arg0, uint64_t arg1) {
+    process_t* self = process_current();
+    process_t* leader = self->group;
+
+    if (!(self->flags & PROCESS_FLAG_USER) || self->pml4_phys == 0) {
+        return -EINVAL;
+    }
+    if (entry < USER_SPACE_START || entry >= USER_SPACE_END) {
+        return -EFAULT;
+    }
+
+    thread_args_t* args = (thread_args_t*)kmalloc(sizeof(thread_args_t));
+    if (!args) {
+        return -ENOMEM;
+    }
+    args->leader = leader;
+    args->entry = entry;
+    args->arg0 = arg0;
+    args->arg1 = arg1;
+
+    /* Claim a stack slot and count the thread in before it can run */
+    uint64_t irq = spin_lock_irqsave(&leader->vm_lock);
+    uint32_t slot;
+    for (slot = 0; slot < PROCESS_MAX_THREADS; slot++) {
+        if (!(leader->thread_slots & (1U << slot))) {
+            break;
+        }
+    }
+    if (slot == PROCESS_MAX_THREADS ||
+        !user_region_add(leader, user_thread_stack_base(slot), USER_THREAD_STACK_SIZE,
+                         PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NX)) {
+        spin_unlock_irqrestore(&leader->vm_lock, irq);
+        kfree(args);
+        return -EAGAIN;
+    }
+    leader->thread_slots |= 1U << slot;
+    leader->group_threads++;
+    spin_unlock_irqrestore(&leader->vm_lock, irq);
+    args->slot = slot;
+
+    irq = vfs_lock();
+    args->fd_table = self->fd_table;
+    fd_table_ref(args->fd_table);
+    vfs_unlock(irq);
+
+    pid_t pid = process_create(self->name, user_thread_entry, args);
+    if (pid == (pid_t)-1) {
+        irq = vfs_lock();
+        fd_table_unref(args->fd_table);
+        vfs_unlock(irq);
+
+        irq = spin_lock_irqsave(&leader->vm_lock);
+        leader->group_threads--;
+        user_thread_stack_put(leader, slot);
+        spin_unlock_irqrestore(&leader->vm_lock, irq);
+        kfree(args);
+        return -EAGAIN;
+    }
+
+    return (int64_t)pid;
+}
+
+bool user_thread_leave(process_t* proc) {
+    process_t* leader = proc->group;
+
+    uint64_t irq = spin_lock_irqsave(&leader->vm_lock);
+    bool last = --leader->group_threads == 0;
+    if (!last && proc->thread_slot != 0) {
+        user_thread_stack_put(leader, proc->thread_slot - 1);
+    }
+    spin_unlock_irqrestore(&leader->vm_lock, irq);
+
+    return last;
+}
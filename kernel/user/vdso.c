@@ -0,0 +1,114 @@
+/**
+ * =============================================================================
+ * Chanux OS - User-Visible Kernel Data (vvar pages)
+ * =============================================================================
+ * The clock page is one frame owned by the kernel; every address space maps
+ * it with an extra reference, so tearing one down never frees it. Each
+ * process page is owned by its address space alone. fork() shares the
+ * parent's process page read-only like any other, so the child swaps in
+ * its own before it first returns to user mode.
+ * =============================================================================
+ */
+
+#include "user/vdso.h"
+#include "mm/pmm.h"
+#include "mm/vmm.h"
+#include "kernel.h"
+#include "clock.h"
+#include "drivers/vga/vga.h"
+
+#define VDSO_PTE_FLAGS  (PTE_PRESENT | PTE_USER | PTE_NX)
+
+/* =============================================================================
+ * Static Data
+ * =============================================================================
+ */
+
+static phys_addr_t vdso_clock_phys = 0;
+static vdso_clock_t* vdso_clock = NULL;
+
+/* =============================================================================
+ * Clock Page
+ * =============================================================================
+ */
+
+void vdso_init(void) {
+    vdso_clock_phys = pmm_alloc_page_zeroed();
+    if (vdso_clock_phys == 0) {
+        PANIC("vdso_init: out of memory");
+    }
+    vdso_clock = (vdso_clock_t*)PHYS_TO_VIRT(vdso_clock_phys);
+
+    uint64_t tsc_base, ns_base, ns_per_cycle;
+    bool tsc = clock_get_scale(&tsc_base, &ns_base, &ns_per_cycle);
+
+    vdso_clock->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (tsc) {
+        vdso_clock->tsc_base = tsc_base;
+        vdso_clock->ns_base = ns_base;
+        vdso_clock->ns_per_cycle = ns_per_cycle;
+        vdso_clock->tsc_khz = clock_tsc_khz();
+        vdso_clock->flags = VDSO_CLOCK_TSC;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vdso_clock->seq++;
+
+    vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    kprintf("[VDSO] ");
+    vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+    kprintf("vvar pages at %x (%s clock)\n",
+            (uint64_t)VDSO_CLOCK_ADDR, tsc ? "TSC" : "tick");
+}
+
+void vdso_update_ticks(uint64_t ticks) {
+    if (vdso_clock) {
+        vdso_clock->ticks = ticks;
+    }
+}
+
+/* =============================================================================
+ * Mapping
+ * =============================================================================
+ */
+
+phys_addr_t vdso_alloc_proc_page(void) {
+    return pmm_alloc_page_zeroed();
+}
+
+bool vdso_map(process_t* proc) {
+    if (!vdso_clock || !proc || proc->pml4_phys == 0) {
+        return false;
+    }
+
+    phys_addr_t page = vdso_alloc_proc_page();
+    if (page == 0) {
+        return false;
+    }
+    ((vdso_proc_t*)PHYS_TO_VIRT(page))->pid = proc->pid;
+
+    if (!vmm_map_user_page(proc->pml4_phys, VDSO_PROC_ADDR, page, VDSO_PTE_FLAGS)) {
+        pmm_free_page(page);
+        return false;
+    }
+
+    pmm_page_ref(vdso_clock_phys);
+    if (!vmm_map_user_page(proc->pml4_phys, VDSO_CLOCK_ADDR, vdso_clock_phys, VDSO_PTE_FLAGS)) {
+        pmm_page_unref(vdso_clock_phys);
+        return false;       /* The process page goes with the address space */
+    }
+
+    return true;
+}
+
+void vdso_install_proc_page(process_t* proc, phys_addr_t page) {
+    ((vdso_proc_t*)PHYS_TO_VIRT(page))->pid = proc->pid;
+
+    /* Same page table as the inherited mapping, so this cannot fail */
+    vmm_unmap_user_page(proc->pml4_phys, VDSO_PROC_ADDR);
+    if (!vmm_map_user_page(proc->pml4_phys, VDSO_PROC_ADDR, page, VDSO_PTE_FLAGS)) {
+        pmm_free_page(page);
+        return;
+    }
+    vmm_flush_tlb(VDSO_PROC_ADDR);
+}
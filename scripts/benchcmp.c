@@ -0,0 +1,130 @@
+/**
+ * =============================================================================
+ * Chanux OS - Benchmark Comparison (host tool)
+ * =============================================================================
+ * Compares two results files of `make bench` (see kernel/include/bench.h),
+ * say from the last release and from the working tree:
+ *
+ *   benchcmp [-t percent] <old.txt> <new.txt>
+ *
+ * Reads "BENCH <name> ... ns=<ns per op> ..." lines and prints, for every
+ * benchmark in new.txt, both timings and the change. Changes beyond the
+ * threshold (default 10%; QEMU timings are noisy) are marked, and the exit
+ * status is 2 if anything got slower by more than that.
+ *
+ * Built on the host by the Makefile (HOSTCC); `make bench BASELINE=file`
+ * runs it.
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LEN    512
+#define NAME_MAX_LEN    64
+#define MAX_RESULTS     256
+
+/* =============================================================================
+ * Results Files
+ * =============================================================================
+ */
+
+typedef struct {
+    char    name[NAME_MAX_LEN];
+    double  ns;
+} result_t;
+
+typedef struct {
+    result_t    results[MAX_RESULTS];
+    size_t      count;
+} results_t;
+
+static void read_results(const char* path, results_t* res) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "benchcmp: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    char line[LINE_MAX_LEN];
+    while (fgets(line, sizeof(line), f) && res->count < MAX_RESULTS) {
+        result_t* r = &res->results[res->count];
+        const char* ns = strstr(line, " ns=");
+        if (strncmp(line, "BENCH ", 6) != 0 || !ns ||
+            sscanf(line + 6, "%63s", r->name) != 1 || sscanf(ns + 4, "%lf", &r->ns) != 1) {
+            continue;
+        }
+        res->count++;
+    }
+    fclose(f);
+
+    if (res->count == 0) {
+        fprintf(stderr, "benchcmp: no BENCH results in %s\n", path);
+        exit(1);
+    }
+}
+
+static const result_t* find_result(const results_t* res, const char* name) {
+    for (size_t i = 0; i < res->count; i++) {
+        if (strcmp(res->results[i].name, name) == 0) {
+            return &res->results[i];
+        }
+    }
+    return NULL;
+}
+
+/* =============================================================================
+ * Comparison
+ * =============================================================================
+ */
+
+static results_t old_results;
+static results_t new_results;
+
+int main(int argc, char** argv) {
+    double threshold = 10.0;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-t") == 0) {
+        threshold = atof(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: benchcmp [-t percent] <old.txt> <new.txt>\n");
+        return 1;
+    }
+
+    read_results(argv[arg], &old_results);
+    read_results(argv[arg + 1], &new_results);
+
+    int regressed = 0;
+    printf("%-32s %12s %12s %8s\n", "benchmark", "old ns/op", "new ns/op", "change");
+    for (size_t i = 0; i < new_results.count; i++) {
+        const result_t* now = &new_results.results[i];
+        const result_t* then = find_result(&old_results, now->name);
+        if (!then) {
+            printf("%-32s %12s %12.1f %8s\n", now->name, "-", now->ns, "new");
+            continue;
+        }
+
+        double change = then->ns > 0 ? (now->ns - then->ns) * 100.0 / then->ns : 0.0;
+        const char* mark = "";
+        if (change > threshold) {
+            mark = "  slower";
+            regressed = 1;
+        } else if (change < -threshold) {
+            mark = "  faster";
+        }
+        printf("%-32s %12.1f %12.1f %+7.1f%%%s\n", now->name, then->ns, now->ns, change, mark);
+    }
+
+    for (size_t i = 0; i < old_results.count; i++) {
+        if (!find_result(&new_results, old_results.results[i].name)) {
+            printf("%-32s %12.1f %12s %8s\n", old_results.results[i].name,
+                   old_results.results[i].ns, "-", "gone");
+        }
+    }
+
+    return regressed ? 2 : 0;
+}
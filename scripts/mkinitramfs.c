@@ -0,0 +1,200 @@
+/**
+ * =============================================================================
+ * Chanux OS - Initramfs Packer (host tool)
+ * =============================================================================
+ * Packs a directory tree into a cpio "newc" archive for the kernel's
+ * initramfs (see kernel/include/fs/initramfs.h):
+ *
+ *   mkinitramfs <directory> <archive>
+ *
+ * Directories come before their contents and names are sorted, so the
+ * same tree always gives the same archive. Only directories and regular
+ * files are packed; anything else is skipped with a warning.
+ *
+ * The data of each file of a page or more starts on a page boundary of
+ * the archive: the name before it is padded with NULs (newc allows any
+ * name size, and readers stop at the first NUL). The kernel then takes
+ * those pages over as ramfs blocks instead of copying them. The
+ * archive still lists and extracts with cpio(1).
+ *
+ * Built and run on the host by the Makefile (HOSTCC).
+ * =============================================================================
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define PAGE_SIZE       4096
+#define NEWC_HDR_SIZE   110
+#define PATH_MAX_LEN    4096
+
+static FILE* out;
+static unsigned long out_pos = 0;
+static unsigned long next_ino = 1;
+
+/* =============================================================================
+ * Output
+ * =============================================================================
+ */
+
+static void put(const void* data, size_t len) {
+    if (fwrite(data, 1, len, out) != len) {
+        perror("mkinitramfs: write");
+        exit(1);
+    }
+    out_pos += len;
+}
+
+static void put_zeros(unsigned long len) {
+    static const char zeros[PAGE_SIZE];
+    while (len > 0) {
+        size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+        put(zeros, n);
+        len -= n;
+    }
+}
+
+static void put_align(unsigned long align) {
+    put_zeros((align - out_pos % align) % align);
+}
+
+/**
+ * Write an entry header and name. For an 'align' above newc's 4 bytes
+ * the name is padded with NULs so the data after it starts there.
+ */
+static void put_header(const char* name, unsigned mode, unsigned long size,
+                       unsigned long align) {
+    unsigned long namesize = strlen(name) + 1;
+    if (align > 4) {
+        unsigned long data = out_pos + NEWC_HDR_SIZE + namesize;
+        namesize += (align - data % align) % align;
+    }
+
+    /* Fields are 8 hex digits: everything fits in 32 bits (see pack_file()) */
+    char hdr[NEWC_HDR_SIZE + 32];
+    snprintf(hdr, sizeof(hdr),
+             "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+             (unsigned)next_ino++, mode, 0u, 0u, (mode & S_IFDIR) ? 2u : 1u, 0u,
+             (unsigned)size, 0u, 0u, 0u, 0u, (unsigned)namesize, 0u);
+    put(hdr, NEWC_HDR_SIZE);
+    put(name, strlen(name));
+    put_zeros(namesize - strlen(name));
+    put_align(4);
+}
+
+/* =============================================================================
+ * Tree Walk
+ * =============================================================================
+ */
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void pack_file(const char* path, const char* name, const struct stat* st) {
+    FILE* in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    unsigned long size = (unsigned long)st->st_size;
+    if (st->st_size > 0xFFFFFFFFL) {
+        fprintf(stderr, "mkinitramfs: %s: too large for newc (4GB)\n", path);
+        exit(1);
+    }
+    put_header(name, S_IFREG | (st->st_mode & 07777), size,
+               size >= PAGE_SIZE ? PAGE_SIZE : 4);
+
+    char buf[65536];
+    unsigned long left = size;
+    while (left > 0) {
+        size_t n = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), in);
+        if (n == 0) {
+            fprintf(stderr, "mkinitramfs: %s: short read\n", path);
+            exit(1);
+        }
+        put(buf, n);
+        left -= n;
+    }
+    put_align(4);
+    fclose(in);
+}
+
+/**
+ * Pack the contents of directory 'path', whose archive name is 'prefix'
+ * ("" for the root).
+ */
+static void pack_dir(const char* path, const char* prefix) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    char** names = NULL;
+    size_t count = 0;
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        names = realloc(names, (count + 1) * sizeof(char*));
+        names[count++] = strdup(de->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char*), compare_names);
+
+    for (size_t i = 0; i < count; i++) {
+        char child[PATH_MAX_LEN];
+        char name[PATH_MAX_LEN];
+        snprintf(child, sizeof(child), "%s/%s", path, names[i]);
+        snprintf(name, sizeof(name), "%s%s%s", prefix, prefix[0] ? "/" : "", names[i]);
+
+        struct stat st;
+        if (lstat(child, &st) < 0) {
+            fprintf(stderr, "mkinitramfs: %s: %s\n", child, strerror(errno));
+            exit(1);
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            put_header(name, S_IFDIR | (st.st_mode & 07777), 0, 4);
+            pack_dir(child, name);
+        } else if (S_ISREG(st.st_mode)) {
+            pack_file(child, name, &st);
+        } else {
+            fprintf(stderr, "mkinitramfs: skipping %s (not a file or directory)\n", child);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: mkinitramfs <directory> <archive>\n");
+        return 1;
+    }
+
+    out = fopen(argv[2], "wb");
+    if (!out) {
+        fprintf(stderr, "mkinitramfs: %s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    pack_dir(argv[1], "");
+    put_header("TRAILER!!!", 0, 0, 4);
+
+    /* Whole pages, so the kernel can hand every page back */
+    put_align(PAGE_SIZE);
+
+    if (fclose(out) != 0) {
+        perror("mkinitramfs: close");
+        return 1;
+    }
+    return 0;
+}
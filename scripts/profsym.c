@@ -0,0 +1,313 @@
+/**
+ * =============================================================================
+ * Chanux OS - Profile Symbolizer (host tool)
+ * =============================================================================
+ * Turns the output of the shell's `profile dump` (see kernel/include/
+ * profile.h) into a profile by function:
+ *
+ *   profsym [-f] <kernel.elf> [user.elf] < serial.log
+ *
+ * Reads "PROF <k|u> <pid> <rip> <count>" lines from anywhere in the log,
+ * looks kernel RIPs up in kernel.elf's symbol table and user RIPs in
+ * user.elf's (every user program links at the same address, so samples
+ * from other programs come out under the wrong names or as [unknown]).
+ *
+ * Prints a flat profile, most samples first; with -f, folded stacks
+ * ("pid-3;kernel;memcpy 42") for flamegraph.pl. Samples carry no call
+ * chains, so each stack is only the process, the mode and the function.
+ *
+ * Built on the host by the Makefile (HOSTCC); `make profile` runs it.
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LEN    512
+
+/* =============================================================================
+ * ELF64 (only what the symbol table needs)
+ * =============================================================================
+ */
+
+typedef struct {
+    unsigned char   ident[16];
+    uint16_t        type;
+    uint16_t        machine;
+    uint32_t        version;
+    uint64_t        entry;
+    uint64_t        phoff;
+    uint64_t        shoff;
+    uint32_t        flags;
+    uint16_t        ehsize;
+    uint16_t        phentsize;
+    uint16_t        phnum;
+    uint16_t        shentsize;
+    uint16_t        shnum;
+    uint16_t        shstrndx;
+} elf64_ehdr_t;
+
+typedef struct {
+    uint32_t        name;
+    uint32_t        type;
+    uint64_t        flags;
+    uint64_t        addr;
+    uint64_t        offset;
+    uint64_t        size;
+    uint32_t        link;
+    uint32_t        info;
+    uint64_t        addralign;
+    uint64_t        entsize;
+} elf64_shdr_t;
+
+typedef struct {
+    uint32_t        name;
+    unsigned char   info;
+    unsigned char   other;
+    uint16_t        shndx;
+    uint64_t        value;
+    uint64_t        size;
+} elf64_sym_t;
+
+#define SHT_SYMTAB      2
+#define STT_NOTYPE      0       /* NASM labels */
+#define STT_FUNC        2
+
+/* =============================================================================
+ * Symbol Tables
+ * =============================================================================
+ */
+
+typedef struct {
+    uint64_t        addr;
+    uint64_t        size;       /* 0: runs up to the next symbol */
+    const char*     name;
+} symbol_t;
+
+typedef struct {
+    symbol_t*       syms;
+    size_t          count;
+} symtab_t;
+
+static void* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "profsym: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* data = malloc(len > 0 ? (size_t)len : 1);
+    if (!data || fread(data, 1, (size_t)len, f) != (size_t)len) {
+        fprintf(stderr, "profsym: cannot read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    *size = (size_t)len;
+    return data;
+}
+
+static int compare_symbols(const void* a, const void* b) {
+    const symbol_t* x = a;
+    const symbol_t* y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/**
+ * Load the function symbols (and NASM's untyped labels) of an ELF64 file.
+ * The file stays in memory: the names point into it.
+ */
+static void load_symbols(const char* path, symtab_t* tab) {
+    size_t size;
+    char* data = read_file(path, &size);
+    const elf64_ehdr_t* eh = (const elf64_ehdr_t*)data;
+
+    if (size < sizeof(*eh) || memcmp(eh->ident, "\177ELF", 4) != 0 || eh->ident[4] != 2 ||
+        eh->shoff + (uint64_t)eh->shnum * sizeof(elf64_shdr_t) > size) {
+        fprintf(stderr, "profsym: %s: not an ELF64 file\n", path);
+        exit(1);
+    }
+
+    const elf64_shdr_t* sh = (const elf64_shdr_t*)(data + eh->shoff);
+    for (uint16_t i = 0; i < eh->shnum; i++) {
+        if (sh[i].type != SHT_SYMTAB || sh[i].link >= eh->shnum) {
+            continue;
+        }
+
+        const elf64_shdr_t* str = &sh[sh[i].link];
+        if (sh[i].offset + sh[i].size > size || str->offset + str->size > size) {
+            break;
+        }
+
+        const elf64_sym_t* sym = (const elf64_sym_t*)(data + sh[i].offset);
+        size_t nsyms = sh[i].size / sizeof(elf64_sym_t);
+        tab->syms = calloc(nsyms, sizeof(symbol_t));
+        if (!tab->syms) {
+            perror("profsym");
+            exit(1);
+        }
+
+        for (size_t j = 0; j < nsyms; j++) {
+            unsigned type = sym[j].info & 0xF;
+            if ((type != STT_FUNC && type != STT_NOTYPE) || sym[j].shndx == 0 ||
+                sym[j].value == 0 || sym[j].name == 0 || sym[j].name >= str->size) {
+                continue;
+            }
+            const char* name = data + str->offset + sym[j].name;
+            if (name[0] == '.' || name[0] == '\0') {
+                continue;       /* Local NASM labels, section names */
+            }
+            symbol_t* s = &tab->syms[tab->count++];
+            s->addr = sym[j].value;
+            s->size = type == STT_FUNC ? sym[j].size : 0;
+            s->name = name;
+        }
+        break;
+    }
+
+    if (tab->count == 0) {
+        fprintf(stderr, "profsym: %s has no symbol table\n", path);
+        exit(1);
+    }
+    qsort(tab->syms, tab->count, sizeof(symbol_t), compare_symbols);
+}
+
+static const char* lookup(const symtab_t* tab, uint64_t addr) {
+    size_t lo = 0;
+    size_t hi = tab->count;
+
+    /* Last symbol at or below addr */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tab->syms[mid].addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+
+    const symbol_t* s = &tab->syms[lo - 1];
+    if (s->size != 0 && addr >= s->addr + s->size) {
+        return NULL;
+    }
+    return s->name;
+}
+
+/* =============================================================================
+ * Profile
+ * =============================================================================
+ */
+
+typedef struct {
+    char            key[LINE_MAX_LEN];  /* Function, or folded stack with -f */
+    unsigned long   count;
+} entry_t;
+
+static entry_t* entries = NULL;
+static size_t entry_count = 0;
+static size_t entry_room = 0;
+
+static void add(const char* key, unsigned long count) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].key, key) == 0) {
+            entries[i].count += count;
+            return;
+        }
+    }
+
+    if (entry_count == entry_room) {
+        entry_room = entry_room ? entry_room * 2 : 256;
+        entries = realloc(entries, entry_room * sizeof(entry_t));
+        if (!entries) {
+            perror("profsym");
+            exit(1);
+        }
+    }
+    snprintf(entries[entry_count].key, LINE_MAX_LEN, "%s", key);
+    entries[entry_count].count = count;
+    entry_count++;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const entry_t* x = a;
+    const entry_t* y = b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return strcmp(x->key, y->key);
+}
+
+int main(int argc, char** argv) {
+    int folded = 0;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-f") == 0) {
+        folded = 1;
+        arg++;
+    }
+    if (argc - arg < 1 || argc - arg > 2) {
+        fprintf(stderr, "usage: profsym [-f] <kernel.elf> [user.elf] < serial.log\n");
+        return 1;
+    }
+
+    symtab_t kernel = { NULL, 0 };
+    symtab_t user = { NULL, 0 };
+    load_symbols(argv[arg], &kernel);
+    if (argc - arg == 2) {
+        load_symbols(argv[arg + 1], &user);
+    }
+
+    char line[LINE_MAX_LEN];
+    unsigned long total = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        const char* p = strstr(line, "PROF ");
+        char mode;
+        unsigned pid;
+        unsigned long long rip;
+        unsigned long count;
+        if (!p || sscanf(p, "PROF %c %u %llx %lu", &mode, &pid, &rip, &count) != 4) {
+            continue;
+        }
+
+        const symtab_t* tab = mode == 'u' ? &user : &kernel;
+        const char* name = tab->count ? lookup(tab, rip) : NULL;
+        char key[LINE_MAX_LEN];
+        if (folded) {
+            snprintf(key, sizeof(key), "pid-%u;%s;%s", pid, mode == 'u' ? "user" : "kernel",
+                     name ? name : "[unknown]");
+        } else {
+            snprintf(key, sizeof(key), "%-6s %s", mode == 'u' ? "user" : "kernel",
+                     name ? name : "[unknown]");
+        }
+        add(key, count);
+        total += count;
+    }
+
+    if (total == 0) {
+        fprintf(stderr, "profsym: no PROF lines in the input (run 'profile dump' in the shell)\n");
+        return 1;
+    }
+
+    qsort(entries, entry_count, sizeof(entry_t), compare_entries);
+    if (!folded) {
+        printf("%lu samples\n\n  samples       %%  mode   function\n", total);
+    }
+    for (size_t i = 0; i < entry_count; i++) {
+        if (folded) {
+            printf("%s %lu\n", entries[i].key, entries[i].count);
+        } else {
+            printf("%9lu  %5.1f%%  %s\n", entries[i].count,
+                   100.0 * (double)entries[i].count / (double)total, entries[i].key);
+        }
+    }
+    return 0;
+}
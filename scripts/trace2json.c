@@ -0,0 +1,268 @@
+/**
+ * =============================================================================
+ * Chanux OS - Trace Exporter (host tool)
+ * =============================================================================
+ * Turns the output of the shell's `trace dump` (see kernel/include/trace.h)
+ * into a Chrome trace that chrome://tracing and ui.perfetto.dev open:
+ *
+ *   trace2json < serial.log > trace.json
+ *
+ * Reads "TRACE <ns> <cpu> <pid> <event> <phase> <arg0> <arg1>" lines from
+ * anywhere in the log, puts them in time order and writes:
+ *   - one track per process, with page faults, VFS calls and IRQs as
+ *     slices (BEGIN/END) and allocations as instants
+ *   - one track per CPU under "CPUs", with a slice for every stretch a
+ *     process ran there, built from the context switch records
+ *
+ * Built on the host by the Makefile (HOSTCC); `make trace` runs it.
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LEN    512
+#define MAX_CPUS        16
+#define CPU_TRACKS_PID  1000000     /* Chrome "process" holding the CPU tracks */
+
+/* =============================================================================
+ * Events (must match kernel/include/trace.h)
+ * =============================================================================
+ */
+
+#define EV_SCHED_SWITCH 1
+
+#define PH_INSTANT      0
+#define PH_BEGIN        1
+#define PH_END          2
+
+typedef enum { ARG_NONE, ARG_DEC, ARG_SIGNED, ARG_HEX } arg_fmt_t;
+
+typedef struct {
+    const char*     name;
+    const char*     cat;
+    const char*     arg_names[2][2];    /* [BEGIN/instant, END][arg] */
+    arg_fmt_t       arg_fmts[2][2];
+} event_t;
+
+static const event_t events[] = {
+    [1] = { "sched_switch", "sched", { { "prev", "next" }, { NULL, NULL } },
+            { { ARG_DEC, ARG_DEC }, { ARG_NONE, ARG_NONE } } },
+    [2] = { "page_fault", "mm", { { "address", "error" }, { NULL, NULL } },
+            { { ARG_HEX, ARG_HEX }, { ARG_NONE, ARG_NONE } } },
+    [3] = { "pmm_alloc", "mm", { { "frame", "pages" }, { NULL, NULL } },
+            { { ARG_HEX, ARG_DEC }, { ARG_NONE, ARG_NONE } } },
+    [4] = { "kmalloc", "mm", { { "size", "ptr" }, { NULL, NULL } },
+            { { ARG_DEC, ARG_HEX }, { ARG_NONE, ARG_NONE } } },
+    [5] = { "vfs_open", "vfs", { { "flags", NULL }, { "result", "inode" } },
+            { { ARG_HEX, ARG_NONE }, { ARG_SIGNED, ARG_DEC } } },
+    [6] = { "vfs_read", "vfs", { { "count", "offset" }, { "result", "inode" } },
+            { { ARG_DEC, ARG_DEC }, { ARG_SIGNED, ARG_DEC } } },
+    [7] = { "vfs_write", "vfs", { { "count", "offset" }, { "result", "inode" } },
+            { { ARG_DEC, ARG_DEC }, { ARG_SIGNED, ARG_DEC } } },
+    [8] = { "irq", "irq", { { "vector", NULL }, { "vector", NULL } },
+            { { ARG_DEC, ARG_NONE }, { ARG_DEC, ARG_NONE } } },
+};
+
+#define EVENT_COUNT     (sizeof(events) / sizeof(events[0]))
+
+/* =============================================================================
+ * Records
+ * =============================================================================
+ */
+
+typedef struct {
+    unsigned long long  ts_ns;
+    unsigned            cpu;
+    unsigned            pid;
+    unsigned            event;
+    unsigned            phase;
+    unsigned long long  arg[2];
+    size_t              seq;        /* Input order, for equal timestamps */
+} record_t;
+
+static record_t* records = NULL;
+static size_t record_count = 0;
+static size_t record_room = 0;
+
+static int compare_records(const void* a, const void* b) {
+    const record_t* x = a;
+    const record_t* y = b;
+    if (x->ts_ns != y->ts_ns) {
+        return x->ts_ns < y->ts_ns ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void read_records(FILE* in) {
+    char line[LINE_MAX_LEN];
+    while (fgets(line, sizeof(line), in)) {
+        const char* p = strstr(line, "TRACE ");
+        record_t r;
+        if (!p || sscanf(p, "TRACE %llu %u %u %u %u %llx %llx", &r.ts_ns, &r.cpu, &r.pid,
+                         &r.event, &r.phase, &r.arg[0], &r.arg[1]) != 7) {
+            continue;
+        }
+        if (r.event == 0 || r.event >= EVENT_COUNT || r.phase > PH_END || r.cpu >= MAX_CPUS) {
+            continue;
+        }
+
+        if (record_count == record_room) {
+            record_room = record_room ? record_room * 2 : 4096;
+            records = realloc(records, record_room * sizeof(record_t));
+            if (!records) {
+                perror("trace2json");
+                exit(1);
+            }
+        }
+        r.seq = record_count;
+        records[record_count++] = r;
+    }
+}
+
+/* =============================================================================
+ * JSON Output
+ * =============================================================================
+ */
+
+static int first_event = 1;
+
+static void begin_event(void) {
+    printf(first_event ? "\n" : ",\n");
+    first_event = 0;
+}
+
+/* Chrome timestamps are microseconds */
+static void print_ts(const char* key, unsigned long long ns) {
+    printf("\"%s\":%llu.%03llu", key, ns / 1000, ns % 1000);
+}
+
+static void print_args(const record_t* r) {
+    const event_t* ev = &events[r->event];
+    int end = r->phase == PH_END;
+    int printed = 0;
+
+    printf(",\"args\":{");
+    for (int i = 0; i < 2; i++) {
+        const char* name = ev->arg_names[end][i];
+        if (!name) {
+            continue;
+        }
+        printf("%s\"%s\":", printed ? "," : "", name);
+        switch (ev->arg_fmts[end][i]) {
+        case ARG_HEX:
+            printf("\"0x%llx\"", r->arg[i]);
+            break;
+        case ARG_SIGNED:
+            printf("%lld", (long long)r->arg[i]);
+            break;
+        default:
+            printf("%llu", r->arg[i]);
+            break;
+        }
+        printed = 1;
+    }
+    printf("}");
+}
+
+static void print_name(const char* what, unsigned pid, unsigned tid, const char* fmt,
+                       unsigned n) {
+    begin_event();
+    printf("{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"",
+           what, pid, tid);
+    printf(fmt, n);
+    printf("\"}}");
+}
+
+/* A stretch of one process on one CPU */
+static void print_run(unsigned cpu, unsigned pid, unsigned long long start,
+                      unsigned long long end) {
+    begin_event();
+    printf("{\"name\":\"pid %u\",\"cat\":\"sched\",\"ph\":\"X\",", pid);
+    print_ts("ts", start);
+    printf(",");
+    print_ts("dur", end - start);
+    printf(",\"pid\":%u,\"tid\":%u}", CPU_TRACKS_PID, cpu);
+}
+
+int main(int argc, char** argv) {
+    (void)argv;
+    if (argc != 1) {
+        fprintf(stderr, "usage: trace2json < serial.log > trace.json\n");
+        return 1;
+    }
+
+    read_records(stdin);
+    if (record_count == 0) {
+        fprintf(stderr, "trace2json: no TRACE lines in the input (run 'trace dump' in the shell)\n");
+        return 1;
+    }
+    qsort(records, record_count, sizeof(record_t), compare_records);
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    /* Track names: the CPUs, then every process seen */
+    print_name("process_name", CPU_TRACKS_PID, 0, "CPUs", 0);
+    unsigned cpus_seen = 0;
+    for (size_t i = 0; i < record_count; i++) {
+        unsigned bit = 1u << records[i].cpu;
+        if (!(cpus_seen & bit)) {
+            cpus_seen |= bit;
+            print_name("thread_name", CPU_TRACKS_PID, records[i].cpu, "CPU %u", records[i].cpu);
+        }
+
+        int known = 0;
+        for (size_t j = 0; j < i && !known; j++) {
+            known = records[j].pid == records[i].pid;
+        }
+        if (!known) {
+            print_name("process_name", records[i].pid, records[i].pid, "pid %u",
+                       records[i].pid);
+        }
+    }
+
+    /* What runs on each CPU since its last switch (valid: seen a switch) */
+    unsigned long long run_start[MAX_CPUS];
+    unsigned run_pid[MAX_CPUS];
+    int run_valid[MAX_CPUS] = { 0 };
+
+    for (size_t i = 0; i < record_count; i++) {
+        const record_t* r = &records[i];
+        const event_t* ev = &events[r->event];
+
+        if (r->event == EV_SCHED_SWITCH) {
+            if (run_valid[r->cpu]) {
+                print_run(r->cpu, run_pid[r->cpu], run_start[r->cpu], r->ts_ns);
+            }
+            run_start[r->cpu] = r->ts_ns;
+            run_pid[r->cpu] = (unsigned)r->arg[1];
+            run_valid[r->cpu] = 1;
+        }
+
+        static const char* const phases[] = { "i", "B", "E" };
+        begin_event();
+        printf("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",", ev->name, ev->cat,
+               phases[r->phase]);
+        print_ts("ts", r->ts_ns);
+        printf(",\"pid\":%u,\"tid\":%u", r->pid, r->pid);
+        if (r->phase == PH_INSTANT) {
+            printf(",\"s\":\"t\"");
+        }
+        print_args(r);
+        printf("}");
+    }
+
+    /* Whatever is still running ran until the last record */
+    unsigned long long last = records[record_count - 1].ts_ns;
+    for (unsigned cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (run_valid[cpu] && last > run_start[cpu]) {
+            print_run(cpu, run_pid[cpu], run_start[cpu], last);
+        }
+    }
+
+    printf("\n]}\n");
+    return 0;
+}
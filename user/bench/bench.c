@@ -0,0 +1,168 @@
+/**
+ * =============================================================================
+ * Chanux OS - User Benchmarks
+ * =============================================================================
+ * The user half of `make bench` (see kernel/include/bench.h): the costs
+ * that only show from ring 3. The kernel suite starts this as /bin/bench
+ * and waits for it to exit.
+ *
+ *   syscall_null    SYS_GETPID through the syscall instruction, which is
+ *                   the whole round trip (getpid() itself reads the vvar
+ *                   page and never enters the kernel)
+ *   vdso_getpid     getpid(), for comparison
+ *   sched_yield     yield() with nothing else to run
+ *   ctxsw_pipe      A byte sent to a forked child and back over two pipes:
+ *                   two context switches (and pipe wakeups) per round trip
+ *
+ * Results use the kernel suite's line format, timed the same way.
+ * =============================================================================
+ */
+
+#include "../include/syscall.h"
+
+#define BENCH_RUNS      5           /* As in the kernel suite: fastest run counts */
+
+/* =============================================================================
+ * Timing and Reporting
+ * =============================================================================
+ */
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+typedef struct {
+    uint64_t    cycles;
+    uint64_t    ns;
+} bench_time_t;
+
+static bench_time_t best;
+static bench_time_t run_start;
+
+static void bench_begin(void) {
+    run_start.ns = clock_ns();
+    run_start.cycles = rdtsc();
+}
+
+static void bench_end(void) {
+    uint64_t cycles = rdtsc() - run_start.cycles;
+    uint64_t ns = clock_ns() - run_start.ns;
+    if (cycles < best.cycles) {
+        best.cycles = cycles;
+        best.ns = ns;
+    }
+}
+
+static void bench_report(const char* name, uint64_t iters) {
+    uint64_t ns10 = best.ns * 10 / iters;
+
+    puts("BENCH ");
+    puts(name);
+    puts(" iters=");
+    print_uint(iters);
+    puts(" cycles=");
+    print_uint(best.cycles / iters);
+    puts(" ns=");
+    print_uint(ns10 / 10);
+    puts(".");
+    print_uint(ns10 % 10);
+    puts("\n");
+
+    best.cycles = ~0ULL;
+}
+
+/* =============================================================================
+ * Benchmarks
+ * =============================================================================
+ */
+
+static void bench_syscalls(void) {
+    const uint64_t iters = 100000;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        bench_begin();
+        for (uint64_t i = 0; i < iters; i++) {
+            syscall0(SYS_GETPID);
+        }
+        bench_end();
+    }
+    bench_report("syscall_null", iters);
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        bench_begin();
+        for (uint64_t i = 0; i < iters; i++) {
+            __asm__ volatile ("" : : "r"(getpid()));
+        }
+        bench_end();
+    }
+    bench_report("vdso_getpid", iters);
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        bench_begin();
+        for (uint64_t i = 0; i < iters / 10; i++) {
+            yield();
+        }
+        bench_end();
+    }
+    bench_report("sched_yield", iters / 10);
+}
+
+/**
+ * Pipe ping-pong with a child.
+ *
+ * @return 0 on success, -1 if the pipes or the child cannot be set up
+ */
+static int bench_ctxsw(void) {
+    const uint64_t iters = 10000;
+    int to_child[2];
+    int to_parent[2];
+    char byte = 0;
+
+    if (pipe(to_child) < 0 || pipe(to_parent) < 0) {
+        puts("BENCH-ERROR pipe failed\n");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        puts("BENCH-ERROR fork failed\n");
+        return -1;
+    }
+
+    if (pid == 0) {
+        /* Echo every byte back, for all the parent's runs */
+        for (uint64_t i = 0; i < BENCH_RUNS * iters; i++) {
+            if (read(to_child[0], &byte, 1) != 1 || write(to_parent[1], &byte, 1) != 1) {
+                exit(1);
+            }
+        }
+        exit(0);
+    }
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        bench_begin();
+        for (uint64_t i = 0; i < iters; i++) {
+            if (write(to_child[1], &byte, 1) != 1 || read(to_parent[0], &byte, 1) != 1) {
+                puts("BENCH-ERROR ping-pong child went away\n");
+                return -1;
+            }
+        }
+        bench_end();
+    }
+    bench_report("ctxsw_pipe", iters);
+    return 0;
+}
+
+/* =============================================================================
+ * Entry Point
+ * =============================================================================
+ */
+
+int bench_main(void) {
+    best.cycles = ~0ULL;
+
+    bench_syscalls();
+    return bench_ctxsw() < 0 ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+; =============================================================================
+; Chanux OS - Benchmark Startup Code
+; =============================================================================
+; Entry point for /bin/bench (make bench).
+; Sets up C runtime environment and calls bench_main().
+; =============================================================================
+
+[BITS 64]
+
+section .text.entry
+
+; External C entry point
+extern bench_main
+
+; =============================================================================
+; _start - Benchmark entry point
+; =============================================================================
+
+global _start
+_start:
+    ; Align stack to 16 bytes (required by System V ABI)
+    and rsp, ~0xF
+
+    ; Clear frame pointer for clean stack traces
+    xor rbp, rbp
+
+    ; Call the C bench_main function
+    call bench_main
+
+    ; Exit with its return value
+    mov rdi, rax
+    mov rax, 0          ; SYS_EXIT = 0
+    syscall
+
+    ; Should never reach here
+.hang:
+    hlt
+    jmp .hang
@@ -54,6 +54,28 @@ typedef int32_t pid_t;
 #define SYS_READDIR     11      /* int readdir(int fd, struct dirent* entry, int index) */
 #define SYS_GETCWD      12      /* int getcwd(char* buf, size_t size) */
 #define SYS_CHDIR       13      /* int chdir(const char* path) */
+#define SYS_FORK        14      /* pid_t fork(void) */
+#define SYS_NANOSLEEP   15      /* int nanosleep(uint64_t ns) */
+#define SYS_IO_RING_SETUP 16    /* int io_ring_setup(io_ring_t* ring) */
+#define SYS_IO_RING_ENTER 17    /* int io_ring_enter(uint32_t to_submit) */
+#define SYS_READV       18      /* ssize_t readv(int fd, const iovec_t* iov, int iovcnt) */
+#define SYS_WRITEV      19      /* ssize_t writev(int fd, const iovec_t* iov, int iovcnt) */
+#define SYS_PREAD       20      /* ssize_t pread(int fd, void* buf, size_t len, off_t off) */
+#define SYS_PWRITE      21      /* ssize_t pwrite(int fd, const void* buf, size_t len, off_t off) */
+#define SYS_SENDFILE    22      /* ssize_t sendfile(int out, int in, off_t* off, size_t len) */
+#define SYS_COPY_FILE_RANGE 23  /* ssize_t copy_file_range(int in, off_t* in_off, int out, off_t* out_off, size_t len) */
+#define SYS_MMAP        24      /* void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off) */
+#define SYS_MUNMAP      25      /* int munmap(void* addr, size_t len) */
+#define SYS_SYNC        26      /* int sync(void) */
+#define SYS_PIPE        27      /* int pipe(int fds[2]) */
+#define SYS_DUP2        28      /* int dup2(int oldfd, int newfd) */
+#define SYS_FUTEX_WAIT  29      /* int futex_wait(uint32_t* addr, uint32_t val) */
+#define SYS_FUTEX_WAKE  30      /* int futex_wake(uint32_t* addr, int count) */
+#define SYS_THREAD_CREATE 31    /* pid_t thread_create(void* entry, void* arg0, void* arg1) */
+#define SYS_KLOG_READ   32      /* ssize_t klog_read(char* buf, size_t len) */
+#define SYS_SYSSTAT     33      /* int sysstat(syscall_stat_t* stats, size_t count) */
+#define SYS_PROFILE     34      /* ssize_t profile(int op, profile_sample_t* buf, size_t count) */
+#define SYS_TRACE       35      /* ssize_t trace(int op, trace_record_t* buf, size_t arg) */
 
 /* =============================================================================
  * File Open Flags
@@ -72,6 +94,17 @@ typedef int32_t pid_t;
 #define SEEK_CUR        1       /* Offset from current position */
 #define SEEK_END        2       /* Offset from end of file */
 
+/* mmap() protection and flags */
+#define PROT_READ       0x1     /* Pages can be read (always true) */
+#define PROT_WRITE      0x2     /* Pages can be written */
+#define PROT_EXEC       0x4     /* Pages can be executed */
+
+#define MAP_SHARED      0x01    /* Writes go to the file */
+#define MAP_PRIVATE     0x02    /* Writes go to a private copy */
+
+#define MAP_FAILED      ((void*)-1)
+#define MMAP_MAX_LEN    0x10000000      /* Longest single mapping (256MB) */
+
 /* =============================================================================
  * File Types (for stat)
  * =============================================================================
@@ -79,6 +112,7 @@ typedef int32_t pid_t;
 
 #define S_IFREG         1       /* Regular file */
 #define S_IFDIR         2       /* Directory */
+#define S_IFIFO         3       /* Pipe (fstat only; st_size = bytes buffered) */
 
 /* =============================================================================
  * File System Structures
@@ -107,6 +141,175 @@ typedef struct dirent {
     char     d_name[256];       /* Filename */
 } dirent_t;
 
+/* Scatter/gather buffer for readv()/writev() */
+#define IOV_MAX         16      /* Most entries per call */
+
+typedef struct iovec {
+    void*    iov_base;          /* Buffer */
+    size_t   iov_len;           /* Buffer length */
+} iovec_t;
+
+/* =============================================================================
+ * Batched File I/O Ring
+ * =============================================================================
+ * Queue SQEs with io_ring_get_sqe(), run them all with one io_ring_submit(),
+ * then collect one CQE per SQE (in order) with io_ring_get_cqe().
+ * Must match kernel syscall/io_ring.h.
+ */
+
+#define IO_RING_ENTRIES         64
+#define IO_RING_MASK            (IO_RING_ENTRIES - 1)
+
+#define IO_OP_NOP               0       /* res = 0 */
+#define IO_OP_OPEN              1       /* addr = path, len = flags */
+#define IO_OP_CLOSE             2       /* fd */
+#define IO_OP_READ              3       /* fd, addr = buffer, len */
+#define IO_OP_WRITE             4       /* fd, addr = buffer, len */
+#define IO_OP_LSEEK             5       /* fd, off, len = whence */
+#define IO_OP_STAT              6       /* addr = path, addr2 = stat buffer */
+#define IO_OP_FSTAT             7       /* fd, addr = stat buffer */
+#define IO_OP_READDIR           8       /* fd, addr = dirent, off = index */
+#define IO_OP_PREAD             9       /* fd, addr = buffer, len, off */
+#define IO_OP_PWRITE            10      /* fd, addr = buffer, len, off */
+
+typedef struct io_sqe {
+    uint8_t             opcode;         /* IO_OP_* */
+    uint8_t             reserved[3];
+    int32_t             fd;
+    uint64_t            addr;           /* Buffer or path */
+    uint64_t            addr2;          /* Second buffer */
+    uint64_t            len;            /* Length, flags or whence */
+    int64_t             off;            /* Offset or index */
+    uint64_t            user_data;      /* Copied to the CQE */
+} io_sqe_t;
+
+typedef struct io_cqe {
+    uint64_t            user_data;      /* From the SQE */
+    int64_t             res;            /* Result or negative error */
+} io_cqe_t;
+
+typedef struct io_ring {
+    volatile uint32_t   sq_head;        /* Written by the kernel */
+    volatile uint32_t   sq_tail;
+    volatile uint32_t   cq_head;
+    volatile uint32_t   cq_tail;        /* Written by the kernel */
+    io_sqe_t            sq[IO_RING_ENTRIES];
+    io_cqe_t            cq[IO_RING_ENTRIES];
+} __attribute__((aligned(8))) io_ring_t;
+
+/* =============================================================================
+ * Mutexes and Condition Variables
+ * =============================================================================
+ * Built on futex_wait()/futex_wake(): taking a free mutex, releasing one
+ * nobody waits for, and signalling a condition nobody waits on are plain
+ * atomic instructions with no system call. The words may live in any
+ * memory, including a MAP_SHARED mapping used by several processes.
+ */
+
+typedef struct {
+    volatile uint32_t   state;          /* 0 free, 1 locked, 2 locked with waiters */
+} mutex_t;
+
+typedef struct {
+    volatile uint32_t   seq;            /* Bumped by every signal/broadcast */
+    volatile uint32_t   waiters;        /* Processes inside cond_wait() */
+} cond_t;
+
+#define MUTEX_INIT          { 0 }
+#define COND_INIT           { 0, 0 }
+
+/* =============================================================================
+ * vvar Pages
+ * =============================================================================
+ * Read-only kernel data mapped into every process, so getpid() and the
+ * clock functions need no system call. Must match kernel user/vdso.h.
+ */
+
+#define VDSO_CLOCK_ADDR     0x00007FFFFFFFE000ULL
+#define VDSO_PROC_ADDR      0x00007FFFFFFFF000ULL
+
+#define VDSO_CLOCK_TSC      0x01
+
+typedef struct {
+    volatile uint32_t   seq;            /* Odd while being updated */
+    uint32_t            flags;          /* VDSO_CLOCK_* */
+    volatile uint64_t   ticks;          /* 100Hz ticks (used without a TSC) */
+    uint64_t            tsc_base;
+    uint64_t            ns_base;
+    uint64_t            ns_per_cycle;   /* 32.32 fixed point */
+    uint64_t            tsc_khz;
+} vdso_clock_t;
+
+typedef struct {
+    uint64_t            pid;
+} vdso_proc_t;
+
+/* =============================================================================
+ * Syscall Statistics
+ * =============================================================================
+ * What sysstat() returns for each syscall number, summed over all CPUs.
+ * Must match kernel syscall/syscall.h.
+ */
+
+#define SYSSTAT_BUCKETS 32      /* hist[i] counts calls of [2^i, 2^(i+1)) ns */
+
+typedef struct {
+    uint64_t    calls;
+    uint64_t    errors;         /* Calls that returned a negative value */
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint32_t    hist[SYSSTAT_BUCKETS];
+} syscall_stat_t;
+
+/* =============================================================================
+ * Sampling Profiler
+ * =============================================================================
+ * One sample per scheduler tick on every busy CPU while profiling is on.
+ * Must match kernel syscall/syscall.h.
+ */
+
+#define PROFILE_START       0   /* Discard old samples and start sampling */
+#define PROFILE_STOP        1   /* Stop sampling */
+#define PROFILE_READ        2   /* Move up to count samples into buf */
+#define PROFILE_DROPPED     3   /* Samples lost to full rings since the start */
+
+#define PROFILE_SAMPLE_USER 0x1 /* Interrupted in user mode */
+
+typedef struct {
+    uint64_t    rip;            /* Interrupted instruction */
+    uint32_t    pid;            /* Running process (0: none yet) */
+    uint16_t    cpu;
+    uint16_t    flags;          /* PROFILE_SAMPLE_* */
+} profile_sample_t;
+
+/* =============================================================================
+ * Tracepoints
+ * =============================================================================
+ * Binary records from the kernel's tracepoints; scripts/trace2json.c
+ * knows the events. Must match kernel trace.h.
+ */
+
+#define TRACE_SCHED         0x01    /* Context switches */
+#define TRACE_MM            0x02    /* Page faults, page and heap allocations */
+#define TRACE_VFS           0x04    /* vfs_open(), reads and writes */
+#define TRACE_IRQ           0x08    /* Hardware interrupts */
+#define TRACE_ALL           0x0F
+
+#define TRACE_START         0       /* Drop old records, trace the categories in arg */
+#define TRACE_STOP          1
+#define TRACE_READ          2       /* Move up to arg records into buf */
+#define TRACE_DROPPED       3       /* Records lost to full rings since the start */
+
+typedef struct {
+    uint64_t    ts_ns;          /* Nanoseconds since boot */
+    uint32_t    pid;
+    uint16_t    cpu;
+    uint8_t     event;
+    uint8_t     phase;          /* 0: instant, 1: begin, 2: end */
+    uint64_t    arg0;
+    uint64_t    arg1;
+} trace_record_t;
+
 /* =============================================================================
  * Raw Syscall Interface
  * =============================================================================
@@ -115,7 +318,7 @@ typedef struct dirent {
  */
 
 /**
- * Invoke a system call with up to 5 arguments.
+ * Invoke a system call with up to 6 arguments.
  *
  * @param num   System call number
  * @param arg1  First argument
@@ -123,29 +326,36 @@ typedef struct dirent {
  * @param arg3  Third argument
  * @param arg4  Fourth argument
  * @param arg5  Fifth argument
+ * @param arg6  Sixth argument
  * @return      System call return value (in RAX)
  */
 extern int64_t syscall_raw(uint64_t num, uint64_t arg1, uint64_t arg2,
-                           uint64_t arg3, uint64_t arg4, uint64_t arg5);
+                           uint64_t arg3, uint64_t arg4, uint64_t arg5,
+                           uint64_t arg6);
 
 /* Convenience macros for different argument counts */
 #define syscall0(num) \
-    syscall_raw(num, 0, 0, 0, 0, 0)
+    syscall_raw(num, 0, 0, 0, 0, 0, 0)
 
 #define syscall1(num, a1) \
-    syscall_raw(num, (uint64_t)(a1), 0, 0, 0, 0)
+    syscall_raw(num, (uint64_t)(a1), 0, 0, 0, 0, 0)
 
 #define syscall2(num, a1, a2) \
-    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), 0, 0, 0)
+    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), 0, 0, 0, 0)
 
 #define syscall3(num, a1, a2, a3) \
-    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), 0, 0)
+    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), 0, 0, 0)
 
 #define syscall4(num, a1, a2, a3, a4) \
-    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4), 0)
+    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4), 0, 0)
 
 #define syscall5(num, a1, a2, a3, a4, a5) \
-    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4), (uint64_t)(a5))
+    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4), \
+                (uint64_t)(a5), 0)
+
+#define syscall6(num, a1, a2, a3, a4, a5, a6) \
+    syscall_raw(num, (uint64_t)(a1), (uint64_t)(a2), (uint64_t)(a3), (uint64_t)(a4), \
+                (uint64_t)(a5), (uint64_t)(a6))
 
 /* =============================================================================
  * High-Level Syscall Wrappers
@@ -155,6 +365,8 @@ extern int64_t syscall_raw(uint64_t num, uint64_t arg1, uint64_t arg2,
 
 /**
  * Terminate the current process.
+ * In a process with several threads only the calling thread ends; the
+ * process is gone once its last thread has exited.
  *
  * @param code Exit code (returned to parent)
  */
@@ -180,6 +392,140 @@ ssize_t write(int fd, const void* buf, size_t len);
  */
 ssize_t read(int fd, void* buf, size_t len);
 
+/**
+ * Read into several buffers, filling each in turn.
+ *
+ * @param fd     File descriptor
+ * @param iov    Buffers (at most IOV_MAX)
+ * @param iovcnt Number of buffers
+ * @return       Total bytes read, or negative error code
+ */
+ssize_t readv(int fd, const iovec_t* iov, int iovcnt);
+
+/**
+ * Write several buffers in one call.
+ *
+ * @param fd     File descriptor
+ * @param iov    Buffers (at most IOV_MAX)
+ * @param iovcnt Number of buffers
+ * @return       Total bytes written, or negative error code
+ */
+ssize_t writev(int fd, const iovec_t* iov, int iovcnt);
+
+/**
+ * Read at a file position without moving the file offset.
+ *
+ * @param fd     File descriptor (not the console)
+ * @param buf    Buffer to store read data
+ * @param len    Maximum bytes to read
+ * @param offset Position to read from
+ * @return       Number of bytes read, or negative error code
+ */
+ssize_t pread(int fd, void* buf, size_t len, ssize_t offset);
+
+/**
+ * Write at a file position without moving the file offset.
+ *
+ * @param fd     File descriptor (not the console)
+ * @param buf    Data to write
+ * @param len    Number of bytes to write
+ * @param offset Position to write at
+ * @return       Number of bytes written, or negative error code
+ */
+ssize_t pwrite(int fd, const void* buf, size_t len, ssize_t offset);
+
+/**
+ * Copy from a file to stdout/stderr or another file inside the kernel.
+ *
+ * @param out_fd Destination (1, 2 or a regular file)
+ * @param in_fd  Source regular file
+ * @param offset Source position, advanced on return; NULL to use and
+ *               advance in_fd's file offset
+ * @param count  Maximum bytes to copy
+ * @return       Bytes copied (0 at end of file), or negative error code
+ */
+ssize_t sendfile(int out_fd, int in_fd, ssize_t* offset, size_t count);
+
+/**
+ * Copy between two regular files inside the kernel.
+ * Block-aligned whole blocks are shared copy-on-write.
+ *
+ * @param fd_in   Source file
+ * @param off_in  Source position (advanced), or NULL for the file offset
+ * @param fd_out  Destination file
+ * @param off_out Destination position (advanced), or NULL for the file offset
+ * @param len     Maximum bytes to copy
+ * @return        Bytes copied (0 at end of file), or negative error code
+ */
+ssize_t copy_file_range(int fd_in, ssize_t* off_in, int fd_out, ssize_t* off_out, size_t len);
+
+/**
+ * Read the kernel log: the newest len bytes of it, or all of it (up to
+ * the 32KB the kernel keeps) if that is less.
+ *
+ * @param buf Buffer to fill
+ * @param len Buffer size
+ * @return    Bytes read, or negative error code
+ */
+ssize_t klog_read(char* buf, size_t len);
+
+/**
+ * Read the per-syscall counters and latency histograms.
+ *
+ * @param stats Array indexed by syscall number
+ * @param count Number of entries in stats (fewer are filled if the kernel
+ *              has fewer syscalls)
+ * @return      Number of syscalls the kernel has, or negative error code
+ */
+int sysstat(syscall_stat_t* stats, size_t count);
+
+/**
+ * Control the sampling profiler.
+ *
+ * @param op    PROFILE_START, PROFILE_STOP, PROFILE_READ or PROFILE_DROPPED
+ * @param buf   Samples buffer (PROFILE_READ; NULL otherwise)
+ * @param count Room in buf, in samples (at most 256 are moved per call)
+ * @return      Samples read (PROFILE_READ), samples dropped
+ *              (PROFILE_DROPPED), 0, or negative error code
+ */
+ssize_t profile(int op, profile_sample_t* buf, size_t count);
+
+/**
+ * Control the kernel tracepoints.
+ *
+ * @param op  TRACE_START, TRACE_STOP, TRACE_READ or TRACE_DROPPED
+ * @param buf Records buffer (TRACE_READ; NULL otherwise)
+ * @param arg TRACE_* categories (TRACE_START), or room in buf, in
+ *            records (TRACE_READ; at most 256 are moved per call)
+ * @return    Records read (TRACE_READ), records dropped (TRACE_DROPPED),
+ *            0, or negative error code
+ */
+ssize_t trace(int op, trace_record_t* buf, size_t arg);
+
+/**
+ * Map a regular file into memory.
+ * The mapping uses the file's own pages: MAP_SHARED writes change the
+ * file directly, MAP_PRIVATE writes go to private copies.
+ *
+ * @param addr   Placement hint (ignored)
+ * @param len    Bytes to map (at most MMAP_MAX_LEN)
+ * @param prot   PROT_READ, PROT_WRITE, PROT_EXEC
+ * @param flags  MAP_SHARED or MAP_PRIVATE
+ * @param fd     Regular file
+ * @param offset Page-aligned file position
+ * @return       Address of the mapping, or MAP_FAILED
+ */
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, ssize_t offset);
+
+/**
+ * Remove a mapping made by mmap().
+ *
+ * @param addr Address returned by mmap()
+ * @param len  Length passed to mmap()
+ * @return     0 on success, negative error code on failure
+ */
+int munmap(void* addr, size_t len);
+
 /**
  * Yield CPU to another process.
  *
@@ -202,6 +548,57 @@ pid_t getpid(void);
  */
 int sleep(uint64_t ms);
 
+/**
+ * Create a child process.
+ * The child gets a copy-on-write copy of the caller's memory and shares
+ * its open files.
+ *
+ * @return Child PID in the parent, 0 in the child, negative on error
+ */
+pid_t fork(void);
+
+/**
+ * Sleep for specified nanoseconds.
+ * The kernel's timer resolution is about 65us.
+ *
+ * @param ns Nanoseconds to sleep
+ * @return   0 on success, negative on error
+ */
+int nanosleep(uint64_t ns);
+
+/**
+ * Run fn(arg) in a new thread of this process.
+ * The thread shares all memory and open files and has its own 256KB
+ * stack; returning from fn ends it like exit(0). Wait for a thread with
+ * the synchronization functions below. At most 8 threads can be running
+ * besides the first.
+ *
+ * @param fn  Thread function
+ * @param arg Passed to fn
+ * @return    Thread ID (a PID) on success, negative on error
+ */
+pid_t thread_create(void (*fn)(void*), void* arg);
+
+/* =============================================================================
+ * Time Functions (vvar, no system call)
+ * =============================================================================
+ */
+
+/**
+ * Nanoseconds since boot (TSC resolution where available).
+ */
+uint64_t clock_ns(void);
+
+/**
+ * Milliseconds since boot.
+ */
+uint64_t uptime_ms(void);
+
+/**
+ * Scheduler ticks (10ms) since boot.
+ */
+uint64_t get_ticks(void);
+
 /* =============================================================================
  * File System Functions (Phase 6)
  * =============================================================================
@@ -279,6 +676,132 @@ char* getcwd(char* buf, size_t size);
  */
 int chdir(const char* path);
 
+/**
+ * Save the filesystem to the snapshot disk; the next boot starts from it.
+ *
+ * @return 0 on success, negative error on failure
+ */
+int sync(void);
+
+/**
+ * Create a pipe. Data written to fds[1] is read from fds[0]; reads
+ * return 0 once every write end is closed.
+ *
+ * @param fds Filled with the read end and the write end
+ * @return    0 on success, negative error on failure
+ */
+int pipe(int fds[2]);
+
+/**
+ * Make newfd refer to the same open file as oldfd (closing newfd first).
+ * Works on 0-2 too, e.g. dup2(fds[1], 1) sends stdout into a pipe.
+ *
+ * @param oldfd Open file descriptor
+ * @param newfd Descriptor to replace
+ * @return      newfd on success, negative error on failure
+ */
+int dup2(int oldfd, int newfd);
+
+/* =============================================================================
+ * Batched File I/O
+ * =============================================================================
+ */
+
+/**
+ * Register a ring with the kernel (resets it).
+ *
+ * @param ring Ring in the caller's memory (NULL to unregister)
+ * @return     0 on success, negative error on failure
+ */
+int io_ring_setup(io_ring_t* ring);
+
+/**
+ * Get the next free SQE, cleared, or NULL if the SQ is full.
+ * The SQE is queued by the next io_ring_submit().
+ */
+io_sqe_t* io_ring_get_sqe(io_ring_t* ring);
+
+/**
+ * Run every queued SQE in one system call.
+ *
+ * @return Number of SQEs run, or negative error
+ */
+int io_ring_submit(io_ring_t* ring);
+
+/**
+ * Take the oldest CQE.
+ *
+ * @param cqe Filled in on success
+ * @return    0 on success, -1 if the CQ is empty
+ */
+int io_ring_get_cqe(io_ring_t* ring, io_cqe_t* cqe);
+
+/* =============================================================================
+ * Synchronization
+ * =============================================================================
+ */
+
+/**
+ * Sleep until woken through futex_wake(), provided *addr still holds val.
+ *
+ * @param addr Word to wait on (4-byte aligned)
+ * @param val  Value last read from it
+ * @return     0 when woken (possibly spuriously), -11 (EAGAIN) if *addr
+ *             no longer holds val, other negative error on a bad address
+ */
+int futex_wait(volatile uint32_t* addr, uint32_t val);
+
+/**
+ * Wake up to count processes sleeping in futex_wait() on addr.
+ * Waiters in other processes are found too if the word is shared memory.
+ *
+ * @return Number of processes woken, or negative error
+ */
+int futex_wake(volatile uint32_t* addr, int count);
+
+/**
+ * Initialize a mutex (or use MUTEX_INIT).
+ */
+void mutex_init(mutex_t* m);
+
+/**
+ * Lock a mutex, sleeping in the kernel only while it is held.
+ */
+void mutex_lock(mutex_t* m);
+
+/**
+ * Try to lock a mutex without sleeping.
+ *
+ * @return 0 on success, -1 if it is held
+ */
+int mutex_trylock(mutex_t* m);
+
+/**
+ * Unlock a mutex, waking one waiter if there are any.
+ */
+void mutex_unlock(mutex_t* m);
+
+/**
+ * Initialize a condition variable (or use COND_INIT).
+ */
+void cond_init(cond_t* c);
+
+/**
+ * Release m, sleep until signalled, and lock m again.
+ * Wake-ups may be spurious: always re-check the condition in a loop.
+ */
+void cond_wait(cond_t* c, mutex_t* m);
+
+/**
+ * Wake one process in cond_wait(). Call with the mutex held.
+ */
+void cond_signal(cond_t* c);
+
+/**
+ * Wake every process in cond_wait(). Call with the mutex held.
+ */
+void cond_broadcast(cond_t* c);
+
 /* =============================================================================
  * Convenience Functions
  * =============================================================================
@@ -40,6 +40,91 @@ ssize_t read(int fd, void* buf, size_t len) {
     return (ssize_t)syscall3(SYS_READ, fd, buf, len);
 }
 
+/**
+ * Scatter read.
+ */
+ssize_t readv(int fd, const iovec_t* iov, int iovcnt) {
+    return (ssize_t)syscall3(SYS_READV, fd, iov, iovcnt);
+}
+
+/**
+ * Gather write.
+ */
+ssize_t writev(int fd, const iovec_t* iov, int iovcnt) {
+    return (ssize_t)syscall3(SYS_WRITEV, fd, iov, iovcnt);
+}
+
+/**
+ * Positional read.
+ */
+ssize_t pread(int fd, void* buf, size_t len, ssize_t offset) {
+    return (ssize_t)syscall4(SYS_PREAD, fd, buf, len, offset);
+}
+
+/**
+ * Positional write.
+ */
+ssize_t pwrite(int fd, const void* buf, size_t len, ssize_t offset) {
+    return (ssize_t)syscall4(SYS_PWRITE, fd, buf, len, offset);
+}
+
+/**
+ * In-kernel copy to the console or a file.
+ */
+ssize_t sendfile(int out_fd, int in_fd, ssize_t* offset, size_t count) {
+    return (ssize_t)syscall4(SYS_SENDFILE, out_fd, in_fd, offset, count);
+}
+
+/**
+ * In-kernel file to file copy.
+ */
+ssize_t copy_file_range(int fd_in, ssize_t* off_in, int fd_out, ssize_t* off_out, size_t len) {
+    return (ssize_t)syscall5(SYS_COPY_FILE_RANGE, fd_in, off_in, fd_out, off_out, len);
+}
+
+/**
+ * Read the kernel log.
+ */
+ssize_t klog_read(char* buf, size_t len) {
+    return (ssize_t)syscall2(SYS_KLOG_READ, buf, len);
+}
+
+/**
+ * Read the syscall statistics.
+ */
+int sysstat(syscall_stat_t* stats, size_t count) {
+    return (int)syscall2(SYS_SYSSTAT, stats, count);
+}
+
+/**
+ * Control the sampling profiler.
+ */
+ssize_t profile(int op, profile_sample_t* buf, size_t count) {
+    return (ssize_t)syscall3(SYS_PROFILE, op, buf, count);
+}
+
+/**
+ * Control the kernel tracepoints.
+ */
+ssize_t trace(int op, trace_record_t* buf, size_t arg) {
+    return (ssize_t)syscall3(SYS_TRACE, op, buf, arg);
+}
+
+/**
+ * Map a file into memory.
+ */
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, ssize_t offset) {
+    int64_t ret = syscall6(SYS_MMAP, addr, len, prot, flags, fd, offset);
+    return ret < 0 ? MAP_FAILED : (void*)ret;
+}
+
+/**
+ * Remove a file mapping.
+ */
+int munmap(void* addr, size_t len) {
+    return (int)syscall2(SYS_MUNMAP, addr, len);
+}
+
 /**
  * Yield CPU to another process.
  */
@@ -48,10 +133,10 @@ int yield(void) {
 }
 
 /**
- * Get current process ID.
+ * Get current process ID (from the vvar page).
  */
 pid_t getpid(void) {
-    return (pid_t)syscall0(SYS_GETPID);
+    return (pid_t)((const vdso_proc_t*)VDSO_PROC_ADDR)->pid;
 }
 
 /**
@@ -61,6 +146,83 @@ int sleep(uint64_t ms) {
     return (int)syscall1(SYS_SLEEP, ms);
 }
 
+/**
+ * Create a copy-on-write child process.
+ */
+pid_t fork(void) {
+    return (pid_t)syscall0(SYS_FORK);
+}
+
+/**
+ * Sleep for specified nanoseconds.
+ */
+int nanosleep(uint64_t ns) {
+    return (int)syscall1(SYS_NANOSLEEP, ns);
+}
+
+/* First code a new thread runs: call its function, then end the thread */
+static void thread_start(void (*fn)(void*), void* arg) {
+    fn(arg);
+    exit(0);
+}
+
+/**
+ * Start a thread.
+ */
+pid_t thread_create(void (*fn)(void*), void* arg) {
+    return (pid_t)syscall3(SYS_THREAD_CREATE, thread_start, fn, arg);
+}
+
+/* =============================================================================
+ * Time Functions (vvar)
+ * =============================================================================
+ */
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * Nanoseconds since boot, computed like the kernel's clock_ns().
+ */
+uint64_t clock_ns(void) {
+    const vdso_clock_t* vd = (const vdso_clock_t*)VDSO_CLOCK_ADDR;
+    uint32_t seq;
+    uint64_t ns;
+
+    do {
+        seq = vd->seq;
+        __asm__ volatile ("" : : : "memory");
+
+        if (vd->flags & VDSO_CLOCK_TSC) {
+            uint64_t delta = rdtsc() - vd->tsc_base;
+            ns = vd->ns_base + (uint64_t)(((unsigned __int128)delta * vd->ns_per_cycle) >> 32);
+        } else {
+            ns = vd->ticks * 10000000ULL;
+        }
+
+        __asm__ volatile ("" : : : "memory");
+    } while ((seq & 1) || seq != vd->seq);
+
+    return ns;
+}
+
+/**
+ * Milliseconds since boot.
+ */
+uint64_t uptime_ms(void) {
+    return clock_ns() / 1000000ULL;
+}
+
+/**
+ * Scheduler ticks since boot.
+ */
+uint64_t get_ticks(void) {
+    return clock_ns() / 10000000ULL;
+}
+
 /* =============================================================================
  * File System Wrappers (Phase 6)
  * =============================================================================
@@ -126,6 +288,187 @@ int chdir(const char* path) {
     return (int)syscall1(SYS_CHDIR, path);
 }
 
+/**
+ * Save a filesystem snapshot.
+ */
+int sync(void) {
+    return (int)syscall0(SYS_SYNC);
+}
+
+/**
+ * Create a pipe.
+ */
+int pipe(int fds[2]) {
+    return (int)syscall1(SYS_PIPE, fds);
+}
+
+/**
+ * Duplicate a file descriptor onto another.
+ */
+int dup2(int oldfd, int newfd) {
+    return (int)syscall2(SYS_DUP2, oldfd, newfd);
+}
+
+/* =============================================================================
+ * Batched File I/O
+ * =============================================================================
+ */
+
+/**
+ * Register a ring with the kernel.
+ */
+int io_ring_setup(io_ring_t* ring) {
+    return (int)syscall1(SYS_IO_RING_SETUP, ring);
+}
+
+/**
+ * Claim the next free SQE.
+ */
+io_sqe_t* io_ring_get_sqe(io_ring_t* ring) {
+    uint32_t tail = ring->sq_tail;
+    if (tail - ring->sq_head >= IO_RING_ENTRIES) {
+        return NULL;
+    }
+
+    io_sqe_t* sqe = &ring->sq[tail & IO_RING_MASK];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_tail = tail + 1;
+    return sqe;
+}
+
+/**
+ * Run all queued SQEs.
+ */
+int io_ring_submit(io_ring_t* ring) {
+    uint32_t pending = ring->sq_tail - ring->sq_head;
+    if (pending == 0) {
+        return 0;
+    }
+    return (int)syscall1(SYS_IO_RING_ENTER, pending);
+}
+
+/**
+ * Take the oldest completion.
+ */
+int io_ring_get_cqe(io_ring_t* ring, io_cqe_t* cqe) {
+    uint32_t head = ring->cq_head;
+    if (head == ring->cq_tail) {
+        return -1;
+    }
+
+    *cqe = ring->cq[head & IO_RING_MASK];
+    ring->cq_head = head + 1;
+    return 0;
+}
+
+/* =============================================================================
+ * Synchronization
+ * =============================================================================
+ * The mutex is the three-state futex lock from Drepper's "Futexes Are
+ * Tricky": 0 free, 1 locked, 2 locked and possibly waited for. Only the
+ * holder of a state-2 lock calls futex_wake() on unlock.
+ */
+
+/**
+ * Sleep on a futex word.
+ */
+int futex_wait(volatile uint32_t* addr, uint32_t val) {
+    return (int)syscall2(SYS_FUTEX_WAIT, addr, val);
+}
+
+/**
+ * Wake futex waiters.
+ */
+int futex_wake(volatile uint32_t* addr, int count) {
+    return (int)syscall2(SYS_FUTEX_WAKE, addr, count);
+}
+
+/**
+ * Initialize a mutex.
+ */
+void mutex_init(mutex_t* m) {
+    m->state = 0;
+}
+
+/**
+ * Lock a mutex.
+ */
+void mutex_lock(mutex_t* m) {
+    uint32_t c = __sync_val_compare_and_swap(&m->state, 0, 1);
+    if (c == 0) {
+        return;         /* Uncontended: no system call */
+    }
+
+    /* Mark it contended, and sleep until we are the one who freed it */
+    if (c != 2) {
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+    while (c != 0) {
+        futex_wait(&m->state, 2);
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+}
+
+/**
+ * Lock a mutex if it is free.
+ */
+int mutex_trylock(mutex_t* m) {
+    return __sync_bool_compare_and_swap(&m->state, 0, 1) ? 0 : -1;
+}
+
+/**
+ * Unlock a mutex.
+ */
+void mutex_unlock(mutex_t* m) {
+    if (__sync_fetch_and_sub(&m->state, 1) != 1) {
+        m->state = 0;
+        futex_wake(&m->state, 1);
+    }
+}
+
+/**
+ * Initialize a condition variable.
+ */
+void cond_init(cond_t* c) {
+    c->seq = 0;
+    c->waiters = 0;
+}
+
+/**
+ * Wait on a condition variable.
+ */
+void cond_wait(cond_t* c, mutex_t* m) {
+    /* Signals from here on change seq, so futex_wait() cannot miss them */
+    uint32_t seq = c->seq;
+    __sync_fetch_and_add(&c->waiters, 1);
+
+    mutex_unlock(m);
+    futex_wait(&c->seq, seq);
+    mutex_lock(m);
+
+    __sync_fetch_and_sub(&c->waiters, 1);
+}
+
+/**
+ * Wake one waiter.
+ */
+void cond_signal(cond_t* c) {
+    __sync_fetch_and_add(&c->seq, 1);
+    if (c->waiters != 0) {
+        futex_wake(&c->seq, 1);
+    }
+}
+
+/**
+ * Wake all waiters.
+ */
+void cond_broadcast(cond_t* c) {
+    __sync_fetch_and_add(&c->seq, 1);
+    if (c->waiters != 0) {
+        futex_wake(&c->seq, 0x7FFFFFFF);
+    }
+}
+
 /* =============================================================================
  * String Functions
  * =============================================================================
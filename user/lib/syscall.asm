@@ -10,7 +10,7 @@
 ;   RDX = arg3
 ;   R10 = arg4 (RCX is used by SYSCALL instruction itself)
 ;   R8  = arg5
-;   R9  = arg6 (not used in our current implementation)
+;   R9  = arg6
 ;
 ; On return:
 ;   RAX = return value
@@ -25,7 +25,7 @@
 section .text
 
 ; =============================================================================
-; syscall_raw(num, arg1, arg2, arg3, arg4, arg5)
+; syscall_raw(num, arg1, arg2, arg3, arg4, arg5, arg6)
 ; =============================================================================
 ; Low-level syscall invocation.
 ;
@@ -36,6 +36,7 @@ section .text
 ;   RCX = arg3
 ;   R8  = arg4
 ;   R9  = arg5
+;   [RSP + 8] = arg6
 ;
 ; We need to rearrange to match SYSCALL convention:
 ;   RAX = syscall number (from RDI)
@@ -44,6 +45,7 @@ section .text
 ;   RDX = arg3 (from RCX)
 ;   R10 = arg4 (from R8, because RCX is clobbered by SYSCALL)
 ;   R8  = arg5 (from R9)
+;   R9  = arg6 (from the stack)
 
 global syscall_raw
 syscall_raw:
@@ -56,6 +58,7 @@ syscall_raw:
     mov rdx, rcx        ; arg3
     mov r10, r8         ; arg4 (into R10, not RCX)
     mov r8, r9          ; arg5
+    mov r9, [rsp + 8]   ; arg6
 
     ; Invoke kernel
     syscall
@@ -14,6 +14,10 @@
  *   cd <dir>     - Change directory
  *   clear        - Clear screen
  *   exit         - Exit shell
+ *
+ * Pipelines: "a | b" runs a in a forked child with its stdout on a pipe,
+ * and b in the shell with its stdin on the other end; cat and wc read
+ * stdin when it is a pipe and no file is given.
  * =============================================================================
  */
 
@@ -27,6 +31,12 @@
 #define MAX_LINE        256     /* Maximum command line length */
 #define MAX_ARGS        16      /* Maximum number of arguments */
 #define PROMPT          "chanux> "
+#define SAVED_STDIN     10      /* Where the shell keeps its stdin during a pipeline */
+#define DMESG_SIZE      32768   /* Kernel log text retained by the kernel */
+#define SYSSTAT_MAX     64      /* Syscall numbers sysstat asks the kernel for */
+#define PROFILE_BATCH   256     /* Samples moved per profile(PROFILE_READ) */
+#define PROFILE_SLOTS   1024    /* Distinct (mode, pid, rip) profile dump merges */
+#define TRACE_BATCH     256     /* Records moved per trace(TRACE_READ) */
 
 /* VGA text mode constants for clear command */
 #define VGA_CLEAR_CHAR  ' '
@@ -42,11 +52,19 @@
 static int cmd_help(int argc, char** argv);
 static int cmd_echo(int argc, char** argv);
 static int cmd_cat(int argc, char** argv);
+static int cmd_cp(int argc, char** argv);
+static int cmd_wc(int argc, char** argv);
 static int cmd_ls(int argc, char** argv);
 static int cmd_pwd(int argc, char** argv);
 static int cmd_cd(int argc, char** argv);
 static int cmd_clear(int argc, char** argv);
 static int cmd_exit(int argc, char** argv);
+static int cmd_uptime(int argc, char** argv);
+static int cmd_sync(int argc, char** argv);
+static int cmd_dmesg(int argc, char** argv);
+static int cmd_sysstat(int argc, char** argv);
+static int cmd_profile(int argc, char** argv);
+static int cmd_trace(int argc, char** argv);
 
 /* =============================================================================
  * String Utilities
@@ -65,6 +83,14 @@ static int strcmp(const char* s1, const char* s2) {
     return *(unsigned char*)s1 - *(unsigned char*)s2;
 }
 
+/**
+ * Check whether stdin is the read end of a pipe (inside a pipeline).
+ */
+static int stdin_is_pipe(void) {
+    stat_t st;
+    return fstat(0, &st) == 0 && st.st_mode == S_IFIFO;
+}
+
 /* =============================================================================
  * Command Table
  * =============================================================================
@@ -80,11 +106,19 @@ static const command_t commands[] = {
     { "help",  "Show available commands",    cmd_help  },
     { "echo",  "Print arguments",            cmd_echo  },
     { "cat",   "Display file contents",      cmd_cat   },
+    { "cp",    "Copy a file",                cmd_cp    },
+    { "wc",    "Count lines, words, bytes",  cmd_wc    },
     { "ls",    "List directory contents",    cmd_ls    },
     { "pwd",   "Print working directory",    cmd_pwd   },
     { "cd",    "Change directory",           cmd_cd    },
     { "clear", "Clear screen",               cmd_clear },
     { "exit",  "Exit shell",                 cmd_exit  },
+    { "uptime", "Show time since boot",      cmd_uptime },
+    { "sync",  "Save filesystem to disk",    cmd_sync  },
+    { "dmesg", "Show kernel messages",       cmd_dmesg },
+    { "sysstat", "Show syscall statistics",  cmd_sysstat },
+    { "profile", "Sample where CPUs spend time", cmd_profile },
+    { "trace", "Record kernel tracepoints",  cmd_trace },
     { NULL,    NULL,                         NULL      }
 };
 
@@ -94,50 +128,32 @@ static const command_t commands[] = {
  */
 
 /**
- * Read a character from stdin with blocking.
- * Polls keyboard until a character is available.
- */
-static char getchar_blocking(void) {
-    char c;
-    while (1) {
-        ssize_t n = read(0, &c, 1);
-        if (n == 1) {
-            return c;
-        }
-        /* No input yet, yield and try again */
-        yield();
-    }
-}
-
-/**
- * Read a line from stdin with echo.
+ * Read a line from stdin.
  * Returns the number of characters read (excluding newline).
- * Supports backspace for editing.
+ * The kernel's TTY echoes and handles backspace, and read() returns once
+ * Enter is pressed; anything past max_len - 1 characters is dropped.
  */
 static int readline(char* buf, int max_len) {
     int pos = 0;
 
     while (pos < max_len - 1) {
-        char c = getchar_blocking();
-
-        if (c == '\n' || c == '\r') {
-            /* Enter pressed - end of line */
-            write(1, "\n", 1);
+        ssize_t n = read(0, buf + pos, (size_t)(max_len - 1 - pos));
+        if (n <= 0) {
+            break;
+        }
+        pos += (int)n;
+        if (buf[pos - 1] == '\n') {
+            /* End of line */
+            pos--;
             break;
-        } else if (c == 8 || c == 127) {
-            /* Backspace */
-            if (pos > 0) {
-                pos--;
-                /* Echo: backspace, space, backspace */
-                write(1, "\b \b", 3);
+        }
+        if (pos == max_len - 1) {
+            /* Line too long: skip to its end */
+            char c;
+            while (read(0, &c, 1) == 1 && c != '\n') {
+                /* Discard */
             }
-        } else if (c >= 32 && c < 127) {
-            /* Printable character */
-            buf[pos++] = c;
-            /* Echo the character */
-            write(1, &c, 1);
         }
-        /* Ignore other control characters */
     }
 
     buf[pos] = '\0';
@@ -223,6 +239,15 @@ static int cmd_echo(int argc, char** argv) {
  * cat - Display file contents
  */
 static int cmd_cat(int argc, char** argv) {
+    if (argc < 2 && stdin_is_pipe()) {
+        /* Copy the pipe to stdout until the writer is done */
+        char buf[512];
+        ssize_t n;
+        while ((n = read(0, buf, sizeof(buf))) > 0) {
+            write(1, buf, (size_t)n);
+        }
+        return n < 0 ? 1 : 0;
+    }
     if (argc < 2) {
         puts("Usage: cat <file>\n");
         return 1;
@@ -236,19 +261,175 @@ static int cmd_cat(int argc, char** argv) {
         return 1;
     }
 
-    char buf[256];
+    /* The kernel writes the file to the console directly */
+    while (sendfile(1, fd, NULL, 4096) > 0) {
+        /* Until end of file */
+    }
+
+    close(fd);
+    return 0;
+}
+
+/**
+ * cp - Copy a file
+ * Whole blocks end up shared copy-on-write by the two files.
+ */
+static int cmd_cp(int argc, char** argv) {
+    if (argc < 3) {
+        puts("Usage: cp <source> <dest>\n");
+        return 1;
+    }
+
+    int in = open(argv[1], O_RDONLY);
+    if (in < 0) {
+        puts("cp: cannot open '");
+        puts(argv[1]);
+        puts("': No such file or directory\n");
+        return 1;
+    }
+
+    int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC);
+    if (out < 0) {
+        puts("cp: cannot create '");
+        puts(argv[2]);
+        puts("'\n");
+        close(in);
+        return 1;
+    }
+
     ssize_t n;
+    while ((n = copy_file_range(in, NULL, out, NULL, 65536)) > 0) {
+        /* Until end of file */
+    }
+    if (n < 0) {
+        puts("cp: copy failed\n");
+    }
+
+    close(out);
+    close(in);
+    return n < 0 ? 1 : 0;
+}
+
+/* Running wc totals; in_word carries over between buffers */
+typedef struct {
+    uint64_t lines;
+    uint64_t words;
+    uint64_t bytes;
+    int      in_word;
+} wc_counts_t;
+
+static void wc_scan(wc_counts_t* wc, const char* data, uint64_t len) {
+    for (uint64_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\n') {
+            wc->lines++;
+        }
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            wc->in_word = 0;
+        } else if (!wc->in_word) {
+            wc->in_word = 1;
+            wc->words++;
+        }
+    }
+    wc->bytes += len;
+}
+
+static void wc_print(const wc_counts_t* wc, const char* name) {
+    print_uint(wc->lines);
+    puts(" ");
+    print_uint(wc->words);
+    puts(" ");
+    print_uint(wc->bytes);
+    if (name) {
+        puts(" ");
+        puts(name);
+    }
+    puts("\n");
+}
+
+/**
+ * wc - Count lines, words and bytes
+ * Scans the file through a read-only mapping of its pages, no read() copies.
+ */
+static int cmd_wc(int argc, char** argv) {
+    wc_counts_t wc = { 0, 0, 0, 0 };
+
+    if (argc < 2 && stdin_is_pipe()) {
+        char buf[512];
+        ssize_t n;
+        while ((n = read(0, buf, sizeof(buf))) > 0) {
+            wc_scan(&wc, buf, (uint64_t)n);
+        }
+        wc_print(&wc, NULL);
+        return n < 0 ? 1 : 0;
+    }
+    if (argc < 2) {
+        puts("Usage: wc <file>\n");
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        puts("wc: cannot open '");
+        puts(argv[1]);
+        puts("': No such file or directory\n");
+        return 1;
+    }
 
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
-        write(1, buf, n);
+    stat_t st;
+    if (fstat(fd, &st) < 0 || st.st_mode != S_IFREG) {
+        puts("wc: not a regular file\n");
+        close(fd);
+        return 1;
     }
 
+    /* Scan the file one mapping-sized window at a time */
+    for (uint64_t pos = 0; pos < st.st_size; pos += MMAP_MAX_LEN) {
+        uint64_t len = st.st_size - pos;
+        if (len > MMAP_MAX_LEN) {
+            len = MMAP_MAX_LEN;
+        }
+
+        const char* data = (const char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, (ssize_t)pos);
+        if (data == MAP_FAILED) {
+            puts("wc: cannot map file\n");
+            close(fd);
+            return 1;
+        }
+
+        wc_scan(&wc, data, len);
+        munmap((void*)data, len);
+    }
     close(fd);
+
+    wc_print(&wc, argv[1]);
     return 0;
 }
 
+/* Directory entries fetched per io_ring_submit() */
+#define LS_BATCH        16
+
+static io_ring_t ls_ring;
+static dirent_t ls_entries[LS_BATCH];
+
+static void ls_print_entry(const dirent_t* entry) {
+    /* Skip . and .. for cleaner output */
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        return;
+    }
+
+    puts(entry->d_name);
+
+    /* Add / suffix for directories */
+    if (entry->d_type == S_IFDIR) {
+        puts("/");
+    }
+    puts("  ");
+}
+
 /**
  * ls - List directory contents
+ * Reads LS_BATCH entries per kernel entry through the I/O ring.
  */
 static int cmd_ls(int argc, char** argv) {
     const char* path = (argc > 1) ? argv[1] : ".";
@@ -272,24 +453,44 @@ static int cmd_ls(int argc, char** argv) {
         return 0;
     }
 
-    /* Read directory entries */
-    dirent_t entry;
+    if (io_ring_setup(&ls_ring) < 0) {
+        puts("ls: cannot set up I/O ring\n");
+        close(fd);
+        return 1;
+    }
+
+    /* Read directory entries, one batch of readdirs per system call */
     int index = 0;
+    int done = 0;
 
-    while (readdir_r(fd, &entry, index) == 0) {
-        /* Skip . and .. for cleaner output */
-        if (strcmp(entry.d_name, ".") != 0 && strcmp(entry.d_name, "..") != 0) {
-            puts(entry.d_name);
+    while (!done) {
+        for (int i = 0; i < LS_BATCH; i++) {
+            io_sqe_t* sqe = io_ring_get_sqe(&ls_ring);
+            sqe->opcode = IO_OP_READDIR;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)&ls_entries[i];
+            sqe->off = index + i;
+            sqe->user_data = (uint64_t)i;
+        }
 
-            /* Add / suffix for directories */
-            if (entry.d_type == S_IFDIR) {
-                puts("/");
+        if (io_ring_submit(&ls_ring) < 0) {
+            break;
+        }
+
+        /* Completions arrive in order; the first failure is the end */
+        io_cqe_t cqe;
+        while (io_ring_get_cqe(&ls_ring, &cqe) == 0) {
+            if (done || cqe.res != 0) {
+                done = 1;
+                continue;
             }
-            puts("  ");
+            ls_print_entry(&ls_entries[cqe.user_data]);
         }
-        index++;
+        index += LS_BATCH;
     }
 
+    io_ring_setup(NULL);
+
     puts("\n");
     close(fd);
     return 0;
@@ -355,6 +556,356 @@ static int cmd_exit(int argc, char** argv) {
     return 0;  /* Never reached */
 }
 
+/**
+ * uptime - Show time since boot
+ */
+static int cmd_uptime(int argc, char** argv) {
+    (void)argc; (void)argv;
+
+    uint64_t ms = uptime_ms();
+    puts("up ");
+    print_uint(ms / 1000);
+    puts(".");
+    uint64_t frac = ms % 1000;
+    if (frac < 100) puts("0");
+    if (frac < 10) puts("0");
+    print_uint(frac);
+    puts(" s\n");
+
+    return 0;
+}
+
+/**
+ * sync - Save the filesystem to the snapshot disk
+ */
+static int cmd_sync(int argc, char** argv) {
+    (void)argc; (void)argv;
+
+    if (sync() < 0) {
+        puts("sync: failed (no snapshot disk, or a write error)\n");
+        return 1;
+    }
+
+    puts("Filesystem saved; it will be restored on the next boot\n");
+    return 0;
+}
+
+/**
+ * dmesg - Show the kernel log
+ */
+static int cmd_dmesg(int argc, char** argv) {
+    (void)argc; (void)argv;
+    static char buf[DMESG_SIZE];
+
+    ssize_t n = klog_read(buf, sizeof(buf));
+    if (n < 0) {
+        puts("dmesg: cannot read the kernel log\n");
+        return 1;
+    }
+
+    write(1, buf, (size_t)n);
+    return 0;
+}
+
+/* Syscall names for sysstat, by number */
+static const char* const syscall_names[] = {
+    "exit", "write", "read", "yield", "getpid", "sleep",
+    "open", "close", "lseek", "stat", "fstat", "readdir", "getcwd", "chdir",
+    "fork", "nanosleep", "io_ring_setup", "io_ring_enter",
+    "readv", "writev", "pread", "pwrite", "sendfile", "copy_file_range",
+    "mmap", "munmap", "sync", "pipe", "dup2", "futex_wait", "futex_wake",
+    "thread_create", "klog_read", "sysstat", "profile", "trace",
+};
+
+#define SYSCALL_NAMES   (sizeof(syscall_names) / sizeof(syscall_names[0]))
+
+/* Print a value right-aligned in a column of the given width */
+static void print_column(uint64_t value, int width) {
+    int digits = 1;
+    for (uint64_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    while (digits++ < width) {
+        puts(" ");
+    }
+    print_uint(value);
+}
+
+/* Upper bound (ns) of the histogram bucket holding the pct'th percentile */
+static uint64_t sysstat_percentile(const syscall_stat_t* stat, uint64_t pct) {
+    uint64_t target = (stat->calls * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < SYSSTAT_BUCKETS - 1; i++) {
+        seen += stat->hist[i];
+        if (seen >= target) {
+            return 2ULL << i;
+        }
+    }
+    return stat->max_ns;
+}
+
+/**
+ * sysstat - Show per-syscall counts and latencies
+ * p50/p99 are histogram bucket bounds, so they are rounded up to a power
+ * of two.
+ */
+static int cmd_sysstat(int argc, char** argv) {
+    (void)argc; (void)argv;
+    static syscall_stat_t stats[SYSSTAT_MAX];
+
+    int count = sysstat(stats, SYSSTAT_MAX);
+    if (count < 0) {
+        puts("sysstat: cannot read the statistics\n");
+        return 1;
+    }
+    if (count > SYSSTAT_MAX) {
+        count = SYSSTAT_MAX;
+    }
+
+    puts("syscall               calls  errors   avg ns   p50 ns   p99 ns   max ns\n");
+    for (int num = 0; num < count; num++) {
+        const syscall_stat_t* stat = &stats[num];
+        if (stat->calls == 0) {
+            continue;
+        }
+
+        const char* name = (size_t)num < SYSCALL_NAMES ? syscall_names[num] : "?";
+        puts(name);
+        for (size_t len = strlen(name); len < 16; len++) {
+            puts(" ");
+        }
+        print_column(stat->calls, 11);
+        print_column(stat->errors, 8);
+        print_column(stat->total_ns / stat->calls, 9);
+        print_column(sysstat_percentile(stat, 50), 9);
+        print_column(sysstat_percentile(stat, 99), 9);
+        print_column(stat->max_ns, 9);
+        puts("\n");
+    }
+
+    return 0;
+}
+
+/* One merged profile line: count samples at the same place */
+typedef struct {
+    uint64_t rip;
+    uint32_t pid;
+    uint32_t flags;
+    uint64_t count;             /* 0: free slot */
+} profile_slot_t;
+
+static void profile_print(uint64_t rip, uint32_t pid, uint32_t flags, uint64_t count) {
+    puts((flags & PROFILE_SAMPLE_USER) ? "PROF u " : "PROF k ");
+    print_uint(pid);
+    puts(" ");
+    print_hex(rip);
+    puts(" ");
+    print_uint(count);
+    puts("\n");
+}
+
+/**
+ * Drain the profiler, print one "PROF <k|u> <pid> <rip> <count>" line per
+ * distinct place and a "PROF-END" summary; scripts/profsym.c reads these
+ * back from the serial log.
+ */
+static int profile_dump(void) {
+    static profile_sample_t samples[PROFILE_BATCH];
+    static profile_slot_t slots[PROFILE_SLOTS];
+    memset(slots, 0, sizeof(slots));
+
+    uint64_t total = 0;
+    ssize_t n;
+    while ((n = profile(PROFILE_READ, samples, PROFILE_BATCH)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            const profile_sample_t* sample = &samples[i];
+            uint32_t slot = (uint32_t)((sample->rip ^ (sample->rip >> 12) ^
+                                        sample->pid * 0x9E3779B1u) & (PROFILE_SLOTS - 1));
+
+            /* Linear probing; with the table full, print the sample by itself */
+            uint32_t probes = 0;
+            while (slots[slot].count != 0 &&
+                   (slots[slot].rip != sample->rip || slots[slot].pid != sample->pid ||
+                    slots[slot].flags != sample->flags)) {
+                slot = (slot + 1) & (PROFILE_SLOTS - 1);
+                if (++probes == PROFILE_SLOTS) {
+                    break;
+                }
+            }
+            if (probes == PROFILE_SLOTS) {
+                profile_print(sample->rip, sample->pid, sample->flags, 1);
+                continue;
+            }
+
+            slots[slot].rip = sample->rip;
+            slots[slot].pid = sample->pid;
+            slots[slot].flags = sample->flags;
+            slots[slot].count++;
+        }
+        total += (uint64_t)n;
+    }
+    if (n < 0) {
+        puts("profile: cannot read the samples\n");
+        return 1;
+    }
+
+    for (int i = 0; i < PROFILE_SLOTS; i++) {
+        if (slots[i].count != 0) {
+            profile_print(slots[i].rip, slots[i].pid, slots[i].flags, slots[i].count);
+        }
+    }
+
+    puts("PROF-END ");
+    print_uint(total);
+    puts(" samples, ");
+    print_uint((uint64_t)profile(PROFILE_DROPPED, NULL, 0));
+    puts(" dropped\n");
+    return 0;
+}
+
+/**
+ * profile - Sampling profiler
+ * start: discard old samples and sample every tick; stop: stop sampling;
+ * dump: print (and remove) the samples taken so far.
+ */
+static int cmd_profile(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "start") == 0) {
+        if (profile(PROFILE_START, NULL, 0) < 0) {
+            puts("profile: cannot start (out of memory)\n");
+            return 1;
+        }
+        puts("Profiling; 'profile dump' prints the samples\n");
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        profile(PROFILE_STOP, NULL, 0);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        return profile_dump();
+    }
+
+    puts("Usage: profile start|stop|dump\n");
+    return 1;
+}
+
+/* Category names for trace start */
+static const struct {
+    const char* name;
+    uint32_t    mask;
+} trace_categories[] = {
+    { "sched", TRACE_SCHED },
+    { "mm",    TRACE_MM    },
+    { "vfs",   TRACE_VFS   },
+    { "irq",   TRACE_IRQ   },
+    { "all",   TRACE_ALL   },
+};
+
+#define TRACE_CATEGORIES    (sizeof(trace_categories) / sizeof(trace_categories[0]))
+
+/* Parse "sched,vfs,..." into TRACE_* bits (0 on an unknown name) */
+static uint32_t trace_parse(char* list) {
+    uint32_t mask = 0;
+
+    while (*list) {
+        char* name = list;
+        while (*list && *list != ',') {
+            list++;
+        }
+        if (*list) {
+            *list++ = '\0';
+        }
+
+        size_t i = 0;
+        while (i < TRACE_CATEGORIES && strcmp(name, trace_categories[i].name) != 0) {
+            i++;
+        }
+        if (i == TRACE_CATEGORIES) {
+            return 0;
+        }
+        mask |= trace_categories[i].mask;
+    }
+    return mask;
+}
+
+/**
+ * Stop tracing and drain the records, one "TRACE <ns> <cpu> <pid> <event>
+ * <phase> <arg0> <arg1>" line each and a "TRACE-END" summary;
+ * scripts/trace2json.c reads these back from the serial log.
+ */
+static int trace_dump(void) {
+    static trace_record_t records[TRACE_BATCH];
+
+    trace(TRACE_STOP, NULL, 0);
+
+    uint64_t total = 0;
+    ssize_t n;
+    while ((n = trace(TRACE_READ, records, TRACE_BATCH)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            const trace_record_t* rec = &records[i];
+            puts("TRACE ");
+            print_uint(rec->ts_ns);
+            puts(" ");
+            print_uint(rec->cpu);
+            puts(" ");
+            print_uint(rec->pid);
+            puts(" ");
+            print_uint(rec->event);
+            puts(" ");
+            print_uint(rec->phase);
+            puts(" ");
+            print_hex(rec->arg0);
+            puts(" ");
+            print_hex(rec->arg1);
+            puts("\n");
+        }
+        total += (uint64_t)n;
+    }
+    if (n < 0) {
+        puts("trace: cannot read the records\n");
+        return 1;
+    }
+
+    puts("TRACE-END ");
+    print_uint(total);
+    puts(" records, ");
+    print_uint((uint64_t)trace(TRACE_DROPPED, NULL, 0));
+    puts(" dropped\n");
+    return 0;
+}
+
+/**
+ * trace - Kernel tracepoints
+ * start [sched,mm,vfs,irq|all]: drop old records and trace those
+ * categories (default: all); stop: stop tracing; dump: stop and print
+ * the records.
+ */
+static int cmd_trace(int argc, char** argv) {
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "start") == 0) {
+        uint32_t mask = (argc == 3) ? trace_parse(argv[2]) : TRACE_ALL;
+        if (mask == 0) {
+            puts("trace: categories are sched, mm, vfs, irq or all\n");
+            return 1;
+        }
+        if (trace(TRACE_START, NULL, mask) < 0) {
+            puts("trace: cannot start (out of memory)\n");
+            return 1;
+        }
+        puts("Tracing; 'trace dump' prints the records\n");
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        trace(TRACE_STOP, NULL, 0);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+        return trace_dump();
+    }
+
+    puts("Usage: trace start [sched,mm,vfs,irq] | stop | dump\n");
+    return 1;
+}
+
 /* =============================================================================
  * Command Execution
  * =============================================================================
@@ -382,6 +933,70 @@ static int execute_command(int argc, char** argv) {
     return 1;
 }
 
+/**
+ * Run "left | right".
+ * The left command runs in a child whose stdout is the pipe; the right
+ * one runs here with stdin switched to the pipe, so the prompt comes
+ * back once it has read everything. The child exits on its own; when
+ * the right side stops reading early, the child's writes fail with
+ * EPIPE once the shell drops the read end.
+ */
+static int run_pipeline(char* left, char* right) {
+    char* largv[MAX_ARGS];
+    char* rargv[MAX_ARGS];
+    int largc = parse_line(left, largv, MAX_ARGS);
+    int rargc = parse_line(right, rargv, MAX_ARGS);
+    if (largc == 0 || rargc == 0) {
+        puts("syntax error near '|'\n");
+        return 1;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        puts("pipe: cannot create pipe\n");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        puts("fork failed\n");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        /* Child: keep only the write end, as stdout */
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        exit(execute_command(largc, largv));
+    }
+
+    /* Parent: drop the write end so the reader sees end of file */
+    close(fds[1]);
+    dup2(0, SAVED_STDIN);
+    dup2(fds[0], 0);
+    close(fds[0]);
+
+    int status = execute_command(rargc, rargv);
+
+    dup2(SAVED_STDIN, 0);
+    close(SAVED_STDIN);
+    return status;
+}
+
+/**
+ * Find the first '|' in a command line (there is no quoting).
+ */
+static char* find_pipe(char* line) {
+    for (char* p = line; *p; p++) {
+        if (*p == '|') {
+            return p;
+        }
+    }
+    return NULL;
+}
+
 /* =============================================================================
  * Shell Main Loop
  * =============================================================================
@@ -413,6 +1028,14 @@ void shell_main(void) {
             continue;  /* Empty line */
         }
 
+        /* Pipeline: split at the '|' */
+        char* bar = find_pipe(line);
+        if (bar) {
+            *bar = '\0';
+            run_pipeline(line, bar + 1);
+            continue;
+        }
+
         /* Parse command */
         int argc = parse_line(line, argv, MAX_ARGS);
         if (argc == 0) {